@@ -0,0 +1,399 @@
+/*
+ * Compile this file together with the UnQLite database engine source code
+ * to generate the executable. For example:
+ *  gcc -W -Wall -O2 unqlite_kv_bench.c unqlite.c -o unqlite_kv_bench
+ * The readers mode ('-r' command) needs a thread-safe build:
+ *  gcc -W -Wall -O2 -DUNQLITE_ENABLE_THREADS unqlite_kv_bench.c unqlite.c -o unqlite_kv_bench -lpthread
+*/
+/*
+ * This program compare the write throughput of the built-in disk Key/Value storage
+ * engines: The Virtual Linear Hash (named "hash", the default), the B+tree
+ * (named "btree") and the log-structured merge tree (named "lsm").
+ *
+ * For each engine, a fresh database is created and random records (Random key of
+ * length 16 + dummy data of length 100) are inserted and committed in batches.
+ * Random point lookups are then performed against the inserted keys.
+ * The elapsed time, the insertion rate and the resulting database size are reported.
+ *
+ * The storage engine is selected via [unqlite_config()] with a configuration verb
+ * set to UNQLITE_CONFIG_KV_ENGINE before the database is accessed.
+ *
+ * Typical usage of this program:
+ *
+ *  ./unqlite_kv_bench
+ *
+ * The number of records and the number of records per transaction can be changed
+ * using the '-n' and '-t' commands as follows:
+ *
+ *  ./unqlite_kv_bench -n 1000000 -t 10000
+ *
+ * A single engine can be benchmarked using the '-e' command:
+ *
+ *  ./unqlite_kv_bench -e lsm
+ *
+ * The '-r' command switch to the readers mode: Once the records are inserted, the
+ * same number of random lookups is split among 1, 2, 4 and up to the given number
+ * of threads sharing the database handle, and the aggregate lookup rate is reported
+ * for each thread count. The in-memory store (named "mem") is benchmarked too in
+ * this mode since its readers run in parallel instead of taking turns:
+ *
+ *  ./unqlite_kv_bench -r 8 -e mem
+ *
+ * For an introduction to the UnQLite C/C++ interface, please refer to:
+ *        http://unqlite.org/api_intro.html
+ * For the full C/C++ API reference guide, please refer to:
+ *        http://unqlite.org/c_api.html
+ */
+/* $SymiscID: unqlite_kv_bench.c v1.0 Unix 2018-06-09 11:40 stable <chm@symisc.net> $ */
+/*
+ * Make sure you have the latest release of UnQLite from:
+ *  http://unqlite.org/downloads.html
+ */
+#include <stdio.h>  /* puts() */
+#include <stdlib.h> /* exit() */
+#include <string.h> /* strcmp() */
+#ifdef __WINNT__
+#include <Windows.h>
+#else
+/* Assume UNIX */
+#include <sys/time.h>
+#include <pthread.h>
+#endif
+/* Make sure this header file is available.*/
+#include "unqlite.h"
+/*
+ * Banner.
+ */
+static const char zBanner[] = {
+	"============================================================\n"
+	"UnQLite Key/Value Storage Engines Benchmark                 \n"
+	"                                         http://unqlite.org/\n"
+	"============================================================\n"
+};
+/*
+ * Extract the database error log and exit.
+ */
+static void Fatal(unqlite *pDb,const char *zMsg)
+{
+	if( pDb ){
+		const char *zErr;
+		int iLen = 0; /* Stupid cc warning */
+
+		/* Extract the database error log */
+		unqlite_config(pDb,UNQLITE_CONFIG_ERR_LOG,&zErr,&iLen);
+		if( iLen > 0 ){
+			/* Output the DB error log */
+			puts(zErr); /* Always null termniated */
+		}
+	}else{
+		if( zMsg ){
+			puts(zMsg);
+		}
+	}
+	/* Manually shutdown the library */
+	unqlite_lib_shutdown();
+	/* Exit immediately */
+	exit(0);
+}
+/*
+ * Wall clock time in milliseconds.
+ */
+static double TimeNow(void)
+{
+#ifdef __WINNT__
+	return (double)GetTickCount();
+#else
+	struct timeval tv;
+	gettimeofday(&tv,0);
+	return (double)tv.tv_sec * 1000.0 + (double)tv.tv_usec / 1000.0;
+#endif
+}
+/*
+ * Generate the key of the given record.
+ * Keys are derived from a simple linear congruential generator so that every
+ * engine see the same random sequence and the lookups can regenerate them.
+ */
+static void MakeKey(unsigned int iRec,char zKey[16])
+{
+	static const char zAlpha[] = "abcdefghijklmnopqrstuvwxyz012345";
+	unsigned int x = iRec * 2654435761U + 0x9E3779B9;
+	int i;
+	for( i = 0 ; i < 16 ; ++i ){
+		x = x * 1103515245 + 12345;
+		zKey[i] = zAlpha[(x >> 16) & 31];
+	}
+}
+/*
+ * Size of the given file.
+ */
+static long FileSize(const char *zPath)
+{
+	FILE *pFile;
+	long nSize;
+	pFile = fopen(zPath,"rb");
+	if( pFile == 0 ){
+		return 0;
+	}
+	fseek(pFile,0,SEEK_END);
+	nSize = ftell(pFile);
+	fclose(pFile);
+	return nSize;
+}
+/*
+ * Open a fresh database using the given storage engine.
+ */
+static unqlite * OpenDb(const char *zEngine,const char *zPath)
+{
+	unqlite *pDb;          /* Database handle */
+	int rc;
+
+	remove(zPath);
+	/* Open our database */
+	rc = unqlite_open(&pDb,zPath,UNQLITE_OPEN_CREATE);
+	if( rc != UNQLITE_OK ){
+		Fatal(0,"Out of memory");
+	}
+	/* Select the storage engine before anything else */
+	rc = unqlite_config(pDb,UNQLITE_CONFIG_KV_ENGINE,zEngine);
+	if( rc != UNQLITE_OK ){
+		Fatal(pDb,0);
+	}
+	return pDb;
+}
+/*
+ * Insert the random records, one transaction every nTrans records.
+ */
+static void Populate(unqlite *pDb,int nRecord,int nTrans)
+{
+	char zKey[16];         /* Random key */
+	char zData[100];       /* Dummy data */
+	int i,rc;
+
+	memset(zData,'x',sizeof(zData));
+	for( i = 0 ; i < nRecord ; ++i ){
+		MakeKey((unsigned int)i,zKey);
+		rc = unqlite_kv_store(pDb,zKey,sizeof(zKey),zData,sizeof(zData));
+		if( rc == UNQLITE_OK && (i + 1) % nTrans == 0 ){
+			rc = unqlite_commit(pDb);
+		}
+		if( rc != UNQLITE_OK ){
+			Fatal(pDb,0);
+		}
+	}
+	rc = unqlite_commit(pDb);
+	if( rc != UNQLITE_OK ){
+		Fatal(pDb,0);
+	}
+}
+/*
+ * Benchmark a single storage engine.
+ */
+static void Bench(const char *zEngine,const char *zPath,int nRecord,int nTrans)
+{
+	double tStart,tInsert,tFetch;
+	unqlite *pDb;          /* Database handle */
+	char zKey[16];         /* Random key */
+	char zData[100];       /* Dummy data */
+	unqlite_int64 nData;
+	int i,rc;
+
+	pDb = OpenDb(zEngine,zPath);
+	tStart = TimeNow();
+	Populate(pDb,nRecord,nTrans);
+	tInsert = TimeNow() - tStart;
+	/* Random point lookups */
+	tStart = TimeNow();
+	for( i = 0 ; i < nRecord ; ++i ){
+		MakeKey((unsigned int)((i * 7919) % nRecord),zKey);
+		nData = sizeof(zData);
+		rc = unqlite_kv_fetch(pDb,zKey,sizeof(zKey),zData,&nData);
+		if( rc != UNQLITE_OK ){
+			Fatal(0,"Record not found");
+		}
+	}
+	tFetch = TimeNow() - tStart;
+	unqlite_close(pDb);
+	printf("%-6s insert: %9.1f ms (%9.0f rec/s)  fetch: %9.1f ms (%9.0f rec/s)  size: %ld KB\n",
+		zEngine,
+		tInsert,tInsert > 0 ? nRecord * 1000.0 / tInsert : 0.0,
+		tFetch,tFetch > 0 ? nRecord * 1000.0 / tFetch : 0.0,
+		FileSize(zPath) / 1024
+		);
+	remove(zPath);
+}
+/*
+ * Share of the random lookups performed by a single reader thread.
+ */
+typedef struct Reader Reader;
+struct Reader
+{
+	unqlite *pDb;   /* Shared database handle */
+	int nRecord;    /* Total number of records */
+	int iFirst;     /* First lookup */
+	int nLookup;    /* Number of lookups */
+	int nMiss;      /* Number of records not found */
+};
+/*
+ * Reader thread body.
+ */
+static void ReaderLoop(Reader *pReader)
+{
+	char zKey[16];
+	char zData[100];
+	unqlite_int64 nData;
+	int i,rc;
+	for( i = pReader->iFirst ; i < pReader->iFirst + pReader->nLookup ; ++i ){
+		MakeKey((unsigned int)((i * 7919) % pReader->nRecord),zKey);
+		nData = sizeof(zData);
+		rc = unqlite_kv_fetch(pReader->pDb,zKey,sizeof(zKey),zData,&nData);
+		if( rc != UNQLITE_OK ){
+			pReader->nMiss++;
+		}
+	}
+}
+#ifdef __WINNT__
+static DWORD WINAPI ReaderThread(LPVOID pArg)
+{
+	ReaderLoop((Reader *)pArg);
+	return 0;
+}
+#else
+static void * ReaderThread(void *pArg)
+{
+	ReaderLoop((Reader *)pArg);
+	return 0;
+}
+#endif
+/*
+ * Perform nRecord random lookups split among nThread threads sharing the handle
+ * and return the elapsed time in milliseconds.
+ */
+static double Readers(unqlite *pDb,int nRecord,int nThread)
+{
+#ifdef __WINNT__
+	HANDLE aThread[64];
+#else
+	pthread_t aThread[64];
+#endif
+	Reader aReader[64];
+	double tStart;
+	int i;
+
+	tStart = TimeNow();
+	for( i = 0 ; i < nThread ; ++i ){
+		aReader[i].pDb = pDb;
+		aReader[i].nRecord = nRecord;
+		aReader[i].iFirst = (int)(((unqlite_int64)nRecord * i) / nThread);
+		aReader[i].nLookup = (int)(((unqlite_int64)nRecord * (i + 1)) / nThread) - aReader[i].iFirst;
+		aReader[i].nMiss = 0;
+#ifdef __WINNT__
+		aThread[i] = CreateThread(0,0,ReaderThread,&aReader[i],0,0);
+		if( aThread[i] == 0 ){
+			Fatal(0,"Cannot create thread");
+		}
+#else
+		if( pthread_create(&aThread[i],0,ReaderThread,&aReader[i]) != 0 ){
+			Fatal(0,"Cannot create thread");
+		}
+#endif
+	}
+	for( i = 0 ; i < nThread ; ++i ){
+#ifdef __WINNT__
+		WaitForSingleObject(aThread[i],INFINITE);
+		CloseHandle(aThread[i]);
+#else
+		pthread_join(aThread[i],0);
+#endif
+		if( aReader[i].nMiss > 0 ){
+			Fatal(0,"Record not found");
+		}
+	}
+	return TimeNow() - tStart;
+}
+/*
+ * Benchmark the lookups of a single storage engine against an increasing number of
+ * reader threads.
+ */
+static void BenchReaders(const char *zEngine,const char *zPath,int nRecord,int nTrans,int nThread)
+{
+	double tFetch;
+	unqlite *pDb;          /* Database handle */
+	int n;
+
+	pDb = OpenDb(zEngine,zPath);
+	Populate(pDb,nRecord,nTrans);
+	for( n = 1 ; ; n <<= 1 ){
+		if( n > nThread ){
+			n = nThread;
+		}
+		tFetch = Readers(pDb,nRecord,n);
+		printf("%-6s %2d reader(s): %9.1f ms (%9.0f rec/s)\n",
+			zEngine,n,
+			tFetch,tFetch > 0 ? nRecord * 1000.0 / tFetch : 0.0
+			);
+		if( n >= nThread ){
+			break;
+		}
+	}
+	unqlite_close(pDb);
+	remove(zPath);
+}
+
+int main(int argc,char *argv[])
+{
+	static const char *azEngine[] = { "hash", "btree", "lsm", "mem" };
+	const char *zEngine = 0;     /* Engine to benchmark, all of them by default */
+	int nRecord = 200000;        /* Total number of records */
+	int nTrans = 1000;           /* Records per transaction */
+	int nThread = 0;             /* Maximum number of reader threads (Readers mode) */
+	int i;
+
+	/* Process arguments */
+	for(i = 1 ; i < argc ; ++i ){
+		int c;
+		if( argv[i][0] != '-' || i + 1 >= argc ){
+			continue;
+		}
+		c = argv[i][1];
+		if( c == 'n' || c == 'N' ){
+			/* Number of records */
+			nRecord = atoi(argv[++i]);
+		}else if( c == 't' || c == 'T' ){
+			/* Records per transaction */
+			nTrans = atoi(argv[++i]);
+		}else if( c == 'e' || c == 'E' ){
+			/* Single engine */
+			zEngine = argv[++i];
+		}else if( c == 'r' || c == 'R' ){
+			/* Readers mode */
+			nThread = atoi(argv[++i]);
+		}
+	}
+	if( nRecord < 1 || nTrans < 1 ){
+		Fatal(0,"Invalid record count");
+	}
+	if( nThread < 0 || nThread > 64 ){
+		Fatal(0,"Invalid number of reader threads (1 to 64)");
+	}
+	/* Initialize the library so that its threading mode can be checked */
+	unqlite_lib_init();
+	if( nThread > 0 && !unqlite_lib_is_threadsafe() ){
+		Fatal(0,"The readers mode needs a thread-safe build (UNQLITE_ENABLE_THREADS)");
+	}
+	puts(zBanner);
+	printf("%d random records, %d records per transaction\n\n",nRecord,nTrans);
+	for( i = 0 ; i < (int)(sizeof(azEngine) / sizeof(azEngine[0])) ; ++i ){
+		const char *zPath;
+		if( zEngine && strcmp(zEngine,azEngine[i]) != 0 ){
+			continue;
+		}
+		/* The in-memory store is only measured in the readers mode */
+		zPath = strcmp(azEngine[i],"mem") == 0 ? ":mem:" : "unqlite_kv_bench.db";
+		if( nThread > 0 ){
+			BenchReaders(azEngine[i],zPath,nRecord,nTrans,nThread);
+		}else if( zPath[0] != ':' ){
+			Bench(azEngine[i],zPath,nRecord,nTrans);
+		}
+	}
+	return 0;
+}
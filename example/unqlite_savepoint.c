@@ -0,0 +1,166 @@
+/*
+ * Compile this file together with the UnQLite database engine source code
+ * to generate the executable. For example:
+ *  gcc -W -Wall -O2 unqlite_savepoint.c unqlite.c -o unqlite_savepoint
+*/
+/*
+ * This program check that nested savepoints restore the database exactly as it was
+ * when they were opened for each of the built-in disk Key/Value storage engines:
+ * The Virtual Linear Hash (named "hash", the default), the B+tree (named "btree")
+ * and the log-structured merge tree (named "lsm").
+ *
+ * For each engine, a fresh database is created and a first record is committed.
+ * Two nested savepoints are then opened, a record is stored and the inner savepoint
+ * is rolled back. The same record is stored again and the outer savepoint is rolled
+ * back. After the transaction is committed and the database reopened, the committed
+ * record must still be there while the rolled back one must not.
+ *
+ * Typical usage of this program:
+ *
+ *  ./unqlite_savepoint
+ *
+ * A single engine can be checked by passing its name as the first argument:
+ *
+ *  ./unqlite_savepoint lsm
+ *
+ * The program exit with status 0 if every engine pass the check, 1 otherwise.
+ *
+ * For an introduction to the UnQLite C/C++ interface, please refer to:
+ *        http://unqlite.org/api_intro.html
+ * For the full C/C++ API reference guide, please refer to:
+ *        http://unqlite.org/c_api.html
+ */
+/*
+ * Make sure you have the latest release of UnQLite from:
+ *  http://unqlite.org/downloads.html
+ */
+#include <stdio.h>  /* printf() */
+#include <stdlib.h> /* exit() */
+#include <string.h> /* strcmp() */
+#include "unqlite.h"
+/*
+ * Database file used by the check.
+ */
+#define SAVEPOINT_DB "unqlite_savepoint.db"
+/*
+ * Remove the database file and any journal left behind by a previous run.
+ */
+static void RemoveDatabase(void)
+{
+	remove(SAVEPOINT_DB);
+	remove(SAVEPOINT_DB "_unqlite_journal");
+}
+/*
+ * Extract the database error log and print it.
+ */
+static void ReportError(unqlite *pDb,const char *zEngine,const char *zMsg)
+{
+	const char *zErr = 0;
+	int iLen = 0; /* Stupid cc warning */
+
+	printf("%s: %s\n",zEngine,zMsg);
+	if( pDb ){
+		unqlite_config(pDb,UNQLITE_CONFIG_ERR_LOG,&zErr,&iLen);
+		if( iLen > 0 ){
+			puts(zErr); /* Always null termniated */
+		}
+	}
+}
+/*
+ * Run the nested savepoint scenario against the given storage engine.
+ * Return 0 on success, 1 otherwise.
+ */
+static int CheckEngine(const char *zEngine)
+{
+	unqlite_int64 nData;
+	unqlite *pDb;
+	int iOuter,iInner;
+	char zBuf[16];
+	int rc;
+
+	RemoveDatabase();
+	rc = unqlite_open(&pDb,SAVEPOINT_DB,UNQLITE_OPEN_CREATE);
+	if( rc != UNQLITE_OK ){
+		ReportError(0,zEngine,"Cannot create the database");
+		return 1;
+	}
+	rc = unqlite_config(pDb,UNQLITE_CONFIG_KV_ENGINE,zEngine);
+	if( rc == UNQLITE_OK ){
+		/* First committed record */
+		rc = unqlite_kv_store(pDb,"committed",-1,"yes",sizeof("yes")-1);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = unqlite_commit(pDb);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Two nested savepoints */
+		rc = unqlite_savepoint_begin(pDb,&iOuter);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = unqlite_savepoint_begin(pDb,&iInner);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = unqlite_kv_store(pDb,"undone",-1,"first",sizeof("first")-1);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Undo the first store, the outer savepoint remain open */
+		rc = unqlite_savepoint_rollback(pDb,iInner);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Touch the same pages again */
+		rc = unqlite_kv_store(pDb,"undone",-1,"second",sizeof("second")-1);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Undo the second store */
+		rc = unqlite_savepoint_rollback(pDb,iOuter);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = unqlite_commit(pDb);
+	}
+	if( rc != UNQLITE_OK ){
+		ReportError(pDb,zEngine,"Savepoint scenario failed");
+		unqlite_close(pDb);
+		return 1;
+	}
+	unqlite_close(pDb);
+	/* Reopen the database and check what made it to disk */
+	rc = unqlite_open(&pDb,SAVEPOINT_DB,UNQLITE_OPEN_READONLY);
+	if( rc != UNQLITE_OK ){
+		ReportError(0,zEngine,"Cannot reopen the database");
+		return 1;
+	}
+	unqlite_config(pDb,UNQLITE_CONFIG_KV_ENGINE,zEngine);
+	nData = sizeof(zBuf);
+	rc = unqlite_kv_fetch(pDb,"committed",-1,zBuf,&nData);
+	if( rc != UNQLITE_OK ){
+		ReportError(pDb,zEngine,"Committed record lost");
+		unqlite_close(pDb);
+		return 1;
+	}
+	nData = sizeof(zBuf);
+	rc = unqlite_kv_fetch(pDb,"undone",-1,zBuf,&nData);
+	unqlite_close(pDb);
+	if( rc != UNQLITE_NOTFOUND ){
+		ReportError(0,zEngine,"Rolled back record reached the disk");
+		return 1;
+	}
+	printf("%s: ok\n",zEngine);
+	return 0;
+}
+int main(int argc,char *argv[])
+{
+	static const char *azEngine[] = { "hash", "btree", "lsm" };
+	int nFail = 0;
+	int i;
+
+	for( i = 0 ; i < (int)(sizeof(azEngine)/sizeof(azEngine[0])) ; ++i ){
+		if( argc > 1 && strcmp(argv[1],azEngine[i]) != 0 ){
+			continue;
+		}
+		nFail += CheckEngine(azEngine[i]);
+	}
+	RemoveDatabase();
+	/* Manually shutdown the library */
+	unqlite_lib_shutdown();
+	exit(nFail > 0 ? 1 : 0);
+}
@@ -20,6 +20,7 @@
  */
 #define UNQLITE_DB_MISUSE(DB) (DB == 0 || DB->nMagic != UNQLITE_DB_MAGIC)
 #define UNQLITE_VM_MISUSE(VM) (VM == 0 || VM->nMagic == JX9_VM_STALE)
+#define UNQLITE_SHARD_MISUSE(SHARD) (SHARD == 0 || SHARD->nMagic != UNQLITE_SHARD_MAGIC)
 /* If another thread have released a working instance, the following macros
  * evaluates to true. These macros are only used when the library
  * is built with threading support enabled.
@@ -52,7 +53,11 @@ static struct unqlGlobal_Data
 	unqlite *pDB;                          /* List of active DB handles */
 	sxu32 nMagic;                          /* Sanity check against library misuse */
 }sUnqlMPGlobal = {
-	{0, 0, 0, 0, 0, 0, 0, 0, {0}}, 
+	{0, 0, 0, 0, 0, 0, 0, 0, {0}, 0, 0, 0
+#if defined(SXMEM_POOL_CACHE)
+	, 0
+#endif
+	}, 
 #if defined(UNQLITE_ENABLE_THREADS)
 	0, 
 	0, 
@@ -81,6 +86,31 @@ static struct unqlGlobal_Data
  */
 #define UNQLITE_THREAD_LEVEL_SINGLE 1 
 #define UNQLITE_THREAD_LEVEL_MULTI  2
+#if defined(UNQLITE_ENABLE_THREADS)
+/*
+ * Acquire the database handle on behalf of an interface that may modify it.
+ * The recursive handle mutex is taken first, then the reader/writer lock exclusively
+ * so that threads reading through unqliteKvSharedEngine() are drained.
+ * Readers must never wait on the handle mutex while holding the shared lock.
+ */
+static void unqliteDbEnter(unqlite *pDb)
+{
+	SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	if( pDb->pRWLock ){
+		SyRWLockExclusive(pDb->pRWLock);
+	}
+}
+/*
+ * Release a database handle acquired by unqliteDbEnter().
+ */
+static void unqliteDbLeave(unqlite *pDb)
+{
+	if( pDb->pRWLock ){
+		SyRWLockExclusiveLeave(pDb->pRWLock);
+	}
+	SyMutexLeave(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+}
+#endif
 /*
  * Find a Key Value storage engine from the set of installed engines.
  * Return a pointer to the storage engine methods on success. NULL on failure.
@@ -347,6 +377,21 @@ static sxi32 unqliteCoreInitialize(void)
 		/* Default disk key/value storage engine */
 		pMethods = unqliteExportDiskKvStorage(); /* Disk storage */
 		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
+		/* Ordered disk key/value storage engine */
+		pMethods = unqliteExportBtreeKvStorage(); /* B+tree storage */
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
+		/* Log-structured merge storage engine */
+		pMethods = unqliteExportLsmKvStorage(); /* LSM storage */
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
+		/* Ordered in-memory key/value storage engine */
+		pMethods = unqliteExportArtKvStorage(); /* Adaptive radix tree */
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
+		/* Concurrent in-memory key/value storage engine */
+		pMethods = unqliteExportShardKvStorage(); /* Sharded hash tables */
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
+		/* Read-only sorted table storage engine */
+		pMethods = unqliteExportSstKvStorage(); /* Immutable sorted table */
+		unqlite_lib_config(UNQLITE_LIB_CONFIG_STORAGE_ENGINE,pMethods);
 		/* Default page size */
 		if( sUnqlMPGlobal.iPageSize < UNQLITE_MIN_PAGE_SIZE ){
 			unqlite_lib_config(UNQLITE_LIB_CONFIG_PAGE_SIZE,UNQLITE_DEFAULT_PAGE_SIZE);
@@ -387,6 +432,8 @@ static int unqliteDbRelease(unqlite *pDb)
 	}
 	/* Close the pager */
 	unqlitePagerClose(pStore->pPager);
+	/* Release the expiration index */
+	unqliteKvTtlReset(pDb);
 	/* Release any active VM's */
 	pVm = pDb->pVms;
 	for(;;){
@@ -405,6 +452,7 @@ static int unqliteDbRelease(unqlite *pDb)
 	pDb->nMagic = 0x7250;
 	/* Release the whole memory subsystem */
 	SyMemBackendRelease(&pDb->sMem);
+	SyMemAccountRelease(&pDb->sAccount);
 	/* Commit or rollback result */
 	return rc;
 }
@@ -422,12 +470,17 @@ static void unqliteCoreShutdown(void)
 			break;
 		}
 		pNext = pDb->pNext;
+		unqliteAsyncRelease(pDb);
 		unqliteDbRelease(pDb); 
 		pDb = pNext;
 		sUnqlMPGlobal.nDB--;
 	}
 	/* Release the storage methods container */
 	SySetRelease(&sUnqlMPGlobal.kv_storage);
+	if( sUnqlMPGlobal.sAllocator.pMethods ){
+		/* Release the memory backend before the mutex subsystem */
+		SyMemBackendRelease(&sUnqlMPGlobal.sAllocator);
+	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	/* Release the mutex subsystem */
 	if( sUnqlMPGlobal.pMutexMethods ){
@@ -442,10 +495,6 @@ static void unqliteCoreShutdown(void)
 	}
 	sUnqlMPGlobal.nThreadingLevel = 0;
 #endif
-	if( sUnqlMPGlobal.sAllocator.pMethods ){
-		/* Release the memory backend */
-		SyMemBackendRelease(&sUnqlMPGlobal.sAllocator);
-	}
 	sUnqlMPGlobal.nMagic = 0x1764;
 	/* Finally, shutdown the Jx9 library */
 	jx9_lib_shutdown();
@@ -572,6 +621,12 @@ static int unqliteInitDatabase(
 	int rc;
 	/* Initialiaze the memory subsystem */
 	SyMemBackendInitFromParent(&pDB->sMem,pParent);
+	/* Charge everything allocated on behalf of this handle to its memory account */
+	rc = SyMemAccountInit(&pDB->sAccount,pDB->sMem.pMutexMethods);
+	if( rc != SXRET_OK ){
+		return UNQLITE_NOMEM;
+	}
+	SyMemBackendSetAccount(&pDB->sMem,&pDB->sAccount);
 //#if defined(UNQLITE_ENABLE_THREADS)
 //	/* No need for internal mutexes */
 //	SyMemBackendDisbaleMutexing(&pDB->sMem);
@@ -589,6 +644,8 @@ static int unqliteInitDatabase(
 	if( rc != JX9_OK ){
 		return rc;
 	}
+	/* Jx9 programs compiled and executed via this handle are charged to it */
+	SyMemBackendSetAccount(&pStorage->pJx9->sAllocator,&pDB->sAccount);
 	return UNQLITE_OK;
 }
 /*
@@ -680,6 +737,23 @@ UNQLITE_PRIVATE int unqliteGenError(unqlite *pDb,const char *zErr)
 	SyBlobAppend(&pDb->sErr,(const void *)"\n",sizeof(char));
 	return rc;
 }
+/*
+ * Generate an error message from a code path that may not hold the database
+ * handle mutex (i.e. UNQLITE_KV_CONCURRENT storage engines).
+ * The handle mutex is recursive so this is also safe when it is already held.
+ */
+UNQLITE_PRIVATE int unqliteGenErrorLocked(unqlite *pDb,const char *zErr)
+{
+	int rc;
+#if defined(UNQLITE_ENABLE_THREADS)
+	SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	rc = unqliteGenError(pDb,zErr);
+#if defined(UNQLITE_ENABLE_THREADS)
+	SyMutexLeave(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
 /*
  * Generate an error message (Printf like).
  */
@@ -746,6 +820,25 @@ static int unqliteConfigure(unqlite *pDb,int nOp,va_list ap)
 		pDb->iFlags |= UNQLITE_FL_DISABLE_AUTO_COMMIT;
 		break;
 											}
+	case UNQLITE_CONFIG_KV_ENGINE: {
+		/* Select the underlying KV storage engine */
+		const char *zName = va_arg(ap,const char *);
+		unqlite_kv_methods *pMethods;
+		sxu32 nByte;
+		if( zName == 0 ){
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		nByte = SyStrlen(zName);
+		pMethods = unqliteFindKVStore(zName,nByte);
+		if( pMethods == 0 ){
+			unqliteGenErrorFormat(pDb,"No such Key/Value storage engine '%s'",zName);
+			rc = UNQLITE_NOTIMPLEMENTED;
+			break;
+		}
+		rc = unqlitePagerSelectKvEngine(pDb->sDB.pPager,pMethods);
+		break;
+								   }
 	case UNQLITE_CONFIG_GET_KV_NAME: {
 		/* Name of the underlying KV storage engine */
 		const char **pzPtr = va_arg(ap,const char **);
@@ -757,6 +850,54 @@ static int unqliteConfigure(unqlite *pDb,int nOp,va_list ap)
 		}
 		break;
 									 }
+	case UNQLITE_CONFIG_MEM_USAGE: {
+		/* Bytes currently allocated on behalf of this handle and the highest value reached */
+		unqlite_int64 *pUsed = va_arg(ap,unqlite_int64 *);
+		unqlite_int64 *pPeak = va_arg(ap,unqlite_int64 *);
+		sxu64 nUsed,nPeak;
+		SyMemAccountUsage(&pDb->sAccount,&nUsed,&nPeak);
+		if( pUsed ){
+			*pUsed = (unqlite_int64)nUsed;
+		}
+		if( pPeak ){
+			*pPeak = (unqlite_int64)nPeak;
+		}
+		break;
+								   }
+	case UNQLITE_CONFIG_MEM_LIMIT: {
+		/* Soft and hard memory limits (Zero or negative for no limit) */
+		unqlite_int64 iSoft = va_arg(ap,unqlite_int64);
+		unqlite_int64 iHard = va_arg(ap,unqlite_int64);
+		if( iSoft < 0 ){
+			iSoft = 0;
+		}
+		if( iHard < 0 ){
+			iHard = 0;
+		}
+		if( iHard > 0 && iSoft > iHard ){
+			unqliteGenError(pDb,"Soft memory limit greater than the hard limit");
+			rc = UNQLITE_INVALID;
+			break;
+		}
+		SyMemAccountSetLimit(&pDb->sAccount,(sxu64)iSoft,(sxu64)iHard);
+		break;
+								   }
+	case UNQLITE_CONFIG_ASYNC_WORKERS: {
+		/* Maximum number of worker threads of the asynchronous interfaces */
+		int nWorker = va_arg(ap,int);
+		if( nWorker < 1 ){
+			rc = UNQLITE_INVALID;
+			break;
+		}
+		rc = unqliteAsyncConfig(pDb,nWorker,-1,0);
+		break;
+									   }
+	case UNQLITE_CONFIG_ASYNC_NOTIFY: {
+		/* Descriptor signaled after each asynchronous completion (Negative to disable) */
+		int iFd = va_arg(ap,int);
+		rc = unqliteAsyncConfig(pDb,0,iFd,1);
+		break;
+									  }
 	default:
 		/* Unknown configuration option */
 		rc = UNQLITE_UNKNOWN;
@@ -814,6 +955,8 @@ int unqlite_open(unqlite **ppDB,const char *zFilename,unsigned int iMode)
 			 rc = UNQLITE_NOMEM;
 			 goto Release;
 		 }
+		 /* Let readers share the handle when the platform support reader/writer locks */
+		 pHandle->pRWLock = SyRWLockNew();
 	 }
 #endif
 	/* Link to the list of active DB handles */
@@ -833,7 +976,12 @@ int unqlite_open(unqlite **ppDB,const char *zFilename,unsigned int iMode)
 	*ppDB = pHandle;
 	return UNQLITE_OK;
 Release:
+	if( pHandle->sDB.pJx9 ){
+		/* The Jx9 engine is charged to the account released below */
+		jx9_release(pHandle->sDB.pJx9);
+	}
 	SyMemBackendRelease(&pHandle->sMem);
+	SyMemAccountRelease(&pHandle->sAccount);
 	SyMemBackendPoolFree(&sUnqlMPGlobal.sAllocator,pHandle);
 	return rc;
 }
@@ -850,7 +998,7 @@ int unqlite_config(unqlite *pDb,int nConfigOp,...)
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -861,7 +1009,7 @@ int unqlite_config(unqlite *pDb,int nConfigOp,...)
 	 va_end(ap);
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -875,9 +1023,11 @@ int unqlite_close(unqlite *pDb)
 	if( UNQLITE_DB_MISUSE(pDb) ){
 		return UNQLITE_CORRUPT;
 	}
+	/* Run the queued asynchronous requests and stop the workers */
+	unqliteAsyncRelease(pDb);
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -887,9 +1037,12 @@ int unqlite_close(unqlite *pDb)
 	rc = unqliteDbRelease(pDb);
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 /* Release DB mutex */
 	 SyMutexRelease(sUnqlMPGlobal.pMutexMethods, pDb->pMutex) /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( pDb->pRWLock ){
+		 SyRWLockRelease(pDb->pRWLock);
+	 }
 #endif
 #if defined(UNQLITE_ENABLE_THREADS)
 	/* Enter the global mutex */
@@ -919,7 +1072,7 @@ int unqlite_compile(unqlite *pDb,const char *zJx9,int nByte,unqlite_vm **ppOut)
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT;
@@ -937,7 +1090,7 @@ int unqlite_compile(unqlite *pDb,const char *zJx9,int nByte,unqlite_vm **ppOut)
 	 }
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -954,7 +1107,7 @@ int unqlite_compile_file(unqlite *pDb,const char *zPath,unqlite_vm **ppOut)
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT;
@@ -972,7 +1125,7 @@ int unqlite_compile_file(unqlite *pDb,const char *zPath,unqlite_vm **ppOut)
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -1070,7 +1223,7 @@ int unqlite_vm_release(unqlite_vm *pVm)
 		 /* Unlink from the list of active VM's */
 #if defined(UNQLITE_ENABLE_THREADS)
 			/* Acquire DB mutex */
-			SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+			unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 			if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 				UNQLITE_THRD_DB_RELEASE(pDb) ){
 					return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -1082,7 +1235,7 @@ int unqlite_vm_release(unqlite_vm *pVm)
 		SyMemBackendPoolFree(&pDb->sMem,pVm);
 #if defined(UNQLITE_ENABLE_THREADS)
 			/* Leave DB mutex */
-			SyMutexLeave(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+			unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	 }
 	 return rc;
@@ -1890,6 +2043,137 @@ void unqlite_context_free_chunk(unqlite_context *pCtx,void *pChunk)
 {
 	jx9_context_free_chunk(pCtx,pChunk);
 }
+/*
+ * The following routines implement the unqlite_kv_store(), unqlite_kv_append(),
+ * unqlite_kv_fetch(), unqlite_kv_fetch_callback() and unqlite_kv_delete() interfaces
+ * for storage engines that serialize their own operations (UNQLITE_KV_CONCURRENT).
+ * The database handle mutex is not held, so threads sharing the same in-memory
+ * database handle run in parallel. No cursor is used either. Such engines never
+ * hold expiring records (See unqliteKvTtlStore()) so no expiration check is due.
+ */
+static int unqliteKvConcurrentWrite(
+	unqlite *pDb,unqlite_kv_engine *pEngine,
+	const void *pKey,int nKeyLen,
+	const void *pData,unqlite_int64 nDataLen,
+	int bAppend
+	)
+{
+	const unqlite_kv_methods *pMethods = pEngine->pIo->pMethods;
+	if( nKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nKeyLen = SyStrlen((const char *)pKey);
+	}
+	if( !nKeyLen ){
+		unqliteGenErrorLocked(pDb,"Empty key");
+		return UNQLITE_EMPTY;
+	}
+	if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+		unqliteGenErrorLocked(pDb,"Reserved key");
+		return UNQLITE_PERM;
+	}
+	/* Perform the requested operation */
+	if( bAppend ){
+		return pMethods->xAppend(pEngine,pKey,nKeyLen,pData,nDataLen);
+	}
+	return pMethods->xReplace(pEngine,pKey,nKeyLen,pData,nDataLen);
+}
+static int unqliteKvConcurrentFetch(
+	unqlite *pDb,unqlite_kv_engine *pEngine,
+	const void *pKey,int nKeyLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData
+	)
+{
+	if( nKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nKeyLen = SyStrlen((const char *)pKey);
+	}
+	if( !nKeyLen ){
+		unqliteGenErrorLocked(pDb,"Empty key");
+		return UNQLITE_EMPTY;
+	}
+	/* Consume the data directly */
+	return pEngine->pIo->pMethods->xFetch(pEngine,pKey,nKeyLen,xConsumer,pUserData);
+}
+static int unqliteKvConcurrentDelete(unqlite *pDb,unqlite_kv_engine *pEngine,const void *pKey,int nKeyLen)
+{
+	if( nKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nKeyLen = SyStrlen((const char *)pKey);
+	}
+	if( !nKeyLen ){
+		unqliteGenErrorLocked(pDb,"Empty key");
+		return UNQLITE_EMPTY;
+	}
+	if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+		unqliteGenErrorLocked(pDb,"Reserved key");
+		return UNQLITE_PERM;
+	}
+	return pEngine->pIo->pMethods->xRemove(pEngine,pKey,nKeyLen);
+}
+/*
+ * Data length consumer.
+ */
+static int unqliteKvLengthConsumer(const void *pOut,unsigned int nLen,void *pUserData)
+{
+	(void)pOut; /* cc warning */
+	*(unqlite_int64 *)pUserData += nLen;
+	return UNQLITE_OK;
+}
+#if defined(UNQLITE_ENABLE_THREADS)
+/*
+ * Hold the database handle shared with other readers and return the underlying
+ * storage engine if its lookups can run in parallel (UNQLITE_KV_SHARED_READ).
+ * Otherwise return NULL without holding anything, in which case the caller
+ * must acquire the handle exclusively via unqliteDbEnter().
+ * The shared hold is released via SyRWLockSharedLeave(). No error is logged and
+ * nothing is allocated from the handle while the hold is in place.
+ */
+static unqlite_kv_engine * unqliteKvSharedEngine(unqlite *pDb)
+{
+	unqlite_kv_engine *pEngine;
+	if( pDb->pRWLock == 0 || SyRWLockOwned(pDb->pRWLock) ){
+		/* No reader/writer lock or invoked from a writer callback */
+		return 0;
+	}
+	SyRWLockShared(pDb->pRWLock);
+	pEngine = unqlitePagerGetSharedReadKvEngine(pDb);
+	if( pEngine == 0 || !unqliteKvTtlIdle(pDb) ){
+		/* Lookups may modify the database */
+		SyRWLockSharedLeave(pDb->pRWLock);
+		return 0;
+	}
+	return pEngine;
+}
+/*
+ * Copy the data of a given record to the supplied buffer (or compute its length
+ * only if the buffer is NULL) using the storage engine xFetch() method.
+ */
+static int unqliteKvSharedFetch(
+	unqlite_kv_engine *pEngine,
+	const void *pKey,int nKeyLen,
+	void *pBuf,unqlite_int64 *pBufLen
+	)
+{
+	SyBlob sBlob;
+	int rc;
+	if( pBuf == 0 ){
+		/* Data length only */
+		*pBufLen = 0;
+		return pEngine->pIo->pMethods->xFetch(pEngine,pKey,nKeyLen,unqliteKvLengthConsumer,pBufLen);
+	}
+	/* Initialize the data consumer */
+	SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)*pBufLen);
+	/* Consume the data */
+	rc = pEngine->pIo->pMethods->xFetch(pEngine,pKey,nKeyLen,unqliteDataConsumer,&sBlob);
+	if( rc == UNQLITE_OK ){
+		/* Data length */
+		*pBufLen = (unqlite_int64)SyBlobLength(&sBlob);
+	}
+	/* Cleanup */
+	SyBlobRelease(&sBlob);
+	return rc;
+}
+#endif
 /*
  * [CAPIREF: unqlite_kv_store()]
  * Please refer to the official documentation for function purpose and expected parameters.
@@ -1901,9 +2185,14 @@ int unqlite_kv_store(unqlite *pDb,const void *pKey,int nKeyLen,const void *pData
 	if( UNQLITE_DB_MISUSE(pDb) ){
 		return UNQLITE_CORRUPT;
 	}
+	pEngine = unqlitePagerGetConcurrentKvEngine(pDb);
+	if( pEngine ){
+		/* The storage engine serialize its own operations */
+		return unqliteKvConcurrentWrite(pDb,pEngine,pKey,nKeyLen,pData,nDataLen,0);
+	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -1923,14 +2212,21 @@ int unqlite_kv_store(unqlite *pDb,const void *pKey,int nKeyLen,const void *pData
 		 if( !nKeyLen ){
 			 unqliteGenError(pDb,"Empty key");
 			 rc = UNQLITE_EMPTY;
+		 }else if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+			 unqliteGenError(pDb,"Reserved key");
+			 rc = UNQLITE_PERM;
 		 }else{
-			 /* Perform the requested operation */
-			 rc = pEngine->pIo->pMethods->xReplace(pEngine,pKey,nKeyLen,pData,nDataLen);
+			 /* The new record does not expire */
+			 rc = unqliteKvTtlClear(pDb,pKey,(sxu32)nKeyLen);
+			 if( rc == UNQLITE_OK ){
+				 /* Perform the requested operation */
+				 rc = pEngine->pIo->pMethods->xReplace(pEngine,pKey,nKeyLen,pData,nDataLen);
+			 }
 		 }
 	 }
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -1947,7 +2243,7 @@ int unqlite_kv_store_fmt(unqlite *pDb,const void *pKey,int nKeyLen,const char *z
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -1967,6 +2263,9 @@ int unqlite_kv_store_fmt(unqlite *pDb,const void *pKey,int nKeyLen,const char *z
 		 if( !nKeyLen ){
 			 unqliteGenError(pDb,"Empty key");
 			 rc = UNQLITE_EMPTY;
+		 }else if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+			 unqliteGenError(pDb,"Reserved key");
+			 rc = UNQLITE_PERM;
 		 }else{
 			 SyBlob sWorker; /* Working buffer */
 			 va_list ap;
@@ -1975,15 +2274,19 @@ int unqlite_kv_store_fmt(unqlite *pDb,const void *pKey,int nKeyLen,const char *z
 			 va_start(ap,zFormat);
 			 SyBlobFormatAp(&sWorker,zFormat,ap);
 			 va_end(ap);
-			 /* Perform the requested operation */
-			 rc = pEngine->pIo->pMethods->xReplace(pEngine,pKey,nKeyLen,SyBlobData(&sWorker),SyBlobLength(&sWorker));
+			 /* The new record does not expire */
+			 rc = unqliteKvTtlClear(pDb,pKey,(sxu32)nKeyLen);
+			 if( rc == UNQLITE_OK ){
+				 /* Perform the requested operation */
+				 rc = pEngine->pIo->pMethods->xReplace(pEngine,pKey,nKeyLen,SyBlobData(&sWorker),SyBlobLength(&sWorker));
+			 }
 			 /* Clean up */
 			 SyBlobRelease(&sWorker);
 		 }
 	 }
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -1998,9 +2301,14 @@ int unqlite_kv_append(unqlite *pDb,const void *pKey,int nKeyLen,const void *pDat
 	if( UNQLITE_DB_MISUSE(pDb) ){
 		return UNQLITE_CORRUPT;
 	}
+	pEngine = unqlitePagerGetConcurrentKvEngine(pDb);
+	if( pEngine ){
+		/* The storage engine serialize its own operations */
+		return unqliteKvConcurrentWrite(pDb,pEngine,pKey,nKeyLen,pData,nDataLen,1);
+	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -2020,14 +2328,21 @@ int unqlite_kv_append(unqlite *pDb,const void *pKey,int nKeyLen,const void *pDat
 		 if( !nKeyLen ){
 			 unqliteGenError(pDb,"Empty key");
 			 rc = UNQLITE_EMPTY;
+		 }else if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+			 unqliteGenError(pDb,"Reserved key");
+			 rc = UNQLITE_PERM;
 		 }else{
-			 /* Perform the requested operation */
-			 rc = pEngine->pIo->pMethods->xAppend(pEngine,pKey,nKeyLen,pData,nDataLen);
+			 /* An expired record is dropped before appending, otherwise its expiration time is kept */
+			 rc = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen);
+			 if( rc == UNQLITE_OK || rc == UNQLITE_NOTFOUND ){
+				 /* Perform the requested operation */
+				 rc = pEngine->pIo->pMethods->xAppend(pEngine,pKey,nKeyLen,pData,nDataLen);
+			 }
 		 }
 	 }
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -2044,7 +2359,7 @@ int unqlite_kv_append_fmt(unqlite *pDb,const void *pKey,int nKeyLen,const char *
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -2064,6 +2379,9 @@ int unqlite_kv_append_fmt(unqlite *pDb,const void *pKey,int nKeyLen,const char *
 		 if( !nKeyLen ){
 			 unqliteGenError(pDb,"Empty key");
 			 rc = UNQLITE_EMPTY;
+		 }else if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+			 unqliteGenError(pDb,"Reserved key");
+			 rc = UNQLITE_PERM;
 		 }else{
 			 SyBlob sWorker; /* Working buffer */
 			 va_list ap;
@@ -2072,15 +2390,19 @@ int unqlite_kv_append_fmt(unqlite *pDb,const void *pKey,int nKeyLen,const char *
 			 va_start(ap,zFormat);
 			 SyBlobFormatAp(&sWorker,zFormat,ap);
 			 va_end(ap);
-			 /* Perform the requested operation */
-			 rc = pEngine->pIo->pMethods->xAppend(pEngine,pKey,nKeyLen,SyBlobData(&sWorker),SyBlobLength(&sWorker));
+			 /* An expired record is dropped before appending, otherwise its expiration time is kept */
+			 rc = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen);
+			 if( rc == UNQLITE_OK || rc == UNQLITE_NOTFOUND ){
+				 /* Perform the requested operation */
+				 rc = pEngine->pIo->pMethods->xAppend(pEngine,pKey,nKeyLen,SyBlobData(&sWorker),SyBlobLength(&sWorker));
+			 }
 			 /* Clean up */
 			 SyBlobRelease(&sWorker);
 		 }
 	 }
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -2097,9 +2419,42 @@ int unqlite_kv_fetch(unqlite *pDb,const void *pKey,int nKeyLen,void *pBuf,unqlit
 	if( UNQLITE_DB_MISUSE(pDb) ){
 		return UNQLITE_CORRUPT;
 	}
+	pEngine = unqlitePagerGetConcurrentKvEngine(pDb);
+	if( pEngine ){
+		/* The storage engine serialize its own operations */
+		if( pBuf == 0 ){
+			/* Data length only */
+			*pBufLen = 0;
+			return unqliteKvConcurrentFetch(pDb,pEngine,pKey,nKeyLen,unqliteKvLengthConsumer,pBufLen);
+		}else{
+			SyBlob sBlob;
+			/* Initialize the data consumer */
+			SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)*pBufLen);
+			/* Consume the data */
+			rc = unqliteKvConcurrentFetch(pDb,pEngine,pKey,nKeyLen,unqliteDataConsumer,&sBlob);
+			if( rc == UNQLITE_OK ){
+				/* Data length */
+				*pBufLen = (unqlite_int64)SyBlobLength(&sBlob);
+			}
+			/* Cleanup */
+			SyBlobRelease(&sBlob);
+			return rc;
+		}
+	}
 #if defined(UNQLITE_ENABLE_THREADS)
+	if( nKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nKeyLen = SyStrlen((const char *)pKey);
+	}
+	pEngine = nKeyLen > 0 ? unqliteKvSharedEngine(pDb) : 0;
+	if( pEngine ){
+		/* Lookup in parallel with other readers */
+		rc = unqliteKvSharedFetch(pEngine,pKey,nKeyLen,pBuf,pBufLen);
+		SyRWLockSharedLeave(pDb->pRWLock);
+		return rc;
+	}
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -2108,7 +2463,11 @@ int unqlite_kv_fetch(unqlite *pDb,const void *pKey,int nKeyLen,void *pBuf,unqlit
 	 /* Point to the underlying storage engine */
 	 pEngine = unqlitePagerGetKvEngine(pDb);
 	 pMethods = pEngine->pIo->pMethods;
-	 pCur = pDb->sDB.pCursor;
+	 /* Borrow a cursor from the pool */
+	 rc = unqliteBorrowCursor(pDb,&pCur);
+	 if( rc != UNQLITE_OK ){
+		 goto leave;
+	 }
 	 if( nKeyLen < 0 ){
 		 /* Assume a null terminated string and compute it's length */
 		 nKeyLen = SyStrlen((const char *)pKey);
@@ -2117,8 +2476,12 @@ int unqlite_kv_fetch(unqlite *pDb,const void *pKey,int nKeyLen,void *pBuf,unqlit
 		  unqliteGenError(pDb,"Empty key");
 		  rc = UNQLITE_EMPTY;
 	 }else{
-		  /* Seek to the record position */
-		  rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		  /* Drop the record if its expiration time is reached */
+		  rc = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen);
+		  if( rc == UNQLITE_OK ){
+		  	/* Seek to the record position */
+		  	rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		  }
 	 }
 	 if( rc == UNQLITE_OK ){
 		 if( pBuf == 0 ){
@@ -2136,9 +2499,11 @@ int unqlite_kv_fetch(unqlite *pDb,const void *pKey,int nKeyLen,void *pBuf,unqlit
 			 SyBlobRelease(&sBlob);
 		 }
 	 }
+	 unqliteReturnCursor(pDb,pCur);
+leave:
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
@@ -2155,9 +2520,14 @@ int unqlite_kv_fetch_callback(unqlite *pDb,const void *pKey,int nKeyLen,int (*xC
 	if( UNQLITE_DB_MISUSE(pDb) ){
 		return UNQLITE_CORRUPT;
 	}
+	pEngine = unqlitePagerGetConcurrentKvEngine(pDb);
+	if( pEngine ){
+		/* The storage engine serialize its own operations */
+		return unqliteKvConcurrentFetch(pDb,pEngine,pKey,nKeyLen,xConsumer,pUserData);
+	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -2166,7 +2536,11 @@ int unqlite_kv_fetch_callback(unqlite *pDb,const void *pKey,int nKeyLen,int (*xC
 	 /* Point to the underlying storage engine */
 	 pEngine = unqlitePagerGetKvEngine(pDb);
 	 pMethods = pEngine->pIo->pMethods;
-	 pCur = pDb->sDB.pCursor;
+	 /* Borrow a cursor from the pool */
+	 rc = unqliteBorrowCursor(pDb,&pCur);
+	 if( rc != UNQLITE_OK ){
+		 goto leave;
+	 }
 	 if( nKeyLen < 0 ){
 		 /* Assume a null terminated string and compute it's length */
 		 nKeyLen = SyStrlen((const char *)pKey);
@@ -2175,35 +2549,43 @@ int unqlite_kv_fetch_callback(unqlite *pDb,const void *pKey,int nKeyLen,int (*xC
 		 unqliteGenError(pDb,"Empty key");
 		 rc = UNQLITE_EMPTY;
 	 }else{
-		 /* Seek to the record position */
-		 rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		 /* Drop the record if its expiration time is reached */
+		 rc = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen);
+		 if( rc == UNQLITE_OK ){
+		 	/* Seek to the record position */
+		 	rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		 }
 	 }
 	 if( rc == UNQLITE_OK && xConsumer ){
 		 /* Consume the data directly */
 		 rc = pMethods->xData(pCur,xConsumer,pUserData);	 
 	 }
+	 unqliteReturnCursor(pDb,pCur);
+leave:
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
 /*
- * [CAPIREF: unqlite_kv_delete()]
+ * [CAPIREF: unqlite_kv_fetch_ref()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_delete(unqlite *pDb,const void *pKey,int nKeyLen)
+int unqlite_kv_fetch_ref(unqlite *pDb,const void *pKey,int nKeyLen,const void **ppData,unqlite_int64 *pDataLen,unqlite_kv_ref **ppRef)
 {
 	unqlite_kv_methods *pMethods;
 	unqlite_kv_engine *pEngine;
 	unqlite_kv_cursor *pCur;
+	unqlite_kv_ref *pRef;
 	int rc;
-	if( UNQLITE_DB_MISUSE(pDb) ){
+	if( UNQLITE_DB_MISUSE(pDb) || ppData == 0 || pDataLen == 0 || ppRef == 0 ){
 		return UNQLITE_CORRUPT;
 	}
+	*ppRef = 0;
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -2212,377 +2594,1966 @@ int unqlite_kv_delete(unqlite *pDb,const void *pKey,int nKeyLen)
 	 /* Point to the underlying storage engine */
 	 pEngine = unqlitePagerGetKvEngine(pDb);
 	 pMethods = pEngine->pIo->pMethods;
-	 pCur = pDb->sDB.pCursor;
-	 if( pMethods->xDelete == 0 ){
-		 /* Storage engine does not implement such method */
-		 unqliteGenError(pDb,"xDelete() method not implemented in the underlying storage engine");
-		 rc = UNQLITE_NOTIMPLEMENTED;
+	 /* Borrow a cursor from the pool */
+	 rc = unqliteBorrowCursor(pDb,&pCur);
+	 if( rc != UNQLITE_OK ){
+		 goto leave;
+	 }
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		  unqliteGenError(pDb,"Empty key");
+		  rc = UNQLITE_EMPTY;
 	 }else{
-		 if( nKeyLen < 0 ){
-			 /* Assume a null terminated string and compute it's length */
-			 nKeyLen = SyStrlen((const char *)pKey);
-		 }
-		 if( !nKeyLen ){
-			 unqliteGenError(pDb,"Empty key");
-			 rc = UNQLITE_EMPTY;
+		  /* Drop the record if its expiration time is reached */
+		  rc = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen);
+		  if( rc == UNQLITE_OK ){
+		  	/* Seek to the record position */
+		  	rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		  }
+	 }
+	 if( rc == UNQLITE_OK ){
+		 pRef = (unqlite_kv_ref *)SyMemBackendPoolAlloc(&pDb->sMem,sizeof(unqlite_kv_ref));
+		 if( pRef == 0 ){
+			 unqliteGenOutofMem(pDb);
+			 rc = UNQLITE_NOMEM;
 		 }else{
-			 /* Seek to the record position */
-			 rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
-		 }
-		 if( rc == UNQLITE_OK ){
-			 /* Exact match found, delete the entry */
-			 rc = pMethods->xDelete(pCur);
+			 SyZero(pRef,sizeof(unqlite_kv_ref));
+			 SyBlobInit(&pRef->sCopy,&pDb->sMem);
+			 pRef->pIo = pEngine->pIo;
+			 rc = UNQLITE_NOTIMPLEMENTED;
+			 if( pMethods->iVersion > 1 && pMethods->xDataRef ){
+				 /* Point directly to the page holding the data */
+				 rc = pMethods->xDataRef(pCur,ppData,pDataLen,&pRef->pPage);
+			 }
+			 if( rc != UNQLITE_OK ){
+				 /* Data spans multiple pages, fallback to a private copy */
+				 pRef->pPage = 0;
+				 rc = pMethods->xData(pCur,unqliteDataConsumer,&pRef->sCopy);
+				 *ppData = SyBlobData(&pRef->sCopy);
+				 *pDataLen = (unqlite_int64)SyBlobLength(&pRef->sCopy);
+			 }
+			 if( rc != UNQLITE_OK ){
+				 SyBlobRelease(&pRef->sCopy);
+				 SyMemBackendPoolFree(&pDb->sMem,pRef);
+			 }else{
+				 *ppRef = pRef;
+			 }
 		 }
 	 }
+	 unqliteReturnCursor(pDb,pCur);
+leave:
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	return rc;
 }
 /*
- * [CAPIREF: unqlite_kv_config()]
+ * [CAPIREF: unqlite_kv_ref_release()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_config(unqlite *pDb,int iOp,...)
+int unqlite_kv_ref_release(unqlite *pDb,unqlite_kv_ref *pRef)
 {
-	unqlite_kv_engine *pEngine;
-	int rc;
-	if( UNQLITE_DB_MISUSE(pDb) ){
+	if( UNQLITE_DB_MISUSE(pDb) || pRef == 0 ){
 		return UNQLITE_CORRUPT;
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
 	 }
 #endif
-	 /* Point to the underlying storage engine */
-	 pEngine = unqlitePagerGetKvEngine(pDb);
-	 if( pEngine->pIo->pMethods->xConfig == 0 ){
-		 /* Storage engine does not implements such method */
-		 unqliteGenError(pDb,"xConfig() method not implemented in the underlying storage engine");
-		 rc = UNQLITE_NOTIMPLEMENTED;
-	 }else{
-		 va_list ap;
-		 /* Configure the storage engine */
-		 va_start(ap,iOp);
-		 rc = pEngine->pIo->pMethods->xConfig(pEngine,iOp,ap);
-		 va_end(ap);
+	 if( pRef->pPage ){
+		 /* Unpin the page */
+		 pRef->pIo->xPageUnref(pRef->pPage);
 	 }
+	 SyBlobRelease(&pRef->sCopy);
+	 SyMemBackendPoolFree(&pDb->sMem,pRef);
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
-	return rc;
+	return UNQLITE_OK;
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_init()]
+ * Range read state.
+ */
+struct unqlite_range_buf
+{
+	unsigned char *zBuf;  /* Output buffer */
+	sxu64 nSkip;          /* Bytes to skip before filling the buffer */
+	sxu64 nAvail;         /* Free space left in the buffer */
+	sxu64 nWritten;       /* Total number of bytes written so far */
+};
+/*
+ * Range read consumer callback. Skip the leading bytes (if any)
+ * then fill the output buffer.
+ */
+static int unqliteRangeConsumer(const void *pOut,unsigned int nLen,void *pUserData)
+{
+	struct unqlite_range_buf *pRange = (struct unqlite_range_buf *)pUserData;
+	const unsigned char *zIn = (const unsigned char *)pOut;
+	if( pRange->nSkip > 0 ){
+		if( (sxu64)nLen <= pRange->nSkip ){
+			pRange->nSkip -= nLen;
+			return UNQLITE_OK;
+		}
+		zIn += pRange->nSkip;
+		nLen -= (unsigned int)pRange->nSkip;
+		pRange->nSkip = 0;
+	}
+	if( (sxu64)nLen > pRange->nAvail ){
+		nLen = (unsigned int)pRange->nAvail;
+	}
+	SyMemcpy((const void *)zIn,(void *)&pRange->zBuf[pRange->nWritten],nLen);
+	pRange->nWritten += nLen;
+	pRange->nAvail -= nLen;
+	/* Stop as soon as the buffer is full */
+	return pRange->nAvail > 0 ? UNQLITE_OK : UNQLITE_ABORT;
+}
+/*
+ * [CAPIREF: unqlite_kv_read_range()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_init(unqlite *pDb,unqlite_kv_cursor **ppOut)
+int unqlite_kv_read_range(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 iOfft,void *pBuf,unqlite_int64 *pBufLen)
 {
+	struct unqlite_range_buf sRange;
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_engine *pEngine;
+	unqlite_kv_cursor *pCur;
 	int rc;
-	if( UNQLITE_DB_MISUSE(pDb) || ppOut == 0 /* Noop */){
+	if( UNQLITE_DB_MISUSE(pDb) || pBuf == 0 || pBufLen == 0 || *pBufLen < 0 || iOfft < 0 ){
 		return UNQLITE_CORRUPT;
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
 	 }
 #endif
-	 /* Allocate a new cursor */
-	 rc = unqliteInitCursor(pDb,ppOut);
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 pMethods = pEngine->pIo->pMethods;
+	 /* Borrow a cursor from the pool */
+	 rc = unqliteBorrowCursor(pDb,&pCur);
+	 if( rc != UNQLITE_OK ){
+		 goto leave;
+	 }
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		  unqliteGenError(pDb,"Empty key");
+		  rc = UNQLITE_EMPTY;
+	 }else{
+		  /* Drop the record if its expiration time is reached */
+		  rc = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen);
+		  if( rc == UNQLITE_OK ){
+		  	/* Seek to the record position */
+		  	rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		  }
+	 }
+	 if( rc == UNQLITE_OK ){
+		 sRange.zBuf = (unsigned char *)pBuf;
+		 sRange.nSkip = 0;
+		 sRange.nAvail = (sxu64)*pBufLen;
+		 sRange.nWritten = 0;
+		 if( sRange.nAvail > 0 ){
+			 if( pMethods->iVersion > 1 && pMethods->xDataRange ){
+				 /* Seek directly to the target range */
+				 rc = pMethods->xDataRange(pCur,iOfft,*pBufLen,unqliteRangeConsumer,&sRange);
+			 }else{
+				 /* Stream the whole record and keep only the requested range */
+				 sRange.nSkip = (sxu64)iOfft;
+				 rc = pMethods->xData(pCur,unqliteRangeConsumer,&sRange);
+			 }
+			 if( rc == UNQLITE_ABORT && sRange.nAvail < 1 ){
+				 /* Buffer full */
+				 rc = UNQLITE_OK;
+			 }
+		 }
+		 *pBufLen = (unqlite_int64)sRange.nWritten;
+	 }
+	 unqliteReturnCursor(pDb,pCur);
+leave:
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
-	 return rc;
+	return rc;
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_release()]
+ * [CAPIREF: unqlite_kv_write_range()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_release(unqlite *pDb,unqlite_kv_cursor *pCur)
+int unqlite_kv_write_range(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 iOfft,const void *pData,unqlite_int64 nDataLen)
 {
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_engine *pEngine;
+	unqlite_kv_cursor *pCur;
+	SyBlob sWorker;
 	int rc;
-	if( UNQLITE_DB_MISUSE(pDb) || pCur == 0 /* Noop */){
+	if( UNQLITE_DB_MISUSE(pDb) || (pData == 0 && nDataLen > 0) || nDataLen < 0 || iOfft < 0 ){
 		return UNQLITE_CORRUPT;
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
 	 }
 #endif
-	 /* Release the cursor */
-	 rc = unqliteReleaseCursor(pDb,pCur);
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 pMethods = pEngine->pIo->pMethods;
+	 /* Borrow a cursor from the pool */
+	 rc = unqliteBorrowCursor(pDb,&pCur);
+	 if( rc != UNQLITE_OK ){
+		 goto leave;
+	 }
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		  unqliteGenError(pDb,"Empty key");
+		  rc = UNQLITE_EMPTY;
+	 }else if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+		  unqliteGenError(pDb,"Reserved key");
+		  rc = UNQLITE_PERM;
+	 }else{
+		  /* Drop the record if its expiration time is reached */
+		  rc = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen);
+		  if( rc == UNQLITE_OK ){
+		  	/* Seek to the record position */
+		  	rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		  }
+	 }
+	 if( rc == UNQLITE_OK ){
+		 if( pMethods->iVersion > 1 && pMethods->xWriteRange ){
+			 /* Patch the record in place */
+			 rc = pMethods->xWriteRange(pCur,iOfft,pData,nDataLen);
+		 }else if( pMethods->xReplace == 0 ){
+			 /* Storage engine does not implement such method */
+			 unqliteGenError(pDb,"xReplace() method not implemented in the underlying storage engine");
+			 rc = UNQLITE_NOTIMPLEMENTED;
+		 }else{
+			 /* Rewrite the whole record */
+			 SyBlobInit(&sWorker,&pDb->sMem);
+			 rc = pMethods->xData(pCur,unqliteDataConsumer,&sWorker);
+			 if( rc == UNQLITE_OK ){
+				 if( (sxu64)iOfft > (sxu64)SyBlobLength(&sWorker) || (sxu64)nDataLen > (sxu64)SyBlobLength(&sWorker) - (sxu64)iOfft ){
+					 /* Out of range */
+					 rc = UNQLITE_INVALID;
+				 }else{
+					 SyMemcpy(pData,(void *)&((unsigned char *)SyBlobData(&sWorker))[iOfft],(sxu32)nDataLen);
+					 rc = pMethods->xReplace(pEngine,pKey,nKeyLen,SyBlobData(&sWorker),(unqlite_int64)SyBlobLength(&sWorker));
+				 }
+			 }
+			 SyBlobRelease(&sWorker);
+		 }
+		 if( rc == UNQLITE_INVALID ){
+			 unqliteGenError(pDb,"Range lies outside the record data");
+		 }
+	 }
+	 unqliteReturnCursor(pDb,pCur);
+leave:
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
-	 return rc;
+	return rc;
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_first_entry()]
+ * [CAPIREF: unqlite_kv_delete()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_first_entry(unqlite_kv_cursor *pCursor)
+int unqlite_kv_delete(unqlite *pDb,const void *pKey,int nKeyLen)
 {
-	int rc;
-#ifdef UNTRUST
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_engine *pEngine;
+	unqlite_kv_cursor *pCur;
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+	pEngine = unqlitePagerGetConcurrentKvEngine(pDb);
+	if( pEngine ){
+		/* The storage engine serialize its own operations */
+		return unqliteKvConcurrentDelete(pDb,pEngine,pKey,nKeyLen);
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 pMethods = pEngine->pIo->pMethods;
+	 /* Borrow a cursor from the pool */
+	 rc = unqliteBorrowCursor(pDb,&pCur);
+	 if( rc != UNQLITE_OK ){
+		 goto leave;
+	 }
+	 if( pMethods->xDelete == 0 ){
+		 /* Storage engine does not implement such method */
+		 unqliteGenError(pDb,"xDelete() method not implemented in the underlying storage engine");
+		 rc = UNQLITE_NOTIMPLEMENTED;
+	 }else{
+		 if( nKeyLen < 0 ){
+			 /* Assume a null terminated string and compute it's length */
+			 nKeyLen = SyStrlen((const char *)pKey);
+		 }
+		 if( !nKeyLen ){
+			 unqliteGenError(pDb,"Empty key");
+			 rc = UNQLITE_EMPTY;
+		 }else if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+			 unqliteGenError(pDb,"Reserved key");
+			 rc = UNQLITE_PERM;
+		 }else{
+			 /* Seek to the record position */
+			 rc = pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+		 }
+		 if( rc == UNQLITE_OK ){
+			 /* Exact match found, delete the entry */
+			 rc = pMethods->xDelete(pCur);
+			 if( rc == UNQLITE_OK ){
+				 /* Drop its expiration time if any */
+				 rc = unqliteKvTtlClear(pDb,pKey,(sxu32)nKeyLen);
+			 }
+		 }
+	 }
+	 unqliteReturnCursor(pDb,pCur);
+leave:
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_delete_prefix()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_delete_prefix(unqlite *pDb,const void *pPrefix,int nPrefixLen,unqlite_int64 *pnDeleted)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+	if( nPrefixLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nPrefixLen = SyStrlen((const char *)pPrefix);
+	}
+	if( !nPrefixLen ){
+		unqliteGenError(pDb,"Empty prefix");
+		return UNQLITE_EMPTY;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Remove the records whose key start with the prefix */
+	 rc = unqliteKvPurge(pDb,pPrefix,(sxu32)nPrefixLen,0,0,1,0,0,pnDeleted);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_delete_range()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_delete_range(unqlite *pDb,const void *pLow,int nLowLen,const void *pHigh,int nHighLen,unqlite_int64 *pnDeleted)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+	if( pLow == 0 ){
+		/* No lower bound */
+		nLowLen = 0;
+	}else if( nLowLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nLowLen = SyStrlen((const char *)pLow);
+	}
+	if( pHigh == 0 ){
+		/* No upper bound */
+		nHighLen = 0;
+	}else if( nHighLen < 0 ){
+		nHighLen = SyStrlen((const char *)pHigh);
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Remove the records of the [pLow,pHigh) range */
+	 rc = unqliteKvPurge(pDb,pLow,(sxu32)nLowLen,pHigh,(sxu32)nHighLen,0,0,0,pnDeleted);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_delete_if()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_delete_if(unqlite *pDb,int (*xFilter)(const void *,unsigned int,void *),void *pUserData,unqlite_int64 *pnDeleted)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || xFilter == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Remove the records selected by the predicate */
+	 rc = unqliteKvPurge(pDb,0,0,0,0,0,xFilter,pUserData,pnDeleted);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_store_ttl()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_store_ttl(unqlite *pDb,const void *pKey,int nKeyLen,const void *pData,unqlite_int64 nDataLen,unqlite_int64 iTtl)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		 unqliteGenError(pDb,"Empty key");
+		 rc = UNQLITE_EMPTY;
+	 }else if( unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+		 unqliteGenError(pDb,"Reserved key");
+		 rc = UNQLITE_PERM;
+	 }else{
+		 /* Store the record and index its expiration time */
+		 rc = unqliteKvTtlStore(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen,pData,nDataLen,iTtl);
+	 }
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_ttl()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_ttl(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 *pTtl)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || pTtl == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		 unqliteGenError(pDb,"Empty key");
+		 rc = UNQLITE_EMPTY;
+	 }else{
+		 /* Remaining lifetime */
+		 rc = unqliteKvTtlGet(pDb,sUnqlMPGlobal.pVfs,pKey,(sxu32)nKeyLen,pTtl);
+	 }
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_expire()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_expire(unqlite *pDb,int nMax,int *pnExpired)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Remove the due records */
+	 rc = unqliteKvTtlReap(pDb,sUnqlMPGlobal.pVfs,nMax,pnExpired);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * Invoke the xConfig() method of the underlying storage engine (if available).
+ */
+static int unqliteKvEngineConfig(unqlite_kv_engine *pEngine,int iOp,...)
+{
+	va_list ap;
+	int rc;
+	if( pEngine->pIo->pMethods->xConfig == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	va_start(ap,iOp);
+	rc = pEngine->pIo->pMethods->xConfig(pEngine,iOp,ap);
+	va_end(ap);
+	return rc;
+}
+/*
+ * Compare two key hashes starting from the least significant bit so that
+ * keys sharing the same low order bits (i.e. the same hash bucket regardless
+ * of the bucket mask in use) are grouped together.
+ */
+static int KvBatchHashCmp(sxu32 nA,sxu32 nB)
+{
+	sxu32 nDiff = nA ^ nB;
+	if( nDiff == 0 ){
+		return 0;
+	}
+	/* Lowest differing bit */
+	nDiff &= ~nDiff + 1;
+	return (nA & nDiff) ? 1 : -1;
+}
+/*
+ * Compute the order in which the entries of a batch are processed.
+ * Entries are sorted by bucket using the hash function of the underlying
+ * storage engine so that each page is loaded once per batch.
+ * If the engine does not expose its hash function, the caller order is kept.
+ */
+static int KvBatchOrder(
+	unqlite *pDb,
+	unqlite_kv_engine *pEngine,
+	int nKey,
+	const void **apKey,
+	int *anKeyLen,
+	sxu32 **papOrder /* OUT: Processing order */
+	)
+{
+	ProcHash xHash = 0;
+	sxu32 *aOrder,*aHash;
+	sxu32 nGap,i,j,iIdx,nHash;
+	/* Allocate the order and the hash arrays at once */
+	if( (sxu32)nKey > SXU32_HIGH / (2 * sizeof(sxu32)) ){
+		/* Allocation size would overflow */
+		aOrder = 0;
+	}else{
+		aOrder = (sxu32 *)SyMemBackendAlloc(&pDb->sMem,(sxu32)(nKey * 2 * sizeof(sxu32)));
+	}
+	if( aOrder == 0 ){
+		unqliteGenOutofMem(pDb);
+		return UNQLITE_NOMEM;
+	}
+	aHash = &aOrder[nKey];
+	for( i = 0 ; i < (sxu32)nKey ; ++i ){
+		aOrder[i] = i;
+	}
+	*papOrder = aOrder;
+	if( nKey < 2 || unqliteKvEngineConfig(pEngine,UNQLITE_KV_CONFIG_GET_HASH_FUNC,&xHash) != UNQLITE_OK || xHash == 0 ){
+		/* Keep the caller order */
+		return UNQLITE_OK;
+	}
+	for( i = 0 ; i < (sxu32)nKey ; ++i ){
+		aHash[i] = anKeyLen[i] > 0 ? xHash(apKey[i],(sxu32)anKeyLen[i]) : 0;
+	}
+	/* Shell sort the order array */
+	for( nGap = (sxu32)nKey >> 1 ; nGap > 0 ; nGap >>= 1 ){
+		for( i = nGap ; i < (sxu32)nKey ; ++i ){
+			iIdx = aOrder[i];
+			nHash = aHash[iIdx];
+			for( j = i ; j >= nGap && KvBatchHashCmp(aHash[aOrder[j - nGap]],nHash) > 0 ; j -= nGap ){
+				aOrder[j] = aOrder[j - nGap];
+			}
+			aOrder[j] = iIdx;
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Prepare the key lengths of a batch. Negative lengths (or a NULL length array)
+ * means null terminated keys.
+ */
+static int * KvBatchKeyLength(unqlite *pDb,int nKey,const void **apKey,const int *anKeyLen)
+{
+	int *anLen;
+	int i;
+	if( (sxu32)nKey > SXU32_HIGH / sizeof(int) ){
+		/* Allocation size would overflow */
+		anLen = 0;
+	}else{
+		anLen = (int *)SyMemBackendAlloc(&pDb->sMem,(sxu32)(nKey * sizeof(int)));
+	}
+	if( anLen == 0 ){
+		unqliteGenOutofMem(pDb);
+		return 0;
+	}
+	for( i = 0 ; i < nKey ; ++i ){
+		if( anKeyLen && anKeyLen[i] >= 0 ){
+			anLen[i] = anKeyLen[i];
+		}else{
+			/* Assume a null terminated string and compute it's length */
+			anLen[i] = apKey[i] ? (int)SyStrlen((const char *)apKey[i]) : 0;
+		}
+	}
+	return anLen;
+}
+/*
+ * [CAPIREF: unqlite_kv_fetch_batch()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_fetch_batch(
+	unqlite *pDb,
+	int nKey,                  /* Total number of keys */
+	const void **apKey,        /* Keys to lookup */
+	const int *anKeyLen,       /* Key lengths (May be NULL) */
+	void **apBuf,              /* Output buffers (May be NULL) */
+	unqlite_int64 *anBufLen,   /* IN: Buffer sizes OUT: Data lengths */
+	int *aRc                   /* OUT: Per-key result (May be NULL) */
+	)
+{
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_engine *pEngine;
+	unqlite_kv_cursor *pCur;
+	sxu32 *aOrder = 0;
+	int *anLen;
+	int i,iIdx,rc;
+	if( UNQLITE_DB_MISUSE(pDb) || apKey == 0 || anBufLen == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+	if( nKey < 1 ){
+		/* Nothing to do */
+		return UNQLITE_OK;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	pEngine = unqliteKvSharedEngine(pDb);
+	if( pEngine ){
+		/* Lookup in parallel with other readers. The keys are not sorted since
+		 * such engines have no locality to exploit.
+		 */
+		for( i = 0 ; i < nKey ; ++i ){
+			int nLen = -1;
+			int rc2;
+			if( anKeyLen && anKeyLen[i] >= 0 ){
+				nLen = anKeyLen[i];
+			}else if( apKey[i] ){
+				/* Assume a null terminated string and compute it's length */
+				nLen = (int)SyStrlen((const char *)apKey[i]);
+			}
+			if( nLen < 1 ){
+				rc2 = UNQLITE_EMPTY;
+			}else{
+				rc2 = unqliteKvSharedFetch(pEngine,apKey[i],nLen,apBuf ? apBuf[i] : 0,&anBufLen[i]);
+			}
+			if( aRc ){
+				aRc[i] = rc2;
+			}
+		}
+		SyRWLockSharedLeave(pDb->pRWLock);
+		return UNQLITE_OK;
+	}
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 pMethods = pEngine->pIo->pMethods;
+	 anLen = KvBatchKeyLength(pDb,nKey,apKey,anKeyLen);
+	 if( anLen == 0 ){
+		 rc = UNQLITE_NOMEM;
+		 goto leave;
+	 }
+	 rc = KvBatchOrder(pDb,pEngine,nKey,apKey,anLen,&aOrder);
+	 if( rc != UNQLITE_OK ){
+		 SyMemBackendFree(&pDb->sMem,anLen);
+		 goto leave;
+	 }
+	 /* Borrow a cursor from the pool */
+	 rc = unqliteBorrowCursor(pDb,&pCur);
+	 if( rc != UNQLITE_OK ){
+		 SyMemBackendFree(&pDb->sMem,aOrder);
+		 SyMemBackendFree(&pDb->sMem,anLen);
+		 goto leave;
+	 }
+	 for( i = 0 ; i < nKey ; ++i ){
+		 int rc2;
+		 iIdx = (int)aOrder[i];
+		 if( !anLen[iIdx] ){
+			 rc2 = UNQLITE_EMPTY;
+		 }else{
+			 /* Drop the record if its expiration time is reached */
+			 rc2 = unqliteKvTtlCheck(pDb,sUnqlMPGlobal.pVfs,apKey[iIdx],(sxu32)anLen[iIdx]);
+			 if( rc2 == UNQLITE_OK ){
+				 /* Seek to the record position */
+				 rc2 = pMethods->xSeek(pCur,apKey[iIdx],anLen[iIdx],UNQLITE_CURSOR_MATCH_EXACT);
+			 }
+		 }
+		 if( rc2 == UNQLITE_OK ){
+			 if( apBuf == 0 || apBuf[iIdx] == 0 ){
+				 /* Data length only */
+				 rc2 = pMethods->xDataLength(pCur,&anBufLen[iIdx]);
+			 }else{
+				 SyBlob sBlob;
+				 /* Initialize the data consumer */
+				 SyBlobInitFromBuf(&sBlob,apBuf[iIdx],(sxu32)anBufLen[iIdx]);
+				 /* Consume the data */
+				 rc2 = pMethods->xData(pCur,unqliteDataConsumer,&sBlob);
+				 /* Data length */
+				 anBufLen[iIdx] = (unqlite_int64)SyBlobLength(&sBlob);
+				 /* Cleanup */
+				 SyBlobRelease(&sBlob);
+			 }
+		 }
+		 if( aRc ){
+			 aRc[iIdx] = rc2;
+		 }
+	 }
+	 /* Release the working arrays */
+	 SyMemBackendFree(&pDb->sMem,aOrder);
+	 SyMemBackendFree(&pDb->sMem,anLen);
+	 unqliteReturnCursor(pDb,pCur);
+leave:
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_store_batch()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_store_batch(
+	unqlite *pDb,
+	int nKey,                       /* Total number of records */
+	const void **apKey,             /* Record keys */
+	const int *anKeyLen,            /* Key lengths (May be NULL) */
+	const void **apData,            /* Record data */
+	const unqlite_int64 *anDataLen, /* Data lengths */
+	int *aRc                        /* OUT: Per-record result (May be NULL) */
+	)
+{
+	unqlite_kv_engine *pEngine;
+	sxu32 *aOrder = 0;
+	int *anLen;
+	int i,iIdx,rc;
+	if( UNQLITE_DB_MISUSE(pDb) || apKey == 0 || apData == 0 || anDataLen == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+	if( nKey < 1 ){
+		/* Nothing to do */
+		return UNQLITE_OK;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 if( pEngine->pIo->pMethods->xReplace == 0 ){
+		 /* Storage engine does not implement such method */
+		 unqliteGenError(pDb,"xReplace() method not implemented in the underlying storage engine");
+		 rc = UNQLITE_NOTIMPLEMENTED;
+		 goto leave;
+	 }
+	 anLen = KvBatchKeyLength(pDb,nKey,apKey,anKeyLen);
+	 if( anLen == 0 ){
+		 rc = UNQLITE_NOMEM;
+		 goto leave;
+	 }
+	 rc = KvBatchOrder(pDb,pEngine,nKey,apKey,anLen,&aOrder);
+	 if( rc != UNQLITE_OK ){
+		 SyMemBackendFree(&pDb->sMem,anLen);
+		 goto leave;
+	 }
+	 for( i = 0 ; i < nKey ; ++i ){
+		 int rc2;
+		 iIdx = (int)aOrder[i];
+		 if( rc != UNQLITE_OK ){
+			 /* A previous write failed, skip the remaining records */
+			 rc2 = UNQLITE_ABORT;
+		 }else if( !anLen[iIdx] ){
+			 unqliteGenError(pDb,"Empty key");
+			 rc2 = UNQLITE_EMPTY;
+		 }else if( unqliteKvTtlReserved(apKey[iIdx],(sxu32)anLen[iIdx]) ){
+			 unqliteGenError(pDb,"Reserved key");
+			 rc2 = UNQLITE_PERM;
+		 }else{
+			 /* The new record does not expire */
+			 rc2 = unqliteKvTtlClear(pDb,apKey[iIdx],(sxu32)anLen[iIdx]);
+			 if( rc2 == UNQLITE_OK ){
+				 /* Perform the requested operation */
+				 rc2 = pEngine->pIo->pMethods->xReplace(pEngine,apKey[iIdx],anLen[iIdx],apData[iIdx],anDataLen[iIdx]);
+			 }
+			 if( rc2 != UNQLITE_OK ){
+				 /* IO error, the transaction should be rolled back */
+				 rc = rc2;
+			 }
+		 }
+		 if( aRc ){
+			 aRc[iIdx] = rc2;
+		 }
+	 }
+	 /* Release the working arrays */
+	 SyMemBackendFree(&pDb->sMem,aOrder);
+	 SyMemBackendFree(&pDb->sMem,anLen);
+leave:
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_config()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_config(unqlite *pDb,int iOp,...)
+{
+	unqlite_kv_engine *pEngine;
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Point to the underlying storage engine */
+	 pEngine = unqlitePagerGetKvEngine(pDb);
+	 if( pEngine->pIo->pMethods->xConfig == 0 ){
+		 /* Storage engine does not implements such method */
+		 unqliteGenError(pDb,"xConfig() method not implemented in the underlying storage engine");
+		 rc = UNQLITE_NOTIMPLEMENTED;
+	 }else{
+		 va_list ap;
+		 /* Configure the storage engine */
+		 va_start(ap,iOp);
+		 rc = pEngine->pIo->pMethods->xConfig(pEngine,iOp,ap);
+		 va_end(ap);
+	 }
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_snapshot()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_snapshot(unqlite *pDb,const char *zPath)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || zPath == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Dump the records in key order */
+	 rc = unqliteKvSnapshot(pDb,sUnqlMPGlobal.pVfs,zPath);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_restore()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_restore(unqlite *pDb,const char *zPath)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || zPath == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Bulk load the snapshot records */
+	 rc = unqliteKvRestore(pDb,sUnqlMPGlobal.pVfs,zPath);
+	 /* The snapshot may carry expiration metadata */
+	 unqliteKvTtlReset(pDb);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_build_table()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_build_table(unqlite *pDb,const char *zPath,int iFlags)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || zPath == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Copy the records to a new sorted table */
+	 rc = unqliteKvBuildTable(pDb,sUnqlMPGlobal.pVfs,zPath,iFlags);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_scan()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_scan(unqlite *pDb,int nWorker,
+	int (*xScan)(void *,int,const void *,unsigned int,const void *,unqlite_int64),void *pUserData)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || xScan == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Make sure the underlying storage engine is loaded */
+	 unqlitePagerGetKvEngine(pDb);
+	 /* Visit every record */
+	 rc = unqliteKvScan(pDb,nWorker,xScan,pUserData);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_fetch_async()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_fetch_async(unqlite *pDb,const void *pKey,int nKeyLen,
+	void (*xDone)(void *,int,const void *,unqlite_int64),void *pUserData)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || pKey == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 if( nKeyLen < 0 ){
+		 /* Assume a null terminated string and compute it's length */
+		 nKeyLen = SyStrlen((const char *)pKey);
+	 }
+	 if( !nKeyLen ){
+		 unqliteGenError(pDb,"Empty key");
+		 rc = UNQLITE_EMPTY;
+	 }else{
+		 /* Queue the request */
+		 rc = unqliteAsyncFetch(pDb,pKey,nKeyLen,xDone,pUserData);
+	 }
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_init()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_init(unqlite *pDb,unqlite_kv_cursor **ppOut)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || ppOut == 0 /* Noop */){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Make sure the underlying storage engine is loaded */
+	 unqlitePagerGetKvEngine(pDb);
+	 /* Allocate a new cursor */
+	 rc = unqliteInitCursor(pDb,ppOut);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_release()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_release(unqlite *pDb,unqlite_kv_cursor *pCur)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) || pCur == 0 /* Noop */){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Release the cursor */
+	 rc = unqliteReleaseCursor(pDb,pCur);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_first_entry()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_first_entry(unqlite_kv_cursor *pCursor)
+{
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	/* Discard the iteration bounds if any */
+	unqliteKvBoundRelease(pCursor);
+	/* Check if the requested method is implemented by the underlying storage engine */
+	if( pCursor->pStore->pIo->pMethods->xFirst == 0 ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+	}else{
+		/* Seek to the first entry */
+		rc = pCursor->pStore->pIo->pMethods->xFirst(pCursor);
+		if( rc == UNQLITE_OK ){
+			/* Hide the expiration metadata */
+			rc = unqliteKvTtlSkip(unqliteCursorTail(pCursor)->pDb,pCursor,1);
+		}
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_last_entry()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_last_entry(unqlite_kv_cursor *pCursor)
+{
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	/* Discard the iteration bounds if any */
+	unqliteKvBoundRelease(pCursor);
+	/* Check if the requested method is implemented by the underlying storage engine */
+	if( pCursor->pStore->pIo->pMethods->xLast == 0 ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+	}else{
+		/* Seek to the last entry */
+		rc = pCursor->pStore->pIo->pMethods->xLast(pCursor);
+		if( rc == UNQLITE_OK ){
+			/* Hide the expiration metadata */
+			rc = unqliteKvTtlSkip(unqliteCursorTail(pCursor)->pDb,pCursor,0);
+		}
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_valid_entry()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_valid_entry(unqlite_kv_cursor *pCursor)
+{
+	unqlite_kv_bound *pBound;
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	pBound = unqliteCursorTail(pCursor)->pBound;
+	if( pBound ){
+		/* Bounded iteration (See unqlite_kv_cursor_seek_range()) */
+		return unqliteKvBoundValid(pCursor,pBound);
+	}
+	/* Check if the requested method is implemented by the underlying storage engine */
+	if( pCursor->pStore->pIo->pMethods->xValid == 0 ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+	}else{
+		rc = pCursor->pStore->pIo->pMethods->xValid(pCursor);
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_next_entry()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_next_entry(unqlite_kv_cursor *pCursor)
+{
+	unqlite_kv_bound *pBound;
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	pBound = unqliteCursorTail(pCursor)->pBound;
+	if( pBound ){
+		/* Bounded iteration (See unqlite_kv_cursor_seek_range()) */
+		return unqliteKvBoundStep(pCursor,pBound,1);
+	}
+	/* Check if the requested method is implemented by the underlying storage engine */
+	if( pCursor->pStore->pIo->pMethods->xNext == 0 ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+	}else{
+		/* Seek to the next entry */
+		rc = pCursor->pStore->pIo->pMethods->xNext(pCursor);
+		if( rc == UNQLITE_OK ){
+			/* Hide the expiration metadata */
+			rc = unqliteKvTtlSkip(unqliteCursorTail(pCursor)->pDb,pCursor,1);
+		}
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_prev_entry()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_prev_entry(unqlite_kv_cursor *pCursor)
+{
+	unqlite_kv_bound *pBound;
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	pBound = unqliteCursorTail(pCursor)->pBound;
+	if( pBound ){
+		/* Bounded iteration (See unqlite_kv_cursor_seek_range()) */
+		return unqliteKvBoundStep(pCursor,pBound,0);
+	}
+	/* Check if the requested method is implemented by the underlying storage engine */
+	if( pCursor->pStore->pIo->pMethods->xPrev == 0 ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+	}else{
+		/* Seek to the previous entry */
+		rc = pCursor->pStore->pIo->pMethods->xPrev(pCursor);
+		if( rc == UNQLITE_OK ){
+			/* Hide the expiration metadata */
+			rc = unqliteKvTtlSkip(unqliteCursorTail(pCursor)->pDb,pCursor,0);
+		}
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_delete_entry()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_delete_entry(unqlite_kv_cursor *pCursor)
+{
+	unqlite_kv_bound *pBound;
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	pBound = unqliteCursorTail(pCursor)->pBound;
+	if( pBound ){
+		/* Bounded iteration (See unqlite_kv_cursor_seek_range()) */
+		return unqliteKvBoundDelete(pCursor,pBound);
+	}
+	/* Check if the requested method is implemented by the underlying storage engine */
+	if( pCursor->pStore->pIo->pMethods->xDelete == 0 ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+	}else{
+		/* Delete the entry */
+		rc = pCursor->pStore->pIo->pMethods->xDelete(pCursor);
+		if( rc == UNQLITE_OK ){
+			/* Hide the expiration metadata */
+			rc = unqliteKvTtlSkip(unqliteCursorTail(pCursor)->pDb,pCursor,1);
+		}
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_reset()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_reset(unqlite_kv_cursor *pCursor)
+{
+	int rc = UNQLITE_OK;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	/* Discard the iteration bounds if any */
+	unqliteKvBoundRelease(pCursor);
+	/* Check if the requested method is implemented by the underlying storage engine */
+	if( pCursor->pStore->pIo->pMethods->xReset == 0 ){
+		rc = UNQLITE_NOTIMPLEMENTED;
+	}else{
+		/* Reset */
+		pCursor->pStore->pIo->pMethods->xReset(pCursor);
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_seek()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_seek(unqlite_kv_cursor *pCursor,const void *pKey,int nKeyLen,int iPos)
+{
+	int rc = UNQLITE_OK;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	if( nKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nKeyLen = SyStrlen((const char *)pKey);
+	}
+	if( !nKeyLen ){
+		rc = UNQLITE_EMPTY;
+	}else{
+		/* Discard the iteration bounds if any */
+		unqliteKvBoundRelease(pCursor);
+		if( iPos == UNQLITE_CURSOR_MATCH_EXACT && unqliteKvTtlReserved(pKey,(sxu32)nKeyLen) ){
+			/* Expiration metadata are not part of the user keyspace */
+			return UNQLITE_NOTFOUND;
+		}
+		/* Seek to the desired location */
+		rc = pCursor->pStore->pIo->pMethods->xSeek(pCursor,pKey,nKeyLen,iPos);
+		if( rc == UNQLITE_OK && iPos != UNQLITE_CURSOR_MATCH_EXACT ){
+			/* Hide the expiration metadata */
+			rc = unqliteKvTtlSkip(unqliteCursorTail(pCursor)->pDb,pCursor,iPos == UNQLITE_CURSOR_MATCH_GE);
+			if( rc == UNQLITE_DONE ){
+				/* Only metadata past the key */
+				rc = UNQLITE_NOTFOUND;
+			}
+		}
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_seek_prefix()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_seek_prefix(unqlite_kv_cursor *pCursor,const void *pPrefix,int nPrefixLen)
+{
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	if( nPrefixLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nPrefixLen = SyStrlen((const char *)pPrefix);
+	}
+	if( !nPrefixLen ){
+		rc = UNQLITE_EMPTY;
+	}else{
+		/* Point to the first record starting with the prefix */
+		rc = unqliteKvBoundSeek(pCursor,pPrefix,(sxu32)nPrefixLen,0,0,1);
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_seek_range()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_seek_range(unqlite_kv_cursor *pCursor,const void *pLow,int nLowLen,const void *pHigh,int nHighLen)
+{
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	if( pLow == 0 ){
+		/* No lower bound */
+		nLowLen = 0;
+	}else if( nLowLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nLowLen = SyStrlen((const char *)pLow);
+	}
+	if( pHigh == 0 ){
+		/* No upper bound */
+		nHighLen = 0;
+	}else if( nHighLen < 0 ){
+		nHighLen = SyStrlen((const char *)pHigh);
+	}
+	/* Point to the first record of the [pLow,pHigh) range */
+	rc = unqliteKvBoundSeek(pCursor,pLow,(sxu32)nLowLen,pHigh,(sxu32)nHighLen,0);
+	return rc;
+}
+/*
+ * Default data consumer callback. That is, all retrieved is redirected to this
+ * routine which store the output in an internal blob.
+ */
+UNQLITE_PRIVATE int unqliteDataConsumer(
+	const void *pOut,   /* Data to consume */
+	unsigned int nLen,  /* Data length */
+	void *pUserData     /* User private data */
+	)
+{
+	 sxi32 rc;
+	 /* Store the output in an internal BLOB */
+	 rc = SyBlobAppend((SyBlob *)pUserData, pOut, nLen);
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_data_callback()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_key_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	/* Consume the key directly */
+	rc = pCursor->pStore->pIo->pMethods->xKey(pCursor,xConsumer,pUserData);
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_key()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_key(unqlite_kv_cursor *pCursor,void *pBuf,int *pnByte)
+{
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	if( pBuf == 0 ){
+		/* Key length only */
+		rc = pCursor->pStore->pIo->pMethods->xKeyLength(pCursor,pnByte);
+	}else{
+		SyBlob sBlob;
+		if( (*pnByte) < 0 ){
+			return UNQLITE_CORRUPT;
+		}
+		/* Initialize the data consumer */
+		SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)(*pnByte));
+		/* Consume the key */
+		rc = pCursor->pStore->pIo->pMethods->xKey(pCursor,unqliteDataConsumer,&sBlob);
+		 /* Key length */
+		*pnByte = SyBlobLength(&sBlob);
+		/* Cleanup */
+		SyBlobRelease(&sBlob);
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_data_callback()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_data_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	int rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+#endif
+	/* Consume the data directly */
+	rc = pCursor->pStore->pIo->pMethods->xData(pCursor,xConsumer,pUserData);
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_kv_cursor_data()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_kv_cursor_data(unqlite_kv_cursor *pCursor,void *pBuf,unqlite_int64 *pnByte)
+{
+	int rc;
+#ifdef UNTRUST
 	if( pCursor == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	/* Check if the requested method is implemented by the underlying storage engine */
-	if( pCursor->pStore->pIo->pMethods->xFirst == 0 ){
-		rc = UNQLITE_NOTIMPLEMENTED;
-	}else{
-		/* Seek to the first entry */
-		rc = pCursor->pStore->pIo->pMethods->xFirst(pCursor);
+#endif
+	if( pBuf == 0 ){
+		/* Data length only */
+		rc = pCursor->pStore->pIo->pMethods->xDataLength(pCursor,pnByte);
+	}else{
+		SyBlob sBlob;
+		if( (*pnByte) < 0 ){
+			return UNQLITE_CORRUPT;
+		}
+		/* Initialize the data consumer */
+		SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)(*pnByte));
+		/* Consume the data */
+		rc = pCursor->pStore->pIo->pMethods->xData(pCursor,unqliteDataConsumer,&sBlob);
+		/* Data length */
+		*pnByte = SyBlobLength(&sBlob);
+		/* Cleanup */
+		SyBlobRelease(&sBlob);
+	}
+	return rc;
+}
+/*
+ * [CAPIREF: unqlite_begin()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_begin(unqlite *pDb)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Begin the write transaction */
+	 rc = unqlitePagerBegin(pDb->sDB.pPager);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_commit()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_commit(unqlite *pDb)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Commit the transaction */
+	 rc = unqlitePagerCommit(pDb->sDB.pPager);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_rollback()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_rollback(unqlite *pDb)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Rollback the transaction */
+	 rc = unqlitePagerRollback(pDb->sDB.pPager,TRUE);
+	 /* Reload the expiration index from the restored metadata on next use */
+	 unqliteKvTtlReset(pDb);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_savepoint_begin()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_savepoint_begin(unqlite *pDb,int *pLevel)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Open the savepoint */
+	 rc = unqlitePagerSavepoint(pDb->sDB.pPager,pLevel);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_savepoint_release()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_savepoint_release(unqlite *pDb,int iLevel)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Close the savepoint, keep the changes */
+	 rc = unqlitePagerSavepointRelease(pDb->sDB.pPager,iLevel);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_savepoint_rollback()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_savepoint_rollback(unqlite *pDb,int iLevel)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Undo the changes made under the savepoint */
+	 rc = unqlitePagerSavepointRollback(pDb->sDB.pPager,iLevel);
+	 /* Reload the expiration index from the restored metadata on next use */
+	 unqliteKvTtlReset(pDb);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_commit_async()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_commit_async(unqlite *pDb,void (*xDone)(void *,int),void *pUserData)
+{
+	int rc;
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Acquire DB mutex */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
+		 UNQLITE_THRD_DB_RELEASE(pDb) ){
+			 return UNQLITE_ABORT; /* Another thread have released this instance */
+	 }
+#endif
+	 /* Queue the request */
+	 rc = unqliteAsyncCommit(pDb,xDone,pUserData);
+#if defined(UNQLITE_ENABLE_THREADS)
+	 /* Leave DB mutex */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+#endif
+	 return rc;
+}
+/*
+ * [CAPIREF: unqlite_async_wait()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_async_wait(unqlite *pDb)
+{
+	if( UNQLITE_DB_MISUSE(pDb) ){
+		return UNQLITE_CORRUPT;
+	}
+	/* The handle is not held since the workers need it */
+	return unqliteAsyncWait(pDb);
+}
+/*
+ * [CAPIREF: unqlite_shard_open()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_shard_open(unqlite_shard **ppOut,const char *zPath,int nShard,unsigned int iMode)
+{
+	int rc;
+	if( ppOut == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+	*ppOut = 0;
+	if( nShard < 1 || nShard > UNQLITE_SHARD_MAX ){
+		return UNQLITE_INVALID;
+	}
+	/* One-time automatic library initialization */
+	rc = unqliteCoreInitialize();
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return unqliteShardOpen(ppOut,zPath,nShard,iMode);
+}
+/*
+ * [CAPIREF: unqlite_shard_close()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_shard_close(unqlite_shard *pShard)
+{
+	if( UNQLITE_SHARD_MISUSE(pShard) ){
+		return UNQLITE_CORRUPT;
+	}
+	return unqliteShardClose(pShard);
+}
+/*
+ * [CAPIREF: unqlite_shard_locate()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_shard_locate(unqlite_shard *pShard,const void *pKey,int nKeyLen)
+{
+	if( UNQLITE_SHARD_MISUSE(pShard) || pKey == 0 ){
+		return -1;
+	}
+	if( nKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nKeyLen = SyStrlen((const char *)pKey);
+	}
+	return unqliteShardLocate(pShard,pKey,(sxu32)nKeyLen);
+}
+/*
+ * [CAPIREF: unqlite_shard_handle()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+unqlite * unqlite_shard_handle(unqlite_shard *pShard,int iShard)
+{
+	if( UNQLITE_SHARD_MISUSE(pShard) || iShard < 0 || iShard >= pShard->nShard ){
+		return 0;
+	}
+	return pShard->apDb[iShard];
+}
+/*
+ * Return the handle of the shard owning the given key or NULL
+ * when the key is empty.
+ */
+static unqlite * unqliteShardRoute(unqlite_shard *pShard,const void *pKey,int *pKeyLen)
+{
+	if( *pKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		*pKeyLen = SyStrlen((const char *)pKey);
+	}
+	if( *pKeyLen < 1 ){
+		return 0;
 	}
-	return rc;
+	return pShard->apDb[unqliteShardLocate(pShard,pKey,(sxu32)*pKeyLen)];
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_last_entry()]
+ * [CAPIREF: unqlite_shard_kv_store()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_last_entry(unqlite_kv_cursor *pCursor)
+int unqlite_shard_kv_store(unqlite_shard *pShard,const void *pKey,int nKeyLen,const void *pData,unqlite_int64 nDataLen)
 {
-	int rc;
-#ifdef UNTRUST
-	if( pCursor == 0 ){
+	unqlite *pDb;
+	if( UNQLITE_SHARD_MISUSE(pShard) || pKey == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	/* Check if the requested method is implemented by the underlying storage engine */
-	if( pCursor->pStore->pIo->pMethods->xLast == 0 ){
-		rc = UNQLITE_NOTIMPLEMENTED;
-	}else{
-		/* Seek to the last entry */
-		rc = pCursor->pStore->pIo->pMethods->xLast(pCursor);
+	pDb = unqliteShardRoute(pShard,pKey,&nKeyLen);
+	if( pDb == 0 ){
+		return UNQLITE_EMPTY;
 	}
-	return rc;
+	return unqlite_kv_store(pDb,pKey,nKeyLen,pData,nDataLen);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_valid_entry()]
+ * [CAPIREF: unqlite_shard_kv_append()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_valid_entry(unqlite_kv_cursor *pCursor)
+int unqlite_shard_kv_append(unqlite_shard *pShard,const void *pKey,int nKeyLen,const void *pData,unqlite_int64 nDataLen)
 {
-	int rc;
-#ifdef UNTRUST
-	if( pCursor == 0 ){
+	unqlite *pDb;
+	if( UNQLITE_SHARD_MISUSE(pShard) || pKey == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	/* Check if the requested method is implemented by the underlying storage engine */
-	if( pCursor->pStore->pIo->pMethods->xValid == 0 ){
-		rc = UNQLITE_NOTIMPLEMENTED;
-	}else{
-		rc = pCursor->pStore->pIo->pMethods->xValid(pCursor);
+	pDb = unqliteShardRoute(pShard,pKey,&nKeyLen);
+	if( pDb == 0 ){
+		return UNQLITE_EMPTY;
 	}
-	return rc;
+	return unqlite_kv_append(pDb,pKey,nKeyLen,pData,nDataLen);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_next_entry()]
+ * [CAPIREF: unqlite_shard_kv_fetch()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_next_entry(unqlite_kv_cursor *pCursor)
+int unqlite_shard_kv_fetch(unqlite_shard *pShard,const void *pKey,int nKeyLen,void *pBuf,unqlite_int64 *pBufLen)
 {
-	int rc;
-#ifdef UNTRUST
-	if( pCursor == 0 ){
+	unqlite *pDb;
+	if( UNQLITE_SHARD_MISUSE(pShard) || pKey == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	/* Check if the requested method is implemented by the underlying storage engine */
-	if( pCursor->pStore->pIo->pMethods->xNext == 0 ){
-		rc = UNQLITE_NOTIMPLEMENTED;
-	}else{
-		/* Seek to the next entry */
-		rc = pCursor->pStore->pIo->pMethods->xNext(pCursor);
+	pDb = unqliteShardRoute(pShard,pKey,&nKeyLen);
+	if( pDb == 0 ){
+		return UNQLITE_EMPTY;
 	}
-	return rc;
+	return unqlite_kv_fetch(pDb,pKey,nKeyLen,pBuf,pBufLen);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_prev_entry()]
+ * [CAPIREF: unqlite_shard_kv_fetch_callback()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_prev_entry(unqlite_kv_cursor *pCursor)
+int unqlite_shard_kv_fetch_callback(unqlite_shard *pShard,const void *pKey,int nKeyLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
 {
-	int rc;
-#ifdef UNTRUST
-	if( pCursor == 0 ){
+	unqlite *pDb;
+	if( UNQLITE_SHARD_MISUSE(pShard) || pKey == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	/* Check if the requested method is implemented by the underlying storage engine */
-	if( pCursor->pStore->pIo->pMethods->xPrev == 0 ){
-		rc = UNQLITE_NOTIMPLEMENTED;
-	}else{
-		/* Seek to the previous entry */
-		rc = pCursor->pStore->pIo->pMethods->xPrev(pCursor);
+	pDb = unqliteShardRoute(pShard,pKey,&nKeyLen);
+	if( pDb == 0 ){
+		return UNQLITE_EMPTY;
 	}
-	return rc;
+	return unqlite_kv_fetch_callback(pDb,pKey,nKeyLen,xConsumer,pUserData);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_delete_entry()]
+ * [CAPIREF: unqlite_shard_kv_delete()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_delete_entry(unqlite_kv_cursor *pCursor)
+int unqlite_shard_kv_delete(unqlite_shard *pShard,const void *pKey,int nKeyLen)
 {
-	int rc;
-#ifdef UNTRUST
-	if( pCursor == 0 ){
+	unqlite *pDb;
+	if( UNQLITE_SHARD_MISUSE(pShard) || pKey == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	/* Check if the requested method is implemented by the underlying storage engine */
-	if( pCursor->pStore->pIo->pMethods->xDelete == 0 ){
-		rc = UNQLITE_NOTIMPLEMENTED;
-	}else{
-		/* Delete the entry */
-		rc = pCursor->pStore->pIo->pMethods->xDelete(pCursor);
+	pDb = unqliteShardRoute(pShard,pKey,&nKeyLen);
+	if( pDb == 0 ){
+		return UNQLITE_EMPTY;
 	}
-	return rc;
+	return unqlite_kv_delete(pDb,pKey,nKeyLen);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_reset()]
+ * [CAPIREF: unqlite_shard_commit()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_reset(unqlite_kv_cursor *pCursor)
+int unqlite_shard_commit(unqlite_shard *pShard)
 {
-	int rc = UNQLITE_OK;
-#ifdef UNTRUST
-	if( pCursor == 0 ){
+	if( UNQLITE_SHARD_MISUSE(pShard) ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	/* Check if the requested method is implemented by the underlying storage engine */
-	if( pCursor->pStore->pIo->pMethods->xReset == 0 ){
-		rc = UNQLITE_NOTIMPLEMENTED;
-	}else{
-		/* Reset */
-		pCursor->pStore->pIo->pMethods->xReset(pCursor);
-	}
-	return rc;
+	return unqliteShardCommit(pShard);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_seek()]
+ * [CAPIREF: unqlite_shard_rollback()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_seek(unqlite_kv_cursor *pCursor,const void *pKey,int nKeyLen,int iPos)
+int unqlite_shard_rollback(unqlite_shard *pShard)
 {
-	int rc = UNQLITE_OK;
-#ifdef UNTRUST
-	if( pCursor == 0 ){
+	if( UNQLITE_SHARD_MISUSE(pShard) ){
 		return UNQLITE_CORRUPT;
 	}
-#endif
-	if( nKeyLen < 0 ){
-		/* Assume a null terminated string and compute it's length */
-		nKeyLen = SyStrlen((const char *)pKey);
+	return unqliteShardRollback(pShard);
+}
+/*
+ * [CAPIREF: unqlite_shard_cursor_init()]
+ * Please refer to the official documentation for function purpose and expected parameters.
+ */
+int unqlite_shard_cursor_init(unqlite_shard *pShard,unqlite_shard_cursor **ppOut)
+{
+	unqlite_shard_cursor *pCursor;
+	if( UNQLITE_SHARD_MISUSE(pShard) || ppOut == 0 ){
+		return UNQLITE_CORRUPT;
 	}
-	if( !nKeyLen ){
-		rc = UNQLITE_EMPTY;
-	}else{
-		/* Seek to the desired location */
-		rc = pCursor->pStore->pIo->pMethods->xSeek(pCursor,pKey,nKeyLen,iPos);
+	pCursor = (unqlite_shard_cursor *)SyMemBackendAlloc((SyMemBackend *)unqliteExportMemBackend(),sizeof(unqlite_shard_cursor));
+	if( pCursor == 0 ){
+		return UNQLITE_NOMEM;
 	}
-	return rc;
+	pCursor->pShard = pShard;
+	pCursor->pCur = 0;
+	pCursor->iShard = -1;
+	*ppOut = pCursor;
+	return UNQLITE_OK;
 }
 /*
- * Default data consumer callback. That is, all retrieved is redirected to this
- * routine which store the output in an internal blob.
+ * [CAPIREF: unqlite_shard_cursor_release()]
+ * Please refer to the official documentation for function purpose and expected parameters.
  */
-UNQLITE_PRIVATE int unqliteDataConsumer(
-	const void *pOut,   /* Data to consume */
-	unsigned int nLen,  /* Data length */
-	void *pUserData     /* User private data */
-	)
+int unqlite_shard_cursor_release(unqlite_shard_cursor *pCursor)
 {
-	 sxi32 rc;
-	 /* Store the output in an internal BLOB */
-	 rc = SyBlobAppend((SyBlob *)pUserData, pOut, nLen);
-	 return rc;
+	if( pCursor == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+	unqliteShardCursorReset(pCursor);
+	SyMemBackendFree((SyMemBackend *)unqliteExportMemBackend(),pCursor);
+	return UNQLITE_OK;
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_data_callback()]
+ * [CAPIREF: unqlite_shard_cursor_first_entry()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_key_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+int unqlite_shard_cursor_first_entry(unqlite_shard_cursor *pCursor)
 {
-	int rc;
 #ifdef UNTRUST
 	if( pCursor == 0 ){
 		return UNQLITE_CORRUPT;
 	}
 #endif
-	/* Consume the key directly */
-	rc = pCursor->pStore->pIo->pMethods->xKey(pCursor,xConsumer,pUserData);
-	return rc;
+	return unqliteShardCursorSettle(pCursor,0,1);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_key()]
+ * [CAPIREF: unqlite_shard_cursor_last_entry()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_key(unqlite_kv_cursor *pCursor,void *pBuf,int *pnByte)
+int unqlite_shard_cursor_last_entry(unqlite_shard_cursor *pCursor)
 {
-	int rc;
 #ifdef UNTRUST
 	if( pCursor == 0 ){
 		return UNQLITE_CORRUPT;
 	}
 #endif
-	if( pBuf == 0 ){
-		/* Key length only */
-		rc = pCursor->pStore->pIo->pMethods->xKeyLength(pCursor,pnByte);
-	}else{
-		SyBlob sBlob;
-		if( (*pnByte) < 0 ){
-			return UNQLITE_CORRUPT;
-		}
-		/* Initialize the data consumer */
-		SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)(*pnByte));
-		/* Consume the key */
-		rc = pCursor->pStore->pIo->pMethods->xKey(pCursor,unqliteDataConsumer,&sBlob);
-		 /* Key length */
-		*pnByte = SyBlobLength(&sBlob);
-		/* Cleanup */
-		SyBlobRelease(&sBlob);
-	}
-	return rc;
+	return unqliteShardCursorSettle(pCursor,pCursor->pShard->nShard - 1,0);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_data_callback()]
+ * [CAPIREF: unqlite_shard_cursor_valid_entry()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_data_callback(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+int unqlite_shard_cursor_valid_entry(unqlite_shard_cursor *pCursor)
 {
-	int rc;
 #ifdef UNTRUST
 	if( pCursor == 0 ){
 		return UNQLITE_CORRUPT;
 	}
 #endif
-	/* Consume the data directly */
-	rc = pCursor->pStore->pIo->pMethods->xData(pCursor,xConsumer,pUserData);
-	return rc;
+	if( pCursor->pCur == 0 ){
+		return 0;
+	}
+	return unqlite_kv_cursor_valid_entry(pCursor->pCur);
 }
 /*
- * [CAPIREF: unqlite_kv_cursor_data()]
+ * [CAPIREF: unqlite_shard_cursor_next_entry()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_kv_cursor_data(unqlite_kv_cursor *pCursor,void *pBuf,unqlite_int64 *pnByte)
+int unqlite_shard_cursor_next_entry(unqlite_shard_cursor *pCursor)
 {
 	int rc;
 #ifdef UNTRUST
@@ -2590,102 +4561,88 @@ int unqlite_kv_cursor_data(unqlite_kv_cursor *pCursor,void *pBuf,unqlite_int64 *
 		return UNQLITE_CORRUPT;
 	}
 #endif
-	if( pBuf == 0 ){
-		/* Data length only */
-		rc = pCursor->pStore->pIo->pMethods->xDataLength(pCursor,pnByte);
-	}else{
-		SyBlob sBlob;
-		if( (*pnByte) < 0 ){
-			return UNQLITE_CORRUPT;
-		}
-		/* Initialize the data consumer */
-		SyBlobInitFromBuf(&sBlob,pBuf,(sxu32)(*pnByte));
-		/* Consume the data */
-		rc = pCursor->pStore->pIo->pMethods->xData(pCursor,unqliteDataConsumer,&sBlob);
-		/* Data length */
-		*pnByte = SyBlobLength(&sBlob);
-		/* Cleanup */
-		SyBlobRelease(&sBlob);
+	if( pCursor->pCur == 0 || !unqlite_kv_cursor_valid_entry(pCursor->pCur) ){
+		return UNQLITE_EOF;
 	}
-	return rc;
+	rc = unqlite_kv_cursor_next_entry(pCursor->pCur);
+	if( unqlite_kv_cursor_valid_entry(pCursor->pCur) ){
+		return UNQLITE_OK;
+	}
+	if( rc != UNQLITE_OK && rc != UNQLITE_EOF && rc != UNQLITE_DONE ){
+		return rc;
+	}
+	/* End of this shard, move to the first entry of the next non-empty one */
+	return unqliteShardCursorSettle(pCursor,pCursor->iShard + 1,1);
 }
 /*
- * [CAPIREF: unqlite_begin()]
+ * [CAPIREF: unqlite_shard_cursor_prev_entry()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_begin(unqlite *pDb)
+int unqlite_shard_cursor_prev_entry(unqlite_shard_cursor *pCursor)
 {
 	int rc;
-	if( UNQLITE_DB_MISUSE(pDb) ){
+#ifdef UNTRUST
+	if( pCursor == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#if defined(UNQLITE_ENABLE_THREADS)
-	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
-	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
-		 UNQLITE_THRD_DB_RELEASE(pDb) ){
-			 return UNQLITE_ABORT; /* Another thread have released this instance */
-	 }
-#endif
-	 /* Begin the write transaction */
-	 rc = unqlitePagerBegin(pDb->sDB.pPager);
-#if defined(UNQLITE_ENABLE_THREADS)
-	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
-	 return rc;
+	if( pCursor->pCur == 0 || !unqlite_kv_cursor_valid_entry(pCursor->pCur) ){
+		return UNQLITE_EOF;
+	}
+	rc = unqlite_kv_cursor_prev_entry(pCursor->pCur);
+	if( unqlite_kv_cursor_valid_entry(pCursor->pCur) ){
+		return UNQLITE_OK;
+	}
+	if( rc != UNQLITE_OK && rc != UNQLITE_EOF && rc != UNQLITE_DONE ){
+		return rc;
+	}
+	/* Start of this shard, move to the last entry of the previous non-empty one */
+	return unqliteShardCursorSettle(pCursor,pCursor->iShard - 1,0);
 }
 /*
- * [CAPIREF: unqlite_commit()]
+ * [CAPIREF: unqlite_shard_cursor_seek()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_commit(unqlite *pDb)
+int unqlite_shard_cursor_seek(unqlite_shard_cursor *pCursor,const void *pKey,int nKeyLen,int iPos)
 {
-	int rc;
-	if( UNQLITE_DB_MISUSE(pDb) ){
+	unqlite_shard *pShard;
+	int iShard,rc;
+#ifdef UNTRUST
+	if( pCursor == 0 ){
 		return UNQLITE_CORRUPT;
 	}
-#if defined(UNQLITE_ENABLE_THREADS)
-	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
-	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
-		 UNQLITE_THRD_DB_RELEASE(pDb) ){
-			 return UNQLITE_ABORT; /* Another thread have released this instance */
-	 }
-#endif
-	 /* Commit the transaction */
-	 rc = unqlitePagerCommit(pDb->sDB.pPager);
-#if defined(UNQLITE_ENABLE_THREADS)
-	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
-	 return rc;
+	pShard = pCursor->pShard;
+	if( nKeyLen < 0 ){
+		/* Assume a null terminated string and compute it's length */
+		nKeyLen = SyStrlen((const char *)pKey);
+	}
+	if( !nKeyLen ){
+		return UNQLITE_EMPTY;
+	}
+	/* Only the shard owning the key is searched */
+	iShard = unqliteShardLocate(pShard,pKey,(sxu32)nKeyLen);
+	if( pCursor->pCur == 0 || pCursor->iShard != iShard ){
+		unqliteShardCursorReset(pCursor);
+		rc = unqlite_kv_cursor_init(pShard->apDb[iShard],&pCursor->pCur);
+		if( rc != UNQLITE_OK ){
+			pCursor->pCur = 0;
+			return rc;
+		}
+		pCursor->iShard = iShard;
+	}
+	return unqlite_kv_cursor_seek(pCursor->pCur,pKey,nKeyLen,iPos);
 }
 /*
- * [CAPIREF: unqlite_rollback()]
+ * [CAPIREF: unqlite_shard_cursor_kv()]
  * Please refer to the official documentation for function purpose and expected parameters.
  */
-int unqlite_rollback(unqlite *pDb)
+unqlite_kv_cursor * unqlite_shard_cursor_kv(unqlite_shard_cursor *pCursor)
 {
-	int rc;
-	if( UNQLITE_DB_MISUSE(pDb) ){
-		return UNQLITE_CORRUPT;
+	if( pCursor == 0 || pCursor->pCur == 0 || !unqlite_kv_cursor_valid_entry(pCursor->pCur) ){
+		return 0;
 	}
-#if defined(UNQLITE_ENABLE_THREADS)
-	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
-	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
-		 UNQLITE_THRD_DB_RELEASE(pDb) ){
-			 return UNQLITE_ABORT; /* Another thread have released this instance */
-	 }
-#endif
-	 /* Rollback the transaction */
-	 rc = unqlitePagerRollback(pDb->sDB.pPager,TRUE);
-#if defined(UNQLITE_ENABLE_THREADS)
-	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
-#endif
-	 return rc;
+	return pCursor->pCur;
 }
 /*
  * [CAPIREF: unqlite_util_load_mmaped_file()]
@@ -2749,7 +4706,7 @@ UNQLITE_APIEXPORT int unqlite_util_random_string(unqlite *pDb,char *zBuf,unsigne
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return UNQLITE_ABORT; /* Another thread have released this instance */
@@ -2759,7 +4716,7 @@ UNQLITE_APIEXPORT int unqlite_util_random_string(unqlite *pDb,char *zBuf,unsigne
 	 unqlitePagerRandomString(pDb->sDB.pPager,zBuf,buf_size);
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	 return UNQLITE_OK;
 }
@@ -2775,7 +4732,7 @@ UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb)
 	}
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Acquire DB mutex */
-	 SyMutexEnter(sUnqlMPGlobal.pMutexMethods, pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbEnter(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 	 if( sUnqlMPGlobal.nThreadingLevel > UNQLITE_THREAD_LEVEL_SINGLE && 
 		 UNQLITE_THRD_DB_RELEASE(pDb) ){
 			 return 0; /* Another thread have released this instance */
@@ -2785,7 +4742,7 @@ UNQLITE_APIEXPORT unsigned int unqlite_util_random_num(unqlite *pDb)
 	 iNum = unqlitePagerRandomNum(pDb->sDB.pPager);
 #if defined(UNQLITE_ENABLE_THREADS)
 	 /* Leave DB mutex */
-	 SyMutexLeave(sUnqlMPGlobal.pMutexMethods,pDb->pMutex); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
+	 unqliteDbLeave(pDb); /* NO-OP if sUnqlMPGlobal.nThreadingLevel != UNQLITE_THREAD_LEVEL_MULTI */
 #endif
 	 return iNum;
 }
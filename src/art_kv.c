@@ -0,0 +1,1262 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: art_kv.c v1.0 Unix 2018-06-11 09:12 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements an in-memory key value storage engine based on an
+ * Adaptive Radix Tree (ART). Like the default in-memory engine, it does not
+ * support transactions.
+ *
+ * Inner nodes come in four sizes (4, 16, 48 and 256 children) and grow or shrink
+ * as children are added or removed. Common key prefixes are stored once in the
+ * inner nodes (path compression) and each record is a single leaf allocation
+ * holding the key and the data, so the per-record overhead is far lower than
+ * the chained hash table and records are iterated in key order (Byte-wise
+ * comparison, shorter keys first). Cursors honor the UNQLITE_CURSOR_MATCH_LE and
+ * UNQLITE_CURSOR_MATCH_GE seek positions so that range and prefix scans are possible.
+ *
+ * The engine is named "art" and is selected via unqlite_config(UNQLITE_CONFIG_KV_ENGINE,"art")
+ * before the database is accessed.
+ */
+/* Inner node types */
+#define ART_NODE4   1
+#define ART_NODE16  2
+#define ART_NODE48  3
+#define ART_NODE256 4
+/*
+ * Child pointers to leaves are tagged with the low bit set.
+ */
+#define ART_IS_LEAF(PTR)   (((sxuptr)(PTR)) & 1)
+#define ART_LEAF(PTR)      ((art_leaf *)(((char *)(PTR)) - 1))
+#define ART_TAG_LEAF(LEAF) ((void *)(((char *)(LEAF)) + 1))
+/* Forward declaration */
+typedef struct art_kv_engine art_kv_engine;
+typedef struct art_node art_node;
+typedef struct art_leaf art_leaf;
+/*
+ * A record: The key and the data follow this header.
+ */
+struct art_leaf
+{
+	sxu32 nKey;   /* Key length */
+	sxu32 nData;  /* Data length */
+};
+#define ART_LEAF_KEY(LEAF)  ((unsigned char *)&(LEAF)[1])
+#define ART_LEAF_DATA(LEAF) (&ART_LEAF_KEY(LEAF)[(LEAF)->nKey])
+/*
+ * Common header of the inner nodes.
+ * The compressed path (nPrefix bytes) follow the node structure.
+ */
+struct art_node
+{
+	void *pValue;     /* Tagged leaf of the key ending at this node if any */
+	sxu32 nPrefix;    /* Compressed path length */
+	sxu16 nChild;     /* Number of children */
+	sxu8 iType;       /* ART_NODE* */
+};
+typedef struct art_node4 art_node4;
+struct art_node4
+{
+	art_node sHdr;
+	unsigned char aKey[4];   /* Sorted child bytes */
+	void *apChild[4];
+};
+typedef struct art_node16 art_node16;
+struct art_node16
+{
+	art_node sHdr;
+	unsigned char aKey[16];  /* Sorted child bytes */
+	void *apChild[16];
+};
+typedef struct art_node48 art_node48;
+struct art_node48
+{
+	art_node sHdr;
+	unsigned char aIndex[256]; /* Slot + 1 of each child byte, 0 when absent */
+	void *apChild[48];
+};
+typedef struct art_node256 art_node256;
+struct art_node256
+{
+	art_node sHdr;
+	void *apChild[256];
+};
+/*
+ * Each ART KV engine is represented by an instance
+ * of the following structure.
+ */
+struct art_kv_engine
+{
+	const unqlite_kv_io *pIo;   /* IO methods: MUST be first */
+	/* Private fields */
+	SyMemBackend sAlloc;        /* Private memory allocator */
+	art_node *pRoot;            /* Root node, never collapsed */
+	sxu32 nRecord;              /* Total number of records */
+	sxu32 iGen;                 /* Incremented on each change so that cursors can detect it */
+	SyBlob sWorker;             /* Working buffer */
+};
+/*
+ * Size of an inner node structure.
+ */
+static sxu32 artNodeSize(sxu8 iType)
+{
+	switch(iType){
+	case ART_NODE4:  return sizeof(art_node4);
+	case ART_NODE16: return sizeof(art_node16);
+	case ART_NODE48: return sizeof(art_node48);
+	default:
+		break;
+	}
+	return sizeof(art_node256);
+}
+#define ART_PREFIX(NODE) (((unsigned char *)(NODE)) + artNodeSize((NODE)->iType))
+/*
+ * Allocate a new empty inner node.
+ */
+static art_node * artNodeAlloc(art_kv_engine *pEngine,sxu8 iType,const unsigned char *zPrefix,sxu32 nPrefix)
+{
+	art_node *pNode;
+	sxu32 nSize = artNodeSize(iType);
+	pNode = (art_node *)SyMemBackendPoolAlloc(&pEngine->sAlloc,nSize + nPrefix);
+	if( pNode == 0 ){
+		return 0;
+	}
+	SyZero(pNode,nSize);
+	pNode->iType = iType;
+	pNode->nPrefix = nPrefix;
+	if( nPrefix > 0 ){
+		SyMemcpy((const void *)zPrefix,(void *)ART_PREFIX(pNode),nPrefix);
+	}
+	return pNode;
+}
+/*
+ * Allocate a new leaf.
+ */
+static art_leaf * artLeafAlloc(art_kv_engine *pEngine,const void *pKey,sxu32 nKey,const void *pData,sxu32 nData)
+{
+	art_leaf *pLeaf;
+	pLeaf = (art_leaf *)SyMemBackendPoolAlloc(&pEngine->sAlloc,sizeof(art_leaf) + nKey + nData);
+	if( pLeaf == 0 ){
+		return 0;
+	}
+	pLeaf->nKey = nKey;
+	pLeaf->nData = nData;
+	SyMemcpy(pKey,(void *)ART_LEAF_KEY(pLeaf),nKey);
+	if( nData > 0 ){
+		SyMemcpy(pData,(void *)ART_LEAF_DATA(pLeaf),nData);
+	}
+	return pLeaf;
+}
+/*
+ * Return a pointer to the slot holding the child for the given byte or NULL.
+ */
+static void ** artFindChild(art_node *pNode,unsigned char c)
+{
+	sxu32 i;
+	switch(pNode->iType){
+	case ART_NODE4: {
+		art_node4 *p = (art_node4 *)pNode;
+		for( i = 0 ; i < pNode->nChild ; ++i ){
+			if( p->aKey[i] == c ){
+				return &p->apChild[i];
+			}
+		}
+		break;
+					}
+	case ART_NODE16: {
+		art_node16 *p = (art_node16 *)pNode;
+		for( i = 0 ; i < pNode->nChild ; ++i ){
+			if( p->aKey[i] >= c ){
+				if( p->aKey[i] == c ){
+					return &p->apChild[i];
+				}
+				break;
+			}
+		}
+		break;
+					 }
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)pNode;
+		if( p->aIndex[c] ){
+			return &p->apChild[p->aIndex[c] - 1];
+		}
+		break;
+					 }
+	default: {
+		art_node256 *p = (art_node256 *)pNode;
+		if( p->apChild[c] ){
+			return &p->apChild[c];
+		}
+		break;
+			 }
+	}
+	return 0;
+}
+/*
+ * Return the child with the smallest byte greater than iPos (-1 for the first child)
+ * or NULL when there is no such child.
+ */
+static void * artNextChild(art_node *pNode,int iPos,int *pByte)
+{
+	sxu32 i;
+	int c;
+	switch(pNode->iType){
+	case ART_NODE4:
+	case ART_NODE16: {
+		unsigned char *aKey = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->aKey : ((art_node16 *)pNode)->aKey;
+		void **apChild = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->apChild : ((art_node16 *)pNode)->apChild;
+		for( i = 0 ; i < pNode->nChild ; ++i ){
+			if( (int)aKey[i] > iPos ){
+				*pByte = aKey[i];
+				return apChild[i];
+			}
+		}
+		break;
+					 }
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)pNode;
+		for( c = iPos + 1 ; c < 256 ; ++c ){
+			if( p->aIndex[c] ){
+				*pByte = c;
+				return p->apChild[p->aIndex[c] - 1];
+			}
+		}
+		break;
+					 }
+	default: {
+		art_node256 *p = (art_node256 *)pNode;
+		for( c = iPos + 1 ; c < 256 ; ++c ){
+			if( p->apChild[c] ){
+				*pByte = c;
+				return p->apChild[c];
+			}
+		}
+		break;
+			 }
+	}
+	return 0;
+}
+/*
+ * Return the child with the largest byte less than iPos (256 for the last child)
+ * or NULL when there is no such child.
+ */
+static void * artPrevChild(art_node *pNode,int iPos,int *pByte)
+{
+	sxi32 i;
+	int c;
+	switch(pNode->iType){
+	case ART_NODE4:
+	case ART_NODE16: {
+		unsigned char *aKey = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->aKey : ((art_node16 *)pNode)->aKey;
+		void **apChild = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->apChild : ((art_node16 *)pNode)->apChild;
+		for( i = (sxi32)pNode->nChild - 1 ; i >= 0 ; --i ){
+			if( (int)aKey[i] < iPos ){
+				*pByte = aKey[i];
+				return apChild[i];
+			}
+		}
+		break;
+					 }
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)pNode;
+		for( c = iPos - 1 ; c >= 0 ; --c ){
+			if( p->aIndex[c] ){
+				*pByte = c;
+				return p->apChild[p->aIndex[c] - 1];
+			}
+		}
+		break;
+					 }
+	default: {
+		art_node256 *p = (art_node256 *)pNode;
+		for( c = iPos - 1 ; c >= 0 ; --c ){
+			if( p->apChild[c] ){
+				*pByte = c;
+				return p->apChild[c];
+			}
+		}
+		break;
+			 }
+	}
+	return 0;
+}
+/*
+ * Insert a child in a node that have room for it.
+ */
+static void artNodeInsert(art_node *pNode,unsigned char c,void *pChild)
+{
+	sxu32 i;
+	switch(pNode->iType){
+	case ART_NODE4:
+	case ART_NODE16: {
+		unsigned char *aKey = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->aKey : ((art_node16 *)pNode)->aKey;
+		void **apChild = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->apChild : ((art_node16 *)pNode)->apChild;
+		/* Keep the bytes sorted */
+		for( i = pNode->nChild ; i > 0 && aKey[i - 1] > c ; --i ){
+			aKey[i] = aKey[i - 1];
+			apChild[i] = apChild[i - 1];
+		}
+		aKey[i] = c;
+		apChild[i] = pChild;
+		break;
+					 }
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)pNode;
+		for( i = 0 ; p->apChild[i] ; ++i ){
+			/* Locate a free slot */
+		}
+		p->apChild[i] = pChild;
+		p->aIndex[c] = (unsigned char)(i + 1);
+		break;
+					 }
+	default:
+		((art_node256 *)pNode)->apChild[c] = pChild;
+		break;
+	}
+	pNode->nChild++;
+}
+/*
+ * Remove the child for the given byte.
+ */
+static void artNodeErase(art_node *pNode,unsigned char c)
+{
+	sxu32 i;
+	switch(pNode->iType){
+	case ART_NODE4:
+	case ART_NODE16: {
+		unsigned char *aKey = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->aKey : ((art_node16 *)pNode)->aKey;
+		void **apChild = pNode->iType == ART_NODE4 ? ((art_node4 *)pNode)->apChild : ((art_node16 *)pNode)->apChild;
+		for( i = 0 ; aKey[i] != c ; ++i ){
+			/* Locate the child */
+		}
+		for( ++i ; i < pNode->nChild ; ++i ){
+			aKey[i - 1] = aKey[i];
+			apChild[i - 1] = apChild[i];
+		}
+		break;
+					 }
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)pNode;
+		p->apChild[p->aIndex[c] - 1] = 0;
+		p->aIndex[c] = 0;
+		break;
+					 }
+	default:
+		((art_node256 *)pNode)->apChild[c] = 0;
+		break;
+	}
+	pNode->nChild--;
+}
+/*
+ * Copy a node into a new node of the given type whose compressed path is
+ * the given head followed by the compressed path of the old node.
+ * The old node is released.
+ */
+static art_node * artNodeClone(art_kv_engine *pEngine,art_node *pOld,sxu8 iType,const unsigned char *zHead,sxu32 nHead)
+{
+	art_node *pNew;
+	void *pChild;
+	int c = -1;
+	pNew = (art_node *)SyMemBackendPoolAlloc(&pEngine->sAlloc,artNodeSize(iType) + nHead + pOld->nPrefix);
+	if( pNew == 0 ){
+		return 0;
+	}
+	SyZero(pNew,artNodeSize(iType));
+	pNew->iType = iType;
+	pNew->nPrefix = nHead + pOld->nPrefix;
+	if( nHead > 0 ){
+		SyMemcpy((const void *)zHead,(void *)ART_PREFIX(pNew),nHead);
+	}
+	if( pOld->nPrefix > 0 ){
+		SyMemcpy((const void *)ART_PREFIX(pOld),(void *)&ART_PREFIX(pNew)[nHead],pOld->nPrefix);
+	}
+	pNew->pValue = pOld->pValue;
+	for(;;){
+		pChild = artNextChild(pOld,c,&c);
+		if( pChild == 0 ){
+			break;
+		}
+		artNodeInsert(pNew,(unsigned char)c,pChild);
+	}
+	SyMemBackendPoolFree(&pEngine->sAlloc,pOld);
+	return pNew;
+}
+/*
+ * Add a child to the node stored in the given slot, growing the node if full.
+ */
+static int artAddChild(art_kv_engine *pEngine,void **pSlot,unsigned char c,void *pChild)
+{
+	art_node *pNode = (art_node *)*pSlot;
+	sxu8 iType = 0;
+	switch(pNode->iType){
+	case ART_NODE4:  if( pNode->nChild >= 4 )  iType = ART_NODE16;  break;
+	case ART_NODE16: if( pNode->nChild >= 16 ) iType = ART_NODE48;  break;
+	case ART_NODE48: if( pNode->nChild >= 48 ) iType = ART_NODE256; break;
+	default:
+		break;
+	}
+	if( iType ){
+		/* Grow the node */
+		pNode = artNodeClone(pEngine,pNode,iType,0,0);
+		if( pNode == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		*pSlot = (void *)pNode;
+	}
+	artNodeInsert(pNode,c,pChild);
+	return UNQLITE_OK;
+}
+/*
+ * Shrink the node stored in the given slot when it become sparse.
+ */
+static void artShrink(art_kv_engine *pEngine,void **pSlot)
+{
+	art_node *pNode = (art_node *)*pSlot;
+	sxu8 iType = 0;
+	switch(pNode->iType){
+	case ART_NODE16:  if( pNode->nChild <= 3 )  iType = ART_NODE4;  break;
+	case ART_NODE48:  if( pNode->nChild <= 12 ) iType = ART_NODE16; break;
+	case ART_NODE256: if( pNode->nChild <= 36 ) iType = ART_NODE48; break;
+	default:
+		break;
+	}
+	if( iType ){
+		pNode = artNodeClone(pEngine,pNode,iType,0,0);
+		if( pNode ){
+			*pSlot = (void *)pNode;
+		}
+		/* Otherwise keep the larger node, simply a memory hit */
+	}
+}
+/*
+ * Compare the key of a leaf with the given key.
+ */
+static sxi32 artLeafCmp(art_leaf *pLeaf,const unsigned char *zKey,sxu32 nKey)
+{
+	sxu32 n = pLeaf->nKey < nKey ? pLeaf->nKey : nKey;
+	sxi32 rc = 0;
+	if( n > 0 ){
+		rc = SyMemcmp((const void *)ART_LEAF_KEY(pLeaf),(const void *)zKey,n);
+	}
+	if( rc == 0 && pLeaf->nKey != nKey ){
+		rc = pLeaf->nKey < nKey ? -1 : 1;
+	}
+	return rc;
+}
+/*
+ * Overwrite or append to the data of the leaf stored in the given slot.
+ */
+static int artLeafStore(art_kv_engine *pEngine,void **pSlot,const void *pData,sxu32 nData,int bAppend)
+{
+	art_leaf *pLeaf = ART_LEAF(*pSlot);
+	art_leaf *pNew;
+	sxu64 nTotal;
+	if( !bAppend && nData == pLeaf->nData ){
+		/* Overwrite in place */
+		if( nData > 0 ){
+			SyMemcpy(pData,(void *)ART_LEAF_DATA(pLeaf),nData);
+		}
+		return UNQLITE_OK;
+	}
+	nTotal = bAppend ? (sxu64)pLeaf->nData + nData : nData;
+	if( nTotal + pLeaf->nKey + sizeof(art_leaf) >= SXU32_HIGH ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Append operation will cause data overflow");
+		return UNQLITE_LIMIT;
+	}
+	pNew = (art_leaf *)SyMemBackendPoolAlloc(&pEngine->sAlloc,sizeof(art_leaf) + pLeaf->nKey + (sxu32)nTotal);
+	if( pNew == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	pNew->nKey = pLeaf->nKey;
+	pNew->nData = (sxu32)nTotal;
+	SyMemcpy((const void *)ART_LEAF_KEY(pLeaf),(void *)ART_LEAF_KEY(pNew),pLeaf->nKey + (bAppend ? pLeaf->nData : 0));
+	if( nData > 0 ){
+		SyMemcpy(pData,(void *)&ART_LEAF_DATA(pNew)[bAppend ? pLeaf->nData : 0],nData);
+	}
+	SyMemBackendPoolFree(&pEngine->sAlloc,pLeaf);
+	*pSlot = ART_TAG_LEAF(pNew);
+	return UNQLITE_OK;
+}
+/*
+ * Insert a new record or overwrite (append to) an existing one.
+ */
+static int artInsert(art_kv_engine *pEngine,const unsigned char *zKey,sxu32 nKey,const void *pData,sxu32 nData,int bAppend)
+{
+	void **pSlot = (void **)&pEngine->pRoot;
+	unsigned char *zPrefix;
+	art_leaf *pLeaf,*pOld;
+	art_node *pNode,*pNew;
+	sxu32 d = 0,i,e;
+	void **pChild;
+	int rc;
+	pEngine->iGen++;
+	for(;;){
+		pNode = (art_node *)*pSlot;
+		zPrefix = ART_PREFIX(pNode);
+		for( i = 0 ; i < pNode->nPrefix && d + i < nKey && zPrefix[i] == zKey[d + i] ; ++i ){
+			/* Match the compressed path */
+		}
+		if( i < pNode->nPrefix ){
+			/* Split the compressed path */
+			pLeaf = artLeafAlloc(pEngine,zKey,nKey,pData,nData);
+			if( pLeaf == 0 ){
+				return UNQLITE_NOMEM;
+			}
+			pNew = artNodeAlloc(pEngine,ART_NODE4,zPrefix,i);
+			if( pNew == 0 ){
+				SyMemBackendPoolFree(&pEngine->sAlloc,pLeaf);
+				return UNQLITE_NOMEM;
+			}
+			artNodeInsert(pNew,zPrefix[i],(void *)pNode);
+			if( d + i == nKey ){
+				pNew->pValue = ART_TAG_LEAF(pLeaf);
+			}else{
+				artNodeInsert(pNew,zKey[d + i],ART_TAG_LEAF(pLeaf));
+			}
+			/* The old node keep the remaining of its path */
+			pNode->nPrefix -= i + 1;
+			if( pNode->nPrefix > 0 ){
+				/* Forward byte copy, safe for this overlapping move */
+				SyMemcpy((const void *)&zPrefix[i + 1],(void *)zPrefix,pNode->nPrefix);
+			}
+			*pSlot = (void *)pNew;
+			break;
+		}
+		d += pNode->nPrefix;
+		if( d == nKey ){
+			/* The key end at this node */
+			if( pNode->pValue ){
+				return artLeafStore(pEngine,&pNode->pValue,pData,nData,bAppend);
+			}
+			pLeaf = artLeafAlloc(pEngine,zKey,nKey,pData,nData);
+			if( pLeaf == 0 ){
+				return UNQLITE_NOMEM;
+			}
+			pNode->pValue = ART_TAG_LEAF(pLeaf);
+			break;
+		}
+		pChild = artFindChild(pNode,zKey[d]);
+		if( pChild == 0 ){
+			/* New child */
+			pLeaf = artLeafAlloc(pEngine,zKey,nKey,pData,nData);
+			if( pLeaf == 0 ){
+				return UNQLITE_NOMEM;
+			}
+			rc = artAddChild(pEngine,pSlot,zKey[d],ART_TAG_LEAF(pLeaf));
+			if( rc != UNQLITE_OK ){
+				SyMemBackendPoolFree(&pEngine->sAlloc,pLeaf);
+				return rc;
+			}
+			break;
+		}
+		if( !ART_IS_LEAF(*pChild) ){
+			/* Descend */
+			pSlot = pChild;
+			d++;
+			continue;
+		}
+		pOld = ART_LEAF(*pChild);
+		if( artLeafCmp(pOld,zKey,nKey) == 0 ){
+			return artLeafStore(pEngine,pChild,pData,nData,bAppend);
+		}
+		/* Replace the leaf with a node holding both keys */
+		e = d + 1;
+		while( e < nKey && e < pOld->nKey && zKey[e] == ART_LEAF_KEY(pOld)[e] ){
+			e++;
+		}
+		pLeaf = artLeafAlloc(pEngine,zKey,nKey,pData,nData);
+		if( pLeaf == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		pNew = artNodeAlloc(pEngine,ART_NODE4,&zKey[d + 1],e - d - 1);
+		if( pNew == 0 ){
+			SyMemBackendPoolFree(&pEngine->sAlloc,pLeaf);
+			return UNQLITE_NOMEM;
+		}
+		if( pOld->nKey == e ){
+			pNew->pValue = *pChild;
+		}else{
+			artNodeInsert(pNew,ART_LEAF_KEY(pOld)[e],*pChild);
+		}
+		if( nKey == e ){
+			pNew->pValue = ART_TAG_LEAF(pLeaf);
+		}else{
+			artNodeInsert(pNew,zKey[e],ART_TAG_LEAF(pLeaf));
+		}
+		*pChild = (void *)pNew;
+		break;
+	}
+	pEngine->nRecord++;
+	return UNQLITE_OK;
+}
+/*
+ * Remove the record of the given key.
+ */
+static int artDelete(art_kv_engine *pEngine,const unsigned char *zKey,sxu32 nKey)
+{
+	void **pSlot = (void **)&pEngine->pRoot;
+	art_node *pNode;
+	void **pChild;
+	void *pOnly;
+	sxu32 d = 0;
+	int c;
+	for(;;){
+		pNode = (art_node *)*pSlot;
+		if( pNode->nPrefix > 0 ){
+			if( nKey - d < pNode->nPrefix || SyMemcmp((const void *)ART_PREFIX(pNode),(const void *)&zKey[d],pNode->nPrefix) != 0 ){
+				return UNQLITE_NOTFOUND;
+			}
+			d += pNode->nPrefix;
+		}
+		if( d == nKey ){
+			if( pNode->pValue == 0 ){
+				return UNQLITE_NOTFOUND;
+			}
+			SyMemBackendPoolFree(&pEngine->sAlloc,ART_LEAF(pNode->pValue));
+			pNode->pValue = 0;
+			break;
+		}
+		pChild = artFindChild(pNode,zKey[d]);
+		if( pChild == 0 ){
+			return UNQLITE_NOTFOUND;
+		}
+		if( !ART_IS_LEAF(*pChild) ){
+			pSlot = pChild;
+			d++;
+			continue;
+		}
+		if( artLeafCmp(ART_LEAF(*pChild),zKey,nKey) != 0 ){
+			return UNQLITE_NOTFOUND;
+		}
+		SyMemBackendPoolFree(&pEngine->sAlloc,ART_LEAF(*pChild));
+		artNodeErase(pNode,zKey[d]);
+		break;
+	}
+	pEngine->iGen++;
+	pEngine->nRecord--;
+	if( pNode == pEngine->pRoot ){
+		/* The root is never collapsed */
+		artShrink(pEngine,pSlot);
+		return UNQLITE_OK;
+	}
+	/* Inner nodes other than the root hold at least two entries */
+	if( pNode->nChild == 0 ){
+		/* Only the value remain, replace the node by its leaf */
+		*pSlot = pNode->pValue;
+		SyMemBackendPoolFree(&pEngine->sAlloc,pNode);
+	}else if( pNode->nChild == 1 && pNode->pValue == 0 ){
+		/* Merge with the only child */
+		pOnly = artNextChild(pNode,-1,&c);
+		if( ART_IS_LEAF(pOnly) ){
+			*pSlot = pOnly;
+			SyMemBackendPoolFree(&pEngine->sAlloc,pNode);
+		}else{
+			art_node *pMerged;
+			unsigned char zEdge = (unsigned char)c;
+			/* New path: our prefix, the edge byte then the child prefix */
+			SyBlobReset(&pEngine->sWorker);
+			SyBlobAppend(&pEngine->sWorker,(const void *)ART_PREFIX(pNode),pNode->nPrefix);
+			SyBlobAppend(&pEngine->sWorker,(const void *)&zEdge,sizeof(unsigned char));
+			if( SyBlobLength(&pEngine->sWorker) == pNode->nPrefix + 1 ){
+				const unsigned char *zHead = (const unsigned char *)SyBlobData(&pEngine->sWorker);
+				pMerged = artNodeClone(pEngine,(art_node *)pOnly,((art_node *)pOnly)->iType,zHead,pNode->nPrefix + 1);
+				if( pMerged ){
+					*pSlot = (void *)pMerged;
+					SyMemBackendPoolFree(&pEngine->sAlloc,pNode);
+				}
+			}
+			/* Otherwise keep the single child node, simply a memory hit */
+		}
+	}else{
+		artShrink(pEngine,pSlot);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xReplace() method.
+ */
+static int ArtReplace(
+	unqlite_kv_engine *pKv,
+	const void *pKey,int nKeyLen,
+	const void *pData,unqlite_int64 nDataLen
+	)
+{
+	art_kv_engine *pEngine = (art_kv_engine *)pKv;
+	if( nDataLen + nKeyLen >= (unqlite_int64)(SXU32_HIGH - sizeof(art_leaf)) ){
+		/* Database limit */
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Record size limit reached");
+		return UNQLITE_LIMIT;
+	}
+	return artInsert(pEngine,(const unsigned char *)pKey,(sxu32)nKeyLen,pData,(sxu32)nDataLen,0);
+}
+/*
+ * Exported: xAppend() method.
+ */
+static int ArtAppend(
+	unqlite_kv_engine *pKv,
+	const void *pKey,int nKeyLen,
+	const void *pData,unqlite_int64 nDataLen
+	)
+{
+	art_kv_engine *pEngine = (art_kv_engine *)pKv;
+	if( nDataLen + nKeyLen >= (unqlite_int64)(SXU32_HIGH - sizeof(art_leaf)) ){
+		/* Database limit */
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Record size limit reached");
+		return UNQLITE_LIMIT;
+	}
+	return artInsert(pEngine,(const unsigned char *)pKey,(sxu32)nKeyLen,pData,(sxu32)nDataLen,1);
+}
+/*
+ * Exported: xInit() method.
+ */
+static int ArtInit(unqlite_kv_engine *pKv,int iPageSize)
+{
+	art_kv_engine *pEngine = (art_kv_engine *)pKv;
+	(void)iPageSize; /* cc warning */
+	/* Note that this instance is already zeroed */
+	SyMemBackendInitFromParent(&pEngine->sAlloc,unqliteKvIoMemBackend(pKv->pIo));
+	SyBlobInit(&pEngine->sWorker,&pEngine->sAlloc);
+	pEngine->iGen = 1;
+	/* An empty root */
+	pEngine->pRoot = artNodeAlloc(pEngine,ART_NODE4,0,0);
+	if( pEngine->pRoot == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xRelease() method.
+ */
+static void ArtRelease(unqlite_kv_engine *pKv)
+{
+	art_kv_engine *pEngine = (art_kv_engine *)pKv;
+	/* Release the private memory backend, every node and leaf go with it */
+	SyMemBackendRelease(&pEngine->sAlloc);
+}
+/*
+ * Exported: xConfig() method.
+ */
+static int ArtConfigure(unqlite_kv_engine *pKv,int iOp,va_list ap)
+{
+	int rc;
+	(void)pKv; /* cc warning */
+	(void)ap;
+	switch(iOp){
+	case UNQLITE_KV_CONFIG_CMP_FUNC:
+		/* Records are always ordered byte-wise by the radix tree */
+		rc = UNQLITE_NOTIMPLEMENTED;
+		break;
+	default:
+		/* Unknown configuration option */
+		rc = UNQLITE_UNKNOWN;
+		break;
+	}
+	return rc;
+}
+/*
+ * Position of a cursor in one of the inner nodes of the path to the current leaf.
+ * iPos is the byte of the child followed or -1 for the value of the node.
+ */
+typedef struct art_frame art_frame;
+struct art_frame
+{
+	art_node *pNode;
+	int iPos;
+};
+/*
+ * Each cursor is represented by an instance of the following structure.
+ * The cursor memory come from the global allocator, not the engine one.
+ */
+typedef struct art_cursor art_cursor;
+struct art_cursor
+{
+	unqlite_kv_engine *pStore; /* Must be first */
+	/* Private fields */
+	art_frame *aFrame;         /* Path from the root to the current leaf */
+	sxu32 nFrame;              /* Path depth, 0 when the cursor is not valid */
+	sxu32 nAlloc;              /* Allocated frames */
+	sxu32 iGen;                /* Engine generation when the cursor was positioned */
+	SyBlob sKey;               /* Copy of the current key */
+};
+/*
+ * Exported: xCursorInit() method.
+ */
+static void ArtCursorInit(unqlite_kv_cursor *pCursor)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	pCur->aFrame = 0;
+	pCur->nFrame = pCur->nAlloc = 0;
+	pCur->iGen = 0;
+	SyBlobInit(&pCur->sKey,(SyMemBackend *)unqliteExportMemBackend());
+}
+/*
+ * Exported: xCursorRelease() method.
+ */
+static void ArtCursorRelease(unqlite_kv_cursor *pCursor)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	if( pCur->aFrame ){
+		SyMemBackendFree((SyMemBackend *)unqliteExportMemBackend(),pCur->aFrame);
+		pCur->aFrame = 0;
+	}
+	SyBlobRelease(&pCur->sKey);
+}
+/*
+ * Exported: xReset() method.
+ */
+static void ArtCursorReset(unqlite_kv_cursor *pCursor)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	pCur->nFrame = 0;
+	SyBlobReset(&pCur->sKey);
+}
+/*
+ * Push a new frame on the cursor path.
+ */
+static int artCursorPush(art_cursor *pCur,art_node *pNode,int iPos)
+{
+	if( pCur->nFrame >= pCur->nAlloc ){
+		sxu32 nNew = pCur->nAlloc < 16 ? 16 : pCur->nAlloc << 1;
+		art_frame *aNew;
+		aNew = (art_frame *)SyMemBackendRealloc((SyMemBackend *)unqliteExportMemBackend(),pCur->aFrame,nNew * sizeof(art_frame));
+		if( aNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		pCur->aFrame = aNew;
+		pCur->nAlloc = nNew;
+	}
+	pCur->aFrame[pCur->nFrame].pNode = pNode;
+	pCur->aFrame[pCur->nFrame].iPos = iPos;
+	pCur->nFrame++;
+	return UNQLITE_OK;
+}
+/*
+ * Leaf the cursor point to.
+ */
+static art_leaf * artCursorLeaf(art_cursor *pCur)
+{
+	art_frame *pFrame = &pCur->aFrame[pCur->nFrame - 1];
+	if( pFrame->iPos < 0 ){
+		return ART_LEAF(pFrame->pNode->pValue);
+	}
+	return ART_LEAF(*artFindChild(pFrame->pNode,(unsigned char)pFrame->iPos));
+}
+/*
+ * Descend to the smallest (bLast == 0) or largest leaf of the given subtree.
+ */
+static int artCursorEdge(art_cursor *pCur,art_node *pNode,int bLast)
+{
+	void *pChild;
+	int c,rc;
+	for(;;){
+		if( !bLast && pNode->pValue ){
+			return artCursorPush(pCur,pNode,-1);
+		}
+		pChild = bLast ? artPrevChild(pNode,256,&c) : artNextChild(pNode,-1,&c);
+		if( pChild == 0 ){
+			if( pNode->pValue ){
+				return artCursorPush(pCur,pNode,-1);
+			}
+			/* Empty root */
+			pCur->nFrame = 0;
+			return UNQLITE_DONE;
+		}
+		rc = artCursorPush(pCur,pNode,c);
+		if( rc != UNQLITE_OK || ART_IS_LEAF(pChild) ){
+			return rc;
+		}
+		pNode = (art_node *)pChild;
+	}
+}
+/*
+ * Move to the leaf following (iDir > 0) or preceding the position recorded in the path.
+ */
+static int artCursorStep(art_cursor *pCur,int iDir)
+{
+	art_frame *pFrame;
+	void *pChild;
+	int c;
+	while( pCur->nFrame > 0 ){
+		pFrame = &pCur->aFrame[pCur->nFrame - 1];
+		if( iDir > 0 ){
+			pChild = artNextChild(pFrame->pNode,pFrame->iPos,&c);
+		}else{
+			pChild = pFrame->iPos >= 0 ? artPrevChild(pFrame->pNode,pFrame->iPos,&c) : 0;
+		}
+		if( pChild ){
+			pFrame->iPos = c;
+			if( ART_IS_LEAF(pChild) ){
+				return UNQLITE_OK;
+			}
+			return artCursorEdge(pCur,(art_node *)pChild,iDir < 0);
+		}
+		if( iDir < 0 && pFrame->iPos >= 0 && pFrame->pNode->pValue ){
+			/* The key ending at this node come before its children */
+			pFrame->iPos = -1;
+			return UNQLITE_OK;
+		}
+		/* Done with this node */
+		pCur->nFrame--;
+	}
+	return UNQLITE_DONE;
+}
+/*
+ * Position the cursor on the given key (iMode == 0) or on the smallest key greater than
+ * or equal to it (iMode > 0) or on the largest key less than or equal to it (iMode < 0).
+ */
+static int artCursorMoveTo(art_cursor *pCur,const unsigned char *zKey,sxu32 nKey,int iMode)
+{
+	art_kv_engine *pEngine = (art_kv_engine *)pCur->pStore;
+	art_node *pNode = pEngine->pRoot;
+	unsigned char *zPrefix;
+	void **pChild;
+	sxu32 d = 0,i;
+	sxi32 iCmp;
+	int rc;
+	pCur->nFrame = 0;
+	for(;;){
+		zPrefix = ART_PREFIX(pNode);
+		for( i = 0 ; i < pNode->nPrefix && d + i < nKey && zPrefix[i] == zKey[d + i] ; ++i ){
+			/* Match the compressed path */
+		}
+		if( i < pNode->nPrefix ){
+			if( iMode == 0 ){
+				return UNQLITE_NOTFOUND;
+			}
+			if( d + i == nKey || zKey[d + i] < zPrefix[i] ){
+				/* The key sort before the whole subtree */
+				return iMode > 0 ? artCursorEdge(pCur,pNode,0) : artCursorStep(pCur,-1);
+			}
+			/* The key sort after the whole subtree */
+			return iMode > 0 ? artCursorStep(pCur,1) : artCursorEdge(pCur,pNode,1);
+		}
+		d += pNode->nPrefix;
+		if( d == nKey ){
+			/* The key end at this node */
+			rc = artCursorPush(pCur,pNode,-1);
+			if( rc != UNQLITE_OK || pNode->pValue ){
+				return rc;
+			}
+			if( iMode == 0 ){
+				return UNQLITE_NOTFOUND;
+			}
+			return artCursorStep(pCur,iMode);
+		}
+		rc = artCursorPush(pCur,pNode,zKey[d]);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pChild = artFindChild(pNode,zKey[d]);
+		if( pChild && !ART_IS_LEAF(*pChild) ){
+			pNode = (art_node *)*pChild;
+			d++;
+			continue;
+		}
+		iCmp = pChild ? artLeafCmp(ART_LEAF(*pChild),zKey,nKey) : 0;
+		if( pChild && (iCmp == 0 || (iCmp > 0 && iMode > 0) || (iCmp < 0 && iMode < 0)) ){
+			return UNQLITE_OK;
+		}
+		if( iMode == 0 ){
+			return UNQLITE_NOTFOUND;
+		}
+		return artCursorStep(pCur,iMode);
+	}
+}
+/*
+ * Record the key of the current leaf once positioned.
+ */
+static int artCursorSettle(art_cursor *pCur,int rc)
+{
+	art_kv_engine *pEngine = (art_kv_engine *)pCur->pStore;
+	art_leaf *pLeaf;
+	if( rc == UNQLITE_OK ){
+		pLeaf = artCursorLeaf(pCur);
+		SyBlobReset(&pCur->sKey);
+		rc = SyBlobAppend(&pCur->sKey,(const void *)ART_LEAF_KEY(pLeaf),pLeaf->nKey);
+		pCur->iGen = pEngine->iGen;
+	}
+	if( rc != UNQLITE_OK ){
+		pCur->nFrame = 0;
+	}
+	return rc;
+}
+/*
+ * Make sure the cursor path is still valid after the tree was modified.
+ * *pExact is cleared when the recorded key is no longer in the tree in which case
+ * the cursor point to the entry that follow (iDir > 0) or precede (iDir < 0) the old key.
+ */
+static int artCursorRestore(art_cursor *pCur,int iDir,int *pExact)
+{
+	art_kv_engine *pEngine = (art_kv_engine *)pCur->pStore;
+	int rc;
+	*pExact = 1;
+	if( pCur->nFrame < 1 ){
+		return UNQLITE_EOF;
+	}
+	if( pCur->iGen == pEngine->iGen ){
+		return UNQLITE_OK;
+	}
+	/* The key buffer is overwritten on success, work on a copy */
+	SyBlobReset(&pEngine->sWorker);
+	SyBlobDup(&pCur->sKey,&pEngine->sWorker);
+	rc = artCursorMoveTo(pCur,(const unsigned char *)SyBlobData(&pEngine->sWorker),SyBlobLength(&pEngine->sWorker),iDir);
+	rc = artCursorSettle(pCur,rc);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	*pExact = SyBlobLength(&pCur->sKey) == SyBlobLength(&pEngine->sWorker) &&
+		SyMemcmp(SyBlobData(&pCur->sKey),SyBlobData(&pEngine->sWorker),SyBlobLength(&pCur->sKey)) == 0;
+	return UNQLITE_OK;
+}
+/*
+ * Locate the leaf the cursor point to.
+ */
+static int artCursorRecord(art_cursor *pCur,art_leaf **ppLeaf)
+{
+	int bExact;
+	int rc;
+	rc = artCursorRestore(pCur,1,&bExact);
+	if( rc != UNQLITE_OK || !bExact ){
+		/* The entry was removed */
+		return rc == UNQLITE_OK || rc == UNQLITE_DONE ? UNQLITE_EOF : rc;
+	}
+	*ppLeaf = artCursorLeaf(pCur);
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xSeek() method.
+ */
+static int ArtCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nByte,int iPos)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	int iMode = 0;
+	int rc;
+	if( iPos == UNQLITE_CURSOR_MATCH_GE ){
+		iMode = 1;
+	}else if( iPos == UNQLITE_CURSOR_MATCH_LE ){
+		iMode = -1;
+	}
+	rc = artCursorMoveTo(pCur,(const unsigned char *)pKey,(sxu32)nByte,iMode);
+	rc = artCursorSettle(pCur,rc);
+	return rc == UNQLITE_DONE ? UNQLITE_NOTFOUND : rc;
+}
+/*
+ * Exported: xFirst() method.
+ */
+static int ArtCursorFirst(unqlite_kv_cursor *pCursor)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	pCur->nFrame = 0;
+	return artCursorSettle(pCur,artCursorEdge(pCur,((art_kv_engine *)pCur->pStore)->pRoot,0));
+}
+/*
+ * Exported: xLast() method.
+ */
+static int ArtCursorLast(unqlite_kv_cursor *pCursor)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	pCur->nFrame = 0;
+	return artCursorSettle(pCur,artCursorEdge(pCur,((art_kv_engine *)pCur->pStore)->pRoot,1));
+}
+/*
+ * Exported: xValid() method.
+ */
+static int ArtCursorValid(unqlite_kv_cursor *pCursor)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	return pCur->nFrame > 0 ? 1 : 0;
+}
+/*
+ * Move to the next (iDir > 0) or previous entry.
+ */
+static int artCursorAdvance(art_cursor *pCur,int iDir)
+{
+	int bExact;
+	int rc;
+	rc = artCursorRestore(pCur,iDir,&bExact);
+	if( rc != UNQLITE_OK || !bExact ){
+		/* Either an error or the cursor already point to the next entry */
+		return rc;
+	}
+	return artCursorSettle(pCur,artCursorStep(pCur,iDir));
+}
+/*
+ * Exported: xNext() method.
+ */
+static int ArtCursorNext(unqlite_kv_cursor *pCursor)
+{
+	return artCursorAdvance((art_cursor *)pCursor,1);
+}
+/*
+ * Exported: xPrev() method.
+ */
+static int ArtCursorPrev(unqlite_kv_cursor *pCursor)
+{
+	return artCursorAdvance((art_cursor *)pCursor,-1);
+}
+/*
+ * Exported: xDelete() method.
+ * The cursor point to the next entry on success.
+ */
+static int ArtCursorDelete(unqlite_kv_cursor *pCursor)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	art_kv_engine *pEngine = (art_kv_engine *)pCur->pStore;
+	art_leaf *pLeaf;
+	int bExact;
+	int rc;
+	rc = artCursorRecord(pCur,&pLeaf);
+	if( rc != UNQLITE_OK ){
+		return rc == UNQLITE_EOF ? UNQLITE_NOTFOUND : rc;
+	}
+	rc = artDelete(pEngine,(const unsigned char *)SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey));
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Point to the next entry */
+	rc = artCursorRestore(pCur,1,&bExact);
+	return rc == UNQLITE_DONE ? UNQLITE_OK : rc;
+}
+/*
+ * Exported: xKeyLength() method.
+ */
+static int ArtCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	if( pCur->nFrame < 1 ){
+		return UNQLITE_EOF;
+	}
+	*pLen = (int)SyBlobLength(&pCur->sKey);
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xKey() method.
+ */
+static int ArtCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	art_cursor *pCur = (art_cursor *)pCursor;
+	if( pCur->nFrame < 1 ){
+		return UNQLITE_EOF;
+	}
+	/* Invoke the callback */
+	return xConsumer(SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey),pUserData);
+}
+/*
+ * Exported: xDataLength() method.
+ */
+static int ArtCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
+{
+	art_leaf *pLeaf;
+	int rc;
+	rc = artCursorRecord((art_cursor *)pCursor,&pLeaf);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	*pLen = (unqlite_int64)pLeaf->nData;
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xDataRange() method.
+ */
+static int ArtCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	art_leaf *pLeaf;
+	int rc;
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	rc = artCursorRecord((art_cursor *)pCursor,&pLeaf);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( iOfft >= (unqlite_int64)pLeaf->nData ){
+		nLen = 0;
+	}else if( nLen > (unqlite_int64)pLeaf->nData - iOfft ){
+		nLen = (unqlite_int64)pLeaf->nData - iOfft;
+	}
+	/* Invoke the callback */
+	return xConsumer((const void *)&ART_LEAF_DATA(pLeaf)[iOfft],(unsigned int)nLen,pUserData);
+}
+/*
+ * Exported: xData() method.
+ */
+static int ArtCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	return ArtCursorDataRange(pCursor,0,SXI64_HIGH,xConsumer,pUserData);
+}
+/*
+ * Exported: xWriteRange() method.
+ * The record data is overwritten in place, the range must lie within the existing data.
+ */
+static int ArtCursorWriteRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen)
+{
+	art_leaf *pLeaf;
+	int rc;
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	rc = artCursorRecord((art_cursor *)pCursor,&pLeaf);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( iOfft + nLen > (unqlite_int64)pLeaf->nData ){
+		return UNQLITE_INVALID;
+	}
+	if( nLen > 0 ){
+		SyMemcpy(pData,(void *)&ART_LEAF_DATA(pLeaf)[iOfft],(sxu32)nLen);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Export the ART in-memory storage engine.
+ */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportArtKvStorage(void)
+{
+	static const unqlite_kv_methods sArtStore = {
+		"art",                      /* zName */
+		sizeof(art_kv_engine),      /* szKv */
+		sizeof(art_cursor),         /* szCursor */
+		4,                          /* iVersion */
+		ArtInit,                    /* xInit */
+		ArtRelease,                 /* xRelease */
+		ArtConfigure,               /* xConfig */
+		0,                          /* xOpen */
+		ArtReplace,                 /* xReplace */
+		ArtAppend,                  /* xAppend */
+		ArtCursorInit,              /* xCursorInit */
+		ArtCursorSeek,              /* xSeek */
+		ArtCursorFirst,             /* xFirst */
+		ArtCursorLast,              /* xLast */
+		ArtCursorValid,             /* xValid */
+		ArtCursorNext,              /* xNext */
+		ArtCursorPrev,              /* xPrev */
+		ArtCursorDelete,            /* xDelete */
+		ArtCursorKeyLength,         /* xKeyLength */
+		ArtCursorKey,               /* xKey */
+		ArtCursorDataLength,        /* xDataLength */
+		ArtCursorData,              /* xData */
+		ArtCursorReset,             /* xReset */
+		ArtCursorRelease,           /* xCursorRelease */
+		0,                          /* xDataRef */
+		ArtCursorDataRange,         /* xDataRange */
+		ArtCursorWriteRange,        /* xWriteRange */
+		0,                          /* xSync */
+		UNQLITE_KV_ORDERED,         /* iFlags */
+		0,                          /* xFetch */
+		0,                          /* xRemove */
+		0                           /* xRemoveIf */
+	};
+	return &sArtStore;
+}
@@ -0,0 +1,1106 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: async.c v1.0 Unix 2018-07-02 09:12 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements the asynchronous interfaces [unqlite_kv_fetch_async()],
+ * [unqlite_commit_async()] and [unqlite_async_wait()].
+ *
+ * Requests are queued on the database handle and executed in submission order by a
+ * pool of worker threads owned by the handle. Workers are started on demand, up to
+ * the configured count (UNQLITE_CONFIG_ASYNC_WORKERS). A worker runs the synchronous
+ * interface (So the usual handle locking apply), invokes the completion callback without
+ * holding the handle and finally signal the notification descriptor if any
+ * (UNQLITE_CONFIG_ASYNC_NOTIFY, i.e. an eventfd(2) polled by an event loop).
+ * The pool is drained and stopped when the handle is closed.
+ *
+ * Lock order: The handle lock may be held while taking the pool mutex but never
+ * the other way around.
+ *
+ * This file also implements the parallel scan behind [unqlite_kv_scan()]. For on-disk
+ * databases, each short-lived scan worker opens its own read-only handle on the database
+ * file and walks a share of the records: A key range for ordered engines or a share of
+ * the buckets for the hash engine (UNQLITE_KV_CONFIG_SCAN_PARTITION). The calling thread
+ * keep a shared lock on the file for the whole scan so that every worker sees the same
+ * image of the database. For in-memory databases (Or when the handle hold uncommitted
+ * changes the other handles would not see), the calling thread walks the database while
+ * holding the handle, copies the records into batches and hands them to the workers which
+ * run the user callback. Those workers never touch the handle so that the storage engine
+ * and the pager remain single threaded.
+ */
+#if defined(UNQLITE_ENABLE_THREADS)
+#if defined(__WINNT__)
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+#include <Windows.h>
+typedef HANDLE async_thread;
+typedef CRITICAL_SECTION async_mutex;
+typedef CONDITION_VARIABLE async_cond;
+#define ASYNC_THREAD_PROC(NAME) static DWORD WINAPI NAME(LPVOID pArg)
+#define ASYNC_THREAD_EXIT 0
+#else
+#define UNQLITE_OMIT_ASYNC
+#endif /* _WIN32_WINNT */
+#elif defined(__UNIXES__)
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_t async_thread;
+typedef pthread_mutex_t async_mutex;
+typedef pthread_cond_t async_cond;
+#define ASYNC_THREAD_PROC(NAME) static void * NAME(void *pArg)
+#define ASYNC_THREAD_EXIT 0
+#else
+#define UNQLITE_OMIT_ASYNC
+#endif /* __WINNT__ */
+#else
+#define UNQLITE_OMIT_ASYNC
+#endif /* UNQLITE_ENABLE_THREADS */
+#ifndef UNQLITE_OMIT_ASYNC
+/*
+ * Asynchronous request types.
+ */
+#define ASYNC_OP_FETCH  1 /* unqlite_kv_fetch_async() */
+#define ASYNC_OP_COMMIT 2 /* unqlite_commit_async() */
+/*
+ * A queued asynchronous request. The key of a fetch request
+ * is copied right after this structure.
+ */
+typedef struct unqlite_async_op unqlite_async_op;
+struct unqlite_async_op
+{
+	int iOp;                   /* Request type (ASYNC_OP_*) */
+	const void *pKey;          /* Record key (Fetch request only) */
+	int nKeyLen;               /* Key length */
+	ProcAsyncFetch xFetchDone; /* Fetch completion callback */
+	ProcAsyncDone xDone;       /* Completion callback of the other requests */
+	void *pUserData;           /* Last argument to the completion callback */
+	unqlite_async_op *pNext;   /* Next request in the queue */
+};
+/*
+ * Per-handle pool of worker threads.
+ */
+struct unqlite_async
+{
+	unqlite *pDb;                        /* Database handle this pool belong to */
+	async_mutex sMutex;                  /* Protect the fields below */
+	async_cond sWork;                    /* Signaled when a request is queued or on shutdown */
+	async_cond sIdle;                    /* Signaled when the last pending request completes */
+	unqlite_async_op *pHead,*pTail;      /* FIFO of queued requests */
+	int nPending;                        /* Queued and running requests */
+	int nIdle;                           /* Workers waiting for a request */
+	int nWorker;                         /* Maximum number of workers */
+	int nThread;                         /* Workers started so far */
+	int iFd;                             /* Notification descriptor (-1 if none) */
+	int bShutdown;                       /* True when the handle is being closed */
+	async_thread aThread[UNQLITE_ASYNC_MAX_WORKER]; /* Started workers */
+};
+/*
+ * Platform synchronization primitives.
+ */
+#if defined(__WINNT__)
+static void AsyncMutexInit(async_mutex *pMutex){ InitializeCriticalSection(pMutex); }
+static void AsyncMutexDestroy(async_mutex *pMutex){ DeleteCriticalSection(pMutex); }
+static void AsyncMutexEnter(async_mutex *pMutex){ EnterCriticalSection(pMutex); }
+static void AsyncMutexLeave(async_mutex *pMutex){ LeaveCriticalSection(pMutex); }
+static void AsyncCondInit(async_cond *pCond){ InitializeConditionVariable(pCond); }
+static void AsyncCondDestroy(async_cond *pCond){ SXUNUSED(pCond); }
+static void AsyncCondWait(async_cond *pCond,async_mutex *pMutex){ SleepConditionVariableCS(pCond,pMutex,INFINITE); }
+static void AsyncCondSignal(async_cond *pCond){ WakeConditionVariable(pCond); }
+static void AsyncCondBroadcast(async_cond *pCond){ WakeAllConditionVariable(pCond); }
+static int AsyncThreadStart(async_thread *pThread,LPTHREAD_START_ROUTINE xProc,void *pArg)
+{
+	*pThread = CreateThread(0,0,xProc,pArg,0,0);
+	return *pThread ? UNQLITE_OK : UNQLITE_IOERR;
+}
+static void AsyncThreadJoin(async_thread *pThread)
+{
+	WaitForSingleObject(*pThread,INFINITE);
+	CloseHandle(*pThread);
+}
+static void AsyncNotify(int iFd)
+{
+	/* Notification descriptors are not supported under Windows */
+	SXUNUSED(iFd);
+}
+#else
+static void AsyncMutexInit(async_mutex *pMutex){ pthread_mutex_init(pMutex,0); }
+static void AsyncMutexDestroy(async_mutex *pMutex){ pthread_mutex_destroy(pMutex); }
+static void AsyncMutexEnter(async_mutex *pMutex){ pthread_mutex_lock(pMutex); }
+static void AsyncMutexLeave(async_mutex *pMutex){ pthread_mutex_unlock(pMutex); }
+static void AsyncCondInit(async_cond *pCond){ pthread_cond_init(pCond,0); }
+static void AsyncCondDestroy(async_cond *pCond){ pthread_cond_destroy(pCond); }
+static void AsyncCondWait(async_cond *pCond,async_mutex *pMutex){ pthread_cond_wait(pCond,pMutex); }
+static void AsyncCondSignal(async_cond *pCond){ pthread_cond_signal(pCond); }
+static void AsyncCondBroadcast(async_cond *pCond){ pthread_cond_broadcast(pCond); }
+static int AsyncThreadStart(async_thread *pThread,void *(*xProc)(void *),void *pArg)
+{
+	return pthread_create(pThread,0,xProc,pArg) == 0 ? UNQLITE_OK : UNQLITE_IOERR;
+}
+static void AsyncThreadJoin(async_thread *pThread)
+{
+	pthread_join(*pThread,0);
+}
+static void AsyncNotify(int iFd)
+{
+	/* An eventfd(2) counter expects 8 bytes, a pipe just wake up the reader */
+	sxu64 iOne = 1;
+	if( write(iFd,(const void *)&iOne,sizeof(iOne)) < 0 ){
+		/* A saturated counter or a full pipe already wake up the reader */
+		return;
+	}
+}
+#endif /* __WINNT__ */
+/*
+ * Data consumer of fetch requests.
+ */
+static int AsyncFetchConsumer(const void *pData,unsigned int nLen,void *pUserData)
+{
+	SyBlob *pBlob = (SyBlob *)pUserData;
+	if( SyBlobAppend(pBlob,pData,nLen) != SXRET_OK ){
+		return UNQLITE_NOMEM;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Run a single request and invoke its completion callback.
+ */
+static void AsyncRun(unqlite *pDb,unqlite_async_op *pOp)
+{
+	SyBlob sData;
+	int rc;
+	switch(pOp->iOp){
+	case ASYNC_OP_FETCH:
+		SyBlobInit(&sData,(SyMemBackend *)unqliteExportMemBackend());
+		rc = unqlite_kv_fetch_callback(pDb,pOp->pKey,pOp->nKeyLen,AsyncFetchConsumer,&sData);
+		if( pOp->xFetchDone ){
+			if( rc == UNQLITE_OK ){
+				pOp->xFetchDone(pOp->pUserData,rc,SyBlobData(&sData),(unqlite_int64)SyBlobLength(&sData));
+			}else{
+				pOp->xFetchDone(pOp->pUserData,rc,0,0);
+			}
+		}
+		SyBlobRelease(&sData);
+		break;
+	case ASYNC_OP_COMMIT:
+		rc = unqlite_commit(pDb);
+		if( pOp->xDone ){
+			pOp->xDone(pOp->pUserData,rc);
+		}
+		break;
+	default:
+		break;
+	}
+}
+/*
+ * Worker thread: Run queued requests until the pool is shut down
+ * and the queue is empty.
+ */
+ASYNC_THREAD_PROC(AsyncWorker)
+{
+	unqlite_async *pAsync = (unqlite_async *)pArg;
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	unqlite_async_op *pOp;
+	int iFd;
+	AsyncMutexEnter(&pAsync->sMutex);
+	for(;;){
+		while( pAsync->pHead == 0 && !pAsync->bShutdown ){
+			pAsync->nIdle++;
+			AsyncCondWait(&pAsync->sWork,&pAsync->sMutex);
+			pAsync->nIdle--;
+		}
+		pOp = pAsync->pHead;
+		if( pOp == 0 ){
+			/* Shutdown with an empty queue */
+			break;
+		}
+		pAsync->pHead = pOp->pNext;
+		if( pAsync->pHead == 0 ){
+			pAsync->pTail = 0;
+		}
+		AsyncMutexLeave(&pAsync->sMutex);
+		/* Run the request without holding the pool mutex */
+		AsyncRun(pAsync->pDb,pOp);
+		SyMemBackendFree(pAlloc,pOp);
+		AsyncMutexEnter(&pAsync->sMutex);
+		iFd = pAsync->iFd;
+		pAsync->nPending--;
+		if( pAsync->nPending < 1 ){
+			AsyncCondBroadcast(&pAsync->sIdle);
+		}
+		if( iFd >= 0 ){
+			AsyncNotify(iFd);
+		}
+	}
+	AsyncMutexLeave(&pAsync->sMutex);
+	return ASYNC_THREAD_EXIT;
+}
+/*
+ * Allocate the worker pool of a given database handle if not yet done.
+ * The caller must hold the database handle.
+ */
+static int AsyncInit(unqlite *pDb)
+{
+	unqlite_async *pAsync;
+	if( pDb->pAsync ){
+		return UNQLITE_OK;
+	}
+	if( pDb->pMutex == 0 ){
+		unqliteGenError(pDb,"Asynchronous interfaces require a threadsafe database handle");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	pAsync = (unqlite_async *)SyMemBackendAlloc((SyMemBackend *)unqliteExportMemBackend(),sizeof(unqlite_async));
+	if( pAsync == 0 ){
+		unqliteGenOutofMem(pDb);
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pAsync,sizeof(unqlite_async));
+	pAsync->pDb = pDb;
+	pAsync->nWorker = UNQLITE_ASYNC_WORKERS;
+	pAsync->iFd = -1;
+	AsyncMutexInit(&pAsync->sMutex);
+	AsyncCondInit(&pAsync->sWork);
+	AsyncCondInit(&pAsync->sIdle);
+	pDb->pAsync = pAsync;
+	return UNQLITE_OK;
+}
+/*
+ * Configure the worker pool of a given database handle.
+ * The caller must hold the database handle.
+ */
+UNQLITE_PRIVATE int unqliteAsyncConfig(unqlite *pDb,int nWorker,int iFd,int bFd)
+{
+	unqlite_async *pAsync;
+	int rc;
+	rc = AsyncInit(pDb);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pAsync = pDb->pAsync;
+	AsyncMutexEnter(&pAsync->sMutex);
+	if( nWorker > 0 ){
+		if( nWorker > UNQLITE_ASYNC_MAX_WORKER ){
+			nWorker = UNQLITE_ASYNC_MAX_WORKER;
+		}
+		/* Already started workers are kept */
+		pAsync->nWorker = nWorker;
+	}
+	if( bFd ){
+		pAsync->iFd = iFd < 0 ? -1 : iFd;
+	}
+	AsyncMutexLeave(&pAsync->sMutex);
+	return UNQLITE_OK;
+}
+/*
+ * Queue a request and start a new worker if none is idle.
+ * The caller must hold the database handle.
+ */
+static int AsyncSubmit(unqlite *pDb,unqlite_async_op *pOp)
+{
+	unqlite_async *pAsync;
+	int rc;
+	rc = AsyncInit(pDb);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pAsync = pDb->pAsync;
+	AsyncMutexEnter(&pAsync->sMutex);
+	if( pAsync->nPending >= pAsync->nThread && pAsync->nThread < pAsync->nWorker ){
+		/* More outstanding requests than workers */
+		rc = AsyncThreadStart(&pAsync->aThread[pAsync->nThread],AsyncWorker,pAsync);
+		if( rc == UNQLITE_OK ){
+			pAsync->nThread++;
+		}else if( pAsync->nThread > 0 ){
+			/* Run later on one of the existing workers */
+			rc = UNQLITE_OK;
+		}
+	}
+	if( rc == UNQLITE_OK ){
+		pOp->pNext = 0;
+		if( pAsync->pTail ){
+			pAsync->pTail->pNext = pOp;
+		}else{
+			pAsync->pHead = pOp;
+		}
+		pAsync->pTail = pOp;
+		pAsync->nPending++;
+		AsyncCondSignal(&pAsync->sWork);
+	}
+	AsyncMutexLeave(&pAsync->sMutex);
+	if( rc != UNQLITE_OK ){
+		unqliteGenError(pDb,"Cannot start an asynchronous worker thread");
+	}
+	return rc;
+}
+/*
+ * Queue an asynchronous fetch request.
+ * The caller must hold the database handle.
+ */
+UNQLITE_PRIVATE int unqliteAsyncFetch(unqlite *pDb,const void *pKey,int nKeyLen,ProcAsyncFetch xDone,void *pUserData)
+{
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	unqlite_async_op *pOp;
+	int rc;
+	/* Copy the key so that the caller may discard it right away */
+	pOp = (unqlite_async_op *)SyMemBackendAlloc(pAlloc,sizeof(unqlite_async_op) + (sxu32)nKeyLen);
+	if( pOp == 0 ){
+		unqliteGenOutofMem(pDb);
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pOp,sizeof(unqlite_async_op));
+	SyMemcpy(pKey,(void *)&pOp[1],(sxu32)nKeyLen);
+	pOp->iOp = ASYNC_OP_FETCH;
+	pOp->pKey = (const void *)&pOp[1];
+	pOp->nKeyLen = nKeyLen;
+	pOp->xFetchDone = xDone;
+	pOp->pUserData = pUserData;
+	rc = AsyncSubmit(pDb,pOp);
+	if( rc != UNQLITE_OK ){
+		SyMemBackendFree(pAlloc,pOp);
+	}
+	return rc;
+}
+/*
+ * Queue an asynchronous commit request.
+ * The caller must hold the database handle.
+ */
+UNQLITE_PRIVATE int unqliteAsyncCommit(unqlite *pDb,ProcAsyncDone xDone,void *pUserData)
+{
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	unqlite_async_op *pOp;
+	int rc;
+	pOp = (unqlite_async_op *)SyMemBackendAlloc(pAlloc,sizeof(unqlite_async_op));
+	if( pOp == 0 ){
+		unqliteGenOutofMem(pDb);
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pOp,sizeof(unqlite_async_op));
+	pOp->iOp = ASYNC_OP_COMMIT;
+	pOp->xDone = xDone;
+	pOp->pUserData = pUserData;
+	rc = AsyncSubmit(pDb,pOp);
+	if( rc != UNQLITE_OK ){
+		SyMemBackendFree(pAlloc,pOp);
+	}
+	return rc;
+}
+/*
+ * Wait until every request queued so far has completed.
+ * The caller must NOT hold the database handle since workers need it.
+ */
+UNQLITE_PRIVATE int unqliteAsyncWait(unqlite *pDb)
+{
+	unqlite_async *pAsync = pDb->pAsync;
+	if( pAsync == 0 ){
+		/* Nothing was ever queued */
+		return UNQLITE_OK;
+	}
+	AsyncMutexEnter(&pAsync->sMutex);
+	while( pAsync->nPending > 0 ){
+		AsyncCondWait(&pAsync->sIdle,&pAsync->sMutex);
+	}
+	AsyncMutexLeave(&pAsync->sMutex);
+	return UNQLITE_OK;
+}
+/*
+ * Run the queued requests, stop the workers and release the pool.
+ * The caller must NOT hold the database handle since workers need it.
+ */
+UNQLITE_PRIVATE void unqliteAsyncRelease(unqlite *pDb)
+{
+	unqlite_async *pAsync = pDb->pAsync;
+	int i;
+	if( pAsync == 0 ){
+		return;
+	}
+	AsyncMutexEnter(&pAsync->sMutex);
+	pAsync->bShutdown = 1;
+	AsyncCondBroadcast(&pAsync->sWork);
+	AsyncMutexLeave(&pAsync->sMutex);
+	for( i = 0 ; i < pAsync->nThread ; ++i ){
+		AsyncThreadJoin(&pAsync->aThread[i]);
+	}
+	AsyncCondDestroy(&pAsync->sIdle);
+	AsyncCondDestroy(&pAsync->sWork);
+	AsyncMutexDestroy(&pAsync->sMutex);
+	SyMemBackendFree((SyMemBackend *)unqliteExportMemBackend(),pAsync);
+	pDb->pAsync = 0;
+}
+#else
+/*
+ * Asynchronous interfaces are not available without threading support.
+ */
+UNQLITE_PRIVATE int unqliteAsyncConfig(unqlite *pDb,int nWorker,int iFd,int bFd)
+{
+	SXUNUSED(nWorker);
+	SXUNUSED(iFd);
+	SXUNUSED(bFd);
+	unqliteGenError(pDb,"Asynchronous interfaces are not supported by this build");
+	return UNQLITE_NOTIMPLEMENTED;
+}
+UNQLITE_PRIVATE int unqliteAsyncFetch(unqlite *pDb,const void *pKey,int nKeyLen,ProcAsyncFetch xDone,void *pUserData)
+{
+	SXUNUSED(pKey);
+	SXUNUSED(nKeyLen);
+	SXUNUSED(xDone);
+	SXUNUSED(pUserData);
+	unqliteGenError(pDb,"Asynchronous interfaces are not supported by this build");
+	return UNQLITE_NOTIMPLEMENTED;
+}
+UNQLITE_PRIVATE int unqliteAsyncCommit(unqlite *pDb,ProcAsyncDone xDone,void *pUserData)
+{
+	SXUNUSED(xDone);
+	SXUNUSED(pUserData);
+	unqliteGenError(pDb,"Asynchronous interfaces are not supported by this build");
+	return UNQLITE_NOTIMPLEMENTED;
+}
+UNQLITE_PRIVATE int unqliteAsyncWait(unqlite *pDb)
+{
+	SXUNUSED(pDb);
+	return UNQLITE_OK;
+}
+UNQLITE_PRIVATE void unqliteAsyncRelease(unqlite *pDb)
+{
+	SXUNUSED(pDb);
+}
+#endif /* UNQLITE_OMIT_ASYNC */
+/*
+ * Parallel scan.
+ */
+#ifndef UNQLITE_OMIT_ASYNC
+/*
+ * A batch of records copied by the scanning thread. Each record is stored
+ * as its key length (4 bytes), its data length (8 bytes), the key and the data.
+ */
+typedef struct async_scan_batch async_scan_batch;
+struct async_scan_batch
+{
+	SyBlob sRec;                  /* Copied records */
+	async_scan_batch *pNext;      /* Next batch in the queue */
+};
+typedef struct async_scan async_scan;
+/*
+ * A scan worker.
+ */
+typedef struct async_scan_worker async_scan_worker;
+struct async_scan_worker
+{
+	async_scan *pScan;            /* Scan this worker belong to */
+	int iWorker;                  /* Worker number passed to the callback */
+	async_thread sThread;         /* Worker thread */
+	int bThread;                  /* True if sThread was started */
+	/* Per-worker handle scan */
+	unqlite *pDb;                 /* Private read-only handle on the database file */
+	SyBlob sLow;                  /* Lower bound of the walked key range (Ordered engines) */
+	SyBlob sHigh;                 /* Upper bound (exclusive). Empty for no bound */
+};
+/*
+ * State of a parallel scan.
+ */
+struct async_scan
+{
+	ProcKvScan xScan;             /* User callback */
+	void *pUserData;              /* Last argument to xScan() */
+	async_mutex sMutex;           /* Protect the fields below */
+	async_cond sWork;             /* Signaled when a batch is queued or on end of scan */
+	async_cond sRoom;             /* Signaled when a batch is taken off the queue */
+	async_scan_batch *pHead,*pTail; /* FIFO of batches */
+	int nQueued;                  /* Batches in the FIFO */
+	int nMaxQueued;               /* Maximum number of batches in the FIFO */
+	int bEof;                     /* True when every record was queued */
+	int rc;                       /* First error reported by a callback */
+	int nWorker;                  /* Started workers */
+	async_scan_worker aWorker[UNQLITE_ASYNC_MAX_WORKER]; /* Workers */
+};
+#endif /* UNQLITE_OMIT_ASYNC */
+/*
+ * Record walk state.
+ */
+typedef struct scan_walker scan_walker;
+struct scan_walker
+{
+	ProcKvScan xScan;             /* User callback (Serial scan) */
+	void *pUserData;              /* Last argument to xScan() */
+	int iWorker;                  /* Worker number passed to xScan() */
+	SyBlob sKey;                  /* Key of the current record */
+	SyBlob sData;                 /* Data of the current record */
+#ifndef UNQLITE_OMIT_ASYNC
+	async_scan *pScan;            /* Parallel scan (NULL if serial) */
+	async_scan_batch *pBatch;     /* Batch being filled */
+#endif
+};
+#ifndef UNQLITE_OMIT_ASYNC
+/*
+ * Invoke the user callback for each record of a batch.
+ */
+static int ScanRunBatch(async_scan *pScan,int iWorker,async_scan_batch *pBatch)
+{
+	const unsigned char *zCur = (const unsigned char *)SyBlobData(&pBatch->sRec);
+	const unsigned char *zEnd = &zCur[SyBlobLength(&pBatch->sRec)];
+	sxu32 nKey;
+	sxu64 nData;
+	int rc;
+	while( zCur < zEnd ){
+		SyMemcpy((const void *)zCur,(void *)&nKey,sizeof(sxu32));
+		SyMemcpy((const void *)&zCur[sizeof(sxu32)],(void *)&nData,sizeof(sxu64));
+		zCur += sizeof(sxu32) + sizeof(sxu64);
+		rc = pScan->xScan(pScan->pUserData,iWorker,(const void *)zCur,nKey,(const void *)&zCur[nKey],(unqlite_int64)nData);
+		if( rc != UNQLITE_OK ){
+			/* Callback request an operation abort */
+			return UNQLITE_ABORT;
+		}
+		zCur += nKey + (sxu32)nData;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Release a batch.
+ */
+static void ScanBatchFree(async_scan_batch *pBatch)
+{
+	SyBlobRelease(&pBatch->sRec);
+	SyMemBackendFree((SyMemBackend *)unqliteExportMemBackend(),pBatch);
+}
+/*
+ * Scan worker thread: Run the callback on queued batches until the end of scan.
+ * Once a callback failed, the remaining batches are discarded.
+ */
+ASYNC_THREAD_PROC(ScanWorker)
+{
+	async_scan_worker *pWorker = (async_scan_worker *)pArg;
+	async_scan *pScan = pWorker->pScan;
+	async_scan_batch *pBatch;
+	int rc;
+	AsyncMutexEnter(&pScan->sMutex);
+	for(;;){
+		while( pScan->pHead == 0 && !pScan->bEof ){
+			AsyncCondWait(&pScan->sWork,&pScan->sMutex);
+		}
+		pBatch = pScan->pHead;
+		if( pBatch == 0 ){
+			/* End of scan */
+			break;
+		}
+		pScan->pHead = pBatch->pNext;
+		if( pScan->pHead == 0 ){
+			pScan->pTail = 0;
+		}
+		pScan->nQueued--;
+		AsyncCondSignal(&pScan->sRoom);
+		rc = pScan->rc;
+		AsyncMutexLeave(&pScan->sMutex);
+		if( rc == UNQLITE_OK ){
+			rc = ScanRunBatch(pScan,pWorker->iWorker,pBatch);
+		}
+		ScanBatchFree(pBatch);
+		AsyncMutexEnter(&pScan->sMutex);
+		if( rc != UNQLITE_OK && pScan->rc == UNQLITE_OK ){
+			/* Stop the scan */
+			pScan->rc = rc;
+			AsyncCondSignal(&pScan->sRoom);
+		}
+	}
+	AsyncMutexLeave(&pScan->sMutex);
+	return ASYNC_THREAD_EXIT;
+}
+/*
+ * Queue the batch being filled, waiting for room in the queue first.
+ * Return the first error reported by a callback if any.
+ */
+static int ScanQueueBatch(scan_walker *pWalker)
+{
+	async_scan *pScan = pWalker->pScan;
+	async_scan_batch *pBatch = pWalker->pBatch;
+	int rc;
+	pWalker->pBatch = 0;
+	AsyncMutexEnter(&pScan->sMutex);
+	while( pScan->nQueued >= pScan->nMaxQueued && pScan->rc == UNQLITE_OK ){
+		AsyncCondWait(&pScan->sRoom,&pScan->sMutex);
+	}
+	rc = pScan->rc;
+	if( rc == UNQLITE_OK ){
+		pBatch->pNext = 0;
+		if( pScan->pTail ){
+			pScan->pTail->pNext = pBatch;
+		}else{
+			pScan->pHead = pBatch;
+		}
+		pScan->pTail = pBatch;
+		pScan->nQueued++;
+		AsyncCondSignal(&pScan->sWork);
+	}
+	AsyncMutexLeave(&pScan->sMutex);
+	if( rc != UNQLITE_OK ){
+		ScanBatchFree(pBatch);
+	}
+	return rc;
+}
+/*
+ * Copy the current record to the batch being filled and queue
+ * the batch once full.
+ */
+static int ScanCopyRecord(scan_walker *pWalker)
+{
+	async_scan_batch *pBatch = pWalker->pBatch;
+	sxu32 nKey = SyBlobLength(&pWalker->sKey);
+	sxu64 nData = (sxu64)SyBlobLength(&pWalker->sData);
+	if( pBatch == 0 ){
+		pBatch = (async_scan_batch *)SyMemBackendAlloc((SyMemBackend *)unqliteExportMemBackend(),sizeof(async_scan_batch));
+		if( pBatch == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		SyBlobInit(&pBatch->sRec,(SyMemBackend *)unqliteExportMemBackend());
+		pBatch->pNext = 0;
+		pWalker->pBatch = pBatch;
+	}
+	if( SyBlobAppend(&pBatch->sRec,(const void *)&nKey,sizeof(sxu32)) != SXRET_OK ||
+		SyBlobAppend(&pBatch->sRec,(const void *)&nData,sizeof(sxu64)) != SXRET_OK ||
+		SyBlobAppend(&pBatch->sRec,SyBlobData(&pWalker->sKey),nKey) != SXRET_OK ||
+		SyBlobAppend(&pBatch->sRec,SyBlobData(&pWalker->sData),(sxu32)nData) != SXRET_OK ){
+			return UNQLITE_NOMEM;
+	}
+	if( SyBlobLength(&pBatch->sRec) >= UNQLITE_SCAN_BATCH_SIZE ){
+		return ScanQueueBatch(pWalker);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Start the scan workers. Return the number of started workers.
+ */
+static int ScanStart(async_scan *pScan,int nWorker,ProcKvScan xScan,void *pUserData)
+{
+	int i;
+	SyZero(pScan,sizeof(async_scan));
+	pScan->xScan = xScan;
+	pScan->pUserData = pUserData;
+	pScan->nMaxQueued = 2 * nWorker;
+	AsyncMutexInit(&pScan->sMutex);
+	AsyncCondInit(&pScan->sWork);
+	AsyncCondInit(&pScan->sRoom);
+	for( i = 0 ; i < nWorker ; ++i ){
+		pScan->aWorker[i].pScan = pScan;
+		pScan->aWorker[i].iWorker = i;
+		if( AsyncThreadStart(&pScan->aWorker[i].sThread,ScanWorker,&pScan->aWorker[i]) != UNQLITE_OK ){
+			break;
+		}
+		pScan->nWorker++;
+	}
+	return pScan->nWorker;
+}
+/*
+ * Signal the end of scan, wait for the workers and release the scan state.
+ * Return the first error reported by a callback if any.
+ */
+static int ScanFinish(async_scan *pScan)
+{
+	int i,rc;
+	AsyncMutexEnter(&pScan->sMutex);
+	pScan->bEof = 1;
+	AsyncCondBroadcast(&pScan->sWork);
+	AsyncMutexLeave(&pScan->sMutex);
+	for( i = 0 ; i < pScan->nWorker ; ++i ){
+		AsyncThreadJoin(&pScan->aWorker[i].sThread);
+	}
+	rc = pScan->rc;
+	AsyncCondDestroy(&pScan->sRoom);
+	AsyncCondDestroy(&pScan->sWork);
+	AsyncMutexDestroy(&pScan->sMutex);
+	return rc;
+}
+#endif /* UNQLITE_OMIT_ASYNC */
+/*
+ * Hand the record the cursor point to either to the user callback (Serial scan)
+ * or to the scan workers.
+ */
+static int ScanRecord(scan_walker *pWalker,unqlite_kv_cursor *pCur)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	int rc;
+	SyBlobReset(&pWalker->sKey);
+	SyBlobReset(&pWalker->sData);
+	rc = pMethods->xKey(pCur,unqliteDataConsumer,&pWalker->sKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( unqliteKvTtlReserved(SyBlobData(&pWalker->sKey),SyBlobLength(&pWalker->sKey)) ){
+		/* Expiration metadata are not part of the user keyspace */
+		return UNQLITE_OK;
+	}
+	rc = pMethods->xData(pCur,unqliteDataConsumer,&pWalker->sData);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+#ifndef UNQLITE_OMIT_ASYNC
+	if( pWalker->pScan ){
+		return ScanCopyRecord(pWalker);
+	}
+#endif
+	rc = pWalker->xScan(pWalker->pUserData,pWalker->iWorker,SyBlobData(&pWalker->sKey),SyBlobLength(&pWalker->sKey),
+		SyBlobData(&pWalker->sData),(unqlite_int64)SyBlobLength(&pWalker->sData));
+	if( rc != UNQLITE_OK ){
+		/* Callback request an operation abort */
+		return UNQLITE_ABORT;
+	}
+	return UNQLITE_OK;
+}
+#ifndef UNQLITE_OMIT_ASYNC
+/*
+ * Number of records a per-handle scan worker walk between two checks
+ * for an error reported by another worker.
+ */
+#define SCAN_PART_CHECK 256
+/*
+ * Return the (Big-endian) number made of the first eight bytes of a key suffix,
+ * missing bytes count as zero.
+ */
+static sxu64 ScanKeyNumber(const unsigned char *zKey,sxu32 nKey)
+{
+	sxu64 iNum = 0;
+	sxu32 i;
+	for( i = 0 ; i < 8 ; ++i ){
+		iNum = (iNum << 8) | (i < nKey ? zKey[i] : 0);
+	}
+	return iNum;
+}
+/*
+ * Split the keyspace of an ordered engine into nWorker ranges, interpolating
+ * between the first and last keys past their common prefix. Worker i walks the
+ * half-open [sLow,sHigh) range, the first worker having no lower bound and the
+ * last no upper bound so that every record is walked exactly once.
+ * Return UNQLITE_DONE when the keys cannot be split (Empty database, etc.).
+ */
+static int ScanSplitKeys(async_scan *pScan,unqlite_kv_cursor *pCur,int nWorker)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	const unsigned char *zFirst,*zLast;
+	sxu32 nFirst,nLast,nPrefix;
+	SyBlob sFirst,sLast;
+	unsigned char zNum[8];
+	sxu64 iLow,iHigh,iNum;
+	int i,j,rc;
+	SyBlobInit(&sFirst,pAlloc);
+	SyBlobInit(&sLast,pAlloc);
+	rc = UNQLITE_DONE;
+	pMethods->xFirst(pCur);
+	if( !pMethods->xValid(pCur) || pMethods->xKey(pCur,unqliteDataConsumer,&sFirst) != UNQLITE_OK ){
+		goto done;
+	}
+	pMethods->xLast(pCur);
+	if( !pMethods->xValid(pCur) || pMethods->xKey(pCur,unqliteDataConsumer,&sLast) != UNQLITE_OK ){
+		goto done;
+	}
+	zFirst = (const unsigned char *)SyBlobData(&sFirst);
+	nFirst = SyBlobLength(&sFirst);
+	zLast = (const unsigned char *)SyBlobData(&sLast);
+	nLast = SyBlobLength(&sLast);
+	nPrefix = 0;
+	while( nPrefix < nFirst && nPrefix < nLast && zFirst[nPrefix] == zLast[nPrefix] ){
+		nPrefix++;
+	}
+	iLow = ScanKeyNumber(&zFirst[nPrefix],nFirst - nPrefix);
+	iHigh = ScanKeyNumber(&zLast[nPrefix],nLast - nPrefix);
+	if( iHigh <= iLow ){
+		/* Nothing to interpolate */
+		goto done;
+	}
+	rc = UNQLITE_OK;
+	for( i = 1 ; i < nWorker ; ++i ){
+		/* Avoid overflowing (iHigh - iLow) * i */
+		iNum = iLow + ((iHigh - iLow) / nWorker) * i + (((iHigh - iLow) % nWorker) * i) / nWorker;
+		for( j = 7 ; j >= 0 ; --j ){
+			zNum[j] = (unsigned char)(iNum & 0xFF);
+			iNum >>= 8;
+		}
+		if( SyBlobAppend(&pScan->aWorker[i].sLow,zFirst,nPrefix) != SXRET_OK ||
+			SyBlobAppend(&pScan->aWorker[i].sLow,zNum,sizeof(zNum)) != SXRET_OK ||
+			SyBlobAppend(&pScan->aWorker[i - 1].sHigh,SyBlobData(&pScan->aWorker[i].sLow),SyBlobLength(&pScan->aWorker[i].sLow)) != SXRET_OK ){
+				rc = UNQLITE_NOMEM;
+				break;
+		}
+	}
+done:
+	SyBlobRelease(&sLast);
+	SyBlobRelease(&sFirst);
+	return rc;
+}
+/*
+ * Close the per-worker handles and release the key ranges.
+ */
+static void ScanCloseParts(async_scan *pScan)
+{
+	async_scan_worker *pWorker;
+	int i;
+	for( i = 0 ; i < UNQLITE_ASYNC_MAX_WORKER ; ++i ){
+		pWorker = &pScan->aWorker[i];
+		if( pWorker->pDb ){
+			unqlite_close(pWorker->pDb);
+			pWorker->pDb = 0;
+		}
+		SyBlobRelease(&pWorker->sHigh);
+		SyBlobRelease(&pWorker->sLow);
+	}
+}
+/*
+ * Open a read-only handle on the database file for each worker and assign
+ * each of them its share of the records.
+ * Any error means the database cannot be scanned through per-worker handles
+ * (In-memory database, uncommitted changes, engine without partition support, etc.)
+ * and the caller should fall back to the batch scan.
+ */
+static int ScanOpenParts(unqlite *pDb,unqlite_kv_cursor *pCur,async_scan *pScan,int nWorker,ProcKvScan xScan,void *pUserData)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	async_scan_worker *pWorker;
+	unqlite_kv_engine *pEngine;
+	unsigned int iFlags,iUnused;
+	const char *zPath;
+	int bOrdered;
+	int i,rc;
+	zPath = unqlitePagerGetReadSource(pDb,&iFlags);
+	if( zPath == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	SyZero(pScan,sizeof(async_scan));
+	pScan->xScan = xScan;
+	pScan->pUserData = pUserData;
+	for( i = 0 ; i < UNQLITE_ASYNC_MAX_WORKER ; ++i ){
+		pWorker = &pScan->aWorker[i];
+		pWorker->pScan = pScan;
+		pWorker->iWorker = i;
+		SyBlobInit(&pWorker->sLow,pAlloc);
+		SyBlobInit(&pWorker->sHigh,pAlloc);
+	}
+	bOrdered = pMethods->iVersion > 3 && (pMethods->iFlags & UNQLITE_KV_ORDERED) && pMethods->xLast;
+	rc = UNQLITE_OK;
+	if( bOrdered ){
+		rc = ScanSplitKeys(pScan,pCur,nWorker);
+	}
+	for( i = 0 ; i < nWorker && rc == UNQLITE_OK ; ++i ){
+		pWorker = &pScan->aWorker[i];
+		rc = unqlite_open(&pWorker->pDb,zPath,iFlags);
+		if( rc != UNQLITE_OK ){
+			pWorker->pDb = 0;
+			break;
+		}
+		/* Pin the same image of the database as the calling handle */
+		if( unqlitePagerGetReadSource(pWorker->pDb,&iUnused) == 0 ){
+			rc = UNQLITE_BUSY;
+			break;
+		}
+		pEngine = unqlitePagerGetKvEngine(pWorker->pDb);
+		if( pEngine == 0 || pEngine->pIo->pMethods != pMethods ){
+			/* Engine not recorded in the database header yet */
+			rc = UNQLITE_NOTIMPLEMENTED;
+			break;
+		}
+		if( !bOrdered ){
+			/* Walk a share of the buckets */
+			rc = unqlite_kv_config(pWorker->pDb,UNQLITE_KV_CONFIG_SCAN_PARTITION,i,nWorker);
+		}
+	}
+	if( rc != UNQLITE_OK ){
+		ScanCloseParts(pScan);
+		return rc;
+	}
+	pScan->nWorker = nWorker;
+	return UNQLITE_OK;
+}
+/*
+ * Walk the share of the records of a per-handle scan worker.
+ * The walk stops as soon as a callback or another worker failed.
+ */
+static void ScanWalkPart(async_scan_worker *pWorker)
+{
+	async_scan *pScan = pWorker->pScan;
+	unqlite_kv_cursor *pCur;
+	scan_walker sWalker;
+	sxu32 nLow,nHigh;
+	sxu32 nRec = 0;
+	int rc;
+	rc = unqliteInitCursor(pWorker->pDb,&pCur);
+	if( rc == UNQLITE_OK ){
+		SyZero(&sWalker,sizeof(scan_walker));
+		sWalker.xScan = pScan->xScan;
+		sWalker.pUserData = pScan->pUserData;
+		sWalker.iWorker = pWorker->iWorker;
+		SyBlobInit(&sWalker.sKey,&pWorker->pDb->sMem);
+		SyBlobInit(&sWalker.sData,&pWorker->pDb->sMem);
+		nLow = SyBlobLength(&pWorker->sLow);
+		nHigh = SyBlobLength(&pWorker->sHigh);
+		if( nLow > 0 || nHigh > 0 ){
+			rc = unqlite_kv_cursor_seek_range(pCur,nLow > 0 ? SyBlobData(&pWorker->sLow) : 0,(int)nLow,
+				nHigh > 0 ? SyBlobData(&pWorker->sHigh) : 0,(int)nHigh);
+		}else{
+			rc = unqlite_kv_cursor_first_entry(pCur);
+		}
+		if( rc == UNQLITE_NOTFOUND || rc == UNQLITE_DONE || rc == UNQLITE_EOF ){
+			/* Empty share */
+			rc = UNQLITE_OK;
+		}
+		while( rc == UNQLITE_OK && unqlite_kv_cursor_valid_entry(pCur) ){
+			rc = ScanRecord(&sWalker,pCur);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			if( (++nRec % SCAN_PART_CHECK) == 0 ){
+				AsyncMutexEnter(&pScan->sMutex);
+				rc = pScan->rc;
+				AsyncMutexLeave(&pScan->sMutex);
+				if( rc != UNQLITE_OK ){
+					/* Another worker failed, its error is reported */
+					rc = UNQLITE_OK;
+					break;
+				}
+			}
+			rc = unqlite_kv_cursor_next_entry(pCur);
+			if( rc == UNQLITE_DONE || rc == UNQLITE_EOF ){
+				rc = UNQLITE_OK;
+			}
+		}
+		SyBlobRelease(&sWalker.sData);
+		SyBlobRelease(&sWalker.sKey);
+		unqliteReleaseCursor(pWorker->pDb,pCur);
+	}
+	if( rc != UNQLITE_OK ){
+		AsyncMutexEnter(&pScan->sMutex);
+		if( pScan->rc == UNQLITE_OK ){
+			/* Stop the scan */
+			pScan->rc = rc;
+		}
+		AsyncMutexLeave(&pScan->sMutex);
+	}
+}
+/*
+ * Per-handle scan worker thread.
+ */
+ASYNC_THREAD_PROC(ScanPartWorker)
+{
+	ScanWalkPart((async_scan_worker *)pArg);
+	return ASYNC_THREAD_EXIT;
+}
+/*
+ * Run the per-handle scan workers opened by ScanOpenParts() and release them.
+ * A share whose thread could not be started is walked by the calling thread.
+ * Return the first error reported by a worker if any.
+ */
+static int ScanRunParts(async_scan *pScan)
+{
+	async_scan_worker *pWorker;
+	int i,rc;
+	AsyncMutexInit(&pScan->sMutex);
+	for( i = 0 ; i < pScan->nWorker ; ++i ){
+		pWorker = &pScan->aWorker[i];
+		pWorker->bThread = AsyncThreadStart(&pWorker->sThread,ScanPartWorker,pWorker) == UNQLITE_OK;
+	}
+	for( i = 0 ; i < pScan->nWorker ; ++i ){
+		pWorker = &pScan->aWorker[i];
+		if( !pWorker->bThread ){
+			ScanWalkPart(pWorker);
+		}
+	}
+	for( i = 0 ; i < pScan->nWorker ; ++i ){
+		pWorker = &pScan->aWorker[i];
+		if( pWorker->bThread ){
+			AsyncThreadJoin(&pWorker->sThread);
+		}
+	}
+	rc = pScan->rc;
+	AsyncMutexDestroy(&pScan->sMutex);
+	ScanCloseParts(pScan);
+	return rc;
+}
+#endif /* UNQLITE_OMIT_ASYNC */
+/*
+ * Invoke the given callback for each database record using up to nWorker threads.
+ * The callback is told the number of the worker (0 to nWorker-1) it runs on so that
+ * it may accumulate per-worker results merged by the caller once the scan is done.
+ * On-disk databases are walked by the workers through their own read-only handles,
+ * in-memory databases by the calling thread which hands the records to the workers.
+ * Without threading support or when nWorker is one, the callback runs on the
+ * calling thread. The caller must hold the database handle.
+ */
+UNQLITE_PRIVATE int unqliteKvScan(unqlite *pDb,int nWorker,ProcKvScan xScan,void *pUserData)
+{
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_cursor *pCur;
+	scan_walker sWalker;
+#ifndef UNQLITE_OMIT_ASYNC
+	async_scan sScan;
+	int rc2;
+#endif
+	int rc;
+	rc = unqliteInitCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pMethods = pCur->pStore->pIo->pMethods;
+	SyZero(&sWalker,sizeof(scan_walker));
+	sWalker.xScan = xScan;
+	sWalker.pUserData = pUserData;
+	SyBlobInit(&sWalker.sKey,&pDb->sMem);
+	SyBlobInit(&sWalker.sData,&pDb->sMem);
+#ifndef UNQLITE_OMIT_ASYNC
+	if( nWorker > 1 ){
+		if( nWorker > UNQLITE_ASYNC_MAX_WORKER ){
+			nWorker = UNQLITE_ASYNC_MAX_WORKER;
+		}
+		if( ScanOpenParts(pDb,pCur,&sScan,nWorker,xScan,pUserData) == UNQLITE_OK ){
+			/* Each worker walk its share through its own handle */
+			rc = ScanRunParts(&sScan);
+			SyBlobRelease(&sWalker.sData);
+			SyBlobRelease(&sWalker.sKey);
+			unqliteReleaseCursor(pDb,pCur);
+			return rc;
+		}
+		if( ScanStart(&sScan,nWorker,xScan,pUserData) > 0 ){
+			sWalker.pScan = &sScan;
+		}else{
+			/* Could not start a thread, scan serially */
+			ScanFinish(&sScan);
+		}
+	}
+#else
+	SXUNUSED(nWorker);
+#endif
+	pMethods->xFirst(pCur);
+	while( pMethods->xValid(pCur) ){
+		rc = ScanRecord(&sWalker,pCur);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		pMethods->xNext(pCur);
+	}
+#ifndef UNQLITE_OMIT_ASYNC
+	if( sWalker.pScan ){
+		if( sWalker.pBatch ){
+			if( rc == UNQLITE_OK ){
+				/* Last partial batch */
+				rc = ScanQueueBatch(&sWalker);
+			}else{
+				ScanBatchFree(sWalker.pBatch);
+			}
+		}
+		rc2 = ScanFinish(&sScan);
+		if( rc2 != UNQLITE_OK ){
+			/* A callback stopped the scan */
+			rc = rc2;
+		}
+	}
+#endif
+	SyBlobRelease(&sWalker.sData);
+	SyBlobRelease(&sWalker.sKey);
+	unqliteReleaseCursor(pDb,pCur);
+	return rc;
+}
@@ -174,6 +174,37 @@ UNQLITE_PRIVATE int unqliteBitvecSet(Bitvec *p,pgno i)
 	}
 	return UNQLITE_OK;
 }
+/*
+ * Remove a given page number from our bitmap.
+ * The list of records is ordered newest first so that removing the most
+ * recently installed pages is cheap.
+ */
+UNQLITE_PRIVATE void unqliteBitvecClear(Bitvec *p,pgno i)
+{
+	bitvec_rec *pRec,**ppLink;
+	/* Unlink from the bucket */
+	ppLink = &p->apRec[i & (p->nSize - 1)];
+	for(;;){
+		pRec = *ppLink;
+		if( pRec == 0 ){
+			/* No such entry */
+			return;
+		}
+		if( pRec->iPage == i ){
+			*ppLink = pRec->pNextCol;
+			break;
+		}
+		ppLink = &pRec->pNextCol;
+	}
+	/* Unlink from the list of records */
+	ppLink = &p->pList;
+	while( *ppLink != pRec ){
+		ppLink = &(*ppLink)->pNext;
+	}
+	*ppLink = pRec->pNext;
+	p->nRec--;
+	SyMemBackendPoolFree(p->pAlloc,(void *)pRec);
+}
 /*
  * Destroy a bitvec instance. Reclaim all memory used.
  */
@@ -0,0 +1,2096 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: btree_kv.c v1.0 Unix 2018-06-02 10:12 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements an ordered on-disk key/value storage engine based on a B+tree.
+ * Records are stored in leaf pages sorted by key and the leaves are chained together
+ * so that ordered iteration (in both directions), LE/GE seeks and prefix scans
+ * are cheap. Interior pages hold separator keys only.
+ * The engine sits on top of the pager [i.e: unqlite_kv_io] and is selected via
+ * unqlite_config(UNQLITE_CONFIG_KV_ENGINE,"btree") before the database is accessed.
+ *
+ * Keys are compared byte-wise (memcmp() followed by the key length) unless a custom
+ * comparison function is installed via UNQLITE_KV_CONFIG_CMP_FUNC. Note that the
+ * comparison function is not persisted so it must be installed each time the database is opened.
+ *
+ * Inserting keys in ascending order (bulk loading) is detected and handled by leaving
+ * the left page full when the rightmost page is split so sorted loads produce densely packed pages.
+ * Pages are reclaimed when they become empty. There is no merging of half empty pages.
+ */
+/* Magic number identifying a valid B+tree storage image */
+#define BT_MAGIC 0xB7EE5A1D
+/*
+ * Page one layout:
+ *   4 byte magic number
+ *   8 byte root page number
+ *   8 byte head of the free page list
+ */
+#define BT_HDR_ROOT_OFFT  4
+#define BT_HDR_FREE_OFFT  12
+/*
+ * Tree page types.
+ */
+#define BT_PAGE_LEAF 0x0D /* Leaf page: Hold records */
+#define BT_PAGE_NODE 0x05 /* Interior page: Hold separator keys */
+/*
+ * Tree page header:
+ *   1 byte page type
+ *   1 byte reserved
+ *   2 byte number of cells
+ *   4 byte offset of the cell content area
+ *   4 byte number of fragmented free bytes
+ *   8 byte right pointer (Next leaf for leaf pages, rightmost child for interior pages)
+ *   8 byte left pointer (Previous leaf for leaf pages, unused for interior pages)
+ * The header is followed by an array of 2 byte cell offsets sorted by key.
+ * Cell content grows from the end of the page.
+ */
+#define BT_PAGE_HDR_SZ 28
+/*
+ * Cell layout:
+ *  Leaf cell:     4 byte key length, 8 byte data length, 8 byte overflow page, local payload.
+ *  Interior cell: 8 byte left child, 4 byte key length, 8 byte overflow page, local key.
+ * The payload is the key immediately followed by the data. When the payload does not fit
+ * in the cell (See nMaxLocal), only a key prefix is kept locally and the rest is stored
+ * in a chain of overflow pages.
+ */
+#define BT_CELL_HDR_SZ 20
+/* Overflow page header: 8 byte next overflow page */
+#define BT_OVFL_HDR_SZ 8
+/* Maximum tree depth */
+#define BT_MAX_DEPTH 40
+/* Forward declaration */
+typedef struct bt_kv_engine bt_kv_engine;
+/*
+ * Decoded tree page header.
+ */
+typedef struct bt_page_hdr bt_page_hdr;
+struct bt_page_hdr
+{
+	sxu8 iType;     /* Page type (BT_PAGE_LEAF or BT_PAGE_NODE) */
+	sxu32 nCell;    /* Total number of cells */
+	sxu32 iContent; /* Offset of the cell content area */
+	sxu32 nFrag;    /* Fragmented free bytes */
+	pgno iRight;    /* Next leaf or rightmost child */
+	pgno iLeft;     /* Previous leaf */
+};
+/*
+ * Decoded cell.
+ */
+typedef struct bt_cell bt_cell;
+struct bt_cell
+{
+	pgno iChild;                 /* Left child (Interior cells only) */
+	sxu32 nKey;                  /* Key length */
+	sxu64 nData;                 /* Data length (Leaf cells only) */
+	pgno iOvfl;                  /* First overflow page, 0 if the whole payload is local */
+	const unsigned char *zLocal; /* Local payload */
+	sxu32 nLocal;                /* Local payload length */
+	sxu32 nSize;                 /* Total cell size */
+};
+/*
+ * Path from the root page to a leaf page.
+ */
+typedef struct bt_path bt_path;
+struct bt_path
+{
+	pgno aPage[BT_MAX_DEPTH];    /* Page at each level */
+	sxu32 aIdx[BT_MAX_DEPTH];    /* Child index at each level, cell index at the leaf level */
+	int aRight[BT_MAX_DEPTH];    /* True if the page is on the rightmost edge of the tree */
+	int nDepth;                  /* Index of the leaf level */
+};
+/*
+ * Each B+tree KV engine is represented by an instance
+ * of the following structure.
+ */
+struct bt_kv_engine
+{
+	const unqlite_kv_io *pIo;     /* IO methods: Must be first */
+	/* Private fields */
+	SyMemBackend sAllocator;      /* Private memory backend */
+	ProcCmp xCmp;                 /* Key comparison function */
+	sxu32 iPageSize;              /* Page size */
+	sxu32 nMaxLocal;              /* Maximum payload stored in a single cell */
+	sxu32 nMinLocal;              /* Local key prefix of an overflowing payload */
+	pgno iRoot;                   /* Root page */
+	pgno iFreeList;               /* Head of the free page list */
+	sxu32 iGen;                   /* Incremented on each write so that cursors can detect changes */
+	bt_path sPath;                /* Path of the last descent */
+	unsigned char *zCell;         /* Cell being inserted */
+	unsigned char *zSep;          /* Separator cell pushed to the parent page */
+	unsigned char *zTmp;          /* Page image used during splits and defragmentation */
+	const unsigned char **apCell; /* Cells of a page being split */
+	sxu32 *anCell;                /* Size of each cell of a page being split */
+	SyBlob sKey;                  /* Overflowing key (comparison) */
+	SyBlob sKey2;                 /* Overflowing key (separator computation) */
+	SyBlob sWorker;               /* Append buffer */
+	int bOpen;                    /* True when xOpen() was successfully called */
+};
+/*
+ * B+tree cursor.
+ * The cursor records a copy of the current key so that it can be repositioned
+ * after the tree has been modified by a write operation.
+ */
+typedef struct bt_kv_cursor bt_kv_cursor;
+struct bt_kv_cursor
+{
+	unqlite_kv_engine *pStore; /* Must be first */
+	/* Private fields */
+	pgno iLeaf;                /* Current leaf page, 0 if the cursor does not point to a valid entry */
+	sxu32 iCell;               /* Cell index in the current leaf */
+	sxu32 iGen;                /* Engine generation when the cursor was positioned */
+	SyBlob sKey;               /* Copy of the current key */
+};
+/*
+ * Decode a tree page header.
+ */
+static void btReadPageHdr(const unsigned char *zRaw,bt_page_hdr *pHdr)
+{
+	sxu16 nCell;
+	pHdr->iType = zRaw[0];
+	SyBigEndianUnpack16(&zRaw[2],&nCell);
+	pHdr->nCell = nCell;
+	SyBigEndianUnpack32(&zRaw[4],&pHdr->iContent);
+	SyBigEndianUnpack32(&zRaw[8],&pHdr->nFrag);
+	SyBigEndianUnpack64(&zRaw[12],&pHdr->iRight);
+	SyBigEndianUnpack64(&zRaw[20],&pHdr->iLeft);
+}
+/*
+ * Encode a tree page header.
+ * A writer lock have been acquired on the target page.
+ */
+static void btWritePageHdr(unsigned char *zRaw,const bt_page_hdr *pHdr)
+{
+	zRaw[0] = pHdr->iType;
+	zRaw[1] = 0;
+	SyBigEndianPack16(&zRaw[2],(sxu16)pHdr->nCell);
+	SyBigEndianPack32(&zRaw[4],pHdr->iContent);
+	SyBigEndianPack32(&zRaw[8],pHdr->nFrag);
+	SyBigEndianPack64(&zRaw[12],pHdr->iRight);
+	SyBigEndianPack64(&zRaw[20],pHdr->iLeft);
+}
+/*
+ * Offset of the i'th cell of a page.
+ */
+static sxu32 btCellOfft(const unsigned char *zRaw,sxu32 i)
+{
+	sxu16 iOfft;
+	SyBigEndianUnpack16(&zRaw[BT_PAGE_HDR_SZ + (i << 1)],&iOfft);
+	return (sxu32)iOfft;
+}
+/*
+ * Amount of payload kept in the cell itself.
+ */
+static sxu32 btLocalSize(bt_kv_engine *pEngine,sxu32 nKey,sxu64 nPayload)
+{
+	if( nPayload <= (sxu64)pEngine->nMaxLocal ){
+		/* The whole payload is local */
+		return (sxu32)nPayload;
+	}
+	/* Keep a key prefix for fast comparison, the rest go to the overflow pages */
+	return nKey < pEngine->nMinLocal ? nKey : pEngine->nMinLocal;
+}
+/*
+ * Decode a cell image.
+ */
+static void btDecodeCell(bt_kv_engine *pEngine,const unsigned char *zCell,int isLeaf,bt_cell *pCell)
+{
+	const unsigned char *zPtr = zCell;
+	if( isLeaf ){
+		pCell->iChild = 0;
+		SyBigEndianUnpack32(zPtr,&pCell->nKey);
+		zPtr += 4;
+		SyBigEndianUnpack64(zPtr,&pCell->nData);
+		zPtr += 8;
+	}else{
+		SyBigEndianUnpack64(zPtr,&pCell->iChild);
+		zPtr += 8;
+		SyBigEndianUnpack32(zPtr,&pCell->nKey);
+		zPtr += 4;
+		pCell->nData = 0;
+	}
+	SyBigEndianUnpack64(zPtr,&pCell->iOvfl);
+	zPtr += 8;
+	pCell->zLocal = zPtr;
+	pCell->nLocal = btLocalSize(pEngine,pCell->nKey,(sxu64)pCell->nKey + pCell->nData);
+	pCell->nSize = (sxu32)(zPtr - zCell) + pCell->nLocal;
+}
+/*
+ * Decode the cell stored at the given offset of a page.
+ */
+static int btParseCell(bt_kv_engine *pEngine,const unsigned char *zRaw,int isLeaf,sxu32 iOfft,bt_cell *pCell)
+{
+	if( iOfft < BT_PAGE_HDR_SZ || iOfft + BT_CELL_HDR_SZ > pEngine->iPageSize ){
+		return UNQLITE_CORRUPT;
+	}
+	btDecodeCell(pEngine,&zRaw[iOfft],isLeaf,pCell);
+	if( iOfft + pCell->nSize > pEngine->iPageSize ){
+		return UNQLITE_CORRUPT;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Decode the i'th cell of a page.
+ */
+static int btPageCell(bt_kv_engine *pEngine,const unsigned char *zRaw,sxu32 i,bt_cell *pCell)
+{
+	return btParseCell(pEngine,zRaw,zRaw[0] == BT_PAGE_LEAF,btCellOfft(zRaw,i),pCell);
+}
+/*
+ * Child pointer at the given index of an interior page.
+ * The index equal to the number of cells refer to the rightmost child.
+ */
+static int btChildAt(bt_kv_engine *pEngine,const unsigned char *zRaw,const bt_page_hdr *pHdr,sxu32 iIdx,pgno *pChild)
+{
+	bt_cell sCell;
+	int rc;
+	if( iIdx >= pHdr->nCell ){
+		*pChild = pHdr->iRight;
+	}else{
+		rc = btPageCell(pEngine,zRaw,iIdx,&sCell);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		*pChild = sCell.iChild;
+	}
+	if( *pChild == 0 ){
+		return UNQLITE_CORRUPT;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Load a tree page and make sure it is a valid one.
+ */
+static int btLoadPage(bt_kv_engine *pEngine,pgno iPage,unqlite_page **ppPage,bt_page_hdr *pHdr)
+{
+	unqlite_page *pPage;
+	int rc;
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPage,&pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	btReadPageHdr(pPage->zData,pHdr);
+	if( (pHdr->iType != BT_PAGE_LEAF && pHdr->iType != BT_PAGE_NODE) || pHdr->iContent > pEngine->iPageSize
+		|| BT_PAGE_HDR_SZ + (pHdr->nCell << 1) > pHdr->iContent ){
+			pEngine->pIo->xPageUnref(pPage);
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Malformed B+tree page");
+			return UNQLITE_CORRUPT;
+	}
+	*ppPage = pPage;
+	return UNQLITE_OK;
+}
+/* Forward declaration */
+static int bt_kv_open(unqlite_kv_engine *pKv,pgno dbSize);
+/*
+ * Read the database header (Page one).
+ * This is done at the start of each operation so that a rollback or a pager
+ * cache reset does not leave stale values behind.
+ */
+static int btLoadHeader(bt_kv_engine *pEngine)
+{
+	unqlite_page *pHeader;
+	sxu32 nMagic;
+	int rc;
+	if( !pEngine->bOpen ){
+		/* Acquire a shared lock, the pager invoke xOpen() at this stage */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->pIo->xPageUnref(pHeader);
+		if( !pEngine->bOpen ){
+			/* In-memory database, xOpen() is never invoked by the pager */
+			rc = bt_kv_open((unqlite_kv_engine *)pEngine,0);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+		}
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack32(pHeader->zData,&nMagic);
+	SyBigEndianUnpack64(&pHeader->zData[BT_HDR_ROOT_OFFT],&pEngine->iRoot);
+	SyBigEndianUnpack64(&pHeader->zData[BT_HDR_FREE_OFFT],&pEngine->iFreeList);
+	pEngine->pIo->xPageUnref(pHeader);
+	if( nMagic != BT_MAGIC || pEngine->iRoot < 2 ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Malformed B+tree database header");
+		return UNQLITE_CORRUPT;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Reflect the head of the free page list in the database header.
+ */
+static int btWriteFreeList(bt_kv_engine *pEngine,pgno iFree)
+{
+	unqlite_page *pHeader;
+	int rc;
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pHeader);
+	if( rc == UNQLITE_OK ){
+		SyBigEndianPack64(&pHeader->zData[BT_HDR_FREE_OFFT],iFree);
+		pEngine->iFreeList = iFree;
+	}
+	pEngine->pIo->xPageUnref(pHeader);
+	return rc;
+}
+/*
+ * Allocate a new page, either from the free list or by extending the database file.
+ * A writer lock is acquired on the returned page.
+ */
+static int btAllocPage(bt_kv_engine *pEngine,unqlite_page **ppPage)
+{
+	unqlite_page *pPage;
+	pgno iNext;
+	int rc;
+	if( pEngine->iFreeList > 0 ){
+		/* Recycle a free page */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iFreeList,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(pPage->zData,&iNext);
+		rc = btWriteFreeList(pEngine,iNext);
+	}else{
+		/* Extend the database file */
+		rc = pEngine->pIo->xNew(pEngine->pIo->pHandle,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( rc == UNQLITE_OK ){
+		rc = pEngine->pIo->xWrite(pPage);
+	}
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(pPage);
+		return rc;
+	}
+	*ppPage = pPage;
+	return UNQLITE_OK;
+}
+/*
+ * Restore a page to the free list.
+ */
+static int btFreePage(bt_kv_engine *pEngine,unqlite_page *pPage)
+{
+	int rc;
+	rc = pEngine->pIo->xWrite(pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianPack64(pPage->zData,pEngine->iFreeList);
+	return btWriteFreeList(pEngine,pPage->pgno);
+}
+/*
+ * Restore a chain of overflow pages to the free list.
+ */
+static int btFreeOverflow(bt_kv_engine *pEngine,pgno iOvfl)
+{
+	unqlite_page *pPage;
+	pgno iNext;
+	int rc;
+	while( iOvfl > 0 ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iOvfl,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(pPage->zData,&iNext);
+		rc = btFreePage(pEngine,pPage);
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		iOvfl = iNext;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Store a payload (Made of two chunks) in a new chain of overflow pages.
+ */
+static int btWriteOverflow(
+	bt_kv_engine *pEngine,
+	const unsigned char *zA,sxu64 nA, /* First chunk */
+	const unsigned char *zB,sxu64 nB, /* Second chunk */
+	pgno *piOvfl                      /* OUT: First overflow page */
+	)
+{
+	sxu32 nAvail = pEngine->iPageSize - BT_OVFL_HDR_SZ;
+	unqlite_page *pPrev = 0,*pPage;
+	unsigned char *zOut;
+	sxu32 nFree,n;
+	int rc;
+	*piOvfl = 0;
+	while( nA + nB > 0 ){
+		rc = btAllocPage(pEngine,&pPage);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		SyBigEndianPack64(pPage->zData,0);
+		if( pPrev ){
+			/* Link to the previous page of the chain */
+			SyBigEndianPack64(pPrev->zData,pPage->pgno);
+			pEngine->pIo->xPageUnref(pPrev);
+		}else{
+			*piOvfl = pPage->pgno;
+		}
+		pPrev = pPage;
+		/* Fill the page */
+		zOut = &pPage->zData[BT_OVFL_HDR_SZ];
+		nFree = nAvail;
+		while( nFree > 0 && nA + nB > 0 ){
+			if( nA < 1 ){
+				/* Switch to the second chunk */
+				zA = zB;
+				nA = nB;
+				nB = 0;
+			}
+			n = nA < (sxu64)nFree ? (sxu32)nA : nFree;
+			SyMemcpy((const void *)zA,(void *)zOut,n);
+			zA += n;
+			nA -= n;
+			zOut += n;
+			nFree -= n;
+		}
+	}
+	if( pPrev ){
+		pEngine->pIo->xPageUnref(pPrev);
+	}
+	return nA + nB > 0 ? UNQLITE_IOERR : UNQLITE_OK;
+}
+/*
+ * Read (or overwrite when zIn is not NULL) a range of the payload of a given cell.
+ * The payload is the key followed by the data.
+ */
+static int btPayloadAccess(
+	bt_kv_engine *pEngine,
+	unqlite_page *pPage,  /* Page holding the cell */
+	bt_cell *pCell,       /* Target cell */
+	sxu64 iOfft,          /* Payload offset */
+	sxu64 nLen,           /* Amount of bytes to access */
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData, /* Read consumer */
+	const unsigned char *zIn /* Overwrite with this content */
+	)
+{
+	sxu32 nAvail = pEngine->iPageSize - BT_OVFL_HDR_SZ;
+	unqlite_page *pOvfl;
+	pgno iOvfl;
+	sxu32 n;
+	int rc;
+	if( nLen < 1 ){
+		return UNQLITE_OK;
+	}
+	if( iOfft < (sxu64)pCell->nLocal ){
+		/* Local chunk */
+		n = pCell->nLocal - (sxu32)iOfft;
+		if( (sxu64)n > nLen ){
+			n = (sxu32)nLen;
+		}
+		if( zIn ){
+			rc = pEngine->pIo->xWrite(pPage);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			SyMemcpy((const void *)zIn,(void *)&pCell->zLocal[iOfft],n);
+			zIn += n;
+		}else{
+			if( xConsumer(&pCell->zLocal[iOfft],n,pUserData) != UNQLITE_OK ){
+				return UNQLITE_ABORT;
+			}
+		}
+		iOfft += n;
+		nLen -= n;
+	}
+	iOfft -= pCell->nLocal;
+	iOvfl = pCell->iOvfl;
+	while( nLen > 0 ){
+		if( iOvfl < 1 ){
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Broken B+tree overflow chain");
+			return UNQLITE_CORRUPT;
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iOvfl,&pOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iOfft < (sxu64)nAvail ){
+			n = nAvail - (sxu32)iOfft;
+			if( (sxu64)n > nLen ){
+				n = (sxu32)nLen;
+			}
+			if( zIn ){
+				rc = pEngine->pIo->xWrite(pOvfl);
+				if( rc == UNQLITE_OK ){
+					SyMemcpy((const void *)zIn,(void *)&pOvfl->zData[BT_OVFL_HDR_SZ + iOfft],n);
+					zIn += n;
+				}
+			}else if( xConsumer(&pOvfl->zData[BT_OVFL_HDR_SZ + iOfft],n,pUserData) != UNQLITE_OK ){
+				rc = UNQLITE_ABORT;
+			}
+			if( rc != UNQLITE_OK ){
+				pEngine->pIo->xPageUnref(pOvfl);
+				return rc;
+			}
+			nLen -= n;
+			iOfft = 0;
+		}else{
+			/* Skip this page */
+			iOfft -= nAvail;
+		}
+		SyBigEndianUnpack64(pOvfl->zData,&iOvfl);
+		pEngine->pIo->xPageUnref(pOvfl);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Return the full key of a cell.
+ * When the key overflows, it is loaded into the given working buffer.
+ */
+static int btCellKey(bt_kv_engine *pEngine,bt_cell *pCell,SyBlob *pWorker,const unsigned char **pzKey)
+{
+	int rc;
+	if( pCell->nKey <= pCell->nLocal ){
+		/* Local key */
+		*pzKey = pCell->zLocal;
+		return UNQLITE_OK;
+	}
+	SyBlobReset(pWorker);
+	rc = btPayloadAccess(pEngine,0,pCell,0,pCell->nKey,unqliteDataConsumer,pWorker,0);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	*pzKey = (const unsigned char *)SyBlobData(pWorker);
+	return UNQLITE_OK;
+}
+/*
+ * Compare two keys.
+ */
+static sxi32 btKeyCmp(bt_kv_engine *pEngine,const void *pA,sxu32 nA,const void *pB,sxu32 nB)
+{
+	sxi32 rc = 0;
+	sxu32 n;
+	n = nA < nB ? nA : nB;
+	if( n > 0 ){
+		rc = pEngine->xCmp(pA,pB,n);
+	}
+	if( rc == 0 && nA != nB ){
+		rc = nA < nB ? -1 : 1;
+	}
+	return rc;
+}
+/*
+ * Compare the key of a cell with a lookup key.
+ */
+static int btCellCompare(bt_kv_engine *pEngine,bt_cell *pCell,const void *pKey,sxu32 nKey,sxi32 *pRes)
+{
+	const unsigned char *zKey;
+	sxu32 n;
+	int rc;
+	if( pCell->nKey > pCell->nLocal && pEngine->xCmp == SyMemcmp ){
+		/* Try the local key prefix first */
+		n = pCell->nLocal < nKey ? pCell->nLocal : nKey;
+		*pRes = n > 0 ? SyMemcmp(pCell->zLocal,pKey,n) : 0;
+		if( *pRes != 0 ){
+			return UNQLITE_OK;
+		}
+		if( nKey <= pCell->nLocal ){
+			/* The lookup key is a prefix of the cell key */
+			*pRes = 1;
+			return UNQLITE_OK;
+		}
+	}
+	rc = btCellKey(pEngine,pCell,&pEngine->sKey,&zKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	*pRes = btKeyCmp(pEngine,zKey,pCell->nKey,pKey,nKey);
+	return UNQLITE_OK;
+}
+/*
+ * Binary search a page for the given key.
+ * For leaf pages, the index of the first cell whose key is greater than or equal
+ * to the lookup key is returned and *pExact is set when the key was found.
+ * For interior pages, the index of the child pointer to follow is returned.
+ */
+static int btPageSearch(bt_kv_engine *pEngine,const unsigned char *zRaw,const bt_page_hdr *pHdr,const void *pKey,sxu32 nKey,sxu32 *pIdx,int *pExact)
+{
+	int isLeaf = pHdr->iType == BT_PAGE_LEAF;
+	sxu32 iLo = 0,iHi = pHdr->nCell,iMid;
+	bt_cell sCell;
+	sxi32 iRes;
+	int rc;
+	*pExact = 0;
+	while( iLo < iHi ){
+		iMid = (iLo + iHi) >> 1;
+		rc = btParseCell(pEngine,zRaw,isLeaf,btCellOfft(zRaw,iMid),&sCell);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = btCellCompare(pEngine,&sCell,pKey,nKey,&iRes);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( iRes < 0 || (!isLeaf && iRes == 0) ){
+			iLo = iMid + 1;
+		}else{
+			if( iRes == 0 ){
+				*pExact = 1;
+			}
+			iHi = iMid;
+		}
+	}
+	*pIdx = iLo;
+	return UNQLITE_OK;
+}
+/*
+ * Walk down the tree from the root page to the leaf page that should hold the given key.
+ * The path is recorded in pEngine->sPath.
+ */
+static int btDescend(bt_kv_engine *pEngine,const void *pKey,sxu32 nKey,int *pExact)
+{
+	bt_path *pPath = &pEngine->sPath;
+	unqlite_page *pPage;
+	bt_page_hdr sHdr;
+	int iRight = 1;
+	pgno iPage;
+	sxu32 iIdx;
+	int i,rc;
+	iPage = pEngine->iRoot;
+	for( i = 0 ; i < BT_MAX_DEPTH ; ++i ){
+		rc = btLoadPage(pEngine,iPage,&pPage,&sHdr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pPath->aPage[i] = iPage;
+		rc = btPageSearch(pEngine,pPage->zData,&sHdr,pKey,nKey,&iIdx,pExact);
+		if( rc == UNQLITE_OK && sHdr.iType == BT_PAGE_NODE ){
+			rc = btChildAt(pEngine,pPage->zData,&sHdr,iIdx,&iPage);
+		}
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pPath->aIdx[i] = iIdx;
+		pPath->aRight[i] = iRight;
+		if( sHdr.iType == BT_PAGE_LEAF ){
+			pPath->aRight[i] = iRight && iIdx >= sHdr.nCell && sHdr.iRight == 0;
+			pPath->nDepth = i;
+			return UNQLITE_OK;
+		}
+		iRight = iRight && iIdx >= sHdr.nCell;
+	}
+	pEngine->pIo->xErr(pEngine->pIo->pHandle,"B+tree is too deep");
+	return UNQLITE_CORRUPT;
+}
+/*
+ * Walk down to the first (iEdge == 0) or last leaf page of the tree.
+ */
+static int btDescendEdge(bt_kv_engine *pEngine,int iEdge,pgno *pLeaf,sxu32 *pCell)
+{
+	unqlite_page *pPage;
+	bt_page_hdr sHdr;
+	pgno iPage;
+	int i,rc;
+	iPage = pEngine->iRoot;
+	for( i = 0 ; i < BT_MAX_DEPTH ; ++i ){
+		rc = btLoadPage(pEngine,iPage,&pPage,&sHdr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( sHdr.iType == BT_PAGE_LEAF ){
+			pEngine->pIo->xPageUnref(pPage);
+			if( sHdr.nCell < 1 ){
+				/* Empty tree */
+				return UNQLITE_DONE;
+			}
+			*pLeaf = iPage;
+			*pCell = iEdge ? sHdr.nCell - 1 : 0;
+			return UNQLITE_OK;
+		}
+		rc = btChildAt(pEngine,pPage->zData,&sHdr,iEdge ? sHdr.nCell : 0,&iPage);
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	return UNQLITE_CORRUPT;
+}
+/*
+ * Defragment a page so that all its free space is contiguous.
+ * A writer lock have been acquired on this page.
+ */
+static void btPageDefragment(bt_kv_engine *pEngine,unsigned char *zRaw,bt_page_hdr *pHdr)
+{
+	unsigned char *zTmp = pEngine->zTmp;
+	bt_cell sCell;
+	sxu32 iOfft,i;
+	SyMemcpy((const void *)zRaw,(void *)zTmp,pEngine->iPageSize);
+	iOfft = pEngine->iPageSize;
+	for( i = 0 ; i < pHdr->nCell ; ++i ){
+		if( btParseCell(pEngine,zTmp,pHdr->iType == BT_PAGE_LEAF,btCellOfft(zTmp,i),&sCell) != UNQLITE_OK ){
+			continue;
+		}
+		iOfft -= sCell.nSize;
+		SyMemcpy((const void *)&zTmp[btCellOfft(zTmp,i)],(void *)&zRaw[iOfft],sCell.nSize);
+		SyBigEndianPack16(&zRaw[BT_PAGE_HDR_SZ + (i << 1)],(sxu16)iOfft);
+	}
+	pHdr->iContent = iOfft;
+	pHdr->nFrag = 0;
+	btWritePageHdr(zRaw,pHdr);
+}
+/*
+ * Insert a cell at the given index of a page.
+ * Return UNQLITE_FULL when there is not enough room in the page.
+ */
+static int btPageInsertCell(bt_kv_engine *pEngine,unqlite_page *pPage,sxu32 iIdx,const unsigned char *zCell,sxu32 nSize)
+{
+	unsigned char *zRaw = pPage->zData;
+	bt_page_hdr sHdr;
+	sxu32 nFree,i;
+	int rc;
+	btReadPageHdr(zRaw,&sHdr);
+	nFree = sHdr.iContent - (BT_PAGE_HDR_SZ + (sHdr.nCell << 1));
+	if( nFree + sHdr.nFrag < nSize + 2 || sHdr.nCell >= 0xFFFF ){
+		return UNQLITE_FULL;
+	}
+	rc = pEngine->pIo->xWrite(pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( nFree < nSize + 2 ){
+		/* Merge the fragmented space */
+		btPageDefragment(pEngine,zRaw,&sHdr);
+	}
+	sHdr.iContent -= nSize;
+	SyMemcpy((const void *)zCell,(void *)&zRaw[sHdr.iContent],nSize);
+	/* Make room in the cell offset array */
+	for( i = sHdr.nCell ; i > iIdx ; --i ){
+		zRaw[BT_PAGE_HDR_SZ + (i << 1)]     = zRaw[BT_PAGE_HDR_SZ + ((i - 1) << 1)];
+		zRaw[BT_PAGE_HDR_SZ + (i << 1) + 1] = zRaw[BT_PAGE_HDR_SZ + ((i - 1) << 1) + 1];
+	}
+	SyBigEndianPack16(&zRaw[BT_PAGE_HDR_SZ + (iIdx << 1)],(sxu16)sHdr.iContent);
+	sHdr.nCell++;
+	btWritePageHdr(zRaw,&sHdr);
+	return UNQLITE_OK;
+}
+/*
+ * Remove the cell at the given index of a page.
+ * Overflow pages of the cell (if any) must be released by the caller.
+ */
+static int btPageDropCell(bt_kv_engine *pEngine,unqlite_page *pPage,sxu32 iIdx)
+{
+	unsigned char *zRaw = pPage->zData;
+	bt_page_hdr sHdr;
+	bt_cell sCell;
+	sxu32 iOfft,i;
+	int rc;
+	btReadPageHdr(zRaw,&sHdr);
+	iOfft = btCellOfft(zRaw,iIdx);
+	rc = btParseCell(pEngine,zRaw,sHdr.iType == BT_PAGE_LEAF,iOfft,&sCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( iOfft == sHdr.iContent ){
+		/* Cell at the start of the content area, reclaim its space directly */
+		sHdr.iContent += sCell.nSize;
+	}else{
+		sHdr.nFrag += sCell.nSize;
+	}
+	for( i = iIdx + 1 ; i < sHdr.nCell ; ++i ){
+		zRaw[BT_PAGE_HDR_SZ + ((i - 1) << 1)]     = zRaw[BT_PAGE_HDR_SZ + (i << 1)];
+		zRaw[BT_PAGE_HDR_SZ + ((i - 1) << 1) + 1] = zRaw[BT_PAGE_HDR_SZ + (i << 1) + 1];
+	}
+	sHdr.nCell--;
+	if( sHdr.nCell < 1 ){
+		/* Empty page */
+		sHdr.iContent = pEngine->iPageSize;
+		sHdr.nFrag = 0;
+	}
+	btWritePageHdr(zRaw,&sHdr);
+	return UNQLITE_OK;
+}
+/*
+ * Fill a page with a set of cells.
+ * A writer lock have been acquired on the target page.
+ */
+static void btPageBuild(bt_kv_engine *pEngine,unsigned char *zRaw,bt_page_hdr *pHdr,const unsigned char **apCell,const sxu32 *anCell,sxu32 nCell)
+{
+	sxu32 iOfft,i;
+	iOfft = pEngine->iPageSize;
+	for( i = 0 ; i < nCell ; ++i ){
+		iOfft -= anCell[i];
+		SyMemcpy((const void *)apCell[i],(void *)&zRaw[iOfft],anCell[i]);
+		SyBigEndianPack16(&zRaw[BT_PAGE_HDR_SZ + (i << 1)],(sxu16)iOfft);
+	}
+	pHdr->nCell = nCell;
+	pHdr->iContent = iOfft;
+	pHdr->nFrag = 0;
+	btWritePageHdr(zRaw,pHdr);
+}
+/*
+ * Initialize an empty tree page.
+ * A writer lock have been acquired on the target page.
+ */
+static void btPageInit(bt_kv_engine *pEngine,unsigned char *zRaw,sxu8 iType)
+{
+	bt_page_hdr sHdr;
+	sHdr.iType = iType;
+	sHdr.nCell = 0;
+	sHdr.iContent = pEngine->iPageSize;
+	sHdr.nFrag = 0;
+	sHdr.iRight = sHdr.iLeft = 0;
+	btWritePageHdr(zRaw,&sHdr);
+}
+/*
+ * Build a cell (Leaf or interior) in the given buffer.
+ * The payload part that does not fit in the cell is written to overflow pages.
+ */
+static int btBuildCell(
+	bt_kv_engine *pEngine,
+	int isLeaf,                                 /* Leaf or interior cell */
+	pgno iChild,                                /* Left child (Interior cell only) */
+	const void *pKey,sxu32 nKey,                /* Key */
+	const void *pData,sxu64 nData,              /* Data (Leaf cell only) */
+	unsigned char *zOut,                        /* OUT: Cell image */
+	sxu32 *pnSize                               /* OUT: Cell size */
+	)
+{
+	const unsigned char *zKey = (const unsigned char *)pKey;
+	unsigned char *zPtr = zOut;
+	sxu32 nLocal,nKeyLocal;
+	pgno iOvfl = 0;
+	int rc;
+	nLocal = btLocalSize(pEngine,nKey,(sxu64)nKey + nData);
+	if( (sxu64)nLocal < (sxu64)nKey + nData ){
+		/* Overflowing payload */
+		nKeyLocal = nLocal < nKey ? nLocal : nKey;
+		rc = btWriteOverflow(pEngine,&zKey[nKeyLocal],nKey - nKeyLocal,(const unsigned char *)pData,nData,&iOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( isLeaf ){
+		SyBigEndianPack32(zPtr,nKey);
+		zPtr += 4;
+		SyBigEndianPack64(zPtr,nData);
+		zPtr += 8;
+	}else{
+		SyBigEndianPack64(zPtr,iChild);
+		zPtr += 8;
+		SyBigEndianPack32(zPtr,nKey);
+		zPtr += 4;
+	}
+	SyBigEndianPack64(zPtr,iOvfl);
+	zPtr += 8;
+	/* Local payload */
+	if( nLocal <= nKey ){
+		SyMemcpy(pKey,(void *)zPtr,nLocal);
+	}else{
+		SyMemcpy(pKey,(void *)zPtr,nKey);
+		SyMemcpy(pData,(void *)&zPtr[nKey],nLocal - nKey);
+	}
+	zPtr += nLocal;
+	*pnSize = (sxu32)(zPtr - zOut);
+	return UNQLITE_OK;
+}
+/*
+ * Compute the separator key to be pushed to the parent page after a leaf split.
+ * With the default comparison function, this is the shortest prefix of the first
+ * key of the right page which is greater than the last key of the left page.
+ */
+static int btLeafSeparator(bt_kv_engine *pEngine,const unsigned char *zLeft,const unsigned char *zRight,pgno iChild,unsigned char *zOut,sxu32 *pnSize)
+{
+	const unsigned char *zA,*zB;
+	bt_cell sLeft,sRight;
+	sxu32 n;
+	int rc;
+	btDecodeCell(pEngine,zLeft,1,&sLeft);
+	btDecodeCell(pEngine,zRight,1,&sRight);
+	rc = btCellKey(pEngine,&sLeft,&pEngine->sKey,&zA);
+	if( rc == UNQLITE_OK ){
+		rc = btCellKey(pEngine,&sRight,&pEngine->sKey2,&zB);
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	n = sRight.nKey;
+	if( pEngine->xCmp == SyMemcmp ){
+		/* Suffix truncation */
+		n = 0;
+		while( n < sLeft.nKey && n < sRight.nKey && zA[n] == zB[n] ){
+			n++;
+		}
+		if( n < sRight.nKey ){
+			n++;
+		}
+	}
+	return btBuildCell(pEngine,0,iChild,zB,n,0,0,zOut,pnSize);
+}
+/*
+ * Move the content of the root page to a new page so that the root page
+ * can become the parent of the pages resulting from a split.
+ * The root page number never change.
+ */
+static int btRootGrow(bt_kv_engine *pEngine)
+{
+	bt_path *pPath = &pEngine->sPath;
+	unqlite_page *pRoot,*pChild;
+	bt_page_hdr sHdr;
+	int i,rc;
+	if( pPath->nDepth + 1 >= BT_MAX_DEPTH ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"B+tree is too deep");
+		return UNQLITE_LIMIT;
+	}
+	rc = btLoadPage(pEngine,pEngine->iRoot,&pRoot,&sHdr);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pRoot);
+	if( rc == UNQLITE_OK ){
+		rc = btAllocPage(pEngine,&pChild);
+	}
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(pRoot);
+		return rc;
+	}
+	/* Copy the root content */
+	SyMemcpy((const void *)pRoot->zData,(void *)pChild->zData,pEngine->iPageSize);
+	/* The root is now an interior page with a single child */
+	btPageInit(pEngine,pRoot->zData,BT_PAGE_NODE);
+	btReadPageHdr(pRoot->zData,&sHdr);
+	sHdr.iRight = pChild->pgno;
+	btWritePageHdr(pRoot->zData,&sHdr);
+	/* Shift the path */
+	for( i = pPath->nDepth ; i >= 0 ; --i ){
+		pPath->aPage[i + 1] = pPath->aPage[i];
+		pPath->aIdx[i + 1] = pPath->aIdx[i];
+		pPath->aRight[i + 1] = pPath->aRight[i];
+	}
+	pPath->aPage[1] = pChild->pgno;
+	pPath->aIdx[0] = 0;
+	pPath->aRight[0] = 1;
+	pPath->nDepth++;
+	pEngine->pIo->xPageUnref(pChild);
+	pEngine->pIo->xPageUnref(pRoot);
+	return UNQLITE_OK;
+}
+/*
+ * Split a full page at the given level of the current path while inserting a new cell.
+ * The separator cell to be inserted in the parent page is stored in zSep.
+ */
+static int btPageSplit(
+	bt_kv_engine *pEngine,
+	int iLevel,                /* Level of the page to split */
+	const unsigned char *zCell,sxu32 nCell, /* Cell to insert */
+	unsigned char *zSep,sxu32 *pnSep        /* OUT: Separator cell */
+	)
+{
+	bt_path *pPath = &pEngine->sPath;
+	const unsigned char **apCell = pEngine->apCell;
+	sxu32 *anCell = pEngine->anCell;
+	unqlite_page *pPage,*pNew,*pParent,*pNext;
+	bt_page_hdr sHdr,sNew,sParent;
+	sxu32 iIdx,nTotal,nSum,i,m,n;
+	bt_cell sCell;
+	int isLeaf;
+	int rc;
+	rc = btLoadPage(pEngine,pPath->aPage[iLevel],&pPage,&sHdr);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	isLeaf = sHdr.iType == BT_PAGE_LEAF;
+	iIdx = pPath->aIdx[iLevel];
+	/* Collect the cells from a copy of the page */
+	SyMemcpy((const void *)pPage->zData,(void *)pEngine->zTmp,pEngine->iPageSize);
+	n = 0;
+	nTotal = 0;
+	for( i = 0 ; i <= sHdr.nCell ; ++i ){
+		if( i == iIdx ){
+			apCell[n] = zCell;
+			anCell[n] = nCell;
+			nTotal += nCell + 2;
+			n++;
+		}
+		if( i == sHdr.nCell ){
+			break;
+		}
+		rc = btParseCell(pEngine,pEngine->zTmp,isLeaf,btCellOfft(pEngine->zTmp,i),&sCell);
+		if( rc != UNQLITE_OK ){
+			pEngine->pIo->xPageUnref(pPage);
+			return rc;
+		}
+		apCell[n] = &pEngine->zTmp[btCellOfft(pEngine->zTmp,i)];
+		anCell[n] = sCell.nSize;
+		nTotal += sCell.nSize + 2;
+		n++;
+	}
+	/* Pick the split point: Cells [0,m) stay in this page */
+	if( pPath->aRight[iLevel] && iIdx == sHdr.nCell ){
+		/* Appending to the rightmost page (i.e. sorted bulk load), keep the old page full */
+		m = n - 1;
+	}else{
+		nSum = 0;
+		for( m = 0 ; m < n - 1 ; ++m ){
+			if( nSum + anCell[m] + 2 > nTotal / 2 && m > 0 ){
+				break;
+			}
+			nSum += anCell[m] + 2;
+		}
+	}
+	/* Allocate the right page */
+	rc = btAllocPage(pEngine,&pNew);
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(pPage);
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pPage);
+	if( rc != UNQLITE_OK ){
+		goto fail;
+	}
+	sNew.iType = sHdr.iType;
+	if( isLeaf ){
+		/* Right page: Cells [m,n) */
+		sNew.iRight = sHdr.iRight;
+		sNew.iLeft = pPage->pgno;
+		btPageBuild(pEngine,pNew->zData,&sNew,&apCell[m],&anCell[m],n - m);
+		/* Separator */
+		rc = btLeafSeparator(pEngine,apCell[m - 1],apCell[m],pPage->pgno,zSep,pnSep);
+		if( rc != UNQLITE_OK ){
+			goto fail;
+		}
+		/* Left page: Cells [0,m) */
+		sHdr.iRight = pNew->pgno;
+		btPageBuild(pEngine,pPage->zData,&sHdr,apCell,anCell,m);
+		if( sNew.iRight > 0 ){
+			/* Fix the back link of the next leaf */
+			rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,sNew.iRight,&pNext);
+			if( rc != UNQLITE_OK ){
+				goto fail;
+			}
+			rc = pEngine->pIo->xWrite(pNext);
+			if( rc == UNQLITE_OK ){
+				SyBigEndianPack64(&pNext->zData[20],pNew->pgno);
+			}
+			pEngine->pIo->xPageUnref(pNext);
+			if( rc != UNQLITE_OK ){
+				goto fail;
+			}
+		}
+	}else{
+		/* Right page: Cells (m,n), same rightmost child */
+		sNew.iRight = sHdr.iRight;
+		sNew.iLeft = 0;
+		btPageBuild(pEngine,pNew->zData,&sNew,&apCell[m + 1],&anCell[m + 1],n - m - 1);
+		/* Cell m is moved to the parent, its child become the rightmost child of the left page */
+		btDecodeCell(pEngine,apCell[m],0,&sCell);
+		sHdr.iRight = sCell.iChild;
+		SyMemcpy((const void *)apCell[m],(void *)zSep,anCell[m]);
+		*pnSep = anCell[m];
+		SyBigEndianPack64(zSep,pPage->pgno);
+		btPageBuild(pEngine,pPage->zData,&sHdr,apCell,anCell,m);
+	}
+	/* The parent pointer to this page now point to the right page */
+	rc = btLoadPage(pEngine,pPath->aPage[iLevel - 1],&pParent,&sParent);
+	if( rc != UNQLITE_OK ){
+		goto fail;
+	}
+	rc = pEngine->pIo->xWrite(pParent);
+	if( rc == UNQLITE_OK ){
+		i = pPath->aIdx[iLevel - 1];
+		if( i >= sParent.nCell ){
+			sParent.iRight = pNew->pgno;
+			btWritePageHdr(pParent->zData,&sParent);
+		}else{
+			SyBigEndianPack64(&pParent->zData[btCellOfft(pParent->zData,i)],pNew->pgno);
+		}
+	}
+	pEngine->pIo->xPageUnref(pParent);
+fail:
+	pEngine->pIo->xPageUnref(pNew);
+	pEngine->pIo->xPageUnref(pPage);
+	return rc;
+}
+/*
+ * Insert a cell in the leaf page of the current path, splitting pages as needed.
+ */
+static int btInsertCell(bt_kv_engine *pEngine,const unsigned char *zCell,sxu32 nCell)
+{
+	bt_path *pPath = &pEngine->sPath;
+	unsigned char *zIn = (unsigned char *)zCell;
+	unsigned char *zOut = pEngine->zSep;
+	unsigned char *zSwap;
+	unqlite_page *pPage;
+	int iLevel = pPath->nDepth;
+	sxu32 nOut;
+	int rc;
+	for(;;){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pPath->aPage[iLevel],&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = btPageInsertCell(pEngine,pPage,pPath->aIdx[iLevel],zIn,nCell);
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_FULL ){
+			return rc;
+		}
+		if( iLevel == 0 ){
+			/* Splitting the root page */
+			rc = btRootGrow(pEngine);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			iLevel = 1;
+		}
+		rc = btPageSplit(pEngine,iLevel,zIn,nCell,zOut,&nOut);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		/* Insert the separator in the parent page */
+		iLevel--;
+		nCell = nOut;
+		zSwap = zIn == zCell ? pEngine->zCell : zIn;
+		zIn = zOut;
+		zOut = zSwap;
+	}
+}
+/*
+ * Remove the pointer at the given index of an interior page.
+ * Set *pEmpty when the page does not have any child left.
+ */
+static int btNodeDropChild(bt_kv_engine *pEngine,unqlite_page *pPage,sxu32 iIdx,int *pEmpty)
+{
+	bt_page_hdr sHdr;
+	bt_cell sCell;
+	int rc;
+	btReadPageHdr(pPage->zData,&sHdr);
+	*pEmpty = 0;
+	if( sHdr.nCell < 1 ){
+		/* Only the rightmost child was left */
+		*pEmpty = 1;
+		return UNQLITE_OK;
+	}
+	if( iIdx >= sHdr.nCell ){
+		/* Rightmost child, its left sibling take its place */
+		iIdx = sHdr.nCell - 1;
+		rc = btPageCell(pEngine,pPage->zData,iIdx,&sCell);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		sHdr.iRight = sCell.iChild;
+		btWritePageHdr(pPage->zData,&sHdr);
+	}else{
+		rc = btPageCell(pEngine,pPage->zData,iIdx,&sCell);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	/* Drop the separator key */
+	rc = btFreeOverflow(pEngine,sCell.iOvfl);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return btPageDropCell(pEngine,pPage,iIdx);
+}
+/*
+ * Unlink an empty leaf page from the chain of leaves.
+ */
+static int btLeafUnlink(bt_kv_engine *pEngine,const bt_page_hdr *pHdr)
+{
+	unqlite_page *pPage;
+	int rc;
+	if( pHdr->iLeft > 0 ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pHdr->iLeft,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pPage);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianPack64(&pPage->zData[12],pHdr->iRight);
+		}
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( pHdr->iRight > 0 ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pHdr->iRight,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pPage);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianPack64(&pPage->zData[20],pHdr->iLeft);
+		}
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Reduce the height of the tree while the root page has a single child.
+ */
+static int btRootShrink(bt_kv_engine *pEngine)
+{
+	unqlite_page *pRoot,*pChild;
+	bt_page_hdr sHdr;
+	int rc;
+	for(;;){
+		rc = btLoadPage(pEngine,pEngine->iRoot,&pRoot,&sHdr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( sHdr.iType == BT_PAGE_LEAF || sHdr.nCell > 0 ){
+			pEngine->pIo->xPageUnref(pRoot);
+			return UNQLITE_OK;
+		}
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,sHdr.iRight,&pChild);
+		if( rc == UNQLITE_OK ){
+			rc = pEngine->pIo->xWrite(pRoot);
+			if( rc == UNQLITE_OK ){
+				/* The only child (and the only leaf when it is a leaf) replace the root */
+				SyMemcpy((const void *)pChild->zData,(void *)pRoot->zData,pEngine->iPageSize);
+				rc = btFreePage(pEngine,pChild);
+			}
+			pEngine->pIo->xPageUnref(pChild);
+		}
+		pEngine->pIo->xPageUnref(pRoot);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+}
+/*
+ * Remove the cell at the leaf level of the current path and release
+ * the pages that become empty.
+ */
+static int btDeleteCell(bt_kv_engine *pEngine)
+{
+	bt_path *pPath = &pEngine->sPath;
+	int iLevel = pPath->nDepth;
+	unqlite_page *pPage;
+	bt_page_hdr sHdr;
+	bt_cell sCell;
+	int bEmpty;
+	int rc;
+	rc = btLoadPage(pEngine,pPath->aPage[iLevel],&pPage,&sHdr);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = btPageCell(pEngine,pPage->zData,pPath->aIdx[iLevel],&sCell);
+	if( rc == UNQLITE_OK ){
+		rc = btFreeOverflow(pEngine,sCell.iOvfl);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = btPageDropCell(pEngine,pPage,pPath->aIdx[iLevel]);
+	}
+	btReadPageHdr(pPage->zData,&sHdr);
+	bEmpty = sHdr.nCell < 1;
+	if( rc == UNQLITE_OK && bEmpty && iLevel > 0 ){
+		/* Release the empty leaf */
+		rc = btLeafUnlink(pEngine,&sHdr);
+		if( rc == UNQLITE_OK ){
+			rc = btFreePage(pEngine,pPage);
+		}
+	}
+	pEngine->pIo->xPageUnref(pPage);
+	while( rc == UNQLITE_OK && bEmpty && iLevel > 0 ){
+		/* Drop the pointer to the released page */
+		iLevel--;
+		rc = btLoadPage(pEngine,pPath->aPage[iLevel],&pPage,&sHdr);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		rc = btNodeDropChild(pEngine,pPage,pPath->aIdx[iLevel],&bEmpty);
+		if( rc == UNQLITE_OK && bEmpty ){
+			if( iLevel > 0 ){
+				rc = btFreePage(pEngine,pPage);
+			}else{
+				/* The tree is empty */
+				rc = pEngine->pIo->xWrite(pPage);
+				if( rc == UNQLITE_OK ){
+					btPageInit(pEngine,pPage->zData,BT_PAGE_LEAF);
+				}
+			}
+		}
+		pEngine->pIo->xPageUnref(pPage);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = btRootShrink(pEngine);
+	}
+	return rc;
+}
+/*
+ * Store a record, overwriting any existing record with the same key.
+ */
+static int btRecordStore(bt_kv_engine *pEngine,const void *pKey,sxu32 nKey,const void *pData,sxu64 nData)
+{
+	bt_path *pPath = &pEngine->sPath;
+	int bExact;
+	sxu32 nCell;
+	int rc;
+	rc = btDescend(pEngine,pKey,nKey,&bExact);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pEngine->iGen++;
+	if( bExact ){
+		/* Overwrite: Remove the old cell first. It is never the last cell of a non-root leaf
+		 * page here since it is replaced immediately, so the path remains valid.
+		 */
+		unqlite_page *pPage;
+		bt_page_hdr sHdr;
+		bt_cell sCell;
+		rc = btLoadPage(pEngine,pPath->aPage[pPath->nDepth],&pPage,&sHdr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = btPageCell(pEngine,pPage->zData,pPath->aIdx[pPath->nDepth],&sCell);
+		if( rc == UNQLITE_OK ){
+			rc = btFreeOverflow(pEngine,sCell.iOvfl);
+		}
+		if( rc == UNQLITE_OK ){
+			rc = btPageDropCell(pEngine,pPage,pPath->aIdx[pPath->nDepth]);
+		}
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	rc = btBuildCell(pEngine,1,0,pKey,nKey,pData,nData,pEngine->zCell,&nCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return btInsertCell(pEngine,pEngine->zCell,nCell);
+}
+/*
+ * Exported: xReplace() method.
+ */
+static int bt_kv_replace(
+	unqlite_kv_engine *pKv,
+	const void *pKey,int nKeyLen,
+	const void *pData,unqlite_int64 nDataLen
+	)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pKv;
+	int rc;
+	rc = btLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return btRecordStore(pEngine,pKey,(sxu32)nKeyLen,pData,(sxu64)nDataLen);
+}
+/*
+ * Exported: xAppend() method.
+ */
+static int bt_kv_append(
+	unqlite_kv_engine *pKv,
+	const void *pKey,int nKeyLen,
+	const void *pData,unqlite_int64 nDataLen
+	)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pKv;
+	bt_path *pPath = &pEngine->sPath;
+	unqlite_page *pPage;
+	bt_page_hdr sHdr;
+	bt_cell sCell;
+	int bExact;
+	int rc;
+	rc = btLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = btDescend(pEngine,pKey,(sxu32)nKeyLen,&bExact);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( !bExact ){
+		/* New record */
+		return btRecordStore(pEngine,pKey,(sxu32)nKeyLen,pData,(sxu64)nDataLen);
+	}
+	/* Load the old data */
+	rc = btLoadPage(pEngine,pPath->aPage[pPath->nDepth],&pPage,&sHdr);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBlobReset(&pEngine->sWorker);
+	rc = btPageCell(pEngine,pPage->zData,pPath->aIdx[pPath->nDepth],&sCell);
+	if( rc == UNQLITE_OK ){
+		rc = btPayloadAccess(pEngine,pPage,&sCell,sCell.nKey,sCell.nData,unqliteDataConsumer,&pEngine->sWorker,0);
+	}
+	pEngine->pIo->xPageUnref(pPage);
+	if( rc == UNQLITE_OK ){
+		rc = SyBlobAppend(&pEngine->sWorker,pData,(sxu32)nDataLen);
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return btRecordStore(pEngine,pKey,(sxu32)nKeyLen,SyBlobData(&pEngine->sWorker),SyBlobLength(&pEngine->sWorker));
+}
+/*
+ * Allocate the working buffers once the page size is known.
+ */
+static int btAllocBuffers(bt_kv_engine *pEngine,sxu32 iPageSize)
+{
+	sxu32 nMaxCell;
+	if( pEngine->zTmp && pEngine->iPageSize == iPageSize ){
+		return UNQLITE_OK;
+	}
+	if( pEngine->zTmp ){
+		SyMemBackendFree(&pEngine->sAllocator,pEngine->zTmp);
+		SyMemBackendFree(&pEngine->sAllocator,(void *)pEngine->apCell);
+		pEngine->zTmp = 0;
+	}
+	pEngine->iPageSize = iPageSize;
+	/* At least four cells per page */
+	pEngine->nMaxLocal = (iPageSize - BT_PAGE_HDR_SZ) / 4 - 2 - BT_CELL_HDR_SZ - 8;
+	pEngine->nMinLocal = pEngine->nMaxLocal / 4;
+	/* Maximum number of cells in a page plus the one being inserted */
+	nMaxCell = (iPageSize - BT_PAGE_HDR_SZ) / (BT_CELL_HDR_SZ + 2) + 2;
+	pEngine->zTmp = (unsigned char *)SyMemBackendAlloc(&pEngine->sAllocator,iPageSize * 3);
+	pEngine->apCell = (const unsigned char **)SyMemBackendAlloc(&pEngine->sAllocator,nMaxCell * (sizeof(unsigned char *) + sizeof(sxu32)));
+	if( pEngine->zTmp == 0 || pEngine->apCell == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	pEngine->anCell = (sxu32 *)&pEngine->apCell[nMaxCell];
+	pEngine->zCell = &pEngine->zTmp[iPageSize];
+	pEngine->zSep = &pEngine->zTmp[iPageSize * 2];
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xInit() method.
+ */
+static int bt_kv_init(unqlite_kv_engine *pKv,int iPageSize)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pKv;
+	/* This structure is always zeroed, go to the initialization directly */
+	SyMemBackendInitFromParent(&pEngine->sAllocator,unqliteKvIoMemBackend(pKv->pIo));
+	pEngine->xCmp = SyMemcmp;
+	pEngine->iGen = 1;
+	SyBlobInit(&pEngine->sKey,&pEngine->sAllocator);
+	SyBlobInit(&pEngine->sKey2,&pEngine->sAllocator);
+	SyBlobInit(&pEngine->sWorker,&pEngine->sAllocator);
+	return btAllocBuffers(pEngine,(sxu32)iPageSize);
+}
+/*
+ * Exported: xRelease() method.
+ */
+static void bt_kv_release(unqlite_kv_engine *pKv)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pKv;
+	/* Release the private memory backend */
+	SyMemBackendRelease(&pEngine->sAllocator);
+}
+/*
+ * Exported: xOpen() method.
+ */
+static int bt_kv_open(unqlite_kv_engine *pKv,pgno dbSize)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pKv;
+	unqlite_page *pHeader,*pRoot;
+	sxu32 nMagic;
+	int rc;
+	rc = btAllocBuffers(pEngine,(sxu32)pEngine->pIo->xPageSize(pEngine->pIo->pHandle));
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( dbSize < 1 ){
+		/* A new database, write the header and the (empty) root page */
+		rc = pEngine->pIo->xNew(pEngine->pIo->pHandle,&pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pHeader);
+		if( rc == UNQLITE_OK ){
+			rc = pEngine->pIo->xNew(pEngine->pIo->pHandle,&pRoot);
+			if( rc == UNQLITE_OK ){
+				rc = pEngine->pIo->xWrite(pRoot);
+				if( rc == UNQLITE_OK ){
+					btPageInit(pEngine,pRoot->zData,BT_PAGE_LEAF);
+					SyBigEndianPack32(pHeader->zData,BT_MAGIC);
+					SyBigEndianPack64(&pHeader->zData[BT_HDR_ROOT_OFFT],pRoot->pgno);
+					SyBigEndianPack64(&pHeader->zData[BT_HDR_FREE_OFFT],0);
+				}
+				pEngine->pIo->xPageUnref(pRoot);
+			}
+		}
+		pEngine->pIo->xPageUnref(pHeader);
+	}else{
+		/* Check the header */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack32(pHeader->zData,&nMagic);
+		pEngine->pIo->xPageUnref(pHeader);
+		if( nMagic != BT_MAGIC ){
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Not a B+tree database");
+			rc = UNQLITE_CORRUPT;
+		}
+	}
+	if( rc == UNQLITE_OK ){
+		pEngine->bOpen = 1;
+	}
+	return rc;
+}
+/*
+ * Exported: xConfig() method.
+ */
+static int bt_kv_config(unqlite_kv_engine *pKv,int iOp,va_list ap)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pKv;
+	int rc = UNQLITE_OK;
+	switch(iOp){
+	case UNQLITE_KV_CONFIG_CMP_FUNC: {
+		/* Key comparison function */
+		ProcCmp xCmp = va_arg(ap,ProcCmp);
+		unqlite_page *pRoot;
+		bt_page_hdr sHdr;
+		if( pEngine->bOpen ){
+			/* Records are already ordered using the current function */
+			rc = btLoadHeader(pEngine);
+			if( rc == UNQLITE_OK ){
+				rc = btLoadPage(pEngine,pEngine->iRoot,&pRoot,&sHdr);
+			}
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			pEngine->pIo->xPageUnref(pRoot);
+			if( sHdr.nCell > 0 || sHdr.iType != BT_PAGE_LEAF ){
+				rc = UNQLITE_LOCKED;
+				break;
+			}
+		}
+		if( xCmp ){
+			pEngine->xCmp = xCmp;
+		}
+		break;
+									 }
+	default:
+		/* Unknown configuration option */
+		rc = UNQLITE_UNKNOWN;
+		break;
+	}
+	return rc;
+}
+/*
+ * Exported: xCursorInit() method.
+ */
+static void btCursorInit(unqlite_kv_cursor *pCursor)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	/* Use the global allocator since the engine memory is released on rollback */
+	SyBlobInit(&pCur->sKey,(SyMemBackend *)unqliteExportMemBackend());
+	pCur->iLeaf = 0;
+}
+/*
+ * Exported: xCursorRelease() method.
+ */
+static void btCursorRelease(unqlite_kv_cursor *pCursor)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	SyBlobRelease(&pCur->sKey);
+}
+/*
+ * Exported: xReset() method.
+ */
+static void btCursorReset(unqlite_kv_cursor *pCursor)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	pCur->iLeaf = 0;
+	SyBlobReset(&pCur->sKey);
+}
+/*
+ * Point the cursor to the given cell of a leaf page and record its key.
+ */
+static int btCursorSet(bt_kv_cursor *pCur,pgno iLeaf,sxu32 iCell)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	const unsigned char *zKey;
+	unqlite_page *pPage;
+	bt_page_hdr sHdr;
+	bt_cell sCell;
+	int rc;
+	pCur->iLeaf = 0;
+	rc = btLoadPage(pEngine,iLeaf,&pPage,&sHdr);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( sHdr.iType != BT_PAGE_LEAF || iCell >= sHdr.nCell ){
+		pEngine->pIo->xPageUnref(pPage);
+		return UNQLITE_CORRUPT;
+	}
+	rc = btPageCell(pEngine,pPage->zData,iCell,&sCell);
+	if( rc == UNQLITE_OK ){
+		rc = btCellKey(pEngine,&sCell,&pEngine->sKey,&zKey);
+	}
+	if( rc == UNQLITE_OK ){
+		SyBlobReset(&pCur->sKey);
+		rc = SyBlobAppend(&pCur->sKey,(const void *)zKey,sCell.nKey);
+	}
+	pEngine->pIo->xPageUnref(pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pCur->iLeaf = iLeaf;
+	pCur->iCell = iCell;
+	pCur->iGen = pEngine->iGen;
+	return UNQLITE_OK;
+}
+/*
+ * Move to the cell following (iDir > 0) or preceding (iDir < 0) the given one
+ * following the chain of leaves.
+ */
+static int btCursorStep(bt_kv_cursor *pCur,pgno iLeaf,sxi64 iCell,int iDir)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	unqlite_page *pPage;
+	bt_page_hdr sHdr;
+	int rc;
+	iCell += iDir;
+	for(;;){
+		rc = btLoadPage(pEngine,iLeaf,&pPage,&sHdr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->pIo->xPageUnref(pPage);
+		if( iCell >= 0 && iCell < (sxi64)sHdr.nCell ){
+			break;
+		}
+		/* Next or previous leaf */
+		iLeaf = iDir > 0 ? sHdr.iRight : sHdr.iLeft;
+		if( iLeaf < 1 ){
+			pCur->iLeaf = 0;
+			return UNQLITE_DONE;
+		}
+		iCell = -1;
+		if( iDir < 0 ){
+			rc = btLoadPage(pEngine,iLeaf,&pPage,&sHdr);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			pEngine->pIo->xPageUnref(pPage);
+			iCell = (sxi64)sHdr.nCell;
+		}
+		iCell += iDir;
+	}
+	return btCursorSet(pCur,iLeaf,(sxu32)iCell);
+}
+/*
+ * Position the cursor relative to the given key.
+ */
+static int btCursorMoveTo(bt_kv_cursor *pCur,const void *pKey,sxu32 nKey,int iPos)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	bt_path *pPath = &pEngine->sPath;
+	unqlite_page *pPage;
+	bt_page_hdr sHdr;
+	pgno iLeaf;
+	int bExact;
+	sxu32 iIdx;
+	int rc;
+	pCur->iLeaf = 0;
+	rc = btDescend(pEngine,pKey,nKey,&bExact);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	iLeaf = pPath->aPage[pPath->nDepth];
+	iIdx = pPath->aIdx[pPath->nDepth];
+	if( bExact ){
+		return btCursorSet(pCur,iLeaf,iIdx);
+	}
+	switch(iPos){
+	case UNQLITE_CURSOR_MATCH_GE:
+		/* First entry greater than the key */
+		rc = btLoadPage(pEngine,iLeaf,&pPage,&sHdr);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->pIo->xPageUnref(pPage);
+		if( iIdx < sHdr.nCell ){
+			return btCursorSet(pCur,iLeaf,iIdx);
+		}
+		rc = btCursorStep(pCur,iLeaf,(sxi64)iIdx - 1,1);
+		break;
+	case UNQLITE_CURSOR_MATCH_LE:
+		/* Last entry less than the key */
+		rc = btCursorStep(pCur,iLeaf,(sxi64)iIdx,-1);
+		break;
+	default:
+		rc = UNQLITE_NOTFOUND;
+		break;
+	}
+	if( rc == UNQLITE_DONE ){
+		rc = UNQLITE_NOTFOUND;
+	}
+	return rc;
+}
+/*
+ * Make sure the cursor still point to its recorded key after the tree was modified.
+ * *pExact is cleared when the recorded key is no longer in the tree in which case
+ * the cursor point to the entry that follow (iDir > 0) or precede (iDir < 0) the old key.
+ */
+static int btCursorRestore(bt_kv_cursor *pCur,int iDir,int *pExact)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	int rc;
+	*pExact = 1;
+	if( pCur->iLeaf < 1 ){
+		return UNQLITE_INVALID;
+	}
+	if( pCur->iGen == pEngine->iGen ){
+		return UNQLITE_OK;
+	}
+	rc = btLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* The key buffer is overwritten on success, work on a copy */
+	SyBlobReset(&pEngine->sWorker);
+	SyBlobDup(&pCur->sKey,&pEngine->sWorker);
+	rc = btCursorMoveTo(pCur,SyBlobData(&pEngine->sWorker),SyBlobLength(&pEngine->sWorker),
+		iDir < 0 ? UNQLITE_CURSOR_MATCH_LE : UNQLITE_CURSOR_MATCH_GE);
+	if( rc != UNQLITE_OK ){
+		pCur->iLeaf = 0;
+		return rc == UNQLITE_NOTFOUND ? UNQLITE_DONE : rc;
+	}
+	*pExact = SyBlobLength(&pCur->sKey) == SyBlobLength(&pEngine->sWorker) &&
+		SyMemcmp(SyBlobData(&pCur->sKey),SyBlobData(&pEngine->sWorker),SyBlobLength(&pCur->sKey)) == 0;
+	return UNQLITE_OK;
+}
+/*
+ * Load the cell the cursor point to.
+ * The page is referenced on success and must be released by the caller.
+ */
+static int btCursorCell(bt_kv_cursor *pCur,unqlite_page **ppPage,bt_cell *pCell)
+{
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	bt_page_hdr sHdr;
+	int bExact;
+	int rc;
+	rc = btCursorRestore(pCur,1,&bExact);
+	if( rc != UNQLITE_OK || !bExact ){
+		/* The entry was removed */
+		return rc == UNQLITE_OK ? UNQLITE_INVALID : rc;
+	}
+	rc = btLoadPage(pEngine,pCur->iLeaf,ppPage,&sHdr);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pCur->iCell >= sHdr.nCell ){
+		rc = UNQLITE_CORRUPT;
+	}else{
+		rc = btPageCell(pEngine,(*ppPage)->zData,pCur->iCell,pCell);
+	}
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(*ppPage);
+	}
+	return rc;
+}
+/*
+ * Exported: xSeek() method.
+ */
+static int btCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nByte,int iPos)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	int rc;
+	pCur->iLeaf = 0;
+	rc = btLoadHeader((bt_kv_engine *)pCur->pStore);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return btCursorMoveTo(pCur,pKey,(sxu32)nByte,iPos);
+}
+/*
+ * Exported: xFirst() and xLast() methods.
+ */
+static int btCursorEdge(unqlite_kv_cursor *pCursor,int iEdge)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	pgno iLeaf;
+	sxu32 iCell;
+	int rc;
+	pCur->iLeaf = 0;
+	rc = btLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = btDescendEdge(pEngine,iEdge,&iLeaf,&iCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return btCursorSet(pCur,iLeaf,iCell);
+}
+static int btCursorFirst(unqlite_kv_cursor *pCursor)
+{
+	return btCursorEdge(pCursor,0);
+}
+static int btCursorLast(unqlite_kv_cursor *pCursor)
+{
+	return btCursorEdge(pCursor,1);
+}
+/*
+ * Exported: xValid() method.
+ */
+static int btCursorValid(unqlite_kv_cursor *pCursor)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	return pCur->iLeaf > 0;
+}
+/*
+ * Exported: xNext() method.
+ */
+static int btCursorNext(unqlite_kv_cursor *pCursor)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	int bExact;
+	int rc;
+	rc = btCursorRestore(pCur,1,&bExact);
+	if( rc != UNQLITE_OK || !bExact ){
+		/* Either an error or the cursor already point to the next entry */
+		return rc;
+	}
+	return btCursorStep(pCur,pCur->iLeaf,(sxi64)pCur->iCell,1);
+}
+/*
+ * Exported: xPrev() method.
+ */
+static int btCursorPrev(unqlite_kv_cursor *pCursor)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	int bExact;
+	int rc;
+	rc = btCursorRestore(pCur,-1,&bExact);
+	if( rc != UNQLITE_OK || !bExact ){
+		return rc;
+	}
+	return btCursorStep(pCur,pCur->iLeaf,(sxi64)pCur->iCell,-1);
+}
+/*
+ * Exported: xDelete() method.
+ * The cursor point to the next entry on success.
+ */
+static int btCursorDelete(unqlite_kv_cursor *pCursor)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	int bExact;
+	int rc;
+	rc = btCursorRestore(pCur,1,&bExact);
+	if( rc != UNQLITE_OK || !bExact ){
+		return rc == UNQLITE_OK ? UNQLITE_INVALID : rc;
+	}
+	/* Descend again so that the path is available */
+	rc = btLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = btDescend(pEngine,SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey),&bExact);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( !bExact ){
+		return UNQLITE_CORRUPT;
+	}
+	pEngine->iGen++;
+	rc = btDeleteCell(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Point to the next entry */
+	rc = btCursorRestore(pCur,1,&bExact);
+	return rc == UNQLITE_DONE ? UNQLITE_OK : rc;
+}
+/*
+ * Exported: xKeyLength() method.
+ */
+static int btCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	if( pCur->iLeaf < 1 ){
+		return UNQLITE_INVALID;
+	}
+	*pLen = (int)SyBlobLength(&pCur->sKey);
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xKey() method.
+ */
+static int btCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	int rc;
+	if( pCur->iLeaf < 1 ){
+		return UNQLITE_INVALID;
+	}
+	rc = xConsumer(SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey),pUserData);
+	return rc != UNQLITE_OK ? UNQLITE_ABORT : UNQLITE_OK;
+}
+/*
+ * Exported: xDataLength() method.
+ */
+static int btCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	unqlite_page *pPage;
+	bt_cell sCell;
+	int rc;
+	rc = btCursorCell(pCur,&pPage,&sCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	*pLen = (unqlite_int64)sCell.nData;
+	pEngine->pIo->xPageUnref(pPage);
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xDataRange() method.
+ */
+static int btCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	unqlite_page *pPage;
+	bt_cell sCell;
+	int rc;
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	rc = btCursorCell(pCur,&pPage,&sCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( (sxu64)iOfft >= sCell.nData ){
+		nLen = 0;
+	}else if( (sxu64)nLen > sCell.nData - (sxu64)iOfft ){
+		nLen = (unqlite_int64)(sCell.nData - (sxu64)iOfft);
+	}
+	rc = btPayloadAccess(pEngine,pPage,&sCell,sCell.nKey + (sxu64)iOfft,(sxu64)nLen,xConsumer,pUserData,0);
+	pEngine->pIo->xPageUnref(pPage);
+	return rc;
+}
+/*
+ * Exported: xData() method.
+ */
+static int btCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	return btCursorDataRange(pCursor,0,SXI64_HIGH,xConsumer,pUserData);
+}
+/*
+ * Exported: xWriteRange() method.
+ * The record data is overwritten in place, the range must lie within the existing data.
+ */
+static int btCursorWriteRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	unqlite_page *pPage;
+	bt_cell sCell;
+	int rc;
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	rc = btCursorCell(pCur,&pPage,&sCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( (sxu64)iOfft + (sxu64)nLen > sCell.nData ){
+		rc = UNQLITE_INVALID;
+	}else{
+		rc = btPayloadAccess(pEngine,pPage,&sCell,sCell.nKey + (sxu64)iOfft,(sxu64)nLen,0,0,(const unsigned char *)pData);
+	}
+	pEngine->pIo->xPageUnref(pPage);
+	return rc;
+}
+/*
+ * Exported: xDataRef() method.
+ * A direct pointer is returned only when the data is stored locally in the leaf page.
+ */
+static int btCursorDataRef(unqlite_kv_cursor *pCursor,const void **ppData,unqlite_int64 *pLen,unqlite_page **ppPage)
+{
+	bt_kv_cursor *pCur = (bt_kv_cursor *)pCursor;
+	bt_kv_engine *pEngine = (bt_kv_engine *)pCur->pStore;
+	unqlite_page *pPage;
+	bt_cell sCell;
+	int rc;
+	rc = btCursorCell(pCur,&pPage,&sCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( sCell.iOvfl > 0 ){
+		/* Data stored in overflow pages */
+		pEngine->pIo->xPageUnref(pPage);
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	*ppData = (const void *)&sCell.zLocal[sCell.nKey];
+	*pLen = (unqlite_int64)sCell.nData;
+	*ppPage = pPage;
+	return UNQLITE_OK;
+}
+/*
+ * Export the B+tree storage engine.
+ */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportBtreeKvStorage(void)
+{
+	static const unqlite_kv_methods sBtreeStore = {
+		"btree",                    /* zName */
+		sizeof(bt_kv_engine),       /* szKv */
+		sizeof(bt_kv_cursor),       /* szCursor */
+		4,                          /* iVersion */
+		bt_kv_init,                 /* xInit */
+		bt_kv_release,              /* xRelease */
+		bt_kv_config,               /* xConfig */
+		bt_kv_open,                 /* xOpen */
+		bt_kv_replace,              /* xReplace */
+		bt_kv_append,               /* xAppend */
+		btCursorInit,               /* xCursorInit */
+		btCursorSeek,               /* xSeek */
+		btCursorFirst,              /* xFirst */
+		btCursorLast,               /* xLast */
+		btCursorValid,              /* xValid */
+		btCursorNext,               /* xNext */
+		btCursorPrev,               /* xPrev */
+		btCursorDelete,             /* xDelete */
+		btCursorKeyLength,          /* xKeyLength */
+		btCursorKey,                /* xKey */
+		btCursorDataLength,         /* xDataLength */
+		btCursorData,               /* xData */
+		btCursorReset,              /* xReset */
+		btCursorRelease,            /* xCursorRelease */
+		btCursorDataRef,            /* xDataRef */
+		btCursorDataRange,          /* xDataRange */
+		btCursorWriteRange,         /* xWriteRange */
+		0,                          /* xSync */
+		UNQLITE_KV_ORDERED|UNQLITE_KV_SAVEPOINT, /* iFlags */
+		0,                          /* xFetch */
+		0,                          /* xRemove */
+		0                           /* xRemoveIf */
+	};
+	return &sBtreeStore;
+}
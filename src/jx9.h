@@ -112,6 +112,9 @@ typedef struct jx9 jx9;
 #ifdef UNQLITE_ENABLE_THREADS
 #define JX9_ENABLE_THREADS
 #endif /* UNQLITE_ENABLE_THREADS */
+#ifdef UNQLITE_DISABLE_POOL_CACHE
+#define JX9_DISABLE_POOL_CACHE
+#endif /* UNQLITE_DISABLE_POOL_CACHE */
 /* Standard JX9 return values */
 #define JX9_OK      SXRET_OK      /* Successful result */
 /* beginning-of-error-codes */
@@ -224,12 +224,31 @@ struct SyBlob
 #define SXMEM_BACKEND_CORRUPT(BACKEND)	(BACKEND == 0 || BACKEND->nMagic != SXMEM_BACKEND_MAGIC)
 
 #define SXMEM_BACKEND_RETRY	3
+/*
+ * Thread-safe backends serve pool allocations from per-thread magazine caches
+ * and reader/writer locks track their exclusive owner when the compiler supports
+ * thread-local storage (See jx9_lib.c).
+ */
+#if defined(JX9_ENABLE_THREADS)
+#if defined(_MSC_VER)
+#define SX_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__) || defined(__INTEL_COMPILER) || defined(__SUNPRO_C)
+#define SX_THREAD_LOCAL __thread
+#endif
+#if defined(SX_THREAD_LOCAL) && !defined(JX9_DISABLE_POOL_CACHE)
+#define SXMEM_POOL_CACHE
+#endif
+#endif /* JX9_ENABLE_THREADS */
+#if defined(SXMEM_POOL_CACHE)
+typedef struct SyMemCache SyMemCache;
+#endif
 /* A memory backend subsystem is defined by an instance of the following structures */
 typedef union SyMemHeader SyMemHeader;
 typedef struct SyMemBlock SyMemBlock;
 struct SyMemBlock
 {
 	SyMemBlock *pNext, *pPrev; /* Chain of allocated memory blocks */
+	sxu32 nByte;              /* Block size including this header */
 #ifdef UNTRUST
 	sxu32 nGuard;             /* magic number associated with each valid block, so we
 							   * can detect misuse.
@@ -244,6 +263,27 @@ union SyMemHeader
 	SyMemHeader *pNext; /* Next chunk of size 1 << (nBucket + SXMEM_POOL_INCR) in the list */
 	sxu32 nBucket;      /* Bucket index in aPool[] */
 };
+/*
+ * Memory accounting.
+ * Backends sharing the same account (i.e: All the allocators of a database handle)
+ * have their allocated bytes summed up and capped. Allocations that would exceed
+ * the hard limit fail while the soft limit is only a hint for upper layers to shrink
+ * their caches (See SyMemAccountPressure()).
+ * Pool chunks are charged while in use (Or held by a thread cache) and given back to
+ * the account once released to the shared free lists of the pool.
+ */
+typedef struct SyMemAccount SyMemAccount;
+struct SyMemAccount
+{
+	const SyMutexMethods *pMutexMethods; /* Mutex methods */
+	SyMutex *pMutex;       /* Protect the counters (NULL if not threadsafe) */
+	sxu64 nUsed;           /* Bytes currently allocated */
+	sxu64 nPeak;           /* Highest value of nUsed */
+	sxu64 nSoftLimit;      /* Caches should be shrunk past this limit (0: Unlimited) */
+	sxu64 nHardLimit;      /* Allocations fail past this limit (0: Unlimited) */
+};
+#define SyMemAccountPressure(ACCOUNT) \
+	((ACCOUNT) && (ACCOUNT)->nSoftLimit > 0 && (ACCOUNT)->nUsed >= (ACCOUNT)->nSoftLimit)
 struct SyMemBackend
 {
 	const SyMutexMethods *pMutexMethods; /* Mutex methods */
@@ -255,7 +295,18 @@ struct SyMemBackend
 	SyMutex *pMutex;               /* Per instance mutex */
 	sxu32 nMagic;                  /* Sanity check against misuse */
 	SyMemHeader *apPool[SXMEM_POOL_NBUCKETS+SXMEM_POOL_INCR]; /* Pool of memory chunks */
+	sxu64 nByte;                   /* Total bytes allocated by this backend */
+	sxu64 nPoolFree;               /* Bytes held by the free lists of the pool (Not charged) */
+	SyMemAccount *pAccount;        /* Account charged for the allocated bytes if any */
+#if defined(SXMEM_POOL_CACHE)
+	SyMemCache *pCaches;           /* Per-thread caches attached to this backend */
+#endif
 };
+/*
+ * Reader/writer lock (See jx9_lib.c). Readers share the lock while a writer
+ * hold it exclusively. The exclusive side is recursive.
+ */
+typedef struct SyRWLock SyRWLock;
 /* Mutex types */
 #define SXMUTEX_TYPE_FAST	1
 #define SXMUTEX_TYPE_RECURSIVE	2
@@ -1664,6 +1715,11 @@ JX9_PRIVATE sxi32 SyMemBackendRelease(SyMemBackend *pBackend);
 JX9_PRIVATE sxi32 SyMemBackendInitFromOthers(SyMemBackend *pBackend, const SyMemMethods *pMethods, ProcMemError xMemErr, void *pUserData);
 JX9_PRIVATE sxi32 SyMemBackendInit(SyMemBackend *pBackend, ProcMemError xMemErr, void *pUserData);
 JX9_PRIVATE sxi32 SyMemBackendInitFromParent(SyMemBackend *pBackend,const SyMemBackend *pParent);
+JX9_PRIVATE sxi32 SyMemBackendSetAccount(SyMemBackend *pBackend, SyMemAccount *pAccount);
+JX9_PRIVATE sxi32 SyMemAccountInit(SyMemAccount *pAccount, const SyMutexMethods *pMethods);
+JX9_PRIVATE void SyMemAccountSetLimit(SyMemAccount *pAccount, sxu64 nSoftLimit, sxu64 nHardLimit);
+JX9_PRIVATE void SyMemAccountUsage(SyMemAccount *pAccount, sxu64 *pUsed, sxu64 *pPeak);
+JX9_PRIVATE void SyMemAccountRelease(SyMemAccount *pAccount);
 #if 0
 /* Not used in the current release of the JX9 engine */
 JX9_PRIVATE void *SyMemBackendPoolRealloc(SyMemBackend *pBackend, void *pOld, sxu32 nByte);
@@ -1691,6 +1747,13 @@ JX9_PRIVATE sxu32 SyStrlen(const char *zSrc);
 JX9_PRIVATE const SyMutexMethods *SyMutexExportMethods(void);
 JX9_PRIVATE sxi32 SyMemBackendMakeThreadSafe(SyMemBackend *pBackend, const SyMutexMethods *pMethods);
 JX9_PRIVATE sxi32 SyMemBackendDisbaleMutexing(SyMemBackend *pBackend);
+JX9_PRIVATE SyRWLock * SyRWLockNew(void);
+JX9_PRIVATE void SyRWLockRelease(SyRWLock *pLock);
+JX9_PRIVATE int SyRWLockOwned(SyRWLock *pLock);
+JX9_PRIVATE void SyRWLockShared(SyRWLock *pLock);
+JX9_PRIVATE void SyRWLockSharedLeave(SyRWLock *pLock);
+JX9_PRIVATE void SyRWLockExclusive(SyRWLock *pLock);
+JX9_PRIVATE void SyRWLockExclusiveLeave(SyRWLock *pLock);
 #endif
 JX9_PRIVATE void SyBigEndianPack32(unsigned char *buf,sxu32 nb);
 JX9_PRIVATE void SyBigEndianUnpack32(const unsigned char *buf,sxu32 *uNB);
@@ -52,7 +52,11 @@ static struct Jx9Global_Data
 	jx9 *pEngines;                          /* List of active engine */
 	sxu32 nMagic;                           /* Sanity check against library misuse */
 }sJx9MPGlobal = {
-	{0, 0, 0, 0, 0, 0, 0, 0, {0}}, 
+	{0, 0, 0, 0, 0, 0, 0, 0, {0}, 0, 0, 0
+#if defined(SXMEM_POOL_CACHE)
+	, 0
+#endif
+	}, 
 #if defined(JX9_ENABLE_THREADS)
 	0, 
 	0, 
@@ -378,6 +382,10 @@ static void JX9CoreShutdown(void)
 		pEngine = pNext;
 		sJx9MPGlobal.nEngine--;
 	}
+	if( sJx9MPGlobal.sAllocator.pMethods ){
+		/* Release the memory backend before the mutex subsystem */
+		SyMemBackendRelease(&sJx9MPGlobal.sAllocator);
+	}
 #if defined(JX9_ENABLE_THREADS)
 	/* Release the mutex subsystem */
 	if( sJx9MPGlobal.pMutexMethods ){
@@ -392,10 +400,6 @@ static void JX9CoreShutdown(void)
 	}
 	sJx9MPGlobal.nThreadingLevel = 0;
 #endif
-	if( sJx9MPGlobal.sAllocator.pMethods ){
-		/* Release the memory backend */
-		SyMemBackendRelease(&sJx9MPGlobal.sAllocator);
-	}
 	sJx9MPGlobal.nMagic = 0x1928;	
 }
 /*
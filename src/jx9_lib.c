@@ -90,14 +90,15 @@ static SyMutex * WinMutexNew(int nType)
 			return 0;
 		}
 		InitializeCriticalSection(&pMutex->sMutex);
+		pMutex->nType = nType;
 	}else{
 		/* Use a pre-allocated static mutex */
 		if( nType > SXMUTEX_TYPE_STATIC_6 ){
 			nType = SXMUTEX_TYPE_STATIC_6;
 		}
+		/* Already typed, not written so that threads may share it freely */
 		pMutex = &aStaticMutexes[nType - 3];
 	}
-	pMutex->nType = nType;
 	return pMutex;
 }
 static void WinMutexRelease(SyMutex *pMutex)
@@ -144,6 +145,108 @@ JX9_PRIVATE const SyMutexMethods * SyMutexExportMethods(void)
 {
 	return &sWinMutexMethods;
 }
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600 && defined(SX_THREAD_LOCAL)
+/* Reader/writer lock based on slim reader/writer locks (Windows Vista and later) */
+struct SyRWLock
+{
+	SRWLOCK sLock;
+	sxu32 nDepth;        /* Exclusive recursion depth: Owner thread only */
+	SyRWLock *pNextHeld; /* Next lock held exclusively by the owner thread */
+};
+/* Locks held exclusively by the calling thread */
+static SX_THREAD_LOCAL SyRWLock *pHeldLocks = 0;
+JX9_PRIVATE SyRWLock * SyRWLockNew(void)
+{
+	SyRWLock *pLock;
+	pLock = (SyRWLock *)HeapAlloc(GetProcessHeap(), 0, sizeof(SyRWLock));
+	if( pLock == 0 ){
+		return 0;
+	}
+	InitializeSRWLock(&pLock->sLock);
+	pLock->nDepth = 0;
+	pLock->pNextHeld = 0;
+	return pLock;
+}
+JX9_PRIVATE void SyRWLockRelease(SyRWLock *pLock)
+{
+	HeapFree(GetProcessHeap(), 0, pLock);
+}
+JX9_PRIVATE int SyRWLockOwned(SyRWLock *pLock)
+{
+	SyRWLock *pHeld;
+	/* Only the thread local list is read, never the state of a lock held by another thread */
+	for( pHeld = pHeldLocks ; pHeld ; pHeld = pHeld->pNextHeld ){
+		if( pHeld == pLock ){
+			return 1;
+		}
+	}
+	return 0;
+}
+JX9_PRIVATE void SyRWLockShared(SyRWLock *pLock)
+{
+	AcquireSRWLockShared(&pLock->sLock);
+}
+JX9_PRIVATE void SyRWLockSharedLeave(SyRWLock *pLock)
+{
+	ReleaseSRWLockShared(&pLock->sLock);
+}
+JX9_PRIVATE void SyRWLockExclusive(SyRWLock *pLock)
+{
+	if( SyRWLockOwned(pLock) ){
+		pLock->nDepth++;
+		return;
+	}
+	AcquireSRWLockExclusive(&pLock->sLock);
+	pLock->nDepth = 1;
+	pLock->pNextHeld = pHeldLocks;
+	pHeldLocks = pLock;
+}
+JX9_PRIVATE void SyRWLockExclusiveLeave(SyRWLock *pLock)
+{
+	SyRWLock **ppHeld;
+	if( --pLock->nDepth > 0 ){
+		return;
+	}
+	/* Remove from the thread local list */
+	ppHeld = &pHeldLocks;
+	while( *ppHeld != pLock ){
+		ppHeld = &(*ppHeld)->pNextHeld;
+	}
+	*ppHeld = pLock->pNextHeld;
+	ReleaseSRWLockExclusive(&pLock->sLock);
+}
+#else
+JX9_PRIVATE SyRWLock * SyRWLockNew(void)
+{
+	/* Not supported, callers fall back to their mutex */
+	return 0;
+}
+JX9_PRIVATE void SyRWLockRelease(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE int SyRWLockOwned(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+	return 0;
+}
+JX9_PRIVATE void SyRWLockShared(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockSharedLeave(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockExclusive(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockExclusiveLeave(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+#endif /* _WIN32_WINNT && SX_THREAD_LOCAL */
 #elif defined(__UNIXES__)
 #include <pthread.h>
 struct SyMutex
@@ -178,15 +281,15 @@ static SyMutex * UnixMutexNew(int nType)
 		if(	nType == SXMUTEX_TYPE_RECURSIVE ){
    			pthread_mutexattr_destroy(&sRecursiveAttr);
 		}
+		pMutex->nType = nType;
 	}else{
 		/* Use a pre-allocated static mutex */
 		if( nType > SXMUTEX_TYPE_STATIC_6 ){
 			nType = SXMUTEX_TYPE_STATIC_6;
 		}
+		/* Already typed, not written so that threads may share it freely */
 		pMutex = &aStaticMutexes[nType - 3];
 	}
-  pMutex->nType = nType;
-  
   return pMutex;
 }
 static void UnixMutexRelease(SyMutex *pMutex)
@@ -218,6 +321,112 @@ JX9_PRIVATE const SyMutexMethods * SyMutexExportMethods(void)
 {
 	return &sPthreadMutexMethods;
 }
+#if defined(SX_THREAD_LOCAL)
+/* Reader/writer lock based on pthread rwlocks */
+struct SyRWLock
+{
+	pthread_rwlock_t sLock;
+	sxu32 nDepth;        /* Exclusive recursion depth: Owner thread only */
+	SyRWLock *pNextHeld; /* Next lock held exclusively by the owner thread */
+};
+/* Locks held exclusively by the calling thread */
+static SX_THREAD_LOCAL SyRWLock *pHeldLocks = 0;
+JX9_PRIVATE SyRWLock * SyRWLockNew(void)
+{
+	SyRWLock *pLock;
+	pLock = (SyRWLock *)malloc(sizeof(SyRWLock));
+	if( pLock == 0 ){
+		return 0;
+	}
+	if( pthread_rwlock_init(&pLock->sLock, 0) != 0 ){
+		free(pLock);
+		return 0;
+	}
+	pLock->nDepth = 0;
+	pLock->pNextHeld = 0;
+	return pLock;
+}
+JX9_PRIVATE void SyRWLockRelease(SyRWLock *pLock)
+{
+	pthread_rwlock_destroy(&pLock->sLock);
+	free(pLock);
+}
+JX9_PRIVATE int SyRWLockOwned(SyRWLock *pLock)
+{
+	SyRWLock *pHeld;
+	/* Only the thread local list is read, never the state of a lock held by another thread */
+	for( pHeld = pHeldLocks ; pHeld ; pHeld = pHeld->pNextHeld ){
+		if( pHeld == pLock ){
+			return 1;
+		}
+	}
+	return 0;
+}
+JX9_PRIVATE void SyRWLockShared(SyRWLock *pLock)
+{
+	pthread_rwlock_rdlock(&pLock->sLock);
+}
+JX9_PRIVATE void SyRWLockSharedLeave(SyRWLock *pLock)
+{
+	pthread_rwlock_unlock(&pLock->sLock);
+}
+JX9_PRIVATE void SyRWLockExclusive(SyRWLock *pLock)
+{
+	if( SyRWLockOwned(pLock) ){
+		pLock->nDepth++;
+		return;
+	}
+	pthread_rwlock_wrlock(&pLock->sLock);
+	pLock->nDepth = 1;
+	pLock->pNextHeld = pHeldLocks;
+	pHeldLocks = pLock;
+}
+JX9_PRIVATE void SyRWLockExclusiveLeave(SyRWLock *pLock)
+{
+	SyRWLock **ppHeld;
+	if( --pLock->nDepth > 0 ){
+		return;
+	}
+	/* Remove from the thread local list */
+	ppHeld = &pHeldLocks;
+	while( *ppHeld != pLock ){
+		ppHeld = &(*ppHeld)->pNextHeld;
+	}
+	*ppHeld = pLock->pNextHeld;
+	pthread_rwlock_unlock(&pLock->sLock);
+}
+#else
+JX9_PRIVATE SyRWLock * SyRWLockNew(void)
+{
+	/* Not supported, callers fall back to their mutex */
+	return 0;
+}
+JX9_PRIVATE void SyRWLockRelease(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE int SyRWLockOwned(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+	return 0;
+}
+JX9_PRIVATE void SyRWLockShared(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockSharedLeave(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockExclusive(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockExclusiveLeave(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+#endif /* SX_THREAD_LOCAL */
 #else
 /* Host application must register their own mutex subsystem if the target
  * platform is not an UNIX-like or windows systems.
@@ -258,6 +467,36 @@ JX9_PRIVATE const SyMutexMethods * SyMutexExportMethods(void)
 {
 	return &sDummyMutexMethods;
 }
+JX9_PRIVATE SyRWLock * SyRWLockNew(void)
+{
+	/* Not supported, callers fall back to their mutex */
+	return 0;
+}
+JX9_PRIVATE void SyRWLockRelease(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE int SyRWLockOwned(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+	return 0;
+}
+JX9_PRIVATE void SyRWLockShared(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockSharedLeave(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockExclusive(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
+JX9_PRIVATE void SyRWLockExclusiveLeave(SyRWLock *pLock)
+{
+	SXUNUSED(pLock);
+}
 #endif /* __WINNT__ */
 #endif /* JX9_ENABLE_THREADS */
 static void * SyOSHeapAlloc(sxu32 nByte)
@@ -499,6 +738,34 @@ static const SyMemMethods sOSAllocMethods = {
 	0, 
 	0
 };
+/*
+ * Charge nByte to a memory account. SXERR_LIMIT is returned and nothing
+ * is charged if the hard limit would be exceeded.
+ */
+static sxi32 MemAccountCharge(SyMemAccount *pAccount, sxu64 nByte, int bForce)
+{
+	sxi32 rc = SXRET_OK;
+	SyMutexEnter(pAccount->pMutexMethods, pAccount->pMutex);
+	if( !bForce && pAccount->nHardLimit > 0 && pAccount->nUsed + nByte > pAccount->nHardLimit ){
+		rc = SXERR_LIMIT;
+	}else{
+		pAccount->nUsed += nByte;
+		if( pAccount->nUsed > pAccount->nPeak ){
+			pAccount->nPeak = pAccount->nUsed;
+		}
+	}
+	SyMutexLeave(pAccount->pMutexMethods, pAccount->pMutex);
+	return rc;
+}
+/*
+ * Give nByte back to a memory account.
+ */
+static void MemAccountUncharge(SyMemAccount *pAccount, sxu64 nByte)
+{
+	SyMutexEnter(pAccount->pMutexMethods, pAccount->pMutex);
+	pAccount->nUsed = pAccount->nUsed > nByte ? pAccount->nUsed - nByte : 0;
+	SyMutexLeave(pAccount->pMutexMethods, pAccount->pMutex);
+}
 static void * MemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
 {
 	SyMemBlock *pBlock;
@@ -508,6 +775,10 @@ static void * MemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
 	 * leaks.
 	 */
 	nByte += sizeof(SyMemBlock);
+	if( pBackend->pAccount && MemAccountCharge(pBackend->pAccount, nByte, FALSE) != SXRET_OK ){
+		/* Memory limit reached */
+		return 0;
+	}
 	for(;;){
 		pBlock = (SyMemBlock *)pBackend->pMethods->xAlloc(nByte);
 		if( pBlock != 0 || pBackend->xMemError == 0 || nRetry > SXMEM_BACKEND_RETRY 
@@ -517,15 +788,20 @@ static void * MemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
 		nRetry++;
 	}
 	if( pBlock  == 0 ){
+		if( pBackend->pAccount ){
+			MemAccountUncharge(pBackend->pAccount, nByte);
+		}
 		return 0;
 	}
 	pBlock->pNext = pBlock->pPrev = 0;
+	pBlock->nByte = nByte;
 	/* Link to the list of already tracked blocks */
 	MACRO_LD_PUSH(pBackend->pBlocks, pBlock);
 #if defined(UNTRUST)
 	pBlock->nGuard = SXMEM_BACKEND_MAGIC;
 #endif
 	pBackend->nBlock++;
+	pBackend->nByte += nByte;
 	return (void *)&pBlock[1];
 }
 JX9_PRIVATE void * SyMemBackendAlloc(SyMemBackend *pBackend, sxu32 nByte)
@@ -549,6 +825,7 @@ static void * MemBackendRealloc(SyMemBackend *pBackend, void * pOld, sxu32 nByte
 {
 	SyMemBlock *pBlock, *pNew, *pPrev, *pNext;
 	sxu32 nRetry = 0;
+	sxu32 nOld;
 
 	if( pOld == 0 ){
 		return MemBackendAlloc(&(*pBackend), nByte);
@@ -560,6 +837,11 @@ static void * MemBackendRealloc(SyMemBackend *pBackend, void * pOld, sxu32 nByte
 	}
 #endif
 	nByte += sizeof(SyMemBlock);
+	nOld = pBlock->nByte;
+	if( pBackend->pAccount && nByte > nOld && MemAccountCharge(pBackend->pAccount, nByte - nOld, FALSE) != SXRET_OK ){
+		/* Memory limit reached */
+		return 0;
+	}
 	pPrev = pBlock->pPrev;
 	pNext = pBlock->pNext;
 	for(;;){
@@ -571,8 +853,16 @@ static void * MemBackendRealloc(SyMemBackend *pBackend, void * pOld, sxu32 nByte
 		nRetry++;
 	}
 	if( pNew == 0 ){
+		if( pBackend->pAccount && nByte > nOld ){
+			MemAccountUncharge(pBackend->pAccount, nByte - nOld);
+		}
 		return 0;
 	}
+	if( pBackend->pAccount && nByte < nOld ){
+		MemAccountUncharge(pBackend->pAccount, nOld - nByte);
+	}
+	pNew->nByte = nByte;
+	pBackend->nByte = pBackend->nByte - nOld + nByte;
 	if( pNew != pBlock ){
 		if( pPrev == 0 ){
 			pBackend->pBlocks = pNew;
@@ -623,6 +913,10 @@ static sxi32 MemBackendFree(SyMemBackend *pBackend, void * pChunk)
 #endif
 		MACRO_LD_REMOVE(pBackend->pBlocks, pBlock);
 		pBackend->nBlock--;
+		pBackend->nByte -= pBlock->nByte;
+		if( pBackend->pAccount ){
+			MemAccountUncharge(pBackend->pAccount, pBlock->nByte);
+		}
 		pBackend->pMethods->xFree(pBlock);
 	}
 	return SXRET_OK;
@@ -665,6 +959,10 @@ JX9_PRIVATE sxi32 SyMemBackendMakeThreadSafe(SyMemBackend *pBackend, const SyMut
 	pBackend->pMutexMethods = pMethods;
 	return SXRET_OK;
 }
+#if defined(SXMEM_POOL_CACHE)
+/* Forward declaration */
+static void MemCacheDetachAll(SyMemBackend *pBackend, int bFlush);
+#endif
 JX9_PRIVATE sxi32 SyMemBackendDisbaleMutexing(SyMemBackend *pBackend)
 {
 #if defined(UNTRUST)
@@ -676,6 +974,10 @@ JX9_PRIVATE sxi32 SyMemBackendDisbaleMutexing(SyMemBackend *pBackend)
 		/* There is no mutex subsystem at all */
 		return SXRET_OK;
 	}
+#if defined(SXMEM_POOL_CACHE)
+	/* Give the chunks cached by each thread back to the pool */
+	MemCacheDetachAll(&(*pBackend), TRUE);
+#endif
 	SyMutexRelease(pBackend->pMutexMethods, pBackend->pMutex);
 	pBackend->pMutexMethods = 0;
 	pBackend->pMutex = 0; 
@@ -700,6 +1002,11 @@ static sxi32 MemPoolBucketAlloc(SyMemBackend *pBackend, sxu32 nBucket)
 		return SXERR_MEM;
 	}
 	zBucketEnd = &zBucket[SXMEM_POOL_MAXALLOC];
+	/* The chunks are charged when taken from the free list */
+	pBackend->nPoolFree += SXMEM_POOL_MAXALLOC;
+	if( pBackend->pAccount ){
+		MemAccountUncharge(pBackend->pAccount, SXMEM_POOL_MAXALLOC);
+	}
 	/* Divide the big block into mini bucket pool */
 	nBucketSize = 1 << (nBucket + SXMEM_POOL_INCR);
 	pBackend->apPool[nBucket] = pHeader = (SyMemHeader *)zBucket;
@@ -716,6 +1023,32 @@ static sxi32 MemPoolBucketAlloc(SyMemBackend *pBackend, sxu32 nBucket)
 	
 	return SXRET_OK;
 }
+/*
+ * Charge a chunk of the given bucket taken from the shared free lists.
+ * SXERR_LIMIT is returned if the hard limit of the account would be exceeded.
+ * The backend mutex must be held.
+ */
+static sxi32 MemPoolChargeChunk(SyMemBackend *pBackend, sxu32 nBucket)
+{
+	sxu32 nBucketSize = 1 << (nBucket + SXMEM_POOL_INCR);
+	if( pBackend->pAccount && MemAccountCharge(pBackend->pAccount, nBucketSize, FALSE) != SXRET_OK ){
+		return SXERR_LIMIT;
+	}
+	pBackend->nPoolFree -= nBucketSize;
+	return SXRET_OK;
+}
+/*
+ * Give a chunk of the given bucket returned to the shared free lists back to the account.
+ * The backend mutex must be held.
+ */
+static void MemPoolUnchargeChunk(SyMemBackend *pBackend, sxu32 nBucket)
+{
+	sxu32 nBucketSize = 1 << (nBucket + SXMEM_POOL_INCR);
+	pBackend->nPoolFree += nBucketSize;
+	if( pBackend->pAccount ){
+		MemAccountUncharge(pBackend->pAccount, nBucketSize);
+	}
+}
 static void * MemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 {
 	SyMemHeader *pBucket, *pNext;
@@ -748,6 +1081,10 @@ static void * MemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 		}
 		pBucket = pBackend->apPool[nBucket];
 	}
+	if( MemPoolChargeChunk(&(*pBackend), nBucket) != SXRET_OK ){
+		/* Memory limit reached */
+		return 0;
+	}
 	/* Remove from the free list */
 	pNext = pBucket->pNext;
 	pBackend->apPool[nBucket] = pNext;
@@ -755,6 +1092,252 @@ static void * MemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 	pBucket->nBucket = (SXMEM_POOL_MAGIC << 16) | nBucket;
 	return (void *)&pBucket[1];
 }
+#if defined(SXMEM_POOL_CACHE)
+/*
+ * Per-thread magazine caches.
+ *
+ * Each thread keeps a few caches, one per recently used thread-safe backend, holding a
+ * short free list (Magazine) per pool bucket. Pool allocations and releases are served
+ * from the magazines of the calling thread without taking the backend mutex.
+ * An empty magazine is refilled with half its capacity from the shared pool and a full
+ * one gives half of its chunks back so that chunks released by a thread are rebalanced
+ * to the others.
+ * Caches are linked to the backend they serve so that they can be detached (Dropping the
+ * cached chunks) when the backend is released. Attaching and detaching caches is serialized
+ * by a static mutex and only happens when a thread switches to a backend it has no cache for.
+ * The caches of a thread are allocated from the OS heap on first use. On UNIX they are
+ * detached (Giving the cached chunks back) and freed when the thread exits. Elsewhere the
+ * chunks cached by an exiting thread are lost until the backend is released.
+ */
+#ifndef SXMEM_POOL_CACHE_SLOTS
+#define SXMEM_POOL_CACHE_SLOTS  8      /* Caches per thread (A power of two) */
+#endif
+#ifndef SXMEM_POOL_CACHE_BYTES
+#define SXMEM_POOL_CACHE_BYTES  16384  /* Bytes cached per bucket */
+#endif
+#define SXMEM_POOL_MAGAZINE_MAX 64     /* Chunks cached per bucket */
+#define SXMEM_POOL_CACHE_NBUCKETS (SXMEM_POOL_NBUCKETS+SXMEM_POOL_INCR) /* Same as the shared pool */
+#define SXMEM_POOL_CACHE_MUTEX  SXMUTEX_TYPE_STATIC_6
+struct SyMemCache
+{
+	SyMemBackend *pBackend;                   /* Backend the cached chunks belong to (NULL when detached) */
+	SyMemCache *pNext, *pPrev;                /* Caches attached to the same backend */
+	SyMemHeader *apFree[SXMEM_POOL_CACHE_NBUCKETS]; /* Per-bucket magazines */
+	sxu32 anFree[SXMEM_POOL_CACHE_NBUCKETS];        /* Chunks in each magazine */
+};
+typedef struct SyMemThreadCache SyMemThreadCache;
+struct SyMemThreadCache
+{
+	SyMemCache aCache[SXMEM_POOL_CACHE_SLOTS]; /* Caches of a thread indexed by backend address */
+	const SyMutexMethods *pMutexMethods;       /* Mutex methods of the static cache mutex (Recorded on first attach) */
+};
+static SX_THREAD_LOCAL SyMemThreadCache *pThreadCache = 0;
+/*
+ * Magazine capacity of a given bucket.
+ */
+static sxu32 MemCacheCapacity(sxu32 nBucket)
+{
+	sxu32 nCap = SXMEM_POOL_CACHE_BYTES >> (nBucket + SXMEM_POOL_INCR);
+	if( nCap < 2 ){
+		nCap = 2;
+	}else if( nCap > SXMEM_POOL_MAGAZINE_MAX ){
+		nCap = SXMEM_POOL_MAGAZINE_MAX;
+	}
+	return nCap;
+}
+/*
+ * Give the first nCount chunks of a magazine back to the shared pool.
+ * The backend mutex must be held.
+ */
+static void MemCacheFlush(SyMemCache *pCache, sxu32 nBucket, sxu32 nCount)
+{
+	SyMemBackend *pBackend = pCache->pBackend;
+	SyMemHeader *pHeader;
+	while( nCount > 0 && pCache->apFree[nBucket] ){
+		pHeader = pCache->apFree[nBucket];
+		pCache->apFree[nBucket] = pHeader->pNext;
+		pCache->anFree[nBucket]--;
+		pHeader->pNext = pBackend->apPool[nBucket];
+		pBackend->apPool[nBucket] = pHeader;
+		MemPoolUnchargeChunk(&(*pBackend), nBucket);
+		nCount--;
+	}
+}
+/*
+ * Detach a cache from its backend. The cached chunks are given back to the shared
+ * pool when bFlush is true or dropped otherwise (Backend being released).
+ * The static cache mutex must be held.
+ */
+static void MemCacheDetach(SyMemCache *pCache, int bFlush)
+{
+	SyMemBackend *pBackend = pCache->pBackend;
+	sxu32 n;
+	if( pBackend == 0 ){
+		return;
+	}
+	if( bFlush ){
+		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+		for( n = 0 ; n < SXMEM_POOL_CACHE_NBUCKETS ; ++n ){
+			MemCacheFlush(pCache, n, pCache->anFree[n]);
+		}
+		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+	MACRO_LD_REMOVE(pBackend->pCaches, pCache);
+	pCache->pNext = pCache->pPrev = 0;
+	SyZero(pCache->apFree, sizeof(pCache->apFree));
+	SyZero(pCache->anFree, sizeof(pCache->anFree));
+	pCache->pBackend = 0;
+}
+/*
+ * Detach the caches of all threads from a given backend.
+ */
+static void MemCacheDetachAll(SyMemBackend *pBackend, int bFlush)
+{
+	SyMutex *pMutex;
+	if( pBackend->pCaches == 0 ){
+		/* No thread cache, nothing to do */
+		return;
+	}
+	pMutex = SyMutexNew(pBackend->pMutexMethods, SXMEM_POOL_CACHE_MUTEX);
+	SyMutexEnter(pBackend->pMutexMethods, pMutex);
+	while( pBackend->pCaches ){
+		MemCacheDetach(pBackend->pCaches, bFlush);
+	}
+	SyMutexLeave(pBackend->pMutexMethods, pMutex);
+}
+#if defined(__UNIXES__)
+static pthread_key_t sCacheKey;
+static pthread_once_t sCacheKeyOnce = PTHREAD_ONCE_INIT;
+/*
+ * Thread exit destructor: give the cached chunks back and free the caches.
+ */
+static void MemCacheThreadExit(void *pArg)
+{
+	SyMemThreadCache *pThread = (SyMemThreadCache *)pArg;
+	SyMutex *pMutex;
+	sxu32 n;
+	pMutex = SyMutexNew(pThread->pMutexMethods, SXMEM_POOL_CACHE_MUTEX);
+	SyMutexEnter(pThread->pMutexMethods, pMutex);
+	for( n = 0 ; n < SXMEM_POOL_CACHE_SLOTS ; ++n ){
+		MemCacheDetach(&pThread->aCache[n], TRUE);
+	}
+	SyMutexLeave(pThread->pMutexMethods, pMutex);
+	SyOSHeapFree(pThread);
+}
+static void MemCacheKeyInit(void)
+{
+	pthread_key_create(&sCacheKey, MemCacheThreadExit);
+}
+#endif /* __UNIXES__ */
+/*
+ * Return the cache of the calling thread for a given backend, attaching one if needed.
+ */
+static SyMemCache * MemCacheGet(SyMemBackend *pBackend)
+{
+	SyMemThreadCache *pThread = pThreadCache;
+	SyMemCache *pCache;
+	SyMutex *pMutex;
+	sxuptr iAddr = (sxuptr)pBackend;
+	sxu32 iSlot;
+	iSlot = (sxu32)((iAddr >> 4) ^ (iAddr >> 10)) & (SXMEM_POOL_CACHE_SLOTS - 1);
+	if( pThread ){
+		pCache = &pThread->aCache[iSlot];
+		if( pCache->pBackend == pBackend ){
+			/* Fast path */
+			return pCache;
+		}
+	}
+	if( pThread == 0 ){
+		pThread = (SyMemThreadCache *)SyOSHeapAlloc(sizeof(SyMemThreadCache));
+		if( pThread == 0 ){
+			return 0;
+		}
+		SyZero(pThread, sizeof(SyMemThreadCache));
+#if defined(__UNIXES__)
+		pthread_once(&sCacheKeyOnce, MemCacheKeyInit);
+		pthread_setspecific(sCacheKey, pThread);
+#endif
+		pThreadCache = pThread;
+		pCache = &pThread->aCache[iSlot];
+	}
+	/* All thread-safe backends share the same mutex methods */
+	pThread->pMutexMethods = pBackend->pMutexMethods;
+	pMutex = SyMutexNew(pThread->pMutexMethods, SXMEM_POOL_CACHE_MUTEX);
+	SyMutexEnter(pThread->pMutexMethods, pMutex);
+	/* Give the chunks cached for the previous backend back to its pool */
+	MemCacheDetach(pCache, TRUE);
+	pCache->pBackend = pBackend;
+	MACRO_LD_PUSH(pBackend->pCaches, pCache);
+	SyMutexLeave(pThread->pMutexMethods, pMutex);
+	return pCache;
+}
+/*
+ * Allocate a chunk from the magazine of a given bucket, refilling it from the shared pool if empty.
+ */
+static void * MemCachePoolAlloc(SyMemBackend *pBackend, SyMemCache *pCache, sxu32 nBucket)
+{
+	SyMemHeader *pHeader;
+	if( pCache->apFree[nBucket] == 0 ){
+		sxu32 nCount = MemCacheCapacity(nBucket) >> 1;
+		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+		while( nCount > 0 ){
+			pHeader = pBackend->apPool[nBucket];
+			if( pHeader == 0 ){
+				if( MemPoolBucketAlloc(&(*pBackend), nBucket) != SXRET_OK ){
+					break;
+				}
+				pHeader = pBackend->apPool[nBucket];
+			}
+			if( MemPoolChargeChunk(&(*pBackend), nBucket) != SXRET_OK ){
+				/* Memory limit reached */
+				break;
+			}
+			pBackend->apPool[nBucket] = pHeader->pNext;
+			pHeader->pNext = pCache->apFree[nBucket];
+			pCache->apFree[nBucket] = pHeader;
+			pCache->anFree[nBucket]++;
+			nCount--;
+		}
+		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+		if( pCache->apFree[nBucket] == 0 ){
+			/* Out of memory */
+			return 0;
+		}
+	}
+	/* Remove from the magazine */
+	pHeader = pCache->apFree[nBucket];
+	pCache->apFree[nBucket] = pHeader->pNext;
+	pCache->anFree[nBucket]--;
+	/* Record bucket&magic number */
+	pHeader->nBucket = (SXMEM_POOL_MAGIC << 16) | nBucket;
+	return (void *)&pHeader[1];
+}
+/*
+ * Return a chunk to the magazine of its bucket, rebalancing half of a full magazine to the shared pool.
+ */
+static void MemCachePoolFree(SyMemBackend *pBackend, SyMemCache *pCache, SyMemHeader *pHeader, sxu32 nBucket)
+{
+	sxu32 nCap = MemCacheCapacity(nBucket);
+	if( pCache->anFree[nBucket] >= nCap || SyMemAccountPressure(pBackend->pAccount) ){
+		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+		if( pCache->anFree[nBucket] >= nCap ){
+			MemCacheFlush(pCache, nBucket, nCap >> 1);
+		}else{
+			/* Short of memory, give everything back */
+			MemCacheFlush(pCache, nBucket, pCache->anFree[nBucket]);
+			pHeader->pNext = pBackend->apPool[nBucket];
+			pBackend->apPool[nBucket] = pHeader;
+			MemPoolUnchargeChunk(&(*pBackend), nBucket);
+			SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+			return;
+		}
+		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+	pHeader->pNext = pCache->apFree[nBucket];
+	pCache->apFree[nBucket] = pHeader;
+	pCache->anFree[nBucket]++;
+}
+#endif /* SXMEM_POOL_CACHE */
 JX9_PRIVATE void * SyMemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 {
 	void *pChunk;
@@ -762,6 +1345,22 @@ JX9_PRIVATE void * SyMemBackendPoolAlloc(SyMemBackend *pBackend, sxu32 nByte)
 	if( SXMEM_BACKEND_CORRUPT(pBackend) ){
 		return 0;
 	}
+#endif
+#if defined(SXMEM_POOL_CACHE)
+	if( pBackend->pMutexMethods && nByte + sizeof(SyMemHeader) < SXMEM_POOL_MAXALLOC ){
+		SyMemCache *pCache;
+		/* Serve the request from the calling thread cache */
+		pCache = MemCacheGet(&(*pBackend));
+		if( pCache ){
+			sxu32 nBucketSize = SXMEM_POOL_MINALLOC;
+			sxu32 nBucket = 0;
+			while( nByte + sizeof(SyMemHeader) > nBucketSize ){
+				nBucketSize <<= 1;
+				nBucket++;
+			}
+			return MemCachePoolAlloc(&(*pBackend), pCache, nBucket);
+		}
+	}
 #endif
 	if( pBackend->pMutexMethods ){
 		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
@@ -790,6 +1389,7 @@ static sxi32 MemBackendPoolFree(SyMemBackend *pBackend, void * pChunk)
 		/* Return to the free list */
 		pHeader->pNext = pBackend->apPool[nBucket & 0x0f];
 		pBackend->apPool[nBucket & 0x0f] = pHeader;
+		MemPoolUnchargeChunk(&(*pBackend), nBucket & 0x0f);
 	}
 	return SXRET_OK;
 }
@@ -800,6 +1400,25 @@ JX9_PRIVATE sxi32 SyMemBackendPoolFree(SyMemBackend *pBackend, void * pChunk)
 	if( SXMEM_BACKEND_CORRUPT(pBackend) || pChunk == 0 ){
 		return SXERR_CORRUPT;
 	}
+#endif
+#if defined(SXMEM_POOL_CACHE)
+	if( pBackend->pMutexMethods ){
+		SyMemHeader *pHeader;
+		pHeader = (SyMemHeader *)(((char *)pChunk) - sizeof(SyMemHeader));
+		/* Sanity check to avoid misuse */
+		if( (pHeader->nBucket >> 16) != SXMEM_POOL_MAGIC ){
+			return SXERR_CORRUPT;
+		}
+		if( (pHeader->nBucket & 0xFFFF) != SXU16_HIGH ){
+			SyMemCache *pCache;
+			/* Return the chunk to the calling thread cache */
+			pCache = MemCacheGet(&(*pBackend));
+			if( pCache ){
+				MemCachePoolFree(&(*pBackend), pCache, pHeader, pHeader->nBucket & 0x0f);
+				return SXRET_OK;
+			}
+		}
+	}
 #endif
 	if( pBackend->pMutexMethods ){
 		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
@@ -932,6 +1551,8 @@ JX9_PRIVATE sxi32 SyMemBackendInitFromParent(SyMemBackend *pBackend,const SyMemB
 	pBackend->pMethods  = pParent->pMethods;
 	pBackend->xMemError = pParent->xMemError;
 	pBackend->pUserData = pParent->pUserData;
+	/* Charge the same account */
+	pBackend->pAccount = pParent->pAccount;
 	bInheritMutex = pParent->pMutexMethods ? TRUE : FALSE;
 	if( bInheritMutex ){
 		pBackend->pMutexMethods = pParent->pMutexMethods;
@@ -988,6 +1609,12 @@ static sxi32 MemBackendRelease(SyMemBackend *pBackend)
 	if( pBackend->pMethods->xRelease ){
 		pBackend->pMethods->xRelease(pBackend->pMethods->pUserData);
 	}
+	if( pBackend->pAccount ){
+		MemAccountUncharge(pBackend->pAccount, pBackend->nByte - pBackend->nPoolFree);
+		pBackend->pAccount = 0;
+	}
+	pBackend->nByte = 0;
+	pBackend->nPoolFree = 0;
 	pBackend->pMethods = 0;
 	pBackend->pBlocks  = 0;
 #if defined(UNTRUST)
@@ -1002,6 +1629,12 @@ JX9_PRIVATE sxi32 SyMemBackendRelease(SyMemBackend *pBackend)
 	if( SXMEM_BACKEND_CORRUPT(pBackend) ){
 		return SXERR_INVALID;
 	}
+#endif
+#if defined(SXMEM_POOL_CACHE)
+	if( pBackend->pMutexMethods ){
+		/* Drop the chunks cached by each thread */
+		MemCacheDetachAll(&(*pBackend), FALSE);
+	}
 #endif
 	if( pBackend->pMutexMethods ){
 		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
@@ -1013,6 +1646,84 @@ JX9_PRIVATE sxi32 SyMemBackendRelease(SyMemBackend *pBackend)
 	}
 	return rc;
 }
+/*
+ * Charge the bytes allocated so far and from now on by a given backend to a memory account.
+ * Backends created later from this one (See SyMemBackendInitFromParent()) inherit the account.
+ * A NULL account stop the accounting.
+ */
+JX9_PRIVATE sxi32 SyMemBackendSetAccount(SyMemBackend *pBackend, SyMemAccount *pAccount)
+{
+#if defined(UNTRUST)
+	if( SXMEM_BACKEND_CORRUPT(pBackend) ){
+		return SXERR_CORRUPT;
+	}
+#endif
+	if( pBackend->pMutexMethods ){
+		SyMutexEnter(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+	if( pBackend->pAccount ){
+		MemAccountUncharge(pBackend->pAccount, pBackend->nByte - pBackend->nPoolFree);
+	}
+	pBackend->pAccount = pAccount;
+	if( pAccount ){
+		/* Already allocated bytes are charged regardless of the limit */
+		MemAccountCharge(pAccount, pBackend->nByte - pBackend->nPoolFree, TRUE);
+	}
+	if( pBackend->pMutexMethods ){
+		SyMutexLeave(pBackend->pMutexMethods, pBackend->pMutex);
+	}
+	return SXRET_OK;
+}
+/*
+ * Initialize a memory account. The counters are protected by a private
+ * mutex if mutex methods are given.
+ */
+JX9_PRIVATE sxi32 SyMemAccountInit(SyMemAccount *pAccount, const SyMutexMethods *pMethods)
+{
+	SyZero(&(*pAccount), sizeof(SyMemAccount));
+	if( pMethods ){
+		pAccount->pMutex = SyMutexNew(pMethods, SXMUTEX_TYPE_FAST);
+		if( pAccount->pMutex == 0 ){
+			return SXERR_OS;
+		}
+		pAccount->pMutexMethods = pMethods;
+	}
+	return SXRET_OK;
+}
+/*
+ * Set the soft and hard limits of a memory account (0 for no limit).
+ */
+JX9_PRIVATE void SyMemAccountSetLimit(SyMemAccount *pAccount, sxu64 nSoftLimit, sxu64 nHardLimit)
+{
+	SyMutexEnter(pAccount->pMutexMethods, pAccount->pMutex);
+	pAccount->nSoftLimit = nSoftLimit;
+	pAccount->nHardLimit = nHardLimit;
+	SyMutexLeave(pAccount->pMutexMethods, pAccount->pMutex);
+}
+/*
+ * Current and peak usage of a memory account.
+ */
+JX9_PRIVATE void SyMemAccountUsage(SyMemAccount *pAccount, sxu64 *pUsed, sxu64 *pPeak)
+{
+	SyMutexEnter(pAccount->pMutexMethods, pAccount->pMutex);
+	if( pUsed ){
+		*pUsed = pAccount->nUsed;
+	}
+	if( pPeak ){
+		*pPeak = pAccount->nPeak;
+	}
+	SyMutexLeave(pAccount->pMutexMethods, pAccount->pMutex);
+}
+/*
+ * Release a memory account. Backends charging it must have been released first.
+ */
+JX9_PRIVATE void SyMemAccountRelease(SyMemAccount *pAccount)
+{
+	if( pAccount->pMutex ){
+		SyMutexRelease(pAccount->pMutexMethods, pAccount->pMutex);
+	}
+	SyZero(&(*pAccount), sizeof(SyMemAccount));
+}
 JX9_PRIVATE void * SyMemBackendDup(SyMemBackend *pBackend, const void *pSrc, sxu32 nSize)
 {
 	void *pNew;
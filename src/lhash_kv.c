@@ -23,6 +23,10 @@
  */
 /* Magic number identifying a valid storage image */
 #define L_HASH_MAGIC 0xFA782DCB
+/* Magic number identifying a storage image using the compact cell format */
+#define L_HASH_MAGIC_COMPACT 0xFA782DCC
+/* True if the compact cell format is in use */
+#define L_HASH_IS_COMPACT(ENGINE) ((ENGINE)->nMagic == L_HASH_MAGIC_COMPACT)
 /*
  * Magic word to hash to identify a valid hash function.
  */
@@ -31,10 +35,40 @@
  * Cell size on disk. 
  */
 #define L_HASH_CELL_SZ (4/*Hash*/+4/*Key*/+8/*Data*/+2/* Offset of the next cell */+8/*Overflow*/)
+/*
+ * Compact cell format (Selected at database creation via UNQLITE_KV_CONFIG_CELL_FORMAT).
+ * A cell header is made of the 4 byte hash, the 2 byte offset of the next cell and a
+ * flags byte followed by:
+ *   Local payload: [1 byte shared prefix length] 1 or 2 byte stored key length, 1 or 2 byte data length.
+ *   Overflow payload: 8 byte overflow page number. Key and data length are stored in the
+ *   first overflow page instead.
+ * Each primary page carries a key prefix (the first key stored in the page) in its header
+ * so that local keys sharing that prefix store only their suffix.
+ * A local cell always occupies at least L_HASH_CELL2_OVFL_SZ bytes so that it can be
+ * turned into an overflow cell in place.
+ */
+#define L_HASH_CELL2_FIXED_SZ (4/*Hash*/+2/* Offset of the next cell */+1/* Flags */)
+#define L_HASH_CELL2_OVFL_SZ  (L_HASH_CELL2_FIXED_SZ+8/*Overflow*/)
+#define L_HASH_CELL2_OVFL     0x80 /* Payload stored on overflow pages */
+#define L_HASH_CELL2_SHARED   0x04 /* Shared prefix length present */
+#define L_HASH_CELL2_KEY16    0x02 /* 2 byte stored key length */
+#define L_HASH_CELL2_DATA16   0x01 /* 2 byte data length */
+/* Longest page key prefix */
+#define L_HASH_MAX_PREFIX 64
+/*
+ * Cell header size of an overflow cell and offset of the next cell field.
+ */
+#define L_HASH_OVFL_CELL_SZ(ENGINE) (L_HASH_IS_COMPACT(ENGINE) ? L_HASH_CELL2_OVFL_SZ : L_HASH_CELL_SZ)
+#define L_HASH_CELL_NEXT_OFFT(ENGINE) (L_HASH_IS_COMPACT(ENGINE) ? 4/*Hash*/ : 4/*Hash*/+4/*Key*/+8/*Data*/)
+/*
+ * Header size of the first overflow page of a cell.
+ */
+#define L_HASH_OVFL_HDR_SZ(ENGINE) (8/* Next ovfl page*/+8/* Data page */+2/* Data offset*/+(L_HASH_IS_COMPACT(ENGINE) ? 4/*Key*/+8/*Data*/ : 0))
 /*
  * Primary page (not overflow pages) header size on disk.
  */
 #define L_HASH_PAGE_HDR_SZ (2/* Cell offset*/+2/* Free block offset*/+8/*Slave page number*/)
+#define L_HASH_PAGE_HDR_SIZE(PAGE) (L_HASH_IS_COMPACT((PAGE)->pHash) ? L_HASH_PAGE_HDR_SZ+1/*Prefix length*/+(PAGE)->sHdr.nPrefix : L_HASH_PAGE_HDR_SZ)
 /*
  * The maximum amount of payload (in bytes) that can be stored locally for
  * a database entry.  If the entry contains more data than this, the
@@ -71,9 +105,19 @@ struct lhcell
 	pgno iDataPage;    /* Data page number when overflow */
 	sxu16 iDataOfft;   /* Offset of the data in iDataPage */
 	SyBlob sKey;       /* Record key for fast lookup (Kept in-memory if < 256KB ) */
+	sxu16 nHdr;        /* Cell header size on disk */
+	sxu32 nShared;     /* Key bytes shared with the page prefix (Compact format only) */
+	sxu8 iFlags;       /* Cell flags (Compact format only) */
+	pgno *aDataPage;   /* Overflow data pages index (Built on demand by range operations) */
+	sxu32 nDataPage;   /* aDataPage[] length */
 	lhcell *pNext,*pPrev;         /* Linked list of the loaded memory cells */
 	lhcell *pNextCol,*pPrevCol;   /* Collison chain  */
 };
+/*
+ * Offset of the local key (suffix only in the compact format) and data of a cell.
+ */
+#define L_HASH_CELL_KEY_OFFT(CELL)  ((CELL)->iStart + (CELL)->nHdr)
+#define L_HASH_CELL_DATA_OFFT(CELL) ((CELL)->iStart + (CELL)->nHdr + (CELL)->nKey - (CELL)->nShared)
 /*
 ** Each database page has a header that is an instance of this
 ** structure.
@@ -84,6 +128,7 @@ struct lhphdr
   sxu16 iOfft; /* Offset of the first cell */
   sxu16 iFree; /* Offset of the first free block*/
   pgno iSlave; /* Slave page number */
+  sxu16 nPrefix; /* Key prefix length (Compact format only) */
 };
 /*
  * Each loaded primary disk page is represented in-memory using
@@ -148,6 +193,16 @@ struct lhash_kv_engine
 	pgno max_split_bucket;        /* Maximum split bucket: MUST BE A POWER OF TWO */
 	pgno nmax_split_nucket;       /* Next maximum split bucket (1 << nMsb): In-memory only */
 	sxu32 nMagic;                 /* Magic number to identify a valid linear hash disk database */
+	/* Incremental split */
+	sxu32 nSplitMax;              /* Maximum number of cells transferred per operation (0: Whole bucket) */
+	sxu32 nOpMoved;               /* Cells transferred so far by the current operation */
+	sxu64 nSplit;                 /* Total number of completed splits */
+	sxu64 nSplitStep;             /* Total number of split steps */
+	sxu64 nCellMoved;             /* Total number of transferred cells */
+	sxu32 nMaxStep;               /* Largest number of cells transferred by a single operation */
+	/* Cursor partition (Parallel scan) */
+	sxu32 iScanPart;              /* Partition walked by the cursors */
+	sxu32 nScanPart;              /* Total number of partitions (0 or 1: Whole database) */
 };
 /*
  * Given a logical bucket number, return the record associated with it.
@@ -173,6 +228,40 @@ static lhash_bmap_rec * lhMapFindBucket(lhash_kv_engine *pEngine,pgno iLogic)
 	/* No such record */
 	return 0;
 }
+/*
+ * Return true if a split operation is in progress. That is, the sibling of the
+ * current split bucket was installed but some of its cells are still stored
+ * in the bucket being split.
+ * This state is not stored in the header, it is derived from the bucket map
+ * so it survives a close/reopen cycle.
+ */
+static int lhSplitPending(lhash_kv_engine *pEngine)
+{
+	return lhMapFindBucket(pEngine,pEngine->split_bucket + pEngine->max_split_bucket) != 0;
+}
+/*
+ * Given the hash of a key, return the logical bucket number where it should be stored.
+ * If a split is in progress and the key belongs to the sibling bucket, the bucket
+ * being split (Which may still hold the key) is stored in *pSplit. Otherwise
+ * *pSplit is set to the returned bucket.
+ */
+static pgno lhHashToBucket(lhash_kv_engine *pEngine,sxu32 nHash,pgno *pSplit)
+{
+	pgno iBucket;
+	/* Extract the logical (i.e. not real) page number */
+	iBucket = nHash & (pEngine->nmax_split_nucket - 1);
+	if( iBucket >= (pEngine->split_bucket + pEngine->max_split_bucket) ){
+		/* Low mask */
+		iBucket = nHash & (pEngine->max_split_bucket - 1);
+	}
+	*pSplit = iBucket;
+	if( iBucket == pEngine->split_bucket
+		&& (nHash & (pEngine->nmax_split_nucket - 1)) != iBucket && lhSplitPending(pEngine) ){
+			/* Sibling bucket */
+			iBucket += pEngine->max_split_bucket;
+	}
+	return iBucket;
+}
 /*
  * Install a new bucket map record.
  */
@@ -297,8 +386,200 @@ static lhcell * lhNewCell(lhash_kv_engine *pEngine,lhpage *pPage)
 	/* Fill in the structure */
 	SyBlobInit(&pCell->sKey,&pEngine->sAllocator);
 	pCell->pPage = pPage;
+	pCell->nHdr = L_HASH_OVFL_CELL_SZ(pEngine);
 	return pCell;
 }
+/*
+ * Release the overflow data pages index of a given cell.
+ * This must be done each time the overflow chain of the cell is altered.
+ */
+static void lhCellDropIndex(lhash_kv_engine *pEngine,lhcell *pCell)
+{
+	if( pCell->aDataPage ){
+		SyMemBackendFree(&pEngine->sAllocator,(void *)pCell->aDataPage);
+		pCell->aDataPage = 0;
+		pCell->nDataPage = 0;
+	}
+}
+/*
+ * Compute the on-disk layout of a local cell holding the given key and data
+ * in a given page. Return the total amount of space occupied by the cell.
+ */
+static sxu64 lhCellLocalLayout(
+	lhpage *pPage,     /* Target page */
+	const void *pKey,  /* Cell key */
+	sxu32 nKey,        /* Key length */
+	sxu64 nData,       /* Data length */
+	sxu32 *pShared,    /* OUT: Key bytes shared with the page prefix */
+	sxu8 *pFlags,      /* OUT: Cell flags */
+	sxu16 *pHdr        /* OUT: Cell header size */
+	)
+{
+	const unsigned char *zKey = (const unsigned char *)pKey;
+	const unsigned char *zPrefix;
+	sxu32 nShared,nMax;
+	sxu64 nSize;
+	sxu16 nHdr;
+	sxu8 iFlags;
+	if( !L_HASH_IS_COMPACT(pPage->pHash) ){
+		/* Fixed size header */
+		*pShared = 0;
+		*pFlags = 0;
+		*pHdr = L_HASH_CELL_SZ;
+		return L_HASH_CELL_SZ + nKey + nData;
+	}
+	/* Length of the prefix shared with the page key prefix */
+	zPrefix = &pPage->pRaw->zData[L_HASH_PAGE_HDR_SZ + 1];
+	nMax = pPage->sHdr.nPrefix;
+	if( nMax > nKey ){
+		nMax = nKey;
+	}
+	nShared = 0;
+	while( nShared < nMax && zPrefix[nShared] == zKey[nShared] ){
+		nShared++;
+	}
+	iFlags = 0;
+	nHdr = L_HASH_CELL2_FIXED_SZ + 1/* Key length */ + 1/* Data length */;
+	if( nShared > 0 ){
+		iFlags |= L_HASH_CELL2_SHARED;
+		nHdr++;
+	}
+	if( nKey - nShared > 0xFF ){
+		iFlags |= L_HASH_CELL2_KEY16;
+		nHdr++;
+	}
+	if( nData > 0xFF ){
+		iFlags |= L_HASH_CELL2_DATA16;
+		nHdr++;
+	}
+	nSize = nHdr + (nKey - nShared) + nData;
+	if( nSize < L_HASH_CELL2_OVFL_SZ ){
+		/* Room for an in-place conversion to an overflow cell */
+		nSize = L_HASH_CELL2_OVFL_SZ;
+	}
+	*pShared = nShared;
+	*pFlags = iFlags;
+	*pHdr = nHdr;
+	return nSize;
+}
+/*
+ * Return the total amount of space occupied by a cell in its page.
+ */
+static sxu64 lhCellSize(lhcell *pCell)
+{
+	sxu64 nSize;
+	if( pCell->iOvfl > 0 ){
+		/* Cell header only */
+		return pCell->nHdr;
+	}
+	nSize = pCell->nHdr + (pCell->nKey - pCell->nShared) + pCell->nData;
+	if( L_HASH_IS_COMPACT(pCell->pPage->pHash) && nSize < L_HASH_CELL2_OVFL_SZ ){
+		nSize = L_HASH_CELL2_OVFL_SZ;
+	}
+	return nSize;
+}
+/*
+ * Return the full key of a local cell.
+ */
+static const void * lhCellLocalKey(lhcell *pCell)
+{
+	if( SyBlobLength(&pCell->sKey) == pCell->nKey ){
+		/* In-memory copy */
+		return SyBlobData(&pCell->sKey);
+	}
+	/* Legacy format only: the whole key is stored in the page */
+	return (const void *)&pCell->pPage->pRaw->zData[L_HASH_CELL_KEY_OFFT(pCell)];
+}
+/*
+ * Reflect the data length of a cell on disk.
+ * A writer lock have been acquired on the cell page.
+ */
+static int lhCellWriteDataLen(lhcell *pCell)
+{
+	lhpage *pPage = pCell->pPage;
+	lhash_kv_engine *pEngine = pPage->pHash;
+	unsigned char *zRaw;
+	unqlite_page *pOvfl;
+	int rc;
+	if( !L_HASH_IS_COMPACT(pEngine) ){
+		SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],pCell->nData);
+		return UNQLITE_OK;
+	}
+	if( pCell->iOvfl > 0 ){
+		/* Stored in the first overflow page */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->iOvfl,&pOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pOvfl);
+		if( rc == UNQLITE_OK ){
+			SyBigEndianPack64(&pOvfl->zData[8/*Next ovfl*/+8/*Data page*/+2/*Data offset*/+4/*Key*/],pCell->nData);
+		}
+		pEngine->pIo->xPageUnref(pOvfl);
+		return rc;
+	}
+	/* Local cell: the data length never grows in place so it fits in its old width */
+	zRaw = &pPage->pRaw->zData[pCell->iStart + L_HASH_CELL2_FIXED_SZ];
+	if( pCell->iFlags & L_HASH_CELL2_SHARED ){
+		zRaw++;
+	}
+	zRaw += (pCell->iFlags & L_HASH_CELL2_KEY16) ? 2 : 1;
+	if( pCell->iFlags & L_HASH_CELL2_DATA16 ){
+		SyBigEndianPack16(zRaw,(sxu16)pCell->nData);
+	}else{
+		zRaw[0] = (unsigned char)pCell->nData;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Reflect the overflow page number of a cell on disk.
+ * A writer lock have been acquired on the cell page.
+ */
+static void lhCellWriteOvflHeader(lhcell *pCell)
+{
+	lhpage *pPage = pCell->pPage;
+	unsigned char *zRaw = &pPage->pRaw->zData[pCell->iStart];
+	if( !L_HASH_IS_COMPACT(pPage->pHash) ){
+		SyBigEndianPack64(&zRaw[4/*Hash*/ + 4/*Key*/ + 8/*Data*/ + 2 /*Next cell*/],pCell->iOvfl);
+		return;
+	}
+	/* Turn the cell into an overflow cell */
+	pCell->iFlags = L_HASH_CELL2_OVFL;
+	pCell->nShared = 0;
+	pCell->nHdr = L_HASH_CELL2_OVFL_SZ;
+	zRaw[4/*Hash*/ + 2/*Next cell*/] = pCell->iFlags;
+	SyBigEndianPack64(&zRaw[L_HASH_CELL2_FIXED_SZ],pCell->iOvfl);
+}
+/*
+ * Install the key prefix of an empty page (Compact format only).
+ * The prefix is taken from the first key stored in the page.
+ */
+static int lhPageSetPrefix(lhpage *pPage,const void *pKey,sxu32 nKey)
+{
+	unsigned char *zRaw = pPage->pRaw->zData;
+	sxu16 iFree;
+	int rc;
+	if( nKey > L_HASH_MAX_PREFIX ){
+		nKey = L_HASH_MAX_PREFIX;
+	}
+	/* Acquire a writer lock */
+	rc = pPage->pHash->pIo->xWrite(pPage->pRaw);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Prefix length and contents */
+	pPage->sHdr.nPrefix = (sxu16)nKey;
+	zRaw[L_HASH_PAGE_HDR_SZ] = (unsigned char)nKey;
+	SyMemcpy(pKey,(void *)&zRaw[L_HASH_PAGE_HDR_SZ + 1],nKey);
+	/* The whole page is now a single free block */
+	iFree = (sxu16)L_HASH_PAGE_HDR_SIZE(pPage);
+	pPage->sHdr.iFree = iFree;
+	SyBigEndianPack16(&zRaw[2/* Offset of the first cell */],iFree);
+	SyBigEndianPack16(&zRaw[iFree],0); /* Offset of the next free block */
+	pPage->nFree = (sxu16)(pPage->pHash->iPageSize - iFree);
+	SyBigEndianPack16(&zRaw[iFree + 2],pPage->nFree);
+	return UNQLITE_OK;
+}
 /*
  * Discard a cell from the page table.
  */
@@ -320,6 +601,7 @@ static void lhCellDiscard(lhcell *pCell)
 	}
 	pPage->nCell--;
 	/* Release the cell */
+	lhCellDropIndex(pPage->pHash,pCell);
 	SyBlobRelease(&pCell->sKey);
 	SyMemBackendPoolFree(&pPage->pHash->sAllocator,pCell);
 }
@@ -476,6 +758,80 @@ static lhcell * lhFindCell(
 	/* No such entry */
 	return 0;
 }
+/*
+ * Parse a raw cell header stored in the compact format.
+ */
+static int lhParseCompactCell(lhpage *pPage,const unsigned char *zRaw,const unsigned char *zEnd,lhcell *pCell)
+{
+	lhash_kv_engine *pEngine = pPage->pHash;
+	unqlite_page *pOvfl;
+	sxu32 nSuffix;
+	sxu16 nLen;
+	int rc;
+	/* 4 byte hash number */
+	SyBigEndianUnpack32(zRaw,&pCell->nHash);
+	zRaw += 4;
+	/* 2 byte offset of the next cell */
+	SyBigEndianUnpack16(zRaw,&pCell->iNext);
+	zRaw += 2;
+	/* Perform a sanity check */
+	if( pCell->iNext > 0 && &pPage->pRaw->zData[pCell->iNext] >= zEnd ){
+		return UNQLITE_CORRUPT;
+	}
+	/* Cell flags */
+	pCell->iFlags = zRaw[0];
+	zRaw++;
+	if( pCell->iFlags & L_HASH_CELL2_OVFL ){
+		/* 8 byte overflow page number */
+		SyBigEndianUnpack64(zRaw,&pCell->iOvfl);
+		pCell->nHdr = L_HASH_CELL2_OVFL_SZ;
+		/* Key and data length are stored in the first overflow page */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->iOvfl,&pOvfl);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack32(&pOvfl->zData[8/*Next ovfl*/+8/*Data page*/+2/*Data offset*/],&pCell->nKey);
+		SyBigEndianUnpack64(&pOvfl->zData[8/*Next ovfl*/+8/*Data page*/+2/*Data offset*/+4/*Key*/],&pCell->nData);
+		pEngine->pIo->xPageUnref(pOvfl);
+		return UNQLITE_OK;
+	}
+	pCell->nHdr = L_HASH_CELL2_FIXED_SZ;
+	if( pCell->iFlags & L_HASH_CELL2_SHARED ){
+		/* 1 byte shared prefix length */
+		pCell->nShared = zRaw[0];
+		zRaw++;
+		pCell->nHdr++;
+		if( pCell->nShared > pPage->sHdr.nPrefix ){
+			return UNQLITE_CORRUPT;
+		}
+	}
+	/* Stored key length */
+	if( pCell->iFlags & L_HASH_CELL2_KEY16 ){
+		SyBigEndianUnpack16(zRaw,&nLen);
+		nSuffix = nLen;
+		zRaw += 2;
+		pCell->nHdr += 2;
+	}else{
+		nSuffix = zRaw[0];
+		zRaw++;
+		pCell->nHdr++;
+	}
+	pCell->nKey = pCell->nShared + nSuffix;
+	/* Data length */
+	if( pCell->iFlags & L_HASH_CELL2_DATA16 ){
+		SyBigEndianUnpack16(zRaw,&nLen);
+		pCell->nData = nLen;
+		pCell->nHdr += 2;
+	}else{
+		pCell->nData = zRaw[0];
+		pCell->nHdr++;
+	}
+	if( (sxu64)pCell->iStart + lhCellSize(pCell) > (sxu64)pEngine->iPageSize ){
+		/* Corrupt cell */
+		return UNQLITE_CORRUPT;
+	}
+	return UNQLITE_OK;
+}
 /*
  * Parse a raw cell fetched from disk.
  */
@@ -488,6 +844,19 @@ static int lhParseOneCell(lhpage *pPage,const unsigned char *zRaw,const unsigned
 	int rc;
 	/* Offset this cell is stored */
 	iOfft = (sxu16)(zRaw - (const unsigned char *)pPage->pRaw->zData);
+	if( L_HASH_IS_COMPACT(pPage->pHash) ){
+		pCell = lhNewCell(pPage->pHash,pPage);
+		if( pCell == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		pCell->iStart = iOfft;
+		rc = lhParseCompactCell(pPage,zRaw,zEnd,pCell);
+		if( rc != UNQLITE_OK ){
+			SyMemBackendPoolFree(&pPage->pHash->sAllocator,pCell);
+			return rc;
+		}
+		goto consume_key;
+	}
 	/* 4 byte hash number */
 	SyBigEndianUnpack32(zRaw,&iHash);
 	zRaw += 4;	
@@ -518,6 +887,7 @@ static int lhParseOneCell(lhpage *pPage,const unsigned char *zRaw,const unsigned
 	zRaw += 8;
 	/* Cell offset */
 	pCell->iStart = iOfft;
+consume_key:
 	/* Consume the key */
 	rc = lhConsumeCellkey(pCell,unqliteDataConsumer,&pCell->sKey,pCell->nKey > 262144 /* 256 KB */? 1 : 0);
 	if( rc != UNQLITE_OK ){
@@ -629,6 +999,14 @@ static int lhParsePageHeader(lhpage *pPage)
 	zRaw += 2;
 	/* Slave page number */
 	SyBigEndianUnpack64(zRaw,&pHdr->iSlave);
+	zRaw += 8;
+	if( L_HASH_IS_COMPACT(pPage->pHash) ){
+		/* Key prefix length */
+		pHdr->nPrefix = zRaw[0];
+		if( pHdr->nPrefix > L_HASH_MAX_PREFIX ){
+			return UNQLITE_CORRUPT;
+		}
+	}
 	/* All done */
 	return UNQLITE_OK;
 }
@@ -727,8 +1105,15 @@ static int lhConsumeCellkey(
 	zPayload = &zRaw[pCell->iStart];
 	if( pCell->iOvfl == 0 ){
 		/* Best scenario, consume the key directly without any overflow page */
-		zPayload += L_HASH_CELL_SZ;
-		rc = xConsumer((const void *)zPayload,pCell->nKey,pUserData);
+		zPayload += pCell->nHdr;
+		if( pCell->nShared > 0 ){
+			/* Shared prefix first */
+			rc = xConsumer((const void *)&zRaw[L_HASH_PAGE_HDR_SZ + 1],pCell->nShared,pUserData);
+			if( rc != UNQLITE_OK ){
+				return UNQLITE_ABORT;
+			}
+		}
+		rc = xConsumer((const void *)zPayload,pCell->nKey - pCell->nShared,pUserData);
 		if( rc != UNQLITE_OK ){
 			rc = UNQLITE_ABORT;
 		}
@@ -740,8 +1125,6 @@ static int lhConsumeCellkey(
 		pgno iOvfl;
 		/* Overflow page */
 		iOvfl = pCell->iOvfl;
-		/* Total usable bytes in an overflow page */
-		nByte = L_HASH_OVERFLOW_SIZE(pEngine->iPageSize);
 		for(;;){
 			if( iOvfl == 0 || nData < 1 ){
 				/* no more overflow page */
@@ -759,7 +1142,8 @@ static int lhConsumeCellkey(
 				SyBigEndianUnpack64(zPayload,&pCell->iDataPage);
 				zPayload += 8;
 				SyBigEndianUnpack16(zPayload,&pCell->iDataOfft);
-				zPayload += 2;
+				/* Skip the key and data length (Compact format only) */
+				zPayload = &pOvfl->zData[L_HASH_OVFL_HDR_SZ(pEngine)];
 				if( offt_only ){
 					/* Key too large, grab the data offset and return */
 					pEngine->pIo->xPageUnref(pOvfl);
@@ -767,6 +1151,8 @@ static int lhConsumeCellkey(
 				}
 				data_offset = 1;
 			}
+			/* Total usable bytes in this overflow page */
+			nByte = (sxu32)(&pOvfl->zData[pEngine->iPageSize] - zPayload);
 			/* Consume the key */
 			if( nData <= nByte ){
 				rc = xConsumer((const void *)zPayload,nData,pUserData);
@@ -809,7 +1195,7 @@ static int lhConsumeCellData(
 	zPayload = &zRaw[pCell->iStart];
 	if( pCell->iOvfl == 0 ){
 		/* Best scenario, consume the data directly without any overflow page */
-		zPayload += L_HASH_CELL_SZ + pCell->nKey;
+		zPayload = &zRaw[L_HASH_CELL_DATA_OFFT(pCell)];
 		rc = xConsumer((const void *)zPayload,(sxu32)pCell->nData,pUserData);
 		if( rc != UNQLITE_OK ){
 			rc = UNQLITE_ABORT;
@@ -872,6 +1258,195 @@ static int lhConsumeCellData(
 	}
 	return rc;
 }
+/*
+ * Build the overflow data pages index of a given cell so that range
+ * operations can seek directly to the target page instead of walking
+ * the whole overflow chain.
+ */
+static int lhCellBuildIndex(lhcell *pCell)
+{
+	lhash_kv_engine *pEngine = pCell->pPage->pHash;
+	sxu64 nFirst,nOvfl;
+	unqlite_page *pOvfl;
+	sxu32 n,i;
+	pgno iNext;
+	int rc;
+	if( pCell->aDataPage ){
+		/* Already built */
+		return UNQLITE_OK;
+	}
+	/* Total number of data pages */
+	nFirst = (sxu64)(pEngine->iPageSize - pCell->iDataOfft);
+	nOvfl = L_HASH_OVERFLOW_SIZE(pEngine->iPageSize);
+	n = 1;
+	if( pCell->nData > nFirst ){
+		n += (sxu32)((pCell->nData - nFirst + nOvfl - 1) / nOvfl);
+	}
+	pCell->aDataPage = (pgno *)SyMemBackendAlloc(&pEngine->sAllocator,n * sizeof(pgno));
+	if( pCell->aDataPage == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	pCell->aDataPage[0] = pCell->iDataPage;
+	for( i = 1 ; i < n ; ++i ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->aDataPage[i-1],&pOvfl);
+		if( rc != UNQLITE_OK ){
+			lhCellDropIndex(pEngine,pCell);
+			return rc;
+		}
+		/* Next overflow page in the chain */
+		SyBigEndianUnpack64(pOvfl->zData,&iNext);
+		pEngine->pIo->xPageUnref(pOvfl);
+		if( iNext == 0 ){
+			/* Truncated chain */
+			lhCellDropIndex(pEngine,pCell);
+			return UNQLITE_CORRUPT;
+		}
+		pCell->aDataPage[i] = iNext;
+	}
+	pCell->nDataPage = n;
+	return UNQLITE_OK;
+}
+/*
+ * Locate the data page holding the byte at offset iOfft of the cell data.
+ * Return the page index in the overflow index, the offset of the byte in
+ * that page and the number of data bytes available from that offset.
+ */
+static void lhCellLocate(lhcell *pCell,sxu64 iOfft,sxu32 *pIdx,sxu32 *pOfft,sxu32 *pAvail)
+{
+	int iPageSize = pCell->pPage->pHash->iPageSize;
+	sxu64 nFirst = (sxu64)(iPageSize - pCell->iDataOfft);
+	sxu32 nOvfl = L_HASH_OVERFLOW_SIZE(iPageSize);
+	if( iOfft < nFirst ){
+		*pIdx = 0;
+		*pOfft = pCell->iDataOfft + (sxu32)iOfft;
+		*pAvail = (sxu32)(nFirst - iOfft);
+	}else{
+		iOfft -= nFirst;
+		*pIdx = 1 + (sxu32)(iOfft / nOvfl);
+		*pOfft = 8 + (sxu32)(iOfft % nOvfl);
+		*pAvail = nOvfl - (sxu32)(iOfft % nOvfl);
+	}
+}
+/*
+ * Consume nLen bytes of the cell data starting at offset iOfft.
+ */
+static int lhConsumeCellDataRange(
+	lhcell *pCell,  /* Target cell */
+	sxu64 iOfft,    /* Data offset */
+	sxu64 nLen,     /* Number of bytes to consume */
+	int (*xConsumer)(const void *,unsigned int,void *), /* Data consumer callback */
+	void *pUserData /* Last argument to xConsumer() */
+	)
+{
+	lhpage *pPage = pCell->pPage;
+	lhash_kv_engine *pEngine = pPage->pHash;
+	sxu32 iIdx,iPos,nByte;
+	unqlite_page *pOvfl;
+	int rc;
+	if( iOfft >= pCell->nData ){
+		/* Nothing to consume */
+		return UNQLITE_OK;
+	}
+	if( nLen > pCell->nData - iOfft ){
+		nLen = pCell->nData - iOfft;
+	}
+	if( pCell->iOvfl == 0 ){
+		/* Local payload */
+		rc = xConsumer((const void *)&pPage->pRaw->zData[L_HASH_CELL_DATA_OFFT(pCell) + iOfft],(sxu32)nLen,pUserData);
+		return rc != UNQLITE_OK ? UNQLITE_ABORT : UNQLITE_OK;
+	}
+	/* Build the overflow index if not yet done */
+	rc = lhCellBuildIndex(pCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	while( nLen > 0 ){
+		lhCellLocate(pCell,iOfft,&iIdx,&iPos,&nByte);
+		if( iIdx >= pCell->nDataPage ){
+			return UNQLITE_CORRUPT;
+		}
+		if( (sxu64)nByte > nLen ){
+			nByte = (sxu32)nLen;
+		}
+		if( nByte > 0 ){
+			rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->aDataPage[iIdx],&pOvfl);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			rc = xConsumer((const void *)&pOvfl->zData[iPos],nByte,pUserData);
+			pEngine->pIo->xPageUnref(pOvfl);
+			if( rc != UNQLITE_OK ){
+				return UNQLITE_ABORT;
+			}
+		}
+		iOfft += nByte;
+		nLen -= nByte;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Overwrite nLen bytes of the cell data starting at offset iOfft.
+ * The data length is unchanged so that the overflow chain is left intact.
+ */
+static int lhCellWriteDataRange(
+	lhcell *pCell,     /* Target cell */
+	sxu64 iOfft,       /* Data offset */
+	const void *pData, /* New content */
+	sxu64 nLen         /* Content length */
+	)
+{
+	lhpage *pPage = pCell->pPage;
+	lhash_kv_engine *pEngine = pPage->pHash;
+	const unsigned char *zIn = (const unsigned char *)pData;
+	sxu32 iIdx,iPos,nByte;
+	unqlite_page *pOvfl;
+	int rc;
+	if( iOfft > pCell->nData || nLen > pCell->nData - iOfft ){
+		/* Out of range */
+		return UNQLITE_INVALID;
+	}
+	if( pCell->iOvfl == 0 ){
+		/* Local payload */
+		rc = pEngine->pIo->xWrite(pPage->pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyMemcpy(pData,(void *)&pPage->pRaw->zData[L_HASH_CELL_DATA_OFFT(pCell) + iOfft],(sxu32)nLen);
+		return UNQLITE_OK;
+	}
+	/* Build the overflow index if not yet done */
+	rc = lhCellBuildIndex(pCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	while( nLen > 0 ){
+		lhCellLocate(pCell,iOfft,&iIdx,&iPos,&nByte);
+		if( iIdx >= pCell->nDataPage ){
+			return UNQLITE_CORRUPT;
+		}
+		if( (sxu64)nByte > nLen ){
+			nByte = (sxu32)nLen;
+		}
+		if( nByte > 0 ){
+			rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->aDataPage[iIdx],&pOvfl);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			/* Acquire a writer lock on this page */
+			rc = pEngine->pIo->xWrite(pOvfl);
+			if( rc != UNQLITE_OK ){
+				pEngine->pIo->xPageUnref(pOvfl);
+				return rc;
+			}
+			SyMemcpy((const void *)zIn,(void *)&pOvfl->zData[iPos],nByte);
+			pEngine->pIo->xPageUnref(pOvfl);
+		}
+		zIn += nByte;
+		iOfft += nByte;
+		nLen -= nByte;
+	}
+	return UNQLITE_OK;
+}
 /*
  * Read the linear hash header (Page one of the database).
  */
@@ -885,7 +1460,7 @@ static int lhash_read_header(lhash_kv_engine *pEngine,unqlite_page *pHeader)
 	/* 4 byte magic number */
 	SyBigEndianUnpack32(zRaw,&pEngine->nMagic);
 	zRaw += 4;
-	if( pEngine->nMagic != L_HASH_MAGIC ){
+	if( pEngine->nMagic != L_HASH_MAGIC && pEngine->nMagic != L_HASH_MAGIC_COMPACT ){
 		/* Corrupt implementation */
 		return UNQLITE_CORRUPT;
 	}
@@ -963,7 +1538,7 @@ static int lhRecordLookup(
 	lhash_bmap_rec *pRec;
 	lhpage *pPage;
 	lhcell *pCell;
-	pgno iBucket;
+	pgno iBucket,iSplit;
 	sxu32 nHash;
 	int rc;
 	/* Acquire the first page (hash Header) so that everything gets loaded autmatically */
@@ -974,28 +1549,31 @@ static int lhRecordLookup(
 	/* Compute the hash of the key first */
 	nHash = pEngine->xHash(pKey,nByte);
 	/* Extract the logical (i.e. not real) page number */
-	iBucket = nHash & (pEngine->nmax_split_nucket - 1);
-	if( iBucket >= (pEngine->split_bucket + pEngine->max_split_bucket) ){
-		/* Low mask */
-		iBucket = nHash & (pEngine->max_split_bucket - 1);
-	}
-	/* Map the logical bucket number to real page number */
-	pRec = lhMapFindBucket(pEngine,iBucket);
-	if( pRec == 0 ){
-		/* No such entry */
-		return UNQLITE_NOTFOUND;
-	}
-	/* Load the master page and it's slave page in-memory  */
-	rc = lhLoadPage(pEngine,pRec->iReal,0,&pPage,0);
-	if( rc != UNQLITE_OK ){
-		/* IO error, unlikely scenario */
-		return rc;
-	}
-	/* Lookup for the cell */
-	pCell = lhFindCell(pPage,pKey,nByte,nHash);
-	if( pCell == 0 ){
-		/* No such entry */
-		return UNQLITE_NOTFOUND;
+	iBucket = lhHashToBucket(pEngine,nHash,&iSplit);
+	for(;;){
+		/* Map the logical bucket number to real page number */
+		pRec = lhMapFindBucket(pEngine,iBucket);
+		if( pRec == 0 ){
+			/* No such entry */
+			return UNQLITE_NOTFOUND;
+		}
+		/* Load the master page and it's slave page in-memory  */
+		rc = lhLoadPage(pEngine,pRec->iReal,0,&pPage,0);
+		if( rc != UNQLITE_OK ){
+			/* IO error, unlikely scenario */
+			return rc;
+		}
+		/* Lookup for the cell */
+		pCell = lhFindCell(pPage,pKey,nByte,nHash);
+		if( pCell ){
+			break;
+		}
+		if( iBucket == iSplit ){
+			/* No such entry */
+			return UNQLITE_NOTFOUND;
+		}
+		/* Split in progress, the cell may not have been transferred yet */
+		iBucket = iSplit;
 	}
 	if( ppCell ){
 		*ppCell = pCell;
@@ -1129,15 +1707,18 @@ static int lhMapWriteRecord(lhash_kv_engine *pEngine,pgno iLogic,pgno iReal)
 static int lhPageDefragment(lhpage *pPage)
 {
 	lhash_kv_engine *pEngine = pPage->pHash;
-	unsigned char *zTmp,*zPtr,*zEnd,*zPayload;
+	unsigned char *zTmp,*zPtr,*zEnd;
 	lhcell *pCell;
+	sxu32 nSize;
 	/* Get a temporary page from the pager. This opertaion never fail */
 	zTmp = pEngine->pIo->xTmpPage(pEngine->pIo->pHandle);
 	/* Move the target cells to the beginning */
 	pCell = pPage->pMaster->pList;
+	/* Copy the page header (Including the key prefix if any) */
+	SyMemcpy((const void *)pPage->pRaw->zData,zTmp,(sxu32)L_HASH_PAGE_HDR_SIZE(pPage));
 	/* Write the slave page number */
 	SyBigEndianPack64(&zTmp[2/*Offset of the first cell */+2/*Offset of the first free block */],pPage->sHdr.iSlave);
-	zPtr = &zTmp[L_HASH_PAGE_HDR_SZ]; /* Offset to start writing from */
+	zPtr = &zTmp[L_HASH_PAGE_HDR_SIZE(pPage)]; /* Offset to start writing from */
 	zEnd = &zTmp[pEngine->iPageSize];
 	pPage->sHdr.iOfft = 0; /* Offset of the first cell */
 	for(;;){
@@ -1146,36 +1727,15 @@ static int lhPageDefragment(lhpage *pPage)
 			break;
 		}
 		if( pCell->pPage->pRaw->pgno == pPage->pRaw->pgno ){
-			/* Cell payload if locally stored */
-			zPayload = 0;
-			if( pCell->iOvfl == 0 ){
-				zPayload = &pCell->pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ];
-			}
-			/* Move the cell */
+			/* Move the cell with its local payload if any */
+			nSize = (sxu32)lhCellSize(pCell);
+			SyMemcpy((const void *)&pCell->pPage->pRaw->zData[pCell->iStart],zPtr,nSize);
 			pCell->iNext = pPage->sHdr.iOfft;
 			pCell->iStart = (sxu16)(zPtr - zTmp); /* Offset where this cell start */
 			pPage->sHdr.iOfft = pCell->iStart;
-			/* Write the cell header */
-			/* 4 byte hash number */
-			SyBigEndianPack32(zPtr,pCell->nHash);
-			zPtr += 4;
-			/* 4 byte ley length */
-			SyBigEndianPack32(zPtr,pCell->nKey);
-			zPtr += 4;
-			/* 8 byte data length */
-			SyBigEndianPack64(zPtr,pCell->nData);
-			zPtr += 8;
 			/* 2 byte offset of the next cell */
-			SyBigEndianPack16(zPtr,pCell->iNext);
-			zPtr += 2;
-			/* 8 byte overflow page number */
-			SyBigEndianPack64(zPtr,pCell->iOvfl);
-			zPtr += 8;
-			if( zPayload ){
-				/* Local payload */
-				SyMemcpy((const void *)zPayload,zPtr,(sxu32)(pCell->nKey + pCell->nData));
-				zPtr += pCell->nKey + pCell->nData;
-			}
+			SyBigEndianPack16(&zPtr[L_HASH_CELL_NEXT_OFFT(pEngine)],pCell->iNext);
+			zPtr += nSize;
 			if( zPtr >= zEnd ){
 				/* Can't happen */
 				break;
@@ -1308,6 +1868,40 @@ static int lhCellWriteHeader(lhcell *pCell)
 	/* 4 byte hash number */
 	SyBigEndianPack32(zRaw,pCell->nHash);
 	zRaw += 4;
+	if( L_HASH_IS_COMPACT(pPage->pHash) ){
+		/* 2 byte offset of the next cell */
+		pCell->iNext = pPage->sHdr.iOfft;
+		SyBigEndianPack16(zRaw,pCell->iNext);
+		zRaw += 2;
+		if( pCell->iOvfl > 0 ){
+			/* Flags and 8 byte overflow page number */
+			lhCellWriteOvflHeader(pCell);
+		}else{
+			/* Flags (Computed by lhCellWriteLocalPayload()) */
+			zRaw[0] = pCell->iFlags;
+			zRaw++;
+			if( pCell->iFlags & L_HASH_CELL2_SHARED ){
+				/* 1 byte shared prefix length */
+				zRaw[0] = (unsigned char)pCell->nShared;
+				zRaw++;
+			}
+			/* Stored key length */
+			if( pCell->iFlags & L_HASH_CELL2_KEY16 ){
+				SyBigEndianPack16(zRaw,(sxu16)(pCell->nKey - pCell->nShared));
+				zRaw += 2;
+			}else{
+				zRaw[0] = (unsigned char)(pCell->nKey - pCell->nShared);
+				zRaw++;
+			}
+			/* Data length */
+			if( pCell->iFlags & L_HASH_CELL2_DATA16 ){
+				SyBigEndianPack16(zRaw,(sxu16)pCell->nData);
+			}else{
+				zRaw[0] = (unsigned char)pCell->nData;
+			}
+		}
+		goto link_cell;
+	}
 	/* 4 byte key length */
 	SyBigEndianPack32(zRaw,pCell->nKey);
 	zRaw += 4;
@@ -1320,6 +1914,7 @@ static int lhCellWriteHeader(lhcell *pCell)
 	zRaw += 2;
 	/* 8 byte overflow page number */
 	SyBigEndianPack64(zRaw,pCell->iOvfl);
+link_cell:
 	/* Update the page header */
 	pPage->sHdr.iOfft = pCell->iStart;
 	/* pEngine->pIo->xWrite() has been successfully called on this page */
@@ -1338,11 +1933,13 @@ static int lhCellWriteLocalPayload(lhcell *pCell,
 	/* A writer lock have been acquired on this page */
 	lhpage *pPage = pCell->pPage;
 	unsigned char *zRaw = pPage->pRaw->zData;
+	/* Compute the cell layout (Shared prefix and header size) */
+	lhCellLocalLayout(pPage,pKey,nKeylen,(sxu64)nDatalen,&pCell->nShared,&pCell->iFlags,&pCell->nHdr);
 	/* Seek to the desired location */
-	zRaw += pCell->iStart + L_HASH_CELL_SZ;
-	/* Write the key */
-	SyMemcpy(pKey,(void *)zRaw,nKeylen);
-	zRaw += nKeylen;
+	zRaw += L_HASH_CELL_KEY_OFFT(pCell);
+	/* Write the key (Without the shared prefix) */
+	SyMemcpy((const void *)&((const unsigned char *)pKey)[pCell->nShared],(void *)zRaw,nKeylen - pCell->nShared);
+	zRaw += nKeylen - pCell->nShared;
 	if( nDatalen > 0 ){
 		/* Write the Data */
 		SyMemcpy(pData,(void *)zRaw,(sxu32)nDatalen);
@@ -1359,6 +1956,7 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 	unqlite_page *pOvfl,*pFirst,*pNew;
 	const unsigned char *zPtr,*zEnd;
 	unsigned char *zRaw,*zRawEnd;
+	sxu64 nTotal = 0;
 	sxu32 nAvail;
 	va_list ap;
 	int rc;
@@ -1373,15 +1971,15 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 		return rc;
 	}
 	pFirst = pOvfl;
-	/* Link */
-	pCell->iOvfl = pOvfl->pgno;
-	/* Update the cell header */
-	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4/*Hash*/ + 4/*Key*/ + 8/*Data*/ + 2 /*Next cell*/],pCell->iOvfl);
 	/* Start the write process */
 	zPtr = (const unsigned char *)pKey;
 	zEnd = &zPtr[nKeylen];
 	SyBigEndianPack64(pOvfl->zData,0); /* Next overflow page on the chain */
-	zRaw = &pOvfl->zData[8/* Next ovfl page*/ + 8 /* Data page */ + 2 /* Data offset*/];
+	if( L_HASH_IS_COMPACT(pEngine) ){
+		/* 4 byte key length */
+		SyBigEndianPack32(&pOvfl->zData[8/* Next ovfl page*/ + 8 /* Data page */ + 2 /* Data offset*/],nKeylen);
+	}
+	zRaw = &pOvfl->zData[L_HASH_OVFL_HDR_SZ(pEngine)];
 	zRawEnd = &pOvfl->zData[pEngine->iPageSize];
 	pNew = pOvfl;
 	/* Write the key */
@@ -1472,10 +2070,20 @@ static int lhCellWriteOvflPayload(lhcell *pCell,const void *pKey,sxu32 nKeylen,.
 			zPtr += nDatalen;
 			zRaw += nDatalen;
 		}
+		nTotal += nData;
+	}
+	if( L_HASH_IS_COMPACT(pEngine) ){
+		/* 8 byte data length */
+		SyBigEndianPack64(&pFirst->zData[8/* Next ovfl page*/ + 8 /* Data page */ + 2 /* Data offset*/ + 4 /* Key */],nTotal);
 	}
 	/* Unref the overflow page */
 	pEngine->pIo->xPageUnref(pOvfl);
 	va_end(ap);
+	/* Link and update the cell header. This is done last since the old local
+	 * payload may be one of the chunks written above.
+	 */
+	pCell->iOvfl = pFirst->pgno;
+	lhCellWriteOvflHeader(pCell);
 	return UNQLITE_OK;
 }
 /*
@@ -1530,7 +2138,7 @@ static int lhUnlinkCell(lhcell *pCell)
 {
 	lhash_kv_engine *pEngine = pCell->pPage->pHash;
 	lhpage *pPage = pCell->pPage;
-	sxu16 nByte = L_HASH_CELL_SZ;
+	sxu16 nByte = (sxu16)lhCellSize(pCell);
 	lhcell *pPrev;
 	int rc;
 	rc = pEngine->pIo->xWrite(pPage->pRaw);
@@ -1542,7 +2150,7 @@ static int lhUnlinkCell(lhcell *pCell)
 	if( pPrev ){
 		pPrev->iNext = pCell->iNext;
 		/* Fix offsets in the page header */
-		SyBigEndianPack16(&pPage->pRaw->zData[pPrev->iStart + 4/*Hash*/+4/*Key*/+8/*Data*/],pCell->iNext);
+		SyBigEndianPack16(&pPage->pRaw->zData[pPrev->iStart + L_HASH_CELL_NEXT_OFFT(pEngine)],pCell->iNext);
 	}else{
 		/* First entry on this page (either master or slave) */
 		pPage->sHdr.iOfft = pCell->iNext;
@@ -1550,18 +2158,15 @@ static int lhUnlinkCell(lhcell *pCell)
 		SyBigEndianPack16(pPage->pRaw->zData,pCell->iNext);
 	}
 	/* Restore cell space */
-	if( pCell->iOvfl == 0 ){
-		nByte += (sxu16)(pCell->nData + pCell->nKey);
-	}
 	lhRestoreSpace(pPage,pCell->iStart,nByte);
 	/* Discard the cell from the in-memory hashtable */
 	lhCellDiscard(pCell);
 	return UNQLITE_OK;
 }
 /*
- * Remove a cell and its paylod (key + data).
+ * Restore the overflow pages of a cell to the free list.
  */
-static int lhRecordRemove(lhcell *pCell)
+static int lhCellFreeOvfl(lhcell *pCell)
 {
 	lhash_kv_engine *pEngine = pCell->pPage->pHash;
 	int rc;
@@ -1589,6 +2194,19 @@ static int lhRecordRemove(lhcell *pCell)
 			}
 		}
 	}
+	return UNQLITE_OK;
+}
+/*
+ * Remove a cell and its paylod (key + data).
+ */
+static int lhRecordRemove(lhcell *pCell)
+{
+	int rc;
+	/* Discard overflow pages */
+	rc = lhCellFreeOvfl(pCell);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	/* Unlink the cell */
 	rc = lhUnlinkCell(pCell);
 	return rc;
@@ -1622,13 +2240,13 @@ static int lhMoveLocalCell(
 	unqlite_int64 nData
 	)
 {
-	sxu16 iKeyOfft = pCell->iStart + L_HASH_CELL_SZ;
+	const void *pKey = lhCellLocalKey(pCell);
 	lhpage *pPage = pCell->pPage;
 	lhcell *pSibeling;
 	pSibeling = lhFindSibeling(pCell);
 	if( pSibeling ){
 		/* Fix link */
-		SyBigEndianPack16(&pPage->pRaw->zData[pSibeling->iStart + 4/*Hash*/+4/*Key*/+8/*Data*/],pCell->iNext);
+		SyBigEndianPack16(&pPage->pRaw->zData[pSibeling->iStart + L_HASH_CELL_NEXT_OFFT(pPage->pHash)],pCell->iNext);
 		pSibeling->iNext = pCell->iNext;
 	}else{
 		/* First cell, update page header only */
@@ -1639,7 +2257,7 @@ static int lhMoveLocalCell(
 	pCell->iStart = iOfft;
 	pCell->nData = (sxu64)nData;
 	/* Write the cell payload */
-	lhCellWriteLocalPayload(pCell,(const void *)&pPage->pRaw->zData[iKeyOfft],pCell->nKey,pData,nData);
+	lhCellWriteLocalPayload(pCell,pKey,pCell->nKey,pData,nData);
 	/* Finally write the cell header */
 	lhCellWriteHeader(pCell);
 	/* All done */
@@ -1666,44 +2284,52 @@ static int lhRecordOverwrite(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	/* The overflow chain is about to change */
+	lhCellDropIndex(pEngine,pCell);
 	if( pCell->iOvfl == 0 ){
 		/* Local payload, try to deal with the free space issues */
-		zPayload = &pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey];
+		sxu16 nOld = (sxu16)lhCellSize(pCell);
+		zPayload = &pPage->pRaw->zData[L_HASH_CELL_DATA_OFFT(pCell)];
 		if( pCell->nData == (sxu64)nByte ){
 			/* Best scenario, simply a memcpy operation */
 			SyMemcpy(pData,(void *)zPayload,(sxu32)nByte);
 		}else if( (sxu64)nByte < pCell->nData ){
 			/* Shorter data, not so ugly */
 			SyMemcpy(pData,(void *)zPayload,(sxu32)nByte);
-			/* Update the cell header */
-			SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],nByte);
-			/* Restore freespace */
-			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_SZ + pCell->nKey + nByte),(sxu16)(pCell->nData - nByte));
 			/* New data size */
 			pCell->nData = (sxu64)nByte;
+			/* Update the cell header */
+			lhCellWriteDataLen(pCell);
+			/* Restore freespace */
+			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + lhCellSize(pCell)),(sxu16)(nOld - lhCellSize(pCell)));
 		}else{
+			const void *pKey = lhCellLocalKey(pCell);
 			sxu16 iOfft = 0; /* cc warning */
+			sxu32 nShared;
+			sxu16 nHdr;
+			sxu8 iFlags;
 			/* Check if another chunk is available for this cell */
-			rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ + pCell->nKey + nByte,&iOfft);
+			rc = lhAllocateSpace(pPage,lhCellLocalLayout(pPage,pKey,pCell->nKey,(sxu64)nByte,&nShared,&iFlags,&nHdr),&iOfft);
 			if( rc != UNQLITE_OK ){
+				/* The page may have been defragmented */
+				pKey = lhCellLocalKey(pCell);
 				/* Transfer the payload to an overflow page */
-				rc = lhCellWriteOvflPayload(pCell,&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ],pCell->nKey,pData,nByte,(const void *)0);
+				rc = lhCellWriteOvflPayload(pCell,pKey,pCell->nKey,pData,nByte,(const void *)0);
 				if( rc != UNQLITE_OK ){
 					return rc;
 				}
-				/* Update the cell header */
-				SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],(sxu64)nByte);
-				/* Restore freespace */
-				lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_SZ),(sxu16)(pCell->nKey + pCell->nData));
 				/* New data size */
 				pCell->nData = (sxu64)nByte;
+				/* Update the cell header */
+				lhCellWriteDataLen(pCell);
+				/* Restore freespace */
+				lhRestoreSpace(pPage,(sxu16)(pCell->iStart + pCell->nHdr),(sxu16)(nOld - pCell->nHdr));
 			}else{
 				sxu16 iOldOfft = pCell->iStart;
-				sxu32 iOld = (sxu32)pCell->nData;
 				/* Space is available, transfer the cell */
 				lhMoveLocalCell(pCell,iOfft,pData,nByte);
 				/* Restore cell space */
-				lhRestoreSpace(pPage,iOldOfft,(sxu16)(L_HASH_CELL_SZ + pCell->nKey + iOld));
+				lhRestoreSpace(pPage,iOldOfft,nOld);
 			}
 		}
 		return UNQLITE_OK;
@@ -1785,9 +2411,8 @@ static int lhRecordOverwrite(
 	pEngine->pIo->xPageUnref(pOvfl);
 	/* Finally, update the cell header */
 	pCell->nData = (sxu64)nByte;
-	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],pCell->nData);
-	/* All done */
-	return UNQLITE_OK;
+	rc = lhCellWriteDataLen(pCell);
+	return rc;
 }
 /*
  * Append data to an existing record.
@@ -1816,33 +2441,41 @@ static int lhRecordAppend(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	/* The overflow chain is about to change */
+	lhCellDropIndex(pEngine,pCell);
 	if( pCell->iOvfl == 0 ){
+		const void *pKey = lhCellLocalKey(pCell);
+		sxu16 nOld = (sxu16)lhCellSize(pCell);
 		sxu16 iOfft = 0; /* cc warning */
+		sxu32 nShared;
+		sxu16 nHdr;
+		sxu8 iFlags;
 		/* Local payload, check for a bigger place */
-		rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ + pCell->nKey + pCell->nData + nByte,&iOfft);
+		rc = lhAllocateSpace(pPage,lhCellLocalLayout(pPage,pKey,pCell->nKey,pCell->nData + nByte,&nShared,&iFlags,&nHdr),&iOfft);
 		if( rc != UNQLITE_OK ){
+			/* The page may have been defragmented */
+			pKey = lhCellLocalKey(pCell);
 			/* Transfer the payload to an overflow page */
 			rc = lhCellWriteOvflPayload(pCell,
-				&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ],pCell->nKey,
-				(const void *)&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey],pCell->nData,
+				pKey,pCell->nKey,
+				(const void *)&pPage->pRaw->zData[L_HASH_CELL_DATA_OFFT(pCell)],pCell->nData,
 				pData,nByte,
 				(const void *)0);
 			if( rc != UNQLITE_OK ){
 				return rc;
 			}
-			/* Update the cell header */
-			SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],pCell->nData + nByte);
-			/* Restore freespace */
-			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + L_HASH_CELL_SZ),(sxu16)(pCell->nKey + pCell->nData));
 			/* New data size */
 			pCell->nData += nByte;
+			/* Update the cell header */
+			lhCellWriteDataLen(pCell);
+			/* Restore freespace */
+			lhRestoreSpace(pPage,(sxu16)(pCell->iStart + pCell->nHdr),(sxu16)(nOld - pCell->nHdr));
 		}else{
 			sxu16 iOldOfft = pCell->iStart;
-			sxu32 iOld = (sxu32)pCell->nData;
 			SyBlob sWorker;
 			SyBlobInit(&sWorker,&pEngine->sAllocator);
 			/* Copy the old data */
-			rc = SyBlobAppend(&sWorker,(const void *)&pPage->pRaw->zData[pCell->iStart + L_HASH_CELL_SZ + pCell->nKey],(sxu32)pCell->nData);
+			rc = SyBlobAppend(&sWorker,(const void *)&pPage->pRaw->zData[L_HASH_CELL_DATA_OFFT(pCell)],(sxu32)pCell->nData);
 			if( rc == SXRET_OK ){
 				/* Append the new data */
 				rc = SyBlobAppend(&sWorker,pData,(sxu32)nByte);
@@ -1854,7 +2487,7 @@ static int lhRecordAppend(
 			/* Space is available, transfer the cell */
 			lhMoveLocalCell(pCell,iOfft,SyBlobData(&sWorker),(unqlite_int64)SyBlobLength(&sWorker));
 			/* Restore cell space */
-			lhRestoreSpace(pPage,iOldOfft,(sxu16)(L_HASH_CELL_SZ + pCell->nKey + iOld));
+			lhRestoreSpace(pPage,iOldOfft,nOld);
 			/* All done */
 			SyBlobRelease(&sWorker);
 		}
@@ -1893,7 +2526,7 @@ static int lhRecordAppend(
 			nAvail = L_HASH_OVERFLOW_SIZE(pCell->pPage->pHash->iPageSize);
 			pOvfl = pNew;
 		}
-		if( (sxu64)nAvail > nDatalen ){
+		if( (sxu64)nAvail >= nDatalen ){
 			zRaw += nDatalen;
 			break;
 		}else{
@@ -1946,9 +2579,8 @@ static int lhRecordAppend(
 	pEngine->pIo->xPageUnref(pOvfl);
 	/* Finally, update the cell header */
 	pCell->nData += nByte;
-	SyBigEndianPack64(&pPage->pRaw->zData[pCell->iStart + 4 /* Hash */ + 4 /* Key */],pCell->nData);
-	/* All done */
-	return UNQLITE_OK;
+	rc = lhCellWriteDataLen(pCell);
+	return rc;
 }
 /*
  * A write privilege have been acquired on this page.
@@ -1969,16 +2601,22 @@ static int lhSetEmptyPage(lhpage *pPage)
 	SyBigEndianPack16(zRaw,0);
 	zRaw += 2;
 	/* Offset of the first free block */
-	pHeader->iFree = L_HASH_PAGE_HDR_SZ;
-	SyBigEndianPack16(zRaw,L_HASH_PAGE_HDR_SZ);
+	pHeader->nPrefix = 0;
+	pHeader->iFree = (sxu16)L_HASH_PAGE_HDR_SIZE(pPage);
+	SyBigEndianPack16(zRaw,pHeader->iFree);
 	zRaw += 2;
 	/* Slave page number */
 	SyBigEndianPack64(zRaw,0);
 	zRaw += 8;
+	if( L_HASH_IS_COMPACT(pPage->pHash) ){
+		/* Empty key prefix */
+		zRaw[0] = 0;
+		zRaw++;
+	}
 	/* Fill the free block */
 	SyBigEndianPack16(zRaw,0); /* Offset of the next free block */
 	zRaw += 2;
-	nByte = (sxu16)L_HASH_MX_FREE_SPACE(pPage->pHash->iPageSize);
+	nByte = (sxu16)(pPage->pHash->iPageSize - pHeader->iFree);
 	SyBigEndianPack16(zRaw,nByte);
 	pPage->nFree = nByte;
 	/* Do not add this page to the hot dirty list */
@@ -2008,16 +2646,26 @@ static int lhStoreCell(
 	lhcell *pCell;
 	sxu16 nOfft;
 	int rc;
+	sxu32 nShared;
+	sxu16 nHdr;
+	sxu8 iFlags;
 	/* Acquire a writer lock on this page first */
 	rc = pEngine->pIo->xWrite(pPage->pRaw);
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	if( L_HASH_IS_COMPACT(pEngine) && pPage->sHdr.iOfft < 1 ){
+		/* Empty page, the first key stored becomes the page key prefix */
+		rc = lhPageSetPrefix(pPage,pKey,nKeyLen);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
 	/* Check for a free block  */
-	rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ+nKeyLen+nDataLen,&nOfft);
+	rc = lhAllocateSpace(pPage,lhCellLocalLayout(pPage,pKey,nKeyLen,(sxu64)nDataLen,&nShared,&iFlags,&nHdr),&nOfft);
 	if( rc != UNQLITE_OK ){
 		/* Check for a free block to hold a single cell only (without payload) */
-		rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ,&nOfft);
+		rc = lhAllocateSpace(pPage,L_HASH_OVFL_CELL_SZ(pEngine),&nOfft);
 		if( rc != UNQLITE_OK ){
 			if( !auto_append ){
 				/* A split must be done */
@@ -2081,11 +2729,11 @@ static int lhFindSlavePage(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft,lhpage **ppS
 	/* Look for an already attached slave page */
 	for( i = 0 ; i < pMaster->iSlave ; ++i ){
 		/* Find a free chunk big enough */
-		sxu16 size = L_HASH_CELL_SZ + nAmount;
+		sxu16 size = L_HASH_OVFL_CELL_SZ(pEngine) + nAmount;
 		rc = lhAllocateSpace(pSlave,size,&iOfft);
 		if( rc != UNQLITE_OK ){
 			/* A space for cell header only */
-			size = L_HASH_CELL_SZ;
+			size = L_HASH_OVFL_CELL_SZ(pEngine);
 			rc = lhAllocateSpace(pSlave,size,&iOfft);
 		}
 		if( rc == UNQLITE_OK ){
@@ -2124,9 +2772,9 @@ static int lhFindSlavePage(lhpage *pPage,sxu64 nAmount,sxu16 *pOfft,lhpage **ppS
 	}
 	if( pOfft ){
 		/* Look for a free block */
-		if( UNQLITE_OK != lhAllocateSpace(pNew,L_HASH_CELL_SZ+nAmount,&iOfft) ){
+		if( UNQLITE_OK != lhAllocateSpace(pNew,L_HASH_OVFL_CELL_SZ(pEngine)+nAmount,&iOfft) ){
 			/* Cell header only */
-			lhAllocateSpace(pNew,L_HASH_CELL_SZ,&iOfft); /* Never fail */
+			lhAllocateSpace(pNew,L_HASH_OVFL_CELL_SZ(pEngine),&iOfft); /* Never fail */
 		}	
 		*pOfft = iOfft;
 	}
@@ -2176,10 +2824,10 @@ static int lhTransferCell(lhcell *pTarget,lhpage *pPage)
 	sxu16 nOfft;
 	int rc;
 	/* Check for a free block to hold a single cell only */
-	rc = lhAllocateSpace(pPage,L_HASH_CELL_SZ,&nOfft);
+	rc = lhAllocateSpace(pPage,L_HASH_OVFL_CELL_SZ(pPage->pHash),&nOfft);
 	if( rc != UNQLITE_OK ){
 		/* Store in a slave page */
-		rc = lhFindSlavePage(pPage,L_HASH_CELL_SZ,&nOfft,&pPage);
+		rc = lhFindSlavePage(pPage,L_HASH_OVFL_CELL_SZ(pPage->pHash),&nOfft,&pPage);
 		if( rc != UNQLITE_OK ){
 			return rc;
 		}
@@ -2210,12 +2858,18 @@ static int lhTransferCell(lhcell *pTarget,lhpage *pPage)
 }
 /*
  * Perform a page split.
+ * At most nMax cells (0 means no limit) are transferred from the old page to the
+ * new one. The number of transferred cells is stored in *pMoved and *pDone is set
+ * to TRUE when the old page does not hold any cell belonging to the new bucket.
  */
 static int lhPageSplit(
 	lhpage *pOld,      /* Page to be split */
 	lhpage *pNew,      /* New page */
 	pgno split_bucket, /* Current split bucket */
-	pgno high_mask     /* High mask (Max split bucket - 1) */
+	pgno high_mask,    /* High mask (Max split bucket - 1) */
+	sxu32 nMax,        /* Maximum number of cells to transfer */
+	sxu32 *pMoved,     /* OUT: Total number of transferred cells */
+	int *pDone         /* OUT: TRUE if the split is complete */
 	)
 {
 	lhcell *pCell,*pNext;
@@ -2223,6 +2877,8 @@ static int lhPageSplit(
 	pgno iBucket;
 	int rc; 
 	SyBlobInit(&sWorker,&pOld->pHash->sAllocator);
+	*pMoved = 0;
+	*pDone = TRUE;
 	/* Perform the split */
 	pCell = pOld->pList;
 	for( ;; ){
@@ -2234,6 +2890,11 @@ static int lhPageSplit(
 		iBucket = pCell->nHash & high_mask;
 		pNext =  pCell->pNext;
 		if( iBucket != split_bucket){
+			if( nMax > 0 && (*pMoved) >= nMax ){
+				/* Transfer limit reached, the remaining cells will be transferred later */
+				*pDone = FALSE;
+				break;
+			}
 			rc = UNQLITE_OK;
 			if( pCell->iOvfl ){
 				/* Transfer the cell only */
@@ -2267,6 +2928,7 @@ static int lhPageSplit(
 			}
 			/* Discard the cell from the old page */
 			lhUnlinkCell(pCell);
+			(*pMoved)++;
 		}
 		/* Point to the next cell */
 		pCell = pNext;
@@ -2277,8 +2939,119 @@ fail:
 	SyBlobRelease(&sWorker);
 	return rc;
 }
+/*
+ * Complete a split operation by moving to the next split bucket
+ * and reflect the change in the database header.
+ */
+static int lhSplitFinish(lhash_kv_engine *pEngine)
+{
+	int rc;
+	/* Update the database header */
+	pEngine->split_bucket++;
+	pEngine->nSplit++;
+	/* Acquire a writer lock on the first page */
+	rc = pEngine->pIo->xWrite(pEngine->pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pEngine->split_bucket >= pEngine->max_split_bucket ){
+		/* Increment the generation number */
+		pEngine->split_bucket = 0;
+		pEngine->max_split_bucket = pEngine->nmax_split_nucket;
+		pEngine->nmax_split_nucket <<= 1;
+		if( !pEngine->nmax_split_nucket ){
+			/* If this happen to your installation, please tell us <chm@symisc.net> */
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Database page (64-bit integer) limit reached");
+			return UNQLITE_LIMIT;
+		}
+		/* Reflect in the page header */
+		SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/],pEngine->split_bucket);
+		SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/+8/*Split bucket*/],pEngine->max_split_bucket);
+	}else{
+		/* Modify only the split bucket */
+		SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/],pEngine->split_bucket);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Transfer cells from the bucket being split to its sibling while honoring
+ * the per-operation transfer limit (i.e. nSplitMax).
+ * Complete the split when there is nothing left to transfer.
+ */
+static int lhSplitStep(lhash_kv_engine *pEngine,lhpage *pOld,lhpage *pNew)
+{
+	sxu32 nMax,nMoved;
+	int is_done;
+	int rc;
+	nMax = 0;
+	if( pEngine->nSplitMax > 0 ){
+		if( pEngine->nOpMoved >= pEngine->nSplitMax ){
+			/* Transfer budget exhausted for this operation */
+			return UNQLITE_OK;
+		}
+		nMax = pEngine->nSplitMax - pEngine->nOpMoved;
+	}
+	rc = lhPageSplit(pOld,pNew,pEngine->split_bucket,pEngine->nmax_split_nucket - 1,nMax,&nMoved,&is_done);
+	/* Update statistics */
+	pEngine->nSplitStep++;
+	pEngine->nCellMoved += nMoved;
+	pEngine->nOpMoved += nMoved;
+	if( pEngine->nOpMoved > pEngine->nMaxStep ){
+		pEngine->nMaxStep = pEngine->nOpMoved;
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( is_done ){
+		rc = lhSplitFinish(pEngine);
+	}
+	return rc;
+}
+/*
+ * Continue a split operation which is in progress (if any).
+ */
+static int lhSplitResume(lhash_kv_engine *pEngine)
+{
+	lhash_bmap_rec *pRec;
+	lhpage *pOld,*pNew;
+	int rc;
+	/* Sibling bucket */
+	pRec = lhMapFindBucket(pEngine,pEngine->split_bucket + pEngine->max_split_bucket);
+	if( pRec == 0 ){
+		/* No split in progress */
+		return UNQLITE_OK;
+	}
+	if( pEngine->nSplitMax > 0 && pEngine->nOpMoved >= pEngine->nSplitMax ){
+		/* Transfer budget exhausted for this operation */
+		return UNQLITE_OK;
+	}
+	rc = lhLoadPage(pEngine,pRec->iReal,0,&pNew,0);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Bucket being split */
+	pRec = lhMapFindBucket(pEngine,pEngine->split_bucket);
+	if( pRec == 0 ){
+		/* Can't happen */
+		pEngine->pIo->xPageUnref(pNew->pRaw);
+		return UNQLITE_CORRUPT;
+	}
+	rc = lhLoadPage(pEngine,pRec->iReal,0,&pOld,0);
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(pNew->pRaw);
+		return rc;
+	}
+	/* Transfer the next batch of cells */
+	rc = lhSplitStep(pEngine,pOld,pNew);
+	pEngine->pIo->xPageUnref(pOld->pRaw);
+	pEngine->pIo->xPageUnref(pNew->pRaw);
+	return rc;
+}
 /*
  * Perform the infamous linear hash split operation.
+ * When a transfer limit is set (i.e. nSplitMax), only part of the bucket is
+ * transferred here and the remaining cells are transferred by subsequent
+ * insert operations (See lhSplitResume()).
  */
 static int lhSplit(lhpage *pTarget,int *pRetry)
 {
@@ -2287,6 +3060,12 @@ static int lhSplit(lhpage *pTarget,int *pRetry)
 	lhpage *pOld,*pNew;
 	unqlite_page *pRaw;
 	int rc;
+	if( lhSplitPending(pEngine) ){
+		/* Split in progress, continue it. The bucket mapping is not altered
+		 * so the caller does not have to retry.
+		 */
+		return lhSplitResume(pEngine);
+	}
 	/* Get the real page number of the bucket to split */
 	pRec = lhMapFindBucket(pEngine,pEngine->split_bucket);
 	if( pRec == 0 ){
@@ -2325,34 +3104,10 @@ static int lhSplit(lhpage *pTarget,int *pRetry)
 		*pRetry = 1;
 	}
 	/* Perform the split */
-	rc = lhPageSplit(pOld,pNew,pEngine->split_bucket,pEngine->nmax_split_nucket - 1);
+	rc = lhSplitStep(pEngine,pOld,pNew);
 	if( rc != UNQLITE_OK ){
 		goto fail;
 	}
-	/* Update the database header */
-	pEngine->split_bucket++;
-	/* Acquire a writer lock on the first page */
-	rc = pEngine->pIo->xWrite(pEngine->pHeader);
-	if( rc != UNQLITE_OK ){
-		return rc;
-	}
-	if( pEngine->split_bucket >= pEngine->max_split_bucket ){
-		/* Increment the generation number */
-		pEngine->split_bucket = 0;
-		pEngine->max_split_bucket = pEngine->nmax_split_nucket;
-		pEngine->nmax_split_nucket <<= 1;
-		if( !pEngine->nmax_split_nucket ){
-			/* If this happen to your installation, please tell us <chm@symisc.net> */
-			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Database page (64-bit integer) limit reached");
-			return UNQLITE_LIMIT;
-		}
-		/* Reflect in the page header */
-		SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/],pEngine->split_bucket);
-		SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/+8/*Split bucket*/],pEngine->max_split_bucket);
-	}else{
-		/* Modify only the split bucket */
-		SyBigEndianPack64(&pEngine->pHeader->zData[4/*Magic*/+4/*Hash*/+8/*Free list*/],pEngine->split_bucket);
-	}
 	/* All done */
 	return UNQLITE_OK;
 fail:
@@ -2399,9 +3154,9 @@ static int lh_record_insert(
 	lhash_kv_engine *pEngine = (lhash_kv_engine *)pKv;
 	lhash_bmap_rec *pRec;
 	unqlite_page *pRaw;
-	lhpage *pPage;
+	lhpage *pPage,*pOld;
 	lhcell *pCell;
-	pgno iBucket;
+	pgno iBucket,iSplit;
 	sxu32 nHash;
 	int iCnt;
 	int rc;
@@ -2411,16 +3166,19 @@ static int lh_record_insert(
 	if( rc != UNQLITE_OK ){
 		return rc;
 	}
+	/* Transfer the next batch of cells if a split is in progress */
+	pEngine->nOpMoved = 0;
+	rc = lhSplitResume(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
 	iCnt = 0;
 	/* Compute the hash of the key first */
 	nHash = pEngine->xHash(pKey,(sxu32)nKeyLen);
 retry:
+	pOld = 0;
 	/* Extract the logical bucket number */
-	iBucket = nHash & (pEngine->nmax_split_nucket - 1);
-	if( iBucket >= pEngine->split_bucket + pEngine->max_split_bucket ){
-		/* Low mask */
-		iBucket = nHash & (pEngine->max_split_bucket - 1);
-	}
+	iBucket = lhHashToBucket(pEngine,nHash,&iSplit);
 	/* Map the logical bucket number to real page number */
 	pRec = lhMapFindBucket(pEngine,iBucket);
 	if( pRec == 0 ){
@@ -2459,10 +3217,26 @@ retry:
 		pEngine->pIo->xDontMkHot(pPage->pRaw);
 		/* Lookup for the cell */
 		pCell = lhFindCell(pPage,pKey,(sxu32)nKeyLen,nHash);
+		if( pCell == 0 && iBucket != iSplit ){
+			/* Split in progress, the record may not have been transferred yet */
+			pRec = lhMapFindBucket(pEngine,iSplit);
+			if( pRec ){
+				rc = lhLoadPage(pEngine,pRec->iReal,0,&pOld,0);
+				if( rc != UNQLITE_OK ){
+					pEngine->pIo->xPageUnref(pPage->pRaw);
+					return rc;
+				}
+				pEngine->pIo->xDontMkHot(pOld->pRaw);
+				pCell = lhFindCell(pOld,pKey,(sxu32)nKeyLen,nHash);
+			}
+		}
 		if( pCell == 0 ){
 			/* Create the record */
 			rc = lhRecordInstall(pPage,nHash,pKey,nKeyLen,pData,nDataLen);
 			if( rc == SXERR_RETRY && iCnt++ < 2 ){
+				if( pOld ){
+					pEngine->pIo->xPageUnref(pOld->pRaw);
+				}
 				rc = UNQLITE_OK;
 				goto retry;
 			}
@@ -2475,6 +3249,9 @@ retry:
 				rc = lhRecordOverwrite(pCell,pData,nDataLen);
 			}
 		}
+		if( pOld ){
+			pEngine->pIo->xPageUnref(pOld->pRaw);
+		}
 		pEngine->pIo->xPageUnref(pPage->pRaw);
 	}
 	return rc;
@@ -2594,6 +3371,7 @@ static void lhash_page_release(void *pUserData)
 	/* Drop in-memory cells */
 	for( n = 0 ; n < pPage->nCell ; ++n ){
 		pNext = pCell->pNext;
+		lhCellDropIndex(pEngine,pCell);
 		SyBlobRelease(&pCell->sKey);
 		/* Release the cell instance */
 		SyMemBackendPoolFree(&pEngine->sAllocator,(void *)pCell);
@@ -2638,7 +3416,7 @@ static int lhash_kv_init(unqlite_kv_engine *pEngine,int iPageSize)
 	int rc;
 
 	/* This structure is always zeroed, go to the initialization directly */
-	SyMemBackendInitFromParent(&pHash->sAllocator,unqliteExportMemBackend());
+	SyMemBackendInitFromParent(&pHash->sAllocator,unqliteKvIoMemBackend(pEngine->pIo));
 //#if defined(UNQLITE_ENABLE_THREADS)
 //	/* Already protected by the upper layers */
 //	SyMemBackendDisbaleMutexing(&pHash->sAllocator);
@@ -2710,6 +3488,76 @@ static int lhash_kv_config(unqlite_kv_engine *pEngine,int op,va_list ap)
 		}
 		break;
 									 }
+	case UNQLITE_KV_CONFIG_GET_HASH_FUNC: {
+		/* Current hash function */
+		ProcHash *pxHash = va_arg(ap,ProcHash *);
+		if( pxHash ){
+			*pxHash = pHash->xHash;
+		}
+		break;
+										  }
+	case UNQLITE_KV_CONFIG_CELL_FORMAT: {
+		/* On-disk cell format */
+		int iFormat = va_arg(ap,int);
+		if( iFormat != UNQLITE_KV_CELL_FORMAT_LEGACY && iFormat != UNQLITE_KV_CELL_FORMAT_COMPACT ){
+			rc = UNQLITE_INVALID;
+		}else if( pHash->nBuckRec > 0 ){
+			/* Locked operation: The format is selected at database creation */
+			rc = UNQLITE_LOCKED;
+		}else{
+			pHash->nMagic = iFormat == UNQLITE_KV_CELL_FORMAT_COMPACT ? L_HASH_MAGIC_COMPACT : L_HASH_MAGIC;
+			if( pHash->pHeader ){
+				/* Header already created, reflect the change */
+				rc = pHash->pIo->xWrite(pHash->pHeader);
+				if( rc == UNQLITE_OK ){
+					SyBigEndianPack32(pHash->pHeader->zData,pHash->nMagic);
+				}
+			}
+		}
+		break;
+										}
+	case UNQLITE_KV_CONFIG_SPLIT_LIMIT: {
+		/* Maximum number of cells transferred per operation */
+		int nMax = va_arg(ap,int);
+		if( nMax < 0 ){
+			rc = UNQLITE_INVALID;
+		}else{
+			pHash->nSplitMax = (sxu32)nMax;
+		}
+		break;
+										}
+	case UNQLITE_KV_CONFIG_SPLIT_STATS: {
+		/* Split statistics */
+		unqlite_int64 *pnSplit = va_arg(ap,unqlite_int64 *);
+		unqlite_int64 *pnStep  = va_arg(ap,unqlite_int64 *);
+		unqlite_int64 *pnMoved = va_arg(ap,unqlite_int64 *);
+		int *pnMaxStep = va_arg(ap,int *);
+		if( pnSplit ){
+			*pnSplit = (unqlite_int64)pHash->nSplit;
+		}
+		if( pnStep ){
+			*pnStep = (unqlite_int64)pHash->nSplitStep;
+		}
+		if( pnMoved ){
+			*pnMoved = (unqlite_int64)pHash->nCellMoved;
+		}
+		if( pnMaxStep ){
+			*pnMaxStep = (int)pHash->nMaxStep;
+		}
+		break;
+										}
+	case UNQLITE_KV_CONFIG_SCAN_PARTITION: {
+		/* Restrict the cursors to a share of the buckets */
+		int iPart = va_arg(ap,int);
+		int nPart = va_arg(ap,int);
+		if( nPart < 0 || (nPart > 1 && (iPart < 0 || iPart >= nPart)) ){
+			rc = UNQLITE_INVALID;
+		}else{
+			pHash->iScanPart = nPart > 1 ? (sxu32)iPart : 0;
+			pHash->nScanPart = (sxu32)nPart;
+		}
+		break;
+										   }
 	default:
 		/* Unknown OP */
 		rc = UNQLITE_UNKNOWN;
@@ -2737,6 +3585,12 @@ struct lhash_kv_cursor
 #define L_HASH_CURSOR_STATE_NEXT_PAGE 1 /* Next page in the list */
 #define L_HASH_CURSOR_STATE_CELL      2 /* Processing Cell */
 #define L_HASH_CURSOR_STATE_DONE      3 /* Cursor does not point to anything */
+/*
+ * Check whether the bucket described by the given map record belong to the
+ * partition walked by the cursors (See UNQLITE_KV_CONFIG_SCAN_PARTITION).
+ */
+#define L_HASH_CURSOR_IN_PART(ENGINE,REC) \
+	((ENGINE)->nScanPart < 2 || ((REC)->iLogic % (ENGINE)->nScanPart) == (ENGINE)->iScanPart)
 /*
  * Initialize the cursor.
  */
@@ -2773,6 +3627,10 @@ static int lhCursorNextPage(lhash_kv_cursor *pPtr)
 		}
 		/* Advance the map cursor */
 		pCur->pRec = pRec->pPrev; /* Not a bug, reverse link */
+		if( !L_HASH_CURSOR_IN_PART((lhash_kv_engine *)pCur->pStore,pRec) ){
+			/* Bucket walked by another cursor */
+			continue;
+		}
 		/* Load the next page on the list */
 		rc = lhLoadPage((lhash_kv_engine *)pCur->pStore,pRec->iReal,0,&pPage,0);
 		if( rc != UNQLITE_OK ){
@@ -2812,6 +3670,10 @@ static int lhCursorPrevPage(lhash_kv_cursor *pPtr)
 		}
 		/* Advance the map cursor */
 		pCur->pRec = pRec->pNext; /* Not a bug, reverse link */
+		if( !L_HASH_CURSOR_IN_PART((lhash_kv_engine *)pCur->pStore,pRec) ){
+			/* Bucket walked by another cursor */
+			continue;
+		}
 		/* Load the previous page on the list */
 		rc = lhLoadPage((lhash_kv_engine *)pCur->pStore,pRec->iReal,0,&pPage,0);
 		if( rc != UNQLITE_OK ){
@@ -3009,6 +3871,76 @@ static int lhCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *
 	rc = lhConsumeCellData(pCell,xConsumer,pUserData);
 	return rc;
 }
+/*
+ * Return a pointer to the data of the current record without copying it.
+ * This is only possible when the data is stored in a single page (either
+ * locally or in the first overflow page). The page is referenced on success
+ * and must be released via xPageUnref() once the caller is done with the data.
+ * UNQLITE_NOTIMPLEMENTED is returned when the data spans multiple pages.
+ */
+static int lhCursorDataRef(unqlite_kv_cursor *pCursor,const void **ppData,unqlite_int64 *pLen,unqlite_page **ppPage)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	lhash_kv_engine *pEngine;
+	unqlite_page *pRaw;
+	lhcell *pCell;
+	int rc;
+	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 ){
+		/* Invalid state */
+		return UNQLITE_INVALID;
+	}
+	/* Point to the target cell */
+	pCell = pCur->pCell;
+	pEngine = pCell->pPage->pHash;
+	if( pCell->iOvfl == 0 ){
+		/* Local payload */
+		pRaw = pCell->pPage->pRaw;
+		pEngine->pIo->xPageRef(pRaw);
+		*ppData = (const void *)&pRaw->zData[L_HASH_CELL_DATA_OFFT(pCell)];
+	}else{
+		if( pCell->iDataPage == 0 || pCell->nData > (sxu64)(pEngine->iPageSize - pCell->iDataOfft) ){
+			/* Data spans multiple overflow pages */
+			return UNQLITE_NOTIMPLEMENTED;
+		}
+		/* Data fits in a single overflow page */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pCell->iDataPage,&pRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		*ppData = (const void *)&pRaw->zData[pCell->iDataOfft];
+	}
+	*pLen = (unqlite_int64)pCell->nData;
+	*ppPage = pRaw;
+	return UNQLITE_OK;
+}
+/*
+ * Consume a range of the data of the current record.
+ */
+static int lhCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	int rc;
+	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 || iOfft < 0 || nLen < 0 ){
+		/* Invalid state */
+		return UNQLITE_INVALID;
+	}
+	rc = lhConsumeCellDataRange(pCur->pCell,(sxu64)iOfft,(sxu64)nLen,xConsumer,pUserData);
+	return rc;
+}
+/*
+ * Overwrite a range of the data of the current record.
+ */
+static int lhCursorWriteRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen)
+{
+	lhash_kv_cursor *pCur = (lhash_kv_cursor *)pCursor;
+	int rc;
+	if( pCur->iState != L_HASH_CURSOR_STATE_CELL || pCur->pCell == 0 || iOfft < 0 || nLen < 0 ){
+		/* Invalid state */
+		return UNQLITE_INVALID;
+	}
+	rc = lhCellWriteDataRange(pCur->pCell,(sxu64)iOfft,pData,(sxu64)nLen);
+	return rc;
+}
 /*
  * Find a partiuclar record.
  */
@@ -3047,6 +3979,106 @@ static int lhCursorDelete(unqlite_kv_cursor *pCursor)
 	rc = lhRecordRemove(pCell);
 	return rc;
 }
+/*
+ * Mark a master or slave page as empty while keeping the link to the next slave page.
+ */
+static int lhPageClear(lhpage *pPage)
+{
+	pgno iSlave = pPage->sHdr.iSlave;
+	int rc;
+	rc = lhSetEmptyPage(pPage);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianPack64(&pPage->pRaw->zData[2/*Cell offset*/+2/*Free block offset*/],iSlave);
+	pPage->sHdr.iOfft = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xRemoveIf() method.
+ * Remove the records whose key is selected by the given filter, one bucket at a time.
+ * When every record of a bucket is selected, the master and slave pages of the bucket
+ * are reset in place (Each page is thus journaled once) instead of unlinking each cell.
+ */
+static int lhRemoveIf(
+	unqlite_kv_engine *pKv,
+	int (*xFilter)(const void *,unsigned int,void *),void *pUserData,
+	unqlite_int64 *pnRemoved
+	)
+{
+	lhash_kv_engine *pEngine = (lhash_kv_engine *)pKv;
+	lhash_bmap_rec *pRec;
+	lhpage *pPage,*pSlave;
+	lhcell **apMatch;
+	lhcell *pCell;
+	SySet aMatch;
+	SyBlob sKey;
+	sxu32 n,i;
+	int rc;
+	/* Read the database header first */
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,0);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SySetInit(&aMatch,&pEngine->sAllocator,sizeof(lhcell *));
+	SyBlobInit(&sKey,&pEngine->sAllocator);
+	for( pRec = pEngine->pFirst ; pRec ; pRec = pRec->pPrev /* Not a bug, reverse link */ ){
+		rc = lhLoadPage(pEngine,pRec->iReal,0,&pPage,0);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		/* Collect the selected cells of this bucket */
+		SySetReset(&aMatch);
+		for( pCell = pPage->pList ; pCell ; pCell = pCell->pNext ){
+			SyBlobReset(&sKey);
+			rc = lhConsumeCellkey(pCell,unqliteDataConsumer,&sKey,0);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			if( xFilter(SyBlobData(&sKey),SyBlobLength(&sKey),pUserData) ){
+				if( SySetPut(&aMatch,(const void *)&pCell) != SXRET_OK ){
+					rc = UNQLITE_NOMEM;
+					break;
+				}
+			}
+		}
+		n = SySetUsed(&aMatch);
+		apMatch = (lhcell **)SySetBasePtr(&aMatch);
+		if( rc == UNQLITE_OK && n > 0 ){
+			if( n >= pPage->nCell ){
+				/* The whole bucket goes away */
+				for( i = 0 ; i < n && rc == UNQLITE_OK ; ++i ){
+					rc = lhCellFreeOvfl(apMatch[i]);
+				}
+				if( rc == UNQLITE_OK ){
+					rc = lhPageClear(pPage);
+				}
+				for( pSlave = pPage->pSlave ; pSlave && rc == UNQLITE_OK ; pSlave = pSlave->pNextSlave ){
+					rc = lhPageClear(pSlave);
+				}
+				if( rc == UNQLITE_OK ){
+					while( pPage->pList ){
+						lhCellDiscard(pPage->pList);
+					}
+				}
+			}else{
+				for( i = 0 ; i < n && rc == UNQLITE_OK ; ++i ){
+					rc = lhRecordRemove(apMatch[i]);
+				}
+			}
+			if( rc == UNQLITE_OK ){
+				*pnRemoved += n;
+			}
+		}
+		pEngine->pIo->xPageUnref(pPage->pRaw);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+	}
+	SyBlobRelease(&sKey);
+	SySetRelease(&aMatch);
+	return rc;
+}
 /*
  * Export the linear-hash storage engine.
  */
@@ -3056,7 +4088,7 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void)
 		"hash",                     /* zName */
 		sizeof(lhash_kv_engine),    /* szKv */
 		sizeof(lhash_kv_cursor),    /* szCursor */
-		1,                          /* iVersion */
+		5,                          /* iVersion */
 		lhash_kv_init,              /* xInit */
 		lhash_kv_release,           /* xRelease */
 		lhash_kv_config,            /* xConfig */
@@ -3076,7 +4108,15 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void)
 		lhCursorDataLength,         /* xDataLength */
 		lhCursorData,               /* xData */
 		lhCursorReset,              /* xReset */
-		0                           /* xRelease */                        
+		0,                          /* xRelease */                        
+		lhCursorDataRef,            /* xDataRef */
+		lhCursorDataRange,          /* xDataRange */
+		lhCursorWriteRange,         /* xWriteRange */
+		0,                          /* xSync */
+		UNQLITE_KV_SAVEPOINT,       /* iFlags */
+		0,                          /* xFetch */
+		0,                          /* xRemove */
+		lhRemoveIf                  /* xRemoveIf */
 	};
 	return &sDiskStore;
 }
@@ -0,0 +1,2207 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: lsm_kv.c v1.0 Unix 2018-06-09 11:40 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements a log-structured merge (LSM) key/value storage engine for
+ * write heavy workloads.
+ *
+ * Writes go to an in-memory sorted table (the memtable, a skip list). When the memtable
+ * grows past its limit, or when the transaction is committed (See the xSync() method),
+ * it is written out as an immutable sorted run. Runs are written to freshly allocated pages
+ * so that ingest turns into sequential I/O instead of random page updates.
+ * Runs are organized in levels: Each time LSM_FANOUT runs accumulate at the same level,
+ * they are merged into a single run at the next level. Newer versions of a key shadow older
+ * ones and deletions are recorded as tombstones which are dropped once they reach the oldest run.
+ *
+ * Each run is made of three page streams:
+ *   - The data stream holding the records sorted by key.
+ *   - The index stream holding the first key of each data page (Loaded in memory).
+ *   - A Bloom filter (Loaded in memory) so that point lookups skip runs that do not hold the key.
+ * The list of live runs (the manifest) is itself stored in a page stream referenced from
+ * the database header.
+ *
+ * The engine is selected via unqlite_config(UNQLITE_CONFIG_KV_ENGINE,"lsm") before
+ * the database is accessed.
+ */
+/* Magic number identifying a valid LSM storage image */
+#define LSM_MAGIC 0x15A7C0DE
+/*
+ * Page one layout:
+ *   4 byte magic number
+ *   4 byte change counter
+ *   8 byte first page of the manifest stream
+ *   8 byte head of the free page list
+ */
+#define LSM_HDR_CHANGE_OFFT   4
+#define LSM_HDR_MANIFEST_OFFT 8
+#define LSM_HDR_FREE_OFFT     16
+/* Stream page header: 8 byte next page number */
+#define LSM_STREAM_HDR_SZ 8
+/*
+ * Record header in the data stream:
+ *  1 byte flags, 4 byte key length, 8 byte data length.
+ * The key and the data follow.
+ */
+#define LSM_REC_HDR_SZ 13
+#define LSM_REC_TOMBSTONE 0x01 /* Deleted record */
+/* Number of runs at the same level that trigger a merge */
+#define LSM_FANOUT 4
+/* Default memtable size limit */
+#define LSM_MEMTABLE_SIZE (4 * 1024 * 1024)
+/* Smallest memtable flushed early when the handle is short of memory */
+#define LSM_MEMTABLE_MIN  (64 * 1024)
+/* Bloom filter parameters: 10 bits per key and 7 probes give a ~1% false positive rate */
+#define LSM_BLOOM_BITS   10
+#define LSM_BLOOM_PROBES 7
+/* Maximum height of the skip list */
+#define LSM_MAX_HEIGHT 16
+/* Seek modes */
+#define LSM_SEEK_GE    1
+#define LSM_SEEK_LE    2
+#define LSM_SEEK_FIRST 3
+#define LSM_SEEK_LAST  4
+/* Forward declaration */
+typedef struct lsm_kv_engine lsm_kv_engine;
+typedef struct lsm_mem_node lsm_mem_node;
+typedef struct lsm_entry lsm_entry;
+typedef struct lsm_run lsm_run;
+typedef struct lsm_iter lsm_iter;
+/*
+ * Memtable entry.
+ */
+struct lsm_mem_node
+{
+	lsm_mem_node *pPrev;        /* Previous entry */
+	unsigned char *zData;       /* Record data */
+	sxu64 nData;                /* Data length */
+	sxu32 nKey;                 /* Key length */
+	sxu8 iFlags;                /* LSM_REC_TOMBSTONE */
+	sxu8 nHeight;               /* Number of forward pointers */
+	lsm_mem_node *apNext[1];    /* Forward pointers, the key follow */
+};
+#define LSM_NODE_KEY(NODE) ((unsigned char *)&(NODE)->apNext[(NODE)->nHeight])
+/*
+ * Index entry: Position of the first record starting in a given data page.
+ */
+struct lsm_entry
+{
+	pgno iPage;   /* Data page */
+	sxu32 iOfft;  /* Offset of the first record in the page payload */
+	sxu32 nRec;   /* Records starting at this position up to the next entry */
+	sxu32 iKey;   /* Offset of the first key in the key buffer */
+	sxu32 nKey;   /* First key length */
+};
+/*
+ * Immutable sorted run.
+ */
+struct lsm_run
+{
+	sxu32 iLevel;       /* Run level */
+	sxu64 nRec;         /* Total number of records (Including tombstones) */
+	pgno iData;         /* First page of the data stream */
+	pgno iIndex;        /* First page of the index stream */
+	pgno iBloom;        /* First page of the Bloom filter stream */
+	lsm_entry *aEntry;  /* In-memory index */
+	sxu32 nEntry;       /* Index entries */
+	SyBlob sKeys;       /* Index keys */
+	unsigned char *zBloom; /* Bloom filter */
+	sxu32 nBloom;       /* Bloom filter size in bytes */
+};
+/*
+ * Sorted iterator over the memtable or a run.
+ */
+struct lsm_iter
+{
+	lsm_kv_engine *pEngine;
+	lsm_run *pRun;            /* Run being iterated, NULL for the memtable */
+	lsm_mem_node *pNode;      /* Current memtable entry */
+	int bValid;               /* True when pointing to a valid record */
+	sxu32 iEntry;             /* Current index entry */
+	sxu32 iOrd;               /* Record ordinal from the index entry */
+	pgno iRecPage;            /* Record position */
+	sxu32 iRecOfft;
+	pgno iDataPage;           /* Data position */
+	sxu32 iDataOfft;
+	pgno iNextPage;           /* Next record position */
+	sxu32 iNextOfft;
+	sxu8 iFlags;              /* Record flags */
+	sxu64 nData;              /* Data length */
+	SyBlob sKey;              /* Current key (Runs only) */
+};
+/*
+ * Each LSM KV engine is represented by an instance
+ * of the following structure.
+ */
+struct lsm_kv_engine
+{
+	const unqlite_kv_io *pIo;     /* IO methods: Must be first */
+	/* Private fields */
+	SyMemBackend sAllocator;      /* Private memory backend */
+	ProcCmp xCmp;                 /* Key comparison function */
+	sxu32 nPayload;               /* Usable bytes in a stream page */
+	/* Memtable */
+	lsm_mem_node *pHead;          /* Skip list head */
+	lsm_mem_node *pLast;          /* Last entry */
+	int nHeight;                  /* Current skip list height */
+	sxu32 iRand;                  /* PRNG state */
+	sxu64 nMemEntry;              /* Memtable entries */
+	sxu64 nMemByte;               /* Memtable footprint */
+	sxu64 nMemLimit;              /* Flush threshold */
+	/* Runs, newest first */
+	lsm_run **apRun;
+	sxu32 nRun;
+	sxu32 nRunAlloc;
+	pgno iManifest;               /* First page of the manifest stream */
+	pgno iFreeList;               /* Head of the free page list */
+	sxu32 iChange;                /* Header change counter */
+	sxu32 iGen;                   /* Incremented on each change so that cursors can detect it */
+	SyBlob sWorker;               /* Working buffer */
+	lsm_iter sProbe;              /* Point lookup iterator */
+	int bOpen;                    /* True when the manifest have been loaded */
+};
+/*
+ * Merge of several sorted iterators where the lowest index is the newest.
+ */
+typedef struct lsm_merger lsm_merger;
+struct lsm_merger
+{
+	lsm_iter *aIter;          /* Iterators */
+	sxu32 nIter;              /* Total number of iterators */
+	int iDir;                 /* Direction: 1 forward, -1 backward */
+	sxi32 iCur;               /* Current iterator, -1 when exhausted */
+	int bTombstone;           /* Report tombstones instead of skipping them */
+	SyBlob sKey;              /* Key being stepped over */
+};
+/*
+ * Page stream reader.
+ */
+typedef struct lsm_reader lsm_reader;
+struct lsm_reader
+{
+	lsm_kv_engine *pEngine;
+	unqlite_page *pPage;      /* Current page */
+	sxu32 iOfft;              /* Offset in the page payload */
+};
+/*
+ * Page stream writer.
+ */
+typedef struct lsm_writer lsm_writer;
+struct lsm_writer
+{
+	lsm_kv_engine *pEngine;
+	unqlite_page *pPage;      /* Current page */
+	pgno iFirst;              /* First page of the stream */
+	sxu32 iOfft;              /* Offset in the page payload */
+};
+/*
+ * Compare two keys.
+ */
+static sxi32 lsmKeyCmp(lsm_kv_engine *pEngine,const void *pA,sxu32 nA,const void *pB,sxu32 nB)
+{
+	sxi32 rc = 0;
+	sxu32 n;
+	n = nA < nB ? nA : nB;
+	if( n > 0 ){
+		rc = pEngine->xCmp(pA,pB,n);
+	}
+	if( rc == 0 && nA != nB ){
+		rc = nA < nB ? -1 : 1;
+	}
+	return rc;
+}
+/*
+ * Reflect the manifest location and the head of the free page list in the database header.
+ */
+static int lsmWriteHeader(lsm_kv_engine *pEngine)
+{
+	unqlite_page *pHeader;
+	int rc;
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pHeader);
+	if( rc == UNQLITE_OK ){
+		pEngine->iChange++;
+		SyBigEndianPack32(pHeader->zData,LSM_MAGIC);
+		SyBigEndianPack32(&pHeader->zData[LSM_HDR_CHANGE_OFFT],pEngine->iChange);
+		SyBigEndianPack64(&pHeader->zData[LSM_HDR_MANIFEST_OFFT],pEngine->iManifest);
+		SyBigEndianPack64(&pHeader->zData[LSM_HDR_FREE_OFFT],pEngine->iFreeList);
+	}
+	pEngine->pIo->xPageUnref(pHeader);
+	return rc;
+}
+/*
+ * Allocate a new page, either from the free list or by extending the database file.
+ * A writer lock is acquired on the returned page.
+ */
+static int lsmAllocPage(lsm_kv_engine *pEngine,unqlite_page **ppPage)
+{
+	unqlite_page *pPage;
+	int rc;
+	if( pEngine->iFreeList > 0 ){
+		/* Recycle a free page */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,pEngine->iFreeList,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(pPage->zData,&pEngine->iFreeList);
+		rc = lsmWriteHeader(pEngine);
+	}else{
+		/* Extend the database file, the pages are appended sequentially */
+		rc = pEngine->pIo->xNew(pEngine->pIo->pHandle,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( rc == UNQLITE_OK ){
+		rc = pEngine->pIo->xWrite(pPage);
+	}
+	if( rc != UNQLITE_OK ){
+		pEngine->pIo->xPageUnref(pPage);
+		return rc;
+	}
+	*ppPage = pPage;
+	return UNQLITE_OK;
+}
+/*
+ * Restore a whole page stream to the free list.
+ */
+static int lsmFreeStream(lsm_kv_engine *pEngine,pgno iPage)
+{
+	unqlite_page *pPage;
+	pgno iNext;
+	int rc;
+	while( iPage > 0 ){
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPage,&pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack64(pPage->zData,&iNext);
+		rc = pEngine->pIo->xWrite(pPage);
+		if( rc == UNQLITE_OK ){
+			/* Link to the free list */
+			SyBigEndianPack64(pPage->zData,pEngine->iFreeList);
+			pEngine->iFreeList = iPage;
+		}
+		pEngine->pIo->xPageUnref(pPage);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		iPage = iNext;
+	}
+	return lsmWriteHeader(pEngine);
+}
+/*
+ * Position a reader at the given stream offset.
+ */
+static int lsmReaderOpen(lsm_reader *pReader,lsm_kv_engine *pEngine,pgno iPage,sxu32 iOfft)
+{
+	int rc;
+	pReader->pEngine = pEngine;
+	pReader->iOfft = iOfft;
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iPage,&pReader->pPage);
+	if( rc != UNQLITE_OK ){
+		pReader->pPage = 0;
+	}
+	return rc;
+}
+/*
+ * Release the page held by a reader.
+ */
+static void lsmReaderClose(lsm_reader *pReader)
+{
+	if( pReader->pPage ){
+		pReader->pEngine->pIo->xPageUnref(pReader->pPage);
+		pReader->pPage = 0;
+	}
+}
+/*
+ * Consume (or skip when xConsumer is NULL) the next nLen bytes of a stream.
+ */
+static int lsmReaderRead(lsm_reader *pReader,sxu64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	lsm_kv_engine *pEngine = pReader->pEngine;
+	pgno iNext;
+	sxu32 n;
+	int rc;
+	while( nLen > 0 ){
+		if( pReader->iOfft >= pEngine->nPayload ){
+			/* Move to the next page of the stream */
+			SyBigEndianUnpack64(pReader->pPage->zData,&iNext);
+			pEngine->pIo->xPageUnref(pReader->pPage);
+			pReader->pPage = 0;
+			if( iNext < 1 ){
+				pEngine->pIo->xErr(pEngine->pIo->pHandle,"Truncated LSM page stream");
+				return UNQLITE_CORRUPT;
+			}
+			rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,iNext,&pReader->pPage);
+			if( rc != UNQLITE_OK ){
+				pReader->pPage = 0;
+				return rc;
+			}
+			pReader->iOfft -= pEngine->nPayload;
+			continue;
+		}
+		n = pEngine->nPayload - pReader->iOfft;
+		if( (sxu64)n > nLen ){
+			n = (sxu32)nLen;
+		}
+		if( xConsumer ){
+			if( xConsumer(&pReader->pPage->zData[LSM_STREAM_HDR_SZ + pReader->iOfft],n,pUserData) != UNQLITE_OK ){
+				return UNQLITE_ABORT;
+			}
+		}
+		pReader->iOfft += n;
+		nLen -= n;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Copy the next nLen bytes of a stream into the given buffer.
+ */
+static int lsmReaderCopyConsumer(const void *pData,unsigned int nLen,void *pUserData)
+{
+	unsigned char **pzOut = (unsigned char **)pUserData;
+	SyMemcpy(pData,(void *)*pzOut,nLen);
+	(*pzOut) += nLen;
+	return UNQLITE_OK;
+}
+static int lsmReaderCopy(lsm_reader *pReader,void *pBuf,sxu32 nLen)
+{
+	unsigned char *zOut = (unsigned char *)pBuf;
+	return lsmReaderRead(pReader,nLen,lsmReaderCopyConsumer,(void *)&zOut);
+}
+/*
+ * Make sure the writer have room for at least one byte and return the current position.
+ */
+static int lsmWriterReserve(lsm_writer *pWriter)
+{
+	lsm_kv_engine *pEngine = pWriter->pEngine;
+	unqlite_page *pNew;
+	int rc;
+	if( pWriter->pPage && pWriter->iOfft < pEngine->nPayload ){
+		return UNQLITE_OK;
+	}
+	rc = lsmAllocPage(pEngine,&pNew);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianPack64(pNew->zData,0);
+	if( pWriter->pPage ){
+		/* Link to the previous page */
+		SyBigEndianPack64(pWriter->pPage->zData,pNew->pgno);
+		pEngine->pIo->xPageUnref(pWriter->pPage);
+	}else{
+		pWriter->iFirst = pNew->pgno;
+	}
+	pWriter->pPage = pNew;
+	pWriter->iOfft = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Append data to a page stream.
+ */
+static int lsmWriterWrite(lsm_writer *pWriter,const void *pData,sxu64 nLen)
+{
+	const unsigned char *zIn = (const unsigned char *)pData;
+	sxu32 n;
+	int rc;
+	while( nLen > 0 ){
+		rc = lsmWriterReserve(pWriter);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		n = pWriter->pEngine->nPayload - pWriter->iOfft;
+		if( (sxu64)n > nLen ){
+			n = (sxu32)nLen;
+		}
+		SyMemcpy((const void *)zIn,(void *)&pWriter->pPage->zData[LSM_STREAM_HDR_SZ + pWriter->iOfft],n);
+		pWriter->iOfft += n;
+		zIn += n;
+		nLen -= n;
+	}
+	return UNQLITE_OK;
+}
+static int lsmWriterConsumer(const void *pData,unsigned int nLen,void *pUserData)
+{
+	return lsmWriterWrite((lsm_writer *)pUserData,pData,nLen);
+}
+/*
+ * Release the page held by a writer.
+ */
+static void lsmWriterClose(lsm_writer *pWriter)
+{
+	if( pWriter->pPage ){
+		pWriter->pEngine->pIo->xPageUnref(pWriter->pPage);
+		pWriter->pPage = 0;
+	}
+}
+/*
+ * Initialize a stream writer.
+ */
+static void lsmWriterInit(lsm_writer *pWriter,lsm_kv_engine *pEngine)
+{
+	pWriter->pEngine = pEngine;
+	pWriter->pPage = 0;
+	pWriter->iFirst = 0;
+	pWriter->iOfft = 0;
+}
+/*
+ * Bloom filter hashes.
+ */
+static void lsmBloomHash(const void *pKey,sxu32 nKey,sxu32 *pH1,sxu32 *pH2)
+{
+	const unsigned char *zIn = (const unsigned char *)pKey;
+	sxu32 h = 2166136261U;
+	sxu32 i;
+	*pH1 = SyBinHash(pKey,nKey);
+	/* FNV-1a */
+	for( i = 0 ; i < nKey ; ++i ){
+		h = (h ^ zIn[i]) * 16777619U;
+	}
+	*pH2 = h | 1;
+}
+static void lsmBloomAdd(lsm_run *pRun,const void *pKey,sxu32 nKey)
+{
+	sxu32 nBit = pRun->nBloom << 3;
+	sxu32 h1,h2,iBit,i;
+	lsmBloomHash(pKey,nKey,&h1,&h2);
+	for( i = 0 ; i < LSM_BLOOM_PROBES ; ++i ){
+		iBit = (h1 + i * h2) % nBit;
+		pRun->zBloom[iBit >> 3] |= (unsigned char)(1 << (iBit & 7));
+	}
+}
+static int lsmBloomTest(lsm_run *pRun,const void *pKey,sxu32 nKey)
+{
+	sxu32 nBit = pRun->nBloom << 3;
+	sxu32 h1,h2,iBit,i;
+	if( nBit < 1 ){
+		return 1;
+	}
+	lsmBloomHash(pKey,nKey,&h1,&h2);
+	for( i = 0 ; i < LSM_BLOOM_PROBES ; ++i ){
+		iBit = (h1 + i * h2) % nBit;
+		if( (pRun->zBloom[iBit >> 3] & (1 << (iBit & 7))) == 0 ){
+			return 0;
+		}
+	}
+	return 1;
+}
+/*
+ * Height of a new skip list node.
+ */
+static int lsmRandomHeight(lsm_kv_engine *pEngine)
+{
+	int nHeight = 1;
+	sxu32 r;
+	/* Xorshift */
+	r = pEngine->iRand;
+	r ^= r << 13;
+	r ^= r >> 17;
+	r ^= r << 5;
+	pEngine->iRand = r;
+	while( nHeight < LSM_MAX_HEIGHT && (r & 3) == 0 ){
+		nHeight++;
+		r >>= 2;
+	}
+	return nHeight;
+}
+/*
+ * Find the first memtable entry whose key is greater than or equal to the given key.
+ * The predecessors at each level are stored in apUpdate when not NULL.
+ */
+static lsm_mem_node * lsmMemSeek(lsm_kv_engine *pEngine,const void *pKey,sxu32 nKey,lsm_mem_node **apUpdate)
+{
+	lsm_mem_node *pNode = pEngine->pHead;
+	lsm_mem_node *pNext;
+	int i;
+	for( i = pEngine->nHeight - 1 ; i >= 0 ; --i ){
+		for(;;){
+			pNext = pNode->apNext[i];
+			if( pNext == 0 || lsmKeyCmp(pEngine,LSM_NODE_KEY(pNext),pNext->nKey,pKey,nKey) >= 0 ){
+				break;
+			}
+			pNode = pNext;
+		}
+		if( apUpdate ){
+			apUpdate[i] = pNode;
+		}
+	}
+	return pNode->apNext[0];
+}
+/*
+ * Insert or overwrite a memtable entry.
+ */
+static int lsmMemPut(lsm_kv_engine *pEngine,const void *pKey,sxu32 nKey,const void *pData,sxu64 nData,sxu8 iFlags)
+{
+	lsm_mem_node *apUpdate[LSM_MAX_HEIGHT];
+	unsigned char *zData = 0;
+	lsm_mem_node *pNode;
+	int nHeight,i;
+	if( nData > 0 ){
+		if( nData >= SXU32_HIGH ){
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Record data too large for the LSM memtable");
+			return UNQLITE_LIMIT;
+		}
+		zData = (unsigned char *)SyMemBackendAlloc(&pEngine->sAllocator,(sxu32)nData);
+		if( zData == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		SyMemcpy(pData,(void *)zData,(sxu32)nData);
+	}
+	pNode = lsmMemSeek(pEngine,pKey,nKey,apUpdate);
+	if( pNode && lsmKeyCmp(pEngine,LSM_NODE_KEY(pNode),pNode->nKey,pKey,nKey) == 0 ){
+		/* Overwrite */
+		if( pNode->zData ){
+			SyMemBackendFree(&pEngine->sAllocator,pNode->zData);
+		}
+		pEngine->nMemByte -= pNode->nData;
+		pEngine->nMemByte += nData;
+		pNode->zData = zData;
+		pNode->nData = nData;
+		pNode->iFlags = iFlags;
+		return UNQLITE_OK;
+	}
+	nHeight = lsmRandomHeight(pEngine);
+	if( nHeight > pEngine->nHeight ){
+		for( i = pEngine->nHeight ; i < nHeight ; ++i ){
+			apUpdate[i] = pEngine->pHead;
+		}
+		pEngine->nHeight = nHeight;
+	}
+	pNode = (lsm_mem_node *)SyMemBackendAlloc(&pEngine->sAllocator,
+		sizeof(lsm_mem_node) + (nHeight - 1) * sizeof(lsm_mem_node *) + nKey);
+	if( pNode == 0 ){
+		if( zData ){
+			SyMemBackendFree(&pEngine->sAllocator,zData);
+		}
+		return UNQLITE_NOMEM;
+	}
+	pNode->zData = zData;
+	pNode->nData = nData;
+	pNode->nKey = nKey;
+	pNode->iFlags = iFlags;
+	pNode->nHeight = (sxu8)nHeight;
+	SyMemcpy(pKey,(void *)LSM_NODE_KEY(pNode),nKey);
+	/* Link */
+	for( i = 0 ; i < nHeight ; ++i ){
+		pNode->apNext[i] = apUpdate[i]->apNext[i];
+		apUpdate[i]->apNext[i] = pNode;
+	}
+	pNode->pPrev = apUpdate[0] == pEngine->pHead ? 0 : apUpdate[0];
+	if( pNode->apNext[0] ){
+		pNode->apNext[0]->pPrev = pNode;
+	}else{
+		pEngine->pLast = pNode;
+	}
+	pEngine->nMemEntry++;
+	pEngine->nMemByte += sizeof(lsm_mem_node) + nHeight * sizeof(lsm_mem_node *) + nKey + nData;
+	return UNQLITE_OK;
+}
+/*
+ * Discard the memtable content.
+ */
+static void lsmMemClear(lsm_kv_engine *pEngine)
+{
+	lsm_mem_node *pNode,*pNext;
+	int i;
+	pNode = pEngine->pHead->apNext[0];
+	while( pNode ){
+		pNext = pNode->apNext[0];
+		if( pNode->zData ){
+			SyMemBackendFree(&pEngine->sAllocator,pNode->zData);
+		}
+		SyMemBackendFree(&pEngine->sAllocator,pNode);
+		pNode = pNext;
+	}
+	for( i = 0 ; i < LSM_MAX_HEIGHT ; ++i ){
+		pEngine->pHead->apNext[i] = 0;
+	}
+	pEngine->nHeight = 1;
+	pEngine->pLast = 0;
+	pEngine->nMemEntry = 0;
+	pEngine->nMemByte = 0;
+}
+/*
+ * Initialize an iterator over the memtable (pRun == NULL) or a run.
+ */
+static void lsmIterInit(lsm_iter *pIter,lsm_kv_engine *pEngine,lsm_run *pRun)
+{
+	pIter->pEngine = pEngine;
+	pIter->pRun = pRun;
+	pIter->pNode = 0;
+	pIter->bValid = 0;
+	SyBlobReset(&pIter->sKey);
+}
+/*
+ * Current key of an iterator.
+ */
+static void lsmIterKey(lsm_iter *pIter,const unsigned char **pzKey,sxu32 *pnKey)
+{
+	if( pIter->pRun == 0 ){
+		*pzKey = LSM_NODE_KEY(pIter->pNode);
+		*pnKey = pIter->pNode->nKey;
+	}else{
+		*pzKey = (const unsigned char *)SyBlobData(&pIter->sKey);
+		*pnKey = SyBlobLength(&pIter->sKey);
+	}
+}
+/*
+ * Current record flags and data length.
+ */
+static sxu8 lsmIterFlags(lsm_iter *pIter)
+{
+	return pIter->pRun ? pIter->iFlags : pIter->pNode->iFlags;
+}
+static sxu64 lsmIterDataLength(lsm_iter *pIter)
+{
+	return pIter->pRun ? pIter->nData : pIter->pNode->nData;
+}
+/*
+ * Consume a range of the current record data.
+ */
+static int lsmIterData(lsm_iter *pIter,sxu64 iOfft,sxu64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	sxu64 nData = lsmIterDataLength(pIter);
+	lsm_reader sReader;
+	int rc;
+	if( iOfft >= nData ){
+		return UNQLITE_OK;
+	}
+	if( nLen > nData - iOfft ){
+		nLen = nData - iOfft;
+	}
+	if( nLen < 1 ){
+		return UNQLITE_OK;
+	}
+	if( pIter->pRun == 0 ){
+		rc = xConsumer((const void *)&pIter->pNode->zData[iOfft],(unsigned int)nLen,pUserData);
+		return rc != UNQLITE_OK ? UNQLITE_ABORT : UNQLITE_OK;
+	}
+	rc = lsmReaderOpen(&sReader,pIter->pEngine,pIter->iDataPage,pIter->iDataOfft);
+	if( rc == UNQLITE_OK ){
+		rc = lsmReaderRead(&sReader,iOfft,0,0);
+		if( rc == UNQLITE_OK ){
+			rc = lsmReaderRead(&sReader,nLen,xConsumer,pUserData);
+		}
+	}
+	lsmReaderClose(&sReader);
+	return rc;
+}
+/*
+ * Load the run record stored at the given stream position.
+ */
+static int lsmRunIterLoad(lsm_iter *pIter,pgno iPage,sxu32 iOfft,sxu32 iEntry,sxu32 iOrd)
+{
+	unsigned char zHdr[LSM_REC_HDR_SZ];
+	lsm_reader sReader;
+	sxu32 nKey;
+	int rc;
+	pIter->bValid = 0;
+	rc = lsmReaderOpen(&sReader,pIter->pEngine,iPage,iOfft);
+	if( rc == UNQLITE_OK ){
+		rc = lsmReaderCopy(&sReader,zHdr,LSM_REC_HDR_SZ);
+	}
+	if( rc == UNQLITE_OK ){
+		pIter->iFlags = zHdr[0];
+		SyBigEndianUnpack32(&zHdr[1],&nKey);
+		SyBigEndianUnpack64(&zHdr[5],&pIter->nData);
+		SyBlobReset(&pIter->sKey);
+		rc = lsmReaderRead(&sReader,nKey,unqliteDataConsumer,&pIter->sKey);
+	}
+	if( rc == UNQLITE_OK ){
+		pIter->iDataPage = sReader.pPage->pgno;
+		pIter->iDataOfft = sReader.iOfft;
+		/* Skip the data */
+		rc = lsmReaderRead(&sReader,pIter->nData,0,0);
+	}
+	if( rc == UNQLITE_OK ){
+		pIter->iNextPage = sReader.pPage->pgno;
+		pIter->iNextOfft = sReader.iOfft;
+		pIter->iRecPage = iPage;
+		pIter->iRecOfft = iOfft;
+		pIter->iEntry = iEntry;
+		pIter->iOrd = iOrd;
+		pIter->bValid = 1;
+	}
+	lsmReaderClose(&sReader);
+	return rc;
+}
+/*
+ * Position a run iterator on the given record ordinal of an index entry.
+ */
+static int lsmRunIterOrd(lsm_iter *pIter,sxu32 iEntry,sxu32 iOrd)
+{
+	lsm_entry *pEntry = &pIter->pRun->aEntry[iEntry];
+	int rc;
+	rc = lsmRunIterLoad(pIter,pEntry->iPage,pEntry->iOfft,iEntry,0);
+	while( rc == UNQLITE_OK && pIter->iOrd < iOrd ){
+		rc = lsmRunIterLoad(pIter,pIter->iNextPage,pIter->iNextOfft,iEntry,pIter->iOrd + 1);
+	}
+	return rc;
+}
+/*
+ * Index of the last entry whose first key is less than or equal to the given key.
+ * Return -1 if the key is less than all the keys of the run.
+ */
+static sxi32 lsmRunFindEntry(lsm_kv_engine *pEngine,lsm_run *pRun,const void *pKey,sxu32 nKey)
+{
+	const unsigned char *zKeys = (const unsigned char *)SyBlobData(&pRun->sKeys);
+	sxu32 iLo = 0,iHi = pRun->nEntry,iMid;
+	lsm_entry *pEntry;
+	while( iLo < iHi ){
+		iMid = (iLo + iHi) >> 1;
+		pEntry = &pRun->aEntry[iMid];
+		if( lsmKeyCmp(pEngine,&zKeys[pEntry->iKey],pEntry->nKey,pKey,nKey) <= 0 ){
+			iLo = iMid + 1;
+		}else{
+			iHi = iMid;
+		}
+	}
+	return (sxi32)iLo - 1;
+}
+/*
+ * Step a run iterator forward or backward.
+ */
+static int lsmRunIterStep(lsm_iter *pIter,int iDir)
+{
+	lsm_run *pRun = pIter->pRun;
+	if( iDir > 0 ){
+		if( pIter->iOrd + 1 < pRun->aEntry[pIter->iEntry].nRec ){
+			return lsmRunIterLoad(pIter,pIter->iNextPage,pIter->iNextOfft,pIter->iEntry,pIter->iOrd + 1);
+		}
+		if( pIter->iEntry + 1 < pRun->nEntry ){
+			return lsmRunIterOrd(pIter,pIter->iEntry + 1,0);
+		}
+	}else{
+		if( pIter->iOrd > 0 ){
+			return lsmRunIterOrd(pIter,pIter->iEntry,pIter->iOrd - 1);
+		}
+		if( pIter->iEntry > 0 ){
+			return lsmRunIterOrd(pIter,pIter->iEntry - 1,pRun->aEntry[pIter->iEntry - 1].nRec - 1);
+		}
+	}
+	pIter->bValid = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Position a run iterator relative to a key.
+ */
+static int lsmRunIterSeek(lsm_iter *pIter,const void *pKey,sxu32 nKey,int iMode)
+{
+	lsm_kv_engine *pEngine = pIter->pEngine;
+	lsm_run *pRun = pIter->pRun;
+	pgno iPrevPage = 0;
+	sxu32 iPrevOfft = 0;
+	sxi32 iEntry,iCmp;
+	int rc;
+	pIter->bValid = 0;
+	if( pRun->nEntry < 1 ){
+		return UNQLITE_OK;
+	}
+	switch(iMode){
+	case LSM_SEEK_FIRST:
+		return lsmRunIterOrd(pIter,0,0);
+	case LSM_SEEK_LAST:
+		return lsmRunIterOrd(pIter,pRun->nEntry - 1,pRun->aEntry[pRun->nEntry - 1].nRec - 1);
+	default:
+		break;
+	}
+	iEntry = lsmRunFindEntry(pEngine,pRun,pKey,nKey);
+	if( iEntry < 0 ){
+		/* All the keys are greater */
+		return iMode == LSM_SEEK_GE ? lsmRunIterOrd(pIter,0,0) : UNQLITE_OK;
+	}
+	rc = lsmRunIterOrd(pIter,(sxu32)iEntry,0);
+	for(;;){
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		iCmp = lsmKeyCmp(pEngine,SyBlobData(&pIter->sKey),SyBlobLength(&pIter->sKey),pKey,nKey);
+		if( iCmp == 0 ){
+			return UNQLITE_OK;
+		}
+		if( iCmp > 0 ){
+			if( iMode == LSM_SEEK_GE ){
+				return UNQLITE_OK;
+			}
+			/* Back to the previous record (The first record of the entry is always less than the key) */
+			return lsmRunIterLoad(pIter,iPrevPage,iPrevOfft,(sxu32)iEntry,pIter->iOrd - 1);
+		}
+		if( pIter->iOrd + 1 >= pRun->aEntry[iEntry].nRec ){
+			/* Last record of the entry */
+			if( iMode == LSM_SEEK_LE ){
+				return UNQLITE_OK;
+			}
+			return lsmRunIterStep(pIter,1);
+		}
+		/* Remember the start of the current record */
+		iPrevPage = pIter->iRecPage;
+		iPrevOfft = pIter->iRecOfft;
+		rc = lsmRunIterLoad(pIter,pIter->iNextPage,pIter->iNextOfft,(sxu32)iEntry,pIter->iOrd + 1);
+	}
+}
+/*
+ * Position a memtable iterator.
+ */
+static void lsmMemIterSeek(lsm_iter *pIter,const void *pKey,sxu32 nKey,int iMode)
+{
+	lsm_kv_engine *pEngine = pIter->pEngine;
+	lsm_mem_node *pNode;
+	switch(iMode){
+	case LSM_SEEK_FIRST:
+		pNode = pEngine->pHead->apNext[0];
+		break;
+	case LSM_SEEK_LAST:
+		pNode = pEngine->pLast;
+		break;
+	default:
+		pNode = lsmMemSeek(pEngine,pKey,nKey,0);
+		if( iMode == LSM_SEEK_LE ){
+			if( pNode == 0 ){
+				pNode = pEngine->pLast;
+			}else if( lsmKeyCmp(pEngine,LSM_NODE_KEY(pNode),pNode->nKey,pKey,nKey) != 0 ){
+				pNode = pNode->pPrev;
+			}
+		}
+		break;
+	}
+	pIter->pNode = pNode;
+	pIter->bValid = pNode != 0;
+}
+/*
+ * Position an iterator relative to the given key.
+ */
+static int lsmIterSeek(lsm_iter *pIter,const void *pKey,sxu32 nKey,int iMode)
+{
+	if( pIter->pRun == 0 ){
+		lsmMemIterSeek(pIter,pKey,nKey,iMode);
+		return UNQLITE_OK;
+	}
+	return lsmRunIterSeek(pIter,pKey,nKey,iMode);
+}
+/*
+ * Step an iterator forward (iDir > 0) or backward.
+ */
+static int lsmIterStep(lsm_iter *pIter,int iDir)
+{
+	if( pIter->pRun == 0 ){
+		pIter->pNode = iDir > 0 ? pIter->pNode->apNext[0] : pIter->pNode->pPrev;
+		pIter->bValid = pIter->pNode != 0;
+		return UNQLITE_OK;
+	}
+	return lsmRunIterStep(pIter,iDir);
+}
+/*
+ * Compare the current key of an iterator with the given key.
+ */
+static sxi32 lsmIterCmp(lsm_iter *pIter,const void *pKey,sxu32 nKey)
+{
+	const unsigned char *zKey;
+	sxu32 n;
+	lsmIterKey(pIter,&zKey,&n);
+	return lsmKeyCmp(pIter->pEngine,zKey,n,pKey,nKey);
+}
+/*
+ * Look up a key in the memtable then in each run from the newest to the oldest.
+ * On success, the returned iterator point to the most recent version of the record.
+ * UNQLITE_NOTFOUND is returned when the key does not exist or was deleted.
+ */
+static int lsmLookup(lsm_kv_engine *pEngine,lsm_iter *pIter,const void *pKey,sxu32 nKey)
+{
+	lsm_run *pRun;
+	sxu32 i;
+	int rc;
+	lsmIterInit(pIter,pEngine,0);
+	lsmMemIterSeek(pIter,pKey,nKey,LSM_SEEK_GE);
+	if( pIter->bValid && lsmIterCmp(pIter,pKey,nKey) == 0 ){
+		return (pIter->pNode->iFlags & LSM_REC_TOMBSTONE) ? UNQLITE_NOTFOUND : UNQLITE_OK;
+	}
+	for( i = 0 ; i < pEngine->nRun ; ++i ){
+		pRun = pEngine->apRun[i];
+		if( !lsmBloomTest(pRun,pKey,nKey) ){
+			/* Definitely not in this run */
+			continue;
+		}
+		lsmIterInit(pIter,pEngine,pRun);
+		rc = lsmRunIterSeek(pIter,pKey,nKey,LSM_SEEK_GE);
+		if( rc != UNQLITE_OK ){
+			pIter->bValid = 0;
+			return rc;
+		}
+		if( pIter->bValid && lsmIterCmp(pIter,pKey,nKey) == 0 ){
+			return (pIter->iFlags & LSM_REC_TOMBSTONE) ? UNQLITE_NOTFOUND : UNQLITE_OK;
+		}
+	}
+	pIter->bValid = 0;
+	return UNQLITE_NOTFOUND;
+}
+/*
+ * Select the current iterator of a merger: The smallest key when moving forward, the
+ * largest when moving backward. On ties, the newest source (lowest index) win.
+ */
+static void lsmMergerPick(lsm_merger *pMerger)
+{
+	const unsigned char *zBest = 0,*zKey;
+	sxu32 nBest = 0,nKey;
+	sxi32 iCmp;
+	sxu32 i;
+	pMerger->iCur = -1;
+	for( i = 0 ; i < pMerger->nIter ; ++i ){
+		lsm_iter *pIter = &pMerger->aIter[i];
+		if( !pIter->bValid ){
+			continue;
+		}
+		lsmIterKey(pIter,&zKey,&nKey);
+		if( pMerger->iCur >= 0 ){
+			iCmp = lsmKeyCmp(pIter->pEngine,zKey,nKey,zBest,nBest) * pMerger->iDir;
+			if( iCmp >= 0 ){
+				continue;
+			}
+		}
+		pMerger->iCur = (sxi32)i;
+		zBest = zKey;
+		nBest = nKey;
+	}
+}
+/*
+ * Move every iterator positioned on the current key past it and select the next entry.
+ */
+static int lsmMergerAdvance(lsm_merger *pMerger)
+{
+	lsm_iter *pCur = &pMerger->aIter[pMerger->iCur];
+	const unsigned char *zKey;
+	sxu32 nKey,i;
+	int rc;
+	lsmIterKey(pCur,&zKey,&nKey);
+	SyBlobReset(&pMerger->sKey);
+	rc = SyBlobAppend(&pMerger->sKey,(const void *)zKey,nKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	for( i = 0 ; i < pMerger->nIter ; ++i ){
+		lsm_iter *pIter = &pMerger->aIter[i];
+		if( pIter->bValid && lsmIterCmp(pIter,SyBlobData(&pMerger->sKey),SyBlobLength(&pMerger->sKey)) == 0 ){
+			rc = lsmIterStep(pIter,pMerger->iDir);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+		}
+	}
+	lsmMergerPick(pMerger);
+	return UNQLITE_OK;
+}
+/*
+ * Select the current entry, skipping deleted records unless requested otherwise.
+ */
+static int lsmMergerSettle(lsm_merger *pMerger)
+{
+	int rc;
+	lsmMergerPick(pMerger);
+	while( pMerger->iCur >= 0 && !pMerger->bTombstone
+		&& (lsmIterFlags(&pMerger->aIter[pMerger->iCur]) & LSM_REC_TOMBSTONE) ){
+			rc = lsmMergerAdvance(pMerger);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Position a merger relative to the given key.
+ */
+static int lsmMergerSeek(lsm_merger *pMerger,const void *pKey,sxu32 nKey,int iMode)
+{
+	sxu32 i;
+	int rc;
+	pMerger->iDir = (iMode == LSM_SEEK_GE || iMode == LSM_SEEK_FIRST) ? 1 : -1;
+	for( i = 0 ; i < pMerger->nIter ; ++i ){
+		rc = lsmIterSeek(&pMerger->aIter[i],pKey,nKey,iMode);
+		if( rc != UNQLITE_OK ){
+			pMerger->iCur = -1;
+			return rc;
+		}
+	}
+	return lsmMergerSettle(pMerger);
+}
+/*
+ * Step a merger in its current direction.
+ */
+static int lsmMergerNext(lsm_merger *pMerger)
+{
+	int rc;
+	if( pMerger->iCur < 0 ){
+		return UNQLITE_OK;
+	}
+	rc = lsmMergerAdvance(pMerger);
+	if( rc != UNQLITE_OK ){
+		pMerger->iCur = -1;
+		return rc;
+	}
+	return lsmMergerSettle(pMerger);
+}
+/*
+ * Release the memory held by a run.
+ */
+static void lsmRunFree(lsm_kv_engine *pEngine,lsm_run *pRun)
+{
+	if( pRun->aEntry ){
+		SyMemBackendFree(&pEngine->sAllocator,pRun->aEntry);
+	}
+	if( pRun->zBloom ){
+		SyMemBackendFree(&pEngine->sAllocator,pRun->zBloom);
+	}
+	SyBlobRelease(&pRun->sKeys);
+	SyMemBackendFree(&pEngine->sAllocator,pRun);
+}
+/*
+ * Allocate a new run.
+ */
+static lsm_run * lsmRunNew(lsm_kv_engine *pEngine,sxu32 iLevel,sxu32 nBloom)
+{
+	lsm_run *pRun;
+	pRun = (lsm_run *)SyMemBackendAlloc(&pEngine->sAllocator,sizeof(lsm_run));
+	if( pRun == 0 ){
+		return 0;
+	}
+	SyZero(pRun,sizeof(lsm_run));
+	pRun->iLevel = iLevel;
+	SyBlobInit(&pRun->sKeys,&pEngine->sAllocator);
+	if( nBloom > 0 ){
+		pRun->zBloom = (unsigned char *)SyMemBackendAlloc(&pEngine->sAllocator,nBloom);
+		if( pRun->zBloom == 0 ){
+			lsmRunFree(pEngine,pRun);
+			return 0;
+		}
+		SyZero(pRun->zBloom,nBloom);
+		pRun->nBloom = nBloom;
+	}
+	return pRun;
+}
+/*
+ * Append an entry to the in-memory index of a run.
+ */
+static int lsmRunAddEntry(lsm_kv_engine *pEngine,lsm_run *pRun,pgno iPage,sxu32 iOfft,sxu32 nRec,const void *pKey,sxu32 nKey)
+{
+	lsm_entry *pEntry;
+	int rc;
+	if( (pRun->nEntry & 63) == 0 ){
+		lsm_entry *aNew;
+		aNew = (lsm_entry *)SyMemBackendRealloc(&pEngine->sAllocator,pRun->aEntry,(pRun->nEntry + 64) * sizeof(lsm_entry));
+		if( aNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		pRun->aEntry = aNew;
+	}
+	pEntry = &pRun->aEntry[pRun->nEntry];
+	pEntry->iPage = iPage;
+	pEntry->iOfft = iOfft;
+	pEntry->nRec = nRec;
+	pEntry->iKey = SyBlobLength(&pRun->sKeys);
+	pEntry->nKey = nKey;
+	rc = SyBlobAppend(&pRun->sKeys,pKey,nKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pRun->nEntry++;
+	return UNQLITE_OK;
+}
+/*
+ * Write a run from the merger entries.
+ * Deleted records are written only when bTombstone is set in the merger.
+ */
+static int lsmRunWrite(lsm_kv_engine *pEngine,lsm_merger *pMerger,sxu32 iLevel,sxu64 nEstimate,lsm_run **ppRun)
+{
+	unsigned char zHdr[LSM_REC_HDR_SZ];
+	const unsigned char *zKey;
+	lsm_writer sWriter;
+	lsm_iter *pIter;
+	lsm_entry *pEntry;
+	lsm_run *pRun;
+	sxu64 nBits;
+	sxu32 nKey,i;
+	int rc;
+	/* Size the Bloom filter for the worst case (No shadowed records) */
+	nBits = nEstimate * LSM_BLOOM_BITS;
+	if( nBits < 64 ){
+		nBits = 64;
+	}
+	pRun = lsmRunNew(pEngine,iLevel,(sxu32)((nBits + 7) >> 3));
+	if( pRun == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	*ppRun = 0;
+	lsmWriterInit(&sWriter,pEngine);
+	rc = UNQLITE_OK;
+	while( pMerger->iCur >= 0 ){
+		pIter = &pMerger->aIter[pMerger->iCur];
+		lsmIterKey(pIter,&zKey,&nKey);
+		/* Make sure the record start position is known */
+		rc = lsmWriterReserve(&sWriter);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		if( pRun->nEntry < 1 || pRun->aEntry[pRun->nEntry - 1].iPage != sWriter.pPage->pgno ){
+			/* First record starting in this page */
+			rc = lsmRunAddEntry(pEngine,pRun,sWriter.pPage->pgno,sWriter.iOfft,0,zKey,nKey);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+		}
+		pRun->aEntry[pRun->nEntry - 1].nRec++;
+		pRun->nRec++;
+		lsmBloomAdd(pRun,zKey,nKey);
+		zHdr[0] = lsmIterFlags(pIter);
+		SyBigEndianPack32(&zHdr[1],nKey);
+		SyBigEndianPack64(&zHdr[5],lsmIterDataLength(pIter));
+		rc = lsmWriterWrite(&sWriter,zHdr,LSM_REC_HDR_SZ);
+		if( rc == UNQLITE_OK ){
+			rc = lsmWriterWrite(&sWriter,zKey,nKey);
+		}
+		if( rc == UNQLITE_OK ){
+			rc = lsmIterData(pIter,0,lsmIterDataLength(pIter),lsmWriterConsumer,&sWriter);
+		}
+		if( rc == UNQLITE_OK ){
+			rc = lsmMergerNext(pMerger);
+		}
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+	}
+	pRun->iData = sWriter.iFirst;
+	lsmWriterClose(&sWriter);
+	if( rc == UNQLITE_OK && pRun->nEntry > 0 ){
+		/* The index stream */
+		lsmWriterInit(&sWriter,pEngine);
+		for( i = 0 ; i < pRun->nEntry ; ++i ){
+			pEntry = &pRun->aEntry[i];
+			SyBigEndianPack64(zHdr,pEntry->iPage);
+			rc = lsmWriterWrite(&sWriter,zHdr,sizeof(sxu64));
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			SyBigEndianPack32(zHdr,pEntry->iOfft);
+			SyBigEndianPack32(&zHdr[4],pEntry->nRec);
+			SyBigEndianPack32(&zHdr[8],pEntry->nKey);
+			rc = lsmWriterWrite(&sWriter,zHdr,3 * sizeof(sxu32));
+			if( rc == UNQLITE_OK ){
+				rc = lsmWriterWrite(&sWriter,&((const unsigned char *)SyBlobData(&pRun->sKeys))[pEntry->iKey],pEntry->nKey);
+			}
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+		}
+		pRun->iIndex = sWriter.iFirst;
+		lsmWriterClose(&sWriter);
+		if( rc == UNQLITE_OK ){
+			/* The Bloom filter */
+			lsmWriterInit(&sWriter,pEngine);
+			rc = lsmWriterWrite(&sWriter,pRun->zBloom,pRun->nBloom);
+			pRun->iBloom = sWriter.iFirst;
+			lsmWriterClose(&sWriter);
+		}
+	}
+	if( rc != UNQLITE_OK || pRun->nEntry < 1 ){
+		/* Nothing to keep (The pages are reclaimed by the rollback on failure) */
+		lsmRunFree(pEngine,pRun);
+		return rc;
+	}
+	*ppRun = pRun;
+	return UNQLITE_OK;
+}
+/*
+ * Write the manifest (The list of live runs) and release the previous one.
+ */
+static int lsmWriteManifest(lsm_kv_engine *pEngine)
+{
+	unsigned char zBuf[44];
+	lsm_writer sWriter;
+	pgno iOld = pEngine->iManifest;
+	lsm_run *pRun;
+	sxu32 i;
+	int rc;
+	lsmWriterInit(&sWriter,pEngine);
+	SyBigEndianPack32(zBuf,pEngine->nRun);
+	rc = lsmWriterWrite(&sWriter,zBuf,sizeof(sxu32));
+	for( i = 0 ; rc == UNQLITE_OK && i < pEngine->nRun ; ++i ){
+		pRun = pEngine->apRun[i];
+		SyBigEndianPack32(zBuf,pRun->iLevel);
+		SyBigEndianPack64(&zBuf[4],pRun->nRec);
+		SyBigEndianPack64(&zBuf[12],pRun->iData);
+		SyBigEndianPack64(&zBuf[20],pRun->iIndex);
+		SyBigEndianPack64(&zBuf[28],pRun->iBloom);
+		SyBigEndianPack32(&zBuf[36],pRun->nEntry);
+		SyBigEndianPack32(&zBuf[40],pRun->nBloom);
+		rc = lsmWriterWrite(&sWriter,zBuf,sizeof(zBuf));
+	}
+	lsmWriterClose(&sWriter);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pEngine->iManifest = sWriter.iFirst;
+	rc = lsmWriteHeader(pEngine);
+	if( rc == UNQLITE_OK ){
+		rc = lsmFreeStream(pEngine,iOld);
+	}
+	return rc;
+}
+/*
+ * Link a run to the list of live runs. The list is ordered by level and
+ * from the newest to the oldest run within the same level.
+ * When bAppend is set, the run is older than any other run of its level.
+ */
+static int lsmRunLink(lsm_kv_engine *pEngine,lsm_run *pRun,int bAppend)
+{
+	sxu32 i,j;
+	if( pEngine->nRun >= pEngine->nRunAlloc ){
+		lsm_run **apNew;
+		sxu32 nNew = pEngine->nRunAlloc + 16;
+		apNew = (lsm_run **)SyMemBackendRealloc(&pEngine->sAllocator,(void *)pEngine->apRun,nNew * sizeof(lsm_run *));
+		if( apNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		pEngine->apRun = apNew;
+		pEngine->nRunAlloc = nNew;
+	}
+	for( i = 0 ; i < pEngine->nRun ; ++i ){
+		if( pEngine->apRun[i]->iLevel > pRun->iLevel || (!bAppend && pEngine->apRun[i]->iLevel == pRun->iLevel) ){
+			break;
+		}
+	}
+	for( j = pEngine->nRun ; j > i ; --j ){
+		pEngine->apRun[j] = pEngine->apRun[j - 1];
+	}
+	pEngine->apRun[i] = pRun;
+	pEngine->nRun++;
+	return UNQLITE_OK;
+}
+/*
+ * Release the in-memory state of the live runs.
+ */
+static void lsmRunsRelease(lsm_kv_engine *pEngine)
+{
+	sxu32 i;
+	for( i = 0 ; i < pEngine->nRun ; ++i ){
+		lsmRunFree(pEngine,pEngine->apRun[i]);
+	}
+	pEngine->nRun = 0;
+}
+/*
+ * Merge the runs of a full level into a single run at the next level.
+ */
+static int lsmCompactLevel(lsm_kv_engine *pEngine,sxu32 iFirst,sxu32 nRun)
+{
+	lsm_merger sMerger;
+	lsm_run *pRun = 0;
+	sxu64 nEstimate = 0;
+	sxu32 iLevel,i;
+	int rc;
+	iLevel = pEngine->apRun[iFirst]->iLevel;
+	sMerger.aIter = (lsm_iter *)SyMemBackendAlloc(&pEngine->sAllocator,nRun * sizeof(lsm_iter));
+	if( sMerger.aIter == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	for( i = 0 ; i < nRun ; ++i ){
+		SyBlobInit(&sMerger.aIter[i].sKey,&pEngine->sAllocator);
+		lsmIterInit(&sMerger.aIter[i],pEngine,pEngine->apRun[iFirst + i]);
+		nEstimate += pEngine->apRun[iFirst + i]->nRec;
+	}
+	sMerger.nIter = nRun;
+	/* Tombstones can be dropped when no older run remain */
+	sMerger.bTombstone = iFirst + nRun < pEngine->nRun;
+	SyBlobInit(&sMerger.sKey,&pEngine->sAllocator);
+	rc = lsmMergerSeek(&sMerger,0,0,LSM_SEEK_FIRST);
+	if( rc == UNQLITE_OK ){
+		rc = lsmRunWrite(pEngine,&sMerger,iLevel + 1,nEstimate,&pRun);
+	}
+	for( i = 0 ; i < nRun ; ++i ){
+		SyBlobRelease(&sMerger.aIter[i].sKey);
+	}
+	SyBlobRelease(&sMerger.sKey);
+	SyMemBackendFree(&pEngine->sAllocator,sMerger.aIter);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Release the merged runs */
+	for( i = 0 ; i < nRun ; ++i ){
+		lsm_run *pOld = pEngine->apRun[iFirst + i];
+		rc = lsmFreeStream(pEngine,pOld->iData);
+		if( rc == UNQLITE_OK ){
+			rc = lsmFreeStream(pEngine,pOld->iIndex);
+		}
+		if( rc == UNQLITE_OK ){
+			rc = lsmFreeStream(pEngine,pOld->iBloom);
+		}
+		lsmRunFree(pEngine,pOld);
+		if( rc != UNQLITE_OK ){
+			/* Unlink the remaining runs, the rollback reload the previous state */
+			pEngine->apRun[iFirst + i] = 0;
+			for( ++i ; i < nRun ; ++i ){
+				lsmRunFree(pEngine,pEngine->apRun[iFirst + i]);
+			}
+			pEngine->nRun = iFirst;
+			if( pRun ){
+				lsmRunFree(pEngine,pRun);
+			}
+			return rc;
+		}
+	}
+	for( i = iFirst + nRun ; i < pEngine->nRun ; ++i ){
+		pEngine->apRun[i - nRun] = pEngine->apRun[i];
+	}
+	pEngine->nRun -= nRun;
+	if( pRun ){
+		rc = lsmRunLink(pEngine,pRun,0);
+		if( rc != UNQLITE_OK ){
+			lsmRunFree(pEngine,pRun);
+		}
+	}
+	return rc;
+}
+/*
+ * Merge every level holding LSM_FANOUT runs or more.
+ */
+static int lsmCompact(lsm_kv_engine *pEngine)
+{
+	sxu32 i,j;
+	int rc;
+	i = 0;
+	while( i < pEngine->nRun ){
+		j = i;
+		while( j < pEngine->nRun && pEngine->apRun[j]->iLevel == pEngine->apRun[i]->iLevel ){
+			j++;
+		}
+		if( j - i >= LSM_FANOUT ){
+			rc = lsmCompactLevel(pEngine,i,j - i);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			/* The merged run may fill the next level, rescan */
+			i = 0;
+			continue;
+		}
+		i = j;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Write the memtable content as a new level zero run and merge full levels.
+ */
+static int lsmFlush(lsm_kv_engine *pEngine)
+{
+	lsm_merger sMerger;
+	lsm_run *pRun = 0;
+	int rc;
+	if( pEngine->nMemEntry < 1 ){
+		return UNQLITE_OK;
+	}
+	pEngine->iGen++;
+	lsmIterInit(&pEngine->sProbe,pEngine,0);
+	sMerger.aIter = &pEngine->sProbe;
+	sMerger.nIter = 1;
+	/* Tombstones are useless when there is nothing to shadow */
+	sMerger.bTombstone = pEngine->nRun > 0;
+	SyBlobInit(&sMerger.sKey,&pEngine->sAllocator);
+	rc = lsmMergerSeek(&sMerger,0,0,LSM_SEEK_FIRST);
+	if( rc == UNQLITE_OK ){
+		rc = lsmRunWrite(pEngine,&sMerger,0,pEngine->nMemEntry,&pRun);
+	}
+	SyBlobRelease(&sMerger.sKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	lsmMemClear(pEngine);
+	if( pRun ){
+		rc = lsmRunLink(pEngine,pRun,0);
+		if( rc != UNQLITE_OK ){
+			lsmRunFree(pEngine,pRun);
+			return rc;
+		}
+		rc = lsmCompact(pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	return lsmWriteManifest(pEngine);
+}
+/*
+ * Load the in-memory index and the Bloom filter of a run.
+ */
+static int lsmRunLoad(lsm_kv_engine *pEngine,lsm_run *pRun,sxu32 nEntry)
+{
+	unsigned char zBuf[sizeof(sxu64) + 3 * sizeof(sxu32)];
+	lsm_reader sReader;
+	lsm_entry *pEntry;
+	sxu32 nRec,nKey,i;
+	int rc;
+	rc = lsmReaderOpen(&sReader,pEngine,pRun->iIndex,0);
+	for( i = 0 ; rc == UNQLITE_OK && i < nEntry ; ++i ){
+		rc = lsmReaderCopy(&sReader,zBuf,sizeof(zBuf));
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		SyBigEndianUnpack32(&zBuf[12],&nRec);
+		SyBigEndianUnpack32(&zBuf[16],&nKey);
+		SyBlobReset(&pEngine->sWorker);
+		rc = lsmReaderRead(&sReader,nKey,unqliteDataConsumer,&pEngine->sWorker);
+		if( rc == UNQLITE_OK ){
+			rc = lsmRunAddEntry(pEngine,pRun,0,0,nRec,SyBlobData(&pEngine->sWorker),nKey);
+		}
+		if( rc == UNQLITE_OK ){
+			pEntry = &pRun->aEntry[pRun->nEntry - 1];
+			SyBigEndianUnpack64(zBuf,&pEntry->iPage);
+			SyBigEndianUnpack32(&zBuf[8],&pEntry->iOfft);
+			if( nRec < 1 || pEntry->iPage < 2 ){
+				rc = UNQLITE_CORRUPT;
+			}
+		}
+	}
+	lsmReaderClose(&sReader);
+	if( rc == UNQLITE_OK && pRun->nBloom > 0 ){
+		rc = lsmReaderOpen(&sReader,pEngine,pRun->iBloom,0);
+		if( rc == UNQLITE_OK ){
+			rc = lsmReaderCopy(&sReader,pRun->zBloom,pRun->nBloom);
+		}
+		lsmReaderClose(&sReader);
+	}
+	if( rc == UNQLITE_CORRUPT ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Malformed LSM run index");
+	}
+	return rc;
+}
+/*
+ * Load the list of live runs from the manifest.
+ */
+static int lsmLoadRuns(lsm_kv_engine *pEngine)
+{
+	unsigned char zBuf[44];
+	lsm_reader sReader;
+	lsm_run *pRun;
+	sxu32 nRun,nEntry,nBloom,i;
+	int rc;
+	lsmRunsRelease(pEngine);
+	if( pEngine->iManifest < 1 ){
+		/* Empty database */
+		return UNQLITE_OK;
+	}
+	rc = lsmReaderOpen(&sReader,pEngine,pEngine->iManifest,0);
+	if( rc == UNQLITE_OK ){
+		rc = lsmReaderCopy(&sReader,zBuf,sizeof(sxu32));
+	}
+	if( rc == UNQLITE_OK ){
+		SyBigEndianUnpack32(zBuf,&nRun);
+		for( i = 0 ; i < nRun ; ++i ){
+			rc = lsmReaderCopy(&sReader,zBuf,sizeof(zBuf));
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			SyBigEndianUnpack32(&zBuf[40],&nBloom);
+			pRun = lsmRunNew(pEngine,0,nBloom);
+			if( pRun == 0 ){
+				rc = UNQLITE_NOMEM;
+				break;
+			}
+			SyBigEndianUnpack32(zBuf,&pRun->iLevel);
+			SyBigEndianUnpack64(&zBuf[4],&pRun->nRec);
+			SyBigEndianUnpack64(&zBuf[12],&pRun->iData);
+			SyBigEndianUnpack64(&zBuf[20],&pRun->iIndex);
+			SyBigEndianUnpack64(&zBuf[28],&pRun->iBloom);
+			SyBigEndianUnpack32(&zBuf[36],&nEntry);
+			rc = lsmRunLoad(pEngine,pRun,nEntry);
+			if( rc == UNQLITE_OK ){
+				rc = lsmRunLink(pEngine,pRun,1);
+			}
+			if( rc != UNQLITE_OK ){
+				lsmRunFree(pEngine,pRun);
+				break;
+			}
+		}
+	}
+	lsmReaderClose(&sReader);
+	if( rc != UNQLITE_OK ){
+		lsmRunsRelease(pEngine);
+	}
+	return rc;
+}
+/* Forward declaration */
+static int lsm_kv_open(unqlite_kv_engine *pKv,pgno dbSize);
+/*
+ * Read the database header (Page one) and reload the manifest if the database
+ * was modified since the last operation.
+ */
+static int lsmLoadHeader(lsm_kv_engine *pEngine)
+{
+	unqlite_page *pHeader;
+	sxu32 nMagic,iChange;
+	int rc;
+	if( !pEngine->bOpen ){
+		/* Acquire a shared lock, the pager invoke xOpen() at this stage */
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->pIo->xPageUnref(pHeader);
+		if( !pEngine->bOpen ){
+			/* In-memory database, xOpen() is never invoked by the pager */
+			return lsm_kv_open((unqlite_kv_engine *)pEngine,0);
+		}
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack32(pHeader->zData,&nMagic);
+	SyBigEndianUnpack32(&pHeader->zData[LSM_HDR_CHANGE_OFFT],&iChange);
+	if( nMagic != LSM_MAGIC ){
+		pEngine->pIo->xPageUnref(pHeader);
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Malformed LSM database header");
+		return UNQLITE_CORRUPT;
+	}
+	if( iChange == pEngine->iChange ){
+		pEngine->pIo->xPageUnref(pHeader);
+		return UNQLITE_OK;
+	}
+	/* Modified by another process */
+	pEngine->iChange = iChange;
+	SyBigEndianUnpack64(&pHeader->zData[LSM_HDR_MANIFEST_OFFT],&pEngine->iManifest);
+	SyBigEndianUnpack64(&pHeader->zData[LSM_HDR_FREE_OFFT],&pEngine->iFreeList);
+	pEngine->pIo->xPageUnref(pHeader);
+	pEngine->iGen++;
+	return lsmLoadRuns(pEngine);
+}
+/*
+ * Prepare for a write operation.
+ * The header page is marked dirty so that the pager enter the writer state and
+ * reset this engine (Discarding the memtable) if the transaction is rolled back.
+ */
+static int lsmBeginWrite(lsm_kv_engine *pEngine)
+{
+	unqlite_page *pHeader;
+	int rc;
+	rc = lsmLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pEngine->pIo->xWrite(pHeader);
+	pEngine->pIo->xPageUnref(pHeader);
+	return rc;
+}
+/*
+ * Store a record (Or a tombstone) in the memtable and flush it when full
+ * or early if the handle is short of memory.
+ */
+static int lsmRecordStore(lsm_kv_engine *pEngine,const void *pKey,sxu32 nKey,const void *pData,sxu64 nData,sxu8 iFlags)
+{
+	int rc;
+	pEngine->iGen++;
+	rc = lsmMemPut(pEngine,pKey,nKey,pData,nData,iFlags);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pEngine->nMemByte >= pEngine->nMemLimit ||
+		(pEngine->nMemByte >= LSM_MEMTABLE_MIN && SyMemAccountPressure(pEngine->sAllocator.pAccount)) ){
+		rc = lsmFlush(pEngine);
+	}
+	return rc;
+}
+/*
+ * Exported: xReplace() method.
+ */
+static int lsm_kv_replace(
+	unqlite_kv_engine *pKv,
+	const void *pKey,int nKeyLen,
+	const void *pData,unqlite_int64 nDataLen
+	)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pKv;
+	int rc;
+	rc = lsmBeginWrite(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return lsmRecordStore(pEngine,pKey,(sxu32)nKeyLen,pData,(sxu64)nDataLen,0);
+}
+/*
+ * Exported: xAppend() method.
+ */
+static int lsm_kv_append(
+	unqlite_kv_engine *pKv,
+	const void *pKey,int nKeyLen,
+	const void *pData,unqlite_int64 nDataLen
+	)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pKv;
+	int rc;
+	rc = lsmBeginWrite(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = lsmLookup(pEngine,&pEngine->sProbe,pKey,(sxu32)nKeyLen);
+	if( rc == UNQLITE_NOTFOUND ){
+		/* New record */
+		return lsmRecordStore(pEngine,pKey,(sxu32)nKeyLen,pData,(sxu64)nDataLen,0);
+	}else if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Load the old data */
+	SyBlobReset(&pEngine->sWorker);
+	rc = lsmIterData(&pEngine->sProbe,0,lsmIterDataLength(&pEngine->sProbe),unqliteDataConsumer,&pEngine->sWorker);
+	if( rc == UNQLITE_OK ){
+		rc = SyBlobAppend(&pEngine->sWorker,pData,(sxu32)nDataLen);
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return lsmRecordStore(pEngine,pKey,(sxu32)nKeyLen,SyBlobData(&pEngine->sWorker),SyBlobLength(&pEngine->sWorker),0);
+}
+/*
+ * Exported: xSync() method.
+ * Invoked by the pager before committing a transaction, the memtable is written
+ * out as a new run so that the committed data reach the disk.
+ */
+static int lsm_kv_sync(unqlite_kv_engine *pKv)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pKv;
+	if( !pEngine->bOpen || pEngine->nMemEntry < 1 ){
+		/* Nothing to flush */
+		return UNQLITE_OK;
+	}
+	return lsmFlush(pEngine);
+}
+/*
+ * Exported: xInit() method.
+ */
+static int lsm_kv_init(unqlite_kv_engine *pKv,int iPageSize)
+{
+	static sxu32 nEpoch = 0;
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pKv;
+	/* This structure is always zeroed, go to the initialization directly */
+	SyMemBackendInitFromParent(&pEngine->sAllocator,unqliteKvIoMemBackend(pKv->pIo));
+	pEngine->xCmp = SyMemcmp;
+	pEngine->nPayload = (sxu32)iPageSize - LSM_STREAM_HDR_SZ;
+	pEngine->nMemLimit = LSM_MEMTABLE_SIZE;
+	pEngine->iRand = 0x2545F491;
+	/* Cursors compare generations to detect changes, keep them distinct across engine resets */
+	nEpoch++;
+	pEngine->iGen = nEpoch << 20;
+	SyBlobInit(&pEngine->sWorker,&pEngine->sAllocator);
+	SyBlobInit(&pEngine->sProbe.sKey,&pEngine->sAllocator);
+	/* Skip list head */
+	pEngine->pHead = (lsm_mem_node *)SyMemBackendAlloc(&pEngine->sAllocator,
+		sizeof(lsm_mem_node) + (LSM_MAX_HEIGHT - 1) * sizeof(lsm_mem_node *));
+	if( pEngine->pHead == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pEngine->pHead,sizeof(lsm_mem_node) + (LSM_MAX_HEIGHT - 1) * sizeof(lsm_mem_node *));
+	pEngine->pHead->nHeight = LSM_MAX_HEIGHT;
+	pEngine->nHeight = 1;
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xRelease() method.
+ */
+static void lsm_kv_release(unqlite_kv_engine *pKv)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pKv;
+	/* Release the private memory backend */
+	SyMemBackendRelease(&pEngine->sAllocator);
+}
+/*
+ * Exported: xOpen() method.
+ */
+static int lsm_kv_open(unqlite_kv_engine *pKv,pgno dbSize)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pKv;
+	unqlite_page *pHeader;
+	sxu32 nMagic;
+	int rc;
+	pEngine->nPayload = (sxu32)pEngine->pIo->xPageSize(pEngine->pIo->pHandle) - LSM_STREAM_HDR_SZ;
+	if( dbSize < 1 ){
+		/* A new database, write the header */
+		rc = pEngine->pIo->xNew(pEngine->pIo->pHandle,&pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = pEngine->pIo->xWrite(pHeader);
+		if( rc == UNQLITE_OK ){
+			pEngine->iChange = 1;
+			pEngine->iManifest = pEngine->iFreeList = 0;
+			SyBigEndianPack32(pHeader->zData,LSM_MAGIC);
+			SyBigEndianPack32(&pHeader->zData[LSM_HDR_CHANGE_OFFT],pEngine->iChange);
+			SyBigEndianPack64(&pHeader->zData[LSM_HDR_MANIFEST_OFFT],0);
+			SyBigEndianPack64(&pHeader->zData[LSM_HDR_FREE_OFFT],0);
+		}
+		pEngine->pIo->xPageUnref(pHeader);
+		lsmRunsRelease(pEngine);
+	}else{
+		rc = pEngine->pIo->xGet(pEngine->pIo->pHandle,1,&pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		SyBigEndianUnpack32(pHeader->zData,&nMagic);
+		SyBigEndianUnpack32(&pHeader->zData[LSM_HDR_CHANGE_OFFT],&pEngine->iChange);
+		SyBigEndianUnpack64(&pHeader->zData[LSM_HDR_MANIFEST_OFFT],&pEngine->iManifest);
+		SyBigEndianUnpack64(&pHeader->zData[LSM_HDR_FREE_OFFT],&pEngine->iFreeList);
+		pEngine->pIo->xPageUnref(pHeader);
+		if( nMagic != LSM_MAGIC ){
+			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Not a LSM database");
+			return UNQLITE_CORRUPT;
+		}
+		rc = lsmLoadRuns(pEngine);
+	}
+	if( rc == UNQLITE_OK ){
+		pEngine->iGen++;
+		pEngine->bOpen = 1;
+	}
+	return rc;
+}
+/*
+ * Exported: xConfig() method.
+ */
+static int lsm_kv_config(unqlite_kv_engine *pKv,int iOp,va_list ap)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pKv;
+	int rc = UNQLITE_OK;
+	switch(iOp){
+	case UNQLITE_KV_CONFIG_CMP_FUNC: {
+		/* Key comparison function */
+		ProcCmp xCmp = va_arg(ap,ProcCmp);
+		if( pEngine->bOpen ){
+			/* Records are already ordered using the current function */
+			rc = lsmLoadHeader(pEngine);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			if( pEngine->nRun > 0 || pEngine->nMemEntry > 0 ){
+				rc = UNQLITE_LOCKED;
+				break;
+			}
+		}
+		if( xCmp ){
+			pEngine->xCmp = xCmp;
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_MEMTABLE_SIZE: {
+		/* Memtable flush threshold */
+		int nByte = va_arg(ap,int);
+		if( nByte < 1 ){
+			rc = UNQLITE_INVALID;
+		}else{
+			pEngine->nMemLimit = (sxu64)nByte;
+		}
+		break;
+										  }
+	default:
+		/* Unknown configuration option */
+		rc = UNQLITE_UNKNOWN;
+		break;
+	}
+	return rc;
+}
+/*
+ * LSM cursor states.
+ */
+#define LSM_CURSOR_INVALID 0 /* Not pointing to a record */
+#define LSM_CURSOR_POINT   1 /* Positioned by a point lookup */
+#define LSM_CURSOR_MERGE   2 /* Positioned by the merger */
+/*
+ * Each LSM cursor is represented by an instance of the following structure.
+ * The cursor memory come from the global allocator since the engine memory
+ * is released on rollback.
+ */
+typedef struct lsm_kv_cursor lsm_kv_cursor;
+struct lsm_kv_cursor
+{
+	unqlite_kv_engine *pStore;  /* Must be first */
+	/* Private fields */
+	int iState;                 /* LSM_CURSOR_* */
+	sxu32 iGen;                 /* Engine generation when the cursor was positioned */
+	SyBlob sKey;                /* Current key */
+	lsm_iter sPoint;            /* Point lookup result */
+	lsm_merger sMerger;         /* Merge of the memtable and the runs */
+	sxu32 nAlloc;               /* Allocated merger iterators */
+};
+/*
+ * Exported: xCursorInit() method.
+ */
+static void lsmCursorInit(unqlite_kv_cursor *pCursor)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	pCur->iState = LSM_CURSOR_INVALID;
+	pCur->iGen = 0;
+	SyBlobInit(&pCur->sKey,pAlloc);
+	SyBlobInit(&pCur->sPoint.sKey,pAlloc);
+	SyBlobInit(&pCur->sMerger.sKey,pAlloc);
+	pCur->sMerger.aIter = 0;
+	pCur->sMerger.nIter = 0;
+	pCur->sMerger.iCur = -1;
+	pCur->nAlloc = 0;
+}
+/*
+ * Exported: xCursorRelease() method.
+ */
+static void lsmCursorRelease(unqlite_kv_cursor *pCursor)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	sxu32 i;
+	SyBlobRelease(&pCur->sKey);
+	SyBlobRelease(&pCur->sPoint.sKey);
+	SyBlobRelease(&pCur->sMerger.sKey);
+	for( i = 0 ; i < pCur->nAlloc ; ++i ){
+		SyBlobRelease(&pCur->sMerger.aIter[i].sKey);
+	}
+	if( pCur->sMerger.aIter ){
+		SyMemBackendFree((SyMemBackend *)unqliteExportMemBackend(),pCur->sMerger.aIter);
+	}
+}
+/*
+ * Exported: xReset() method.
+ */
+static void lsmCursorReset(unqlite_kv_cursor *pCursor)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	pCur->iState = LSM_CURSOR_INVALID;
+	SyBlobReset(&pCur->sKey);
+}
+/*
+ * Record the current key of the given iterator.
+ */
+static int lsmCursorSet(lsm_kv_cursor *pCur,lsm_iter *pIter,int iState)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pCur->pStore;
+	const unsigned char *zKey;
+	sxu32 nKey;
+	int rc;
+	lsmIterKey(pIter,&zKey,&nKey);
+	SyBlobReset(&pCur->sKey);
+	rc = SyBlobAppend(&pCur->sKey,(const void *)zKey,nKey);
+	if( rc != UNQLITE_OK ){
+		pCur->iState = LSM_CURSOR_INVALID;
+		return rc;
+	}
+	pCur->iState = iState;
+	pCur->iGen = pEngine->iGen;
+	return UNQLITE_OK;
+}
+/*
+ * Position the merger of a cursor relative to the given key.
+ * When bSkip is set, an entry equal to the key is skipped.
+ * UNQLITE_DONE is returned when no entry satisfy the request.
+ */
+static int lsmCursorMoveTo(lsm_kv_cursor *pCur,const void *pKey,sxu32 nKey,int iMode,int bSkip)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pCur->pStore;
+	lsm_merger *pMerger = &pCur->sMerger;
+	sxu32 i;
+	int rc;
+	pCur->iState = LSM_CURSOR_INVALID;
+	rc = lsmLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pCur->nAlloc < pEngine->nRun + 1 ){
+		SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+		lsm_iter *aNew;
+		sxu32 nNew = pEngine->nRun + 8;
+		aNew = (lsm_iter *)SyMemBackendRealloc(pAlloc,pMerger->aIter,nNew * sizeof(lsm_iter));
+		if( aNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		for( i = pCur->nAlloc ; i < nNew ; ++i ){
+			SyBlobInit(&aNew[i].sKey,pAlloc);
+		}
+		pMerger->aIter = aNew;
+		pCur->nAlloc = nNew;
+	}
+	/* The memtable first since it hold the most recent data */
+	lsmIterInit(&pMerger->aIter[0],pEngine,0);
+	for( i = 0 ; i < pEngine->nRun ; ++i ){
+		lsmIterInit(&pMerger->aIter[i + 1],pEngine,pEngine->apRun[i]);
+	}
+	pMerger->nIter = pEngine->nRun + 1;
+	pMerger->bTombstone = 0;
+	rc = lsmMergerSeek(pMerger,pKey,nKey,iMode);
+	if( rc == UNQLITE_OK && bSkip && pMerger->iCur >= 0
+		&& lsmIterCmp(&pMerger->aIter[pMerger->iCur],pKey,nKey) == 0 ){
+			rc = lsmMergerNext(pMerger);
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pMerger->iCur < 0 ){
+		return UNQLITE_DONE;
+	}
+	return lsmCursorSet(pCur,&pMerger->aIter[pMerger->iCur],LSM_CURSOR_MERGE);
+}
+/*
+ * Move to the entry following (iDir > 0) or preceding the current one.
+ */
+static int lsmCursorStep(lsm_kv_cursor *pCur,int iDir)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pCur->pStore;
+	lsm_merger *pMerger = &pCur->sMerger;
+	int rc;
+	if( pCur->iState == LSM_CURSOR_INVALID ){
+		return UNQLITE_INVALID;
+	}
+	rc = lsmLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pCur->iState != LSM_CURSOR_MERGE || pCur->iGen != pEngine->iGen || pMerger->iDir != iDir ){
+		/* Reposition the merger relative to the recorded key. Work on a copy since the
+		 * key buffer is overwritten on success.
+		 */
+		SyBlobReset(&pEngine->sWorker);
+		SyBlobDup(&pCur->sKey,&pEngine->sWorker);
+		return lsmCursorMoveTo(pCur,SyBlobData(&pEngine->sWorker),SyBlobLength(&pEngine->sWorker),
+			iDir > 0 ? LSM_SEEK_GE : LSM_SEEK_LE,1);
+	}
+	rc = lsmMergerNext(pMerger);
+	if( rc != UNQLITE_OK ){
+		pCur->iState = LSM_CURSOR_INVALID;
+		return rc;
+	}
+	if( pMerger->iCur < 0 ){
+		pCur->iState = LSM_CURSOR_INVALID;
+		return UNQLITE_DONE;
+	}
+	return lsmCursorSet(pCur,&pMerger->aIter[pMerger->iCur],LSM_CURSOR_MERGE);
+}
+/*
+ * Locate the record the cursor point to.
+ */
+static int lsmCursorRecord(lsm_kv_cursor *pCur,lsm_iter **ppIter)
+{
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pCur->pStore;
+	int rc;
+	if( pCur->iState == LSM_CURSOR_INVALID ){
+		return UNQLITE_INVALID;
+	}
+	rc = lsmLoadHeader(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pCur->iGen != pEngine->iGen ){
+		/* The database was modified, look up the key again */
+		rc = lsmLookup(pEngine,&pCur->sPoint,SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey));
+		if( rc != UNQLITE_OK ){
+			/* The entry was removed */
+			return rc == UNQLITE_NOTFOUND ? UNQLITE_INVALID : rc;
+		}
+		pCur->iState = LSM_CURSOR_POINT;
+		pCur->iGen = pEngine->iGen;
+	}
+	*ppIter = pCur->iState == LSM_CURSOR_POINT ? &pCur->sPoint : &pCur->sMerger.aIter[pCur->sMerger.iCur];
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xSeek() method.
+ */
+static int lsmCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nByte,int iPos)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pCur->pStore;
+	int rc;
+	pCur->iState = LSM_CURSOR_INVALID;
+	switch(iPos){
+	case UNQLITE_CURSOR_MATCH_GE:
+	case UNQLITE_CURSOR_MATCH_LE:
+		rc = lsmCursorMoveTo(pCur,pKey,(sxu32)nByte,iPos == UNQLITE_CURSOR_MATCH_GE ? LSM_SEEK_GE : LSM_SEEK_LE,0);
+		break;
+	default:
+		/* Point lookup, take advantage of the Bloom filters */
+		rc = lsmLoadHeader(pEngine);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		rc = lsmLookup(pEngine,&pCur->sPoint,pKey,(sxu32)nByte);
+		if( rc == UNQLITE_OK ){
+			rc = lsmCursorSet(pCur,&pCur->sPoint,LSM_CURSOR_POINT);
+		}
+		break;
+	}
+	return rc == UNQLITE_DONE ? UNQLITE_NOTFOUND : rc;
+}
+/*
+ * Exported: xFirst() and xLast() methods.
+ */
+static int lsmCursorFirst(unqlite_kv_cursor *pCursor)
+{
+	return lsmCursorMoveTo((lsm_kv_cursor *)pCursor,0,0,LSM_SEEK_FIRST,0);
+}
+static int lsmCursorLast(unqlite_kv_cursor *pCursor)
+{
+	return lsmCursorMoveTo((lsm_kv_cursor *)pCursor,0,0,LSM_SEEK_LAST,0);
+}
+/*
+ * Exported: xValid() method.
+ */
+static int lsmCursorValid(unqlite_kv_cursor *pCursor)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	return pCur->iState != LSM_CURSOR_INVALID;
+}
+/*
+ * Exported: xNext() method.
+ */
+static int lsmCursorNext(unqlite_kv_cursor *pCursor)
+{
+	return lsmCursorStep((lsm_kv_cursor *)pCursor,1);
+}
+/*
+ * Exported: xPrev() method.
+ */
+static int lsmCursorPrev(unqlite_kv_cursor *pCursor)
+{
+	return lsmCursorStep((lsm_kv_cursor *)pCursor,-1);
+}
+/*
+ * Exported: xDelete() method.
+ * A tombstone is written to the memtable and the cursor point to the next entry on success.
+ */
+static int lsmCursorDelete(unqlite_kv_cursor *pCursor)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	lsm_kv_engine *pEngine = (lsm_kv_engine *)pCur->pStore;
+	lsm_iter *pIter;
+	int rc;
+	rc = lsmCursorRecord(pCur,&pIter);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = lsmBeginWrite(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = lsmRecordStore(pEngine,SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey),0,0,LSM_REC_TOMBSTONE);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Point to the next entry */
+	rc = lsmCursorStep(pCur,1);
+	return rc == UNQLITE_DONE ? UNQLITE_OK : rc;
+}
+/*
+ * Exported: xKeyLength() method.
+ */
+static int lsmCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	if( pCur->iState == LSM_CURSOR_INVALID ){
+		return UNQLITE_INVALID;
+	}
+	*pLen = (int)SyBlobLength(&pCur->sKey);
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xKey() method.
+ */
+static int lsmCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	lsm_kv_cursor *pCur = (lsm_kv_cursor *)pCursor;
+	int rc;
+	if( pCur->iState == LSM_CURSOR_INVALID ){
+		return UNQLITE_INVALID;
+	}
+	rc = xConsumer(SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey),pUserData);
+	return rc != UNQLITE_OK ? UNQLITE_ABORT : UNQLITE_OK;
+}
+/*
+ * Exported: xDataLength() method.
+ */
+static int lsmCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
+{
+	lsm_iter *pIter;
+	int rc;
+	rc = lsmCursorRecord((lsm_kv_cursor *)pCursor,&pIter);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	*pLen = (unqlite_int64)lsmIterDataLength(pIter);
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xDataRange() method.
+ */
+static int lsmCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	lsm_iter *pIter;
+	int rc;
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	rc = lsmCursorRecord((lsm_kv_cursor *)pCursor,&pIter);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return lsmIterData(pIter,(sxu64)iOfft,(sxu64)nLen,xConsumer,pUserData);
+}
+/*
+ * Exported: xData() method.
+ */
+static int lsmCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	return lsmCursorDataRange(pCursor,0,SXI64_HIGH,xConsumer,pUserData);
+}
+/*
+ * Export the LSM storage engine.
+ */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportLsmKvStorage(void)
+{
+	static const unqlite_kv_methods sLsmStore = {
+		"lsm",                      /* zName */
+		sizeof(lsm_kv_engine),      /* szKv */
+		sizeof(lsm_kv_cursor),      /* szCursor */
+		4,                          /* iVersion */
+		lsm_kv_init,                /* xInit */
+		lsm_kv_release,             /* xRelease */
+		lsm_kv_config,              /* xConfig */
+		lsm_kv_open,                /* xOpen */
+		lsm_kv_replace,             /* xReplace */
+		lsm_kv_append,              /* xAppend */
+		lsmCursorInit,              /* xCursorInit */
+		lsmCursorSeek,              /* xSeek */
+		lsmCursorFirst,             /* xFirst */
+		lsmCursorLast,              /* xLast */
+		lsmCursorValid,             /* xValid */
+		lsmCursorNext,              /* xNext */
+		lsmCursorPrev,              /* xPrev */
+		lsmCursorDelete,            /* xDelete */
+		lsmCursorKeyLength,         /* xKeyLength */
+		lsmCursorKey,               /* xKey */
+		lsmCursorDataLength,        /* xDataLength */
+		lsmCursorData,              /* xData */
+		lsmCursorReset,             /* xReset */
+		lsmCursorRelease,           /* xCursorRelease */
+		0,                          /* xDataRef */
+		lsmCursorDataRange,         /* xDataRange */
+		0,                          /* xWriteRange */
+		lsm_kv_sync,                /* xSync */
+		UNQLITE_KV_ORDERED|UNQLITE_KV_SAVEPOINT, /* iFlags */
+		0,                          /* xFetch */
+		0,                          /* xRemove */
+		0                           /* xRemoveIf */
+	};
+	return &sLsmStore;
+}
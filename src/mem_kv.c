@@ -27,20 +27,90 @@
  */
 /* Forward declaration */
 typedef struct mem_hash_kv_engine mem_hash_kv_engine;
+typedef struct mem_hash_cursor mem_hash_cursor;
 /*
- * Each record is storead in an instance of the following structure.
+ * Records are kept in an array of entries ordered by insertion time (the
+ * cursors walk this array) and are located via an open addressing hash table
+ * holding the entry indexes.
+ * The key and the data of each record are stored back to back in the arena.
  */
-typedef struct mem_hash_record mem_hash_record;
-struct mem_hash_record
+typedef struct mem_hash_entry mem_hash_entry;
+struct mem_hash_entry
 {
-	mem_hash_kv_engine *pEngine;    /* Storage engine */
+	char *zBlob;                    /* Key followed by the data, NULL for a deleted entry */
 	sxu32 nHash;                    /* Hash of the key */
-	const void *pKey;               /* Key */
-	sxu32 nKeyLen;                  /* Key size (Max 1GB) */
-	const void *pData;              /* Data */
+	sxu32 nKeyLen;                  /* Key size */
 	sxu32 nDataLen;                 /* Data length (Max 4GB) */
-	mem_hash_record *pNext,*pPrev;  /* Link to other records */
-	mem_hash_record *pNextHash,*pPrevHash; /* Collision link */
+	sxu32 iSeg;                     /* Arena segment holding the blob */
+};
+/*
+ * Keys and data are stored in a log-structured arena made of fixed size segments.
+ * New blobs are appended at the end of the active segment and each blob is preceded
+ * by a small header so that segments can be walked. Space left by deleted or
+ * relocated blobs is reclaimed by moving the surviving blobs of a sealed segment to
+ * the active one once less than half of the segment is live, after which the segment
+ * is released. Fragmentation is thus bounded and allocator calls are limited to one
+ * per segment. Blobs too large for a segment get a dedicated one.
+ */
+#define MEM_ARENA_SEG_SIZE   65536
+#define MEM_ARENA_ALIGN(N)   (((N) + 3) & ~((sxu32)3))
+/* Bytes taken by a blob of N bytes, header included */
+#define MEM_ARENA_SLOT(N)    (sizeof(mem_arena_hdr) + MEM_ARENA_ALIGN(N))
+/* Largest blob */
+#define MEM_ARENA_MAX_BLOB   (SXU32_HIGH - 2 * MEM_ARENA_SEG_SIZE)
+/* Header of a given blob */
+#define MEM_ARENA_HDR(BLOB)  (((mem_arena_hdr *)(BLOB)) - 1)
+typedef struct mem_arena_hdr mem_arena_hdr;
+struct mem_arena_hdr
+{
+	sxu32 iEntry;  /* Owner entry, MEM_HASH_NO_ENTRY for a dead blob */
+	sxu32 nSize;   /* Room available for the blob (Key + data) */
+};
+typedef struct mem_arena_seg mem_arena_seg;
+struct mem_arena_seg
+{
+	char *zBuf;    /* Segment buffer, NULL for an unused segment */
+	sxu32 nSize;   /* Buffer size */
+	sxu32 nUsed;   /* Appended bytes (Next free segment when unused) */
+	sxu32 nLive;   /* Bytes taken by live blobs */
+	int bLarge;    /* Dedicated segment of a large blob */
+};
+/*
+ * The hash table slots are organized in groups of 8. Each slot has a control
+ * byte which is either EMPTY, DELETED (Tombstone) or the 7 low bits of the mixed
+ * key hash. The control bytes of a group are packed in a single 64-bit word so that
+ * the 8 candidate slots of a group are matched at once using SWAR (SIMD within
+ * a register) arithmetic and only the slots with a matching tag are compared
+ * against the key. Groups are probed quadratically until a group with an
+ * EMPTY slot is found.
+ */
+#define MEM_HASH_GROUP        8     /* Slots per group */
+#define MEM_HASH_CTRL_EMPTY   0x80  /* Free slot */
+#define MEM_HASH_CTRL_DELETED 0xFE  /* Tombstone */
+#define MEM_HASH_LSB  0x0101010101010101
+#define MEM_HASH_MSB  0x8080808080808080
+/* High bit of each EMPTY control byte of the group W */
+#define MEM_HASH_MATCH_EMPTY(W) ((W) & ~((W) << 6) & MEM_HASH_MSB)
+/* High bit of each EMPTY or DELETED control byte of the group W */
+#define MEM_HASH_MATCH_FREE(W)  ((W) & MEM_HASH_MSB)
+/* Control byte of the slot S */
+#define MEM_HASH_CTRL(TABLE,S) ((sxu8)((TABLE)->aCtrl[(S) >> 3] >> (((S) & 7) << 3)))
+/* Invalid entry index */
+#define MEM_HASH_NO_ENTRY SXU32_HIGH
+/* Default bucket size (Slots) */
+#define MEM_HASH_BUCKET_SIZE 64
+/* Default fill factor: Maximum used slots (including tombstones) per group */
+#define MEM_HASH_MAX_LOAD 7
+/* Groups of the old table migrated on each write operation while resizing */
+#define MEM_HASH_MIGRATE_STEP 4
+typedef struct mem_hash_table mem_hash_table;
+struct mem_hash_table
+{
+	sxu64 *aCtrl;     /* Control bytes, one 64-bit word per group */
+	sxu32 *aSlot;     /* Entry index of each slot */
+	sxu32 nGroup;     /* Total number of groups: Must be a power of two */
+	sxu32 nFull;      /* Used slots */
+	sxu32 nDeleted;   /* DELETED slots */
 };
 /*
  * Each in-memory KV engine is represented by an instance
@@ -54,229 +124,648 @@ struct mem_hash_kv_engine
 	ProcHash    xHash;          /* Default hash function */
 	ProcCmp     xCmp;           /* Default comparison function */
 	sxu32 nRecord;              /* Total number of records  */
-	sxu32 nBucket;              /* Bucket size: Must be a power of two */
-	mem_hash_record **apBucket; /* Hash bucket */
-	mem_hash_record *pFirst;    /* First inserted entry */
-	mem_hash_record *pLast;     /* Last inserted entry */
+	mem_hash_table sTable;      /* Hash table */
+	mem_hash_table sOld;        /* Table being migrated to sTable after a resize, if any */
+	sxu32 iMigrate;             /* Next group of sOld to migrate */
+	mem_hash_entry *aEntry;     /* Records in insertion order */
+	sxu32 nEntry;               /* Used entries including the deleted ones */
+	sxu32 nEntryAlloc;          /* Allocated entries */
+	mem_hash_cursor *pCursor;   /* List of opened cursors */
+	mem_arena_seg *aSeg;        /* Arena segments */
+	sxu32 nSeg;                 /* Used segment slots */
+	sxu32 nSegAlloc;            /* Allocated segment slots */
+	sxu32 iActive;              /* Segment new blobs are appended to or MEM_HASH_NO_ENTRY */
+	sxu32 iFreeSeg;             /* List of unused segment slots */
+	int bEvacuate;              /* A segment is being evacuated */
 };
 /*
- * Allocate a new hash record.
+ * Each public cursor is identified by an instance of this structure.
  */
-static mem_hash_record * MemHashNewRecord(
-	mem_hash_kv_engine *pEngine,
-	const void *pKey,int nKey,
-	const void *pData,unqlite_int64 nData,
-	sxu32 nHash
-	)
+struct mem_hash_cursor
 {
-	SyMemBackend *pAlloc = &pEngine->sAlloc;
-	mem_hash_record *pRecord;
-	void *pDupData;
-	sxu32 nByte;
-	char *zPtr;
-	
-	/* Total number of bytes to alloc */
-	nByte = sizeof(mem_hash_record) + nKey;
-	/* Allocate a new instance */
-	pRecord = (mem_hash_record *)SyMemBackendAlloc(pAlloc,nByte);
-	if( pRecord == 0 ){
-		return 0;
+	unqlite_kv_engine *pStore; /* Must be first */
+	/* Private fields */
+	sxu32 iEntry;              /* Current entry or MEM_HASH_NO_ENTRY */
+	mem_hash_cursor *pNext;    /* Next opened cursor */
+};
+/*
+ * Scramble the key hash so that both the low bits (slot tag) and the
+ * high bits (first probed group) are well distributed.
+ */
+static sxu32 MemHashMix(sxu32 nHash)
+{
+	nHash *= 0x9E3779B1;
+	return nHash ^ (nHash >> 16);
+}
+/*
+ * High bit of each control byte of the group W equal to the tag C.
+ * False positives are possible but harmless since the candidates are verified.
+ */
+static sxu64 MemHashMatchTag(sxu64 w,sxu8 c)
+{
+	sxu64 x = w ^ (MEM_HASH_LSB * c);
+	return (x - MEM_HASH_LSB) & ~x & MEM_HASH_MSB;
+}
+/*
+ * Set the control byte of a given slot.
+ */
+static void MemHashSetCtrl(mem_hash_table *pTable,sxu32 iSlot,sxu8 c)
+{
+	sxu64 *pWord = &pTable->aCtrl[iSlot >> 3];
+	int iShift = (int)((iSlot & 7) << 3);
+	*pWord = (*pWord & ~((sxu64)0xFF << iShift)) | ((sxu64)c << iShift);
+}
+/*
+ * Allocate an empty hash table of the given number of groups.
+ */
+static int MemHashTableInit(mem_hash_kv_engine *pEngine,mem_hash_table *pTable,sxu32 nGroup)
+{
+	sxu32 i;
+	if( nGroup > SXU32_HIGH / (sizeof(sxu64) + MEM_HASH_GROUP * sizeof(sxu32)) ){
+		return UNQLITE_NOMEM;
 	}
-	pDupData = (void *)SyMemBackendAlloc(pAlloc,(sxu32)nData);
-	if( pDupData == 0 ){
-		SyMemBackendFree(pAlloc,pRecord);
-		return 0;
+	/* Control words followed by the slots */
+	pTable->aCtrl = (sxu64 *)SyMemBackendAlloc(&pEngine->sAlloc,nGroup * (sizeof(sxu64) + MEM_HASH_GROUP * sizeof(sxu32)));
+	if( pTable->aCtrl == 0 ){
+		return UNQLITE_NOMEM;
 	}
-	zPtr = (char *)pRecord;
-	zPtr += sizeof(mem_hash_record);
-	/* Zero the structure */
-	SyZero(pRecord,sizeof(mem_hash_record));
-	/* Fill in the structure */
-	pRecord->pEngine = pEngine;
-	pRecord->nDataLen = (sxu32)nData;
-	pRecord->nKeyLen = (sxu32)nKey;
-	pRecord->nHash = nHash;
-	SyMemcpy(pKey,zPtr,pRecord->nKeyLen);
-	pRecord->pKey = (const void *)zPtr;
-	SyMemcpy(pData,pDupData,pRecord->nDataLen);
-	pRecord->pData = pDupData;
-	/* All done */
-	return pRecord;
-}
-/*
- * Install a given record in the hashtable.
- */
-static void MemHashLinkRecord(mem_hash_kv_engine *pEngine,mem_hash_record *pRecord)
-{
-	sxu32 nBucket = pRecord->nHash & (pEngine->nBucket - 1);
-	pRecord->pNextHash = pEngine->apBucket[nBucket];
-	if( pEngine->apBucket[nBucket] ){
-		pEngine->apBucket[nBucket]->pPrevHash = pRecord;
-	}
-	pEngine->apBucket[nBucket] = pRecord;
-	if( pEngine->pFirst == 0 ){
-		pEngine->pFirst = pEngine->pLast = pRecord;
-	}else{
-		MACRO_LD_PUSH(pEngine->pLast,pRecord);
+	for( i = 0 ; i < nGroup ; ++i ){
+		pTable->aCtrl[i] = MEM_HASH_MSB; /* All EMPTY */
 	}
-	pEngine->nRecord++;
+	pTable->aSlot = (sxu32 *)&pTable->aCtrl[nGroup];
+	pTable->nGroup = nGroup;
+	pTable->nFull = pTable->nDeleted = 0;
+	return UNQLITE_OK;
 }
 /*
- * Unlink a given record from the hashtable.
+ * Install a given entry in the hash table.
+ * The caller must make sure the entry is not already installed and that the table is not full.
  */
-static void MemHashUnlinkRecord(mem_hash_kv_engine *pEngine,mem_hash_record *pEntry)
+static void MemHashTableInsert(mem_hash_table *pTable,sxu32 nHash,sxu32 iEntry)
 {
-	sxu32 nBucket = pEntry->nHash & (pEngine->nBucket - 1);
-	SyMemBackend *pAlloc = &pEngine->sAlloc;
-	if( pEntry->pPrevHash == 0 ){
-		pEngine->apBucket[nBucket] = pEntry->pNextHash;
-	}else{
-		pEntry->pPrevHash->pNextHash = pEntry->pNextHash;
-	}
-	if( pEntry->pNextHash ){
-		pEntry->pNextHash->pPrevHash = pEntry->pPrevHash;
+	sxu32 nMix = MemHashMix(nHash);
+	sxu32 iMask = pTable->nGroup - 1;
+	sxu32 iGroup = (nMix >> 7) & iMask;
+	sxu32 nStep = 0;
+	sxu32 iSlot;
+	sxu64 m;
+	int j;
+	for(;;){
+		m = MEM_HASH_MATCH_FREE(pTable->aCtrl[iGroup]);
+		if( m ){
+			/* First free slot of this group */
+			for( j = 0 ; ((m >> (j << 3)) & 0x80) == 0 ; ++j );
+			iSlot = (iGroup * MEM_HASH_GROUP) + (sxu32)j;
+			if( MEM_HASH_CTRL(pTable,iSlot) == MEM_HASH_CTRL_DELETED ){
+				pTable->nDeleted--;
+			}
+			MemHashSetCtrl(pTable,iSlot,(sxu8)(nMix & 0x7F));
+			pTable->aSlot[iSlot] = iEntry;
+			pTable->nFull++;
+			return;
+		}
+		/* Quadratic probing */
+		nStep++;
+		iGroup = (iGroup + nStep) & iMask;
 	}
-	MACRO_LD_REMOVE(pEngine->pLast,pEntry);
-	if( pEntry == pEngine->pFirst ){
-		pEngine->pFirst = pEntry->pPrev;
+}
+/*
+ * Remove the entry stored in a given slot from the hash table.
+ */
+static void MemHashTableErase(mem_hash_table *pTable,sxu32 iSlot)
+{
+	if( MEM_HASH_MATCH_EMPTY(pTable->aCtrl[iSlot >> 3]) ){
+		/* Lookups stop at this group anyway, no need for a tombstone */
+		MemHashSetCtrl(pTable,iSlot,MEM_HASH_CTRL_EMPTY);
+	}else{
+		MemHashSetCtrl(pTable,iSlot,MEM_HASH_CTRL_DELETED);
+		pTable->nDeleted++;
 	}
-	pEngine->nRecord--;
-	/* Release the entry */
-	SyMemBackendFree(pAlloc,(void *)pEntry->pData);
-	SyMemBackendFree(pAlloc,pEntry); /* Key is also stored here */
+	pTable->nFull--;
 }
 /*
- * Perform a lookup for a given entry.
+ * Perform a lookup for a given key in a given table.
+ * Return the slot holding the entry or MEM_HASH_NO_ENTRY.
  */
-static mem_hash_record * MemHashGetEntry(
+static sxu32 MemHashTableLookup(
 	mem_hash_kv_engine *pEngine,
-	const void *pKey,int nKeyLen
+	mem_hash_table *pTable,
+	const void *pKey,sxu32 nKeyLen,
+	sxu32 nHash
 	)
 {
-	mem_hash_record *pEntry;
-	sxu32 nHash,nBucket;
-	/* Hash the entry */
-	nHash = pEngine->xHash(pKey,(sxu32)nKeyLen);
-	nBucket = nHash & (pEngine->nBucket - 1);
-	pEntry = pEngine->apBucket[nBucket];
+	sxu32 nMix = MemHashMix(nHash);
+	sxu32 iMask = pTable->nGroup - 1;
+	sxu32 iGroup = (nMix >> 7) & iMask;
+	mem_hash_entry *pEntry;
+	sxu32 nStep = 0;
+	sxu32 iSlot;
+	sxu64 w,m;
+	int j;
 	for(;;){
-		if( pEntry == 0 ){
+		w = pTable->aCtrl[iGroup];
+		m = MemHashMatchTag(w,(sxu8)(nMix & 0x7F));
+		for( j = 0 ; m != 0 ; ++j ){
+			if( (m >> (j << 3)) & 0x80 ){
+				m &= ~((sxu64)0x80 << (j << 3));
+				iSlot = (iGroup * MEM_HASH_GROUP) + (sxu32)j;
+				pEntry = &pEngine->aEntry[pTable->aSlot[iSlot]];
+				if( pEntry->nHash == nHash && pEntry->nKeyLen == nKeyLen &&
+					pEngine->xCmp(pEntry->zBlob,pKey,nKeyLen) == 0 ){
+						return iSlot;
+				}
+			}
+		}
+		if( MEM_HASH_MATCH_EMPTY(w) || nStep >= iMask ){
+			/* No such entry */
 			break;
 		}
-		if( pEntry->nHash == nHash && pEntry->nKeyLen == (sxu32)nKeyLen && 
-			pEngine->xCmp(pEntry->pKey,pKey,pEntry->nKeyLen) == 0 ){
-				return pEntry;
+		/* Quadratic probing */
+		nStep++;
+		iGroup = (iGroup + nStep) & iMask;
+	}
+	return MEM_HASH_NO_ENTRY;
+}
+/*
+ * Perform a lookup for a given key.
+ * Return the slot holding the entry and the table it belong to or MEM_HASH_NO_ENTRY.
+ */
+static sxu32 MemHashGetSlot(
+	mem_hash_kv_engine *pEngine,
+	const void *pKey,sxu32 nKeyLen,
+	sxu32 nHash,
+	mem_hash_table **ppTable
+	)
+{
+	sxu32 iSlot;
+	*ppTable = &pEngine->sTable;
+	iSlot = MemHashTableLookup(pEngine,&pEngine->sTable,pKey,nKeyLen,nHash);
+	if( iSlot == MEM_HASH_NO_ENTRY && pEngine->sOld.aCtrl ){
+		/* Not migrated yet */
+		*ppTable = &pEngine->sOld;
+		iSlot = MemHashTableLookup(pEngine,&pEngine->sOld,pKey,nKeyLen,nHash);
+	}
+	return iSlot;
+}
+/*
+ * Migrate up to nGroup groups of the old table to the current one.
+ * The old table is released once empty.
+ */
+static void MemHashMigrate(mem_hash_kv_engine *pEngine,sxu32 nGroup)
+{
+	mem_hash_table *pOld = &pEngine->sOld;
+	sxu32 iSlot,iEntry;
+	int j;
+	while( nGroup > 0 && pEngine->iMigrate < pOld->nGroup ){
+		for( j = 0 ; j < MEM_HASH_GROUP ; ++j ){
+			iSlot = (pEngine->iMigrate * MEM_HASH_GROUP) + (sxu32)j;
+			if( MEM_HASH_CTRL(pOld,iSlot) & 0x80 ){
+				/* EMPTY or DELETED */
+				continue;
+			}
+			iEntry = pOld->aSlot[iSlot];
+			MemHashTableInsert(&pEngine->sTable,pEngine->aEntry[iEntry].nHash,iEntry);
+			/* Leave a tombstone so that lookups of the remaining entries still work */
+			MemHashSetCtrl(pOld,iSlot,MEM_HASH_CTRL_DELETED);
+			pOld->nFull--;
 		}
-		pEntry = pEntry->pNextHash;
+		pEngine->iMigrate++;
+		nGroup--;
+	}
+	if( pEngine->iMigrate >= pOld->nGroup ){
+		/* All done, release the old table */
+		SyMemBackendFree(&pEngine->sAlloc,(void *)pOld->aCtrl);
+		SyZero(pOld,sizeof(mem_hash_table));
+		pEngine->iMigrate = 0;
 	}
-	/* No such entry */
-	return 0;
 }
 /*
- * Rehash all the entries in the given table.
+ * Start migrating the entries to a new table of the given size.
+ * Rather than rehashing everything in one go which would stall the caller on large
+ * tables, the entries are moved a few groups at a time by the following write
+ * operations (See MemHashMigrate()). Tombstones are dropped in the process.
  */
-static int MemHashGrowTable(mem_hash_kv_engine *pEngine)
+static int MemHashResizeTable(mem_hash_kv_engine *pEngine,sxu32 nGroup)
 {
-	sxu32 nNewSize = pEngine->nBucket << 1;
-	mem_hash_record *pEntry;
-	mem_hash_record **apNew;
-	sxu32 n,iBucket;
-	/* Allocate a new larger table */
-	apNew = (mem_hash_record **)SyMemBackendAlloc(&pEngine->sAlloc, nNewSize * sizeof(mem_hash_record *));
-	if( apNew == 0 ){
-		/* Not so fatal, simply a performance hit */
+	mem_hash_table sNew;
+	int rc;
+	if( pEngine->sOld.aCtrl ){
+		/* Previous resize still in progress, finish it first */
+		MemHashMigrate(pEngine,SXU32_HIGH);
+	}
+	rc = MemHashTableInit(pEngine,&sNew,nGroup);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pEngine->sOld = pEngine->sTable;
+	pEngine->sTable = sNew;
+	pEngine->iMigrate = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Make room in the hash table for a new entry.
+ */
+static int MemHashReserveSlot(mem_hash_kv_engine *pEngine)
+{
+	mem_hash_table *pTable = &pEngine->sTable;
+	sxu32 nGroup = pTable->nGroup;
+	if( pTable->nFull + pTable->nDeleted < nGroup * MEM_HASH_MAX_LOAD ){
+		/* Fill factor not reached yet */
 		return UNQLITE_OK;
 	}
-	/* Zero the new table */
-	SyZero((void *)apNew, nNewSize * sizeof(mem_hash_record *));
-	/* Rehash all entries */
-	n = 0;
-	pEntry = pEngine->pLast;
-	for(;;){
-		
-		/* Loop one */
-		if( n >= pEngine->nRecord ){
-			break;
+	if( pEngine->sOld.aCtrl ){
+		/* Previous resize still in progress, finish it so that nFull count every record */
+		MemHashMigrate(pEngine,SXU32_HIGH);
+	}
+	if( pTable->nFull >= (nGroup * MEM_HASH_MAX_LOAD) / 2 ){
+		/* Grow the table, otherwise simply purge the tombstones */
+		nGroup <<= 1;
+	}
+	if( MemHashResizeTable(pEngine,nGroup) != UNQLITE_OK ){
+		if( pTable->nFull + pTable->nDeleted >= pTable->nGroup * MEM_HASH_GROUP - 1 ){
+			/* At least one EMPTY slot is required to terminate lookups */
+			return UNQLITE_NOMEM;
 		}
-		pEntry->pNextHash = pEntry->pPrevHash = 0;
-		/* Install in the new bucket */
-		iBucket = pEntry->nHash & (nNewSize - 1);
-		pEntry->pNextHash = apNew[iBucket];
-		if( apNew[iBucket] ){
-			apNew[iBucket]->pPrevHash = pEntry;
+		/* Not so fatal, simply a performance hit */
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Allocate a new arena segment of the given size.
+ */
+static int MemArenaNewSeg(mem_hash_kv_engine *pEngine,sxu32 nSize,int bLarge,sxu32 *piSeg)
+{
+	mem_arena_seg *pSeg;
+	sxu32 iSeg;
+	char *zBuf;
+	zBuf = (char *)SyMemBackendAlloc(&pEngine->sAlloc,nSize);
+	if( zBuf == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	if( pEngine->iFreeSeg != MEM_HASH_NO_ENTRY ){
+		/* Recycle an unused slot */
+		iSeg = pEngine->iFreeSeg;
+		pEngine->iFreeSeg = pEngine->aSeg[iSeg].nUsed;
+	}else{
+		if( pEngine->nSeg >= pEngine->nSegAlloc ){
+			sxu32 nNew = pEngine->nSegAlloc > 0 ? pEngine->nSegAlloc << 1 : 16;
+			mem_arena_seg *aNew;
+			aNew = (mem_arena_seg *)SyMemBackendRealloc(&pEngine->sAlloc,pEngine->aSeg,nNew * sizeof(mem_arena_seg));
+			if( aNew == 0 ){
+				SyMemBackendFree(&pEngine->sAlloc,zBuf);
+				return UNQLITE_NOMEM;
+			}
+			pEngine->aSeg = aNew;
+			pEngine->nSegAlloc = nNew;
 		}
-		apNew[iBucket] = pEntry;
-		/* Point to the next entry */
-		pEntry = pEntry->pNext;
-		n++;
-
-		/* Loop two */
-		if( n >= pEngine->nRecord ){
-			break;
+		iSeg = pEngine->nSeg++;
+	}
+	pSeg = &pEngine->aSeg[iSeg];
+	pSeg->zBuf = zBuf;
+	pSeg->nSize = nSize;
+	pSeg->nUsed = pSeg->nLive = 0;
+	pSeg->bLarge = bLarge;
+	*piSeg = iSeg;
+	return UNQLITE_OK;
+}
+/*
+ * Release an arena segment.
+ */
+static void MemArenaFreeSeg(mem_hash_kv_engine *pEngine,sxu32 iSeg)
+{
+	mem_arena_seg *pSeg = &pEngine->aSeg[iSeg];
+	SyMemBackendFree(&pEngine->sAlloc,pSeg->zBuf);
+	pSeg->zBuf = 0;
+	pSeg->nUsed = pEngine->iFreeSeg;
+	pEngine->iFreeSeg = iSeg;
+	if( pEngine->iActive == iSeg ){
+		pEngine->iActive = MEM_HASH_NO_ENTRY;
+	}
+}
+/* Forward declaration */
+static void MemArenaCheckSeg(mem_hash_kv_engine *pEngine,sxu32 iSeg);
+/*
+ * Allocate room for a blob of nSize bytes owned by the given entry.
+ * Note that a sealed segment may be evacuated in the process so blob pointers
+ * must be reloaded from their entries afterwards.
+ */
+static char * MemArenaAlloc(mem_hash_kv_engine *pEngine,sxu32 iEntry,sxu32 nSize,sxu32 *piSeg)
+{
+	sxu32 nNeed = MEM_ARENA_SLOT(nSize);
+	mem_arena_seg *pSeg;
+	mem_arena_hdr *pHdr;
+	sxu32 iSeg,iSealed;
+	if( nNeed > MEM_ARENA_SEG_SIZE / 4 ){
+		/* Large blob, dedicated segment */
+		if( MemArenaNewSeg(pEngine,nNeed,1,&iSeg) != UNQLITE_OK ){
+			return 0;
 		}
-		pEntry->pNextHash = pEntry->pPrevHash = 0;
-		/* Install in the new bucket */
-		iBucket = pEntry->nHash & (nNewSize - 1);
-		pEntry->pNextHash = apNew[iBucket];
-		if( apNew[iBucket] ){
-			apNew[iBucket]->pPrevHash = pEntry;
+	}else{
+		iSeg = pEngine->iActive;
+		if( iSeg == MEM_HASH_NO_ENTRY || pEngine->aSeg[iSeg].nSize - pEngine->aSeg[iSeg].nUsed < nNeed ){
+			/* Seal the active segment and start a new one */
+			iSealed = iSeg;
+			if( MemArenaNewSeg(pEngine,MEM_ARENA_SEG_SIZE,0,&iSeg) != UNQLITE_OK ){
+				return 0;
+			}
+			pEngine->iActive = iSeg;
+			if( iSealed != MEM_HASH_NO_ENTRY ){
+				MemArenaCheckSeg(pEngine,iSealed);
+			}
 		}
-		apNew[iBucket] = pEntry;
-		/* Point to the next entry */
-		pEntry = pEntry->pNext;
-		n++;
-
-		/* Loop three */
-		if( n >= pEngine->nRecord ){
-			break;
+	}
+	pSeg = &pEngine->aSeg[iSeg];
+	pHdr = (mem_arena_hdr *)&pSeg->zBuf[pSeg->nUsed];
+	pHdr->iEntry = iEntry;
+	pHdr->nSize = MEM_ARENA_ALIGN(nSize);
+	pSeg->nUsed += nNeed;
+	pSeg->nLive += nNeed;
+	*piSeg = iSeg;
+	return (char *)&pHdr[1];
+}
+/*
+ * Release the blob of a given entry.
+ */
+static void MemArenaRelease(mem_hash_kv_engine *pEngine,mem_hash_entry *pEntry)
+{
+	mem_arena_hdr *pHdr = MEM_ARENA_HDR(pEntry->zBlob);
+	pEngine->aSeg[pEntry->iSeg].nLive -= MEM_ARENA_SLOT(pHdr->nSize);
+	pHdr->iEntry = MEM_HASH_NO_ENTRY;
+	MemArenaCheckSeg(pEngine,pEntry->iSeg);
+}
+/*
+ * Move the live blobs of a sealed segment to the active one and release the segment.
+ */
+static void MemArenaEvacuate(mem_hash_kv_engine *pEngine,sxu32 iSeg)
+{
+	mem_hash_entry *pEntry;
+	mem_arena_hdr *pHdr;
+	sxu32 iOfft,iNew,nLen;
+	char *zNew;
+	pEngine->bEvacuate = 1;
+	iOfft = 0;
+	while( iOfft < pEngine->aSeg[iSeg].nUsed ){
+		pHdr = (mem_arena_hdr *)&pEngine->aSeg[iSeg].zBuf[iOfft];
+		iOfft += MEM_ARENA_SLOT(pHdr->nSize);
+		if( pHdr->iEntry == MEM_HASH_NO_ENTRY ){
+			/* Dead blob */
+			continue;
+		}
+		pEntry = &pEngine->aEntry[pHdr->iEntry];
+		/* The slack left by previous updates is dropped */
+		nLen = pEntry->nKeyLen + pEntry->nDataLen;
+		zNew = MemArenaAlloc(pEngine,pHdr->iEntry,nLen,&iNew);
+		if( zNew == 0 ){
+			/* Not so fatal, try again later */
+			pEngine->bEvacuate = 0;
+			return;
 		}
-		pEntry->pNextHash = pEntry->pPrevHash = 0;
-		/* Install in the new bucket */
-		iBucket = pEntry->nHash & (nNewSize - 1);
-		pEntry->pNextHash = apNew[iBucket];
-		if( apNew[iBucket] ){
-			apNew[iBucket]->pPrevHash = pEntry;
+		SyMemcpy((const void *)&pHdr[1],zNew,nLen);
+		pEntry->zBlob = zNew;
+		pEntry->iSeg = iNew;
+		pEngine->aSeg[iSeg].nLive -= MEM_ARENA_SLOT(pHdr->nSize);
+		pHdr->iEntry = MEM_HASH_NO_ENTRY;
+	}
+	pEngine->bEvacuate = 0;
+	MemArenaFreeSeg(pEngine,iSeg);
+}
+/*
+ * Reclaim the space of a given segment if worth it.
+ */
+static void MemArenaCheckSeg(mem_hash_kv_engine *pEngine,sxu32 iSeg)
+{
+	mem_arena_seg *pSeg = &pEngine->aSeg[iSeg];
+	if( pSeg->nLive < 1 ){
+		if( iSeg == pEngine->iActive ){
+			/* Rewind the active segment */
+			pSeg->nUsed = 0;
+		}else{
+			MemArenaFreeSeg(pEngine,iSeg);
 		}
-		apNew[iBucket] = pEntry;
-		/* Point to the next entry */
-		pEntry = pEntry->pNext;
-		n++;
-
-		/* Loop four */
-		if( n >= pEngine->nRecord ){
-			break;
+	}else if( iSeg != pEngine->iActive && !pSeg->bLarge && !pEngine->bEvacuate && pSeg->nLive < (pSeg->nUsed >> 1) ){
+		MemArenaEvacuate(pEngine,iSeg);
+	}
+}
+/*
+ * Try to resize the blob of a given entry without moving it.
+ * Return 1 on success, 0 if the blob must be relocated by the caller.
+ */
+static int MemArenaResize(mem_hash_kv_engine *pEngine,mem_hash_entry *pEntry,sxu32 nSize)
+{
+	mem_arena_seg *pSeg = &pEngine->aSeg[pEntry->iSeg];
+	mem_arena_hdr *pHdr = MEM_ARENA_HDR(pEntry->zBlob);
+	sxu32 nOld = MEM_ARENA_SLOT(pHdr->nSize);
+	sxu32 nNew = MEM_ARENA_SLOT(nSize);
+	if( nNew <= nOld && nNew >= (nOld >> 1) ){
+		/* Fit in the current slot */
+		return 1;
+	}
+	if( pSeg->bLarge ){
+		char *zBuf;
+		if( nNew <= MEM_ARENA_SEG_SIZE / 4 ){
+			/* No longer large */
+			return 0;
+		}
+		zBuf = (char *)SyMemBackendRealloc(&pEngine->sAlloc,pSeg->zBuf,nNew);
+		if( zBuf == 0 ){
+			return 0;
+		}
+		pSeg->zBuf = zBuf;
+		pSeg->nSize = pSeg->nUsed = pSeg->nLive = nNew;
+		pHdr = (mem_arena_hdr *)zBuf;
+		pHdr->nSize = MEM_ARENA_ALIGN(nSize);
+		pEntry->zBlob = (char *)&pHdr[1];
+		return 1;
+	}
+	if( pEntry->iSeg == pEngine->iActive && nNew > nOld && nNew <= MEM_ARENA_SEG_SIZE / 4 &&
+		(char *)pHdr + nOld == &pSeg->zBuf[pSeg->nUsed] && pSeg->nSize - pSeg->nUsed >= nNew - nOld ){
+			/* Last blob of the active segment, grow in place */
+			pSeg->nUsed += nNew - nOld;
+			pSeg->nLive += nNew - nOld;
+			pHdr->nSize = MEM_ARENA_ALIGN(nSize);
+			return 1;
+	}
+	return 0;
+}
+/*
+ * Move the blob of a given entry to a new location of nSize bytes.
+ * The first nKeep bytes of the old blob are preserved.
+ */
+static int MemArenaRelocate(mem_hash_kv_engine *pEngine,sxu32 iEntry,sxu32 nSize,sxu32 nKeep)
+{
+	mem_hash_entry *pEntry = &pEngine->aEntry[iEntry];
+	mem_hash_entry sOld;
+	sxu32 iSeg;
+	char *zNew;
+	zNew = MemArenaAlloc(pEngine,iEntry,nSize,&iSeg);
+	if( zNew == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	/* Reload, the old blob may have been evacuated */
+	sOld = *pEntry;
+	SyMemcpy((const void *)sOld.zBlob,zNew,nKeep);
+	pEntry->zBlob = zNew;
+	pEntry->iSeg = iSeg;
+	MemArenaRelease(pEngine,&sOld);
+	return UNQLITE_OK;
+}
+/*
+ * Remove the deleted entries from the entry array.
+ * The hash table slots and the opened cursors are updated to point to the new
+ * entry indexes.
+ */
+static int MemHashCompactEntries(mem_hash_kv_engine *pEngine)
+{
+	mem_hash_table *apTable[2];
+	mem_hash_table *pTable;
+	mem_hash_cursor *pCur;
+	sxu32 i,n,*aMap;
+	int k;
+	/* aMap[i] hold the number of live entries before the entry i */
+	aMap = (sxu32 *)SyMemBackendAlloc(&pEngine->sAlloc,(pEngine->nEntry + 1) * sizeof(sxu32));
+	if( aMap == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	n = 0;
+	for( i = 0 ; i < pEngine->nEntry ; ++i ){
+		aMap[i] = n;
+		if( pEngine->aEntry[i].zBlob ){
+			pEngine->aEntry[n] = pEngine->aEntry[i];
+			/* Update the owner of the blob */
+			MEM_ARENA_HDR(pEngine->aEntry[n].zBlob)->iEntry = n;
+			n++;
 		}
-		pEntry->pNextHash = pEntry->pPrevHash = 0;
-		/* Install in the new bucket */
-		iBucket = pEntry->nHash & (nNewSize - 1);
-		pEntry->pNextHash = apNew[iBucket];
-		if( apNew[iBucket] ){
-			apNew[iBucket]->pPrevHash = pEntry;
+	}
+	aMap[pEngine->nEntry] = n;
+	/* Remap the slots of both tables when a resize is in progress */
+	apTable[0] = &pEngine->sTable;
+	apTable[1] = pEngine->sOld.aCtrl ? &pEngine->sOld : 0;
+	for( k = 0 ; k < 2 && apTable[k] ; ++k ){
+		pTable = apTable[k];
+		for( i = 0 ; i < pTable->nGroup * MEM_HASH_GROUP ; ++i ){
+			if( (MEM_HASH_CTRL(pTable,i) & 0x80) == 0 ){
+				pTable->aSlot[i] = aMap[pTable->aSlot[i]];
+			}
+		}
+	}
+	/* Cursors pointing to a deleted entry now point to the entry that follow */
+	for( pCur = pEngine->pCursor ; pCur ; pCur = pCur->pNext ){
+		if( pCur->iEntry != MEM_HASH_NO_ENTRY ){
+			pCur->iEntry = aMap[pCur->iEntry] < n ? aMap[pCur->iEntry] : MEM_HASH_NO_ENTRY;
 		}
-		apNew[iBucket] = pEntry;
-		/* Point to the next entry */
-		pEntry = pEntry->pNext;
-		n++;
-	}
-	/* Release the old table and reflect the change */
-	SyMemBackendFree(&pEngine->sAlloc,(void *)pEngine->apBucket);
-	pEngine->apBucket = apNew;
-	pEngine->nBucket  = nNewSize;
+	}
+	pEngine->nEntry = n;
+	SyMemBackendFree(&pEngine->sAlloc,aMap);
 	return UNQLITE_OK;
 }
+/*
+ * Allocate a new entry at the end of the entry array.
+ */
+static int MemHashNewEntry(
+	mem_hash_kv_engine *pEngine,
+	const void *pKey,sxu32 nKey,
+	const void *pData,sxu32 nData,
+	sxu32 nHash,
+	sxu32 *piEntry
+	)
+{
+	mem_hash_entry *pEntry;
+	sxu32 iSeg;
+	char *zBlob;
+	if( pEngine->nEntry >= pEngine->nEntryAlloc ){
+		if( pEngine->nEntry - pEngine->nRecord >= (pEngine->nEntry >> 2) && pEngine->nEntry > 0 ){
+			/* Enough deleted entries, reclaim them first */
+			MemHashCompactEntries(pEngine);
+		}
+		if( pEngine->nEntry >= pEngine->nEntryAlloc ){
+			sxu32 nNew = pEngine->nEntryAlloc > 0 ? pEngine->nEntryAlloc << 1 : MEM_HASH_BUCKET_SIZE;
+			mem_hash_entry *aNew;
+			if( nNew > SXU32_HIGH / sizeof(mem_hash_entry) ){
+				return UNQLITE_NOMEM;
+			}
+			aNew = (mem_hash_entry *)SyMemBackendRealloc(&pEngine->sAlloc,pEngine->aEntry,nNew * sizeof(mem_hash_entry));
+			if( aNew == 0 ){
+				return UNQLITE_NOMEM;
+			}
+			pEngine->aEntry = aNew;
+			pEngine->nEntryAlloc = nNew;
+		}
+	}
+	/* Key and data in a single blob */
+	zBlob = MemArenaAlloc(pEngine,pEngine->nEntry,nKey + nData,&iSeg);
+	if( zBlob == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	SyMemcpy(pKey,zBlob,nKey);
+	SyMemcpy(pData,&zBlob[nKey],nData);
+	pEntry = &pEngine->aEntry[pEngine->nEntry];
+	pEntry->zBlob = zBlob;
+	pEntry->iSeg = iSeg;
+	pEntry->nHash = nHash;
+	pEntry->nKeyLen = nKey;
+	pEntry->nDataLen = nData;
+	*piEntry = pEngine->nEntry++;
+	return UNQLITE_OK;
+}
+/*
+ * Insert a new record.
+ */
+static int MemHashInsertRecord(
+	mem_hash_kv_engine *pEngine,
+	const void *pKey,sxu32 nKey,
+	const void *pData,sxu32 nData,
+	sxu32 nHash
+	)
+{
+	sxu32 iEntry;
+	int rc;
+	rc = MemHashReserveSlot(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = MemHashNewEntry(pEngine,pKey,nKey,pData,nData,nHash,&iEntry);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Link the entry */
+	MemHashTableInsert(&pEngine->sTable,nHash,iEntry);
+	pEngine->nRecord++;
+	return UNQLITE_OK;
+}
+/*
+ * Remove the record stored in a given slot.
+ */
+static void MemHashRemoveRecord(mem_hash_kv_engine *pEngine,mem_hash_table *pTable,sxu32 iSlot)
+{
+	mem_hash_entry *pEntry = &pEngine->aEntry[pTable->aSlot[iSlot]];
+	MemHashTableErase(pTable,iSlot);
+	/* Release the key and the data */
+	MemArenaRelease(pEngine,pEntry);
+	pEntry->zBlob = 0;
+	pEngine->nRecord--;
+}
 /*
  * Exported Interfaces.
  */
 /*
- * Each public cursor is identified by an instance of this structure.
+ * Current entry of a given cursor.
+ * A cursor pointing to a deleted entry move to the entry that follow.
  */
-typedef struct mem_hash_cursor mem_hash_cursor;
-struct mem_hash_cursor
+static mem_hash_entry * MemHashCursorEntry(mem_hash_cursor *pMem)
 {
-	unqlite_kv_engine *pStore; /* Must be first */
-	/* Private fields */
-	mem_hash_record *pCur;     /* Current hash record */
-};
+	mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pMem->pStore;
+	if( pMem->iEntry == MEM_HASH_NO_ENTRY ){
+		return 0;
+	}
+	while( pMem->iEntry < pEngine->nEntry ){
+		if( pEngine->aEntry[pMem->iEntry].zBlob ){
+			return &pEngine->aEntry[pMem->iEntry];
+		}
+		pMem->iEntry++;
+	}
+	pMem->iEntry = MEM_HASH_NO_ENTRY;
+	return 0;
+}
 /*
  * Initialize the cursor.
  */
@@ -285,16 +774,35 @@ static void MemHashInitCursor(unqlite_kv_cursor *pCursor)
 	 mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pCursor->pStore;
 	 mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
 	 /* Point to the first inserted entry */
-	 pMem->pCur = pEngine->pFirst;
+	 pMem->iEntry = 0;
+	 /* Link to the list of opened cursors */
+	 pMem->pNext = pEngine->pCursor;
+	 pEngine->pCursor = pMem;
+}
+/*
+ * Release the cursor.
+ */
+static void MemHashReleaseCursor(unqlite_kv_cursor *pCursor)
+{
+	 mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pCursor->pStore;
+	 mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
+	 mem_hash_cursor **ppCur;
+	 /* Unlink from the list of opened cursors */
+	 for( ppCur = &pEngine->pCursor ; *ppCur ; ppCur = &(*ppCur)->pNext ){
+		 if( *ppCur == pMem ){
+			 *ppCur = pMem->pNext;
+			 break;
+		 }
+	 }
 }
 /*
  * Point to the first entry.
  */
 static int MemHashCursorFirst(unqlite_kv_cursor *pCursor)
 {
-	 mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pCursor->pStore;
 	 mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	 pMem->pCur = pEngine->pFirst;
+	 pMem->iEntry = 0;
+	 MemHashCursorEntry(pMem);
 	 return UNQLITE_OK;
 }
 /*
@@ -304,7 +812,15 @@ static int MemHashCursorLast(unqlite_kv_cursor *pCursor)
 {
 	 mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pCursor->pStore;
 	 mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	 pMem->pCur = pEngine->pLast;
+	 sxu32 i = pEngine->nEntry;
+	 pMem->iEntry = MEM_HASH_NO_ENTRY;
+	 while( i > 0 ){
+		 i--;
+		 if( pEngine->aEntry[i].zBlob ){
+			 pMem->iEntry = i;
+			 break;
+		 }
+	 }
 	 return UNQLITE_OK;
 }
 /*
@@ -313,7 +829,7 @@ static int MemHashCursorLast(unqlite_kv_cursor *pCursor)
 static int MemHashCursorValid(unqlite_kv_cursor *pCursor)
 {
 	 mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	 return pMem->pCur != 0 ? 1 : 0;
+	 return MemHashCursorEntry(pMem) != 0 ? 1 : 0;
 }
 /*
  * Point to the next entry.
@@ -321,10 +837,11 @@ static int MemHashCursorValid(unqlite_kv_cursor *pCursor)
 static int MemHashCursorNext(unqlite_kv_cursor *pCursor)
 {
 	 mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	 if( pMem->pCur == 0){
+	 if( MemHashCursorEntry(pMem) == 0 ){
 		 return UNQLITE_EOF;
 	 }
-	 pMem->pCur = pMem->pCur->pPrev; /* Reverse link: Not a Bug */
+	 pMem->iEntry++;
+	 MemHashCursorEntry(pMem);
 	 return UNQLITE_OK;
 }
 /*
@@ -332,11 +849,21 @@ static int MemHashCursorNext(unqlite_kv_cursor *pCursor)
  */
 static int MemHashCursorPrev(unqlite_kv_cursor *pCursor)
 {
+	 mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pCursor->pStore;
 	 mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	 if( pMem->pCur == 0){
+	 sxu32 i;
+	 if( MemHashCursorEntry(pMem) == 0 ){
 		 return UNQLITE_EOF;
 	 }
-	 pMem->pCur = pMem->pCur->pNext; /* Reverse link: Not a Bug */
+	 i = pMem->iEntry;
+	 pMem->iEntry = MEM_HASH_NO_ENTRY;
+	 while( i > 0 ){
+		 i--;
+		 if( pEngine->aEntry[i].zBlob ){
+			 pMem->iEntry = i;
+			 break;
+		 }
+	 }
 	 return UNQLITE_OK;
 }
 /*
@@ -344,11 +871,11 @@ static int MemHashCursorPrev(unqlite_kv_cursor *pCursor)
  */
 static int MemHashCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
 {
-	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	if( pMem->pCur == 0){
+	mem_hash_entry *pEntry = MemHashCursorEntry((mem_hash_cursor *)pCursor);
+	if( pEntry == 0 ){
 		 return UNQLITE_EOF;
 	}
-	*pLen = (int)pMem->pCur->nKeyLen;
+	*pLen = (int)pEntry->nKeyLen;
 	return UNQLITE_OK;
 }
 /*
@@ -356,11 +883,11 @@ static int MemHashCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
  */
 static int MemHashCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
 {
-	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	if( pMem->pCur == 0 ){
+	mem_hash_entry *pEntry = MemHashCursorEntry((mem_hash_cursor *)pCursor);
+	if( pEntry == 0 ){
 		 return UNQLITE_EOF;
 	}
-	*pLen = pMem->pCur->nDataLen;
+	*pLen = pEntry->nDataLen;
 	return UNQLITE_OK;
 }
 /*
@@ -368,13 +895,13 @@ static int MemHashCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLe
  */
 static int MemHashCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
 {
-	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
+	mem_hash_entry *pEntry = MemHashCursorEntry((mem_hash_cursor *)pCursor);
 	int rc;
-	if( pMem->pCur == 0){
+	if( pEntry == 0 ){
 		 return UNQLITE_EOF;
 	}
 	/* Invoke the callback */
-	rc = xConsumer(pMem->pCur->pKey,pMem->pCur->nKeyLen,pUserData);
+	rc = xConsumer((const void *)pEntry->zBlob,pEntry->nKeyLen,pUserData);
 	/* Callback result */
 	return rc;
 }
@@ -383,13 +910,13 @@ static int MemHashCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const vo
  */
 static int MemHashCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
 {
-	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
+	mem_hash_entry *pEntry = MemHashCursorEntry((mem_hash_cursor *)pCursor);
 	int rc;
-	if( pMem->pCur == 0){
+	if( pEntry == 0 ){
 		 return UNQLITE_EOF;
 	}
 	/* Invoke the callback */
-	rc = xConsumer(pMem->pCur->pData,pMem->pCur->nDataLen,pUserData);
+	rc = xConsumer((const void *)&pEntry->zBlob[pEntry->nKeyLen],pEntry->nDataLen,pUserData);
 	/* Callback result */
 	return rc;
 }
@@ -399,24 +926,34 @@ static int MemHashCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const v
 static void MemHashCursorReset(unqlite_kv_cursor *pCursor)
 {
 	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	pMem->pCur = ((mem_hash_kv_engine *)pCursor->pStore)->pFirst;
+	pMem->iEntry = 0;
 }
 /*
  * Remove a particular record.
  */
 static int MemHashCursorDelete(unqlite_kv_cursor *pCursor)
 {
+	mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pCursor->pStore;
 	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
-	mem_hash_record *pNext;
-	if( pMem->pCur == 0 ){
+	mem_hash_table *pTable;
+	mem_hash_entry *pEntry;
+	sxu32 iSlot;
+	pEntry = MemHashCursorEntry(pMem);
+	if( pEntry == 0 ){
 		/* Cursor does not point to anything */
 		return UNQLITE_NOTFOUND;
 	}
-	pNext = pMem->pCur->pPrev;
-	/* Perform the deletion */
-	MemHashUnlinkRecord(pMem->pCur->pEngine,pMem->pCur);
-	/* Point to the next entry */
-	pMem->pCur = pNext;
+	if( pEngine->sOld.aCtrl ){
+		/* Resize in progress */
+		MemHashMigrate(pEngine,MEM_HASH_MIGRATE_STEP);
+	}
+	iSlot = MemHashGetSlot(pEngine,(const void *)pEntry->zBlob,pEntry->nKeyLen,pEntry->nHash,&pTable);
+	if( iSlot == MEM_HASH_NO_ENTRY ){
+		/* Cannot happen */
+		return UNQLITE_CORRUPT;
+	}
+	/* Perform the deletion, the cursor now point to the next entry */
+	MemHashRemoveRecord(pEngine,pTable,iSlot);
 	return UNQLITE_OK;
 }
 /*
@@ -426,15 +963,19 @@ static int MemHashCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nBy
 {
 	mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pCursor->pStore;
 	mem_hash_cursor *pMem = (mem_hash_cursor *)pCursor;
+	mem_hash_table *pTable;
+	sxu32 iSlot;
 	/* Perform the lookup */
-	pMem->pCur = MemHashGetEntry(pEngine,pKey,nByte);
-	if( pMem->pCur == 0 ){
+	iSlot = MemHashGetSlot(pEngine,pKey,(sxu32)nByte,pEngine->xHash(pKey,(sxu32)nByte),&pTable);
+	if( iSlot == MEM_HASH_NO_ENTRY ){
 		if( iPos != UNQLITE_CURSOR_MATCH_EXACT ){
 			/* noop; */
 		}
 		/* No such record */
+		pMem->iEntry = MEM_HASH_NO_ENTRY;
 		return UNQLITE_NOTFOUND;
 	}
+	pMem->iEntry = pTable->aSlot[iSlot];
 	return UNQLITE_OK;
 }
 /*
@@ -454,19 +995,16 @@ static sxu32 MemHashFunc(const void *pSrc,sxu32 nLen)
 	}	
 	return nH;
 }
-/* Default bucket size */
-#define MEM_HASH_BUCKET_SIZE 64
-/* Default fill factor */
-#define MEM_HASH_FILL_FACTOR 4 /* or 3 */
 /*
  * Initialize the in-memory storage engine.
  */
 static int MemHashInit(unqlite_kv_engine *pKvEngine,int iPageSize)
 {
 	mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pKvEngine;
+	(void)iPageSize; /* cc warning */
 	/* Note that this instance is already zeroed */	
 	/* Memory backend */
-	SyMemBackendInitFromParent(&pEngine->sAlloc,unqliteExportMemBackend());
+	SyMemBackendInitFromParent(&pEngine->sAlloc,unqliteKvIoMemBackend(pKvEngine->pIo));
 //#if defined(UNQLITE_ENABLE_THREADS)
 //	/* Already protected by the upper layers */
 //	SyMemBackendDisbaleMutexing(&pEngine->sAlloc);
@@ -475,15 +1013,12 @@ static int MemHashInit(unqlite_kv_engine *pKvEngine,int iPageSize)
 	pEngine->xHash = MemHashFunc;
 	pEngine->xCmp = SyMemcmp;
 	/* Allocate a new bucket */
-	pEngine->apBucket = (mem_hash_record **)SyMemBackendAlloc(&pEngine->sAlloc,MEM_HASH_BUCKET_SIZE * sizeof(mem_hash_record *));
-	if( pEngine->apBucket == 0 ){
-		SXUNUSED(iPageSize); /* cc warning */
+	if( MemHashTableInit(pEngine,&pEngine->sTable,MEM_HASH_BUCKET_SIZE / MEM_HASH_GROUP) != UNQLITE_OK ){
 		return UNQLITE_NOMEM;
 	}
-	/* Zero the bucket */
-	SyZero(pEngine->apBucket,MEM_HASH_BUCKET_SIZE * sizeof(mem_hash_record *));
 	pEngine->nRecord = 0;
-	pEngine->nBucket = MEM_HASH_BUCKET_SIZE;
+	/* Empty arena */
+	pEngine->iActive = pEngine->iFreeSeg = MEM_HASH_NO_ENTRY;
 	return UNQLITE_OK;
 }
 /*
@@ -523,6 +1058,57 @@ static int MemHashConfigure(unqlite_kv_engine *pKvEngine,int iOp,va_list ap)
 		}
 		break;
 									 }
+	case UNQLITE_KV_CONFIG_GET_HASH_FUNC: {
+		/* Current hash function */
+		ProcHash *pxHash = va_arg(ap,ProcHash *);
+		if( pxHash ){
+			*pxHash = pEngine->xHash;
+		}
+		break;
+										  }
+	case UNQLITE_KV_CONFIG_RESERVE: {
+		/* Size the hash table and the entry array for the expected number of records */
+		unqlite_int64 nReserve = va_arg(ap,unqlite_int64);
+		sxu32 nGroup = pEngine->sTable.nGroup;
+		sxu64 nWant;
+		if( nReserve <= 0 ){
+			break;
+		}
+		nWant = (sxu64)pEngine->nRecord + (sxu64)nReserve;
+		if( nWant >= SXU32_HIGH / 2 ){
+			rc = UNQLITE_FULL;
+			break;
+		}
+		while( (sxu64)nGroup * MEM_HASH_MAX_LOAD <= nWant ){
+			nGroup <<= 1;
+		}
+		if( nGroup > pEngine->sTable.nGroup ){
+			rc = MemHashResizeTable(pEngine,nGroup);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			/* Nothing to gain from an incremental migration here */
+			MemHashMigrate(pEngine,SXU32_HIGH);
+		}
+		if( (sxu64)pEngine->nEntry + (sxu64)nReserve > pEngine->nEntryAlloc ){
+			sxu32 nNew = pEngine->nEntry + (sxu32)nReserve;
+			sxu64 nByte = (sxu64)nNew * sizeof(mem_hash_entry);
+			mem_hash_entry *aNew;
+			if( nByte >= SXU32_HIGH ){
+				/* Entry table size overflow */
+				rc = UNQLITE_LIMIT;
+				break;
+			}
+			aNew = (mem_hash_entry *)SyMemBackendRealloc(&pEngine->sAlloc,pEngine->aEntry,(sxu32)nByte);
+			if( aNew == 0 ){
+				rc = UNQLITE_NOMEM;
+				break;
+			}
+			pEngine->aEntry = aNew;
+			pEngine->nEntryAlloc = nNew;
+		}
+		break;
+									}
 	default:
 		/* Unknown configuration option */
 		rc = UNQLITE_UNKNOWN;
@@ -539,49 +1125,38 @@ static int MemHashReplace(
 	  )
 {
 	mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pKv;
-	mem_hash_record *pRecord;
-	if( nDataLen > SXU32_HIGH ){
+	mem_hash_table *pTable;
+	mem_hash_entry *pEntry;
+	sxu32 nHash,iSlot;
+	if( nDataLen + nKeyLen > (unqlite_int64)MEM_ARENA_MAX_BLOB ){
 		/* Database limit */
 		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Record size limit reached");
 		return UNQLITE_LIMIT;
 	}
+	if( pEngine->sOld.aCtrl ){
+		/* Resize in progress */
+		MemHashMigrate(pEngine,MEM_HASH_MIGRATE_STEP);
+	}
 	/* Fetch the record first */
-	pRecord = MemHashGetEntry(pEngine,pKey,nKeyLen);
-	if( pRecord == 0 ){
-		/* Allocate a new record */
-		pRecord = MemHashNewRecord(pEngine,
-			pKey,nKeyLen,
-			pData,nDataLen,
-			pEngine->xHash(pKey,nKeyLen)
-			);
-		if( pRecord == 0 ){
-			return UNQLITE_NOMEM;
-		}
-		/* Link the entry */
-		MemHashLinkRecord(pEngine,pRecord);
-		if( (pEngine->nRecord >= pEngine->nBucket * MEM_HASH_FILL_FACTOR) && pEngine->nRecord < 100000 ){
-			/* Rehash the table */
-			MemHashGrowTable(pEngine);
-		}
+	nHash = pEngine->xHash(pKey,(sxu32)nKeyLen);
+	iSlot = MemHashGetSlot(pEngine,pKey,(sxu32)nKeyLen,nHash,&pTable);
+	if( iSlot == MEM_HASH_NO_ENTRY ){
+		/* Insert a new record */
+		return MemHashInsertRecord(pEngine,pKey,(sxu32)nKeyLen,pData,(sxu32)nDataLen,nHash);
 	}else{
 		sxu32 nData = (sxu32)nDataLen;
-		void *pNew;
+		sxu32 iEntry = pTable->aSlot[iSlot];
 		/* Replace an existing record */
-		if( nData == pRecord->nDataLen ){
-			/* No need to free the old chunk */
-			pNew = (void *)pRecord->pData;
-		}else{
-			pNew = SyMemBackendAlloc(&pEngine->sAlloc,nData);
-			if( pNew == 0 ){
+		pEntry = &pEngine->aEntry[iEntry];
+		if( nData != pEntry->nDataLen && !MemArenaResize(pEngine,pEntry,pEntry->nKeyLen + nData) ){
+			/* Move the blob, the key is preserved */
+			if( MemArenaRelocate(pEngine,iEntry,pEntry->nKeyLen + nData,pEntry->nKeyLen) != UNQLITE_OK ){
 				return UNQLITE_NOMEM;
 			}
-			/* Release the old data */
-			SyMemBackendFree(&pEngine->sAlloc,(void *)pRecord->pData);
 		}
 		/* Reflect the change */
-		pRecord->nDataLen = nData;
-		SyMemcpy(pData,pNew,nData);
-		pRecord->pData = pNew;
+		SyMemcpy(pData,&pEntry->zBlob[pEntry->nKeyLen],nData);
+		pEntry->nDataLen = nData;
 	}
 	return UNQLITE_OK;
 }
@@ -595,54 +1170,75 @@ static int MemHashAppend(
 	  )
 {
 	mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pKv;
-	mem_hash_record *pRecord;
-	if( nDataLen > SXU32_HIGH ){
+	mem_hash_table *pTable;
+	mem_hash_entry *pEntry;
+	sxu32 nHash,iSlot;
+	if( nDataLen + nKeyLen > (unqlite_int64)MEM_ARENA_MAX_BLOB ){
 		/* Database limit */
 		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Record size limit reached");
 		return UNQLITE_LIMIT;
 	}
+	if( pEngine->sOld.aCtrl ){
+		/* Resize in progress */
+		MemHashMigrate(pEngine,MEM_HASH_MIGRATE_STEP);
+	}
 	/* Fetch the record first */
-	pRecord = MemHashGetEntry(pEngine,pKey,nKeyLen);
-	if( pRecord == 0 ){
-		/* Allocate a new record */
-		pRecord = MemHashNewRecord(pEngine,
-			pKey,nKeyLen,
-			pData,nDataLen,
-			pEngine->xHash(pKey,nKeyLen)
-			);
-		if( pRecord == 0 ){
-			return UNQLITE_NOMEM;
-		}
-		/* Link the entry */
-		MemHashLinkRecord(pEngine,pRecord);
-		if( pEngine->nRecord * MEM_HASH_FILL_FACTOR >= pEngine->nBucket && pEngine->nRecord < 100000 ){
-			/* Rehash the table */
-			MemHashGrowTable(pEngine);
-		}
+	nHash = pEngine->xHash(pKey,(sxu32)nKeyLen);
+	iSlot = MemHashGetSlot(pEngine,pKey,(sxu32)nKeyLen,nHash,&pTable);
+	if( iSlot == MEM_HASH_NO_ENTRY ){
+		/* Insert a new record */
+		return MemHashInsertRecord(pEngine,pKey,(sxu32)nKeyLen,pData,(sxu32)nDataLen,nHash);
 	}else{
-		unqlite_int64 nNew = pRecord->nDataLen + nDataLen;
-		void *pOld = (void *)pRecord->pData;
-		sxu32 nData;
-		char *zNew;
+		sxu32 iEntry = pTable->aSlot[iSlot];
+		unqlite_int64 nNew;
+		pEntry = &pEngine->aEntry[iEntry];
+		nNew = (unqlite_int64)pEntry->nKeyLen + pEntry->nDataLen + nDataLen;
 		/* Append data to the existing record */
-		if( nNew > SXU32_HIGH ){
+		if( nNew > (unqlite_int64)MEM_ARENA_MAX_BLOB ){
 			/* Overflow */
 			pEngine->pIo->xErr(pEngine->pIo->pHandle,"Append operation will cause data overflow");	
 			return UNQLITE_LIMIT;
 		}
-		nData = (sxu32)nNew;
-		/* Allocate bigger chunk */
-		zNew = (char *)SyMemBackendRealloc(&pEngine->sAlloc,pOld,nData);
-		if( zNew == 0 ){
-			return UNQLITE_NOMEM;
+		/* Grow in place if possible, move the blob otherwise */
+		if( !MemArenaResize(pEngine,pEntry,(sxu32)nNew) &&
+			MemArenaRelocate(pEngine,iEntry,(sxu32)nNew,pEntry->nKeyLen + pEntry->nDataLen) != UNQLITE_OK ){
+				return UNQLITE_NOMEM;
 		}
 		/* Reflect the change */
-		SyMemcpy(pData,&zNew[pRecord->nDataLen],(sxu32)nDataLen);
-		pRecord->pData = (const void *)zNew;
-		pRecord->nDataLen = nData;
+		SyMemcpy(pData,&pEntry->zBlob[pEntry->nKeyLen + pEntry->nDataLen],(sxu32)nDataLen);
+		pEntry->nDataLen += (sxu32)nDataLen;
 	}
 	return UNQLITE_OK;
 }
+/*
+ * Fetch method: Consume the data of a given record without a cursor.
+ * The engine is not modified so several threads may fetch at the same
+ * time as long as no other method run (UNQLITE_KV_SHARED_READ).
+ * A NULL consumer only check for the existence of the record.
+ */
+static int MemHashFetch(
+	unqlite_kv_engine *pKvEngine,
+	const void *pKey,int nKeyLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData
+	)
+{
+	mem_hash_kv_engine *pEngine = (mem_hash_kv_engine *)pKvEngine;
+	mem_hash_table *pTable;
+	mem_hash_entry *pEntry;
+	sxu32 iSlot;
+	/* Perform the lookup */
+	iSlot = MemHashGetSlot(pEngine,pKey,(sxu32)nKeyLen,pEngine->xHash(pKey,(sxu32)nKeyLen),&pTable);
+	if( iSlot == MEM_HASH_NO_ENTRY ){
+		/* No such record */
+		return UNQLITE_NOTFOUND;
+	}
+	if( xConsumer == 0 ){
+		return UNQLITE_OK;
+	}
+	pEntry = &pEngine->aEntry[pTable->aSlot[iSlot]];
+	/* Invoke the callback */
+	return xConsumer((const void *)&pEntry->zBlob[pEntry->nKeyLen],pEntry->nDataLen,pUserData);
+}
 /*
  * Export the in-memory storage engine.
  */
@@ -652,7 +1248,7 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportMemKvStorage(void)
 		"mem",                      /* zName */
 		sizeof(mem_hash_kv_engine), /* szKv */
 		sizeof(mem_hash_cursor),    /* szCursor */
-		1,                          /* iVersion */
+		4,                          /* iVersion */
 		MemHashInit,                /* xInit */
 		MemHashRelease,             /* xRelease */
 		MemHashConfigure,           /* xConfig */
@@ -672,7 +1268,15 @@ UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportMemKvStorage(void)
 		MemHashCursorDataLength,    /* xDataLength */
 		MemHashCursorData,          /* xData */
 		MemHashCursorReset,         /* xReset */
-		0        /* xRelease */                        
+		MemHashReleaseCursor,       /* xCursorRelease */
+		0,                          /* xDataRef */
+		0,                          /* xDataRange */
+		0,                          /* xWriteRange */
+		0,                          /* xSync */
+		UNQLITE_KV_SHARED_READ,     /* iFlags */
+		MemHashFetch,               /* xFetch */
+		0,                          /* xRemove */
+		0                           /* xRemoveIf */
 	};
 	return &sMemStore;
 }
@@ -186,6 +186,32 @@ struct Page {
 #define PAGE_DONT_MAKE_HOT     0x080  /* Dont make this page Hot. In other words,
 									   * do not link it to the hot dirty list.
 									   */
+/*
+ * Image of a page as it was before being first modified under a savepoint.
+ * Images are kept in memory, newest first.
+ */
+typedef struct page_image page_image;
+struct page_image
+{
+  pgno iPage;                    /* Page number */
+  int bJournal;                  /* True if the page was journaled at the same time */
+  unsigned char *zData;          /* Page content */
+  page_image *pNext;             /* Next (older) image */
+};
+/*
+ * An open savepoint. Savepoints nest, the innermost is at the head of the list.
+ */
+typedef struct pager_savepoint pager_savepoint;
+struct pager_savepoint
+{
+  pgno nOrig;                    /* Database size when the savepoint was opened */
+  sxi64 iJournalOfft;            /* Journal offset when the savepoint was opened */
+  sxu32 nRec;                    /* Journal records written so far */
+  sxu32 nDirtyCommit;            /* Dirty commits applied so far */
+  sxu32 nImage;                  /* Page images recorded so far */
+  Bitvec *pImaged;               /* Pages whose image was recorded under this savepoint */
+  pager_savepoint *pOuter;       /* Enclosing savepoint */
+};
 /*
  * Each active database pager is represented by an instance of
  * the following structure.
@@ -235,6 +261,12 @@ struct Pager
   sxu32 nSize;                   /* apHash[] size: Must be a power of two  */
   sxu32 nPage;                   /* Total number of page loaded in memory */
   sxu32 nCacheMax;               /* Maximum page to cache*/
+  sxu32 nShed;                   /* Page allocations made while short of memory */
+  pager_savepoint *pSavepoint;   /* Innermost open savepoint */
+  int nSavepoint;                /* Total number of open savepoints */
+  page_image *pImage;            /* Page images recorded under the open savepoints */
+  sxu32 nImage;                  /* Total number of page images */
+  sxu32 nDirtyCommit;            /* Dirty commits applied by the current transaction */
 };
 /* Control flags */
 #define PAGER_CTRL_COMMIT_ERR   0x001 /* Commit error */
@@ -352,8 +384,10 @@ static Page * pager_fetch_page(Pager *pPager,pgno page_num)
 static Page * pager_alloc_page(Pager *pPager,pgno num_page)
 {
 	Page *pNew;
-	
-	pNew = (Page *)SyMemBackendPoolAlloc(pPager->pAllocator,sizeof(Page)+pPager->iPageSize);
+	/* Not a pool chunk: sizeof(Page)+iPageSize is just past a power of two and
+	 * would waste almost half of the chunk.
+	 */
+	pNew = (Page *)SyMemBackendAlloc(pPager->pAllocator,sizeof(Page)+pPager->iPageSize);
 	if( pNew == 0 ){
 		return 0;
 	}
@@ -392,7 +426,7 @@ static int pager_release_page(Pager *pPager,Page *pPage)
 			pPager->xPageUnpin(pPage->pUserData);
 		}
 		pPage->pUserData = 0;
-		SyMemBackendPoolFree(pPager->pAllocator,pPage);
+		SyMemBackendFree(pPager->pAllocator,pPage);
 	}else{
 		/* Dirty page, it will be released later when a dirty commit
 		 * or the final commit have been applied.
@@ -403,6 +437,28 @@ static int pager_release_page(Pager *pPager,Page *pPage)
 }
 /* Forward declaration */
 static int pager_unlink_page(Pager *pPager,Page *pPage);
+/*
+ * Add an unused dirty page to the list of hot dirty pages.
+ */
+static void pager_page_to_hot_list(Pager *pPager,Page *pPage)
+{
+	if( pPage->flags & (PAGE_HOT_DIRTY|PAGE_DONT_MAKE_HOT) ){
+		/* Already set or must not be made hot */
+		return;
+	}
+	pPage->pPrevHot = 0;
+	if( pPager->pFirstHot == 0 ){
+		pPager->pFirstHot = pPager->pHotDirty = pPage;
+	}else{
+		pPage->pNextHot = pPager->pHotDirty;
+		if( pPager->pHotDirty ){
+			pPager->pHotDirty->pPrevHot = pPage;
+		}
+		pPager->pHotDirty = pPage;
+	}
+	pPager->nHot++;
+	pPage->flags |= PAGE_HOT_DIRTY;
+}
 /*
  * Decrement the reference count of a given page.
  */
@@ -423,25 +479,8 @@ static void page_unref(Page *pPage)
 			/* Release the page */
 			pager_release_page(pPager,pPage);
 		}else{
-			if( pPage->flags & PAGE_DONT_MAKE_HOT ){
-				/* Do not add this page to the hot dirty list */
-				return;
-			}
-			if( !(pPage->flags & PAGE_HOT_DIRTY) ){
-				/* Add to the hot dirty list */
-				pPage->pPrevHot = 0;
-				if( pPager->pFirstHot == 0 ){
-					pPager->pFirstHot = pPager->pHotDirty = pPage;
-				}else{
-					pPage->pNextHot = pPager->pHotDirty;
-					if( pPager->pHotDirty ){
-						pPager->pHotDirty->pPrevHot = pPage;
-					}
-					pPager->pHotDirty = pPage;
-				}
-				pPager->nHot++;
-				pPage->flags |= PAGE_HOT_DIRTY;
-			}
+			/* Add to the hot dirty list */
+			pager_page_to_hot_list(pPager,pPage);
 		}
 	}
 }
@@ -517,6 +556,26 @@ static int pager_unlink_page(Pager *pPager,Page *pPage)
 	pPager->nPage--;
 	return UNQLITE_OK;
 }
+/*
+ * Release the unused clean pages of the cache.
+ * This is called when the handle is short of memory.
+ */
+static void pager_shed_pages(Pager *pPager)
+{
+	Page *pNext,*pPage = pPager->pAll;
+	for(;;){
+		if( pPage == 0 ){
+			break;
+		}
+		pNext = pPage->pNext;
+		if( pPage->nRef < 1 && !(pPage->flags & PAGE_DIRTY) && pPage != pPager->pHeader ){
+			/* Unused page, it will be read again from disk if needed */
+			pager_unlink_page(pPager,pPage);
+			pager_release_page(pPager,pPage);
+		}
+		pPage = pNext;
+	}
+}
 /*
  * Update the content of a cached page.
  */
@@ -1572,6 +1631,7 @@ UNQLITE_PRIVATE int unqlitePagerBegin(Pager *pPager)
 		pPager->dbOrigSize = pPager->dbSize;
 		pPager->iJournalOfft = 0;
 		pPager->nRec = 0;
+		pPager->nDirtyCommit = 0;
 		if( pPager->dbSize < 1 ){
 			/* Write the  database header */
 			rc = pager_create_header(pPager);
@@ -1692,12 +1752,109 @@ static int unqliteFinalizeJournal(Pager *pPager,int *pRetry,int close_jrnl)
 	}
 	return UNQLITE_OK;
 }
+/*
+ * Record the image of a page about to be modified if some open savepoint
+ * does not hold it yet. The image is shared by all the savepoints which
+ * lack it.
+ */
+static int pager_savepoint_record(Pager *pPager,Page *pPage,int bJournal)
+{
+	pager_savepoint *pSave;
+	page_image *pImage;
+	for( pSave = pPager->pSavepoint ; pSave ; pSave = pSave->pOuter ){
+		if( pPage->pgno < pSave->nOrig && !unqliteBitvecTest(pSave->pImaged,pPage->pgno) ){
+			break;
+		}
+	}
+	if( pSave == 0 ){
+		/* Page created after the savepoints or image already recorded */
+		return UNQLITE_OK;
+	}
+	pImage = (page_image *)SyMemBackendAlloc(pPager->pAllocator,sizeof(page_image) + pPager->iPageSize);
+	if( pImage == 0 ){
+		unqliteGenOutofMem(pPager->pDb);
+		return UNQLITE_NOMEM;
+	}
+	pImage->iPage = pPage->pgno;
+	pImage->bJournal = bJournal;
+	pImage->zData = (unsigned char *)&pImage[1];
+	SyMemcpy(pPage->zData,pImage->zData,pPager->iPageSize);
+	pImage->pNext = pPager->pImage;
+	pPager->pImage = pImage;
+	pPager->nImage++;
+	/* Mark as recorded */
+	for( ; pSave ; pSave = pSave->pOuter ){
+		if( pPage->pgno < pSave->nOrig && !unqliteBitvecTest(pSave->pImaged,pPage->pgno) ){
+			unqliteBitvecSet(pSave->pImaged,pPage->pgno);
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Fix the image marks of the savepoints enclosing the one being rolled back
+ * once the images recorded since it was opened are gone. A page whose image
+ * went away is imaged again on next write unless one of the remaining images
+ * was recorded under the enclosing savepoint.
+ */
+static void pager_savepoint_remark(Pager *pPager,pager_savepoint *pOuter,SySet *pPopped)
+{
+	pager_savepoint *pSave;
+	page_image *pImage;
+	pgno *aPage;
+	sxu32 i,iIdx;
+	aPage = (pgno *)SySetBasePtr(pPopped);
+	for( pSave = pOuter ; pSave ; pSave = pSave->pOuter ){
+		for( i = 0 ; i < SySetUsed(pPopped) ; ++i ){
+			if( aPage[i] < pSave->nOrig ){
+				unqliteBitvecClear(pSave->pImaged,aPage[i]);
+			}
+		}
+		/* Images are newest first, the newest has index nImage - 1 */
+		iIdx = pPager->nImage;
+		for( pImage = pPager->pImage ; pImage && iIdx > pSave->nImage ; pImage = pImage->pNext ){
+			iIdx--;
+			if( pImage->iPage < pSave->nOrig ){
+				unqliteBitvecSet(pSave->pImaged,pImage->iPage);
+			}
+		}
+	}
+}
+/*
+ * Close the given savepoint and the savepoints nested inside it (All the
+ * savepoints if pSave is NULL). Page images are released with the last
+ * savepoint.
+ */
+static void pager_savepoint_close(Pager *pPager,pager_savepoint *pSave)
+{
+	pager_savepoint *pOuter;
+	page_image *pNext;
+	while( pPager->pSavepoint ){
+		pOuter = pPager->pSavepoint->pOuter;
+		unqliteBitvecDestroy(pPager->pSavepoint->pImaged);
+		SyMemBackendFree(pPager->pAllocator,pPager->pSavepoint);
+		pPager->nSavepoint--;
+		if( pPager->pSavepoint == pSave ){
+			pPager->pSavepoint = pOuter;
+			break;
+		}
+		pPager->pSavepoint = pOuter;
+	}
+	if( pPager->pSavepoint == 0 ){
+		while( pPager->pImage ){
+			pNext = pPager->pImage->pNext;
+			SyMemBackendFree(pPager->pAllocator,pPager->pImage);
+			pPager->pImage = pNext;
+		}
+		pPager->nImage = 0;
+	}
+}
 /*
  * Mark a single data page as writeable. The page is written into the 
  * main journal as required.
  */
 static int page_write(Pager *pPager,Page *pPage)
 {
+	int bJournal = 0;
 	int rc;
 	if( !pPager->is_mem && !pPager->no_jrnl ){
 		/* Write the page to the transaction journal */
@@ -1724,6 +1881,14 @@ static int page_write(Pager *pPager,Page *pPage)
 			pPager->nRec++;
 			/* Mark as journalled  */
 			unqliteBitvecSet(pPager->pVec,pPage->pgno);
+			bJournal = 1;
+		}
+	}
+	if( pPager->pSavepoint ){
+		/* Keep the page image for partial rollback */
+		rc = pager_savepoint_record(pPager,pPage,bJournal);
+		if( rc != UNQLITE_OK ){
+			return rc;
 		}
 	}
 	/* Add the page to the dirty list */
@@ -1892,12 +2057,19 @@ static int pager_commit_phase1(Pager *pPager)
                 break;
             }
             pager_unlink_page(pPager, p);
+            if( p->nRef < 1 && p != pPager->pHeader ){
+                /* Unused, free it now instead of leaving it to the backend release */
+                pager_release_page(pPager, p);
+            }
         }
     }
 	/* If the file on disk is not the same size as the database image,
      * then use unqliteOsTruncate to grow or shrink the file here.
      */
-	if( pPager->dbSize != pPager->dbOrigSize ){
+	if( pPager->dbSize != pPager->dbOrigSize || pPager->nDirtyCommit > 0 ){
+		/* A dirty commit may have written pages past the end of the database
+		 * if a savepoint was rolled back afterwards.
+		 */
 		unqliteOsTruncate(pPager->pfd,pPager->iPageSize * pPager->dbSize);
 	}
 	/* Sync the database file */
@@ -1921,6 +2093,8 @@ static int pager_commit_phase2(Pager *pPager)
 				/* Finally, unlink the journal file */
 				unqliteOsDelete(pPager->pVfs,pPager->zJournal,1);
 			}
+			/* Discard the savepoints */
+			pager_savepoint_close(pPager,0);
 			/* Downgrade to shraed lock */
 			pager_unlock_db(pPager,SHARED_LOCK);
 			pPager->iState = PAGER_READER;
@@ -1972,6 +2146,7 @@ static int pager_dirty_commit(Pager *pPager)
 	}
 	pPager->pFirstHot = pPager->pHotDirty = 0;
 	pPager->nHot = 0;
+	pPager->nDirtyCommit++;
 	/* No need to sync the database file here, since the journal is already
 	 * open here and this is not the final commit.
 	 */
@@ -1990,7 +2165,15 @@ static int pager_dirty_commit(Pager *pPager)
 */
 UNQLITE_PRIVATE int unqlitePagerCommit(Pager *pPager)
 {
+	const unqlite_kv_methods *pMethods = pPager->pEngine->pIo->pMethods;
 	int rc;
+	if( pMethods->iVersion > 2 && pMethods->xSync ){
+		/* Let the storage engine write out its buffered data */
+		rc = pMethods->xSync(pPager->pEngine);
+		if( rc != UNQLITE_OK ){
+			goto fail;
+		}
+	}
 	/* Commit: Phase One */
 	rc = pager_commit_phase1(pPager);
 	if( rc != UNQLITE_OK ){
@@ -2010,16 +2193,45 @@ fail:
 	pPager->pDb->iFlags |= UNQLITE_FL_DISABLE_AUTO_COMMIT;
 	return rc;
 }
+/*
+ * Release the underlying KV engine state and reload it from the database pages.
+ */
+static int pager_reset_kv_engine(Pager *pPager)
+{
+	unqlite_kv_engine *pEngine = pPager->pEngine;
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	int rc;
+	if( pIo->pMethods->xRelease ){
+		/* Call the release callback */
+		pIo->pMethods->xRelease(pEngine);
+	}
+	/* Zero the structure */
+	SyZero(pEngine,(sxu32)pIo->pMethods->szKv);
+	/* Fill in */
+	pEngine->pIo = pIo;
+	if( pIo->pMethods->xInit ){
+		/* Call the init method */
+		rc = pIo->pMethods->xInit(pEngine,pPager->iPageSize);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	if( pIo->pMethods->xOpen ){
+		/* Call the xOpen method */
+		rc = pIo->pMethods->xOpen(pEngine,pPager->dbSize);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	return UNQLITE_OK;
+}
 /*
  * Reset the pager to its initial state. This is caused by
  * a rollback operation.
  */
 static int pager_reset_state(Pager *pPager,int bResetKvEngine)
 {
-	unqlite_kv_engine *pEngine = pPager->pEngine;
 	Page *pNext,*pPtr = pPager->pAll;
-	const unqlite_kv_io *pIo;
-	int rc;
 	/* Remove stale flags */
 	pPager->iFlags &= ~(PAGER_CTRL_COMMIT_ERR|PAGER_CTRL_DIRTY_COMMIT);
 	pPager->iJournalOfft = 0;
@@ -2052,34 +2264,14 @@ static int pager_reset_state(Pager *pPager,int bResetKvEngine)
 		unqliteBitvecDestroy(pPager->pVec);
 		pPager->pVec = 0;
 	}
+	/* Discard the savepoints */
+	pager_savepoint_close(pPager,0);
 	/* Switch back to shared lock */
 	pager_unlock_db(pPager,SHARED_LOCK);
 	pPager->iState = PAGER_READER;
 	if( bResetKvEngine ){
 		/* Reset the underlying KV engine */
-		pIo = pEngine->pIo;
-		if( pIo->pMethods->xRelease ){
-			/* Call the release callback */
-			pIo->pMethods->xRelease(pEngine);
-		}
-		/* Zero the structure */
-		SyZero(pEngine,(sxu32)pIo->pMethods->szKv);
-		/* Fill in */
-		pEngine->pIo = pIo;
-		if( pIo->pMethods->xInit ){
-			/* Call the init method */
-			rc = pIo->pMethods->xInit(pEngine,pPager->iPageSize);
-			if( rc != UNQLITE_OK ){
-				return rc;
-			}
-		}
-		if( pIo->pMethods->xOpen ){
-			/* Call the xOpen method */
-			rc = pIo->pMethods->xOpen(pEngine,pPager->dbSize);
-			if( rc != UNQLITE_OK ){
-				return rc;
-			}
-		}
+		return pager_reset_kv_engine(pPager);
 	}
 	/* All done */
 	return UNQLITE_OK;
@@ -2148,6 +2340,8 @@ UNQLITE_PRIVATE int unqlitePagerRollback(Pager *pPager,int bResetKvEngine)
 			return rc;
 		}
 	}else{
+		/* Discard the savepoints */
+		pager_savepoint_close(pPager,0);
 		/* Downgrade to shared lock */
 		pager_unlock_db(pPager,SHARED_LOCK);
 		pPager->iState = PAGER_READER;
@@ -2175,6 +2369,7 @@ static int unqlitePageWrite(unqlite_page *pMyPage)
 {
 	Page *pPage = (Page *)pMyPage;
 	Pager *pPager = pPage->pPager;
+	int bPressure;
 	int rc;
 	/* Begin the write transaction */
 	rc = unqlitePagerBegin(pPager);
@@ -2191,8 +2386,18 @@ static int unqlitePageWrite(unqlite_page *pMyPage)
 			return rc;
 		}
 	}
-	if( pPager->nHot > 127 ){
-		/* Write hot dirty pages */
+	bPressure = SyMemAccountPressure(pPager->pAllocator->pAccount) && !pPager->is_mem;
+	if( bPressure ){
+		Page *pDirty;
+		/* Short of memory, unused dirty pages are written early so they can be released */
+		for( pDirty = pPager->pDirty ; pDirty ; pDirty = pDirty->pDirtyNext ){
+			if( pDirty->nRef < 1 ){
+				pager_page_to_hot_list(pPager,pDirty);
+			}
+		}
+	}
+	if( pPager->nHot > 127 || (pPager->nHot > 0 && bPressure) ){
+		/* Write hot dirty pages (Early if the handle is short of memory) */
 		rc = pager_dirty_commit(pPager);
 		if( rc != UNQLITE_OK ){
 			/* A rollback must be done */
@@ -2237,8 +2442,17 @@ static int unqlitePagerAcquire(
 		return pPage ? UNQLITE_OK : UNQLITE_NOTFOUND;
 	}
 	if( pPage == 0 ){
+		if( SyMemAccountPressure(pPager->pAllocator->pAccount) && !pPager->is_mem && (pPager->nShed++ & 0x3F) == 0 ){
+			/* Short of memory, drop the unused pages first */
+			pager_shed_pages(pPager);
+		}
 		/* Allocate a new page */
 		pPage = pager_alloc_page(pPager,pgno);
+		if( pPage == 0 && !pPager->is_mem ){
+			/* Memory limit reached, drop the unused pages and try again */
+			pager_shed_pages(pPager);
+			pPage = pager_alloc_page(pPager,pgno);
+		}
 		if( pPage == 0 ){
 			unqliteGenOutofMem(pPager->pDb);
 			return UNQLITE_NOMEM;
@@ -2246,7 +2460,7 @@ static int unqlitePagerAcquire(
 		/* Read page contents */
 		rc = pager_get_page_contents(pPager,pPage,noContent);
 		if( rc != UNQLITE_OK ){
-			SyMemBackendPoolFree(pPager->pAllocator,pPage);
+			SyMemBackendFree(pPager->pAllocator,pPage);
 			return rc;
 		}
 		/* Link the page */
@@ -2262,6 +2476,231 @@ static int unqlitePagerAcquire(
 	}
 	return UNQLITE_OK;
 }
+/*
+ * Drop a cached page created after a savepoint which is being rolled back.
+ */
+static void pager_discard_page(Pager *pPager,Page *pPage)
+{
+	if( pPage->flags & PAGE_DIRTY ){
+		/* Unlink from the list of dirty pages */
+		if( pPage->pDirtyPrev ){
+			pPage->pDirtyPrev->pDirtyNext = pPage->pDirtyNext;
+		}else{
+			pPager->pDirty = pPage->pDirtyNext;
+		}
+		if( pPage->pDirtyNext ){
+			pPage->pDirtyNext->pDirtyPrev = pPage->pDirtyPrev;
+		}else{
+			pPager->pFirstDirty = pPage->pDirtyPrev;
+		}
+	}
+	if( pPage->flags & PAGE_HOT_DIRTY ){
+		/* Unlink from the list of hot dirty pages */
+		if( pPage->pPrevHot ){
+			pPage->pPrevHot->pNextHot = pPage->pNextHot;
+		}else{
+			pPager->pHotDirty = pPage->pNextHot;
+		}
+		if( pPager->pFirstHot == pPage ){
+			pPager->pFirstHot = pPage->pPrevHot;
+		}else if( pPage->pNextHot ){
+			pPage->pNextHot->pPrevHot = pPage->pPrevHot;
+		}
+		pPager->nHot--;
+	}
+	pPage->flags &= ~(PAGE_DIRTY|PAGE_DONT_WRITE|PAGE_NEED_SYNC|PAGE_IN_JOURNAL|PAGE_HOT_DIRTY);
+	pPage->pDirtyNext = pPage->pDirtyPrev = 0;
+	pPage->pNextHot = pPage->pPrevHot = 0;
+	if( pPage->nRef < 1 ){
+		pager_unlink_page(pPager,pPage);
+		pager_release_page(pPager,pPage);
+	}else{
+		/* Still referenced, read as a fresh page */
+		SyZero(pPage->zData,pPager->iPageSize);
+	}
+}
+/*
+ * Return true if savepoints are supported by this pager and its storage engine.
+ */
+UNQLITE_PRIVATE int unqlitePagerSavepointSupported(Pager *pPager)
+{
+	const unqlite_kv_methods *pMethods = pPager->pEngine->pIo->pMethods;
+	return !pPager->is_mem && pMethods->iVersion > 3 && (pMethods->iFlags & UNQLITE_KV_SAVEPOINT);
+}
+/*
+ * Open a new savepoint nested inside the current ones.
+ * A write transaction is started if not yet done.
+ */
+UNQLITE_PRIVATE int unqlitePagerSavepoint(Pager *pPager,int *pLevel)
+{
+	const unqlite_kv_methods *pMethods = pPager->pEngine->pIo->pMethods;
+	pager_savepoint *pSave;
+	int rc;
+	if( !unqlitePagerSavepointSupported(pPager) ){
+		unqliteGenErrorFormat(pPager->pDb,"Savepoints are not supported by the '%s' storage engine%s",
+			pMethods->zName,pPager->is_mem ? " of in-memory databases" : "");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	/* Begin the write transaction */
+	rc = unqlitePagerBegin(pPager);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pMethods->iVersion > 2 && pMethods->xSync ){
+		/* Let the storage engine write out its buffered data so that its state
+		 * can be reloaded from the pages when rolling back to this savepoint.
+		 */
+		rc = pMethods->xSync(pPager->pEngine);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	pSave = (pager_savepoint *)SyMemBackendAlloc(pPager->pAllocator,sizeof(pager_savepoint));
+	if( pSave == 0 ){
+		unqliteGenOutofMem(pPager->pDb);
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pSave,sizeof(pager_savepoint));
+	pSave->pImaged = unqliteBitvecCreate(pPager->pAllocator,pPager->dbSize);
+	if( pSave->pImaged == 0 ){
+		SyMemBackendFree(pPager->pAllocator,pSave);
+		unqliteGenOutofMem(pPager->pDb);
+		return UNQLITE_NOMEM;
+	}
+	pSave->nOrig = pPager->dbSize;
+	pSave->iJournalOfft = pPager->iJournalOfft;
+	pSave->nRec = pPager->nRec;
+	pSave->nDirtyCommit = pPager->nDirtyCommit;
+	pSave->nImage = pPager->nImage;
+	/* Push */
+	pSave->pOuter = pPager->pSavepoint;
+	pPager->pSavepoint = pSave;
+	pPager->nSavepoint++;
+	if( pLevel ){
+		*pLevel = pPager->nSavepoint;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Return the savepoint at the given nesting level (The innermost one
+ * if iLevel is less than one) or NULL if there is no such savepoint.
+ */
+static pager_savepoint * pager_savepoint_at(Pager *pPager,int iLevel)
+{
+	pager_savepoint *pSave = pPager->pSavepoint;
+	int n = pPager->nSavepoint;
+	if( iLevel < 1 ){
+		return pSave;
+	}
+	if( iLevel > n ){
+		return 0;
+	}
+	while( pSave && n > iLevel ){
+		pSave = pSave->pOuter;
+		n--;
+	}
+	return pSave;
+}
+/*
+ * Close the savepoint at the given nesting level and the savepoints nested
+ * inside it, keeping their changes.
+ */
+UNQLITE_PRIVATE int unqlitePagerSavepointRelease(Pager *pPager,int iLevel)
+{
+	pager_savepoint *pSave;
+	pSave = pager_savepoint_at(pPager,iLevel);
+	if( pSave == 0 ){
+		unqliteGenError(pPager->pDb,"No such savepoint");
+		return UNQLITE_NOTFOUND;
+	}
+	pager_savepoint_close(pPager,pSave);
+	return UNQLITE_OK;
+}
+/*
+ * Undo the changes made since the savepoint at the given nesting level was
+ * opened and close it as well as the savepoints nested inside it.
+ *
+ * Pages modified since are restored from their in-memory images, so neither
+ * the journal nor the database file are read. If no dirty commit was applied
+ * in the meantime, the pages journaled since are forgotten and the journal is
+ * rewound to where it was when the savepoint was opened. Pages created since
+ * are dropped. The storage engine then reload its state from the pages.
+ */
+UNQLITE_PRIVATE int unqlitePagerSavepointRollback(Pager *pPager,int iLevel)
+{
+	pager_savepoint *pSave;
+	page_image *pImage;
+	Page *pPage,*pNext;
+	SySet sPopped;
+	int bRewind;
+	int rc;
+	pSave = pager_savepoint_at(pPager,iLevel);
+	if( pSave == 0 ){
+		unqliteGenError(pPager->pDb,"No such savepoint");
+		return UNQLITE_NOTFOUND;
+	}
+	/* The engine state attached to the cached pages is rebuilt below */
+	for( pPage = pPager->pAll ; pPage ; pPage = pPage->pNext ){
+		if( pPager->xPageUnpin && pPage->pUserData ){
+			pPager->xPageUnpin(pPage->pUserData);
+		}
+		pPage->pUserData = 0;
+	}
+	bRewind = pSave->nDirtyCommit == pPager->nDirtyCommit && pSave->nRec != pPager->nRec;
+	/* Restore the page images, newest first so that the oldest image of each page wins */
+	SySetInit(&sPopped,pPager->pAllocator,sizeof(pgno));
+	rc = UNQLITE_OK;
+	while( pPager->nImage > pSave->nImage ){
+		pImage = pPager->pImage;
+		if( rc == UNQLITE_OK ){
+			rc = unqlitePagerAcquire(pPager,pImage->iPage,(unqlite_page **)&pPage,0,0);
+			if( rc == UNQLITE_OK ){
+				SyMemcpy(pImage->zData,pPage->zData,pPager->iPageSize);
+				pPage->flags &= ~PAGE_DONT_WRITE;
+				pager_page_to_dirty_list(pPager,pPage);
+				page_unref(pPage);
+			}
+		}
+		if( bRewind && pImage->bJournal ){
+			/* Journal again on next write */
+			unqliteBitvecClear(pPager->pVec,pImage->iPage);
+		}
+		if( pSave->pOuter && SySetPut(&sPopped,(const void *)&pImage->iPage) != SXRET_OK && rc == UNQLITE_OK ){
+			rc = UNQLITE_NOMEM;
+		}
+		pPager->pImage = pImage->pNext;
+		pPager->nImage--;
+		SyMemBackendFree(pPager->pAllocator,pImage);
+	}
+	/* The enclosing savepoints may no longer hold an image of the popped pages */
+	pager_savepoint_remark(pPager,pSave->pOuter,&sPopped);
+	SySetRelease(&sPopped);
+	if( bRewind ){
+		/* Records past this point are overwritten by the next journaled pages */
+		pPager->nRec = pSave->nRec;
+		pPager->iJournalOfft = pSave->iJournalOfft > 0 ? pSave->iJournalOfft : JOURNAL_HDR_SZ(pPager);
+	}
+	/* Drop the pages created since */
+	for( pPage = pPager->pAll ; pPage ; pPage = pNext ){
+		pNext = pPage->pNext;
+		if( pPage->pgno >= pSave->nOrig ){
+			pager_discard_page(pPager,pPage);
+		}
+	}
+	pPager->dbSize = pSave->nOrig;
+	/* Close the savepoints */
+	pager_savepoint_close(pPager,pSave);
+	if( rc == UNQLITE_OK ){
+		/* Reload the storage engine state */
+		rc = pager_reset_kv_engine(pPager);
+	}
+	if( rc != UNQLITE_OK ){
+		/* Mostly an unlikely scenario */
+		pPager->pDb->iFlags |= UNQLITE_FL_DISABLE_AUTO_COMMIT;
+		unqliteGenError(pPager->pDb,"Error while rolling back to a savepoint, rollback your database");
+	}
+	return rc;
+}
 /*
  * Return true if we are dealing with an in-memory database.
  */
@@ -2283,12 +2722,32 @@ static int unqliteInMemory(const char *zFilename)
 	}
 	return FALSE;
 }
+/*
+ * Size of the storage engine part of a cursor rounded up so that the
+ * tail fields which follow it are properly aligned.
+ */
+static sxu32 pager_cursor_size(unqlite_kv_methods *pMethods)
+{
+	sxu32 nByte = pMethods->szCursor;
+	if( nByte < sizeof(unqlite_kv_cursor) ){
+		nByte += sizeof(unqlite_kv_cursor);
+	}
+	return (nByte + 7) & ~7;
+}
+/*
+ * Return the tail fields of a cursor allocated by unqliteInitCursor().
+ */
+UNQLITE_PRIVATE unqlite_cursor_tail * unqliteCursorTail(unqlite_kv_cursor *pCur)
+{
+	return (unqlite_cursor_tail *)&((unsigned char *)pCur)[pager_cursor_size(pCur->pStore->pIo->pMethods)];
+}
 /*
  * Allocate a new KV cursor.
  */
 UNQLITE_PRIVATE int unqliteInitCursor(unqlite *pDb,unqlite_kv_cursor **ppOut)
 {
 	unqlite_kv_methods *pMethods;
+	unqlite_cursor_tail *pTail;
 	unqlite_kv_cursor *pCur;
 	sxu32 nByte;
 	/* Storage engine methods */
@@ -2298,10 +2757,8 @@ UNQLITE_PRIVATE int unqliteInitCursor(unqlite *pDb,unqlite_kv_cursor **ppOut)
 		unqliteGenErrorFormat(pDb,"Storage engine '%s' does not support cursors",pMethods->zName);
 		return UNQLITE_NOTIMPLEMENTED;
 	}
-	nByte = pMethods->szCursor;
-	if( nByte < sizeof(unqlite_kv_cursor) ){
-		nByte += sizeof(unqlite_kv_cursor);
-	}
+	/* Room for the tail fields */
+	nByte = pager_cursor_size(pMethods) + sizeof(unqlite_cursor_tail);
 	pCur = (unqlite_kv_cursor *)SyMemBackendPoolAlloc(&pDb->sMem,nByte);
 	if( pCur == 0 ){
 		unqliteGenOutofMem(pDb);
@@ -2311,6 +2768,8 @@ UNQLITE_PRIVATE int unqliteInitCursor(unqlite *pDb,unqlite_kv_cursor **ppOut)
 	SyZero(pCur,nByte);
 	/* Save the cursor */
 	pCur->pStore = pDb->sDB.pPager->pEngine;
+	pTail = unqliteCursorTail(pCur);
+	pTail->pDb = pDb;
 	/* Invoke the initialization callback if any */
 	if( pMethods->xCursorInit ){
 		pMethods->xCursorInit(pCur);
@@ -2327,6 +2786,8 @@ UNQLITE_PRIVATE int unqliteReleaseCursor(unqlite *pDb,unqlite_kv_cursor *pCur)
 	unqlite_kv_methods *pMethods;
 	/* Storage engine methods */
 	pMethods = pDb->sDB.pPager->pEngine->pIo->pMethods;
+	/* Discard the iteration bounds if any */
+	unqliteKvBoundRelease(pCur);
 	/* Invoke the release callback if available */
 	if( pMethods->xCursorRelease ){
 		pMethods->xCursorRelease(pCur);
@@ -2335,6 +2796,35 @@ UNQLITE_PRIVATE int unqliteReleaseCursor(unqlite *pDb,unqlite_kv_cursor *pCur)
 	SyMemBackendPoolFree(&pDb->sMem,pCur);
 	return UNQLITE_OK;
 }
+/*
+ * Hand out an idle cursor of this database handle or allocate a new one.
+ * Point operations borrow their own cursor rather than sharing a single one
+ * so that re-entrant calls (i.e. from a data consumer callback) do not move
+ * a cursor which is still in use. Callers hold the database handle so the
+ * pool need no locking of its own.
+ */
+UNQLITE_PRIVATE int unqliteBorrowCursor(unqlite *pDb,unqlite_kv_cursor **ppOut)
+{
+	unqlite_db *pStorage = &pDb->sDB;
+	if( pStorage->nCursor > 0 ){
+		*ppOut = pStorage->apCursor[--pStorage->nCursor];
+		return UNQLITE_OK;
+	}
+	return unqliteInitCursor(pDb,ppOut);
+}
+/*
+ * Give back a cursor obtained via unqliteBorrowCursor().
+ */
+UNQLITE_PRIVATE void unqliteReturnCursor(unqlite *pDb,unqlite_kv_cursor *pCur)
+{
+	unqlite_db *pStorage = &pDb->sDB;
+	if( pStorage->nCursor < UNQLITE_CURSOR_POOL ){
+		pStorage->apCursor[pStorage->nCursor++] = pCur;
+	}else{
+		/* Pool full */
+		unqliteReleaseCursor(pDb,pCur);
+	}
+}
 /*
  * Release the underlying KV storage engine and invoke
  * its associated callbacks if available.
@@ -2343,10 +2833,9 @@ static void pager_release_kv_engine(Pager *pPager)
 {
 	unqlite_kv_engine *pEngine = pPager->pEngine;
 	unqlite_db *pStorage = &pPager->pDb->sDB;
-	if( pStorage->pCursor ){
-		/* Release the associated cursor */
-		unqliteReleaseCursor(pPager->pDb,pStorage->pCursor);
-		pStorage->pCursor = 0;
+	while( pStorage->nCursor > 0 ){
+		/* Release the idle cursors */
+		unqliteReleaseCursor(pPager->pDb,pStorage->apCursor[--pStorage->nCursor]);
 	}
 	if( pEngine->pIo->pMethods->xRelease ){
 		pEngine->pIo->pMethods->xRelease(pEngine);
@@ -2408,23 +2897,114 @@ UNQLITE_PRIVATE int unqlitePagerRegisterKvEngine(Pager *pPager,unqlite_kv_method
 		pEngine->pIo = pIo;
 	}
 	pPager->pEngine = pEngine;
-	/* Allocate a new cursor */
-	rc = unqliteInitCursor(pDb,&pStorage->pCursor);
+	/* Allocate the first cursor of the pool */
+	rc = unqliteInitCursor(pDb,&pStorage->apCursor[0]);
 	if( rc != UNQLITE_OK ){
 		goto fail;
 	}
+	pStorage->nCursor = 1;
 	return UNQLITE_OK;
 fail:
 	SyMemBackendFree(&pDb->sMem,pEngine);
 	SyMemBackendFree(&pDb->sMem,pIo);
 	return rc;
 }
+/*
+ * Switch to a different KV storage engine.
+ * This is only allowed before the database is accessed. Note that for an existing database
+ * the engine recorded in the database header take precedence over the selected one.
+ */
+UNQLITE_PRIVATE int unqlitePagerSelectKvEngine(Pager *pPager,unqlite_kv_methods *pMethods)
+{
+	if( pPager->is_mem ? pPager->dbSize > 0 : pPager->iState != PAGER_OPEN ){
+		unqliteGenError(pPager->pDb,"Cannot change the underlying KV storage engine once the database is in use");
+		return UNQLITE_LOCKED;
+	}
+	return unqlitePagerRegisterKvEngine(pPager,pMethods);
+}
 /*
  * Return the underlying KV storage engine instance.
  */
 UNQLITE_PRIVATE unqlite_kv_engine * unqlitePagerGetKvEngine(unqlite *pDb)
 {
-	return pDb->sDB.pPager->pEngine;
+	Pager *pPager = pDb->sDB.pPager;
+	if( !pPager->is_mem && pPager->iState == PAGER_OPEN ){
+		/* 
+		 * Install the KV engine recorded in the database header now rather than on the
+		 * first page access so that the caller does not end up with a released engine.
+		 * Errors are reported again on the next page access.
+		 */
+		pager_shared_lock(pPager);
+	}
+	return pPager->pEngine;
+}
+/*
+ * Return the underlying KV storage engine if its operations can be invoked without
+ * holding the database handle mutex (UNQLITE_KV_CONCURRENT), NULL otherwise.
+ * Only in-memory databases qualify since the pager is not threadsafe.
+ */
+UNQLITE_PRIVATE unqlite_kv_engine * unqlitePagerGetConcurrentKvEngine(unqlite *pDb)
+{
+	Pager *pPager = pDb->sDB.pPager;
+	const unqlite_kv_methods *pMethods;
+	if( !pPager->is_mem || pPager->pEngine == 0 ){
+		return 0;
+	}
+	pMethods = pPager->pEngine->pIo->pMethods;
+	if( pMethods->iVersion < 4 || (pMethods->iFlags & UNQLITE_KV_CONCURRENT) == 0 ){
+		return 0;
+	}
+	return pPager->pEngine;
+}
+/*
+ * Return the underlying KV storage engine if its xFetch() method can be invoked by
+ * several readers at the same time (UNQLITE_KV_SHARED_READ), NULL otherwise.
+ */
+UNQLITE_PRIVATE unqlite_kv_engine * unqlitePagerGetSharedReadKvEngine(unqlite *pDb)
+{
+	Pager *pPager = pDb->sDB.pPager;
+	const unqlite_kv_methods *pMethods;
+	if( !pPager->is_mem || pPager->pEngine == 0 ){
+		return 0;
+	}
+	pMethods = pPager->pEngine->pIo->pMethods;
+	if( pMethods->iVersion < 4 || (pMethods->iFlags & UNQLITE_KV_SHARED_READ) == 0 || pMethods->xFetch == 0 ){
+		return 0;
+	}
+	return pPager->pEngine;
+}
+/*
+ * Return the path of the database file if a read-only handle opened on it see the
+ * same image of the database as the given handle, NULL otherwise (In-memory database
+ * or uncommitted changes). A shared lock is taken first so that no other process
+ * may commit until the handle is released. *pFlags receive the flags such handles
+ * should be opened with.
+ */
+UNQLITE_PRIVATE const char * unqlitePagerGetReadSource(unqlite *pDb,unsigned int *pFlags)
+{
+	Pager *pPager = pDb->sDB.pPager;
+	if( pPager->is_mem || pPager->zFilename == 0 ){
+		return 0;
+	}
+	if( pager_shared_lock(pPager) != UNQLITE_OK || pPager->iState != PAGER_READER ){
+		return 0;
+	}
+	*pFlags = UNQLITE_OPEN_READONLY|(pPager->iOpenFlags & UNQLITE_OPEN_MMAP);
+	return pPager->zFilename;
+}
+/*
+ * Return the read-only memory view of the whole database file (UNQLITE_OPEN_MMAP) and
+ * its size, NULL if the database file is not memory mapped.
+ * The view remain valid until the database handle is closed.
+ */
+UNQLITE_PRIVATE const unsigned char * unqlitePagerGetMmap(unqlite_kv_handle pHandle,unqlite_int64 *pnByte)
+{
+	Pager *pPager = (Pager *)pHandle;
+	if( (pPager->iOpenFlags & UNQLITE_OPEN_MMAP) == 0 || pPager->pMmap == 0 ){
+		return 0;
+	}
+	*pnByte = pPager->dbByteSize;
+	return (const unsigned char *)pPager->pMmap;
 }
 /*
 * Allocate and initialize a new Pager object. The pager should
@@ -2545,6 +3125,8 @@ UNQLITE_PRIVATE int unqlitePagerOpen(
 	}
 	/* Set the pager state */
 	if( pPager->is_mem ){
+		/* Page size for engines built on top of the pager (i.e. B+tree) */
+		pPager->iPageSize = unqliteGetPageSize();
 		pPager->iState = PAGER_WRITER_FINISHED;
 		pPager->iLock = EXCLUSIVE_LOCK;
 	}else{
@@ -2588,6 +3170,8 @@ UNQLITE_PRIVATE int unqlitePagerClose(Pager *pPager)
 		/* Close the file  */
 		unqliteOsCloseFree(pPager->pAllocator,pPager->pfd);
 	}
+	/* Discard the savepoints */
+	pager_savepoint_close(pPager,0);
 	if( pPager->pVec ){
 		unqliteBitvecDestroy(pPager->pVec);
 		pPager->pVec = 0;
@@ -2608,6 +3192,36 @@ UNQLITE_PRIVATE void unqlitePagerRandomString(Pager *pPager,char *zBuf,sxu32 nLe
 		 zBuf[i] = zBase[zBuf[i] % (sizeof(zBase)-1)];
 	 }
 }
+/*
+ * Open a temporary file next to the database file where large sorts
+ * spill their sorted runs. The file is deleted when closed.
+ * In-memory databases have no such file.
+ */
+UNQLITE_PRIVATE int unqlitePagerOpenSpill(Pager *pPager,unqlite_file **ppOut)
+{
+	char zRand[9];
+	char *zPath;
+	sxu32 n;
+	int rc;
+	if( pPager->is_mem || pPager->zFilename == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	n = SyStrlen(pPager->zFilename) + sizeof("_unqlite_sort_") + sizeof(zRand);
+	zPath = (char *)SyMemBackendAlloc(pPager->pAllocator,n);
+	if( zPath == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	unqlitePagerRandomString(pPager,zRand,sizeof(zRand) - 1);
+	zRand[sizeof(zRand) - 1] = 0;
+	SyBufferFormat(zPath,n,"%s_unqlite_sort_%s",pPager->zFilename,zRand);
+	rc = unqliteOsOpen(pPager->pVfs,pPager->pAllocator,zPath,ppOut,
+		UNQLITE_OPEN_READWRITE|UNQLITE_OPEN_CREATE|UNQLITE_OPEN_EXCLUSIVE|UNQLITE_OPEN_TEMP_DB);
+	if( rc != UNQLITE_OK ){
+		unqliteGenErrorFormat(pPager->pDb,"Cannot open temporary sort file '%s'",zPath);
+	}
+	SyMemBackendFree(pPager->pAllocator,zPath);
+	return rc;
+}
 /*
  * Generate a random number.
  */
@@ -2797,7 +3411,8 @@ static void unqliteKvIoPageReload(unqlite_kv_handle pHandle,void (*xPageReload)(
 static void unqliteKvIoErr(unqlite_kv_handle pHandle,const char *zErr)
 {
 	Pager *pPager = (Pager *)pHandle;
-	unqliteGenError(pPager->pDb,zErr);
+	/* Concurrent storage engines may report errors without the handle mutex held */
+	unqliteGenErrorLocked(pPager->pDb,zErr);
 }
 /*
  * Init an instance of the [unqlite_kv_io] structure.
@@ -2831,3 +3446,17 @@ static int pager_kv_io_init(Pager *pPager,unqlite_kv_methods *pMethods,unqlite_k
 
 	return UNQLITE_OK;
 }
+/*
+ * Return the memory backend a storage engine should derive its private allocator
+ * from so that the engine memory is charged to the database handle that own it.
+ * Engines instantiated outside the pager (i.e: Partitions of the sharded engine)
+ * get the global allocator.
+ */
+UNQLITE_PRIVATE const SyMemBackend * unqliteKvIoMemBackend(const unqlite_kv_io *pIo)
+{
+	if( pIo && pIo->xErr == unqliteKvIoErr ){
+		Pager *pPager = (Pager *)pIo->pHandle;
+		return &pPager->pDb->sMem;
+	}
+	return unqliteExportMemBackend();
+}
@@ -0,0 +1,841 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: range.c v1.0 Unix 2018-06-25 11:02 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements bounded cursor iteration, that is the
+ * [unqlite_kv_cursor_seek_prefix()] and [unqlite_kv_cursor_seek_range()] interfaces,
+ * as well as the bulk delete interfaces built on top of it ([unqlite_kv_delete_prefix()],
+ * [unqlite_kv_delete_range()] and [unqlite_kv_delete_if()]).
+ *
+ * Storage engines advertising UNQLITE_KV_ORDERED iterate in key order. The cursor is
+ * then positioned via a single seek and each step simply check the bounds.
+ * Other engines (i.e. the default hash engine) walk every record once, keep the keys
+ * within the bounds and sort them. When the kept keys of an on-disk database exceed
+ * UNQLITE_KV_SORT_BUFFER bytes, sorted runs are spilled to a temporary file and merged
+ * while iterating. Each step then position the engine cursor via an exact seek so that
+ * records deleted in the meantime are skipped while records inserted after the initial
+ * seek are not visited.
+ */
+/*
+ * Iteration modes.
+ */
+#define KV_BOUND_ORDERED 1 /* Native iteration of an ordered engine */
+#define KV_BOUND_SORTED  2 /* Sorted keys held in memory */
+#define KV_BOUND_MERGE   3 /* Sorted runs merged from the spill file */
+/*
+ * Read buffer of each spilled run and write buffer of the spill file.
+ */
+#define KV_RUN_BUFFER 16384
+/*
+ * A sorted run stored in the spill file. Each key is stored as a 4 byte
+ * big-endian length followed by the raw key.
+ */
+typedef struct kv_bound_run kv_bound_run;
+struct kv_bound_run
+{
+	sxi64 iOfft;          /* Offset of the next byte to be read in the spill file */
+	sxi64 iEnd;           /* End of the run in the spill file */
+	unsigned char *zBuf;  /* Read buffer */
+	sxu32 nBuf;           /* Bytes in the read buffer */
+	sxu32 iBuf;           /* Next byte to consume in the read buffer */
+	SyBlob sKey;          /* Current key */
+};
+/*
+ * Bounds of a cursor (See unqlite_cursor_tail).
+ */
+struct unqlite_kv_bound
+{
+	unqlite *pDb;          /* Database handle that own the cursor */
+	int iMode;             /* Iteration mode (KV_BOUND_ORDERED, etc.) */
+	int bPrefix;           /* True for a prefix iteration (sLow hold the prefix) */
+	int bEof;              /* True when the cursor moved past the bounds */
+	SyBlob sLow;           /* Lower bound (inclusive) or prefix. Empty for no bound */
+	SyBlob sHigh;          /* Upper bound (exclusive). Empty for no bound */
+	SyBlob sKey;           /* Key of the current record */
+	/* KV_BOUND_SORTED */
+	SyBlob sKeys;          /* Collected keys */
+	kv_sort_key *aKey;     /* Sorted keys */
+	sxu32 nKey;            /* Total collected keys */
+	sxu32 nAlloc;          /* Allocated entries in aKey[] */
+	sxu32 iKey;            /* Current key in aKey[] (nKey past the end) */
+	/* KV_BOUND_MERGE */
+	unqlite_file *pSpill;  /* Spill file */
+	sxi64 iSpill;          /* Spill file size */
+	kv_bound_run *aRun;    /* Spilled runs */
+	sxu32 nRun;            /* Total spilled runs */
+	sxu32 *aHeap;          /* Min-heap of the runs which are not exhausted */
+	sxu32 nHeap;           /* Entries in aHeap[] */
+};
+/*
+ * Check whether the given key lies within the bounds.
+ */
+static int BoundContains(unqlite_kv_bound *pBound,const void *pKey,sxu32 nKey)
+{
+	sxu32 nLow = SyBlobLength(&pBound->sLow);
+	sxu32 nHigh = SyBlobLength(&pBound->sHigh);
+	if( pBound->bPrefix ){
+		return nKey >= nLow && SyMemcmp(pKey,SyBlobData(&pBound->sLow),nLow) == 0;
+	}
+	if( nLow > 0 && unqliteKvKeyCmp(pKey,nKey,SyBlobData(&pBound->sLow),nLow) < 0 ){
+		return 0;
+	}
+	if( nHigh > 0 && unqliteKvKeyCmp(pKey,nKey,SyBlobData(&pBound->sHigh),nHigh) >= 0 ){
+		return 0;
+	}
+	return 1;
+}
+/*
+ * Check the record the cursor of an ordered engine point to, stepping in the
+ * given direction past the expiration metadata first.
+ * The bounds are exhausted when the cursor is invalid or out of bounds.
+ */
+static int BoundCheck(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound,int bForward)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	int rc;
+	rc = unqliteKvTtlSkip(pBound->pDb,pCur,bForward);
+	if( rc != UNQLITE_OK && pMethods->xValid(pCur) ){
+		return rc;
+	}
+	if( !pMethods->xValid(pCur) ){
+		pBound->bEof = 1;
+		return UNQLITE_OK;
+	}
+	SyBlobReset(&pBound->sKey);
+	rc = pMethods->xKey(pCur,unqliteDataConsumer,&pBound->sKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( !BoundContains(pBound,SyBlobData(&pBound->sKey),SyBlobLength(&pBound->sKey)) ){
+		pBound->bEof = 1;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Point the cursor of an ordered engine to the first record greater than
+ * or equal to the given key (The first record if the key is empty).
+ */
+static int BoundSeekOrdered(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound,const void *pKey,sxu32 nKey)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	int rc;
+	if( nKey > 0 ){
+		rc = pMethods->xSeek(pCur,pKey,(int)nKey,UNQLITE_CURSOR_MATCH_GE);
+	}else{
+		rc = pMethods->xFirst(pCur);
+	}
+	if( rc == UNQLITE_NOTFOUND || rc == UNQLITE_DONE || rc == UNQLITE_EOF ){
+		/* Nothing at or past the key */
+		pBound->bEof = 1;
+		return UNQLITE_OK;
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return BoundCheck(pCur,pBound,1);
+}
+/*
+ * Compare the current keys of two spilled runs.
+ */
+static int BoundRunCmp(unqlite_kv_bound *pBound,sxu32 iA,sxu32 iB)
+{
+	SyBlob *pA = &pBound->aRun[iA].sKey;
+	SyBlob *pB = &pBound->aRun[iB].sKey;
+	return unqliteKvKeyCmp(SyBlobData(pA),SyBlobLength(pA),SyBlobData(pB),SyBlobLength(pB));
+}
+/*
+ * Restore the heap property of the run heap from the given entry down.
+ */
+static void BoundHeapSift(unqlite_kv_bound *pBound,sxu32 i)
+{
+	sxu32 *aHeap = pBound->aHeap;
+	sxu32 iChild,iTmp;
+	for(;;){
+		iChild = (i << 1) + 1;
+		if( iChild >= pBound->nHeap ){
+			break;
+		}
+		if( iChild + 1 < pBound->nHeap && BoundRunCmp(pBound,aHeap[iChild + 1],aHeap[iChild]) < 0 ){
+			iChild++;
+		}
+		if( BoundRunCmp(pBound,aHeap[i],aHeap[iChild]) <= 0 ){
+			break;
+		}
+		iTmp = aHeap[i];
+		aHeap[i] = aHeap[iChild];
+		aHeap[iChild] = iTmp;
+		i = iChild;
+	}
+}
+/*
+ * Read nByte bytes of a spilled run either in the zOut buffer or,
+ * if zOut is NULL, at the end of the current key of the run.
+ */
+static int BoundRunRead(unqlite_kv_bound *pBound,kv_bound_run *pRun,unsigned char *zOut,sxu32 nByte)
+{
+	sxi64 nRead;
+	sxu32 n;
+	int rc;
+	while( nByte > 0 ){
+		if( pRun->iBuf >= pRun->nBuf ){
+			/* Refill the read buffer */
+			nRead = pRun->iEnd - pRun->iOfft;
+			if( nRead <= 0 ){
+				return UNQLITE_CORRUPT;
+			}
+			if( nRead > KV_RUN_BUFFER ){
+				nRead = KV_RUN_BUFFER;
+			}
+			rc = unqliteOsRead(pBound->pSpill,pRun->zBuf,nRead,pRun->iOfft);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			pRun->iOfft += nRead;
+			pRun->nBuf = (sxu32)nRead;
+			pRun->iBuf = 0;
+		}
+		n = pRun->nBuf - pRun->iBuf;
+		if( n > nByte ){
+			n = nByte;
+		}
+		if( zOut ){
+			SyMemcpy((const void *)&pRun->zBuf[pRun->iBuf],(void *)zOut,n);
+			zOut += n;
+		}else if( SyBlobAppend(&pRun->sKey,(const void *)&pRun->zBuf[pRun->iBuf],n) != SXRET_OK ){
+			return UNQLITE_NOMEM;
+		}
+		pRun->iBuf += n;
+		nByte -= n;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Load the next key of a spilled run.
+ * Return UNQLITE_DONE when the run is exhausted.
+ */
+static int BoundRunNext(unqlite_kv_bound *pBound,kv_bound_run *pRun)
+{
+	unsigned char zLen[4];
+	sxu32 nLen;
+	int rc;
+	if( pRun->iBuf >= pRun->nBuf && pRun->iOfft >= pRun->iEnd ){
+		return UNQLITE_DONE;
+	}
+	rc = BoundRunRead(pBound,pRun,zLen,sizeof(zLen));
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack32(zLen,&nLen);
+	SyBlobReset(&pRun->sKey);
+	return BoundRunRead(pBound,pRun,0,nLen);
+}
+/*
+ * Sort the collected keys and write them as a new run at the end of the spill file.
+ */
+static int BoundSpill(unqlite_kv_bound *pBound)
+{
+	const char *zBase = (const char *)SyBlobData(&pBound->sKeys);
+	SyMemBackend *pAlloc = &pBound->pDb->sMem;
+	unsigned char zLen[4];
+	kv_bound_run *pRun;
+	SyBlob sOut;
+	sxu32 i;
+	int rc;
+	rc = unqliteKvSortKeys(pAlloc,zBase,pBound->aKey,pBound->nKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( (pBound->nRun & 15) == 0 ){
+		/* Room for the new run */
+		kv_bound_run *aNew;
+		aNew = (kv_bound_run *)SyMemBackendRealloc(pAlloc,pBound->aRun,(pBound->nRun + 16) * sizeof(kv_bound_run));
+		if( aNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		pBound->aRun = aNew;
+	}
+	pRun = &pBound->aRun[pBound->nRun];
+	SyZero(pRun,sizeof(kv_bound_run));
+	pRun->iOfft = pBound->iSpill;
+	SyBlobInit(&sOut,pAlloc);
+	for( i = 0 ; i < pBound->nKey ; ++i ){
+		SyBigEndianPack32(zLen,pBound->aKey[i].nLen);
+		if( SyBlobAppend(&sOut,(const void *)zLen,sizeof(zLen)) != SXRET_OK ||
+			SyBlobAppend(&sOut,(const void *)&zBase[pBound->aKey[i].iOfft],pBound->aKey[i].nLen) != SXRET_OK ){
+				rc = UNQLITE_NOMEM;
+				break;
+		}
+		if( SyBlobLength(&sOut) >= KV_RUN_BUFFER || i + 1 >= pBound->nKey ){
+			/* Flush the write buffer */
+			rc = unqliteOsWrite(pBound->pSpill,SyBlobData(&sOut),(unqlite_int64)SyBlobLength(&sOut),pBound->iSpill);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			pBound->iSpill += SyBlobLength(&sOut);
+			SyBlobReset(&sOut);
+		}
+	}
+	SyBlobRelease(&sOut);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pRun->iEnd = pBound->iSpill;
+	SyBlobInit(&pRun->sKey,pAlloc);
+	pBound->nRun++;
+	/* Start collecting the next run */
+	SyBlobReset(&pBound->sKeys);
+	pBound->nKey = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Walk every record and collect the keys which lie within the bounds.
+ */
+static int BoundCollect(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	unqlite *pDb = pBound->pDb;
+	int bSpill = 1;
+	sxu32 n;
+	int rc = UNQLITE_OK;
+	pMethods->xFirst(pCur);
+	while( pMethods->xValid(pCur) ){
+		n = SyBlobLength(&pBound->sKeys);
+		rc = pMethods->xKey(pCur,unqliteDataConsumer,&pBound->sKeys);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		if( unqliteKvTtlReserved(&((const char *)SyBlobData(&pBound->sKeys))[n],SyBlobLength(&pBound->sKeys) - n) ||
+			!BoundContains(pBound,&((const char *)SyBlobData(&pBound->sKeys))[n],SyBlobLength(&pBound->sKeys) - n) ){
+			/* Out of bounds or expiration metadata, discard */
+			SyBlobTruncate(&pBound->sKeys,n);
+		}else{
+			if( pBound->nKey >= pBound->nAlloc ){
+				sxu32 nNew = pBound->nAlloc > 0 ? pBound->nAlloc << 1 : 1024;
+				kv_sort_key *aNew;
+				aNew = (kv_sort_key *)SyMemBackendRealloc(&pDb->sMem,pBound->aKey,nNew * sizeof(kv_sort_key));
+				if( aNew == 0 ){
+					rc = UNQLITE_NOMEM;
+					break;
+				}
+				pBound->aKey = aNew;
+				pBound->nAlloc = nNew;
+			}
+			pBound->aKey[pBound->nKey].iOfft = n;
+			pBound->aKey[pBound->nKey].nLen = SyBlobLength(&pBound->sKeys) - n;
+			pBound->nKey++;
+			if( bSpill && SyBlobLength(&pBound->sKeys) >= UNQLITE_KV_SORT_BUFFER ){
+				if( pBound->pSpill == 0 ){
+					rc = unqlitePagerOpenSpill(pDb->sDB.pPager,&pBound->pSpill);
+					if( rc == UNQLITE_NOTIMPLEMENTED ){
+						/* In-memory database, keep everything in memory */
+						bSpill = 0;
+						rc = UNQLITE_OK;
+					}
+				}
+				if( rc == UNQLITE_OK && pBound->pSpill ){
+					rc = BoundSpill(pBound);
+				}
+				if( rc != UNQLITE_OK ){
+					break;
+				}
+			}
+		}
+		pMethods->xNext(pCur);
+	}
+	return rc;
+}
+/*
+ * Release the collected keys.
+ */
+static void BoundFreeKeys(unqlite_kv_bound *pBound)
+{
+	SyBlobRelease(&pBound->sKeys);
+	if( pBound->aKey ){
+		SyMemBackendFree(&pBound->pDb->sMem,pBound->aKey);
+		pBound->aKey = 0;
+	}
+	pBound->nKey = pBound->nAlloc = pBound->iKey = 0;
+}
+/*
+ * Load the first key of each spilled run and build the run heap.
+ */
+static int BoundMergeStart(unqlite_kv_bound *pBound)
+{
+	SyMemBackend *pAlloc = &pBound->pDb->sMem;
+	kv_bound_run *pRun;
+	sxu32 i;
+	int rc;
+	pBound->aHeap = (sxu32 *)SyMemBackendAlloc(pAlloc,pBound->nRun * sizeof(sxu32));
+	if( pBound->aHeap == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	for( i = 0 ; i < pBound->nRun ; ++i ){
+		pRun = &pBound->aRun[i];
+		pRun->zBuf = (unsigned char *)SyMemBackendAlloc(pAlloc,KV_RUN_BUFFER);
+		if( pRun->zBuf == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		rc = BoundRunNext(pBound,pRun);
+		if( rc == UNQLITE_OK ){
+			pBound->aHeap[pBound->nHeap++] = i;
+		}else if( rc != UNQLITE_DONE ){
+			return rc;
+		}
+	}
+	for( i = pBound->nHeap >> 1 ; i > 0 ; --i ){
+		BoundHeapSift(pBound,i - 1);
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Move to the following key in the sorted key set or the run heap.
+ * Spilled runs are merged forward only.
+ */
+static int BoundAdvance(unqlite_kv_bound *pBound,int bForward)
+{
+	int rc;
+	if( pBound->iMode == KV_BOUND_SORTED ){
+		if( bForward ){
+			if( pBound->iKey < pBound->nKey ){
+				pBound->iKey++;
+			}
+		}else{
+			pBound->iKey = (pBound->iKey > 0 && pBound->iKey < pBound->nKey) ? pBound->iKey - 1 : pBound->nKey;
+		}
+		return UNQLITE_OK;
+	}
+	if( pBound->nHeap < 1 ){
+		return UNQLITE_OK;
+	}
+	rc = BoundRunNext(pBound,&pBound->aRun[pBound->aHeap[0]]);
+	if( rc == UNQLITE_DONE ){
+		/* Run exhausted */
+		pBound->aHeap[0] = pBound->aHeap[--pBound->nHeap];
+	}else if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	BoundHeapSift(pBound,0);
+	return UNQLITE_OK;
+}
+/*
+ * Point the engine cursor to the current sorted key, skipping the keys
+ * whose record was deleted since they were collected.
+ */
+static int BoundSettle(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound,int bForward)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	const void *pKey;
+	sxu32 nKey;
+	int rc;
+	for(;;){
+		if( pBound->iMode == KV_BOUND_SORTED ){
+			if( pBound->iKey >= pBound->nKey ){
+				break;
+			}
+			pKey = (const void *)&((const char *)SyBlobData(&pBound->sKeys))[pBound->aKey[pBound->iKey].iOfft];
+			nKey = pBound->aKey[pBound->iKey].nLen;
+		}else{
+			if( pBound->nHeap < 1 ){
+				break;
+			}
+			pKey = SyBlobData(&pBound->aRun[pBound->aHeap[0]].sKey);
+			nKey = SyBlobLength(&pBound->aRun[pBound->aHeap[0]].sKey);
+		}
+		rc = pMethods->xSeek(pCur,pKey,(int)nKey,UNQLITE_CURSOR_MATCH_EXACT);
+		if( rc != UNQLITE_NOTFOUND ){
+			return rc;
+		}
+		/* Record deleted meanwhile */
+		rc = BoundAdvance(pBound,bForward);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	pBound->bEof = 1;
+	return UNQLITE_OK;
+}
+/*
+ * Release the resources held by the bounds.
+ */
+static void BoundFree(unqlite_kv_bound *pBound)
+{
+	SyMemBackend *pAlloc = &pBound->pDb->sMem;
+	sxu32 i;
+	BoundFreeKeys(pBound);
+	SyBlobRelease(&pBound->sLow);
+	SyBlobRelease(&pBound->sHigh);
+	SyBlobRelease(&pBound->sKey);
+	for( i = 0 ; i < pBound->nRun ; ++i ){
+		SyBlobRelease(&pBound->aRun[i].sKey);
+		if( pBound->aRun[i].zBuf ){
+			SyMemBackendFree(pAlloc,pBound->aRun[i].zBuf);
+		}
+	}
+	if( pBound->aRun ){
+		SyMemBackendFree(pAlloc,pBound->aRun);
+	}
+	if( pBound->aHeap ){
+		SyMemBackendFree(pAlloc,pBound->aHeap);
+	}
+	if( pBound->pSpill ){
+		/* The spill file is deleted on close */
+		unqliteOsCloseFree(pAlloc,pBound->pSpill);
+	}
+	SyMemBackendFree(pAlloc,pBound);
+}
+/*
+ * Discard the bounds of the given cursor if any so that it iterate
+ * over the whole database again.
+ */
+UNQLITE_PRIVATE void unqliteKvBoundRelease(unqlite_kv_cursor *pCur)
+{
+	unqlite_cursor_tail *pTail = unqliteCursorTail(pCur);
+	if( pTail->pBound ){
+		BoundFree(pTail->pBound);
+		pTail->pBound = 0;
+	}
+}
+/*
+ * Point the cursor to the first record within the given bounds and restrict
+ * the following cursor moves to those bounds.
+ * When bPrefix is set, pLow hold a prefix and the bounds are made of every
+ * key starting with it. Otherwise the bounds are the half-open [pLow,pHigh)
+ * range where an empty bound is unlimited.
+ * Return UNQLITE_NOTFOUND when no record lies within the bounds.
+ */
+UNQLITE_PRIVATE int unqliteKvBoundSeek(unqlite_kv_cursor *pCur,const void *pLow,sxu32 nLow,const void *pHigh,sxu32 nHigh,int bPrefix)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	unqlite_cursor_tail *pTail = unqliteCursorTail(pCur);
+	SyMemBackend *pAlloc = &pTail->pDb->sMem;
+	unqlite_kv_bound *pBound;
+	int rc;
+	/* Discard the previous bounds */
+	unqliteKvBoundRelease(pCur);
+	pBound = (unqlite_kv_bound *)SyMemBackendAlloc(pAlloc,sizeof(unqlite_kv_bound));
+	if( pBound == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pBound,sizeof(unqlite_kv_bound));
+	pBound->pDb = pTail->pDb;
+	pBound->bPrefix = bPrefix;
+	SyBlobInit(&pBound->sLow,pAlloc);
+	SyBlobInit(&pBound->sHigh,pAlloc);
+	SyBlobInit(&pBound->sKey,pAlloc);
+	SyBlobInit(&pBound->sKeys,pAlloc);
+	pTail->pBound = pBound;
+	if( (nLow > 0 && SyBlobAppend(&pBound->sLow,pLow,nLow) != SXRET_OK) ||
+		(nHigh > 0 && SyBlobAppend(&pBound->sHigh,pHigh,nHigh) != SXRET_OK) ){
+			unqliteKvBoundRelease(pCur);
+			return UNQLITE_NOMEM;
+	}
+	if( pMethods->iVersion > 3 && (pMethods->iFlags & UNQLITE_KV_ORDERED) ){
+		/* Native iteration */
+		pBound->iMode = KV_BOUND_ORDERED;
+		rc = BoundSeekOrdered(pCur,pBound,pLow,nLow);
+	}else{
+		pBound->iMode = KV_BOUND_SORTED;
+		rc = BoundCollect(pCur,pBound);
+		if( rc == UNQLITE_OK ){
+			if( pBound->nRun > 0 ){
+				/* Spill the last run and merge */
+				if( pBound->nKey > 0 ){
+					rc = BoundSpill(pBound);
+				}
+				BoundFreeKeys(pBound);
+				pBound->iMode = KV_BOUND_MERGE;
+				if( rc == UNQLITE_OK ){
+					rc = BoundMergeStart(pBound);
+				}
+			}else{
+				rc = unqliteKvSortKeys(pAlloc,(const char *)SyBlobData(&pBound->sKeys),pBound->aKey,pBound->nKey);
+			}
+		}
+		if( rc == UNQLITE_OK ){
+			rc = BoundSettle(pCur,pBound,1);
+		}
+	}
+	if( rc != UNQLITE_OK ){
+		unqliteKvBoundRelease(pCur);
+		return rc;
+	}
+	return pBound->bEof ? UNQLITE_NOTFOUND : UNQLITE_OK;
+}
+/*
+ * Move a bounded cursor to the next (bForward) or previous record within its bounds.
+ * Return UNQLITE_DONE when the cursor already moved past the bounds.
+ */
+UNQLITE_PRIVATE int unqliteKvBoundStep(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound,int bForward)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	int rc;
+	if( pBound->bEof ){
+		return UNQLITE_DONE;
+	}
+	if( pBound->iMode == KV_BOUND_ORDERED ){
+		if( (bForward ? pMethods->xNext : pMethods->xPrev) == 0 ){
+			return UNQLITE_NOTIMPLEMENTED;
+		}
+		rc = bForward ? pMethods->xNext(pCur) : pMethods->xPrev(pCur);
+		if( rc != UNQLITE_OK && pMethods->xValid(pCur) ){
+			return rc;
+		}
+		return BoundCheck(pCur,pBound,bForward);
+	}
+	if( !bForward && pBound->iMode == KV_BOUND_MERGE ){
+		/* Spilled runs are merged forward only */
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	rc = BoundAdvance(pBound,bForward);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return BoundSettle(pCur,pBound,bForward);
+}
+/*
+ * Check whether a bounded cursor point to a record within its bounds.
+ */
+UNQLITE_PRIVATE int unqliteKvBoundValid(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound)
+{
+	if( pBound->bEof ){
+		return 0;
+	}
+	return pCur->pStore->pIo->pMethods->xValid(pCur);
+}
+/*
+ * Delete the record a bounded cursor point to and move to the next record
+ * within the bounds.
+ */
+UNQLITE_PRIVATE int unqliteKvBoundDelete(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	int rc;
+	if( pBound->bEof ){
+		return UNQLITE_DONE;
+	}
+	if( pMethods->xDelete == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	if( pBound->iMode == KV_BOUND_ORDERED ){
+		/* Remember the key so that the cursor can be repositioned past it */
+		SyBlobReset(&pBound->sKey);
+		rc = pMethods->xKey(pCur,unqliteDataConsumer,&pBound->sKey);
+		if( rc == UNQLITE_OK ){
+			rc = pMethods->xDelete(pCur);
+		}
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		return BoundSeekOrdered(pCur,pBound,SyBlobData(&pBound->sKey),SyBlobLength(&pBound->sKey));
+	}
+	rc = pMethods->xDelete(pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = BoundAdvance(pBound,1);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return BoundSettle(pCur,pBound,1);
+}
+/*
+ * State of a bulk delete.
+ */
+typedef struct kv_purge kv_purge;
+struct kv_purge
+{
+	unqlite_kv_bound sBound;  /* Key bounds (Only sLow, sHigh and bPrefix are used) */
+	int bBounded;             /* True if the keys are bounded */
+	ProcKvFilter xFilter;     /* Caller predicate (NULL if none) */
+	void *pUserData;          /* xFilter() last argument */
+};
+/*
+ * Select the records to be removed by a bulk delete.
+ */
+static int PurgeSelect(const void *pKey,unsigned int nKey,void *pUserData)
+{
+	kv_purge *pPurge = (kv_purge *)pUserData;
+	if( unqliteKvTtlReserved(pKey,nKey) ){
+		/* Expiration metadata are dropped with their record */
+		return 0;
+	}
+	if( pPurge->bBounded && !BoundContains(&pPurge->sBound,pKey,nKey) ){
+		return 0;
+	}
+	if( pPurge->xFilter ){
+		return pPurge->xFilter(pKey,nKey,pPurge->pUserData);
+	}
+	return 1;
+}
+/*
+ * Bulk delete over an ordered engine: Visit the bounded keys only.
+ */
+static int PurgeOrdered(unqlite *pDb,kv_purge *pPurge,sxi64 *pnRemoved)
+{
+	unqlite_kv_bound *pBound;
+	unqlite_kv_cursor *pCur;
+	int rc;
+	rc = unqliteInitCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = unqliteKvBoundSeek(pCur,
+		SyBlobData(&pPurge->sBound.sLow),SyBlobLength(&pPurge->sBound.sLow),
+		SyBlobData(&pPurge->sBound.sHigh),SyBlobLength(&pPurge->sBound.sHigh),
+		pPurge->sBound.bPrefix);
+	if( rc == UNQLITE_NOTFOUND ){
+		/* Nothing to remove */
+		rc = UNQLITE_OK;
+	}
+	pBound = unqliteCursorTail(pCur)->pBound;
+	while( rc == UNQLITE_OK && unqliteKvBoundValid(pCur,pBound) ){
+		/* The current key was loaded while checking the bounds */
+		if( PurgeSelect(SyBlobData(&pBound->sKey),SyBlobLength(&pBound->sKey),pPurge) ){
+			rc = unqliteKvBoundDelete(pCur,pBound);
+			if( rc == UNQLITE_OK ){
+				(*pnRemoved)++;
+			}
+		}else{
+			rc = unqliteKvBoundStep(pCur,pBound,1);
+		}
+	}
+	unqliteReleaseCursor(pDb,pCur);
+	return rc;
+}
+/*
+ * Bulk delete fallback: Collect the selected keys in a single pass, then remove
+ * each record via an exact seek.
+ */
+static int PurgeWalk(unqlite *pDb,kv_purge *pPurge,sxi64 *pnRemoved)
+{
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_cursor *pCur;
+	kv_sort_key *aKey = 0;
+	sxu32 nKey = 0,nAlloc = 0,i,n;
+	const char *zBase;
+	SyBlob sKeys;
+	int rc;
+	rc = unqliteInitCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pMethods = pCur->pStore->pIo->pMethods;
+	SyBlobInit(&sKeys,&pDb->sMem);
+	pMethods->xFirst(pCur);
+	while( pMethods->xValid(pCur) ){
+		n = SyBlobLength(&sKeys);
+		rc = pMethods->xKey(pCur,unqliteDataConsumer,&sKeys);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		if( !PurgeSelect(&((const char *)SyBlobData(&sKeys))[n],SyBlobLength(&sKeys) - n,pPurge) ){
+			SyBlobTruncate(&sKeys,n);
+		}else{
+			if( nKey >= nAlloc ){
+				sxu32 nNew = nAlloc > 0 ? nAlloc << 1 : 1024;
+				kv_sort_key *aNew;
+				aNew = (kv_sort_key *)SyMemBackendRealloc(&pDb->sMem,aKey,nNew * sizeof(kv_sort_key));
+				if( aNew == 0 ){
+					rc = UNQLITE_NOMEM;
+					break;
+				}
+				aKey = aNew;
+				nAlloc = nNew;
+			}
+			aKey[nKey].iOfft = n;
+			aKey[nKey].nLen = SyBlobLength(&sKeys) - n;
+			nKey++;
+		}
+		pMethods->xNext(pCur);
+	}
+	zBase = (const char *)SyBlobData(&sKeys);
+	for( i = 0 ; i < nKey && rc == UNQLITE_OK ; ++i ){
+		rc = pMethods->xSeek(pCur,&zBase[aKey[i].iOfft],(int)aKey[i].nLen,UNQLITE_CURSOR_MATCH_EXACT);
+		if( rc == UNQLITE_OK ){
+			rc = pMethods->xDelete(pCur);
+			if( rc == UNQLITE_OK ){
+				(*pnRemoved)++;
+			}
+		}else if( rc == UNQLITE_NOTFOUND ){
+			rc = UNQLITE_OK;
+		}
+	}
+	if( aKey ){
+		SyMemBackendFree(&pDb->sMem,aKey);
+	}
+	SyBlobRelease(&sKeys);
+	unqliteReleaseCursor(pDb,pCur);
+	return rc;
+}
+/*
+ * Remove every record whose key lies within the given bounds (See unqliteKvBoundSeek()),
+ * or every record if there are no bounds, and is selected by the optional xFilter()
+ * predicate. Expiration metadata records are never selected, they are dropped together
+ * with their record.
+ * Ordered engines visit the bounded keys only. Engines implementing the xRemoveIf()
+ * method remove the records in a single pass. Other engines collect the selected keys
+ * first. The number of removed records is stored in *pnRemoved if not NULL.
+ * The caller must hold the database handle mutex.
+ */
+UNQLITE_PRIVATE int unqliteKvPurge(
+	unqlite *pDb,
+	const void *pLow,sxu32 nLow,
+	const void *pHigh,sxu32 nHigh,
+	int bPrefix,
+	ProcKvFilter xFilter,void *pUserData,
+	unqlite_int64 *pnRemoved
+	)
+{
+	unqlite_kv_engine *pEngine = unqlitePagerGetKvEngine(pDb);
+	unqlite_kv_methods *pMethods = pEngine->pIo->pMethods;
+	sxi64 nRemoved = 0;
+	kv_purge sPurge;
+	int rc,rc2;
+	if( pMethods->xDelete == 0 ){
+		unqliteGenError(pDb,"xDelete() method not implemented in the underlying storage engine");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	SyZero(&sPurge,sizeof(kv_purge));
+	SyBlobInit(&sPurge.sBound.sLow,&pDb->sMem);
+	SyBlobInit(&sPurge.sBound.sHigh,&pDb->sMem);
+	sPurge.sBound.bPrefix = bPrefix;
+	sPurge.bBounded = nLow > 0 || nHigh > 0;
+	sPurge.xFilter = xFilter;
+	sPurge.pUserData = pUserData;
+	if( (nLow > 0 && SyBlobAppend(&sPurge.sBound.sLow,pLow,nLow) != SXRET_OK) ||
+		(nHigh > 0 && SyBlobAppend(&sPurge.sBound.sHigh,pHigh,nHigh) != SXRET_OK) ){
+			rc = UNQLITE_NOMEM;
+	}else if( sPurge.bBounded && pMethods->iVersion > 3 && (pMethods->iFlags & UNQLITE_KV_ORDERED) ){
+		rc = PurgeOrdered(pDb,&sPurge,&nRemoved);
+	}else if( pMethods->iVersion > 4 && pMethods->xRemoveIf ){
+		rc = pMethods->xRemoveIf(pEngine,PurgeSelect,&sPurge,&nRemoved);
+	}else{
+		rc = PurgeWalk(pDb,&sPurge,&nRemoved);
+	}
+	if( nRemoved > 0 ){
+		/* Drop the expiration time of the removed records */
+		rc2 = unqliteKvTtlPrune(pDb);
+		if( rc == UNQLITE_OK ){
+			rc = rc2;
+		}
+	}
+	SyBlobRelease(&sPurge.sBound.sLow);
+	SyBlobRelease(&sPurge.sBound.sHigh);
+	if( pnRemoved ){
+		*pnRemoved = nRemoved;
+	}
+	return rc;
+}
@@ -0,0 +1,222 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: shard_db.c v1.0 Unix 2018-06-18 09:14 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements the [unqlite_shard_open()] family of interfaces which
+ * horizontally partition a database across several files.
+ *
+ * Each shard is an ordinary database handle opened via [unqlite_open()] on the
+ * file named after the base path followed by a dot and the shard number
+ * (i.e: 'test.db.0', 'test.db.1', ...) so that every shard has its own lock,
+ * journal and fsync stream. Records are routed to a shard by hash of their
+ * key. A collection is routed by hash of its name and lives entirely in that
+ * shard (See [unqlite_shard_locate()] and [unqlite_shard_handle()]).
+ *
+ * The hash must remain stable across releases since it decides where the
+ * records of an existing sharded database are stored. The shard count is not
+ * recorded, a sharded database must thus always be opened with the same count.
+ *
+ * Commit is issued to every shard in parallel when the shard handles are
+ * thread-safe (Via the asynchronous interfaces, see async.c) and one shard
+ * after the other otherwise. Shards commit independently, there is no atomic
+ * commit across shards.
+ *
+ * Cursors walk the shards one after the other.
+ */
+#if defined(UNQLITE_ENABLE_THREADS)
+/*
+ * Collect the completion status of an asynchronous commit.
+ */
+static void ShardCommitDone(void *pUserData,int rc)
+{
+	int *pRc = (int *)pUserData;
+	*pRc = rc;
+}
+#endif
+/*
+ * Open a sharded database. When zPath is NULL, empty or ":mem:", every shard
+ * is an in-memory database.
+ */
+UNQLITE_PRIVATE int unqliteShardOpen(unqlite_shard **ppOut,const char *zPath,int nShard,unsigned int iMode)
+{
+	SyMemBackend *pAlloc = (SyMemBackend *)unqliteExportMemBackend();
+	unqlite_shard *pShard;
+	char *zName = 0;
+	sxu32 nName = 0;
+	sxu32 n;
+	int i,rc;
+	/* Allocate a new instance */
+	pShard = (unqlite_shard *)SyMemBackendAlloc(pAlloc,sizeof(unqlite_shard) + nShard * sizeof(unqlite *));
+	if( pShard == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	SyZero(pShard,sizeof(unqlite_shard) + nShard * sizeof(unqlite *));
+	pShard->apDb = (unqlite **)&pShard[1];
+	n = zPath ? SyStrlen(zPath) : 0;
+	if( n > 0 && (n != sizeof(":mem:") - 1 || SyStrnicmp(zPath,":mem:",sizeof(":mem:") - 1) != 0) ){
+		/* Room for the shard file names */
+		nName = n + sizeof(".4294967295");
+		zName = (char *)SyMemBackendAlloc(pAlloc,nName);
+		if( zName == 0 ){
+			SyMemBackendFree(pAlloc,pShard);
+			return UNQLITE_NOMEM;
+		}
+	}
+	rc = UNQLITE_OK;
+	for( i = 0 ; i < nShard ; ++i ){
+		if( zName ){
+			SyBufferFormat(zName,nName,"%s.%d",zPath,i);
+		}
+		rc = unqlite_open(&pShard->apDb[i],zName ? zName : ":mem:",iMode);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		pShard->nShard++;
+	}
+	if( zName ){
+		SyMemBackendFree(pAlloc,zName);
+	}
+	if( rc != UNQLITE_OK ){
+		/* Close the shards opened so far */
+		unqliteShardClose(pShard);
+		return rc;
+	}
+	pShard->nMagic = UNQLITE_SHARD_MAGIC;
+	*ppOut = pShard;
+	return UNQLITE_OK;
+}
+/*
+ * Close every shard and release the instance.
+ * Return the first error reported by a shard.
+ */
+UNQLITE_PRIVATE int unqliteShardClose(unqlite_shard *pShard)
+{
+	int i,rc,rc2;
+	rc = UNQLITE_OK;
+	pShard->nMagic = 0x1234; /* Stale */
+	for( i = 0 ; i < pShard->nShard ; ++i ){
+		rc2 = unqlite_close(pShard->apDb[i]);
+		if( rc == UNQLITE_OK ){
+			rc = rc2;
+		}
+	}
+	SyMemBackendFree((SyMemBackend *)unqliteExportMemBackend(),pShard);
+	return rc;
+}
+/*
+ * Index of the shard owning the given key.
+ */
+UNQLITE_PRIVATE int unqliteShardLocate(unqlite_shard *pShard,const void *pKey,sxu32 nKeyLen)
+{
+	return (int)(SyBinHash(pKey,nKeyLen) % (sxu32)pShard->nShard);
+}
+/*
+ * Commit every shard. Return the first error reported by a shard.
+ */
+UNQLITE_PRIVATE int unqliteShardCommit(unqlite_shard *pShard)
+{
+	int aRc[UNQLITE_SHARD_MAX];
+	char aQueued[UNQLITE_SHARD_MAX];
+	int i,rc;
+	SyZero(aQueued,sizeof(aQueued));
+#if defined(UNQLITE_ENABLE_THREADS)
+	if( pShard->nShard > 1 ){
+		/* Overlap the fsync() of the thread-safe shards */
+		for( i = 0 ; i < pShard->nShard ; ++i ){
+			if( pShard->apDb[i]->pMutex == 0 ){
+				continue;
+			}
+			if( unqlite_commit_async(pShard->apDb[i],ShardCommitDone,&aRc[i]) == UNQLITE_OK ){
+				aQueued[i] = 1;
+			}
+		}
+	}
+#endif
+	rc = UNQLITE_OK;
+	for( i = 0 ; i < pShard->nShard ; ++i ){
+		if( aQueued[i] ){
+			/* Wait for the worker */
+			unqlite_async_wait(pShard->apDb[i]);
+		}else{
+			aRc[i] = unqlite_commit(pShard->apDb[i]);
+		}
+		if( rc == UNQLITE_OK ){
+			rc = aRc[i];
+		}
+	}
+	return rc;
+}
+/*
+ * Rollback every shard. Return the first error reported by a shard.
+ */
+UNQLITE_PRIVATE int unqliteShardRollback(unqlite_shard *pShard)
+{
+	int i,rc,rc2;
+	rc = UNQLITE_OK;
+	for( i = 0 ; i < pShard->nShard ; ++i ){
+		rc2 = unqlite_rollback(pShard->apDb[i]);
+		if( rc == UNQLITE_OK ){
+			rc = rc2;
+		}
+	}
+	return rc;
+}
+/*
+ * Point the cursor to the first (bForward) or last entry of the first
+ * non-empty shard starting at iShard and moving in the given direction.
+ * The cursor is left invalid when every remaining shard is empty.
+ */
+UNQLITE_PRIVATE int unqliteShardCursorSettle(unqlite_shard_cursor *pCursor,int iShard,int bForward)
+{
+	unqlite_shard *pShard = pCursor->pShard;
+	int rc;
+	while( iShard >= 0 && iShard < pShard->nShard ){
+		if( pCursor->pCur == 0 || pCursor->iShard != iShard ){
+			/* Switch to the cursor of this shard */
+			if( pCursor->pCur ){
+				unqlite_kv_cursor_release(pShard->apDb[pCursor->iShard],pCursor->pCur);
+				pCursor->pCur = 0;
+			}
+			rc = unqlite_kv_cursor_init(pShard->apDb[iShard],&pCursor->pCur);
+			if( rc != UNQLITE_OK ){
+				pCursor->pCur = 0;
+				return rc;
+			}
+			pCursor->iShard = iShard;
+		}
+		rc = bForward ? unqlite_kv_cursor_first_entry(pCursor->pCur) : unqlite_kv_cursor_last_entry(pCursor->pCur);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( unqlite_kv_cursor_valid_entry(pCursor->pCur) ){
+			/* Got an entry */
+			return UNQLITE_OK;
+		}
+		iShard += bForward ? 1 : -1;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Release the cursor of the current shard if any.
+ */
+UNQLITE_PRIVATE void unqliteShardCursorReset(unqlite_shard_cursor *pCursor)
+{
+	if( pCursor->pCur ){
+		unqlite_kv_cursor_release(pCursor->pShard->apDb[pCursor->iShard],pCursor->pCur);
+		pCursor->pCur = 0;
+	}
+	pCursor->iShard = -1;
+}
@@ -0,0 +1,643 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: shard_kv.c v1.0 Unix 2018-06-14 10:27 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements a sharded in-memory key value storage engine for unQLite.
+ * Like the default in-memory engine, it does not support transactions.
+ *
+ * Records are partitioned by key hash among UNQLITE_KV_SHARD_COUNT instances of
+ * the default in-memory engine (each with its own memory backend), and every
+ * partition is protected by its own lock. The engine advertise the
+ * UNQLITE_KV_CONCURRENT capability so that, for in-memory databases, the
+ * unqlite_kv_store(), unqlite_kv_fetch(), unqlite_kv_delete(), etc. interfaces do not
+ * serialize on the database handle mutex and threads working on different partitions
+ * run in parallel.
+ *
+ * Cursors walk the partitions one after the other, records are thus not iterated
+ * in insertion order.
+ *
+ * The engine is named "shard" and is selected via unqlite_config(UNQLITE_CONFIG_KV_ENGINE,"shard")
+ * before the database is accessed.
+ */
+#ifndef UNQLITE_KV_SHARD_COUNT
+#define UNQLITE_KV_SHARD_COUNT 16
+#endif
+#if (UNQLITE_KV_SHARD_COUNT < 1) || (UNQLITE_KV_SHARD_COUNT & (UNQLITE_KV_SHARD_COUNT - 1))
+#error "UNQLITE_KV_SHARD_COUNT must be a power of two"
+#endif
+/*
+ * Room reserved for a cursor of the partitions (64-bit words).
+ */
+#define SHARD_KV_CURSOR_SPACE 8
+/* Forward declaration */
+typedef struct shard_kv_engine shard_kv_engine;
+typedef struct shard_kv_cursor shard_kv_cursor;
+/*
+ * A partition.
+ */
+typedef struct shard_kv_slot shard_kv_slot;
+struct shard_kv_slot
+{
+	SyMutex *pMutex;            /* Partition lock, NULL when the library is not threadsafe */
+	unqlite_kv_engine *pStore;  /* In-memory engine holding the records of this partition */
+	unqlite_kv_io sIo;          /* IO methods of pStore */
+	const char *zErr;           /* Error reported by pStore while the lock was held */
+	sxu64 aCursor[SHARD_KV_CURSOR_SPACE]; /* Private cursor used for point lookups */
+};
+/*
+ * Each sharded KV engine is represented by an instance
+ * of the following structure.
+ */
+struct shard_kv_engine
+{
+	const unqlite_kv_io *pIo;   /* IO methods: MUST be first */
+	/* Private data */
+	SyMemBackend sAlloc;                  /* Private memory allocator */
+	const unqlite_kv_methods *pMethods;   /* Methods of the partitions */
+	const SyMutexMethods *pMutexMethods;  /* Mutex methods, NULL when the library is not threadsafe */
+	shard_kv_slot aShard[UNQLITE_KV_SHARD_COUNT]; /* Partitions */
+};
+/*
+ * Each public cursor is identified by an instance of this structure.
+ * The cursor of the partition it currently walk is embedded.
+ */
+struct shard_kv_cursor
+{
+	unqlite_kv_engine *pStore; /* Must be first */
+	/* Private fields */
+	sxu32 iShard;              /* Partition pCur is attached to */
+	sxu64 aCur[SHARD_KV_CURSOR_SPACE]; /* Cursor of the partition */
+};
+#define SHARD_KV_CUR(SHARD)   ((unqlite_kv_cursor *)(SHARD)->aCur)
+/* Lock/Unlock a given partition */
+#define SHARD_KV_ENTER(ENGINE,SLOT) SyMutexEnter((ENGINE)->pMutexMethods,(SLOT)->pMutex)
+#define SHARD_KV_LEAVE(ENGINE,SLOT) SyMutexLeave((ENGINE)->pMutexMethods,(SLOT)->pMutex)
+/*
+ * Partition of a given key.
+ * The hash function is unrelated to the one used by the partitions so that
+ * their hash tables are evenly loaded.
+ */
+static sxu32 ShardKvIndex(const void *pKey,sxu32 nLen)
+{
+	const unsigned char *zIn = (const unsigned char *)pKey;
+	const unsigned char *zEnd = &zIn[nLen];
+	sxu32 nH = 2166136261U;
+	while( zIn < zEnd ){
+		nH = (nH ^ zIn[0]) * 16777619U;
+		zIn++;
+	}
+	nH ^= nH >> 16;
+	nH *= 0x85EBCA6B;
+	nH ^= nH >> 13;
+	return nH & (UNQLITE_KV_SHARD_COUNT - 1);
+}
+/*
+ * Error reported by a partition.
+ * The message is forwarded to the upper layer once the partition lock is released
+ * so that the database handle mutex is never requested while a partition is locked.
+ * Note that the in-memory engine only report static strings.
+ */
+static void ShardKvErr(unqlite_kv_handle pHandle,const char *zErr)
+{
+	shard_kv_slot *pSlot = (shard_kv_slot *)pHandle;
+	pSlot->zErr = zErr;
+}
+/*
+ * Leave a given partition and forward the pending error message if any.
+ */
+static void ShardKvLeave(shard_kv_engine *pEngine,shard_kv_slot *pSlot)
+{
+	const char *zErr = pSlot->zErr;
+	pSlot->zErr = 0;
+	SHARD_KV_LEAVE(pEngine,pSlot);
+	if( zErr ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,zErr);
+	}
+}
+/*
+ * Invoke the xConfig() method of a given partition.
+ */
+static int ShardKvConfigSlot(shard_kv_engine *pEngine,shard_kv_slot *pSlot,int iOp,...)
+{
+	va_list ap;
+	int rc;
+	va_start(ap,iOp);
+	SHARD_KV_ENTER(pEngine,pSlot);
+	rc = pEngine->pMethods->xConfig(pSlot->pStore,iOp,ap);
+	ShardKvLeave(pEngine,pSlot);
+	va_end(ap);
+	return rc;
+}
+/*
+ * Attach the cursor to a given partition and lock it.
+ * The caller must release the partition lock.
+ */
+static void ShardCursorEnter(shard_kv_cursor *pShard,sxu32 iShard)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pShard->pStore;
+	const unqlite_kv_methods *pMethods = pEngine->pMethods;
+	unqlite_kv_cursor *pCur = SHARD_KV_CUR(pShard);
+	shard_kv_slot *pSlot;
+	if( pShard->iShard != iShard ){
+		/* Detach from the current partition */
+		pSlot = &pEngine->aShard[pShard->iShard];
+		SHARD_KV_ENTER(pEngine,pSlot);
+		if( pMethods->xCursorRelease ){
+			pMethods->xCursorRelease(pCur);
+		}
+		SHARD_KV_LEAVE(pEngine,pSlot);
+		/* Attach to the new one */
+		pSlot = &pEngine->aShard[iShard];
+		SHARD_KV_ENTER(pEngine,pSlot);
+		SyZero(pCur,(sxu32)pMethods->szCursor);
+		pCur->pStore = pSlot->pStore;
+		pMethods->xCursorInit(pCur);
+		pShard->iShard = iShard;
+	}else{
+		pSlot = &pEngine->aShard[iShard];
+		SHARD_KV_ENTER(pEngine,pSlot);
+	}
+}
+/*
+ * Release the lock of the partition the cursor is attached to.
+ */
+static void ShardCursorLeave(shard_kv_cursor *pShard)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pShard->pStore;
+	SHARD_KV_LEAVE(pEngine,&pEngine->aShard[pShard->iShard]);
+}
+/*
+ * Move the cursor to the first valid entry starting from a given partition and
+ * walking the partitions in the given direction. When bRewind is false, the current
+ * position of the cursor in the starting partition is tried first.
+ */
+static void ShardCursorSettle(shard_kv_cursor *pShard,int iShard,int iDir,int bRewind)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pShard->pStore;
+	const unqlite_kv_methods *pMethods = pEngine->pMethods;
+	unqlite_kv_cursor *pCur = SHARD_KV_CUR(pShard);
+	int bValid;
+	while( iShard >= 0 && iShard < UNQLITE_KV_SHARD_COUNT ){
+		ShardCursorEnter(pShard,(sxu32)iShard);
+		if( bRewind ){
+			if( iDir > 0 ){
+				pMethods->xFirst(pCur);
+			}else{
+				pMethods->xLast(pCur);
+			}
+		}
+		bValid = pMethods->xValid(pCur);
+		ShardCursorLeave(pShard);
+		if( bValid ){
+			break;
+		}
+		/* Try the next partition */
+		iShard += iDir;
+		bRewind = 1;
+	}
+}
+/*
+ * Initialize the cursor.
+ */
+static void ShardCursorInit(unqlite_kv_cursor *pCursor)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	unqlite_kv_cursor *pCur = SHARD_KV_CUR(pShard);
+	shard_kv_slot *pSlot = &pEngine->aShard[0];
+	/* Attach to the first partition */
+	pShard->iShard = 0;
+	SHARD_KV_ENTER(pEngine,pSlot);
+	pCur->pStore = pSlot->pStore;
+	pEngine->pMethods->xCursorInit(pCur);
+	SHARD_KV_LEAVE(pEngine,pSlot);
+}
+/*
+ * Release the cursor.
+ */
+static void ShardCursorRelease(unqlite_kv_cursor *pCursor)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	if( pEngine->pMethods->xCursorRelease ){
+		ShardCursorEnter(pShard,pShard->iShard);
+		pEngine->pMethods->xCursorRelease(SHARD_KV_CUR(pShard));
+		ShardCursorLeave(pShard);
+	}
+}
+/*
+ * Point to the first entry.
+ */
+static int ShardCursorFirst(unqlite_kv_cursor *pCursor)
+{
+	ShardCursorSettle((shard_kv_cursor *)pCursor,0,1,1);
+	return UNQLITE_OK;
+}
+/*
+ * Point to the last entry.
+ */
+static int ShardCursorLast(unqlite_kv_cursor *pCursor)
+{
+	ShardCursorSettle((shard_kv_cursor *)pCursor,UNQLITE_KV_SHARD_COUNT - 1,-1,1);
+	return UNQLITE_OK;
+}
+/*
+ * is a Valid Cursor.
+ */
+static int ShardCursorValid(unqlite_kv_cursor *pCursor)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int bValid;
+	ShardCursorEnter(pShard,pShard->iShard);
+	bValid = pEngine->pMethods->xValid(SHARD_KV_CUR(pShard));
+	ShardCursorLeave(pShard);
+	return bValid;
+}
+/*
+ * Point to the next entry.
+ */
+static int ShardCursorNext(unqlite_kv_cursor *pCursor)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,pShard->iShard);
+	rc = pEngine->pMethods->xNext(SHARD_KV_CUR(pShard));
+	ShardCursorLeave(pShard);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Move to the next partition if this one is exhausted */
+	ShardCursorSettle(pShard,(int)pShard->iShard,1,0);
+	return UNQLITE_OK;
+}
+/*
+ * Point to the previous entry.
+ */
+static int ShardCursorPrev(unqlite_kv_cursor *pCursor)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,pShard->iShard);
+	rc = pEngine->pMethods->xPrev(SHARD_KV_CUR(pShard));
+	ShardCursorLeave(pShard);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Move to the previous partition if this one is exhausted */
+	ShardCursorSettle(pShard,(int)pShard->iShard,-1,0);
+	return UNQLITE_OK;
+}
+/*
+ * Return key length.
+ */
+static int ShardCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,pShard->iShard);
+	rc = pEngine->pMethods->xKeyLength(SHARD_KV_CUR(pShard),pLen);
+	ShardCursorLeave(pShard);
+	return rc;
+}
+/*
+ * Return data length.
+ */
+static int ShardCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,pShard->iShard);
+	rc = pEngine->pMethods->xDataLength(SHARD_KV_CUR(pShard),pLen);
+	ShardCursorLeave(pShard);
+	return rc;
+}
+/*
+ * Consume the key.
+ */
+static int ShardCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,pShard->iShard);
+	rc = pEngine->pMethods->xKey(SHARD_KV_CUR(pShard),xConsumer,pUserData);
+	ShardCursorLeave(pShard);
+	return rc;
+}
+/*
+ * Consume the data.
+ */
+static int ShardCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,pShard->iShard);
+	rc = pEngine->pMethods->xData(SHARD_KV_CUR(pShard),xConsumer,pUserData);
+	ShardCursorLeave(pShard);
+	return rc;
+}
+/*
+ * Reset the cursor.
+ */
+static void ShardCursorReset(unqlite_kv_cursor *pCursor)
+{
+	ShardCursorSettle((shard_kv_cursor *)pCursor,0,1,1);
+}
+/*
+ * Remove the record the cursor point to.
+ * The cursor then point to the entry that follow.
+ */
+static int ShardCursorDelete(unqlite_kv_cursor *pCursor)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,pShard->iShard);
+	rc = pEngine->pMethods->xDelete(SHARD_KV_CUR(pShard));
+	ShardCursorLeave(pShard);
+	if( rc == UNQLITE_OK ){
+		ShardCursorSettle(pShard,(int)pShard->iShard,1,0);
+	}
+	return rc;
+}
+/*
+ * Find a particular record.
+ */
+static int ShardCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nByte,int iPos)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pCursor->pStore;
+	shard_kv_cursor *pShard = (shard_kv_cursor *)pCursor;
+	int rc;
+	ShardCursorEnter(pShard,ShardKvIndex(pKey,(sxu32)nByte));
+	rc = pEngine->pMethods->xSeek(SHARD_KV_CUR(pShard),pKey,nByte,iPos);
+	ShardCursorLeave(pShard);
+	return rc;
+}
+/*
+ * Release the sharded storage engine.
+ */
+static void ShardKvRelease(unqlite_kv_engine *pKvEngine)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pKvEngine;
+	const unqlite_kv_methods *pMethods = pEngine->pMethods;
+	shard_kv_slot *pSlot;
+	int i;
+	for( i = 0 ; i < UNQLITE_KV_SHARD_COUNT ; ++i ){
+		pSlot = &pEngine->aShard[i];
+		if( pSlot->pStore ){
+			if( pMethods->xCursorRelease ){
+				pMethods->xCursorRelease((unqlite_kv_cursor *)pSlot->aCursor);
+			}
+			if( pMethods->xRelease ){
+				pMethods->xRelease(pSlot->pStore);
+			}
+			SyMemBackendFree(&pEngine->sAlloc,pSlot->pStore);
+			pSlot->pStore = 0;
+		}
+		if( pSlot->pMutex ){
+			SyMutexRelease(pEngine->pMutexMethods,pSlot->pMutex);
+			pSlot->pMutex = 0;
+		}
+	}
+	/* Release the private memory backend */
+	SyMemBackendRelease(&pEngine->sAlloc);
+}
+/*
+ * Initialize the sharded storage engine.
+ */
+static int ShardKvInit(unqlite_kv_engine *pKvEngine,int iPageSize)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pKvEngine;
+	const SyMemBackend *pParent = unqliteKvIoMemBackend(pEngine->pIo);
+	const unqlite_kv_methods *pMethods;
+	unqlite_kv_cursor *pCur;
+	shard_kv_slot *pSlot;
+	int i,rc;
+	/* Note that this instance is already zeroed */
+	SyMemBackendInitFromParent(&pEngine->sAlloc,pParent);
+	/* Partitions are instances of the default in-memory engine */
+	pMethods = pEngine->pMethods = unqliteExportMemKvStorage();
+	if( (sxu32)pMethods->szCursor > sizeof(pEngine->aShard[0].aCursor) ){
+		/* Cannot happen */
+		return UNQLITE_CORRUPT;
+	}
+	/* One lock per partition if the library is threadsafe */
+	pEngine->pMutexMethods = pParent->pMutexMethods;
+	for( i = 0 ; i < UNQLITE_KV_SHARD_COUNT ; ++i ){
+		pSlot = &pEngine->aShard[i];
+		if( pEngine->pMutexMethods ){
+			/* Recursive so that data consumers can safely re-enter the engine */
+			pSlot->pMutex = SyMutexNew(pEngine->pMutexMethods,SXMUTEX_TYPE_RECURSIVE);
+			if( pSlot->pMutex == 0 ){
+				rc = UNQLITE_NOMEM;
+				goto fail;
+			}
+		}
+		/* IO methods of the partition. The pager methods are kept while the partition
+		 * is initialized so that its memory is charged to the database handle.
+		 */
+		pSlot->sIo = *pEngine->pIo;
+		pSlot->sIo.pMethods = (unqlite_kv_methods *)pMethods;
+		/* Allocate and initialize the partition */
+		pSlot->pStore = (unqlite_kv_engine *)SyMemBackendAlloc(&pEngine->sAlloc,(sxu32)pMethods->szKv);
+		if( pSlot->pStore == 0 ){
+			rc = UNQLITE_NOMEM;
+			goto fail;
+		}
+		SyZero(pSlot->pStore,(sxu32)pMethods->szKv);
+		pSlot->pStore->pIo = &pSlot->sIo;
+		rc = pMethods->xInit(pSlot->pStore,iPageSize);
+		if( rc != UNQLITE_OK ){
+			SyMemBackendFree(&pEngine->sAlloc,pSlot->pStore);
+			pSlot->pStore = 0;
+			goto fail;
+		}
+		/* Errors are reported to the upper layer once the partition lock is released */
+		pSlot->sIo.pHandle = (unqlite_kv_handle)pSlot;
+		pSlot->sIo.xErr = ShardKvErr;
+		/* Private cursor */
+		pCur = (unqlite_kv_cursor *)pSlot->aCursor;
+		pCur->pStore = pSlot->pStore;
+		pMethods->xCursorInit(pCur);
+	}
+	return UNQLITE_OK;
+fail:
+	ShardKvRelease(pKvEngine);
+	return rc;
+}
+/*
+ * Configure the sharded storage engine.
+ * Hash and comparison functions are installed on every partition.
+ */
+static int ShardKvConfigure(unqlite_kv_engine *pKvEngine,int iOp,va_list ap)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pKvEngine;
+	int i,rc = UNQLITE_OK;
+	switch(iOp){
+	case UNQLITE_KV_CONFIG_HASH_FUNC:{
+		ProcHash xHash = va_arg(ap,ProcHash);
+		for( i = 0 ; i < UNQLITE_KV_SHARD_COUNT && rc == UNQLITE_OK ; ++i ){
+			rc = ShardKvConfigSlot(pEngine,&pEngine->aShard[i],iOp,xHash);
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_CMP_FUNC: {
+		ProcCmp xCmp = va_arg(ap,ProcCmp);
+		for( i = 0 ; i < UNQLITE_KV_SHARD_COUNT && rc == UNQLITE_OK ; ++i ){
+			rc = ShardKvConfigSlot(pEngine,&pEngine->aShard[i],iOp,xCmp);
+		}
+		break;
+									 }
+	case UNQLITE_KV_CONFIG_GET_HASH_FUNC: {
+		ProcHash *pxHash = va_arg(ap,ProcHash *);
+		rc = ShardKvConfigSlot(pEngine,&pEngine->aShard[0],iOp,pxHash);
+		break;
+										  }
+	case UNQLITE_KV_CONFIG_RESERVE: {
+		/* Spread the reservation with some slack for uneven partitions */
+		unqlite_int64 nReserve = va_arg(ap,unqlite_int64);
+		nReserve = (nReserve / UNQLITE_KV_SHARD_COUNT) + (nReserve / (UNQLITE_KV_SHARD_COUNT * 4)) + 1;
+		for( i = 0 ; i < UNQLITE_KV_SHARD_COUNT && rc == UNQLITE_OK ; ++i ){
+			rc = ShardKvConfigSlot(pEngine,&pEngine->aShard[i],iOp,nReserve);
+		}
+		break;
+									}
+	default:
+		/* Unknown configuration option */
+		rc = UNQLITE_UNKNOWN;
+	}
+	return rc;
+}
+/*
+ * Replace method.
+ */
+static int ShardKvReplace(
+	  unqlite_kv_engine *pKv,
+	  const void *pKey,int nKeyLen,
+	  const void *pData,unqlite_int64 nDataLen
+	  )
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pKv;
+	shard_kv_slot *pSlot = &pEngine->aShard[ShardKvIndex(pKey,(sxu32)nKeyLen)];
+	int rc;
+	SHARD_KV_ENTER(pEngine,pSlot);
+	rc = pEngine->pMethods->xReplace(pSlot->pStore,pKey,nKeyLen,pData,nDataLen);
+	ShardKvLeave(pEngine,pSlot);
+	return rc;
+}
+/*
+ * Append method.
+ */
+static int ShardKvAppend(
+	  unqlite_kv_engine *pKv,
+	  const void *pKey,int nKeyLen,
+	  const void *pData,unqlite_int64 nDataLen
+	  )
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pKv;
+	shard_kv_slot *pSlot = &pEngine->aShard[ShardKvIndex(pKey,(sxu32)nKeyLen)];
+	int rc;
+	SHARD_KV_ENTER(pEngine,pSlot);
+	rc = pEngine->pMethods->xAppend(pSlot->pStore,pKey,nKeyLen,pData,nDataLen);
+	ShardKvLeave(pEngine,pSlot);
+	return rc;
+}
+/*
+ * Fetch method: Consume the data of a given record.
+ * A NULL consumer only check for the existence of the record.
+ */
+static int ShardKvFetch(
+	unqlite_kv_engine *pKv,
+	const void *pKey,int nKeyLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData
+	)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pKv;
+	shard_kv_slot *pSlot = &pEngine->aShard[ShardKvIndex(pKey,(sxu32)nKeyLen)];
+	unqlite_kv_cursor *pCur = (unqlite_kv_cursor *)pSlot->aCursor;
+	int rc;
+	SHARD_KV_ENTER(pEngine,pSlot);
+	rc = pEngine->pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+	if( rc == UNQLITE_OK && xConsumer ){
+		rc = pEngine->pMethods->xData(pCur,xConsumer,pUserData);
+	}
+	ShardKvLeave(pEngine,pSlot);
+	return rc;
+}
+/*
+ * Remove method.
+ */
+static int ShardKvRemove(unqlite_kv_engine *pKv,const void *pKey,int nKeyLen)
+{
+	shard_kv_engine *pEngine = (shard_kv_engine *)pKv;
+	shard_kv_slot *pSlot = &pEngine->aShard[ShardKvIndex(pKey,(sxu32)nKeyLen)];
+	unqlite_kv_cursor *pCur = (unqlite_kv_cursor *)pSlot->aCursor;
+	int rc;
+	SHARD_KV_ENTER(pEngine,pSlot);
+	rc = pEngine->pMethods->xSeek(pCur,pKey,nKeyLen,UNQLITE_CURSOR_MATCH_EXACT);
+	if( rc == UNQLITE_OK ){
+		rc = pEngine->pMethods->xDelete(pCur);
+	}
+	ShardKvLeave(pEngine,pSlot);
+	return rc;
+}
+/*
+ * Export the sharded in-memory storage engine.
+ */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportShardKvStorage(void)
+{
+	static const unqlite_kv_methods sShardStore = {
+		"shard",                    /* zName */
+		sizeof(shard_kv_engine),    /* szKv */
+		sizeof(shard_kv_cursor),    /* szCursor */
+		4,                          /* iVersion */
+		ShardKvInit,                /* xInit */
+		ShardKvRelease,             /* xRelease */
+		ShardKvConfigure,           /* xConfig */
+		0,                          /* xOpen */
+		ShardKvReplace,             /* xReplace */
+		ShardKvAppend,              /* xAppend */
+		ShardCursorInit,            /* xCursorInit */
+		ShardCursorSeek,            /* xSeek */
+		ShardCursorFirst,           /* xFirst */
+		ShardCursorLast,            /* xLast */
+		ShardCursorValid,           /* xValid */
+		ShardCursorNext,            /* xNext */
+		ShardCursorPrev,            /* xPrev */
+		ShardCursorDelete,          /* xDelete */
+		ShardCursorKeyLength,       /* xKeyLength */
+		ShardCursorKey,             /* xKey */
+		ShardCursorDataLength,      /* xDataLength */
+		ShardCursorData,            /* xData */
+		ShardCursorReset,           /* xReset */
+		ShardCursorRelease,         /* xCursorRelease */
+		0,                          /* xDataRef */
+		0,                          /* xDataRange */
+		0,                          /* xWriteRange */
+		0,                          /* xSync */
+		UNQLITE_KV_CONCURRENT,      /* iFlags */
+		ShardKvFetch,               /* xFetch */
+		ShardKvRemove,              /* xRemove */
+		0                           /* xRemoveIf */
+	};
+	return &sShardStore;
+}
@@ -0,0 +1,586 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: snapshot.c v1.0 Unix 2018-06-15 08:52 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements the [unqlite_kv_snapshot()] and [unqlite_kv_restore()] interfaces
+ * which dump the records of a database (Typically an in-memory one) to a compact file
+ * sorted by key and reload them later.
+ *
+ * Snapshot file layout:
+ *   4 byte magic number
+ *   4 byte format version
+ *   8 byte total number of records
+ *   8 byte total number of key and data bytes
+ * followed by the records in key order (Byte-wise comparison, shorter keys first):
+ *   varint key length, varint data length, key, data.
+ * Integers are stored in big-endian and varints are 7 bits per byte, least
+ * significant group first with the high bit set on all bytes but the last.
+ *
+ * The records are visited in key order by unqliteKvWalkSorted() which is also used by
+ * the sorted table builder (See sst_kv.c). Unlike the table builder, a snapshot keeps the
+ * expiration metadata records (See ttl.c) so that restored records expire as scheduled.
+ * On restore, the record count is passed to the engine (UNQLITE_KV_CONFIG_RESERVE) so that
+ * it can size its structures once and the records are inserted in a single pass.
+ * The load runs under a savepoint when the engine support them so that a malformed
+ * snapshot leave the database untouched. Otherwise (i.e. in-memory databases) the
+ * records loaded before the error is detected are kept.
+ */
+#define SNAPSHOT_MAGIC   0x554E5153 /* "UNQS" */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HDR_SZ  24
+/* I/O buffer size */
+#define SNAPSHOT_BUF_SZ  (64 * 1024)
+/* Largest varint */
+#define SNAPSHOT_VARINT_MAX 10
+/* Smallest record: two single byte varints and a one byte key */
+#define SNAPSHOT_REC_MIN 3
+/*
+ * Buffered snapshot writer.
+ */
+typedef struct snapshot_writer snapshot_writer;
+struct snapshot_writer
+{
+	unqlite_file *pFile;   /* Snapshot file */
+	SyBlob sBuf;           /* Pending bytes */
+	unqlite_int64 iOfft;   /* File offset of the pending bytes */
+	sxu64 nRecord;         /* Records written so far */
+	sxu64 nPayload;        /* Key and data bytes written so far */
+	int rc;                /* First I/O error */
+};
+/*
+ * Buffered snapshot reader.
+ */
+typedef struct snapshot_reader snapshot_reader;
+struct snapshot_reader
+{
+	unqlite_file *pFile;   /* Snapshot file */
+	SyMemBackend *pAlloc;  /* Buffer allocator */
+	unsigned char *zBuf;   /* Read buffer */
+	sxu32 nAlloc;          /* Buffer size */
+	sxu32 nAvail;          /* Bytes loaded in the buffer */
+	sxu32 iPos;            /* Current position in the buffer */
+	unqlite_int64 iOfft;   /* File offset of the next read */
+	unqlite_int64 nSize;   /* File size */
+};
+/*
+ * Flush the pending bytes to the snapshot file.
+ */
+static int SnapshotFlush(snapshot_writer *pWriter)
+{
+	sxu32 n = SyBlobLength(&pWriter->sBuf);
+	if( n > 0 && pWriter->rc == UNQLITE_OK ){
+		pWriter->rc = unqliteOsWrite(pWriter->pFile,SyBlobData(&pWriter->sBuf),n,pWriter->iOfft);
+		pWriter->iOfft += n;
+	}
+	SyBlobReset(&pWriter->sBuf);
+	return pWriter->rc;
+}
+/*
+ * Append raw bytes to the snapshot file.
+ */
+static int SnapshotWrite(snapshot_writer *pWriter,const void *pData,sxu32 nLen)
+{
+	if( pWriter->rc != UNQLITE_OK ){
+		return pWriter->rc;
+	}
+	if( nLen >= SNAPSHOT_BUF_SZ ){
+		/* Large chunk, write it directly */
+		if( SnapshotFlush(pWriter) == UNQLITE_OK ){
+			pWriter->rc = unqliteOsWrite(pWriter->pFile,pData,nLen,pWriter->iOfft);
+			pWriter->iOfft += nLen;
+		}
+		return pWriter->rc;
+	}
+	if( SyBlobAppend(&pWriter->sBuf,pData,nLen) != SXRET_OK ){
+		pWriter->rc = UNQLITE_NOMEM;
+		return pWriter->rc;
+	}
+	if( SyBlobLength(&pWriter->sBuf) >= SNAPSHOT_BUF_SZ ){
+		SnapshotFlush(pWriter);
+	}
+	return pWriter->rc;
+}
+/*
+ * Append a varint to the snapshot file.
+ */
+static int SnapshotPutVarint(snapshot_writer *pWriter,sxu64 v)
+{
+	unsigned char zBuf[SNAPSHOT_VARINT_MAX];
+	sxu32 n = 0;
+	while( v >= 0x80 ){
+		zBuf[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	zBuf[n++] = (unsigned char)v;
+	return SnapshotWrite(pWriter,zBuf,n);
+}
+/*
+ * Data consumer: Append the record data to the snapshot file.
+ */
+static int SnapshotDataConsumer(const void *pData,unsigned int nLen,void *pUserData)
+{
+	snapshot_writer *pWriter = (snapshot_writer *)pUserData;
+	if( SnapshotWrite(pWriter,pData,nLen) != UNQLITE_OK ){
+		return UNQLITE_ABORT;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Walk callback: Write the record the cursor point to given its key.
+ */
+static int SnapshotPutRecord(unqlite_kv_cursor *pCur,const void *pKey,sxu32 nKey,void *pUserData)
+{
+	snapshot_writer *pWriter = (snapshot_writer *)pUserData;
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	unqlite_int64 nData;
+	int rc;
+	rc = pMethods->xDataLength(pCur,&nData);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SnapshotPutVarint(pWriter,nKey);
+	SnapshotPutVarint(pWriter,(sxu64)nData);
+	SnapshotWrite(pWriter,pKey,nKey);
+	if( pWriter->rc == UNQLITE_OK ){
+		rc = pMethods->xData(pCur,SnapshotDataConsumer,pWriter);
+		if( rc != UNQLITE_OK ){
+			return pWriter->rc != UNQLITE_OK ? pWriter->rc : rc;
+		}
+	}
+	pWriter->nRecord++;
+	pWriter->nPayload += nKey + (sxu64)nData;
+	return pWriter->rc;
+}
+/*
+ * Compare two keys: Byte-wise comparison, shorter keys first.
+ */
+UNQLITE_PRIVATE int unqliteKvKeyCmp(const void *pA,sxu32 nA,const void *pB,sxu32 nB)
+{
+	int rc = SyMemcmp(pA,pB,nA < nB ? nA : nB);
+	if( rc == 0 ){
+		rc = nA < nB ? -1 : (nA > nB ? 1 : 0);
+	}
+	return rc;
+}
+/*
+ * Sort the collected keys (Bottom-up merge sort).
+ */
+UNQLITE_PRIVATE int unqliteKvSortKeys(SyMemBackend *pAlloc,const char *zBase,kv_sort_key *aKey,sxu32 nKey)
+{
+	kv_sort_key *aTmp,*aSrc,*aDest,*aSwap;
+	sxu32 nWidth,i,j,k,iMid,iEnd;
+	if( nKey < 2 ){
+		return UNQLITE_OK;
+	}
+	aTmp = (kv_sort_key *)SyMemBackendAlloc(pAlloc,nKey * sizeof(kv_sort_key));
+	if( aTmp == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	aSrc = aKey;
+	aDest = aTmp;
+	for( nWidth = 1 ; nWidth < nKey ; nWidth <<= 1 ){
+		for( i = 0 ; i < nKey ; i += nWidth << 1 ){
+			iMid = i + nWidth < nKey ? i + nWidth : nKey;
+			iEnd = iMid + nWidth < nKey ? iMid + nWidth : nKey;
+			j = i;
+			k = iMid;
+			while( j < iMid || k < iEnd ){
+				if( k >= iEnd || (j < iMid &&
+					unqliteKvKeyCmp(&zBase[aSrc[j].iOfft],aSrc[j].nLen,&zBase[aSrc[k].iOfft],aSrc[k].nLen) <= 0) ){
+						aDest[j + k - iMid] = aSrc[j];
+						j++;
+				}else{
+					aDest[j + k - iMid] = aSrc[k];
+					k++;
+				}
+			}
+		}
+		aSwap = aSrc; aSrc = aDest; aDest = aSwap;
+	}
+	if( aSrc != aKey ){
+		SyMemcpy((const void *)aSrc,(void *)aKey,nKey * sizeof(kv_sort_key));
+	}
+	SyMemBackendFree(pAlloc,aTmp);
+	return UNQLITE_OK;
+}
+/*
+ * Check whether the cursor iterate the records in key order.
+ */
+static int SnapshotIsSorted(unqlite *pDb,unqlite_kv_cursor *pCur,int *pSorted)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	SyBlob sKey,sPrev,sSwap;
+	int rc = UNQLITE_OK;
+	*pSorted = 1;
+	SyBlobInit(&sKey,&pDb->sMem);
+	SyBlobInit(&sPrev,&pDb->sMem);
+	pMethods->xFirst(pCur);
+	while( pMethods->xValid(pCur) ){
+		SyBlobReset(&sKey);
+		rc = pMethods->xKey(pCur,unqliteDataConsumer,&sKey);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		if( SyBlobLength(&sPrev) > 0 && unqliteKvKeyCmp(SyBlobData(&sPrev),SyBlobLength(&sPrev),
+			SyBlobData(&sKey),SyBlobLength(&sKey)) >= 0 ){
+				/* Not in key order */
+				*pSorted = 0;
+				break;
+		}
+		sSwap = sPrev; sPrev = sKey; sKey = sSwap;
+		pMethods->xNext(pCur);
+	}
+	SyBlobRelease(&sKey);
+	SyBlobRelease(&sPrev);
+	return rc;
+}
+/*
+ * Invoke the walk callback for each record in cursor order.
+ */
+static int SnapshotWalkCursor(unqlite *pDb,unqlite_kv_cursor *pCur,ProcKvWalk xWalk,void *pUserData)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	SyBlob sKey;
+	int rc = UNQLITE_OK;
+	SyBlobInit(&sKey,&pDb->sMem);
+	pMethods->xFirst(pCur);
+	while( pMethods->xValid(pCur) ){
+		SyBlobReset(&sKey);
+		rc = pMethods->xKey(pCur,unqliteDataConsumer,&sKey);
+		if( rc == UNQLITE_OK ){
+			rc = xWalk(pCur,SyBlobData(&sKey),SyBlobLength(&sKey),pUserData);
+		}
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		pMethods->xNext(pCur);
+	}
+	SyBlobRelease(&sKey);
+	return rc;
+}
+/*
+ * Collect and sort the keys, then invoke the walk callback for each record in key order.
+ */
+static int SnapshotWalkSorted(unqlite *pDb,unqlite_kv_cursor *pCur,ProcKvWalk xWalk,void *pUserData)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	kv_sort_key *aKey = 0;
+	sxu32 nKey = 0,nAlloc = 0,i;
+	const char *zBase;
+	SyBlob sKeys;
+	sxu32 n;
+	int rc = UNQLITE_OK;
+	SyBlobInit(&sKeys,&pDb->sMem);
+	/* Collect the keys */
+	pMethods->xFirst(pCur);
+	while( pMethods->xValid(pCur) ){
+		if( nKey >= nAlloc ){
+			sxu32 nNew = nAlloc > 0 ? nAlloc << 1 : 1024;
+			kv_sort_key *aNew;
+			aNew = (kv_sort_key *)SyMemBackendRealloc(&pDb->sMem,aKey,nNew * sizeof(kv_sort_key));
+			if( aNew == 0 ){
+				rc = UNQLITE_NOMEM;
+				break;
+			}
+			aKey = aNew;
+			nAlloc = nNew;
+		}
+		n = SyBlobLength(&sKeys);
+		rc = pMethods->xKey(pCur,unqliteDataConsumer,&sKeys);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		aKey[nKey].iOfft = n;
+		aKey[nKey].nLen = SyBlobLength(&sKeys) - n;
+		nKey++;
+		pMethods->xNext(pCur);
+	}
+	zBase = (const char *)SyBlobData(&sKeys);
+	if( rc == UNQLITE_OK ){
+		rc = unqliteKvSortKeys(&pDb->sMem,zBase,aKey,nKey);
+	}
+	/* Visit the records in key order */
+	for( i = 0 ; i < nKey && rc == UNQLITE_OK ; ++i ){
+		rc = pMethods->xSeek(pCur,&zBase[aKey[i].iOfft],(int)aKey[i].nLen,UNQLITE_CURSOR_MATCH_EXACT);
+		if( rc == UNQLITE_OK ){
+			rc = xWalk(pCur,&zBase[aKey[i].iOfft],aKey[i].nLen,pUserData);
+		}
+	}
+	if( aKey ){
+		SyMemBackendFree(&pDb->sMem,aKey);
+	}
+	SyBlobRelease(&sKeys);
+	return rc;
+}
+/*
+ * Invoke the given callback for each database record in key order (Byte-wise comparison,
+ * shorter keys first) with a cursor pointing to the record.
+ * When the underlying engine already iterate in key order (btree, lsm, art), the records
+ * are visited in a single pass. Otherwise the keys are collected and sorted first and
+ * each record is then located via an exact seek.
+ * The caller must hold the database handle mutex.
+ */
+UNQLITE_PRIVATE int unqliteKvWalkSorted(unqlite *pDb,ProcKvWalk xWalk,void *pUserData)
+{
+	unqlite_kv_cursor *pCur;
+	int rc,bSorted;
+	rc = unqliteInitCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = SnapshotIsSorted(pDb,pCur,&bSorted);
+	if( rc == UNQLITE_OK ){
+		if( bSorted ){
+			rc = SnapshotWalkCursor(pDb,pCur,xWalk,pUserData);
+		}else{
+			rc = SnapshotWalkSorted(pDb,pCur,xWalk,pUserData);
+		}
+	}
+	unqliteReleaseCursor(pDb,pCur);
+	return rc;
+}
+/*
+ * Write a snapshot of the database records to the file at zPath.
+ * The file is created or truncated. The caller must hold the database handle mutex.
+ */
+UNQLITE_PRIVATE int unqliteKvSnapshot(unqlite *pDb,unqlite_vfs *pVfs,const char *zPath)
+{
+	unsigned char zHdr[SNAPSHOT_HDR_SZ];
+	snapshot_writer sWriter;
+	int rc;
+	/* Open the snapshot file */
+	rc = unqliteOsOpen(pVfs,&pDb->sMem,zPath,&sWriter.pFile,UNQLITE_OPEN_READWRITE|UNQLITE_OPEN_CREATE);
+	if( rc != UNQLITE_OK ){
+		unqliteGenErrorFormat(pDb,"Cannot open snapshot file '%s'",zPath);
+		return UNQLITE_IOERR;
+	}
+	SyBlobInit(&sWriter.sBuf,&pDb->sMem);
+	sWriter.iOfft = SNAPSHOT_HDR_SZ;
+	sWriter.nRecord = sWriter.nPayload = 0;
+	sWriter.rc = unqliteOsTruncate(sWriter.pFile,0);
+	rc = sWriter.rc;
+	if( rc == UNQLITE_OK ){
+		/* Dump the records in key order */
+		rc = unqliteKvWalkSorted(pDb,SnapshotPutRecord,&sWriter);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = SnapshotFlush(&sWriter);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Finally, the header */
+		SyBigEndianPack32(zHdr,SNAPSHOT_MAGIC);
+		SyBigEndianPack32(&zHdr[4],SNAPSHOT_VERSION);
+		SyBigEndianPack64(&zHdr[8],sWriter.nRecord);
+		SyBigEndianPack64(&zHdr[16],sWriter.nPayload);
+		rc = unqliteOsWrite(sWriter.pFile,zHdr,SNAPSHOT_HDR_SZ,0);
+		if( rc == UNQLITE_OK ){
+			rc = unqliteOsSync(sWriter.pFile,UNQLITE_SYNC_NORMAL);
+		}
+	}
+	if( rc == UNQLITE_IOERR ){
+		unqliteGenErrorFormat(pDb,"IO error while writing snapshot file '%s'",zPath);
+	}
+	SyBlobRelease(&sWriter.sBuf);
+	unqliteOsCloseFree(&pDb->sMem,sWriter.pFile);
+	return rc;
+}
+/*
+ * Make sure at least nNeed bytes are available in the read buffer.
+ */
+static int SnapshotFill(snapshot_reader *pReader,sxu32 nNeed)
+{
+	sxu32 nLeft = pReader->nAvail - pReader->iPos;
+	unqlite_int64 nRead;
+	int rc;
+	if( nLeft >= nNeed ){
+		return UNQLITE_OK;
+	}
+	if( (unqlite_int64)(nNeed - nLeft) > pReader->nSize - pReader->iOfft ){
+		/* Truncated file */
+		return UNQLITE_CORRUPT;
+	}
+	if( nNeed > pReader->nAlloc ){
+		unsigned char *zNew;
+		zNew = (unsigned char *)SyMemBackendRealloc(pReader->pAlloc,pReader->zBuf,nNeed);
+		if( zNew == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		pReader->zBuf = zNew;
+		pReader->nAlloc = nNeed;
+	}
+	/* Move the leftover to the start of the buffer (Forward copy) */
+	if( nLeft > 0 && pReader->iPos > 0 ){
+		SyMemcpy((const void *)&pReader->zBuf[pReader->iPos],(void *)pReader->zBuf,nLeft);
+	}
+	pReader->iPos = 0;
+	pReader->nAvail = nLeft;
+	/* Fill the rest of the buffer */
+	nRead = pReader->nSize - pReader->iOfft;
+	if( nRead > (unqlite_int64)(pReader->nAlloc - nLeft) ){
+		nRead = pReader->nAlloc - nLeft;
+	}
+	rc = unqliteOsRead(pReader->pFile,&pReader->zBuf[nLeft],nRead,pReader->iOfft);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pReader->iOfft += nRead;
+	pReader->nAvail += (sxu32)nRead;
+	return UNQLITE_OK;
+}
+/*
+ * Read a varint.
+ */
+static int SnapshotGetVarint(snapshot_reader *pReader,sxu64 *pVal)
+{
+	unqlite_int64 nLeft = (pReader->nAvail - pReader->iPos) + (pReader->nSize - pReader->iOfft);
+	sxu64 v = 0;
+	int i,rc;
+	rc = SnapshotFill(pReader,nLeft < SNAPSHOT_VARINT_MAX ? (sxu32)nLeft : SNAPSHOT_VARINT_MAX);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	for( i = 0 ; i < SNAPSHOT_VARINT_MAX && pReader->iPos < pReader->nAvail ; ++i ){
+		unsigned char c = pReader->zBuf[pReader->iPos++];
+		v |= (sxu64)(c & 0x7F) << (7 * i);
+		if( (c & 0x80) == 0 ){
+			*pVal = v;
+			return UNQLITE_OK;
+		}
+	}
+	/* Malformed varint */
+	return UNQLITE_CORRUPT;
+}
+/*
+ * Tell the storage engine how many records are about to be inserted.
+ */
+static int SnapshotReserve(unqlite_kv_engine *pEngine,...)
+{
+	va_list ap;
+	int rc;
+	if( pEngine->pIo->pMethods->xConfig == 0 ){
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	va_start(ap,pEngine);
+	rc = pEngine->pIo->pMethods->xConfig(pEngine,UNQLITE_KV_CONFIG_RESERVE,ap);
+	va_end(ap);
+	return rc;
+}
+/*
+ * Load the records of the snapshot file at zPath into a given storage engine.
+ * Existing records with the same key are overwritten. The caller must hold the
+ * database handle mutex.
+ */
+UNQLITE_PRIVATE int unqliteKvRestore(unqlite *pDb,unqlite_vfs *pVfs,const char *zPath)
+{
+	unqlite_kv_engine *pEngine = unqlitePagerGetKvEngine(pDb);
+	unqlite_kv_methods *pMethods = pEngine->pIo->pMethods;
+	snapshot_reader sReader;
+	sxu64 nRecord,nPayload,nKey,nData,nLoaded,i;
+	sxu32 iMagic,iVersion;
+	int iLevel = 0;
+	int rc;
+	if( pMethods->xReplace == 0 ){
+		unqliteGenError(pDb,"xReplace() method not implemented in the underlying storage engine");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	/* Open the snapshot file */
+	SyZero(&sReader,sizeof(snapshot_reader));
+	rc = unqliteOsOpen(pVfs,&pDb->sMem,zPath,&sReader.pFile,UNQLITE_OPEN_READONLY);
+	if( rc != UNQLITE_OK ){
+		unqliteGenErrorFormat(pDb,"Cannot open snapshot file '%s'",zPath);
+		return UNQLITE_IOERR;
+	}
+	sReader.pAlloc = &pDb->sMem;
+	rc = unqliteOsFileSize(sReader.pFile,&sReader.nSize);
+	if( rc == UNQLITE_OK ){
+		sReader.zBuf = (unsigned char *)SyMemBackendAlloc(&pDb->sMem,SNAPSHOT_BUF_SZ);
+		if( sReader.zBuf == 0 ){
+			rc = UNQLITE_NOMEM;
+		}else{
+			sReader.nAlloc = SNAPSHOT_BUF_SZ;
+			rc = SnapshotFill(&sReader,SNAPSHOT_HDR_SZ);
+		}
+	}
+	if( rc == UNQLITE_OK ){
+		/* Validate the header */
+		SyBigEndianUnpack32(sReader.zBuf,&iMagic);
+		SyBigEndianUnpack32(&sReader.zBuf[4],&iVersion);
+		SyBigEndianUnpack64(&sReader.zBuf[8],&nRecord);
+		SyBigEndianUnpack64(&sReader.zBuf[16],&nPayload);
+		sReader.iPos = SNAPSHOT_HDR_SZ;
+		if( iMagic != SNAPSHOT_MAGIC || iVersion != SNAPSHOT_VERSION ||
+			nPayload > (sxu64)(sReader.nSize - SNAPSHOT_HDR_SZ) ||
+			nRecord > (sxu64)(sReader.nSize - SNAPSHOT_HDR_SZ) / SNAPSHOT_REC_MIN ){
+				rc = UNQLITE_CORRUPT;
+		}
+	}
+	if( rc == UNQLITE_OK && unqlitePagerSavepointSupported(pDb->sDB.pPager) ){
+		/* Undo a partial load */
+		rc = unqlitePagerSavepoint(pDb->sDB.pPager,&iLevel);
+		if( rc != UNQLITE_OK ){
+			iLevel = 0;
+			rc = UNQLITE_OK;
+		}
+	}
+	if( rc == UNQLITE_OK && nRecord > 0 ){
+		/* Let the engine size its structures once. This is only a hint */
+		SnapshotReserve(pEngine,(unqlite_int64)nRecord);
+	}
+	/* Load the records */
+	nLoaded = 0;
+	for( i = 0 ; i < nRecord && rc == UNQLITE_OK ; ++i ){
+		rc = SnapshotGetVarint(&sReader,&nKey);
+		if( rc == UNQLITE_OK ){
+			rc = SnapshotGetVarint(&sReader,&nData);
+		}
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		if( nKey < 1 || nKey > SXI32_HIGH || nData >= (sxu64)SXU32_HIGH - nKey ){
+			rc = UNQLITE_CORRUPT;
+			break;
+		}
+		rc = SnapshotFill(&sReader,(sxu32)(nKey + nData));
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		rc = pMethods->xReplace(pEngine,&sReader.zBuf[sReader.iPos],(int)nKey,
+			&sReader.zBuf[sReader.iPos + (sxu32)nKey],(unqlite_int64)nData);
+		sReader.iPos += (sxu32)(nKey + nData);
+		nLoaded += nKey + nData;
+	}
+	if( rc == UNQLITE_OK && (nLoaded != nPayload || sReader.iPos < sReader.nAvail || sReader.iOfft < sReader.nSize) ){
+		/* Trailing garbage */
+		rc = UNQLITE_CORRUPT;
+	}
+	if( iLevel > 0 ){
+		if( rc == UNQLITE_OK ){
+			unqlitePagerSavepointRelease(pDb->sDB.pPager,iLevel);
+		}else{
+			unqlitePagerSavepointRollback(pDb->sDB.pPager,iLevel);
+		}
+	}
+	if( rc == UNQLITE_CORRUPT ){
+		unqliteGenErrorFormat(pDb,"Malformed snapshot file '%s'",zPath);
+	}else if( rc == UNQLITE_IOERR ){
+		unqliteGenErrorFormat(pDb,"IO error while reading snapshot file '%s'",zPath);
+	}
+	if( sReader.zBuf ){
+		SyMemBackendFree(&pDb->sMem,sReader.zBuf);
+	}
+	unqliteOsCloseFree(&pDb->sMem,sReader.pFile);
+	return rc;
+}
@@ -0,0 +1,1312 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: sst_kv.c v1.0 Unix 2018-06-18 10:05 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements a read-only key/value storage engine for static datasets that
+ * are built offline (A sorted string table).
+ *
+ * Records are stored sorted by key (Byte-wise comparison, shorter keys first) in blocks
+ * of about UNQLITE_KV_SST_BLOCK_SIZE bytes followed by an index holding the first key of each block.
+ * Everything is laid out in consecutive pages so that, when the database is opened with
+ * UNQLITE_OPEN_READONLY|UNQLITE_OPEN_MMAP, the engine work directly on the memory view of
+ * the file: Opening a table only read its header and lookups binary search the index in
+ * place. Without a memory view, the table is loaded in memory on first access.
+ *
+ * Within a block, each key is stored as the length of the prefix it share with the previous
+ * key followed by the remaining bytes. Blocks are optionally compressed (See the
+ * UNQLITE_KV_CONFIG_BLOCK_COMPRESSION configuration verb) using a simple LZ77 scheme and
+ * are kept uncompressed when compression does not pay off.
+ *
+ * A table is built by storing its records in strictly ascending key order in an empty
+ * database using this engine. The table is sealed when the transaction is committed and
+ * any further write fails with UNQLITE_READ_ONLY. The [unqlite_kv_build_table()] interface
+ * convert an existing database to this format.
+ *
+ * The engine is named "sst" and is recorded in the database header so that tables are
+ * opened with it automatically.
+ */
+/* Magic number identifying a valid sorted table */
+#define SST_MAGIC   0x55515354 /* "UQST" */
+#define SST_VERSION 1
+/*
+ * Page one layout:
+ *   4 byte magic number
+ *   4 byte format version
+ *   4 byte flags (SST_FLAG_*)
+ *   4 byte number of blocks
+ *   8 byte number of records
+ *   8 byte offset of the index
+ *   8 byte size of the key area following the index
+ *   8 byte total size of the blocks, the index and the key area
+ * Blocks start at page two. Offsets are relative to the start of page two.
+ */
+#define SST_HDR_FLAGS_OFFT   8
+#define SST_HDR_BLOCK_OFFT   12
+#define SST_HDR_RECORD_OFFT  16
+#define SST_HDR_INDEX_OFFT   24
+#define SST_HDR_KEYS_OFFT    32
+#define SST_HDR_SIZE_OFFT    40
+#define SST_FLAG_COMPRESSED  0x01 /* At least one block is compressed */
+/* First page of the blocks */
+#define SST_FIRST_PAGE 2
+/*
+ * Index entry:
+ *   8 byte block offset
+ *   4 byte block size as stored
+ *   4 byte uncompressed block size (Same as the stored size for uncompressed blocks)
+ *   4 byte offset of the first key of the block in the key area
+ *   4 byte length of the first key
+ */
+#define SST_INDEX_ENTRY_SZ 24
+/* Uncompressed block size threshold */
+#ifndef UNQLITE_KV_SST_BLOCK_SIZE
+#define UNQLITE_KV_SST_BLOCK_SIZE 4096
+#endif
+/* Largest varint */
+#define SST_VARINT_MAX 10
+/* LZ77 parameters: Minimum match, farthest match and hash table size */
+#define SST_LZ_MIN_MATCH  4
+#define SST_LZ_MAX_OFFT   0xFFFF
+#define SST_LZ_HASH_SIZE  4096
+/* Engine states */
+#define SST_STATE_BUILD  1 /* Empty table, accepting records in key order */
+#define SST_STATE_SEALED 2 /* Read-only table */
+/* Forward declaration */
+typedef struct sst_kv_engine sst_kv_engine;
+/*
+ * Each sorted table engine is represented by an instance
+ * of the following structure.
+ */
+struct sst_kv_engine
+{
+	const unqlite_kv_io *pIo;     /* IO methods: Must be first */
+	/* Private fields */
+	SyMemBackend sAlloc;          /* Private memory backend */
+	sxu32 iPageSize;              /* Page size */
+	int iState;                   /* SST_STATE_* */
+	int bCompress;                /* Compress blocks while building */
+	/* Sealed table */
+	const unsigned char *zBase;   /* Start of the blocks (Memory view or private copy) */
+	unsigned char *zCopy;         /* Private copy when the file is not memory mapped */
+	int bLoaded;                  /* True when zBase is available */
+	int bMapped;                  /* True when zBase point to the memory view of the file */
+	sxu32 iFlags;                 /* SST_FLAG_* */
+	sxu32 nBlock;                 /* Number of blocks */
+	sxu64 nRecord;                /* Number of records */
+	sxu64 iIndexOfft;             /* Index offset */
+	sxu64 nKeyArea;               /* Key area size */
+	sxu64 nSize;                  /* Size of the blocks, the index and the key area */
+	const unsigned char *zIndex;  /* Index */
+	const unsigned char *zKeys;   /* Key area */
+	/* Table under construction */
+	int bStarted;                 /* True once page one is allocated */
+	unqlite_page *pPage;          /* Page being filled */
+	sxu32 iPageOfft;              /* Write offset in pPage */
+	pgno iLastPage;               /* Last allocated page */
+	sxu32 nBlockRec;              /* Records in the current block */
+	SyBlob sBlock;                /* Current block */
+	SyBlob sPacked;               /* Compressed block */
+	SyBlob sIndex;                /* Index entries */
+	SyBlob sKeys;                 /* Key area */
+	SyBlob sLast;                 /* Last stored key */
+	sxu32 *aHash;                 /* LZ77 match finder */
+};
+/*
+ * Append a varint to a blob.
+ */
+static int sstPutVarint(SyBlob *pBlob,sxu64 v)
+{
+	unsigned char zBuf[SST_VARINT_MAX];
+	sxu32 n = 0;
+	while( v >= 0x80 ){
+		zBuf[n++] = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	zBuf[n++] = (unsigned char)v;
+	return SyBlobAppend(pBlob,zBuf,n) == SXRET_OK ? UNQLITE_OK : UNQLITE_NOMEM;
+}
+/*
+ * Decode a varint. Return the number of bytes consumed or zero on malformed input.
+ */
+static sxu32 sstGetVarint(const unsigned char *zBuf,sxu32 nBuf,sxu64 *pVal)
+{
+	sxu64 v = 0;
+	sxu32 i;
+	for( i = 0 ; i < nBuf && i < SST_VARINT_MAX ; ++i ){
+		v |= (sxu64)(zBuf[i] & 0x7F) << (7 * i);
+		if( (zBuf[i] & 0x80) == 0 ){
+			*pVal = v;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+/*
+ * Compare two keys: Byte-wise comparison, shorter keys first.
+ */
+static int sstKeyCmp(const void *pA,sxu32 nA,const void *pB,sxu32 nB)
+{
+	int rc = SyMemcmp(pA,pB,nA < nB ? nA : nB);
+	if( rc == 0 ){
+		rc = nA < nB ? -1 : (nA > nB ? 1 : 0);
+	}
+	return rc;
+}
+/*
+ * Append a LZ77 length extension (A run of 255 followed by the remainder).
+ */
+static int sstLzPutLength(SyBlob *pOut,sxu32 n)
+{
+	unsigned char c = 255;
+	while( n >= 255 ){
+		if( SyBlobAppend(pOut,&c,1) != SXRET_OK ){
+			return UNQLITE_NOMEM;
+		}
+		n -= 255;
+	}
+	c = (unsigned char)n;
+	return SyBlobAppend(pOut,&c,1) == SXRET_OK ? UNQLITE_OK : UNQLITE_NOMEM;
+}
+/*
+ * Append a LZ77 sequence: A token holding the literal count (High nibble) and the
+ * match length (Low nibble) followed by the length extensions, the literals and the
+ * match offset. The final sequence hold literals only.
+ */
+static int sstLzPutSequence(SyBlob *pOut,const unsigned char *zLit,sxu32 nLit,sxu32 nMatch,sxu32 iOfft)
+{
+	unsigned char zOfft[2];
+	unsigned char iToken;
+	int rc;
+	iToken = (unsigned char)((nLit >= 15 ? 15 : nLit) << 4);
+	if( nMatch > 0 ){
+		nMatch -= SST_LZ_MIN_MATCH;
+		iToken |= (unsigned char)(nMatch >= 15 ? 15 : nMatch);
+	}
+	rc = SyBlobAppend(pOut,&iToken,1) == SXRET_OK ? UNQLITE_OK : UNQLITE_NOMEM;
+	if( rc == UNQLITE_OK && nLit >= 15 ){
+		rc = sstLzPutLength(pOut,nLit - 15);
+	}
+	if( rc == UNQLITE_OK && nLit > 0 && SyBlobAppend(pOut,zLit,nLit) != SXRET_OK ){
+		rc = UNQLITE_NOMEM;
+	}
+	if( rc != UNQLITE_OK || iOfft == 0 ){
+		/* Final sequence */
+		return rc;
+	}
+	zOfft[0] = (unsigned char)(iOfft >> 8);
+	zOfft[1] = (unsigned char)iOfft;
+	if( SyBlobAppend(pOut,zOfft,sizeof(zOfft)) != SXRET_OK ){
+		return UNQLITE_NOMEM;
+	}
+	if( nMatch >= 15 ){
+		rc = sstLzPutLength(pOut,nMatch - 15);
+	}
+	return rc;
+}
+/*
+ * Compress a block.
+ */
+static int sstLzCompress(sst_kv_engine *pEngine,const unsigned char *zIn,sxu32 nIn,SyBlob *pOut)
+{
+	sxu32 *aHash = pEngine->aHash;
+	sxu32 i = 0,iAnchor = 0,iEnd,iCand,n,h;
+	int rc;
+	SyZero(aHash,SST_LZ_HASH_SIZE * sizeof(sxu32));
+	/* Keep the last bytes as literals */
+	iEnd = nIn > SST_LZ_MIN_MATCH + 8 ? nIn - SST_LZ_MIN_MATCH - 4 : 0;
+	while( i < iEnd ){
+		h = ((sxu32)zIn[i] | ((sxu32)zIn[i + 1] << 8) | ((sxu32)zIn[i + 2] << 16) | ((sxu32)zIn[i + 3] << 24));
+		h = (h * 2654435761U) >> 20;
+		h &= SST_LZ_HASH_SIZE - 1;
+		iCand = aHash[h];
+		aHash[h] = i + 1; /* Zero mark an empty slot */
+		if( iCand == 0 || i - (iCand - 1) > SST_LZ_MAX_OFFT || SyMemcmp(&zIn[iCand - 1],&zIn[i],SST_LZ_MIN_MATCH) != 0 ){
+			i++;
+			continue;
+		}
+		iCand--;
+		n = SST_LZ_MIN_MATCH;
+		while( i + n < nIn && zIn[iCand + n] == zIn[i + n] ){
+			n++;
+		}
+		rc = sstLzPutSequence(pOut,&zIn[iAnchor],i - iAnchor,n,i - iCand);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		i += n;
+		iAnchor = i;
+	}
+	/* Trailing literals */
+	return sstLzPutSequence(pOut,&zIn[iAnchor],nIn - iAnchor,0,0);
+}
+/*
+ * Decode a LZ77 length extension.
+ */
+static int sstLzGetLength(const unsigned char *zIn,sxu32 nIn,sxu32 *pPos,sxu32 *pLen,sxu32 nMax)
+{
+	sxu32 n = *pLen;
+	unsigned char c;
+	do{
+		if( *pPos >= nIn ){
+			return UNQLITE_CORRUPT;
+		}
+		c = zIn[(*pPos)++];
+		n += c;
+		if( n > nMax ){
+			return UNQLITE_CORRUPT;
+		}
+	}while( c == 255 );
+	*pLen = n;
+	return UNQLITE_OK;
+}
+/*
+ * Decompress a block of exactly nOut bytes.
+ */
+static int sstLzDecompress(const unsigned char *zIn,sxu32 nIn,unsigned char *zOut,sxu32 nOut)
+{
+	sxu32 ip = 0,op = 0;
+	sxu32 nLit,nMatch,iOfft;
+	unsigned char iToken;
+	while( ip < nIn ){
+		iToken = zIn[ip++];
+		nLit = iToken >> 4;
+		if( nLit == 15 && sstLzGetLength(zIn,nIn,&ip,&nLit,nOut) != UNQLITE_OK ){
+			return UNQLITE_CORRUPT;
+		}
+		if( nLit > nIn - ip || nLit > nOut - op ){
+			return UNQLITE_CORRUPT;
+		}
+		SyMemcpy(&zIn[ip],&zOut[op],nLit);
+		ip += nLit;
+		op += nLit;
+		if( ip >= nIn ){
+			/* Final sequence */
+			break;
+		}
+		if( nIn - ip < 2 ){
+			return UNQLITE_CORRUPT;
+		}
+		iOfft = ((sxu32)zIn[ip] << 8) | zIn[ip + 1];
+		ip += 2;
+		nMatch = iToken & 0x0F;
+		if( nMatch == 15 && sstLzGetLength(zIn,nIn,&ip,&nMatch,nOut) != UNQLITE_OK ){
+			return UNQLITE_CORRUPT;
+		}
+		nMatch += SST_LZ_MIN_MATCH;
+		if( iOfft == 0 || iOfft > op || nMatch > nOut - op ){
+			return UNQLITE_CORRUPT;
+		}
+		/* Byte by byte since the source may overlap the destination */
+		while( nMatch-- > 0 ){
+			zOut[op] = zOut[op - iOfft];
+			op++;
+		}
+	}
+	return op == nOut ? UNQLITE_OK : UNQLITE_CORRUPT;
+}
+/*
+ * Append raw bytes to the page stream.
+ * Pages are allocated one after the other so that the stream is contiguous in the file.
+ */
+static int sstStreamWrite(sst_kv_engine *pEngine,const void *pData,sxu32 nLen)
+{
+	const unsigned char *zData = (const unsigned char *)pData;
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	sxu32 n;
+	int rc;
+	while( nLen > 0 ){
+		if( pEngine->pPage == 0 || pEngine->iPageOfft >= pEngine->iPageSize ){
+			if( pEngine->pPage ){
+				pIo->xPageUnref(pEngine->pPage);
+				pEngine->pPage = 0;
+			}
+			rc = pIo->xNew(pIo->pHandle,&pEngine->pPage);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			if( pEngine->pPage->pgno != pEngine->iLastPage + 1 ){
+				pIo->xErr(pIo->pHandle,"Sorted table pages must be allocated contiguously");
+				return UNQLITE_CORRUPT;
+			}
+			rc = pIo->xWrite(pEngine->pPage);
+			if( rc != UNQLITE_OK ){
+				return rc;
+			}
+			pEngine->iLastPage = pEngine->pPage->pgno;
+			pEngine->iPageOfft = 0;
+		}
+		n = pEngine->iPageSize - pEngine->iPageOfft;
+		if( n > nLen ){
+			n = nLen;
+		}
+		SyMemcpy(zData,&pEngine->pPage->zData[pEngine->iPageOfft],n);
+		pEngine->iPageOfft += n;
+		pEngine->nSize += n;
+		zData += n;
+		nLen -= n;
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Write the current block and record its index entry.
+ */
+static int sstFlushBlock(sst_kv_engine *pEngine)
+{
+	unsigned char zEntry[SST_INDEX_ENTRY_SZ];
+	const void *pBlock;
+	sxu32 nRaw,nStored;
+	int rc;
+	if( pEngine->nBlockRec < 1 ){
+		return UNQLITE_OK;
+	}
+	pBlock = SyBlobData(&pEngine->sBlock);
+	nStored = nRaw = SyBlobLength(&pEngine->sBlock);
+	if( pEngine->bCompress ){
+		SyBlobReset(&pEngine->sPacked);
+		rc = sstLzCompress(pEngine,(const unsigned char *)pBlock,nRaw,&pEngine->sPacked);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( SyBlobLength(&pEngine->sPacked) < nRaw - (nRaw >> 3) ){
+			/* Worth it */
+			pBlock = SyBlobData(&pEngine->sPacked);
+			nStored = SyBlobLength(&pEngine->sPacked);
+			pEngine->iFlags |= SST_FLAG_COMPRESSED;
+		}
+	}
+	/* The first key offset and length were filled when the block was started */
+	SyBigEndianPack64(zEntry,pEngine->nSize);
+	SyBigEndianPack32(&zEntry[8],nStored);
+	SyBigEndianPack32(&zEntry[12],nRaw);
+	rc = sstStreamWrite(pEngine,pBlock,nStored);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyMemcpy(zEntry,SyBlobDataAt(&pEngine->sIndex,SyBlobLength(&pEngine->sIndex) - SST_INDEX_ENTRY_SZ),16);
+	pEngine->nBlock++;
+	pEngine->nBlockRec = 0;
+	SyBlobReset(&pEngine->sBlock);
+	return UNQLITE_OK;
+}
+/*
+ * Append a record to the table under construction.
+ */
+static int sstBuildAppend(sst_kv_engine *pEngine,const void *pKey,sxu32 nKey,const void *pData,sxu64 nData)
+{
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	const unsigned char *zLast;
+	sxu32 nShared,nLast;
+	int rc;
+	if( !pEngine->bStarted ){
+		unqlite_page *pHeader;
+		/* Reserve page one for the header */
+		rc = pIo->xNew(pIo->pHandle,&pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( pHeader->pgno != 1 ){
+			pIo->xPageUnref(pHeader);
+			pIo->xErr(pIo->pHandle,"A sorted table must be built in an empty database");
+			return UNQLITE_LOCKED;
+		}
+		rc = pIo->xWrite(pHeader);
+		pIo->xPageUnref(pHeader);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pEngine->iLastPage = 1;
+		pEngine->bStarted = 1;
+	}else if( sstKeyCmp(SyBlobData(&pEngine->sLast),SyBlobLength(&pEngine->sLast),pKey,nKey) >= 0 ){
+		pIo->xErr(pIo->pHandle,"Sorted table records must be stored in strictly ascending key order");
+		return UNQLITE_INVALID;
+	}
+	if( nData >= SXU32_HIGH / 2 - nKey - SyBlobLength(&pEngine->sBlock) ){
+		pIo->xErr(pIo->pHandle,"Sorted table record too large");
+		return UNQLITE_FULL;
+	}
+	if( pEngine->nBlockRec < 1 ){
+		unsigned char zEntry[SST_INDEX_ENTRY_SZ];
+		/* Start a new block, record its first key */
+		SyZero(zEntry,sizeof(zEntry));
+		SyBigEndianPack32(&zEntry[16],(sxu32)SyBlobLength(&pEngine->sKeys));
+		SyBigEndianPack32(&zEntry[20],nKey);
+		if( SyBlobAppend(&pEngine->sIndex,zEntry,sizeof(zEntry)) != SXRET_OK ||
+			SyBlobAppend(&pEngine->sKeys,pKey,nKey) != SXRET_OK ){
+				return UNQLITE_NOMEM;
+		}
+		nShared = 0;
+	}else{
+		/* Length of the prefix shared with the previous key */
+		zLast = (const unsigned char *)SyBlobData(&pEngine->sLast);
+		nLast = SyBlobLength(&pEngine->sLast);
+		nShared = 0;
+		while( nShared < nLast && nShared < nKey && zLast[nShared] == ((const unsigned char *)pKey)[nShared] ){
+			nShared++;
+		}
+	}
+	rc = sstPutVarint(&pEngine->sBlock,nShared);
+	if( rc == UNQLITE_OK ){
+		rc = sstPutVarint(&pEngine->sBlock,nKey - nShared);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = sstPutVarint(&pEngine->sBlock,nData);
+	}
+	if( rc == UNQLITE_OK && SyBlobAppend(&pEngine->sBlock,&((const unsigned char *)pKey)[nShared],nKey - nShared) != SXRET_OK ){
+		rc = UNQLITE_NOMEM;
+	}
+	if( rc == UNQLITE_OK && nData > 0 && SyBlobAppend(&pEngine->sBlock,pData,(sxu32)nData) != SXRET_OK ){
+		rc = UNQLITE_NOMEM;
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBlobReset(&pEngine->sLast);
+	if( SyBlobAppend(&pEngine->sLast,pKey,nKey) != SXRET_OK ){
+		return UNQLITE_NOMEM;
+	}
+	pEngine->nBlockRec++;
+	pEngine->nRecord++;
+	if( SyBlobLength(&pEngine->sBlock) >= UNQLITE_KV_SST_BLOCK_SIZE ){
+		rc = sstFlushBlock(pEngine);
+	}
+	return rc;
+}
+/*
+ * Write the last block, the index and the header. The table is read-only afterwards.
+ */
+static int sstSeal(sst_kv_engine *pEngine)
+{
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	unqlite_page *pHeader;
+	int rc;
+	rc = sstFlushBlock(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pEngine->iIndexOfft = pEngine->nSize;
+	pEngine->nKeyArea = SyBlobLength(&pEngine->sKeys);
+	rc = sstStreamWrite(pEngine,SyBlobData(&pEngine->sIndex),SyBlobLength(&pEngine->sIndex));
+	if( rc == UNQLITE_OK ){
+		rc = sstStreamWrite(pEngine,SyBlobData(&pEngine->sKeys),SyBlobLength(&pEngine->sKeys));
+	}
+	if( pEngine->pPage ){
+		pIo->xPageUnref(pEngine->pPage);
+		pEngine->pPage = 0;
+	}
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pIo->xGet(pIo->pHandle,1,&pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pIo->xWrite(pHeader);
+	if( rc == UNQLITE_OK ){
+		SyBigEndianPack32(pHeader->zData,SST_MAGIC);
+		SyBigEndianPack32(&pHeader->zData[4],SST_VERSION);
+		SyBigEndianPack32(&pHeader->zData[SST_HDR_FLAGS_OFFT],pEngine->iFlags);
+		SyBigEndianPack32(&pHeader->zData[SST_HDR_BLOCK_OFFT],pEngine->nBlock);
+		SyBigEndianPack64(&pHeader->zData[SST_HDR_RECORD_OFFT],pEngine->nRecord);
+		SyBigEndianPack64(&pHeader->zData[SST_HDR_INDEX_OFFT],pEngine->iIndexOfft);
+		SyBigEndianPack64(&pHeader->zData[SST_HDR_KEYS_OFFT],pEngine->nKeyArea);
+		SyBigEndianPack64(&pHeader->zData[SST_HDR_SIZE_OFFT],pEngine->nSize);
+	}
+	pIo->xPageUnref(pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Builder buffers are no longer needed */
+	SyBlobRelease(&pEngine->sBlock);
+	SyBlobRelease(&pEngine->sPacked);
+	SyBlobRelease(&pEngine->sIndex);
+	SyBlobRelease(&pEngine->sKeys);
+	SyBlobRelease(&pEngine->sLast);
+	pEngine->iState = SST_STATE_SEALED;
+	pEngine->bLoaded = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Make the blocks, the index and the key area of a sealed table available.
+ * The memory view of the file is used when available, otherwise the table is
+ * copied from the page cache.
+ */
+static int sstLoad(sst_kv_engine *pEngine)
+{
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	const unsigned char *zMap;
+	unqlite_int64 nByte = 0;
+	unqlite_page *pPage;
+	sxu64 nOfft,n;
+	pgno iPage;
+	int rc;
+	if( pEngine->bLoaded ){
+		return UNQLITE_OK;
+	}
+	zMap = unqlitePagerGetMmap(pIo->pHandle,&nByte);
+	if( zMap && (sxu64)nByte >= (sxu64)SST_FIRST_PAGE * pEngine->iPageSize + pEngine->nSize ){
+		/* Zero copy */
+		pEngine->zBase = &zMap[SST_FIRST_PAGE * pEngine->iPageSize];
+		pEngine->bMapped = 1;
+	}else if( pEngine->nSize > 0 ){
+		if( pEngine->nSize >= SXU32_HIGH ){
+			pIo->xErr(pIo->pHandle,"Sorted table too large to be loaded in memory, open it with UNQLITE_OPEN_MMAP");
+			return UNQLITE_NOMEM;
+		}
+		pEngine->zCopy = (unsigned char *)SyMemBackendAlloc(&pEngine->sAlloc,(sxu32)pEngine->nSize);
+		if( pEngine->zCopy == 0 ){
+			return UNQLITE_NOMEM;
+		}
+		iPage = SST_FIRST_PAGE;
+		for( nOfft = 0 ; nOfft < pEngine->nSize ; nOfft += n ){
+			rc = pIo->xGet(pIo->pHandle,iPage++,&pPage);
+			if( rc != UNQLITE_OK ){
+				SyMemBackendFree(&pEngine->sAlloc,pEngine->zCopy);
+				pEngine->zCopy = 0;
+				return rc;
+			}
+			n = pEngine->nSize - nOfft;
+			if( n > pEngine->iPageSize ){
+				n = pEngine->iPageSize;
+			}
+			SyMemcpy(pPage->zData,&pEngine->zCopy[nOfft],(sxu32)n);
+			pIo->xPageUnref(pPage);
+		}
+		pEngine->zBase = pEngine->zCopy;
+		pEngine->bMapped = 0;
+	}else{
+		pEngine->zBase = 0;
+		pEngine->bMapped = 0;
+	}
+	pEngine->zIndex = pEngine->zBase ? &pEngine->zBase[pEngine->iIndexOfft] : 0;
+	pEngine->zKeys = pEngine->zIndex ? &pEngine->zIndex[(sxu64)pEngine->nBlock * SST_INDEX_ENTRY_SZ] : 0;
+	pEngine->bLoaded = 1;
+	return UNQLITE_OK;
+}
+/*
+ * Read and validate the header of an existing table.
+ */
+static int sstReadHeader(sst_kv_engine *pEngine)
+{
+	const unqlite_kv_io *pIo = pEngine->pIo;
+	unqlite_page *pHeader;
+	sxu32 nMagic,iVersion;
+	int rc;
+	rc = pIo->xGet(pIo->pHandle,1,&pHeader);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SyBigEndianUnpack32(pHeader->zData,&nMagic);
+	SyBigEndianUnpack32(&pHeader->zData[4],&iVersion);
+	SyBigEndianUnpack32(&pHeader->zData[SST_HDR_FLAGS_OFFT],&pEngine->iFlags);
+	SyBigEndianUnpack32(&pHeader->zData[SST_HDR_BLOCK_OFFT],&pEngine->nBlock);
+	SyBigEndianUnpack64(&pHeader->zData[SST_HDR_RECORD_OFFT],&pEngine->nRecord);
+	SyBigEndianUnpack64(&pHeader->zData[SST_HDR_INDEX_OFFT],&pEngine->iIndexOfft);
+	SyBigEndianUnpack64(&pHeader->zData[SST_HDR_KEYS_OFFT],&pEngine->nKeyArea);
+	SyBigEndianUnpack64(&pHeader->zData[SST_HDR_SIZE_OFFT],&pEngine->nSize);
+	pIo->xPageUnref(pHeader);
+	if( nMagic != SST_MAGIC || iVersion != SST_VERSION ){
+		pIo->xErr(pIo->pHandle,"Not a sorted table");
+		return UNQLITE_CORRUPT;
+	}
+	if( pEngine->iIndexOfft > pEngine->nSize || pEngine->nKeyArea > pEngine->nSize ||
+		pEngine->iIndexOfft + (sxu64)pEngine->nBlock * SST_INDEX_ENTRY_SZ + pEngine->nKeyArea != pEngine->nSize ){
+			pIo->xErr(pIo->pHandle,"Malformed sorted table header");
+			return UNQLITE_CORRUPT;
+	}
+	pEngine->iState = SST_STATE_SEALED;
+	pEngine->bLoaded = 0;
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xInit() method.
+ */
+static int sstInit(unqlite_kv_engine *pKv,int iPageSize)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pKv;
+	/* Note that this instance is already zeroed */
+	SyMemBackendInitFromParent(&pEngine->sAlloc,unqliteKvIoMemBackend(pKv->pIo));
+	SyBlobInit(&pEngine->sBlock,&pEngine->sAlloc);
+	SyBlobInit(&pEngine->sPacked,&pEngine->sAlloc);
+	SyBlobInit(&pEngine->sIndex,&pEngine->sAlloc);
+	SyBlobInit(&pEngine->sKeys,&pEngine->sAlloc);
+	SyBlobInit(&pEngine->sLast,&pEngine->sAlloc);
+	pEngine->iPageSize = (sxu32)iPageSize;
+	pEngine->iState = SST_STATE_BUILD;
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xRelease() method.
+ */
+static void sstRelease(unqlite_kv_engine *pKv)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pKv;
+	if( pEngine->pPage ){
+		pEngine->pIo->xPageUnref(pEngine->pPage);
+		pEngine->pPage = 0;
+	}
+	/* Release the private memory backend */
+	SyMemBackendRelease(&pEngine->sAlloc);
+}
+/*
+ * Exported: xOpen() method.
+ */
+static int sstOpen(unqlite_kv_engine *pKv,pgno dbSize)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pKv;
+	if( dbSize < 2 ){
+		/* A new table */
+		return UNQLITE_OK;
+	}
+	return sstReadHeader(pEngine);
+}
+/*
+ * Exported: xConfig() method.
+ */
+static int sstConfigure(unqlite_kv_engine *pKv,int iOp,va_list ap)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pKv;
+	int rc = UNQLITE_OK;
+	switch(iOp){
+	case UNQLITE_KV_CONFIG_CMP_FUNC:
+		/* Records are always ordered byte-wise */
+		rc = UNQLITE_NOTIMPLEMENTED;
+		break;
+	case UNQLITE_KV_CONFIG_BLOCK_COMPRESSION: {
+		int bEnable = va_arg(ap,int);
+		if( pEngine->iState != SST_STATE_BUILD ){
+			rc = UNQLITE_READ_ONLY;
+			break;
+		}
+		if( bEnable && pEngine->aHash == 0 ){
+			pEngine->aHash = (sxu32 *)SyMemBackendAlloc(&pEngine->sAlloc,SST_LZ_HASH_SIZE * sizeof(sxu32));
+			if( pEngine->aHash == 0 ){
+				rc = UNQLITE_NOMEM;
+				break;
+			}
+		}
+		pEngine->bCompress = bEnable ? 1 : 0;
+		break;
+											  }
+	default:
+		/* Unknown configuration option */
+		rc = UNQLITE_UNKNOWN;
+		break;
+	}
+	return rc;
+}
+/*
+ * Exported: xReplace() method.
+ * Only allowed while building the table, in strictly ascending key order.
+ */
+static int sstReplace(
+	  unqlite_kv_engine *pKv,
+	  const void *pKey,int nKeyLen,
+	  const void *pData,unqlite_int64 nDataLen
+	  )
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pKv;
+	if( pEngine->iState != SST_STATE_BUILD ){
+		pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only sorted table");
+		return UNQLITE_READ_ONLY;
+	}
+	return sstBuildAppend(pEngine,pKey,(sxu32)nKeyLen,pData,(sxu64)nDataLen);
+}
+/*
+ * Exported: xAppend() method.
+ * Same as xReplace() since a key cannot be stored twice while building.
+ */
+static int sstAppend(
+	  unqlite_kv_engine *pKv,
+	  const void *pKey,int nKeyLen,
+	  const void *pData,unqlite_int64 nDataLen
+	  )
+{
+	return sstReplace(pKv,pKey,nKeyLen,pData,nDataLen);
+}
+/*
+ * Exported: xSync() method.
+ * Seal the table under construction.
+ */
+static int sstSync(unqlite_kv_engine *pKv)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pKv;
+	if( pEngine->iState != SST_STATE_BUILD || !pEngine->bStarted ){
+		return UNQLITE_OK;
+	}
+	return sstSeal(pEngine);
+}
+/*
+ * Each sorted table cursor is represented by an instance of the following structure.
+ * The cursor memory come from the global allocator since the engine memory
+ * is released on rollback.
+ */
+typedef struct sst_kv_cursor sst_kv_cursor;
+struct sst_kv_cursor
+{
+	unqlite_kv_engine *pStore;  /* Must be first */
+	/* Private fields */
+	int bValid;                 /* True when pointing to a record */
+	sxu32 iBlock;               /* Current block */
+	const unsigned char *zBlock;/* Uncompressed block */
+	sxu32 nBlock;               /* Uncompressed block size */
+	int bRaw;                   /* True when zBlock point to the table itself */
+	unsigned char *zBuf;        /* Decompression buffer */
+	sxu32 nAlloc;               /* Decompression buffer size */
+	sxu32 iRec;                 /* Current record offset in the block */
+	sxu32 iNext;                /* Next record offset in the block */
+	SyBlob sKey;                /* Current key */
+	const unsigned char *zData; /* Current record data */
+	sxu32 nData;                /* Current record data length */
+};
+/*
+ * Point to the first key of a given block.
+ */
+static int sstBlockFirstKey(sst_kv_engine *pEngine,sxu32 iBlock,const unsigned char **pzKey,sxu32 *pnKey)
+{
+	const unsigned char *zEntry = &pEngine->zIndex[(sxu64)iBlock * SST_INDEX_ENTRY_SZ];
+	sxu32 iOfft,nKey;
+	SyBigEndianUnpack32(&zEntry[16],&iOfft);
+	SyBigEndianUnpack32(&zEntry[20],&nKey);
+	if( (sxu64)iOfft + nKey > pEngine->nKeyArea ){
+		return UNQLITE_CORRUPT;
+	}
+	*pzKey = &pEngine->zKeys[iOfft];
+	*pnKey = nKey;
+	return UNQLITE_OK;
+}
+/*
+ * Load a given block in the cursor.
+ */
+static int sstCursorLoadBlock(sst_kv_cursor *pCur,sxu32 iBlock)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pCur->pStore;
+	const unsigned char *zEntry = &pEngine->zIndex[(sxu64)iBlock * SST_INDEX_ENTRY_SZ];
+	sxu32 nStored,nRaw;
+	sxu64 iOfft;
+	int rc;
+	pCur->bValid = 0;
+	SyBigEndianUnpack64(zEntry,&iOfft);
+	SyBigEndianUnpack32(&zEntry[8],&nStored);
+	SyBigEndianUnpack32(&zEntry[12],&nRaw);
+	if( iOfft > pEngine->iIndexOfft || nStored > pEngine->iIndexOfft - iOfft || nStored > nRaw ){
+		return UNQLITE_CORRUPT;
+	}
+	if( nStored == nRaw ){
+		/* Stored uncompressed */
+		pCur->zBlock = &pEngine->zBase[iOfft];
+		pCur->bRaw = 1;
+	}else{
+		if( nRaw > pCur->nAlloc ){
+			unsigned char *zNew;
+			zNew = (unsigned char *)SyMemBackendRealloc((SyMemBackend *)unqliteExportMemBackend(),pCur->zBuf,nRaw);
+			if( zNew == 0 ){
+				return UNQLITE_NOMEM;
+			}
+			pCur->zBuf = zNew;
+			pCur->nAlloc = nRaw;
+		}
+		rc = sstLzDecompress(&pEngine->zBase[iOfft],nStored,pCur->zBuf,nRaw);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		pCur->zBlock = pCur->zBuf;
+		pCur->bRaw = 0;
+	}
+	pCur->nBlock = nRaw;
+	pCur->iBlock = iBlock;
+	pCur->iNext = 0;
+	SyBlobReset(&pCur->sKey);
+	return UNQLITE_OK;
+}
+/*
+ * Decode the record at the given block offset.
+ * The cursor key must hold the key of the previous record in the block.
+ */
+static int sstCursorDecode(sst_kv_cursor *pCur,sxu32 iOfft)
+{
+	const unsigned char *zBlock = pCur->zBlock;
+	sxu64 nShared,nSuffix,nData;
+	sxu32 n,i = iOfft;
+	pCur->bValid = 0;
+	if( i >= pCur->nBlock ){
+		return UNQLITE_CORRUPT;
+	}
+	n = sstGetVarint(&zBlock[i],pCur->nBlock - i,&nShared);
+	i += n;
+	if( n > 0 ){
+		n = sstGetVarint(&zBlock[i],pCur->nBlock - i,&nSuffix);
+		i += n;
+	}
+	if( n > 0 ){
+		n = sstGetVarint(&zBlock[i],pCur->nBlock - i,&nData);
+		i += n;
+	}
+	if( n < 1 || nShared > SyBlobLength(&pCur->sKey) || (iOfft == 0 && nShared > 0) ||
+		nSuffix > pCur->nBlock - i || nData > pCur->nBlock - i - nSuffix || nShared + nSuffix < 1 ){
+			return UNQLITE_CORRUPT;
+	}
+	SyBlobTruncate(&pCur->sKey,(sxu32)nShared);
+	if( SyBlobAppend(&pCur->sKey,&zBlock[i],(sxu32)nSuffix) != SXRET_OK ){
+		return UNQLITE_NOMEM;
+	}
+	i += (sxu32)nSuffix;
+	pCur->zData = &zBlock[i];
+	pCur->nData = (sxu32)nData;
+	pCur->iRec = iOfft;
+	pCur->iNext = i + (sxu32)nData;
+	pCur->bValid = 1;
+	return UNQLITE_OK;
+}
+/*
+ * Position the cursor on the record preceding the one at iOfft in the current block.
+ */
+static int sstCursorRewind(sst_kv_cursor *pCur,sxu32 iOfft)
+{
+	int rc;
+	SyBlobReset(&pCur->sKey);
+	rc = sstCursorDecode(pCur,0);
+	while( rc == UNQLITE_OK && pCur->iNext < iOfft ){
+		rc = sstCursorDecode(pCur,pCur->iNext);
+	}
+	return rc;
+}
+/*
+ * Make sure the table is available for reading.
+ * Return UNQLITE_DONE when there is nothing to read.
+ */
+static int sstCursorPrepare(sst_kv_cursor *pCur)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pCur->pStore;
+	int rc;
+	pCur->bValid = 0;
+	if( pEngine->iState != SST_STATE_SEALED ){
+		/* Records are not visible until the table is sealed */
+		return UNQLITE_DONE;
+	}
+	rc = sstLoad(pEngine);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return pEngine->nBlock > 0 ? UNQLITE_OK : UNQLITE_DONE;
+}
+/*
+ * Exported: xCursorInit() method.
+ */
+static void sstCursorInit(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	SyBlobInit(&pCur->sKey,(SyMemBackend *)unqliteExportMemBackend());
+	pCur->bValid = 0;
+	pCur->zBuf = 0;
+	pCur->nAlloc = 0;
+}
+/*
+ * Exported: xCursorRelease() method.
+ */
+static void sstCursorRelease(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	SyBlobRelease(&pCur->sKey);
+	if( pCur->zBuf ){
+		SyMemBackendFree((SyMemBackend *)unqliteExportMemBackend(),pCur->zBuf);
+		pCur->zBuf = 0;
+		pCur->nAlloc = 0;
+	}
+	pCur->bValid = 0;
+}
+/*
+ * Exported: xReset() method.
+ */
+static void sstCursorReset(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	pCur->bValid = 0;
+}
+/*
+ * Exported: xFirst() method.
+ */
+static int sstCursorFirst(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	int rc;
+	rc = sstCursorPrepare(pCur);
+	if( rc == UNQLITE_OK ){
+		rc = sstCursorLoadBlock(pCur,0);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = sstCursorDecode(pCur,0);
+	}
+	return rc == UNQLITE_DONE ? UNQLITE_OK : rc;
+}
+/*
+ * Exported: xLast() method.
+ */
+static int sstCursorLast(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	int rc;
+	rc = sstCursorPrepare(pCur);
+	if( rc == UNQLITE_OK ){
+		rc = sstCursorLoadBlock(pCur,((sst_kv_engine *)pCur->pStore)->nBlock - 1);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = sstCursorRewind(pCur,pCur->nBlock);
+	}
+	return rc == UNQLITE_DONE ? UNQLITE_OK : rc;
+}
+/*
+ * Exported: xValid() method.
+ */
+static int sstCursorValid(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	return pCur->bValid;
+}
+/*
+ * Exported: xNext() method.
+ */
+static int sstCursorNext(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	sst_kv_engine *pEngine = (sst_kv_engine *)pCur->pStore;
+	int rc;
+	if( !pCur->bValid ){
+		return UNQLITE_EOF;
+	}
+	if( pCur->iNext < pCur->nBlock ){
+		return sstCursorDecode(pCur,pCur->iNext);
+	}
+	if( pCur->iBlock + 1 >= pEngine->nBlock ){
+		pCur->bValid = 0;
+		return UNQLITE_EOF;
+	}
+	rc = sstCursorLoadBlock(pCur,pCur->iBlock + 1);
+	if( rc == UNQLITE_OK ){
+		rc = sstCursorDecode(pCur,0);
+	}
+	return rc;
+}
+/*
+ * Exported: xPrev() method.
+ */
+static int sstCursorPrev(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	int rc;
+	if( !pCur->bValid ){
+		return UNQLITE_EOF;
+	}
+	if( pCur->iRec > 0 ){
+		/* Keys are prefix compressed, rescan the block */
+		return sstCursorRewind(pCur,pCur->iRec);
+	}
+	if( pCur->iBlock < 1 ){
+		pCur->bValid = 0;
+		return UNQLITE_EOF;
+	}
+	rc = sstCursorLoadBlock(pCur,pCur->iBlock - 1);
+	if( rc == UNQLITE_OK ){
+		rc = sstCursorRewind(pCur,pCur->nBlock);
+	}
+	return rc;
+}
+/*
+ * Exported: xSeek() method.
+ */
+static int sstCursorSeek(unqlite_kv_cursor *pCursor,const void *pKey,int nByte,int iPos)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	sst_kv_engine *pEngine = (sst_kv_engine *)pCur->pStore;
+	const unsigned char *zFirst;
+	sxi64 iLo,iHi,iMid,iFound;
+	sxu32 nFirst;
+	int rc,c;
+	rc = sstCursorPrepare(pCur);
+	if( rc != UNQLITE_OK ){
+		return rc == UNQLITE_DONE ? UNQLITE_NOTFOUND : rc;
+	}
+	/* Binary search the last block whose first key is less than or equal to the target */
+	iLo = 0;
+	iHi = (sxi64)pEngine->nBlock - 1;
+	iFound = -1;
+	while( iLo <= iHi ){
+		iMid = (iLo + iHi) >> 1;
+		rc = sstBlockFirstKey(pEngine,(sxu32)iMid,&zFirst,&nFirst);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( sstKeyCmp(zFirst,nFirst,pKey,(sxu32)nByte) <= 0 ){
+			iFound = iMid;
+			iLo = iMid + 1;
+		}else{
+			iHi = iMid - 1;
+		}
+	}
+	if( iFound < 0 ){
+		/* Target before the first key */
+		if( iPos != UNQLITE_CURSOR_MATCH_GE ){
+			return UNQLITE_NOTFOUND;
+		}
+		rc = sstCursorLoadBlock(pCur,0);
+		return rc == UNQLITE_OK ? sstCursorDecode(pCur,0) : rc;
+	}
+	rc = sstCursorLoadBlock(pCur,(sxu32)iFound);
+	if( rc == UNQLITE_OK ){
+		rc = sstCursorDecode(pCur,0);
+	}
+	while( rc == UNQLITE_OK ){
+		c = sstKeyCmp(SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey),pKey,(sxu32)nByte);
+		if( c == 0 ){
+			return UNQLITE_OK;
+		}
+		if( c > 0 ){
+			/* Past the target, the first key of the block is not */
+			if( iPos == UNQLITE_CURSOR_MATCH_GE ){
+				return UNQLITE_OK;
+			}
+			if( iPos == UNQLITE_CURSOR_MATCH_LE ){
+				return sstCursorRewind(pCur,pCur->iRec);
+			}
+			pCur->bValid = 0;
+			return UNQLITE_NOTFOUND;
+		}
+		if( pCur->iNext >= pCur->nBlock ){
+			/* Every key of the block is smaller than the target */
+			if( iPos == UNQLITE_CURSOR_MATCH_LE ){
+				return UNQLITE_OK;
+			}
+			if( iPos == UNQLITE_CURSOR_MATCH_GE ){
+				rc = sstCursorNext(pCursor);
+				return rc == UNQLITE_EOF ? UNQLITE_NOTFOUND : rc;
+			}
+			pCur->bValid = 0;
+			return UNQLITE_NOTFOUND;
+		}
+		rc = sstCursorDecode(pCur,pCur->iNext);
+	}
+	return rc;
+}
+/*
+ * Exported: xDelete() method.
+ */
+static int sstCursorDelete(unqlite_kv_cursor *pCursor)
+{
+	sst_kv_engine *pEngine = (sst_kv_engine *)pCursor->pStore;
+	pEngine->pIo->xErr(pEngine->pIo->pHandle,"Read-only sorted table");
+	return UNQLITE_READ_ONLY;
+}
+/*
+ * Exported: xKeyLength() method.
+ */
+static int sstCursorKeyLength(unqlite_kv_cursor *pCursor,int *pLen)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	if( !pCur->bValid ){
+		return UNQLITE_EOF;
+	}
+	*pLen = (int)SyBlobLength(&pCur->sKey);
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xKey() method.
+ */
+static int sstCursorKey(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	if( !pCur->bValid ){
+		return UNQLITE_EOF;
+	}
+	/* Invoke the callback */
+	return xConsumer(SyBlobData(&pCur->sKey),SyBlobLength(&pCur->sKey),pUserData);
+}
+/*
+ * Exported: xDataLength() method.
+ */
+static int sstCursorDataLength(unqlite_kv_cursor *pCursor,unqlite_int64 *pLen)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	if( !pCur->bValid ){
+		return UNQLITE_EOF;
+	}
+	*pLen = (unqlite_int64)pCur->nData;
+	return UNQLITE_OK;
+}
+/*
+ * Exported: xDataRange() method.
+ */
+static int sstCursorDataRange(unqlite_kv_cursor *pCursor,unqlite_int64 iOfft,unqlite_int64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	if( iOfft < 0 || nLen < 0 ){
+		return UNQLITE_INVALID;
+	}
+	if( !pCur->bValid ){
+		return UNQLITE_EOF;
+	}
+	if( iOfft >= (unqlite_int64)pCur->nData ){
+		nLen = 0;
+		iOfft = 0;
+	}else if( nLen > (unqlite_int64)pCur->nData - iOfft ){
+		nLen = (unqlite_int64)pCur->nData - iOfft;
+	}
+	/* Invoke the callback */
+	return xConsumer((const void *)&pCur->zData[iOfft],(unsigned int)nLen,pUserData);
+}
+/*
+ * Exported: xData() method.
+ */
+static int sstCursorData(unqlite_kv_cursor *pCursor,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData)
+{
+	return sstCursorDataRange(pCursor,0,SXI64_HIGH,xConsumer,pUserData);
+}
+/*
+ * Exported: xDataRef() method.
+ * Point directly to the memory view of the file. No page is pinned since
+ * the view remain valid until the database is closed.
+ */
+static int sstCursorDataRef(unqlite_kv_cursor *pCursor,const void **ppData,unqlite_int64 *pLen,unqlite_page **ppPage)
+{
+	sst_kv_cursor *pCur = (sst_kv_cursor *)pCursor;
+	if( !pCur->bValid ){
+		return UNQLITE_EOF;
+	}
+	if( !pCur->bRaw || !((sst_kv_engine *)pCur->pStore)->bMapped ){
+		/* Decompressed or private copy, let the caller make its own copy */
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	*ppData = (const void *)pCur->zData;
+	*pLen = (unqlite_int64)pCur->nData;
+	*ppPage = 0;
+	return UNQLITE_OK;
+}
+/*
+ * State of the sorted table builder.
+ */
+typedef struct sst_build_ctx sst_build_ctx;
+struct sst_build_ctx
+{
+	unqlite *pOut;  /* Table under construction */
+	SyBlob sData;   /* Record data */
+};
+/*
+ * Walk callback: Copy a record to the table under construction.
+ */
+static int sstBuildRecord(unqlite_kv_cursor *pCur,const void *pKey,sxu32 nKey,void *pUserData)
+{
+	sst_build_ctx *pCtx = (sst_build_ctx *)pUserData;
+	int rc;
+	if( unqliteKvTtlReserved(pKey,nKey) ){
+		/* Expiration metadata are meaningless in a read-only table */
+		return UNQLITE_OK;
+	}
+	SyBlobReset(&pCtx->sData);
+	rc = pCur->pStore->pIo->pMethods->xData(pCur,unqliteDataConsumer,&pCtx->sData);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	return unqlite_kv_store(pCtx->pOut,pKey,(int)nKey,SyBlobData(&pCtx->sData),(unqlite_int64)SyBlobLength(&pCtx->sData));
+}
+/*
+ * Build a sorted table holding the records of a database at zPath.
+ * The destination file must not exist. The caller must hold the database handle mutex.
+ */
+UNQLITE_PRIVATE int unqliteKvBuildTable(unqlite *pDb,unqlite_vfs *pVfs,const char *zPath,int iFlags)
+{
+	sst_build_ctx sCtx;
+	int rc,bExists = 0;
+	rc = unqliteOsAccess(pVfs,zPath,UNQLITE_ACCESS_EXISTS,&bExists);
+	if( rc == UNQLITE_OK && bExists ){
+		unqliteGenErrorFormat(pDb,"Sorted table destination '%s' already exists",zPath);
+		return UNQLITE_EXISTS;
+	}
+	/* Journaling is pointless, the file is discarded on failure */
+	rc = unqlite_open(&sCtx.pOut,zPath,UNQLITE_OPEN_CREATE|UNQLITE_OPEN_OMIT_JOURNALING);
+	if( rc != UNQLITE_OK ){
+		unqliteGenErrorFormat(pDb,"Cannot create sorted table '%s'",zPath);
+		return rc;
+	}
+	rc = unqlite_config(sCtx.pOut,UNQLITE_CONFIG_KV_ENGINE,"sst");
+	if( rc == UNQLITE_OK && (iFlags & UNQLITE_KV_TABLE_COMPRESS) ){
+		rc = unqlite_kv_config(sCtx.pOut,UNQLITE_KV_CONFIG_BLOCK_COMPRESSION,1);
+	}
+	if( rc == UNQLITE_OK ){
+		SyBlobInit(&sCtx.sData,&pDb->sMem);
+		/* Copy the records in key order */
+		rc = unqliteKvWalkSorted(pDb,sstBuildRecord,&sCtx);
+		SyBlobRelease(&sCtx.sData);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Seal the table */
+		rc = unqlite_commit(sCtx.pOut);
+	}
+	if( rc != UNQLITE_OK ){
+		const char *zErr = 0;
+		int nErr = 0;
+		unqlite_config(sCtx.pOut,UNQLITE_CONFIG_ERR_LOG,&zErr,&nErr);
+		if( nErr > 0 ){
+			unqliteGenErrorFormat(pDb,"Error while building sorted table '%s': %.*s",zPath,nErr,zErr);
+		}else{
+			unqliteGenErrorFormat(pDb,"Error while building sorted table '%s'",zPath);
+		}
+		unqlite_rollback(sCtx.pOut);
+	}
+	unqlite_close(sCtx.pOut);
+	if( rc != UNQLITE_OK ){
+		unqliteOsDelete(pVfs,zPath,1);
+	}
+	return rc;
+}
+/*
+ * Export the sorted table storage engine.
+ */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportSstKvStorage(void)
+{
+	static const unqlite_kv_methods sSstStore = {
+		"sst",                      /* zName */
+		sizeof(sst_kv_engine),      /* szKv */
+		sizeof(sst_kv_cursor),      /* szCursor */
+		4,                          /* iVersion */
+		sstInit,                    /* xInit */
+		sstRelease,                 /* xRelease */
+		sstConfigure,               /* xConfig */
+		sstOpen,                    /* xOpen */
+		sstReplace,                 /* xReplace */
+		sstAppend,                  /* xAppend */
+		sstCursorInit,              /* xCursorInit */
+		sstCursorSeek,              /* xSeek */
+		sstCursorFirst,             /* xFirst */
+		sstCursorLast,              /* xLast */
+		sstCursorValid,             /* xValid */
+		sstCursorNext,              /* xNext */
+		sstCursorPrev,              /* xPrev */
+		sstCursorDelete,            /* xDelete */
+		sstCursorKeyLength,         /* xKeyLength */
+		sstCursorKey,               /* xKey */
+		sstCursorDataLength,        /* xDataLength */
+		sstCursorData,              /* xData */
+		sstCursorReset,             /* xReset */
+		sstCursorRelease,           /* xCursorRelease */
+		sstCursorDataRef,           /* xDataRef */
+		sstCursorDataRange,         /* xDataRange */
+		0,                          /* xWriteRange */
+		sstSync,                    /* xSync */
+		UNQLITE_KV_ORDERED,         /* iFlags */
+		0,                          /* xFetch */
+		0,                          /* xRemove */
+		0                           /* xRemoveIf */
+	};
+	return &sSstStore;
+}
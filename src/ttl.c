@@ -0,0 +1,691 @@
+/*
+ * Symisc unQLite: An Embeddable NoSQL (Post Modern) Database Engine.
+ * Copyright (C) 2012-2018, Symisc Systems http://unqlite.org/
+ * Version 1.1.6
+ * For information on licensing, redistribution of this file, and for a DISCLAIMER OF ALL WARRANTIES
+ * please contact Symisc Systems via:
+ *       legal@symisc.net
+ *       licensing@symisc.net
+ *       contact@symisc.net
+ * or visit:
+ *      http://unqlite.org/licensing.html
+ */
+ /* $SymiscID: ttl.c v1.0 Unix 2018-06-22 10:41 stable <chm@symisc.net> $ */
+#ifndef UNQLITE_AMALGAMATION
+#include "unqliteInt.h"
+#endif
+/*
+ * This file implements record expiration for the [unqlite_kv_store_ttl()], [unqlite_kv_ttl()]
+ * and [unqlite_kv_expire()] interfaces.
+ *
+ * The expiration time of a record is persisted next to it in a metadata record whose key
+ * is the reserved 4 byte prefix "\0TTL" followed by the record key and whose data is the
+ * expiration time (Seconds since the epoch) as a 64-bit big-endian integer.
+ * A marker record keyed by the bare prefix tells whether the database holds such records
+ * so that databases which never used expiration pay a single lookup per handle.
+ *
+ * In memory, the expiration times are indexed by a hash table keyed by the record key
+ * (Lazy expiration on read) and a binary min-heap ordered by expiration time (Reaper).
+ * The index is built on first use by a single pass over the metadata records (The whole
+ * database for unordered engines) and discarded when a transaction is rolled back so that
+ * it is rebuilt from the persisted metadata.
+ * Metadata records are not part of the user keyspace: The public interfaces refuse to write
+ * them and cursors step over them.
+ * All routines in this file are called with the database handle mutex held.
+ */
+#define TTL_PREFIX_SZ 4
+static const unsigned char aTtlPrefix[TTL_PREFIX_SZ] = { 0, 'T', 'T', 'L' };
+/*
+ * Expiration index state.
+ */
+#define TTL_STATE_UNKNOWN 0 /* Marker record not yet looked up */
+#define TTL_STATE_EMPTY   1 /* No expiring records in this database */
+#define TTL_STATE_LOADED  2 /* Index loaded in memory */
+/*
+ * Maximum number of due records removed by each [unqlite_kv_store_ttl()] call.
+ */
+#ifndef UNQLITE_TTL_REAP_STEP
+#define UNQLITE_TTL_REAP_STEP 4
+#endif
+/*
+ * An indexed expiration time. The record key follows this structure.
+ */
+typedef struct ttl_entry ttl_entry;
+struct ttl_entry
+{
+	sxi64 iExpire;  /* Expiration time */
+	sxu32 iSlot;    /* Position in the heap */
+	sxu32 nKey;     /* Record key length */
+};
+#define TTL_ENTRY_KEY(ENTRY) ((const void *)&(ENTRY)[1])
+/*
+ * Return the current time in seconds since the epoch using the xCurrentTime()
+ * method of the underlying VFS.
+ */
+static sxi64 TtlNow(unqlite_vfs *pVfs)
+{
+	sxi64 y,m,era,yoe,doy,doe;
+	Sytm sTm;
+	SyZero(&sTm,sizeof(Sytm));
+	pVfs->xCurrentTime(pVfs,&sTm);
+	/* Days since 1970-01-01 of a proleptic Gregorian date */
+	y = (sxi64)sTm.tm_year;
+	m = (sxi64)sTm.tm_mon + 1;
+	if( m <= 2 ){
+		y--;
+	}
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = y - era * 400;
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + sTm.tm_mday - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return (era * 146097 + doe - 719468) * 86400 + sTm.tm_hour * 3600 + sTm.tm_min * 60 + sTm.tm_sec;
+}
+/*
+ * Build the metadata key of a given record.
+ */
+static int TtlMetaKey(SyBlob *pOut,const void *pKey,sxu32 nKey)
+{
+	int rc;
+	SyBlobReset(pOut);
+	rc = SyBlobAppend(pOut,aTtlPrefix,TTL_PREFIX_SZ);
+	if( rc == SXRET_OK ){
+		rc = SyBlobAppend(pOut,pKey,nKey);
+	}
+	return rc == SXRET_OK ? UNQLITE_OK : UNQLITE_NOMEM;
+}
+/*
+ * Remove a record from the underlying storage engine.
+ */
+static int TtlEngineDelete(unqlite *pDb,const void *pKey,sxu32 nKey)
+{
+	unqlite_kv_engine *pEngine = unqlitePagerGetKvEngine(pDb);
+	unqlite_kv_methods *pMethods = pEngine->pIo->pMethods;
+	unqlite_kv_cursor *pCur;
+	int rc;
+	if( pMethods->xDelete == 0 ){
+		unqliteGenError(pDb,"xDelete() method not implemented in the underlying storage engine");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	rc = unqliteBorrowCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	/* Seek to the record position */
+	rc = pMethods->xSeek(pCur,pKey,(int)nKey,UNQLITE_CURSOR_MATCH_EXACT);
+	if( rc == UNQLITE_OK ){
+		rc = pMethods->xDelete(pCur);
+	}
+	unqliteReturnCursor(pDb,pCur);
+	return rc;
+}
+/*
+ * Remove the metadata record of a given record.
+ */
+static int TtlDeleteMeta(unqlite *pDb,const void *pKey,sxu32 nKey)
+{
+	SyBlob sMeta;
+	int rc;
+	SyBlobInit(&sMeta,&pDb->sMem);
+	rc = TtlMetaKey(&sMeta,pKey,nKey);
+	if( rc == UNQLITE_OK ){
+		rc = TtlEngineDelete(pDb,SyBlobData(&sMeta),SyBlobLength(&sMeta));
+		if( rc == UNQLITE_NOTFOUND ){
+			rc = UNQLITE_OK;
+		}
+	}
+	SyBlobRelease(&sMeta);
+	return rc;
+}
+/*
+ * Persist the expiration time of a given record.
+ */
+static int TtlWriteMeta(unqlite *pDb,const void *pKey,sxu32 nKey,sxi64 iExpire)
+{
+	unqlite_kv_engine *pEngine = unqlitePagerGetKvEngine(pDb);
+	unsigned char zExpire[8];
+	SyBlob sMeta;
+	int rc;
+	SyBigEndianPack64(zExpire,(sxu64)iExpire);
+	SyBlobInit(&sMeta,&pDb->sMem);
+	rc = TtlMetaKey(&sMeta,pKey,nKey);
+	if( rc == UNQLITE_OK ){
+		rc = pEngine->pIo->pMethods->xReplace(pEngine,SyBlobData(&sMeta),(int)SyBlobLength(&sMeta),zExpire,sizeof(zExpire));
+	}
+	SyBlobRelease(&sMeta);
+	return rc;
+}
+/*
+ * Min-heap primitives.
+ */
+static void TtlHeapSet(ttl_entry **apHeap,sxu32 iSlot,ttl_entry *pEntry)
+{
+	apHeap[iSlot] = pEntry;
+	pEntry->iSlot = iSlot;
+}
+static void TtlHeapUp(unqlite_ttl *pTtl,sxu32 iSlot)
+{
+	ttl_entry **apHeap = (ttl_entry **)SySetBasePtr(&pTtl->aHeap);
+	ttl_entry *pEntry = apHeap[iSlot];
+	while( iSlot > 0 ){
+		sxu32 iParent = (iSlot - 1) >> 1;
+		if( apHeap[iParent]->iExpire <= pEntry->iExpire ){
+			break;
+		}
+		TtlHeapSet(apHeap,iSlot,apHeap[iParent]);
+		iSlot = iParent;
+	}
+	TtlHeapSet(apHeap,iSlot,pEntry);
+}
+static void TtlHeapDown(unqlite_ttl *pTtl,sxu32 iSlot)
+{
+	ttl_entry **apHeap = (ttl_entry **)SySetBasePtr(&pTtl->aHeap);
+	sxu32 nUsed = SySetUsed(&pTtl->aHeap);
+	ttl_entry *pEntry = apHeap[iSlot];
+	for(;;){
+		sxu32 iChild = (iSlot << 1) + 1;
+		if( iChild >= nUsed ){
+			break;
+		}
+		if( iChild + 1 < nUsed && apHeap[iChild + 1]->iExpire < apHeap[iChild]->iExpire ){
+			iChild++;
+		}
+		if( pEntry->iExpire <= apHeap[iChild]->iExpire ){
+			break;
+		}
+		TtlHeapSet(apHeap,iSlot,apHeap[iChild]);
+		iSlot = iChild;
+	}
+	TtlHeapSet(apHeap,iSlot,pEntry);
+}
+/*
+ * Lookup the expiration entry of a given record.
+ */
+static ttl_entry * TtlIndexFind(unqlite_ttl *pTtl,const void *pKey,sxu32 nKey)
+{
+	SyHashEntry *pHashEntry;
+	pHashEntry = SyHashGet(&pTtl->sKeys,pKey,nKey);
+	return pHashEntry ? (ttl_entry *)SyHashEntryGetUserData(pHashEntry) : 0;
+}
+/*
+ * Index or re-index the expiration time of a given record.
+ */
+static int TtlIndexPut(unqlite *pDb,const void *pKey,sxu32 nKey,sxi64 iExpire)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	ttl_entry *pEntry;
+	pEntry = TtlIndexFind(pTtl,pKey,nKey);
+	if( pEntry ){
+		sxi64 iOld = pEntry->iExpire;
+		pEntry->iExpire = iExpire;
+		if( iExpire < iOld ){
+			TtlHeapUp(pTtl,pEntry->iSlot);
+		}else{
+			TtlHeapDown(pTtl,pEntry->iSlot);
+		}
+		return UNQLITE_OK;
+	}
+	pEntry = (ttl_entry *)SyMemBackendAlloc(&pDb->sMem,sizeof(ttl_entry)+nKey);
+	if( pEntry == 0 ){
+		return UNQLITE_NOMEM;
+	}
+	pEntry->iExpire = iExpire;
+	pEntry->nKey = nKey;
+	SyMemcpy(pKey,(void *)&pEntry[1],nKey);
+	if( SySetPut(&pTtl->aHeap,(const void *)&pEntry) != SXRET_OK ){
+		SyMemBackendFree(&pDb->sMem,pEntry);
+		return UNQLITE_NOMEM;
+	}
+	if( SyHashInsert(&pTtl->sKeys,TTL_ENTRY_KEY(pEntry),nKey,pEntry) != SXRET_OK ){
+		SySetPop(&pTtl->aHeap);
+		SyMemBackendFree(&pDb->sMem,pEntry);
+		return UNQLITE_NOMEM;
+	}
+	TtlHeapUp(pTtl,SySetUsed(&pTtl->aHeap) - 1);
+	return UNQLITE_OK;
+}
+/*
+ * Drop an entry from the expiration index.
+ */
+static void TtlIndexRemove(unqlite *pDb,ttl_entry *pEntry)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	ttl_entry **apHeap = (ttl_entry **)SySetBasePtr(&pTtl->aHeap);
+	ttl_entry *pLast;
+	sxu32 iSlot = pEntry->iSlot;
+	pLast = apHeap[SySetUsed(&pTtl->aHeap) - 1];
+	SySetPop(&pTtl->aHeap);
+	if( pLast != pEntry ){
+		/* Move the last entry to the vacant slot and restore the heap order */
+		TtlHeapSet(apHeap,iSlot,pLast);
+		if( iSlot > 0 && apHeap[(iSlot - 1) >> 1]->iExpire > pLast->iExpire ){
+			TtlHeapUp(pTtl,iSlot);
+		}else{
+			TtlHeapDown(pTtl,iSlot);
+		}
+	}
+	SyHashDeleteEntry(&pTtl->sKeys,TTL_ENTRY_KEY(pEntry),pEntry->nKey,0);
+	SyMemBackendFree(&pDb->sMem,pEntry);
+}
+/*
+ * Prepare an empty in-memory index.
+ */
+static int TtlIndexInit(unqlite *pDb)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	if( SyHashInit(&pTtl->sKeys,&pDb->sMem,0,0) != SXRET_OK ){
+		return UNQLITE_NOMEM;
+	}
+	SySetInit(&pTtl->aHeap,&pDb->sMem,sizeof(ttl_entry *));
+	pTtl->iState = TTL_STATE_LOADED;
+	return UNQLITE_OK;
+}
+/*
+ * Release the in-memory index. It is rebuilt from the persisted metadata on next use.
+ */
+UNQLITE_PRIVATE void unqliteKvTtlReset(unqlite *pDb)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	if( pTtl->iState == TTL_STATE_LOADED ){
+		ttl_entry **apHeap = (ttl_entry **)SySetBasePtr(&pTtl->aHeap);
+		sxu32 n;
+		for( n = 0 ; n < SySetUsed(&pTtl->aHeap) ; ++n ){
+			SyMemBackendFree(&pDb->sMem,apHeap[n]);
+		}
+		SyHashRelease(&pTtl->sKeys);
+		SySetRelease(&pTtl->aHeap);
+	}
+	pTtl->iState = TTL_STATE_UNKNOWN;
+}
+/*
+ * Load the expiration index from the metadata records on first use.
+ * This is skipped when the marker record is missing. Ordered engines visit
+ * the metadata records only since they follow the marker in key order,
+ * other engines make a single pass over the database.
+ */
+static int TtlLoad(unqlite *pDb)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_cursor *pCur;
+	int bOrdered;
+	SyBlob sKey;
+	int rc;
+	if( pTtl->iState != TTL_STATE_UNKNOWN ){
+		return UNQLITE_OK;
+	}
+	pMethods = unqlitePagerGetKvEngine(pDb)->pIo->pMethods;
+	rc = unqliteBorrowCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pMethods->xSeek(pCur,aTtlPrefix,TTL_PREFIX_SZ,UNQLITE_CURSOR_MATCH_EXACT);
+	if( rc == UNQLITE_NOTFOUND ){
+		/* No expiring records */
+		unqliteReturnCursor(pDb,pCur);
+		pTtl->iState = TTL_STATE_EMPTY;
+		return UNQLITE_OK;
+	}
+	if( rc == UNQLITE_OK ){
+		rc = TtlIndexInit(pDb);
+	}
+	if( rc != UNQLITE_OK ){
+		unqliteReturnCursor(pDb,pCur);
+		return rc;
+	}
+	SyBlobInit(&sKey,&pDb->sMem);
+	bOrdered = pMethods->iVersion > 3 && (pMethods->iFlags & UNQLITE_KV_ORDERED);
+	if( !bOrdered ){
+		pMethods->xFirst(pCur);
+	}
+	while( pMethods->xValid(pCur) ){
+		SyBlobReset(&sKey);
+		rc = pMethods->xKey(pCur,unqliteDataConsumer,&sKey);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		if( bOrdered && !unqliteKvTtlReserved(SyBlobData(&sKey),SyBlobLength(&sKey)) ){
+			/* Past the metadata records */
+			break;
+		}
+		if( SyBlobLength(&sKey) > TTL_PREFIX_SZ && SyMemcmp(SyBlobData(&sKey),aTtlPrefix,TTL_PREFIX_SZ) == 0 ){
+			unsigned char zExpire[8];
+			SyBlob sData;
+			sxu64 iExpire;
+			SyBlobInitFromBuf(&sData,zExpire,sizeof(zExpire));
+			rc = pMethods->xData(pCur,unqliteDataConsumer,&sData);
+			if( rc != UNQLITE_OK ){
+				break;
+			}
+			if( SyBlobLength(&sData) == sizeof(zExpire) ){
+				SyBigEndianUnpack64(zExpire,&iExpire);
+				rc = TtlIndexPut(pDb,SyBlobDataAt(&sKey,TTL_PREFIX_SZ),SyBlobLength(&sKey) - TTL_PREFIX_SZ,(sxi64)iExpire);
+				if( rc != UNQLITE_OK ){
+					break;
+				}
+			}
+		}
+		rc = pMethods->xNext(pCur);
+		if( rc != UNQLITE_OK ){
+			if( rc == UNQLITE_DONE ){
+				rc = UNQLITE_OK;
+			}
+			break;
+		}
+	}
+	SyBlobRelease(&sKey);
+	unqliteReturnCursor(pDb,pCur);
+	if( rc != UNQLITE_OK ){
+		unqliteKvTtlReset(pDb);
+	}
+	return rc;
+}
+/*
+ * Remove an expired record together with its metadata.
+ */
+static int TtlExpire(unqlite *pDb,ttl_entry *pEntry)
+{
+	int rc;
+	rc = TtlEngineDelete(pDb,TTL_ENTRY_KEY(pEntry),pEntry->nKey);
+	if( rc == UNQLITE_OK || rc == UNQLITE_NOTFOUND ){
+		rc = TtlDeleteMeta(pDb,TTL_ENTRY_KEY(pEntry),pEntry->nKey);
+	}
+	if( rc == UNQLITE_OK ){
+		TtlIndexRemove(pDb,pEntry);
+	}
+	return rc;
+}
+/*
+ * Remove at most nMax records (All due records if nMax < 1) whose expiration time is reached.
+ */
+static int TtlReap(unqlite *pDb,sxi64 iNow,int nMax,int *pnExpired)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	int n = 0;
+	int rc = UNQLITE_OK;
+	while( (nMax < 1 || n < nMax) && SySetUsed(&pTtl->aHeap) > 0 ){
+		ttl_entry *pTop = ((ttl_entry **)SySetBasePtr(&pTtl->aHeap))[0];
+		if( pTop->iExpire > iNow ){
+			break;
+		}
+		rc = TtlExpire(pDb,pTop);
+		if( rc != UNQLITE_OK ){
+			break;
+		}
+		n++;
+	}
+	if( pnExpired ){
+		*pnExpired = n;
+	}
+	return rc;
+}
+/*
+ * Return TRUE if the database holds no expiring records so that shared readers
+ * may skip the expiration checks. The state is only updated with the handle held
+ * exclusively, so the caller must hold it at least shared.
+ */
+UNQLITE_PRIVATE int unqliteKvTtlIdle(unqlite *pDb)
+{
+	return pDb->sDB.sTtl.iState == TTL_STATE_EMPTY;
+}
+/*
+ * Return TRUE if the given key is reserved for expiration metadata.
+ */
+UNQLITE_PRIVATE int unqliteKvTtlReserved(const void *pKey,sxu32 nKey)
+{
+	return nKey >= TTL_PREFIX_SZ && SyMemcmp(pKey,aTtlPrefix,TTL_PREFIX_SZ) == 0;
+}
+/*
+ * Leading bytes of a key collected by TtlPrefixConsumer().
+ */
+typedef struct ttl_key_prefix ttl_key_prefix;
+struct ttl_key_prefix
+{
+	unsigned char zPrefix[TTL_PREFIX_SZ];
+	sxu32 nPrefix;
+};
+static int TtlPrefixConsumer(const void *pData,unsigned int nData,void *pUserData)
+{
+	ttl_key_prefix *pOut = (ttl_key_prefix *)pUserData;
+	sxu32 nCopy = TTL_PREFIX_SZ - pOut->nPrefix;
+	if( nCopy > nData ){
+		nCopy = nData;
+	}
+	SyMemcpy(pData,&pOut->zPrefix[pOut->nPrefix],nCopy);
+	pOut->nPrefix += nCopy;
+	return UNQLITE_OK;
+}
+/*
+ * Move the given cursor forward (or backward if bForward is false) past the
+ * metadata records so that they stay hidden from the user keyspace.
+ * Nothing is read when the database is known to hold no such record.
+ */
+UNQLITE_PRIVATE int unqliteKvTtlSkip(unqlite *pDb,unqlite_kv_cursor *pCur,int bForward)
+{
+	unqlite_kv_methods *pMethods = pCur->pStore->pIo->pMethods;
+	ttl_key_prefix sPrefix;
+	int rc;
+	if( pDb->sDB.sTtl.iState == TTL_STATE_EMPTY || pMethods->xValid == 0 || pMethods->xKey == 0 ){
+		return UNQLITE_OK;
+	}
+	while( pMethods->xValid(pCur) ){
+		sPrefix.nPrefix = 0;
+		rc = pMethods->xKey(pCur,TtlPrefixConsumer,&sPrefix);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		if( !unqliteKvTtlReserved(sPrefix.zPrefix,sPrefix.nPrefix) ){
+			break;
+		}
+		if( (bForward ? pMethods->xNext : pMethods->xPrev) == 0 ){
+			return UNQLITE_NOTIMPLEMENTED;
+		}
+		rc = bForward ? pMethods->xNext(pCur) : pMethods->xPrev(pCur);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Drop the expiration time of the indexed records which no longer exist.
+ * Called after a bulk delete which bypassed unqliteKvTtlClear().
+ */
+UNQLITE_PRIVATE int unqliteKvTtlPrune(unqlite *pDb)
+{
+	unqlite_kv_engine *pEngine = unqlitePagerGetKvEngine(pDb);
+	unqlite_kv_methods *pMethods = pEngine->pIo->pMethods;
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	unqlite_kv_cursor *pCur;
+	ttl_entry **apHeap,**apGone;
+	SySet aGone;
+	sxu32 n;
+	int rc;
+	rc = TtlLoad(pDb);
+	if( rc != UNQLITE_OK || pTtl->iState != TTL_STATE_LOADED ){
+		return rc;
+	}
+	rc = unqliteBorrowCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	SySetInit(&aGone,&pDb->sMem,sizeof(ttl_entry *));
+	/* Collect the entries of the removed records first since dropping reorder the heap */
+	apHeap = (ttl_entry **)SySetBasePtr(&pTtl->aHeap);
+	for( n = 0 ; n < SySetUsed(&pTtl->aHeap) ; ++n ){
+		rc = pMethods->xSeek(pCur,TTL_ENTRY_KEY(apHeap[n]),(int)apHeap[n]->nKey,UNQLITE_CURSOR_MATCH_EXACT);
+		if( rc == UNQLITE_NOTFOUND ){
+			if( SySetPut(&aGone,(const void *)&apHeap[n]) != SXRET_OK ){
+				rc = UNQLITE_NOMEM;
+				break;
+			}
+		}else if( rc != UNQLITE_OK ){
+			break;
+		}
+		rc = UNQLITE_OK;
+	}
+	unqliteReturnCursor(pDb,pCur);
+	apGone = (ttl_entry **)SySetBasePtr(&aGone);
+	for( n = 0 ; n < SySetUsed(&aGone) && rc == UNQLITE_OK ; ++n ){
+		rc = TtlDeleteMeta(pDb,TTL_ENTRY_KEY(apGone[n]),apGone[n]->nKey);
+		if( rc == UNQLITE_OK ){
+			TtlIndexRemove(pDb,apGone[n]);
+		}
+	}
+	SySetRelease(&aGone);
+	return rc;
+}
+/*
+ * Lazy expiration. Remove the given record if its expiration time is reached and
+ * return UNQLITE_NOTFOUND in which case the caller must treat the record as missing.
+ */
+UNQLITE_PRIVATE int unqliteKvTtlCheck(unqlite *pDb,unqlite_vfs *pVfs,const void *pKey,sxu32 nKey)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	ttl_entry *pEntry;
+	int rc;
+	rc = TtlLoad(pDb);
+	if( rc != UNQLITE_OK || pTtl->iState != TTL_STATE_LOADED ){
+		return rc;
+	}
+	pEntry = TtlIndexFind(pTtl,pKey,nKey);
+	if( pEntry == 0 || pVfs->xCurrentTime == 0 || pEntry->iExpire > TtlNow(pVfs) ){
+		return UNQLITE_OK;
+	}
+	/* Expired record. The removal fails on read-only databases but the record is reported missing anyway */
+	TtlExpire(pDb,pEntry);
+	return UNQLITE_NOTFOUND;
+}
+/*
+ * Forget the expiration time of a record that is about to be overwritten or was deleted.
+ */
+UNQLITE_PRIVATE int unqliteKvTtlClear(unqlite *pDb,const void *pKey,sxu32 nKey)
+{
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	ttl_entry *pEntry;
+	int rc;
+	rc = TtlLoad(pDb);
+	if( rc != UNQLITE_OK || pTtl->iState != TTL_STATE_LOADED ){
+		return rc;
+	}
+	pEntry = TtlIndexFind(pTtl,pKey,nKey);
+	if( pEntry == 0 ){
+		return UNQLITE_OK;
+	}
+	rc = TtlDeleteMeta(pDb,pKey,nKey);
+	if( rc == UNQLITE_OK ){
+		TtlIndexRemove(pDb,pEntry);
+	}
+	return rc;
+}
+/*
+ * Store a record that expires iTtl seconds from now (Never if iTtl < 1).
+ */
+UNQLITE_PRIVATE int unqliteKvTtlStore(
+	unqlite *pDb,unqlite_vfs *pVfs,
+	const void *pKey,sxu32 nKey,
+	const void *pData,unqlite_int64 nData,
+	unqlite_int64 iTtl
+	)
+{
+	unqlite_kv_engine *pEngine = unqlitePagerGetKvEngine(pDb);
+	unqlite_ttl *pTtl = &pDb->sDB.sTtl;
+	sxi64 iNow;
+	int rc;
+	if( pEngine->pIo->pMethods->xReplace == 0 ){
+		unqliteGenError(pDb,"xReplace() method not implemented in the underlying storage engine");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	if( iTtl < 1 ){
+		/* Persistent record */
+		rc = unqliteKvTtlClear(pDb,pKey,nKey);
+		if( rc == UNQLITE_OK ){
+			rc = pEngine->pIo->pMethods->xReplace(pEngine,pKey,(int)nKey,pData,nData);
+		}
+		return rc;
+	}
+	if( pVfs->xCurrentTime == 0 ){
+		unqliteGenError(pDb,"xCurrentTime() method not implemented in the underlying VFS");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	if( unqlitePagerGetConcurrentKvEngine(pDb) ){
+		/* Lookups bypass the handle mutex and thus the expiration checks */
+		unqliteGenError(pDb,"Expiring records are not supported by concurrent storage engines");
+		return UNQLITE_NOTIMPLEMENTED;
+	}
+	rc = TtlLoad(pDb);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	if( pTtl->iState == TTL_STATE_EMPTY ){
+		/* First expiring record, write the marker */
+		rc = pEngine->pIo->pMethods->xReplace(pEngine,aTtlPrefix,TTL_PREFIX_SZ,0,0);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+		rc = TtlIndexInit(pDb);
+		if( rc != UNQLITE_OK ){
+			return rc;
+		}
+	}
+	iNow = TtlNow(pVfs);
+	rc = pEngine->pIo->pMethods->xReplace(pEngine,pKey,(int)nKey,pData,nData);
+	if( rc == UNQLITE_OK ){
+		rc = TtlWriteMeta(pDb,pKey,nKey,iNow + iTtl);
+	}
+	if( rc == UNQLITE_OK ){
+		rc = TtlIndexPut(pDb,pKey,nKey,iNow + iTtl);
+	}
+	if( rc == UNQLITE_OK ){
+		/* Piggyback a bounded amount of reaping work */
+		rc = TtlReap(pDb,iNow,UNQLITE_TTL_REAP_STEP,0);
+	}
+	return rc;
+}
+/*
+ * Extract the remaining lifetime of a record in seconds (-1 for persistent records).
+ */
+UNQLITE_PRIVATE int unqliteKvTtlGet(unqlite *pDb,unqlite_vfs *pVfs,const void *pKey,sxu32 nKey,unqlite_int64 *pTtl)
+{
+	unqlite_kv_methods *pMethods;
+	unqlite_kv_cursor *pCur;
+	ttl_entry *pEntry;
+	int rc;
+	rc = unqliteKvTtlCheck(pDb,pVfs,pKey,nKey);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	pMethods = unqlitePagerGetKvEngine(pDb)->pIo->pMethods;
+	rc = unqliteBorrowCursor(pDb,&pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	rc = pMethods->xSeek(pCur,pKey,(int)nKey,UNQLITE_CURSOR_MATCH_EXACT);
+	unqliteReturnCursor(pDb,pCur);
+	if( rc != UNQLITE_OK ){
+		return rc;
+	}
+	*pTtl = -1;
+	if( pDb->sDB.sTtl.iState == TTL_STATE_LOADED ){
+		pEntry = TtlIndexFind(&pDb->sDB.sTtl,pKey,nKey);
+		if( pEntry ){
+			sxi64 iLeft = pEntry->iExpire - TtlNow(pVfs);
+			*pTtl = iLeft > 0 ? iLeft : 0;
+		}
+	}
+	return UNQLITE_OK;
+}
+/*
+ * Incremental reaper. Remove at most nMax expired records per call.
+ */
+UNQLITE_PRIVATE int unqliteKvTtlReap(unqlite *pDb,unqlite_vfs *pVfs,int nMax,int *pnExpired)
+{
+	int rc;
+	if( pnExpired ){
+		*pnExpired = 0;
+	}
+	rc = TtlLoad(pDb);
+	if( rc != UNQLITE_OK || pDb->sDB.sTtl.iState != TTL_STATE_LOADED || pVfs->xCurrentTime == 0 ){
+		return rc;
+	}
+	return TtlReap(pDb,TtlNow(pVfs),nMax,pnExpired);
+}
@@ -100,6 +100,9 @@ typedef struct jx9_value unqlite_value;
 typedef struct unqlite_vfs unqlite_vfs;
 typedef struct unqlite_vm unqlite_vm;
 typedef struct unqlite unqlite;
+typedef struct unqlite_kv_ref unqlite_kv_ref;
+typedef struct unqlite_shard unqlite_shard;
+typedef struct unqlite_shard_cursor unqlite_shard_cursor;
 /*
  * ------------------------------
  * Compile time directives
@@ -127,6 +130,8 @@ typedef struct unqlite unqlite;
  *  unqlite_lib_config() with a configuration verb set to UNQLITE_LIB_CONFIG_USER_MUTEX.
  *  Otherwise the library is not threadsafe.
  *  Note that you must link UnQLite with the POSIX threads library under UNIX systems (i.e: -lpthread).
+ *  Under UNIX and Windows Vista or later, threads reading the same in-memory database handle
+ *  share it instead of taking turns (Refer to UNQLITE_KV_SHARED_READ).
  *
  * Options To Omit/Enable Features
  *
@@ -157,6 +162,24 @@ typedef struct unqlite unqlite;
  * UNQLITE_ENABLE_JX9_HASH_IO
  * If this directive is enabled, built-in hash functions such as md5(), sha1(), md5_file(), crc32(), etc.
  * are included in the build.
+ *
+ * UNQLITE_KV_SHARD_COUNT
+ *  Number of partitions (A power of two, 16 by default) of the sharded in-memory storage engine
+ *  named "shard".
+ *
+ * UNQLITE_KV_SST_BLOCK_SIZE
+ *  Uncompressed block size (4096 bytes by default) of the sorted tables produced by the
+ *  read-only storage engine named "sst". Larger blocks compress better at the cost of
+ *  longer scans on point lookups.
+ *
+ * UNQLITE_TTL_REAP_STEP
+ *  Maximum number of expired records (4 by default) removed by each call to
+ *  unqlite_kv_store_ttl() in addition to the explicit unqlite_kv_expire() calls.
+ *
+ * UNQLITE_DISABLE_POOL_CACHE
+ *  When compiled with UNQLITE_ENABLE_THREADS, small allocations made by a thread are served
+ *  from per-thread caches without taking the allocator mutex. If this directive is enabled,
+ *  every allocation goes through the mutex protected shared pool instead.
  */
 /* Symisc public definitions */
 #if !defined(SYMISC_STANDARD_DEFS)
@@ -392,6 +415,151 @@ typedef sxi64 unqlite_int64;
 #define UNQLITE_CONFIG_KV_ENGINE           4  /* ONE ARGUMENT: const char *zKvName */
 #define UNQLITE_CONFIG_DISABLE_AUTO_COMMIT 5  /* NO ARGUMENTS */
 #define UNQLITE_CONFIG_GET_KV_NAME         6  /* ONE ARGUMENT: const char **pzPtr */
+#define UNQLITE_CONFIG_MEM_USAGE           7  /* TWO ARGUMENTS: unqlite_int64 *pUsed, unqlite_int64 *pPeak */
+#define UNQLITE_CONFIG_MEM_LIMIT           8  /* TWO ARGUMENTS: unqlite_int64 iSoftLimit, unqlite_int64 iHardLimit */
+#define UNQLITE_CONFIG_ASYNC_WORKERS       9  /* ONE ARGUMENT: int nWorker */
+#define UNQLITE_CONFIG_ASYNC_NOTIFY       10  /* ONE ARGUMENT: int iFd */
+/*
+ * Per-handle memory accounting.
+ *
+ * Every byte allocated on behalf of a database handle (Pager cache, storage engine,
+ * cursors, Jx9 programs and their collection record caches) is charged to the handle.
+ * UNQLITE_CONFIG_MEM_USAGE reports the bytes currently allocated and the highest value
+ * reached so far (Either pointer may be NULL).
+ * UNQLITE_CONFIG_MEM_LIMIT caps that usage. Past the soft limit the pager writes its hot
+ * dirty pages out early and collections drop their cached records instead of growing
+ * their cache. Allocations that would exceed the hard limit fail and the failing
+ * interface return UNQLITE_NOMEM. Set the soft limit below the hard limit so that the
+ * caches are shrunk first. Zero or a negative value means no limit (The default).
+ * Memory is charged in allocation blocks so usage grows in steps of up to 32KB.
+ */
+/*
+ * Asynchronous interfaces.
+ *
+ * [unqlite_kv_fetch_async()] and [unqlite_commit_async()] queue the request and return
+ * immediately. The requests are served in submission order by a small pool of worker
+ * threads owned by the database handle and started on first use. Up to
+ * UNQLITE_CONFIG_ASYNC_WORKERS threads are started (Two by default, at most 32).
+ * The completion callback runs on a worker thread. The fetched data is only valid
+ * until the callback returns. The callback may call the synchronous interfaces on
+ * the same handle but must not call [unqlite_async_wait()] or [unqlite_close()].
+ * [unqlite_async_wait()] blocks until every queued request is done and [unqlite_close()]
+ * runs the remaining requests before closing the handle.
+ * On UNIX, UNQLITE_CONFIG_ASYNC_NOTIFY registers a descriptor (Typically an eventfd) to
+ * which an 8-byte counter increment is written after each completion so that an event
+ * loop can poll for it. A negative descriptor disables notification.
+ * These interfaces require a thread-safe build and a thread-safe handle (See
+ * UNQLITE_LIB_CONFIG_THREAD_LEVEL_MULTI) and return UNQLITE_NOTIMPLEMENTED otherwise.
+ */
+/*
+ * Parallel scan.
+ *
+ * [unqlite_kv_scan()] invoke the given callback once for each database record on up
+ * to nWorker threads (At most 32), so that both the walk and the work done by the
+ * callback spread over the available cores. For on-disk databases, each worker opens
+ * its own read-only handle on the database file and walks a share of the records
+ * (A key range for ordered engines, a share of the buckets for the hash engine).
+ * For in-memory databases or when the handle hold uncommitted changes, the calling
+ * thread walks the database and copies the records in batches handed to the workers.
+ * The callback is told the number of the worker (0 to nWorker-1) it runs on so that
+ * it can accumulate per-worker results without locking and merge them once
+ * unqlite_kv_scan() returns.
+ * The handle is held for the whole scan so that every worker sees the same image of
+ * the database. The callback must therefore not use the database handle.
+ * Records are not visited in any particular order across workers. A callback returning
+ * a value other than UNQLITE_OK stops the scan and unqlite_kv_scan() return UNQLITE_ABORT.
+ * With nWorker set to one or without threading support, the callback runs on the
+ * calling thread.
+ */
+/*
+ * Prefix and range iteration.
+ *
+ * [unqlite_kv_cursor_seek_prefix()] point a cursor to the first record whose key start
+ * with the given prefix and [unqlite_kv_cursor_seek_range()] to the first record whose
+ * key lies within the half-open [low,high) range (A NULL bound is unlimited). Keys are
+ * compared byte-wise, shorter keys first. Both return UNQLITE_NOTFOUND when no record
+ * match. unqlite_kv_cursor_next_entry(), unqlite_kv_cursor_prev_entry() and
+ * unqlite_kv_cursor_delete_entry() (which move to the next matching record) then stay
+ * within the bounds and unqlite_kv_cursor_valid_entry() return false once the cursor
+ * leave them. Seeking, resetting or moving the cursor to the first or last entry
+ * discard the bounds.
+ * Ordered engines (Refer to UNQLITE_KV_ORDERED) seek directly to the first matching
+ * record. Other engines walk the database once to collect and sort the matching keys.
+ * For on-disk databases, keys in excess of UNQLITE_KV_SORT_BUFFER bytes (8 MB by default)
+ * are spilled as sorted runs to a temporary file next to the database file and merged
+ * while iterating, in which case unqlite_kv_cursor_prev_entry() return
+ * UNQLITE_NOTIMPLEMENTED. Records inserted after such a seek are not visited.
+ */
+/*
+ * Bulk delete.
+ *
+ * [unqlite_kv_delete_prefix()], [unqlite_kv_delete_range()] and [unqlite_kv_delete_if()]
+ * remove in a single call every record whose key start with a prefix, lies within the
+ * half-open [low,high) range (A NULL bound is unlimited) or is selected by the given
+ * predicate (Return non-zero to remove the record). The number of removed records is
+ * stored in the last argument if not NULL. The expiration time of the removed records
+ * is dropped too.
+ * Ordered engines (Refer to UNQLITE_KV_ORDERED) only visit the matching keys for prefix
+ * and range deletes. The default hash engine make a single pass over its buckets and
+ * empty the pages of the buckets whose records are all removed at once, journaling each
+ * page a single time. Other engines collect the matching keys first.
+ * The predicate is invoked with the database handle held and must not use it. Cursors
+ * pointing to removed records must be repositioned before use.
+ */
+/*
+ * Zero-copy fetch.
+ *
+ * [unqlite_kv_fetch_ref()] store a pointer to the record data and its length in the given
+ * arguments together with a reference which must be released via [unqlite_kv_ref_release()].
+ * When the storage engine implements the xDataRef() method and the data fits in a single
+ * page, the pointer refers directly to the page in the pager cache which is held until
+ * the reference is released. Otherwise the data is copied in a private buffer owned by
+ * the reference.
+ * Pages are modified in place, so the data pointed to is only valid until the next write
+ * to the database handle: any store, append, delete or [unqlite_kv_write_range()] as well
+ * as a rollback (Or a rollback to a savepoint) may change or move it even though the
+ * reference is still held. Copy the data (i.e. via [unqlite_kv_fetch()]) if it must
+ * survive such writes. The reference itself must still be released.
+ */
+/*
+ * Savepoints.
+ *
+ * [unqlite_savepoint_begin()] open a savepoint nested inside the current ones (Starting
+ * the write transaction if not yet done) and store its nesting level (1 for the outermost)
+ * in the last argument if not NULL. [unqlite_savepoint_rollback()] undo the changes made
+ * since the savepoint at the given level was opened while [unqlite_savepoint_release()]
+ * keep them. Both close the savepoint and the savepoints nested inside it. A level less
+ * than one designate the innermost savepoint. The transaction itself remain open and is
+ * terminated as usual via [unqlite_commit()] or [unqlite_rollback()] which discard any
+ * open savepoint.
+ * The content of each page is copied in memory the first time it is modified under a
+ * savepoint so that rolling back only restore these pages without reading the journal
+ * or the database file. The memory is reclaimed when the outermost savepoint is closed.
+ * The storage engine must advertise the UNQLITE_KV_SAVEPOINT capability, savepoints are
+ * not supported for in-memory databases. Cursors must be repositioned after a rollback
+ * to a savepoint.
+ */
+/*
+ * Sharded databases.
+ *
+ * [unqlite_shard_open()] partitions a database across nShard files (At most 64) named
+ * after the given path followed by a dot and the shard number ('test.db.0', 'test.db.1',...).
+ * Each shard is an ordinary database with its own lock and journal so that writes to
+ * different shards are not serialized and their fsync() are spread over the files.
+ * The unqlite_shard_kv_*() interfaces route each record to a shard by hash of its key.
+ * The shard count is not recorded in the files, a sharded database must always be
+ * opened with the same count.
+ * [unqlite_shard_commit()] commit the shards in parallel when they are thread-safe (See
+ * [unqlite_commit_async()]), one after the other otherwise. Each shard commit
+ * independently, there is no atomic commit across shards.
+ * A collection lives entirely in the shard whose handle is returned by
+ * [unqlite_shard_handle()] for the index returned by [unqlite_shard_locate()] applied to
+ * the collection name. Jx9 scripts working on that collection are compiled on that handle.
+ * Shard cursors walk the shards one after the other. The record the cursor points to
+ * is read via the key/data interfaces of the shard cursor returned by
+ * [unqlite_shard_cursor_kv()]. [unqlite_shard_cursor_seek()] only search the shard
+ * owning the key.
+ */
 /*
  * UnQLite/Jx9 Virtual Machine Configuration Commands.
  *
@@ -437,6 +605,25 @@ typedef sxi64 unqlite_int64;
  */
 #define UNQLITE_KV_CONFIG_HASH_FUNC  1 /* ONE ARGUMENT: unsigned int (*xHash)(const void *,unsigned int) */
 #define UNQLITE_KV_CONFIG_CMP_FUNC   2 /* ONE ARGUMENT: int (*xCmp)(const void *,const void *,unsigned int) */
+#define UNQLITE_KV_CONFIG_SPLIT_LIMIT 3 /* ONE ARGUMENT: int nMaxCell */
+#define UNQLITE_KV_CONFIG_SPLIT_STATS 4 /* FOUR ARGUMENTS: unqlite_int64 *pnSplit, unqlite_int64 *pnStep, unqlite_int64 *pnMoved, int *pnMaxStep */
+#define UNQLITE_KV_CONFIG_GET_HASH_FUNC 5 /* ONE ARGUMENT: unsigned int (**pxHash)(const void *,unsigned int) */
+#define UNQLITE_KV_CONFIG_CELL_FORMAT 6 /* ONE ARGUMENT: int iFormat (UNQLITE_KV_CELL_FORMAT_*) */
+#define UNQLITE_KV_CONFIG_MEMTABLE_SIZE 7 /* ONE ARGUMENT: int nByte */
+#define UNQLITE_KV_CONFIG_RESERVE    8 /* ONE ARGUMENT: unqlite_int64 nRecord */
+#define UNQLITE_KV_CONFIG_BLOCK_COMPRESSION 9 /* ONE ARGUMENT: int bEnable */
+#define UNQLITE_KV_CONFIG_SCAN_PARTITION 10 /* TWO ARGUMENTS: int iPart, int nPart */
+/*
+ * On-disk cell format of the built-in disk KV store.
+ * The format is selected via UNQLITE_KV_CONFIG_CELL_FORMAT before any record
+ * is stored and is recorded in the database header.
+ */
+#define UNQLITE_KV_CELL_FORMAT_LEGACY  1 /* Fixed size cell header (Default) */
+#define UNQLITE_KV_CELL_FORMAT_COMPACT 2 /* Variable size cell header and per-page key prefix compression */
+/*
+ * Flags accepted by [unqlite_kv_build_table()].
+ */
+#define UNQLITE_KV_TABLE_COMPRESS 0x01 /* Compress the blocks of the sorted table */
 /*
  * Global Library Configuration Commands.
  *
@@ -723,10 +910,30 @@ struct unqlite_kv_cursor
  * UnQLite works with run-time interchangeable storage engines (i.e. Hash, B+Tree, R+Tree, LSM, etc.).
  * The storage engine works with key/value pairs where both the key
  * and the value are byte arrays of arbitrary length and with no restrictions on content.
- * UnQLite come with two built-in KV storage engine: A Virtual Linear Hash (VLH) storage
+ * UnQLite come with three built-in KV storage engine: A Virtual Linear Hash (VLH) storage
  * engine is used for persistent on-disk databases with O(1) lookup time and an in-memory
  * hash-table or Red-black tree storage engine is used for in-memory databases.
- * Future versions of UnQLite might add other built-in storage engines (i.e. LSM). 
+ * An ordered on-disk B+tree storage engine (named "btree") is also available and can be
+ * selected via [unqlite_config()] with a configuration verb set to UNQLITE_CONFIG_KV_ENGINE
+ * before the database is accessed. Unlike the hash engine, it honor the UNQLITE_CURSOR_MATCH_LE
+ * and UNQLITE_CURSOR_MATCH_GE seek positions and iterate records in key order so that range
+ * and prefix scans (seek to the prefix with UNQLITE_CURSOR_MATCH_GE and walk forward) are possible.
+ * A log-structured merge storage engine (named "lsm") is selected the same way. It buffer
+ * writes in memory and store them as immutable sorted runs written sequentially on commit
+ * (or when the memtable exceed UNQLITE_KV_CONFIG_MEMTABLE_SIZE bytes) which make it suitable
+ * for write heavy workloads. Like the B+tree engine, it iterate records in key order.
+ * For in-memory databases, an adaptive radix tree engine (named "art") keep records in key
+ * order with a far lower per-record overhead than the default hash table, it support the
+ * same LE/GE seek positions and is well suited for large caches of short keys.
+ * The sharded in-memory engine (named "shard") partition the records among several
+ * instances of the default in-memory engine, each with its own lock, so that threads sharing
+ * the same in-memory database handle do not serialize on the handle mutex (Refer to
+ * UNQLITE_KV_CONCURRENT). Records are not iterated in insertion order.
+ * Static datasets built offline are best served by the read-only sorted table engine
+ * (named "sst"). Tables are produced by [unqlite_kv_build_table()] (or by storing records
+ * in ascending key order in an empty database using this engine) and are opened like any
+ * other database. With UNQLITE_OPEN_READONLY|UNQLITE_OPEN_MMAP, lookups and scans work
+ * directly on the memory view of the file without any parsing at startup.
  * Registration of a Key/Value storage engine at run-time is done via [unqlite_lib_config()]
  * with a configuration verb set to UNQLITE_LIB_CONFIG_STORAGE_ENGINE.
  */
@@ -748,7 +955,7 @@ struct unqlite_kv_methods
   const char *zName; /* Storage engine name [i.e. Hash, B+tree, LSM, R-tree, Mem, etc.]*/
   int szKv;          /* 'unqlite_kv_engine' subclass size */
   int szCursor;      /* 'unqlite_kv_cursor' subclass size */
-  int iVersion;      /* Structure version, currently 1 */
+  int iVersion;      /* Structure version, currently 5 */
   /* Storage engine methods */
   int (*xInit)(unqlite_kv_engine *,int iPageSize);
   void (*xRelease)(unqlite_kv_engine *);
@@ -778,7 +985,83 @@ struct unqlite_kv_methods
   int (*xData)(unqlite_kv_cursor *,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
   void (*xReset)(unqlite_kv_cursor *);
   void (*xCursorRelease)(unqlite_kv_cursor *);
+  /* Methods above are in version 1. Methods below were added in version 2 */
+  int (*xDataRef)(unqlite_kv_cursor *,const void **ppData,unqlite_int64 *pLen,unqlite_page **ppPage);
+  int (*xDataRange)(unqlite_kv_cursor *,unqlite_int64 iOfft,unqlite_int64 nLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
+  int (*xWriteRange)(unqlite_kv_cursor *,unqlite_int64 iOfft,const void *pData,unqlite_int64 nLen);
+  /* Methods below were added in version 3 */
+  int (*xSync)(unqlite_kv_engine *); /* Invoked before a transaction is committed */
+  /* Members below were added in version 4 */
+  int iFlags; /* Combination of UNQLITE_KV_CONCURRENT, etc. */
+  int (*xFetch)(unqlite_kv_engine *,const void *pKey,int nKeyLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
+  int (*xRemove)(unqlite_kv_engine *,const void *pKey,int nKeyLen);
+  /* Methods below were added in version 5 */
+  int (*xRemoveIf)(unqlite_kv_engine *,int (*xFilter)(const void *pKey,unsigned int nKeyLen,void *pUserData),void *pUserData,unqlite_int64 *pnRemoved);
 };
+/*
+ * Storage engine capabilities (unqlite_kv_methods.iFlags).
+ *
+ * UNQLITE_KV_CONCURRENT
+ *  The engine serialize its own operations so that the xReplace(), xAppend(), xFetch()
+ *  and xRemove() methods (which are then mandatory) as well as the cursor methods can
+ *  be invoked from different threads at the same time. For in-memory databases, the
+ *  unqlite_kv_store(), unqlite_kv_append(), unqlite_kv_fetch(), unqlite_kv_fetch_callback()
+ *  and unqlite_kv_delete() interfaces call such engine without holding the database handle
+ *  mutex. Expiring records are not supported by such engines (See below).
+ *  Data consumer callbacks are invoked with the engine internal lock held.
+ */
+#define UNQLITE_KV_CONCURRENT 0x01
+/*
+ * UNQLITE_KV_SHARED_READ
+ *  The xFetch() method (which is then mandatory) does not modify the engine so that
+ *  it can be invoked from different threads at the same time as long as no other method
+ *  is running. For in-memory databases, the unqlite_kv_fetch() and unqlite_kv_fetch_batch()
+ *  interfaces then hold the database handle shared with other readers instead of
+ *  exclusively, as long as the database holds no expiring records. All the other
+ *  interfaces still hold the handle exclusively. Cursors are not affected.
+ *  The default in-memory engine (named "mem") advertise this capability.
+ */
+#define UNQLITE_KV_SHARED_READ 0x02
+/*
+ * UNQLITE_KV_ORDERED
+ *  The cursor iterate the records in key order (Byte-wise comparison, shorter keys
+ *  first) and the xSeek() method honor the UNQLITE_CURSOR_MATCH_GE seek position.
+ *  [unqlite_kv_cursor_seek_prefix()] and [unqlite_kv_cursor_seek_range()] then
+ *  position the cursor via a single seek instead of sorting the matching keys.
+ *  The btree, lsm, art and sst engines advertise this capability. It assume the
+ *  default key comparison, a comparison function installed via the
+ *  UNQLITE_KV_CONFIG_CMP_FUNC configuration verb must preserve this order.
+ */
+#define UNQLITE_KV_ORDERED 0x04
+/*
+ * UNQLITE_KV_SAVEPOINT
+ *  The whole engine state can be reloaded from the database pages once the xSync()
+ *  method (if any) returned, and the xRelease(), xInit() and xOpen() methods do so.
+ *  [unqlite_savepoint_rollback()] then restore the pages modified under the savepoint
+ *  and reload the engine instead of rolling back the whole transaction.
+ *  The hash, btree and lsm engines advertise this capability.
+ */
+#define UNQLITE_KV_SAVEPOINT 0x08
+/*
+ * Record expiration.
+ *
+ * Records stored via unqlite_kv_store_ttl() expire after the given number of seconds.
+ * The expiration time of each record is persisted in a metadata record whose key is the
+ * reserved prefix "\0TTL" (4 bytes) followed by the record key. Such keys are not part of
+ * the user keyspace: the store, append and delete interfaces reject them with UNQLITE_PERM,
+ * cursors and unqlite_kv_scan() step over them.
+ * Expired records are removed lazily when they are looked up (unqlite_kv_fetch() and friends
+ * then return UNQLITE_NOTFOUND) and incrementally by unqlite_kv_expire() which removes at most
+ * a given number of due records per call in expiration order, without scanning the database.
+ * unqlite_kv_store() and unqlite_kv_delete() clear the expiration time of a record while
+ * unqlite_kv_append() keeps it.
+ * The expiration index is held in memory and built on first use after the database
+ * is opened (or a transaction is rolled back) by a single pass over the metadata records
+ * (Over all the records for storage engines which are not UNQLITE_KV_ORDERED).
+ * Since their lookups do not hold the database handle mutex, UNQLITE_KV_CONCURRENT storage
+ * engines (i.e. "shard") do not support expiring records: unqlite_kv_store_ttl() then fail
+ * with UNQLITE_NOTIMPLEMENTED unless the record never expire (Lifetime less than one).
+ */
 /*
  * UnQLite journal file suffix.
  */
@@ -819,7 +1102,33 @@ UNQLITE_APIEXPORT int unqlite_kv_fetch(unqlite *pDb,const void *pKey,int nKeyLen
 UNQLITE_APIEXPORT int unqlite_kv_fetch_callback(unqlite *pDb,const void *pKey,
 	                    int nKeyLen,int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
 UNQLITE_APIEXPORT int unqlite_kv_delete(unqlite *pDb,const void *pKey,int nKeyLen);
+UNQLITE_APIEXPORT int unqlite_kv_delete_prefix(unqlite *pDb,const void *pPrefix,int nPrefixLen,unqlite_int64 *pnDeleted);
+UNQLITE_APIEXPORT int unqlite_kv_delete_range(unqlite *pDb,const void *pLow,int nLowLen,const void *pHigh,int nHighLen,unqlite_int64 *pnDeleted);
+UNQLITE_APIEXPORT int unqlite_kv_delete_if(unqlite *pDb,
+	int (*xFilter)(const void *pKey,unsigned int nKeyLen,void *pUserData),void *pUserData,unqlite_int64 *pnDeleted);
+UNQLITE_APIEXPORT int unqlite_kv_fetch_ref(unqlite *pDb,const void *pKey,int nKeyLen,
+						const void **ppData,unqlite_int64 *pDataLen,unqlite_kv_ref **ppRef);
+UNQLITE_APIEXPORT int unqlite_kv_ref_release(unqlite *pDb,unqlite_kv_ref *pRef);
+UNQLITE_APIEXPORT int unqlite_kv_read_range(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 iOfft,
+						void *pBuf,unqlite_int64 /* in|out */*pBufLen);
+UNQLITE_APIEXPORT int unqlite_kv_write_range(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 iOfft,
+						const void *pData,unqlite_int64 nDataLen);
+UNQLITE_APIEXPORT int unqlite_kv_fetch_batch(unqlite *pDb,int nKey,const void **apKey,const int *anKeyLen,
+						void **apBuf,unqlite_int64 /* in|out */*anBufLen,int *aRc);
+UNQLITE_APIEXPORT int unqlite_kv_store_batch(unqlite *pDb,int nKey,const void **apKey,const int *anKeyLen,
+						const void **apData,const unqlite_int64 *anDataLen,int *aRc);
+UNQLITE_APIEXPORT int unqlite_kv_store_ttl(unqlite *pDb,const void *pKey,int nKeyLen,const void *pData,unqlite_int64 nDataLen,
+						unqlite_int64 iTtl);
+UNQLITE_APIEXPORT int unqlite_kv_ttl(unqlite *pDb,const void *pKey,int nKeyLen,unqlite_int64 *pTtl);
+UNQLITE_APIEXPORT int unqlite_kv_expire(unqlite *pDb,int nMax,int *pnExpired);
 UNQLITE_APIEXPORT int unqlite_kv_config(unqlite *pDb,int iOp,...);
+UNQLITE_APIEXPORT int unqlite_kv_snapshot(unqlite *pDb,const char *zPath);
+UNQLITE_APIEXPORT int unqlite_kv_restore(unqlite *pDb,const char *zPath);
+UNQLITE_APIEXPORT int unqlite_kv_build_table(unqlite *pDb,const char *zPath,int iFlags);
+UNQLITE_APIEXPORT int unqlite_kv_scan(unqlite *pDb,int nWorker,
+	int (*xScan)(void *pUserData,int iWorker,const void *pKey,unsigned int nKeyLen,const void *pData,unqlite_int64 nDataLen),void *pUserData);
+UNQLITE_APIEXPORT int unqlite_kv_fetch_async(unqlite *pDb,const void *pKey,int nKeyLen,
+	void (*xDone)(void *pUserData,int rc,const void *pData,unqlite_int64 nDataLen),void *pUserData);
 
 /* Document (JSON) Store Interfaces powered by the Jx9 Scripting Language */
 UNQLITE_APIEXPORT int unqlite_compile(unqlite *pDb,const char *zJx9,int nByte,unqlite_vm **ppOut);
@@ -835,6 +1144,8 @@ UNQLITE_APIEXPORT unqlite_value * unqlite_vm_extract_variable(unqlite_vm *pVm,co
 UNQLITE_APIEXPORT int unqlite_kv_cursor_init(unqlite *pDb,unqlite_kv_cursor **ppOut);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_release(unqlite *pDb,unqlite_kv_cursor *pCur);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_seek(unqlite_kv_cursor *pCursor,const void *pKey,int nKeyLen,int iPos);
+UNQLITE_APIEXPORT int unqlite_kv_cursor_seek_prefix(unqlite_kv_cursor *pCursor,const void *pPrefix,int nPrefixLen);
+UNQLITE_APIEXPORT int unqlite_kv_cursor_seek_range(unqlite_kv_cursor *pCursor,const void *pLow,int nLowLen,const void *pHigh,int nHighLen);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_first_entry(unqlite_kv_cursor *pCursor);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_last_entry(unqlite_kv_cursor *pCursor);
 UNQLITE_APIEXPORT int unqlite_kv_cursor_valid_entry(unqlite_kv_cursor *pCursor);
@@ -851,6 +1162,34 @@ UNQLITE_APIEXPORT int unqlite_kv_cursor_reset(unqlite_kv_cursor *pCursor);
 UNQLITE_APIEXPORT int unqlite_begin(unqlite *pDb);
 UNQLITE_APIEXPORT int unqlite_commit(unqlite *pDb);
 UNQLITE_APIEXPORT int unqlite_rollback(unqlite *pDb);
+UNQLITE_APIEXPORT int unqlite_savepoint_begin(unqlite *pDb,int *pLevel);
+UNQLITE_APIEXPORT int unqlite_savepoint_release(unqlite *pDb,int iLevel);
+UNQLITE_APIEXPORT int unqlite_savepoint_rollback(unqlite *pDb,int iLevel);
+UNQLITE_APIEXPORT int unqlite_commit_async(unqlite *pDb,void (*xDone)(void *pUserData,int rc),void *pUserData);
+UNQLITE_APIEXPORT int unqlite_async_wait(unqlite *pDb);
+
+/* Sharded Database Interfaces */
+UNQLITE_APIEXPORT int unqlite_shard_open(unqlite_shard **ppOut,const char *zPath,int nShard,unsigned int iMode);
+UNQLITE_APIEXPORT int unqlite_shard_close(unqlite_shard *pShard);
+UNQLITE_APIEXPORT int unqlite_shard_locate(unqlite_shard *pShard,const void *pKey,int nKeyLen);
+UNQLITE_APIEXPORT unqlite * unqlite_shard_handle(unqlite_shard *pShard,int iShard);
+UNQLITE_APIEXPORT int unqlite_shard_kv_store(unqlite_shard *pShard,const void *pKey,int nKeyLen,const void *pData,unqlite_int64 nDataLen);
+UNQLITE_APIEXPORT int unqlite_shard_kv_append(unqlite_shard *pShard,const void *pKey,int nKeyLen,const void *pData,unqlite_int64 nDataLen);
+UNQLITE_APIEXPORT int unqlite_shard_kv_fetch(unqlite_shard *pShard,const void *pKey,int nKeyLen,void *pBuf,unqlite_int64 *pBufLen);
+UNQLITE_APIEXPORT int unqlite_shard_kv_fetch_callback(unqlite_shard *pShard,const void *pKey,int nKeyLen,
+	int (*xConsumer)(const void *,unsigned int,void *),void *pUserData);
+UNQLITE_APIEXPORT int unqlite_shard_kv_delete(unqlite_shard *pShard,const void *pKey,int nKeyLen);
+UNQLITE_APIEXPORT int unqlite_shard_commit(unqlite_shard *pShard);
+UNQLITE_APIEXPORT int unqlite_shard_rollback(unqlite_shard *pShard);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_init(unqlite_shard *pShard,unqlite_shard_cursor **ppOut);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_release(unqlite_shard_cursor *pCursor);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_first_entry(unqlite_shard_cursor *pCursor);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_last_entry(unqlite_shard_cursor *pCursor);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_valid_entry(unqlite_shard_cursor *pCursor);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_next_entry(unqlite_shard_cursor *pCursor);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_prev_entry(unqlite_shard_cursor *pCursor);
+UNQLITE_APIEXPORT int unqlite_shard_cursor_seek(unqlite_shard_cursor *pCursor,const void *pKey,int nKeyLen,int iPos);
+UNQLITE_APIEXPORT unqlite_kv_cursor * unqlite_shard_cursor_kv(unqlite_shard_cursor *pCursor);
 
 /* Utility interfaces */
 UNQLITE_APIEXPORT int unqlite_util_load_mmaped_file(const char *zFile,void **ppMap,unqlite_int64 *pFileSize);
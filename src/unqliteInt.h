@@ -93,6 +93,44 @@ typedef struct unqlite_db unqlite_db;
  * of the "Pager" structure.
  */
 typedef struct Pager Pager;
+/*
+ * In-memory expiration index of the records stored via [unqlite_kv_store_ttl()] (See ttl.c).
+ */
+typedef struct unqlite_ttl unqlite_ttl;
+struct unqlite_ttl
+{
+	SyHash sKeys;  /* Record key to expiration entry map */
+	SySet aHeap;   /* Binary min-heap of the entries ordered by expiration time */
+	int iState;    /* Index state (See ttl.c) */
+};
+/*
+ * Maximum number of idle storage engine cursors kept by each database handle
+ * for point operations. Cursors in excess are released.
+ */
+#ifndef UNQLITE_CURSOR_POOL
+#define UNQLITE_CURSOR_POOL 4
+#endif
+/*
+ * Worker pool serving the asynchronous interfaces (See async.c).
+ */
+typedef struct unqlite_async unqlite_async;
+typedef void (*ProcAsyncFetch)(void *,int,const void *,unqlite_int64);
+typedef void (*ProcAsyncDone)(void *,int);
+/*
+ * Default and maximum number of worker threads per database handle.
+ */
+#ifndef UNQLITE_ASYNC_WORKERS
+#define UNQLITE_ASYNC_WORKERS 2
+#endif
+#define UNQLITE_ASYNC_MAX_WORKER 32
+/*
+ * Records visited by [unqlite_kv_scan()] are handed to the scan workers in
+ * batches of about this size (In bytes).
+ */
+#ifndef UNQLITE_SCAN_BATCH_SIZE
+#define UNQLITE_SCAN_BATCH_SIZE 65536
+#endif
+typedef int (*ProcKvScan)(void *,int,const void *,unsigned int,const void *,unqlite_int64);
 /*
  * Each database file to be accessed by the system is an instance
  * of the following structure.
@@ -101,19 +139,74 @@ struct unqlite_db
 {
 	Pager *pPager;              /* Pager and Transaction manager */
 	jx9 *pJx9;                  /* Jx9 Engine handle */
-	unqlite_kv_cursor *pCursor; /* Database cursor for common usage */
+	unqlite_kv_cursor *apCursor[UNQLITE_CURSOR_POOL]; /* Idle cursors (See unqliteBorrowCursor()) */
+	int nCursor;                /* Total number of idle cursors */
+	unqlite_ttl sTtl;           /* Records expiration index */
+};
+/*
+ * A reference to the data of a record returned by [unqlite_kv_fetch_ref()].
+ * The data is either read directly from a pinned page or, when it spans
+ * multiple pages, from a private copy.
+ */
+struct unqlite_kv_ref
+{
+	unqlite_page *pPage;        /* Pinned page holding the data (NULL if copied) */
+	const unqlite_kv_io *pIo;   /* IO methods used to unpin the page */
+	SyBlob sCopy;               /* Private copy of the data */
+};
+/*
+ * A key collected for sorting: Offset and length of the key in
+ * a buffer holding the collected keys (See unqliteKvSortKeys()).
+ */
+typedef struct kv_sort_key kv_sort_key;
+struct kv_sort_key
+{
+	sxu64 iOfft;  /* Key offset in the key buffer */
+	sxu32 nLen;   /* Key length */
 };
+/*
+ * Bounds of a cursor positioned via [unqlite_kv_cursor_seek_prefix()]
+ * or [unqlite_kv_cursor_seek_range()] (See range.c).
+ */
+typedef struct unqlite_kv_bound unqlite_kv_bound;
+/*
+ * Fields appended by the pager to every cursor it allocates, right after
+ * the part used by the storage engine (See unqliteInitCursor()).
+ */
+typedef struct unqlite_cursor_tail unqlite_cursor_tail;
+struct unqlite_cursor_tail
+{
+	unqlite *pDb;              /* Database handle that own the cursor */
+	unqlite_kv_bound *pBound;  /* Iteration bounds (NULL if none) */
+};
+/*
+ * Memory used to sort the keys of a bounded cursor over an unordered
+ * storage engine before sorted runs are spilled to a temporary file.
+ */
+#ifndef UNQLITE_KV_SORT_BUFFER
+#define UNQLITE_KV_SORT_BUFFER (8 << 20) /* 8 MB */
+#endif
+/*
+ * Collections holding at least this number of records are dropped in a single pass
+ * over the storage engine rather than one record lookup at a time.
+ */
+#ifndef UNQLITE_COLLECTION_BULK_DROP
+#define UNQLITE_COLLECTION_BULK_DROP 1024
+#endif
 /*
  * Each database connection is an instance of the following structure.
  */
 struct unqlite
 {
 	SyMemBackend sMem;              /* Memory allocator subsystem */
+	SyMemAccount sAccount;          /* Memory used by this handle and its limits */
 	SyBlob sErr;                    /* Error log */
 	unqlite_db sDB;                 /* Storage backend */
 #if defined(UNQLITE_ENABLE_THREADS)
 	const SyMutexMethods *pMethods;  /* Mutex methods */
 	SyMutex *pMutex;                 /* Per-handle mutex */
+	SyRWLock *pRWLock;               /* Held shared by readers, exclusively with pMutex by everything else (NULL if unsupported) */
+	unqlite_async *pAsync;           /* Worker pool of the asynchronous interfaces (See async.c) */
 #endif
 	unqlite_vm *pVms;                /* List of active VM */
 	sxi32 iVm;                       /* Total number of active VM */
@@ -191,6 +284,29 @@ struct unqlite_vm
 	unqlite_vm *pNext,*pPrev;  /* Linked list of active unQLite VM */
 	sxu32 nMagic;              /* Magic number to avoid misuse */
 };
+/*
+ * A database horizontally partitioned across several files (See shard_db.c).
+ */
+struct unqlite_shard
+{
+	unqlite **apDb;            /* Database handle of each shard */
+	int nShard;                /* Total number of shards */
+	sxu32 nMagic;              /* Sanity check against misuse */
+};
+/*
+ * Cursor walking every shard of a sharded database.
+ */
+struct unqlite_shard_cursor
+{
+	unqlite_shard *pShard;     /* Sharded database this cursor belongs to */
+	unqlite_kv_cursor *pCur;   /* Cursor of the current shard (NULL if none) */
+	int iShard;                /* Current shard */
+};
+#define UNQLITE_SHARD_MAGIC 0x5D3A7C41
+/*
+ * Maximum number of shards.
+ */
+#define UNQLITE_SHARD_MAX   64
 /* 
  * Database signature to identify a valid database image.
  */
@@ -236,6 +352,7 @@ UNQLITE_PRIVATE unqlite_kv_methods * unqliteFindKVStore(
 	);
 UNQLITE_PRIVATE int unqliteGetPageSize(void);
 UNQLITE_PRIVATE int unqliteGenError(unqlite *pDb,const char *zErr);
+UNQLITE_PRIVATE int unqliteGenErrorLocked(unqlite *pDb,const char *zErr);
 UNQLITE_PRIVATE int unqliteGenErrorFormat(unqlite *pDb,const char *zFmt,...);
 UNQLITE_PRIVATE int unqliteGenOutofMem(unqlite *pDb);
 /* unql_vm.c */
@@ -275,6 +392,70 @@ UNQLITE_PRIVATE const unqlite_vfs * unqliteExportBuiltinVfs(void);
 UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportMemKvStorage(void);
 /* lhash_kv.c */
 UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportDiskKvStorage(void);
+/* btree_kv.c */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportBtreeKvStorage(void);
+/* lsm_kv.c */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportLsmKvStorage(void);
+/* art_kv.c */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportArtKvStorage(void);
+/* shard_kv.c */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportShardKvStorage(void);
+/* sst_kv.c */
+UNQLITE_PRIVATE const unqlite_kv_methods * unqliteExportSstKvStorage(void);
+UNQLITE_PRIVATE int unqliteKvBuildTable(unqlite *pDb,unqlite_vfs *pVfs,const char *zPath,int iFlags);
+/* snapshot.c */
+typedef int (*ProcKvWalk)(unqlite_kv_cursor *,const void *,sxu32,void *);
+UNQLITE_PRIVATE int unqliteKvKeyCmp(const void *pA,sxu32 nA,const void *pB,sxu32 nB);
+UNQLITE_PRIVATE int unqliteKvSortKeys(SyMemBackend *pAlloc,const char *zBase,kv_sort_key *aKey,sxu32 nKey);
+UNQLITE_PRIVATE int unqliteKvWalkSorted(unqlite *pDb,ProcKvWalk xWalk,void *pUserData);
+UNQLITE_PRIVATE int unqliteKvSnapshot(unqlite *pDb,unqlite_vfs *pVfs,const char *zPath);
+UNQLITE_PRIVATE int unqliteKvRestore(unqlite *pDb,unqlite_vfs *pVfs,const char *zPath);
+/* async.c */
+UNQLITE_PRIVATE int unqliteAsyncConfig(unqlite *pDb,int nWorker,int iFd,int bFd);
+UNQLITE_PRIVATE int unqliteAsyncFetch(unqlite *pDb,const void *pKey,int nKeyLen,ProcAsyncFetch xDone,void *pUserData);
+UNQLITE_PRIVATE int unqliteAsyncCommit(unqlite *pDb,ProcAsyncDone xDone,void *pUserData);
+UNQLITE_PRIVATE int unqliteAsyncWait(unqlite *pDb);
+UNQLITE_PRIVATE void unqliteAsyncRelease(unqlite *pDb);
+UNQLITE_PRIVATE int unqliteKvScan(unqlite *pDb,int nWorker,ProcKvScan xScan,void *pUserData);
+/* range.c */
+UNQLITE_PRIVATE int unqliteKvBoundSeek(unqlite_kv_cursor *pCur,const void *pLow,sxu32 nLow,const void *pHigh,sxu32 nHigh,int bPrefix);
+UNQLITE_PRIVATE int unqliteKvBoundStep(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound,int bForward);
+UNQLITE_PRIVATE int unqliteKvBoundValid(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound);
+UNQLITE_PRIVATE int unqliteKvBoundDelete(unqlite_kv_cursor *pCur,unqlite_kv_bound *pBound);
+UNQLITE_PRIVATE void unqliteKvBoundRelease(unqlite_kv_cursor *pCur);
+typedef int (*ProcKvFilter)(const void *,unsigned int,void *);
+UNQLITE_PRIVATE int unqliteKvPurge(
+	unqlite *pDb,
+	const void *pLow,sxu32 nLow,
+	const void *pHigh,sxu32 nHigh,
+	int bPrefix,
+	ProcKvFilter xFilter,void *pUserData,
+	unqlite_int64 *pnRemoved
+	);
+/* shard_db.c */
+UNQLITE_PRIVATE int unqliteShardOpen(unqlite_shard **ppOut,const char *zPath,int nShard,unsigned int iMode);
+UNQLITE_PRIVATE int unqliteShardClose(unqlite_shard *pShard);
+UNQLITE_PRIVATE int unqliteShardLocate(unqlite_shard *pShard,const void *pKey,sxu32 nKeyLen);
+UNQLITE_PRIVATE int unqliteShardCommit(unqlite_shard *pShard);
+UNQLITE_PRIVATE int unqliteShardRollback(unqlite_shard *pShard);
+UNQLITE_PRIVATE int unqliteShardCursorSettle(unqlite_shard_cursor *pCursor,int iShard,int bForward);
+UNQLITE_PRIVATE void unqliteShardCursorReset(unqlite_shard_cursor *pCursor);
+/* ttl.c */
+UNQLITE_PRIVATE void unqliteKvTtlReset(unqlite *pDb);
+UNQLITE_PRIVATE int unqliteKvTtlIdle(unqlite *pDb);
+UNQLITE_PRIVATE int unqliteKvTtlCheck(unqlite *pDb,unqlite_vfs *pVfs,const void *pKey,sxu32 nKey);
+UNQLITE_PRIVATE int unqliteKvTtlClear(unqlite *pDb,const void *pKey,sxu32 nKey);
+UNQLITE_PRIVATE int unqliteKvTtlReserved(const void *pKey,sxu32 nKey);
+UNQLITE_PRIVATE int unqliteKvTtlSkip(unqlite *pDb,unqlite_kv_cursor *pCur,int bForward);
+UNQLITE_PRIVATE int unqliteKvTtlPrune(unqlite *pDb);
+UNQLITE_PRIVATE int unqliteKvTtlStore(
+	unqlite *pDb,unqlite_vfs *pVfs,
+	const void *pKey,sxu32 nKey,
+	const void *pData,unqlite_int64 nData,
+	unqlite_int64 iTtl
+	);
+UNQLITE_PRIVATE int unqliteKvTtlGet(unqlite *pDb,unqlite_vfs *pVfs,const void *pKey,sxu32 nKey,unqlite_int64 *pTtl);
+UNQLITE_PRIVATE int unqliteKvTtlReap(unqlite *pDb,unqlite_vfs *pVfs,int nMax,int *pnExpired);
 /* os.c */
 UNQLITE_PRIVATE int unqliteOsRead(unqlite_file *id, void *pBuf, unqlite_int64 amt, unqlite_int64 offset);
 UNQLITE_PRIVATE int unqliteOsWrite(unqlite_file *id, const void *pBuf, unqlite_int64 amt, unqlite_int64 offset);
@@ -299,10 +480,15 @@ UNQLITE_PRIVATE int unqliteOsAccess(unqlite_vfs *pVfs,const char *zPath,int flag
 UNQLITE_PRIVATE Bitvec *unqliteBitvecCreate(SyMemBackend *pAlloc,pgno iSize);
 UNQLITE_PRIVATE int unqliteBitvecTest(Bitvec *p,pgno i);
 UNQLITE_PRIVATE int unqliteBitvecSet(Bitvec *p,pgno i);
+UNQLITE_PRIVATE void unqliteBitvecClear(Bitvec *p,pgno i);
 UNQLITE_PRIVATE void unqliteBitvecDestroy(Bitvec *p);
 /* pager.c */
 UNQLITE_PRIVATE int unqliteInitCursor(unqlite *pDb,unqlite_kv_cursor **ppOut);
 UNQLITE_PRIVATE int unqliteReleaseCursor(unqlite *pDb,unqlite_kv_cursor *pCur);
+UNQLITE_PRIVATE int unqliteBorrowCursor(unqlite *pDb,unqlite_kv_cursor **ppOut);
+UNQLITE_PRIVATE unqlite_cursor_tail * unqliteCursorTail(unqlite_kv_cursor *pCur);
+UNQLITE_PRIVATE int unqlitePagerOpenSpill(Pager *pPager,unqlite_file **ppOut);
+UNQLITE_PRIVATE void unqliteReturnCursor(unqlite *pDb,unqlite_kv_cursor *pCur);
 UNQLITE_PRIVATE int unqlitePagerSetCachesize(Pager *pPager,int mxPage);
 UNQLITE_PRIVATE int unqlitePagerClose(Pager *pPager);
 UNQLITE_PRIVATE int unqlitePagerOpen(
@@ -312,10 +498,20 @@ UNQLITE_PRIVATE int unqlitePagerOpen(
   unsigned int iFlags      /* flags controlling this file */
   );
 UNQLITE_PRIVATE int unqlitePagerRegisterKvEngine(Pager *pPager,unqlite_kv_methods *pMethods);
+UNQLITE_PRIVATE int unqlitePagerSelectKvEngine(Pager *pPager,unqlite_kv_methods *pMethods);
 UNQLITE_PRIVATE unqlite_kv_engine * unqlitePagerGetKvEngine(unqlite *pDb);
+UNQLITE_PRIVATE unqlite_kv_engine * unqlitePagerGetConcurrentKvEngine(unqlite *pDb);
+UNQLITE_PRIVATE unqlite_kv_engine * unqlitePagerGetSharedReadKvEngine(unqlite *pDb);
+UNQLITE_PRIVATE const char * unqlitePagerGetReadSource(unqlite *pDb,unsigned int *pFlags);
+UNQLITE_PRIVATE const unsigned char * unqlitePagerGetMmap(unqlite_kv_handle pHandle,unqlite_int64 *pnByte);
+UNQLITE_PRIVATE const SyMemBackend * unqliteKvIoMemBackend(const unqlite_kv_io *pIo);
 UNQLITE_PRIVATE int unqlitePagerBegin(Pager *pPager);
 UNQLITE_PRIVATE int unqlitePagerCommit(Pager *pPager);
 UNQLITE_PRIVATE int unqlitePagerRollback(Pager *pPager,int bResetKvEngine);
+UNQLITE_PRIVATE int unqlitePagerSavepointSupported(Pager *pPager);
+UNQLITE_PRIVATE int unqlitePagerSavepoint(Pager *pPager,int *pLevel);
+UNQLITE_PRIVATE int unqlitePagerSavepointRelease(Pager *pPager,int iLevel);
+UNQLITE_PRIVATE int unqlitePagerSavepointRollback(Pager *pPager,int iLevel);
 UNQLITE_PRIVATE void unqlitePagerRandomString(Pager *pPager,char *zBuf,sxu32 nLen);
 UNQLITE_PRIVATE sxu32 unqlitePagerRandomNum(Pager *pPager);
 #endif /* __UNQLITEINT_H__ */
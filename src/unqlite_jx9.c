@@ -977,6 +977,8 @@ static int unqliteBuiltin_db_rollback(jx9_context *pCtx,int argc,jx9_value **arg
 	pDb = pVm->pDb;
 	/* Rollback the transaction if any */
 	rc = unqlitePagerRollback(pDb->sDB.pPager,TRUE);
+	/* Reload the expiration index from the restored metadata on next use */
+	unqliteKvTtlReset(pDb);
 	/* Rollback result */
 	jx9_result_bool(pCtx,rc == UNQLITE_OK );
 	return JX9_OK;
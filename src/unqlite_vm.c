@@ -47,6 +47,24 @@ static unqlite_col_record * CollectionCacheFetchRecord(
 	/* No such record */
 	return 0;
 }
+/*
+ * Drop the cached records of a given collection but keep its table.
+ */
+static void CollectionCachePurge(unqlite_col *pCol)
+{
+	unqlite_col_record *pNext,*pRec = pCol->pList;
+	unqlite_vm *pVm = pCol->pVm;
+	sxu32 n;
+	for( n = 0 ; n < pCol->nRec ; ++n ){
+		pNext = pRec->pNext;
+		jx9MemObjRelease(&pRec->sValue);
+		SyMemBackendPoolFree(&pVm->sAlloc,(void *)pRec);
+		pRec = pNext;
+	}
+	SyZero((void *)pCol->apRecord,pCol->nRecSize * sizeof(unqlite_col_record *));
+	pCol->nRec = 0;
+	pCol->pList = 0;
+}
 /*
  * Install a freshly created record in a given collection. 
  */
@@ -65,6 +83,10 @@ static int CollectionCacheInstallRecord(
 		jx9MemObjStore(pValue,&pRecord->sValue);
 		return UNQLITE_OK;
 	}
+	if( SyMemAccountPressure(pCol->pVm->sAlloc.pAccount) ){
+		/* Past the soft memory limit of the database handle, do not grow the cache */
+		CollectionCachePurge(pCol);
+	}
 	/* Allocate a new instance */
 	pRecord = (unqlite_col_record *)SyMemBackendPoolAlloc(&pCol->pVm->sAlloc,sizeof(unqlite_col_record));
 	if( pRecord == 0 ){
@@ -968,6 +990,30 @@ UNQLITE_PRIVATE int unqliteCollectionUpdateRecord(unqlite_col *pCol,jx9_int64 nI
     }
     return rc;
 }
+/*
+ * Select the records of the collection being dropped, that is the keys
+ * made of the collection name, an underscore and a record ID below the last
+ * assigned ID. The caller already checked the '<name>_' prefix.
+ */
+static int CollectionDropFilter(const void *pKey,unsigned int nKeyLen,void *pUserData)
+{
+	unqlite_col *pCol = (unqlite_col *)pUserData;
+	const char *zId = &((const char *)pKey)[SyStringLength(&pCol->sName) + 1];
+	const char *zEnd = &((const char *)pKey)[nKeyLen];
+	jx9_int64 nId = 0;
+	if( zId >= zEnd || (zId[0] == '0' && &zId[1] < zEnd) ){
+		/* Empty or non canonical ID */
+		return 0;
+	}
+	while( zId < zEnd ){
+		if( !SyisDigit(zId[0]) || nId >= pCol->nLastid ){
+			return 0;
+		}
+		nId = nId * 10 + (zId[0] - '0');
+		zId++;
+	}
+	return nId < pCol->nLastid;
+}
 /*
  * Drop a collection from the KV storage engine and the underlying
  * unqlite VM.
@@ -975,6 +1021,7 @@ UNQLITE_PRIVATE int unqliteCollectionUpdateRecord(unqlite_col *pCol,jx9_int64 nI
 UNQLITE_PRIVATE int unqliteDropCollection(unqlite_col *pCol)
 {
 	unqlite_vm *pVm = pCol->pVm;
+	unqlite_kv_methods *pMethods;
 	jx9_int64 nId;
 	int rc;
 	/* Reset the cursor */
@@ -996,8 +1043,18 @@ UNQLITE_PRIVATE int unqliteDropCollection(unqlite_col *pCol)
 		return rc;
 	}
 	/* Drop collection records */
-	for( nId = 0 ; nId < pCol->nLastid ; ++nId ){
-		unqliteCollectionDropRecord(pCol,nId,0,0);
+	pMethods = unqlitePagerGetKvEngine(pVm->pDb)->pIo->pMethods;
+	if( (pMethods->iVersion > 3 && (pMethods->iFlags & UNQLITE_KV_ORDERED)) ||
+		pCol->nTotRec >= UNQLITE_COLLECTION_BULK_DROP ){
+		/* Remove the records in a single pass */
+		SyBlobReset(&pCol->sWorker);
+		SyBlobFormat(&pCol->sWorker,"%z_",&pCol->sName);
+		unqliteKvPurge(pVm->pDb,SyBlobData(&pCol->sWorker),SyBlobLength(&pCol->sWorker),0,0,1,
+			CollectionDropFilter,pCol,0);
+	}else{
+		for( nId = 0 ; nId < pCol->nLastid ; ++nId ){
+			unqliteCollectionDropRecord(pCol,nId,0,0);
+		}
 	}
 	/* Cleanup */
 	CollectionCacheRelease(pCol);